@@ -40,7 +40,7 @@ void main(void)
 
     sync_state_set_stage_complete(DCPRC_INIT_STAGE_READY_TO_RUN);
     if (ctx()==0) {
-        data_coproc_workq_manager(32);
+        data_coproc_workq_manager(DCPRC_SCANNED_WORKQS);
     } else {
         data_coproc_work_gatherer();
     }
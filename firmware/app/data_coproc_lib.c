@@ -212,6 +212,10 @@ __asm {
 }
 static int check_dcprc_cls_workq_is_0x400_long[(sizeof(struct dcprc_cls_workq)==0x400)?1:-1];
 static __imem int ctm_scratch[32]; // Scratch thread-local storage
+static __imem __declspec(aligned(64)) uint32_t wptr_mirror_scratch[16]; // Workq manager DMA target
+#ifdef DCPRC_STAGE_TIMESTAMPS
+static uint32_t worker_pickup_timestamp; // Thread-local; set by dcprc_worker_get_work
+#endif
 
 __shared __cls int          cls_mu_work_wptr;
 static __shared __lmem struct dcprc_cls_workq cls_workq_cache;
@@ -248,6 +252,9 @@ dcprc_worker_get_work(const struct dcprc_worker_me *restrict dcprc_worker_me,
         mem_read64_s8(&workq_entry_in, dcprc_worker_me->mu_work_buffer_s8, mu_work_wptr*sizeof(struct dcprc_workq_entry), sizeof(workq_entry_in));
         if (workq_entry_in.work.valid_work) {
             *workq_entry = workq_entry_in;
+#ifdef DCPRC_STAGE_TIMESTAMPS
+            worker_pickup_timestamp = local_csr_read(local_csr_timestamp_low);
+#endif
             break;
         }
     }
@@ -302,9 +309,15 @@ dcprc_worker_write_results(const struct dcprc_worker_me *restrict dcprc_worker_m
     uint64_32_t pcie_addr;
     uint32_t dma_size;
 
+#ifdef DCPRC_STAGE_TIMESTAMPS
+    workq_entry_out.__raw[0] = mu_work_entry->pad;
+    workq_entry_out.__raw[1] = worker_pickup_timestamp;
+    workq_entry_out.__raw[2] = local_csr_read(local_csr_timestamp_low);
+#else
     workq_entry_out.__raw[0] = workq_entry->__raw[0];
     workq_entry_out.__raw[1] = workq_entry->__raw[1];
     workq_entry_out.__raw[2] = workq_entry->__raw[2];
+#endif
     workq_entry_out.__raw[3] = workq_entry->__raw[3] &~ (1<<31);
     mu_base.uint64 = (uint64_t)&ctm_scratch[0];
 
@@ -520,6 +533,9 @@ gatherer_dma_and_give_work(int workq_to_read,
         mu_work_entry.host_physical_address_lo = workq_desc->host_physical_address_lo + (rptr+i)*sizeof(struct dcprc_workq_entry);
         mu_work_entry.host_physical_address_hi = workq_desc->host_physical_address_hi;
         mu_work_entry.mu_ofs = mu_work_wptr+i;
+#ifdef DCPRC_STAGE_TIMESTAMPS
+        mu_work_entry.pad = local_csr_read(local_csr_timestamp_low);
+#endif
 
         mem_workq_add_work(shared_data.muq_mu_workq, &mu_work_entry, sizeof(mu_work_entry));
     }
@@ -564,9 +580,44 @@ data_coproc_work_gatherer(void)
     }
 }
 
+/*f workq_manager_read_wptr_mirror */
+/**
+ * @brief Read the host memory wptr mirror of a work queue
+ *
+ * @param workq_desc Work queue descriptor, with the
+ * DCPRC_WORKQ_WPTR_MIRROR flag cleared from max_entries
+ *
+ * @returns Work queue wptr as last written by the host
+ *
+ * The mirror is the 32-bit word just beyond the host work queue
+ * entries; it is DMAed to memory, and the DMA completes before this
+ * returns.
+ *
+ */
+static int
+workq_manager_read_wptr_mirror(struct dcprc_workq_buffer_desc *workq_desc)
+{
+    __xread uint32_t mirror[2];
+    uint64_32_t cpp_addr;
+    uint64_32_t pcie_addr;
+
+    cpp_addr.uint64 = (uint64_t)&wptr_mirror_scratch[0];
+    pcie_addr.uint32_lo = (workq_desc->host_physical_address_lo +
+                           workq_desc->max_entries*sizeof(struct dcprc_workq_entry));
+    pcie_addr.uint32_hi = workq_desc->host_physical_address_hi;
+    pcie_dma_buffer(0, pcie_addr, cpp_addr, sizeof(mirror), NFP_PCIE_DMA_FROMPCI_HI, 0, PCIE_DMA_CFG);
+    mem_read64_hl(mirror, cpp_addr.uint32_hi, cpp_addr.uint32_lo, sizeof(mirror));
+    return mirror[0];
+}
+
 /*f data_coproc_workq_manager */
 /**
  * @callgraph
+ *
+ * Work queues whose descriptors have DCPRC_WORKQ_WPTR_MIRROR set have
+ * their wptr DMAed from host memory on every scan, so the host need
+ * not write the descriptor to commit work; this costs a PCIe read
+ * per scan for each such queue.
  */
 void
 data_coproc_workq_manager(int max_queue)
@@ -579,15 +630,22 @@ data_coproc_workq_manager(int max_queue)
     for (;;) {
 
         __xread struct dcprc_workq_buffer_desc cls_buffer_desc;
+        struct dcprc_workq_buffer_desc workq_desc;
         int ofs;
 
         ofs = sizeof(struct dcprc_workq_buffer_desc)*workq_to_read;
         cls_read(&cls_buffer_desc, cls_workq_base, ofs, sizeof(cls_buffer_desc));
-        cls_workq_cache.workqs[workq_to_read] = cls_buffer_desc;
+        workq_desc = cls_buffer_desc;
+        if ((workq_desc.max_entries & DCPRC_WORKQ_WPTR_MIRROR) &&
+            !(workq_desc.wptr&(1<<31))) {
+            workq_desc.max_entries &= ~DCPRC_WORKQ_WPTR_MIRROR;
+            workq_desc.wptr = workq_manager_read_wptr_mirror(&workq_desc) & DCPRC_WORKQ_PTR_CLEAR_MASK;
+        }
+        cls_workq_cache.workqs[workq_to_read] = workq_desc;
 
-        if (cls_buffer_desc.wptr&(1<<31)) {
+        if (workq_desc.wptr&(1<<31)) {
             workq_enables &= ~workq_bit;
-        } else if (cls_buffer_desc.wptr != workq_rptr[workq_to_read]) {
+        } else if (workq_desc.wptr != workq_rptr[workq_to_read]) {
             workq_enables |= workq_bit;
         } else {
             workq_enables &= ~workq_bit;
@@ -83,7 +83,7 @@ struct dcprc_mu_work_entry {
     uint32_t host_physical_address_lo;
     uint32_t host_physical_address_hi;
     uint32_t mu_ofs;
-    uint32_t pad;
+    uint32_t pad;    /* Gather timestamp if DCPRC_STAGE_TIMESTAMPS */
 };
 
 /*a Functions */
@@ -156,6 +156,9 @@ dcprc_worker_release_dma(int to_pcie);
 /**
  * @brief Write results back to the host work queue for work done
  *
+ * If built with DCPRC_STAGE_TIMESTAMPS, the results are replaced by
+ * the stage timestamps of the work (see data_coproc.h).
+ *
  * @param dcprc_worker_me Data structure initialized when worker ME
  * started with @p dcprc_worker_init()
  *
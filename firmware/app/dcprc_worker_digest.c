@@ -0,0 +1,348 @@
+/*a Copyright */
+/**
+ Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+/*a Documentation */
+/**
+ * @file        dcprc_worker_digest.c
+ * @brief       Data coprocessor worker computing a CRC32C and XXH64
+ *
+ * The work is a contiguous region of host memory (the host physical
+ * address and size); the result is the CRC32C of the region in
+ * data_0, and the XXH64 (seed zero) in data_1 (low) and data_2
+ * (high), with the flags (operand_1) unchanged. dcprc_kernels.c has
+ * the host implementation of the same.
+ *
+ * The region is fetched by DMA in buffer-sized pieces and read from
+ * the buffer 64 bytes at a time. The CRC32C uses the ME CRC unit; its
+ * remainder is shared by the contexts of the ME, so it is loaded and
+ * saved around each 64 bytes, between which there are no context
+ * swaps. The XXH64 keeps its four accumulators in registers.
+ *
+ * The words read from the buffer hold the host's little-endian 32-bit
+ * words, as the work queue entries do; byte 0 of the data is the
+ * least significant byte of the first word.
+ *
+ * Scatter-gather lists (DCPRC_WORK_SGL) are not supported; such work
+ * is returned with a zero digest.
+ */
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <nfp/me.h>
+#include <nfp/mem.h>
+#include <nfp/cls.h>
+#include <nfp/pcie.h>
+#include <nfp/types.h>
+#include <nfp.h>
+#include <nfp_override.h>
+#include "firmware/data_coproc.h"
+#include "data_coproc_lib.h"
+
+/*a Defines
+ */
+#define XXH64_PRIME_1 0x9E3779B185EBCA87ULL
+#define XXH64_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define XXH64_PRIME_3 0x165667B19E3779F9ULL
+#define XXH64_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define XXH64_PRIME_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x,n) (((x)<<(n)) | ((x)>>(64-(n))))
+
+/*a Static data used globally */
+struct dcprc_worker_me dcprc_worker_me;
+
+#define BUFFER_SIZE (1<<13)
+static __mem unsigned char data_buffer[BUFFER_SIZE];
+
+struct dcprc_workq_entry_digest {
+    union {
+        struct {
+            uint32_t host_physical_address_lo;
+            uint32_t host_physical_address_hi;
+            uint32_t size;
+            uint32_t flags;
+        } work;
+        struct {
+            uint32_t crc32c;
+            uint32_t hash_lo;
+            uint32_t hash_hi;
+            uint32_t flags;
+        } result;
+        struct dcprc_workq_entry dcprc_workq_entry;
+    };
+};
+
+/*t struct digest_state */
+/**
+ * Digests of the data so far; stripes are 32 bytes, and all data
+ * before the end is whole stripes
+ */
+struct digest_state {
+    uint32_t crc;     /* CRC32C remainder (inverted CRC) */
+    uint64_t v1;      /* XXH64 accumulators */
+    uint64_t v2;
+    uint64_t v3;
+    uint64_t v4;
+};
+
+/*a CRC32C
+ */
+/*f crc32c_word */
+/**
+ * @brief Add a word (four bytes, least significant first) to the CRC
+ * unit remainder; CRC32C is bit-reflected
+ */
+static __intrinsic void
+crc32c_word(uint32_t w)
+{
+    __asm {
+        crc_le[crc_32c, --, w], bit_swap;
+    }
+}
+
+/*f crc32c_byte */
+/**
+ * @brief Add the least significant byte of a word to the CRC unit
+ * remainder
+ */
+static __intrinsic void
+crc32c_byte(uint32_t w)
+{
+    __asm {
+        crc_le[crc_32c, --, w], bytes_0_0, bit_swap;
+    }
+}
+
+/*a XXH64
+ */
+/*f xxh64_round */
+static __intrinsic uint64_t
+xxh64_round(uint64_t acc, uint32_t lo, uint32_t hi)
+{
+    uint64_t lane;
+    lane = (((uint64_t)hi)<<32) | lo;
+    acc += lane * XXH64_PRIME_2;
+    acc = ROTL64(acc, 31);
+    return acc * XXH64_PRIME_1;
+}
+
+/*f xxh64_merge_round */
+static __intrinsic uint64_t
+xxh64_merge_round(uint64_t acc, uint64_t v)
+{
+    acc ^= xxh64_round(0, (uint32_t)v, (uint32_t)(v>>32));
+    return acc * XXH64_PRIME_1 + XXH64_PRIME_4;
+}
+
+#define XXH64_STRIPE(s,d,o) do { \
+    (s)->v1 = xxh64_round((s)->v1, d[(o)+0], d[(o)+1]); \
+    (s)->v2 = xxh64_round((s)->v2, d[(o)+2], d[(o)+3]); \
+    (s)->v3 = xxh64_round((s)->v3, d[(o)+4], d[(o)+5]); \
+    (s)->v4 = xxh64_round((s)->v4, d[(o)+6], d[(o)+7]); \
+    } while (0)
+
+#define CRC32C_WORDS_4(d,o) do { \
+    crc32c_word(d[(o)+0]); crc32c_word(d[(o)+1]); \
+    crc32c_word(d[(o)+2]); crc32c_word(d[(o)+3]); \
+    } while (0)
+
+/*a Digest
+ */
+/*f digest_init */
+static __inline void
+digest_init(struct digest_state *state)
+{
+    state->crc = 0xffffffff;
+    state->v1  = XXH64_PRIME_1 + XXH64_PRIME_2;
+    state->v2  = XXH64_PRIME_2;
+    state->v3  = 0;
+    state->v4  = -XXH64_PRIME_1;
+}
+
+/*f digest_memory */
+/**
+ * @brief Add whole 64-byte blocks of MU memory to the digests
+ *
+ * @returns Bytes left (less than 64), which have not been added
+ */
+static __inline uint32_t
+digest_memory(struct digest_state *state, uint64_32_t cpp_addr, uint32_t size)
+{
+    __xread uint32_t data[16];
+    while (size>=sizeof(data)) {
+        mem_read64_hl(data, cpp_addr.uint32_hi, cpp_addr.uint32_lo, sizeof(data));
+        size -= sizeof(data);
+        cpp_addr.uint32_lo += sizeof(data);
+        local_csr_write(local_csr_crc_remainder, state->crc);
+        CRC32C_WORDS_4(data, 0);
+        CRC32C_WORDS_4(data, 4);
+        CRC32C_WORDS_4(data, 8);
+        CRC32C_WORDS_4(data,12);
+        XXH64_STRIPE(state, data, 0);
+        XXH64_STRIPE(state, data, 8);
+        state->crc = local_csr_read(local_csr_crc_remainder);
+    }
+    return size;
+}
+
+/*f digest_final */
+/**
+ * @brief Add the last (less than 64) bytes of the data, in MU memory,
+ * and finish the digests
+ */
+static __inline void
+digest_final(struct digest_state *state, uint64_32_t cpp_addr, uint32_t size,
+             uint32_t total, struct dcprc_workq_entry_digest *workq_entry)
+{
+    __xread uint32_t data[16];
+    uint32_t words[16];
+    uint64_t h;
+    int i, n;
+
+    mem_read64_hl(data, cpp_addr.uint32_hi, cpp_addr.uint32_lo, sizeof(data));
+    for (i=0; i<16; i++) {
+        words[i] = data[i];
+    }
+
+    local_csr_write(local_csr_crc_remainder, state->crc);
+    for (i=0; i<(size>>2); i++) {
+        crc32c_word(words[i]);
+    }
+    for (n=0; n<(size&3); n++) {
+        crc32c_byte(words[i]>>(8*n));
+    }
+    state->crc = local_csr_read(local_csr_crc_remainder);
+
+    i = 0;
+    if (size>=32) {
+        XXH64_STRIPE(state, words, 0);
+        i = 8;
+    }
+    if (total>=32) {
+        h = (ROTL64(state->v1,1) + ROTL64(state->v2,7) +
+             ROTL64(state->v3,12) + ROTL64(state->v4,18));
+        h = xxh64_merge_round(h, state->v1);
+        h = xxh64_merge_round(h, state->v2);
+        h = xxh64_merge_round(h, state->v3);
+        h = xxh64_merge_round(h, state->v4);
+    } else {
+        h = XXH64_PRIME_5;
+    }
+    h += total;
+    size -= 4*i;
+    while (size>=8) {
+        h ^= xxh64_round(0, words[i], words[i+1]);
+        h = ROTL64(h,27) * XXH64_PRIME_1 + XXH64_PRIME_4;
+        i += 2;
+        size -= 8;
+    }
+    if (size>=4) {
+        h ^= words[i] * XXH64_PRIME_1;
+        h = ROTL64(h,23) * XXH64_PRIME_2 + XXH64_PRIME_3;
+        i += 1;
+        size -= 4;
+    }
+    for (n=0; n<size; n++) {
+        h ^= ((words[i]>>(8*n)) & 0xff) * XXH64_PRIME_5;
+        h = ROTL64(h,11) * XXH64_PRIME_1;
+    }
+    h ^= h>>33;
+    h *= XXH64_PRIME_2;
+    h ^= h>>29;
+    h *= XXH64_PRIME_3;
+    h ^= h>>32;
+
+    workq_entry->result.crc32c  = ~state->crc;
+    workq_entry->result.hash_lo = (uint32_t)h;
+    workq_entry->result.hash_hi = (uint32_t)(h>>32);
+}
+
+/*f fetch_and_digest */
+/**
+ * @brief Fetch the work data in buffer-sized pieces and digest it
+ */
+static __inline void
+fetch_and_digest(struct dcprc_workq_entry_digest *workq_entry)
+{
+    struct digest_state state;
+    uint64_32_t pcie_addr;
+    uint64_32_t cpp_addr;
+    uint32_t size;
+    uint32_t total;
+    uint32_t dma_size;
+    uint32_t left;
+
+    total = workq_entry->work.size;
+    if (total & DCPRC_WORK_SGL) {
+        workq_entry->result.crc32c  = 0;
+        workq_entry->result.hash_lo = 0;
+        workq_entry->result.hash_hi = 0;
+        return;
+    }
+    pcie_addr.uint32_lo = workq_entry->work.host_physical_address_lo;
+    pcie_addr.uint32_hi = workq_entry->work.host_physical_address_hi;
+    cpp_addr.uint64 = (uint64_t) &(data_buffer[0]);
+    digest_init(&state);
+    size = total;
+    left = 0;
+    while (size>0) {
+        dma_size = size;
+        if (dma_size>BUFFER_SIZE) dma_size=BUFFER_SIZE;
+        dcprc_worker_claim_dma(0,1000);
+        pcie_dma_buffer(0, pcie_addr, cpp_addr, dma_size, NFP_PCIE_DMA_FROMPCI_HI, 0, PCIE_DMA_CFG);
+        dcprc_worker_release_dma(0);
+        /* Only the last piece may leave bytes over, as BUFFER_SIZE is a
+         * multiple of 64 */
+        left = digest_memory(&state, cpp_addr, dma_size);
+        size -= dma_size;
+        pcie_addr.uint64 += dma_size;
+    }
+    cpp_addr.uint32_lo += (total - left) & (BUFFER_SIZE-1);
+    digest_final(&state, cpp_addr, left, total, workq_entry);
+}
+
+/*f dcprc_worker_thread */
+/**
+ * @brief Main loop for the data coprocessor worker thread
+ */
+void
+dcprc_worker_thread(void)
+{
+    for (;;) {
+        __xread struct dcprc_mu_work_entry mu_work_entry;
+        struct dcprc_workq_entry_digest workq_entry;
+        dcprc_worker_get_work(&dcprc_worker_me,
+                              &mu_work_entry,
+                              &workq_entry.dcprc_workq_entry);
+
+        fetch_and_digest(&workq_entry);
+
+        dcprc_worker_write_results(&dcprc_worker_me,
+                                   &mu_work_entry,
+                                   &workq_entry.dcprc_workq_entry);
+    }
+}
+
+/*f dcprc_worker_thread_init */
+/**
+ * @brief Initialize the data coprocessor worker thread
+ */
+void
+dcprc_worker_thread_init(void)
+{
+    dcprc_worker_init(&dcprc_worker_me);
+}
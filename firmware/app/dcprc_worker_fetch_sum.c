@@ -202,6 +202,10 @@ struct dcprc_worker_me dcprc_worker_me;
 #define BUFFER_SIZE (1<<13)
 static __mem unsigned char data_buffer[BUFFER_SIZE];
 
+/* Scatter-gather list entries fetched by DMA at a time (64B) */
+#define SGL_BUFFER_ENTRIES 4
+static __mem struct dcprc_sg_entry sgl_buffer[SGL_BUFFER_ENTRIES];
+
 struct dcprc_workq_entry_fetch_sum {
     union {
         struct {
@@ -289,18 +293,16 @@ sum_memory(uint32_t sum_so_far, uint64_32_t cpp_addr, uint32_t size)
     return sum_so_far&0xff;
 }
 
-static __inline void
-fetch_and_sum(struct dcprc_workq_entry_fetch_sum *workq_entry)
+/*f fetch_and_sum_region */
+/**
+ * @brief Fetch a contiguous region of host memory in buffer-sized
+ * pieces and add it to the sum so far
+ */
+static __inline uint32_t
+fetch_and_sum_region(uint32_t sum, uint64_32_t pcie_addr, uint32_t size)
 {
     uint64_32_t cpp_addr;
-    uint64_32_t pcie_addr;
     uint32_t dma_size;
-    uint32_t size;
-    uint32_t sum;
-    size = workq_entry->size;
-    sum = 0;
-    pcie_addr.uint32_lo = workq_entry->host_physical_address_lo;
-    pcie_addr.uint32_hi = workq_entry->host_physical_address_hi;
     cpp_addr.uint64 = (uint64_t) &(data_buffer[0]);
     while (size>0) {
         dma_size = size;
@@ -310,6 +312,64 @@ fetch_and_sum(struct dcprc_workq_entry_fetch_sum *workq_entry)
         dcprc_worker_release_dma(0);
         sum = sum_memory(sum, cpp_addr, dma_size);
         size -= dma_size;
+        pcie_addr.uint64 += dma_size;
+    }
+    return sum;
+}
+
+/*f fetch_and_sum_sgl */
+/**
+ * @brief Walk a scatter-gather list in host memory, fetching its
+ * entries four at a time, and add each region to the sum so far
+ */
+static __inline uint32_t
+fetch_and_sum_sgl(uint32_t sum, uint64_32_t sgl_pcie_addr, uint32_t num_entries)
+{
+    uint64_32_t sgl_cpp_addr;
+    uint32_t num;
+    uint32_t i;
+    sgl_cpp_addr.uint64 = (uint64_t) &(sgl_buffer[0]);
+    while (num_entries>0) {
+        num = num_entries;
+        if (num>SGL_BUFFER_ENTRIES) num=SGL_BUFFER_ENTRIES;
+        dcprc_worker_claim_dma(0,1000);
+        pcie_dma_buffer(0, sgl_pcie_addr, sgl_cpp_addr,
+                        num*sizeof(struct dcprc_sg_entry),
+                        NFP_PCIE_DMA_FROMPCI_HI, 0, PCIE_DMA_CFG);
+        dcprc_worker_release_dma(0);
+        for (i=0; i<num; i++) {
+            __xread struct dcprc_sg_entry sg_entry;
+            uint64_32_t pcie_addr;
+            mem_read64(&sg_entry, &sgl_buffer[i], sizeof(sg_entry));
+            pcie_addr.uint32_lo = sg_entry.host_physical_address_lo;
+            pcie_addr.uint32_hi = sg_entry.host_physical_address_hi;
+            sum = fetch_and_sum_region(sum, pcie_addr, sg_entry.size);
+        }
+        num_entries -= num;
+        sgl_pcie_addr.uint64 += num*sizeof(struct dcprc_sg_entry);
+    }
+    return sum;
+}
+
+/*f fetch_and_sum */
+/**
+ * @brief Sum the bytes of the work data, which is either contiguous
+ * ('size' bytes) or described by a scatter-gather list
+ * (DCPRC_WORK_SGL in 'size')
+ */
+static __inline void
+fetch_and_sum(struct dcprc_workq_entry_fetch_sum *workq_entry)
+{
+    uint64_32_t pcie_addr;
+    uint32_t size;
+    uint32_t sum;
+    size = workq_entry->size;
+    pcie_addr.uint32_lo = workq_entry->host_physical_address_lo;
+    pcie_addr.uint32_hi = workq_entry->host_physical_address_hi;
+    if (size & DCPRC_WORK_SGL) {
+        sum = fetch_and_sum_sgl(0, pcie_addr, size & DCPRC_WORK_SGL_ENTRIES_MASK);
+    } else {
+        sum = fetch_and_sum_region(0, pcie_addr, size);
     }
     workq_entry->result=sum;
 }
@@ -0,0 +1,259 @@
+/*a Copyright */
+/**
+ Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **/
+/*a Documentation */
+/**
+ * @file        dcprc_worker_pattern.c
+ * @brief       Data coprocessor worker searching for a set of patterns
+ *
+ * The work is a contiguous region of host memory (the host physical
+ * address and size), and the slot of a pattern set automaton in
+ * operand_1 bits 30:24 (DCPRC_PATTERN_SLOT_SHIFT). The result is the
+ * number of occurrences of the patterns in data_0, and the lowest
+ * offset at which one starts (or DCPRC_PATTERN_NO_MATCH) in data_1,
+ * with data_2 zero and the flags (operand_1) unchanged.
+ * dcprc_pattern.c has the host implementation of the same.
+ *
+ * The automata are loaded by the host into the 'dcprc_patterns'
+ * symbol (struct dcprc_pattern_automaton, see data_coproc.h). For
+ * each work item the header and byte class map of its automaton are
+ * read into the thread; the region is then fetched by DMA in
+ * buffer-sized pieces, read from the buffer 64 bytes at a time, and
+ * each byte takes one transition read from the automaton in MU
+ * memory (as an aligned 8-byte read, the smallest mem_read64_hl).
+ *
+ * Scatter-gather lists (DCPRC_WORK_SGL) are not supported, nor are
+ * empty slots; such work is returned with no matches.
+ */
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <nfp/me.h>
+#include <nfp/mem.h>
+#include <nfp/cls.h>
+#include <nfp/pcie.h>
+#include <nfp/types.h>
+#include <nfp.h>
+#include <nfp_override.h>
+#include "firmware/data_coproc.h"
+#include "data_coproc_lib.h"
+
+/*a Static data used globally */
+struct dcprc_worker_me dcprc_worker_me;
+
+#define BUFFER_SIZE (1<<13)
+static __mem unsigned char data_buffer[BUFFER_SIZE];
+
+/* Pattern automata, loaded by the host (4 slots of 256kB) */
+__asm {
+    .alloc_mem dcprc_patterns emem global 0x100000 256;
+}
+
+struct dcprc_workq_entry_pattern {
+    union {
+        struct {
+            uint32_t host_physical_address_lo;
+            uint32_t host_physical_address_hi;
+            uint32_t size;
+            uint32_t flags;
+        } work;
+        struct {
+            uint32_t count;
+            uint32_t first;
+            uint32_t data_2;
+            uint32_t flags;
+        } result;
+        struct dcprc_workq_entry dcprc_workq_entry;
+    };
+};
+
+/*t struct pattern_state */
+/**
+ * State of a search of a work item
+ */
+struct pattern_state {
+    uint64_32_t transitions; /* MU address of the transitions */
+    uint32_t num_classes;
+    uint32_t classes[64];    /* Byte class map */
+    uint32_t state;
+    uint32_t offset;         /* Offset of the next byte in the region */
+    uint32_t count;
+    uint32_t first;
+};
+
+/*a Search
+ */
+/*f pattern_init */
+/**
+ * @brief Read the header and class map of the automaton in a slot
+ *
+ * @returns Non-zero if the slot holds an automaton
+ */
+static __inline int
+pattern_init(struct pattern_state *state, uint32_t slot)
+{
+    __xread uint32_t data[16];
+    uint64_32_t cpp_addr;
+    int i, j;
+
+    cpp_addr.uint64 = __link_sym("dcprc_patterns");
+    cpp_addr.uint64 += slot * DCPRC_PATTERN_SLOT_SIZE;
+    mem_read64_hl(data, cpp_addr.uint32_hi, cpp_addr.uint32_lo, 16);
+    if (data[0] == 0)
+        return 0;
+    state->num_classes = data[1];
+    cpp_addr.uint32_lo += sizeof(struct dcprc_pattern_automaton);
+    for (i=0; i<4; i++) {
+        mem_read64_hl(data, cpp_addr.uint32_hi, cpp_addr.uint32_lo, sizeof(data));
+        for (j=0; j<16; j++) {
+            state->classes[16*i+j] = data[j];
+        }
+        cpp_addr.uint32_lo += sizeof(data);
+    }
+    state->transitions = cpp_addr;
+    state->state  = 0;
+    state->offset = 0;
+    state->count  = 0;
+    state->first  = DCPRC_PATTERN_NO_MATCH;
+    return 1;
+}
+
+/*f pattern_byte */
+/**
+ * @brief Take the transition for a byte
+ */
+static __inline void
+pattern_byte(struct pattern_state *state, uint32_t b)
+{
+    __xread uint32_t transitions[2];
+    uint32_t c, t, start, index;
+    uint64_32_t cpp_addr;
+
+    c = (state->classes[b>>2] >> (8*(b&3))) & 0xff;
+    index = state->state*state->num_classes + c;
+    cpp_addr = state->transitions;
+    cpp_addr.uint32_lo += 4*(index &~ 1);
+    mem_read64_hl(transitions, cpp_addr.uint32_hi, cpp_addr.uint32_lo, sizeof(transitions));
+    t = transitions[index & 1];
+    state->state = DCPRC_PATTERN_NEXT_STATE(t);
+    state->offset++;
+    if (DCPRC_PATTERN_MATCHES(t)) {
+        state->count += DCPRC_PATTERN_MATCHES(t);
+        start = state->offset - DCPRC_PATTERN_MAX_MATCH(t);
+        if (start < state->first)
+            state->first = start;
+    }
+}
+
+/*f pattern_memory */
+/**
+ * @brief Run the automaton over bytes of MU memory
+ */
+static __inline void
+pattern_memory(struct pattern_state *state, uint64_32_t cpp_addr, uint32_t size)
+{
+    __xread uint32_t data[16];
+    uint32_t words[16];
+    uint32_t n;
+    int i;
+
+    while (size>0) {
+        mem_read64_hl(data, cpp_addr.uint32_hi, cpp_addr.uint32_lo, sizeof(data));
+        for (i=0; i<16; i++) {
+            words[i] = data[i];
+        }
+        n = size;
+        if (n>sizeof(data)) n=sizeof(data);
+        for (i=0; i<n; i++) {
+            pattern_byte(state, (words[i>>2] >> (8*(i&3))) & 0xff);
+        }
+        size -= n;
+        cpp_addr.uint32_lo += sizeof(data);
+    }
+}
+
+/*f fetch_and_search */
+/**
+ * @brief Fetch the work data in buffer-sized pieces and search it
+ */
+static __inline void
+fetch_and_search(struct dcprc_workq_entry_pattern *workq_entry)
+{
+    struct pattern_state state;
+    uint64_32_t pcie_addr;
+    uint64_32_t cpp_addr;
+    uint32_t size;
+    uint32_t slot;
+    uint32_t dma_size;
+
+    size = workq_entry->work.size;
+    slot = ((workq_entry->work.flags &~ (1U<<31)) >> DCPRC_PATTERN_SLOT_SHIFT) % DCPRC_PATTERN_SLOTS;
+    workq_entry->result.count  = 0;
+    workq_entry->result.first  = DCPRC_PATTERN_NO_MATCH;
+    workq_entry->result.data_2 = 0;
+    if (size & DCPRC_WORK_SGL)
+        return;
+    if (!pattern_init(&state, slot))
+        return;
+    pcie_addr.uint32_lo = workq_entry->work.host_physical_address_lo;
+    pcie_addr.uint32_hi = workq_entry->work.host_physical_address_hi;
+    cpp_addr.uint64 = (uint64_t) &(data_buffer[0]);
+    while (size>0) {
+        dma_size = size;
+        if (dma_size>BUFFER_SIZE) dma_size=BUFFER_SIZE;
+        dcprc_worker_claim_dma(0,1000);
+        pcie_dma_buffer(0, pcie_addr, cpp_addr, dma_size, NFP_PCIE_DMA_FROMPCI_HI, 0, PCIE_DMA_CFG);
+        dcprc_worker_release_dma(0);
+        pattern_memory(&state, cpp_addr, dma_size);
+        size -= dma_size;
+        pcie_addr.uint64 += dma_size;
+    }
+    workq_entry->result.count = state.count;
+    workq_entry->result.first = state.first;
+}
+
+/*f dcprc_worker_thread */
+/**
+ * @brief Main loop for the data coprocessor worker thread
+ */
+void
+dcprc_worker_thread(void)
+{
+    for (;;) {
+        __xread struct dcprc_mu_work_entry mu_work_entry;
+        struct dcprc_workq_entry_pattern workq_entry;
+        dcprc_worker_get_work(&dcprc_worker_me,
+                              &mu_work_entry,
+                              &workq_entry.dcprc_workq_entry);
+
+        fetch_and_search(&workq_entry);
+
+        dcprc_worker_write_results(&dcprc_worker_me,
+                                   &mu_work_entry,
+                                   &workq_entry.dcprc_workq_entry);
+    }
+}
+
+/*f dcprc_worker_thread_init */
+/**
+ * @brief Initialize the data coprocessor worker thread
+ */
+void
+dcprc_worker_thread_init(void)
+{
+    dcprc_worker_init(&dcprc_worker_me);
+}
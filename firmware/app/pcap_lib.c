@@ -44,15 +44,23 @@
  * Using a test-and-add-sat provides the allocator with the allocation
  * while moving the buffer descriptor on appropriately.
  *
- * Using 256kB MU buffers aligned to 256kB requires a 22-bit MU address,
- * and it can take 128 2kB packets or 2k 64B packets.
+ * The MU buffers are numbered from 1 within a pool of equal-sized
+ * buffers, so the number (0 for none) identifies the buffer in the
+ * descriptor with a 16-bit field, whatever the buffer size.
+ *
+ * The buffer geometry (size from 64kB to 2MB, packets per buffer and
+ * first packet offset) is chosen by the host in the pcap_cls_host CLS
+ * data before the firmware starts; the recycler reads it when it fills
+ * the MU buffer pool and publishes it in pcap_buf_config for the
+ * packet receive threads. A 256kB buffer can take 128 2kB packets or
+ * 2k 64B packets.
  *
  * The front of the MU buffer contains:
  *  A bit mask of the packets that have completed DMA (atomic sets)
  *  Descriptors of the packets that have completed DMA (bulk writes)
  * 
- * The host buffers must be multiples of 256kB as they are paired with
- * the 256kB MU buffers.
+ * The host buffers must be the size of the MU buffers as they are
+ * paired with them.
  *
  * The to-host DMA process consists of a master thread which takes
  * control of an MU buffer and it monitors the bit-mask of packets
@@ -61,8 +69,7 @@
  * to slave DMA threads When the MU buffer is completed and all the DMA
  * threads complete the MU buffer can be recycled.
  * 
- * The buffer recycling thread manages the 256kB PCIe buffer
- * allocation, using a CLS memory as a ring. The buffers from the host
+ * The buffer recycling thread manages the PCIe buffer allocation, using a CLS memory as a ring. The buffers from the host
  * are consumed in the order that they are presented. It pairs the
  * PCIe buffers with MU buffers from a free pool. Before the MU buffer
  * is presented for allocation its header must be zeroed as that
@@ -81,6 +88,7 @@
 #include <nfp.h>
 #include <nfp_override.h>
 #include "firmware/pcap.h"
+#include "firmware/nfp_stats.h"
 #include "pcap_lib.h"
 
 /** Defines
@@ -90,6 +98,10 @@
 
 #define CTM_PKT_OFFSET (64)
 
+/* PCAP_STATS_INCR increments a counter in this island's pcap_stats */
+#define PCAP_STATS_INCR(counter) \
+    cls_incr((__cls void *)cls_pcap_stats, NFP_STATS_COUNTER_OFFSET(counter))
+
 /* MAX_CTM_DMAS_IN_PROGRESS is the maximum number of CTM DMAs that the
  * hardware supports
  *
@@ -114,12 +126,15 @@ enum {
 /* mu_buf_desc_store : struct mu_buf_desc */
 _alloc_mem("mu_buf_desc_store emem global 8 256")
 
+/* pcap_buf_config : struct pcap_buf_config, written by the recycler */
+_alloc_mem("pcap_buf_config emem global 32 64")
+
 /** Queue descriptors and allocations
  */
 /* Recycle queue is workq of mu_base_s8 */
 #define QDEF_MU_BUF_RECYCLE pcap_mu_buf_recycle,10,16,i24.emem
 
-/* Buf in use is workq of mu_base_s18 */
+/* Buf in use is workq of mu_base_s8 */
 #define QDEF_MU_BUF_IN_USE  pcap_mu_buf_in_use,10,17,i24.emem
 
 /* Buf alloc is workq of struct mu_buf_desc (8 bytes) */
@@ -128,9 +143,14 @@ _alloc_mem("mu_buf_desc_store emem global 8 256")
 /* To host DMA is workq of struct mu_buf_to_host_dma_work (8 bytes) */
 #define QDEF_TO_HOST_DMA    pcap_to_host_dma,11,19,i24.emem
 
-/* Debugging journal */
+/* Debugging journal of struct pcap_journal_entry (PCAP_JOURNAL_*) */
 #define QDEF_DEBUG_JOURNAL  pcap_debug_journal,16,24,i24.emem
 
+/* PCAP_JOURNAL_ENABLE enables the typed debug journal entries */
+#ifndef PCAP_JOURNAL_ENABLE
+#define PCAP_JOURNAL_ENABLE 1
+#endif
+
 MU_QUEUE_ALLOC(QDEF_MU_BUF_RECYCLE);
 MU_QUEUE_ALLOC(QDEF_MU_BUF_IN_USE);
 MU_QUEUE_ALLOC(QDEF_MU_BUF_ALLOC);
@@ -148,6 +168,10 @@ _alloc_mem("cls_ctm_dmas cls island 8")
  */
 _alloc_mem("cls_pcap_debug cls island 16")
 
+/** Counters read by the host (PCAP_STATS_*)
+ */
+_alloc_mem("pcap_stats cls island 32")
+
 /** Memory allocation for host interaction threads
  */
 #ifdef PCAP_HOST_ISLAND
@@ -169,9 +193,16 @@ ALLOC_MEM(pcap_cls_host_ring_base,  cls,global,PCAP_HOST_CLS_RING_SIZE)
  * The compiler optimizes out unneeded regs
  */
 static uint32_t mu_buf_desc_store_s8; /* For packet rx */
+static uint32_t buf_pool_base_s8;     /* For packet rx and recycler */
+static uint32_t buf_shift_s8;         /* For packet rx and recycler */
+static uint32_t buf_end_blocks;       /* For packet rx */
+static uint32_t buf_max_pkts;         /* For packet rx and recycler */
+static uint32_t buf_first_pkt_offset; /* For packet rx */
+static uint32_t buf_snaplen;          /* For packet rx */
 static uint32_t cls_ctm_dmas;         /* For packet rx */
 static __declspec(shared) int packet_count; /* For packet rx */
 static uint32_t cls_pcap_debug;         /* For general debug */
+static uint32_t cls_pcap_stats;         /* For all threads */
 
 /* muq_mu_buf_recycle is used by fill, DMA master, MU recycler */
 static __declspec(shared) uint32_t muq_mu_buf_recycle;
@@ -188,6 +219,61 @@ static __declspec(shared) uint32_t muq_to_host_dma;
 /* muq_debug_journal is used by various debug points */
 static __declspec(shared) uint32_t muq_debug_journal;
 
+/** pcap_journal - 8i
+ *
+ * Add a typed entry to the debug journal, stamped with the ME
+ * timestamp and the island, ME and context adding it
+ *
+ * @param type  PCAP_JOURNAL_* entry type
+ * @param a     First argument, the MU buffer base for buffer events
+ * @param b     Second argument
+ *
+ */
+static __inline void
+pcap_journal(int type, uint32_t a, uint32_t b)
+{
+#if PCAP_JOURNAL_ENABLE
+    __xwrite struct pcap_journal_entry entry;
+    entry.id        = PCAP_JOURNAL_ID(type,
+                                      local_csr_read(local_csr_active_ctx_sts));
+    entry.timestamp = local_csr_read(local_csr_timestamp_low);
+    entry.a         = a;
+    entry.b         = b;
+    mem_ring_journal(muq_debug_journal, &entry, sizeof(entry));
+#endif
+}
+
+/** mu_buf_base_s8 - 3i
+ *
+ * Get the MU address >> 8 of a buffer from its number in the pool
+ *
+ */
+static __inline uint32_t
+mu_buf_base_s8(uint32_t mu_buf)
+{
+    return buf_pool_base_s8 + ((mu_buf - 1) << buf_shift_s8);
+}
+
+/** pcap_buf_config_read
+ *
+ * Read the buffer geometry published by the recycler
+ *
+ */
+static void
+pcap_buf_config_read(void)
+{
+    __xread struct pcap_buf_config config_in;
+
+    mem_atomic_read_s8(&config_in, U32_LINK_SYM(pcap_buf_config, 8), 0,
+                       sizeof(config_in));
+    buf_pool_base_s8     = config_in.pool_base_s8;
+    buf_shift_s8         = config_in.buf_shift - 8;
+    buf_end_blocks       = 1 << (config_in.buf_shift - 6);
+    buf_max_pkts         = config_in.max_pkts;
+    buf_first_pkt_offset = config_in.first_pkt_offset;
+    buf_snaplen          = config_in.snaplen;
+}
+
 /** struct cls_ctm_dma_credit
  *
  * Stored in CLS, this is a CTM DMA credit management structure. It is
@@ -221,7 +307,8 @@ struct ctm_pkt_hdr {
     unsigned int mu_base_s11:29;
 
     unsigned int seq:16;
-    unsigned int pad2:8;
+    unsigned int seqr:3;
+    unsigned int pad2:5;
     unsigned int buf_pool:8; /* From metadata */
 
     unsigned int word3; /* CTM packet hdr is ALWAYS 6 32-bit words at least */
@@ -243,13 +330,16 @@ struct pkt_buf_desc {
     uint32_t seq;
     uint32_t pkt_num;
     uint32_t pkt_addr;
+    uint32_t length;
+    uint32_t caplen;
 };
 
 /** struct mu_buf_desc
  *
  * MU buffer descriptor for the allocation system
  *
- * mu_base_s18 is the base address in MU of the buffer (>>18)
+ * mu_buf is the number of the buffer in the MU buffer pool, from 1
+ *     (0 if there is no buffer)
  * offset is the offset in 64Bs from the start of MU buffer to the next
  *     available spot for allocation
  * number is the next packet number for the MU buffer
@@ -261,13 +351,28 @@ struct mu_buf_desc {
         struct { /** a **/
             unsigned int offset:24; /** a **/
             unsigned int pad:8; /** a **/
-            unsigned int number:10; /** a **/
-            unsigned int mu_base_s18:22; /** a **/
+            unsigned int number:16; /** a **/
+            unsigned int mu_buf:16; /** a **/
         }; /** a **/
         int64_t __raw; /** a **/
     }; /** a **/
 };
 
+/** struct pcap_buf_config
+ *
+ * Buffer geometry in use, with the MU buffer pool, as published in
+ * pcap_buf_config by the recycler before the threads run
+ *
+ */
+struct pcap_buf_config {
+    uint32_t pool_base_s8;     /* MU address >> 8 of buffer number 1 */
+    uint32_t buf_shift;        /* Buffers are 1<<buf_shift bytes */
+    uint32_t max_pkts;
+    uint32_t first_pkt_offset;
+    uint32_t snaplen;          /* 1 to PCAP_BUF_SNAPLEN_MAX */
+    uint32_t pad[3];
+};
+
 /** struct mu_buf_to_host_dma_work
  *
  * MU buffer DMA work descriptor, giving MU buffer base address and
@@ -361,14 +466,14 @@ pkt_mu_buf_desc_taken(struct mu_buf_desc *mu_buf_desc)
 {
     __xwrite uint32_t wdesc; /* Xfer for work item for MU workq */
 
-    wdesc = mu_buf_desc->mu_base_s18;
+    wdesc = mu_buf_base_s8(mu_buf_desc->mu_buf);
     mem_workq_add_work(muq_mu_buf_in_use, &wdesc, sizeof(wdesc));
     if (0) {
         __xwrite uint32_t data[4];
         data[0] = 100;
         data[1] = 0;
         data[2] = 0;
-        data[3] = mu_buf_desc->mu_base_s18;
+        data[3] = mu_buf_desc->mu_buf;
         mem_ring_journal(muq_debug_journal,data,sizeof(data));
     }
 }
@@ -392,10 +497,11 @@ pkt_mu_buf_desc_complete(struct mu_buf_desc *mu_buf_desc)
                                          structure element */
 
     total_packets = mu_buf_desc->number;
-    mem_base_s8 = mu_buf_desc->mu_base_s18<<10;
+    mem_base_s8 = mu_buf_base_s8(mu_buf_desc->mu_buf);
     mem_offset = offsetof(struct pcap_buf_hdr,total_packets);
     mem_atomic_write_s8(&total_packets, mem_base_s8, mem_offset,
                         sizeof(uint32_t));
+    pcap_journal(PCAP_JOURNAL_MU_BUF_FULL, mem_base_s8, mu_buf_desc->number);
 }
 
 /** pkt_work_enq - 16i + 100d
@@ -421,6 +527,7 @@ pkt_work_enq(struct pkt_buf_desc *pkt_buf_desc)
     SIGNAL sig1, sig2; /* Signals for parallel MU transactions */
     struct pcap_pkt_buf_desc pcap_pkt_buf_desc;
     __xwrite struct pcap_pkt_buf_desc pcap_pkt_buf_desc_out;
+    uint32_t pcap_pkt_buf_desc_size; /* In 64-bit words */
     uint32_t mu_base_s8;     /* Base address of MU buffer >> 8 */
     uint32_t mu_desc_offset; /* Offset to pkt_buf_desc in MU buffer */
     uint32_t mu_bit_offset;  /* Offset to word in bitmask for the packet
@@ -431,6 +538,9 @@ pkt_work_enq(struct pkt_buf_desc *pkt_buf_desc)
     pcap_pkt_buf_desc.offset     = pkt_buf_desc->mu_offset>>6;
     pcap_pkt_buf_desc.num_blocks = pkt_buf_desc->num_blocks;
     pcap_pkt_buf_desc.seq        = pkt_buf_desc->seq;
+    pcap_pkt_buf_desc.length     = pkt_buf_desc->length;
+    pcap_pkt_buf_desc.caplen     = pkt_buf_desc->caplen;
+    pcap_pkt_buf_desc.pad        = 0;
 
     mu_base_s8 = pkt_buf_desc->mu_base_s8;
     mu_bit_offset = (offsetof(struct pcap_buffer,pkt_bitmask) +
@@ -440,9 +550,10 @@ pkt_work_enq(struct pkt_buf_desc *pkt_buf_desc)
 
     mu_bit_out = 1 << (pkt_buf_desc->mu_num & 31);
     pcap_pkt_buf_desc_out = pcap_pkt_buf_desc;
+    pcap_pkt_buf_desc_size = sizeof(struct pcap_pkt_buf_desc) / sizeof(uint64_t);
     __asm {
         mem[write, pcap_pkt_buf_desc_out, mu_base_s8, <<8, \
-            mu_desc_offset, 1], ctx_swap[sig1];
+            mu_desc_offset, pcap_pkt_buf_desc_size], ctx_swap[sig1];
         mem[set, mu_bit_out, mu_base_s8, <<8, \
             mu_bit_offset, 1], ctx_swap[sig2];
     }
@@ -468,11 +579,12 @@ pkt_free(struct pkt_buf_desc *pkt_buf_desc)
     packet_count++;
 }
 
-/** pkt_receive - 10i + 200d
- * 10 inst, 2 ctm read
+/** pkt_receive - 14i + 200d
+ * 14 inst, 2 ctm read
  *
  * Take next received packet from CTM, get packet number, address and
- * size in blocks
+ * size in blocks; only the snaplen of the packet is captured, so the
+ * blocks are of that
  * 
  */
 static __intrinsic void
@@ -495,8 +607,13 @@ pkt_receive(struct pkt_buf_desc *pkt_buf_desc)
 
     pkt_num = pkt_hdr.pkt_num;
     pkt_buf_desc->pkt_num = pkt_hdr.pkt_num;
-    pkt_buf_desc->seq  = pkt_hdr.seq;
-    pkt_buf_desc->num_blocks = (pkt_hdr.length+CTM_PKT_OFFSET+63)>>6;
+    pkt_buf_desc->seq  = PCAP_PKT_SEQ_WORD(pkt_hdr.seqr, pkt_hdr.seq);
+    pkt_buf_desc->length = pkt_hdr.length;
+    pkt_buf_desc->caplen = pkt_hdr.length;
+    if (pkt_buf_desc->caplen > buf_snaplen) {
+        pkt_buf_desc->caplen = buf_snaplen;
+    }
+    pkt_buf_desc->num_blocks = (pkt_buf_desc->caplen+CTM_PKT_OFFSET+63)>>6;
     __asm {
         mem[packet_read_packet_status, pkt_status[0], pkt_num, 0, 1], \
             ctx_swap[sig]
@@ -563,32 +680,33 @@ pkt_buffer_alloc_from_current(struct mu_buf_desc *mu_buf_desc,
            until first allocator has filled mu_buf_desc_store
         */
         *mu_buf_desc = atomic_buffer_desc_rw;
-        if (mu_buf_desc->mu_base_s18 == 0) {
+        if (mu_buf_desc->mu_buf == 0) {
             if (mu_buf_desc->offset == 0) return PKT_BUF_NOT_INIT;
+            PCAP_STATS_INCR(PCAP_STATS_ALLOC_RETRIES);
             me_sleep(poll_interval);
             continue;
         }
-        buffer_end = 1 << (18-6); /* Buffer size fixed at 256kB, 1<<18 */
+        buffer_end = buf_end_blocks;
 
         pkt_starts_okay = (mu_buf_desc->offset <= buffer_end);
         pkt_ends_okay   = ((mu_buf_desc->offset + pkt_buf_desc->num_blocks)
                            <= buffer_end);
-        pkt_num_okay    = (mu_buf_desc->number < PCAP_BUF_MAX_PKT);
-        pkt_num_max     = (mu_buf_desc->number == PCAP_BUF_MAX_PKT);
+        pkt_num_okay    = (mu_buf_desc->number < buf_max_pkts);
+        pkt_num_max     = (mu_buf_desc->number == buf_max_pkts);
 
         /* If a good allocation then return
          */
         if (pkt_ends_okay && pkt_num_okay) {
             if (0) {
                 __xwrite uint32_t data[4];
-                data[0] = mu_buf_desc->mu_base_s18;
+                data[0] = mu_buf_desc->mu_buf;
                 data[1] = mu_buf_desc->number;
                 data[2] = mu_buf_desc->offset;
                 data[3] = pkt_buf_desc->num_blocks;
                 mem_ring_journal(muq_debug_journal,data,sizeof(data));
             }
             pkt_buf_desc->mu_num     = mu_buf_desc->number;
-            pkt_buf_desc->mu_base_s8 = mu_buf_desc->mu_base_s18 << 10;
+            pkt_buf_desc->mu_base_s8 = mu_buf_base_s8(mu_buf_desc->mu_buf);
             pkt_buf_desc->mu_offset  = mu_buf_desc->offset << 6;
             return PKT_BUF_ALLOCKED;
         }
@@ -618,6 +736,7 @@ pkt_buffer_alloc_from_current(struct mu_buf_desc *mu_buf_desc,
         /* This allocation failed, last also failed, so retry required
          * - another context should be setting up the new MU buffer
          */
+        PCAP_STATS_INCR(PCAP_STATS_ALLOC_RETRIES);
         me_sleep(poll_interval);
     }
 }
@@ -652,18 +771,20 @@ pkt_buffer_alloc_from_new(struct mu_buf_desc *mu_buf_desc,
      if (0) {
         __xwrite uint32_t data[4];
         data[0] = 2;
-        data[1] = mu_buf_desc->mu_base_s18;
-        data[2] = PCAP_BUF_FIRST_PKT_OFFSET;
+        data[1] = mu_buf_desc->mu_buf;
+        data[2] = buf_first_pkt_offset;
         data[3] = pkt_buf_desc->seq;
         mem_ring_journal(muq_debug_journal,data,sizeof(data));
     }
     pkt_mu_buf_desc_taken(mu_buf_desc);
-
-    pkt_buf_desc->mu_base_s8 = mu_buf_desc->mu_base_s18 << 10;
-    pkt_buf_desc->mu_offset  = PCAP_BUF_FIRST_PKT_OFFSET;
+    PCAP_STATS_INCR(PCAP_STATS_MU_BUFS_STARTED);
+    pkt_buf_desc->mu_base_s8 = mu_buf_base_s8(mu_buf_desc->mu_buf);
+    pkt_buf_desc->mu_offset  = buf_first_pkt_offset;
     pkt_buf_desc->mu_num     = mu_buf_desc->number;
+    pcap_journal(PCAP_JOURNAL_MU_BUF_TAKEN, pkt_buf_desc->mu_base_s8,
+                 pkt_buf_desc->seq);
 
-    mu_buf_desc->offset = ((PCAP_BUF_FIRST_PKT_OFFSET >> 6) +
+    mu_buf_desc->offset = ((buf_first_pkt_offset >> 6) +
                            pkt_buf_desc->num_blocks);
     mu_buf_desc->number = 1;
 
@@ -748,6 +869,7 @@ void pkt_dma_to_memory(struct pkt_buf_desc *pkt_buf_desc,
         cls[test_add, data[0], cls_ctm_dmas, 0, 2], ctx_swap[sig];
     }
     while ((data[1] - data[0]) >= MAX_CTM_DMAS_IN_PROGRESS) {
+        PCAP_STATS_INCR(PCAP_STATS_CTM_DMA_STALLS);
         me_sleep(poll_interval);
         cls_read(&data[0], (__cls void *)cls_ctm_dmas, 0,
                  sizeof(uint32_t));
@@ -777,6 +899,7 @@ void pkt_dma_to_memory(struct pkt_buf_desc *pkt_buf_desc,
     /* Release credit of one of CTM DMAs
      */
     cls_incr((__cls void *)cls_ctm_dmas, 0);
+    PCAP_STATS_INCR(PCAP_STATS_CTM_DMAS);
 }
 
 /** packet_capture_pkt_rx_dma - 89i + 707d + pktB/4
@@ -795,10 +918,13 @@ void packet_capture_pkt_rx_dma(int poll_interval)
 {
     mu_buf_desc_store_s8 = U32_LINK_SYM(mu_buf_desc_store, 8);
     cls_ctm_dmas         = U32_LINK_SYM(cls_ctm_dmas, 0);
+    cls_pcap_stats       = U32_LINK_SYM(pcap_stats, 0);
+    pcap_buf_config_read();
     for (;;) {
         struct pkt_buf_desc pkt_buf_desc;
 
         pkt_receive(&pkt_buf_desc);
+        PCAP_STATS_INCR(PCAP_STATS_PKTS_RX);
         pkt_buffer_alloc(&pkt_buf_desc,poll_interval);
         pkt_dma_to_memory(&pkt_buf_desc,poll_interval);
         pkt_work_enq(&pkt_buf_desc);
@@ -837,6 +963,7 @@ pkt_dma_memory_to_host(struct mu_buf_dma_desc *mu_buf_dma_desc,
     pcie_dma_buffer(0 /*PCAP_PCIE_ISLAND*/, pcie_addr,
                     cpp_addr, dma_size,
                                  NFP_PCIE_DMA_TOPCI_HI, token, PCAP_PCIE_DMA_CFG);
+    PCAP_STATS_INCR(PCAP_STATS_PCIE_DMAS);
 }
 
 /** pkt_dma_slave_get_desc - 20i + 300d
@@ -916,6 +1043,7 @@ pkt_dma_slave_get_desc(struct mu_buf_dma_desc *mu_buf_dma_desc)
 void
 packet_capture_dma_to_host_slave(void)
 {
+    cls_pcap_stats = U32_LINK_SYM(pcap_stats, 0);
     for(;;) {
         struct mu_buf_dma_desc mu_buf_dma_desc;
         int dma_start_offset, dma_length;
@@ -923,14 +1051,10 @@ packet_capture_dma_to_host_slave(void)
 
         pkt_dma_slave_get_desc(&mu_buf_dma_desc);
 
-        if (1) {
-            __xwrite uint32_t data[4];
-            data[0] = 65;
-            data[1] = mu_buf_dma_desc.first_block;
-            data[2] = mu_buf_dma_desc.end_block - mu_buf_dma_desc.first_block;
-            data[3] = mu_buf_dma_desc.num_packets;
-            mem_ring_journal(muq_debug_journal,data,sizeof(data));
-        }
+        pcap_journal(PCAP_JOURNAL_SLAVE_DMA, mu_buf_dma_desc.mu_base_s8,
+                     (((mu_buf_dma_desc.end_block -
+                        mu_buf_dma_desc.first_block) << 16) |
+                      mu_buf_dma_desc.num_packets));
 
         if (mu_buf_dma_desc.num_packets==0) {
             pkt_dma_memory_to_host(&mu_buf_dma_desc, 0, 64, 0);
@@ -1045,6 +1169,7 @@ dma_master_buffer_complete(uint32_t mu_base_s8, __xread struct pcap_buf_hdr *pca
     mu_buf_dma_desc.pcie_base_high = pcap_buf_hdr->pcie_base_high;
 
     pkt_dma_memory_to_host(&mu_buf_dma_desc, 0, 64, 0);
+    PCAP_STATS_INCR(PCAP_STATS_MU_BUFS_COMPLETED);
 }
 
 /** packet_capture_dma_to_host_master
@@ -1079,9 +1204,10 @@ dma_master_buffer_complete(uint32_t mu_base_s8, __xread struct pcap_buf_hdr *pca
 void
 packet_capture_dma_to_host_master(int poll_interval)
 {
+    cls_pcap_stats = U32_LINK_SYM(pcap_stats, 0);
     for(;;) {
-        __xread uint32_t mu_base_s18; /* MU buff addr >>18 from workq */
-        uint32_t mu_base_s8;          /* MU buf addr >>8 for CPP cmd */
+        __xread uint32_t mu_base_s8_in; /* MU buf addr >>8 from workq */
+        uint32_t mu_base_s8;            /* MU buf addr >>8 for CPP cmd */
         __xread struct pcap_buf_hdr pcap_buf_hdr_in;
         __xwrite uint32_t mu_base_s8_out; /* MU base for recyle workq */
         int first_packet;  /* First packet to give to next slave */
@@ -1098,21 +1224,22 @@ packet_capture_dma_to_host_master(int poll_interval)
             data[3] = 0;
             mem_ring_journal(muq_debug_journal,data,sizeof(data));
         }
-        mem_workq_add_thread(muq_mu_buf_in_use, &mu_base_s18,
-                             sizeof(mu_base_s18));
+        mem_workq_add_thread(muq_mu_buf_in_use, &mu_base_s8_in,
+                             sizeof(mu_base_s8_in));
         if (0) {
             __xwrite uint32_t data[4];
             data[0] = 201;
             data[1] = 0;
             data[2] = 0;
-            data[3] = mu_base_s18;
+            data[3] = mu_base_s8_in;
             mem_ring_journal(muq_debug_journal,data,sizeof(data));
         }
 
-        mu_base_s8 = mu_base_s18 << 10;
+        mu_base_s8 = mu_base_s8_in;
         mem_atomic_read_s8(&pcap_buf_hdr_in, mu_base_s8, 0,
                            sizeof(pcap_buf_hdr_in));
         total_packets = pcap_buf_hdr_in.total_packets;
+        pcap_journal(PCAP_JOURNAL_DMA_MASTER, mu_base_s8, total_packets);
 
         /* Add slave DMA batches until all of MU buf is batched up
          */
@@ -1166,6 +1293,7 @@ packet_capture_dma_to_host_master(int poll_interval)
 
         /*b DMA a completion of an MU buf
          */
+        pcap_journal(PCAP_JOURNAL_MU_BUF_DMAED, mu_base_s8, total_dmas);
         dma_master_buffer_complete(mu_base_s8,&pcap_buf_hdr_in);
 
         /*b Recycle the MU buf
@@ -1176,8 +1304,9 @@ packet_capture_dma_to_host_master(int poll_interval)
     }
 }
 
-/** pkt_add_mu_buf_desc - 20i + 200d
- * 20 inst + 4 parallel MU bulk write + MU add work
+/** pkt_add_mu_buf_desc - 20i + 200d + 150d per 512 max_pkts
+ * 20 inst + 2 parallel MU bulk write + 2 MU bulk writes per 64B of
+ * bitmask + MU add work
  *
  * Set up an MU buffer, zeroing required bitmask data, and add it to
  * the mu_buf_alloc workq
@@ -1187,9 +1316,10 @@ static __intrinsic void
 pkt_add_mu_buf_desc(uint32_t mu_base_s8, int buf_seq,
                     struct pcie_buf_desc *pcie_buf_desc)
 {
-    int c_128;       /* =128, in a register as required by assembler */
-    int c_160;       /* =160, in a register as required by assembler */
-    SIGNAL sig1, sig2, sig3, sig4;         /* Completion signals */
+    int ofs;         /* Offset of 64B of bitmask to clear */
+    int ofs_32;      /* =ofs+32, in a register as required by assembler */
+    int bitmask_end; /* Offset beyond the bitmask of max_pkts packets */
+    SIGNAL sig1, sig2, sig3;               /* Completion signals */
     __xwrite struct pcap_buf_hdr pcap_buf_hdr; /* MU buffer header data */
     __xwrite uint64_t zeros[8];            /* Zeros to clear bitmask */
 
@@ -1210,35 +1340,33 @@ pkt_add_mu_buf_desc(uint32_t mu_base_s8, int buf_seq,
     zeros[5] = 0;
     zeros[6] = 0;
     zeros[7] = 0;
-    c_128 = 128;
-    c_160 = 160;
     __asm {
         mem[atomic_write,pcap_buf_hdr,mu_base_s8,<<8, 0, 4], sig_done[sig1];
         // Clear DMAs completed... but not the whole cache line is okay
         mem[atomic_write,zeros,mu_base_s8,<<8, 16, 8],  sig_done[sig2];
-        //Next two are bitmask - atomic write?
-        //No need to clear the offset/size area as that is not DMAed to host
-        //unless bitmask bits are set
-        mem[atomic_write,zeros,mu_base_s8,<<8, 64, 8];
-        mem[atomic_write,zeros,mu_base_s8,<<8, 96, 8],  sig_done[sig3];
-        mem[atomic_write,zeros,mu_base_s8,<<8, c_128, 8];
-        mem[atomic_write,zeros,mu_base_s8,<<8, c_160, 8], sig_done[sig4];
     }
-    wait_for_all(&sig1, &sig2, &sig3, &sig4);
+    wait_for_all(&sig1, &sig2);
+
+    /* Clear the 64B lumps of bitmask for max_pkts packets
+     * No need to clear the offset/size area as that is not DMAed to host
+     * unless bitmask bits are set
+     */
+    ofs = offsetof(struct pcap_buffer, pkt_bitmask);
+    bitmask_end = ofs + (((buf_max_pkts + 511) >> 9) << 6);
+    for (; ofs < bitmask_end; ofs += 64) {
+        ofs_32 = ofs + 32;
+        __asm {
+            mem[atomic_write,zeros,mu_base_s8,<<8, ofs, 8];
+            mem[atomic_write,zeros,mu_base_s8,<<8, ofs_32, 8], ctx_swap[sig3];
+        }
+    }
 
     mu_buf_desc.__raw = 0;
     mu_buf_desc.offset = 0;
     mu_buf_desc.number = 0;
-    mu_buf_desc.mu_base_s18 = mu_base_s8>>10;
+    mu_buf_desc.mu_buf = ((mu_base_s8 - buf_pool_base_s8) >> buf_shift_s8) + 1;
     mu_buf_desc_out = mu_buf_desc;
-    if (0) {
-        __xwrite uint32_t data[4];
-        data[0] = 99;
-        data[1] = 0;
-        data[2] = buf_seq;
-        data[3] = mu_base_s8;
-        mem_ring_journal(muq_debug_journal,data,sizeof(data));
-    }
+    pcap_journal(PCAP_JOURNAL_MU_BUF_ADDED, mu_base_s8, buf_seq);
     mem_workq_add_work(muq_mu_buf_alloc, (void *)&mu_buf_desc_out,
                        sizeof(mu_buf_desc));
 }
@@ -1264,10 +1392,17 @@ host_get_buf(struct host_data *host_data,
     addr = host_data->cls_host_shared_data;
     if (host_data->wptr == host_data->rptr) {
         __xread uint32_t wptr; /* Xfer to read CLS wptr */
+        int stalled;           /* Set once the stall is journalled */
+        stalled = 0;
         for (;;) {
             cls_read(&wptr, (__cls void *)addr, 0,
                      sizeof(uint32_t));
             if (wptr != host_data->rptr) break;
+            PCAP_STATS_INCR(PCAP_STATS_HOST_BUF_STALLS);
+            if (!stalled) {
+                pcap_journal(PCAP_JOURNAL_HOST_BUF_STALL, host_data->rptr, 0);
+                stalled = 1;
+            }
             me_sleep(poll_interval);
         }
         host_data->wptr = wptr;
@@ -1298,7 +1433,7 @@ host_get_buf(struct host_data *host_data,
  * ~8k cycles.
  *
  * If an MU buffer lasts for 256kB=2Mbits of data then this needs to
- * run every ~20k cycles.
+ * run every ~20k cycles; for 64kB buffers, every ~5k cycles.
  *
  * The max utilization of the ME is <1%.
  */
@@ -1313,6 +1448,7 @@ packet_capture_mu_buffer_recycler(int poll_interval)
     host_data.cls_host_ring_item_mask = PCAP_HOST_CLS_RING_SIZE_ENTRIES-1;
     host_data.rptr = 0;
     host_data.wptr = 0;
+    cls_pcap_stats = U32_LINK_SYM(pcap_stats, 0);
 
     buf_seq = 0;
     for (;;) {
@@ -1325,16 +1461,9 @@ packet_capture_mu_buffer_recycler(int poll_interval)
          * recycle rings?*/
         mem_workq_add_thread(muq_mu_buf_recycle, &mu_base_s8,
                              sizeof(mu_base_s8));
+        pcap_journal(PCAP_JOURNAL_HOST_BUF, buf_seq, pcie_buf_desc.pcie_base_low);
         pkt_add_mu_buf_desc(mu_base_s8, buf_seq, &pcie_buf_desc);
         buf_seq++;
-        if (0) {
-            __xwrite uint32_t data[4];
-            data[0] = buf_seq;
-            data[1] = mu_base_s8;
-            data[2] = pcie_buf_desc.pcie_base_low;
-            data[3] = pcie_buf_desc.pcie_base_high;
-            mem_ring_journal(muq_debug_journal,data,sizeof(data));
-        }
         //local_csr_write(local_csr_mailbox0, buf_seq);
         //local_csr_write(local_csr_mailbox1, mu_base_s8);
         //local_csr_write(local_csr_mailbox2, pcie_buf_desc.pcie_base_low);
@@ -1342,24 +1471,75 @@ packet_capture_mu_buffer_recycler(int poll_interval)
     }
 }
 
+/** pcap_buf_config_write
+ *
+ * Get the buffer geometry from the host CLS data, or the defaults if
+ * the host has not given a valid one, and publish it with the MU
+ * buffer pool in pcap_buf_config. Must run on host PCIe island.
+ *
+ * @param  mu_base_s8   MU buffer pool base address >> 8
+ *
+ */
+static void
+pcap_buf_config_write(uint32_t mu_base_s8)
+{
+    __xread struct pcap_buf_geometry geometry_in;
+    __xwrite struct pcap_buf_config config_out;
+    struct pcap_buf_config config;
+
+    cls_read(&geometry_in,
+             (__cls void *)__link_sym("pcap_cls_host_shared_data"),
+             offsetof(struct pcap_cls_host, geometry),
+             sizeof(geometry_in));
+    config.pool_base_s8     = mu_base_s8;
+    config.buf_shift        = PCAP_BUF_SIZE_SHIFT;
+    config.max_pkts         = PCAP_BUF_MAX_PKT;
+    config.first_pkt_offset = PCAP_BUF_FIRST_PKT_OFFSET;
+    config.snaplen          = PCAP_BUF_SNAPLEN_MAX;
+    config.pad[0]           = 0;
+    config.pad[1]           = 0;
+    config.pad[2]           = 0;
+    if ((geometry_in.magic == PCAP_BUF_GEOMETRY_MAGIC) &&
+        PCAP_BUF_GEOMETRY_VALID(geometry_in.buf_size_shift,
+                                geometry_in.max_pkts,
+                                geometry_in.first_pkt_offset)) {
+        config.buf_shift        = geometry_in.buf_size_shift;
+        config.max_pkts         = geometry_in.max_pkts;
+        config.first_pkt_offset = geometry_in.first_pkt_offset;
+        if ((geometry_in.snaplen != 0) &&
+            (geometry_in.snaplen < PCAP_BUF_SNAPLEN_MAX)) {
+            config.snaplen = geometry_in.snaplen;
+        }
+    }
+    config_out = config;
+    mem_atomic_write_s8(&config_out, U32_LINK_SYM(pcap_buf_config, 8), 0,
+                        sizeof(config_out));
+}
+
 /** packet_capture_fill_mu_buffer_list
  *
- * Fill the MU buffer list with 'num_buf' 256kB buffers starting at
- * given base
+ * Set up the buffer geometry, and fill the MU buffer list with as
+ * many buffers as fit in the pool at the given base. Must run on host
+ * PCIe island, in the context that runs the recycler.
  *
- * @param  mu_base_s8   MU buffer base address >> 8
- * @param  num_buf      Number of 256kB buffers to fill with
+ * @param  mu_base_s8    MU buffer pool base address >> 8
+ * @param  pool_size_s8  Size of the MU buffer pool >> 8
  *
  */
 void
-packet_capture_fill_mu_buffer_list(uint32_t mu_base_s8, int num_buf)
+packet_capture_fill_mu_buffer_list(uint32_t mu_base_s8, uint32_t pool_size_s8)
 {
+    int num_buf;
+
+    pcap_buf_config_write(mu_base_s8);
+    pcap_buf_config_read();
+    num_buf = pool_size_s8 >> buf_shift_s8;
     for (;num_buf>0;num_buf--) {
         __xwrite uint32_t mu_base_s8_out;
         mu_base_s8_out = mu_base_s8;
         mem_workq_add_work(muq_mu_buf_recycle, &mu_base_s8_out,
                            sizeof(mu_base_s8));
-        mu_base_s8 += ((1<<18)>>8);
+        mu_base_s8 += (1 << buf_shift_s8);
     }
 }
 
@@ -22,6 +22,8 @@
 
 /** Defines
  */
+/* Size of the MU buffer pool is in units of the default buffer size;
+ * buffers of other sizes are carved from the same pool */
 #define PKT_CAP_MU_BUF_SHIFT 18
 #define PKT_CAP_MU_BUF_SIZE (1<<PKT_CAP_MU_BUF_SHIFT)
 
@@ -70,15 +72,16 @@ void packet_capture_dma_to_host_master(int poll_interval);
 
 /** packet_capture_fill_mu_buffer_list
  *
- * Fill the MU buffer list with 'num_buf' 256kB buffers starting at
- * given base
+ * Set up the buffer geometry, and fill the MU buffer list with as
+ * many buffers as fit in the pool at the given base. Must run on host
+ * PCIe island, in the context that runs the recycler.
  *
- * @param  mu_base_s8   MU buffer base address >> 8
- * @param  num_buf      Number of 256kB buffers to fill with
+ * @param  mu_base_s8    MU buffer pool base address >> 8
+ * @param  pool_size_s8  Size of the MU buffer pool >> 8
  *
  */
 void packet_capture_fill_mu_buffer_list(uint32_t mu_base_s8,
-                                        int num_buf);
+                                        uint32_t pool_size_s8);
 
 /** packet_capture_init_pkt_rx_dma
  *
@@ -20,8 +20,8 @@
 #define NUM_MU_BUF 64
 //#define NUM_MU_BUF 8
 __asm {
-    .alloc_mem   pcap_emu_buffer0    i24.mem global (PKT_CAP_MU_BUF_SIZE*NUM_MU_BUF) (1<<18);
-//    .alloc_mem   pcap_emu_buffer0    i28.mem global (PKT_CAP_MU_BUF_SIZE*NUM_MU_BUF) (1<<18);
+    .alloc_mem   pcap_emu_buffer0    i24.mem global (PKT_CAP_MU_BUF_SIZE*NUM_MU_BUF) (1<<21);
+//    .alloc_mem   pcap_emu_buffer0    i28.mem global (PKT_CAP_MU_BUF_SIZE*NUM_MU_BUF) (1<<21);
 };
 
 /** Synchronization
@@ -80,7 +80,8 @@ void main(void)
     if (ctx()==0) {
         uint32_t mu_base_s8;
         mu_base_s8 = (uint32_t)(__link_sym("pcap_emu_buffer0")>>8);
-        packet_capture_fill_mu_buffer_list(mu_base_s8, NUM_MU_BUF);
+        packet_capture_fill_mu_buffer_list(mu_base_s8,
+                                           (PKT_CAP_MU_BUF_SIZE*NUM_MU_BUF)>>8);
     }
     sync_state_set_stage_complete(PCAP_INIT_STAGE_READY_TO_RUN);
     if (ctx()==0) {
@@ -247,13 +247,26 @@ struct batch_work {
             unsigned int tx_time_hi:8; /** Top 8 bits */
             unsigned int num_valid_pkts:8;        /** Pad 8 bits */
             unsigned int tx_seq:16;    /** Tx sequence for first of 8 entries */
-            uint32_t     mu_base_s8;   /** 256B aligned flow script start */
-            uint32_t     work_ofs;     /** Offset to script from script base */
+            uint32_t     mu_base_s8;   /** 256B aligned schedule batch start */
+            unsigned int work_ofs:8;   /** Offset of batch from mu_base_s8 */
+            unsigned int time_scale:24; /** Playback time scale */
         }; /** a **/
         uint32_t __raw[4]; /** a **/
     }; /** a **/
 };
 
+/** struct playback
+ *
+ * Playback mode set by PKTGEN_HOST_CMD_PLAYBACK, used for all
+ * subsequent PKTGEN_HOST_CMD_PKT schedules
+ */
+struct playback {
+    uint32_t time_scale;     /* PKTGEN_TIME_SCALE_ONE is real-time */
+    uint32_t loop_count;     /* Number of times to play the schedule */
+    uint32_t loop_offset_lo; /* Schedule time between starts of loops */
+    uint32_t loop_offset_hi;
+};
+
 /** struct tx_seq
  */
 struct tx_seq {
@@ -632,11 +645,16 @@ batch_dist_add_pkt_to_batch(struct batch_work *batch_work,
                             SIGNAL *sig)
 {
     uint32_t tx_seq;
+    uint64_32_t tx_time;
     struct tx_pkt_work tx_pkt_work;
 
     tx_seq = batch_work->tx_seq;
-    tx_pkt_work.tx_time_lo = batch_work->tx_time_lo + sched_entry->tx_time_lo;
-    tx_pkt_work.tx_time_hi = batch_work->tx_time_hi + sched_entry->tx_time_hi; /* carry */
+    tx_time.uint64 = pktgen_scale_tx_time(sched_entry->tx_time_lo,
+                                          sched_entry->tx_time_hi,
+                                          batch_work->time_scale);
+    tx_time.uint64 += (((uint64_t)batch_work->tx_time_hi) << 32) | batch_work->tx_time_lo;
+    tx_pkt_work.tx_time_lo = tx_time.uint32_lo;
+    tx_pkt_work.tx_time_hi = tx_time.uint32_hi & 0xff;
     tx_pkt_work.mu_base_s8 = sched_entry->mu_base_s8;
     tx_pkt_work.script_ofs = sched_entry->script_ofs;
     tx_pkt_work.length     = sched_entry->length;
@@ -699,7 +717,8 @@ batch_dist_get_sched_entries(struct batch_work *batch_work,
  *
  * The work in is 16B:
  *
- * a 32-bit packet-flow entry offset
+ * a 32-bit 256B-aligned packet-flow entry base and 8-bit offset
+ * a 24-bit playback time scale applied to each entry's time
  * a 16-bit batch sequence (same for all 8 batches)
  * a 16-bit transmit sequence (for the Tx orderer)
  * a 4-bit number of valid packets
@@ -733,7 +752,7 @@ tx_master_add_batch_work(struct batch_work *batch_work)
                        sizeof(*batch_work));
 }
 
-/** tx_master_distribute_schedule - to do - manage backup
+/** tx_master_distribute_loop - to do - manage backup
  * The batches are credit-managed
  *
  * Probably need to do a number of batch_works at the same time to get
@@ -741,28 +760,35 @@ tx_master_add_batch_work(struct batch_work *batch_work)
  *
  * A burst of 4 at one time would be good.
  *
+ * The tx sequence number used for flow control against last_tx_seq
+ * is the full 32 bits, as a looped schedule will easily run past the
+ * 16 bits of tx_seq in the batch work.
+ *
  */
 #define MAX_PKTS_IN_PROGRESS (32)
 static void
-tx_master_distribute_schedule(struct host_data *host_data,
-                              uint64_t base_time,
-                              int total_pkts,
-                              uint32_t mu_base_s8,
-                              uint32_t *tx_seq)
+tx_master_distribute_loop(struct host_data *host_data,
+                          uint64_t base_time,
+                          uint32_t time_scale,
+                          int total_pkts,
+                          uint32_t mu_base_s8,
+                          uint32_t *tx_seq)
 {
     struct batch_work batch_work;
     uint32_t addr; /* Address in CLS of host data */
     int num_batches;
+    uint32_t seq;
+    uint32_t work_ofs;
     __xread uint32_t last_tx_seq;
 
     num_batches = (total_pkts + 7) >> 3;
 
     batch_work.tx_time_lo = (uint32_t) base_time;
     batch_work.tx_time_hi = ((uint32_t) (base_time >> 32)) & 0xff;
-    batch_work.mu_base_s8 = mu_base_s8;
-    batch_work.work_ofs = 64;
-    batch_work.tx_seq = *tx_seq;
+    batch_work.time_scale = time_scale;
     batch_work.num_valid_pkts = 8;
+    seq = *tx_seq;
+    work_ofs = 64;
     *tx_seq = *tx_seq + total_pkts;
 
     addr = host_data->cls_host_shared_data;
@@ -771,25 +797,144 @@ tx_master_distribute_schedule(struct host_data *host_data,
              sizeof(uint32_t));
 
     while (num_batches>0) {
-        while ((batch_work.tx_seq - last_tx_seq) > MAX_PKTS_IN_PROGRESS) {
+        while ((seq - last_tx_seq) > MAX_PKTS_IN_PROGRESS) {
             cls_read(&last_tx_seq, (__cls void *)addr,
                      offsetof(struct pktgen_cls_host,last_tx_seq),
                      sizeof(uint32_t));
-            if ((batch_work.tx_seq - last_tx_seq) > MAX_PKTS_IN_PROGRESS) {
+            if ((seq - last_tx_seq) > MAX_PKTS_IN_PROGRESS) {
                 me_sleep(poll_interval);
             }
         }
         if (total_pkts<8) {
             batch_work.num_valid_pkts = total_pkts;
         }
+        batch_work.tx_seq = seq;
+        batch_work.mu_base_s8 = mu_base_s8 + (work_ofs >> 8);
+        batch_work.work_ofs = work_ofs & 0xff;
         tx_master_add_batch_work(&batch_work);
-        batch_work.work_ofs += 128;
-        batch_work.tx_seq += 8;
+        work_ofs += 128;
+        seq += 8;
         total_pkts -= 8;
         num_batches -= 1;
     }
 }
 
+/** tx_master_distribute_schedule
+ *
+ * Distribute a schedule once per loop of the playback mode, with
+ * loop 'n' starting at base_time plus 'n' times the scaled loop
+ * offset (all modulo 40 bits)
+ *
+ */
+static void
+tx_master_distribute_schedule(struct host_data *host_data,
+                              struct playback *playback,
+                              uint64_t base_time,
+                              int total_pkts,
+                              uint32_t mu_base_s8,
+                              uint32_t *tx_seq)
+{
+    uint64_t loop_offset;
+    uint32_t loop;
+
+    loop_offset = pktgen_scale_tx_time(playback->loop_offset_lo,
+                                       playback->loop_offset_hi,
+                                       playback->time_scale);
+    for (loop=0; loop<playback->loop_count; loop++) {
+        tx_master_distribute_loop(host_data,
+                                  base_time & PKTGEN_TX_TIME_MASK,
+                                  playback->time_scale,
+                                  total_pkts, mu_base_s8, tx_seq);
+        base_time += loop_offset;
+    }
+}
+
+/** tx_master_distribute_stream
+ *
+ * Distribute a schedule from a host-refilled stream ring of batches,
+ * until the host indicates the end of the stream and all the entries
+ * it wrote have been distributed.
+ *
+ * The host stream_wptr is only reread when less than a batch of the
+ * entries previously seen remain to be distributed; a partial batch
+ * is only distributed at the end of the stream. Flow control is as for
+ * tx_master_distribute_loop.
+ *
+ */
+static void
+tx_master_distribute_stream(struct host_data *host_data,
+                            struct playback *playback,
+                            uint64_t base_time,
+                            uint32_t ring_mu_base_s8,
+                            uint32_t ring_batch_mask,
+                            uint32_t *tx_seq)
+{
+    struct batch_work batch_work;
+    uint32_t addr; /* Address in CLS of host data */
+    uint32_t stream_rptr;
+    uint32_t stream_wptr;
+    uint32_t stream_end;
+    uint32_t seq;
+    __xread uint32_t last_tx_seq;
+
+    base_time &= PKTGEN_TX_TIME_MASK;
+    batch_work.tx_time_lo = (uint32_t) base_time;
+    batch_work.tx_time_hi = ((uint32_t) (base_time >> 32)) & 0xff;
+    batch_work.time_scale = playback->time_scale;
+    seq = *tx_seq;
+
+    addr = host_data->cls_host_shared_data;
+    cls_read(&last_tx_seq, (__cls void *)addr,
+             offsetof(struct pktgen_cls_host,last_tx_seq),
+             sizeof(uint32_t));
+
+    stream_rptr = 0;
+    stream_wptr = 0;
+    stream_end  = 0;
+    for (;;) {
+        uint32_t batch_ofs;
+        int num_pkts;
+
+        num_pkts = stream_wptr - stream_rptr;
+        if ((num_pkts < PKTGEN_STREAM_BATCH_ENTRIES) && !stream_end) {
+            __xread uint32_t stream_data[2];
+            cls_read(stream_data, (__cls void *)addr,
+                     offsetof(struct pktgen_cls_host,stream_wptr),
+                     sizeof(stream_data));
+            stream_wptr = stream_data[0];
+            stream_end  = stream_data[1];
+            num_pkts = stream_wptr - stream_rptr;
+            if ((num_pkts < PKTGEN_STREAM_BATCH_ENTRIES) && !stream_end) {
+                me_sleep(poll_interval);
+                continue;
+            }
+        }
+        if (num_pkts == 0)
+            break;
+        if (num_pkts > PKTGEN_STREAM_BATCH_ENTRIES)
+            num_pkts = PKTGEN_STREAM_BATCH_ENTRIES;
+
+        while ((seq - last_tx_seq) > MAX_PKTS_IN_PROGRESS) {
+            cls_read(&last_tx_seq, (__cls void *)addr,
+                     offsetof(struct pktgen_cls_host,last_tx_seq),
+                     sizeof(uint32_t));
+            if ((seq - last_tx_seq) > MAX_PKTS_IN_PROGRESS) {
+                me_sleep(poll_interval);
+            }
+        }
+        batch_ofs = ((stream_rptr / PKTGEN_STREAM_BATCH_ENTRIES) & ring_batch_mask);
+        batch_ofs = batch_ofs * PKTGEN_STREAM_BATCH_SIZE;
+        batch_work.tx_seq = seq;
+        batch_work.num_valid_pkts = num_pkts;
+        batch_work.mu_base_s8 = ring_mu_base_s8 + (batch_ofs >> 8);
+        batch_work.work_ofs = batch_ofs & 0xff;
+        tx_master_add_batch_work(&batch_work);
+        stream_rptr += num_pkts;
+        seq += num_pkts;
+    }
+    *tx_seq = seq;
+}
+
 /** host_get_cmd
  *
  * Get a command from the host
@@ -863,8 +1008,9 @@ void
 pktgen_master(void)
 {
     struct host_data host_data; /* Host data cached in shared registers */
+    struct playback playback; /* Playback mode for schedules */
     int buf_seq; /* Monotonically increasing buffer sequence number */
-    int tx_seq;
+    uint32_t tx_seq;
 
     host_data.cls_host_shared_data = ALLOC_PKTGEN_HOST();
     host_data.cls_ring_base = ALLOC_PKTGEN_RING();
@@ -872,6 +1018,11 @@ pktgen_master(void)
     host_data.wptr = 0;
     host_data.rptr = 0;
 
+    playback.time_scale = PKTGEN_TIME_SCALE_ONE;
+    playback.loop_count = 1;
+    playback.loop_offset_lo = 0;
+    playback.loop_offset_hi = 0;
+
     tx_seq = 0;
     for (;;) {
         __xread uint32_t mu_base_s8;
@@ -891,9 +1042,27 @@ pktgen_master(void)
           local_csr_write(local_csr_mailbox3, ((base_time>>32)&0xffffffff));
             mu_base_s8 = host_cmd.pkt_cmd.mu_base_s8;
             total_pkts = host_cmd.pkt_cmd.total_pkts;
-            tx_master_distribute_schedule(&host_data,
+            tx_master_distribute_schedule(&host_data, &playback,
                                           base_time, total_pkts,
                                           mu_base_s8, &tx_seq);
+        } else if (host_cmd.all_cmds.cmd_type == PKTGEN_HOST_CMD_STREAM) {
+            uint64_t base_time;
+            uint64_32_t time_now;
+            time_now = me_time64();
+            base_time = time_now.uint64 + host_cmd.stream_cmd.base_delay;
+            tx_master_distribute_stream(&host_data, &playback, base_time,
+                                        host_cmd.stream_cmd.mu_base_s8,
+                                        (1<<host_cmd.stream_cmd.ring_batches_log2)-1,
+                                        &tx_seq);
+        } else if (host_cmd.all_cmds.cmd_type == PKTGEN_HOST_CMD_PLAYBACK) {
+            playback.time_scale     = host_cmd.playback_cmd.time_scale;
+            playback.loop_count     = host_cmd.playback_cmd.loop_count;
+            playback.loop_offset_lo = host_cmd.playback_cmd.loop_offset_lo;
+            playback.loop_offset_hi = host_cmd.playback_cmd.loop_offset_hi;
+            if (playback.time_scale == 0)
+                playback.time_scale = PKTGEN_TIME_SCALE_ONE;
+            if (playback.loop_count == 0)
+                playback.loop_count = 1;
         } else if (host_cmd.all_cmds.cmd_type == PKTGEN_HOST_CMD_DMA) {
             uint64_32_t cpp_addr;
             uint64_32_t pcie_addr;
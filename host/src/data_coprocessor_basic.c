@@ -16,9 +16,9 @@
  * @file  data_coprocessor_basic.c
  * @brief Simple basic data coprocessor
  *
- * This is a simple data coprocessor example, using just the
- * nfp_support subsystem to interact with an NFP card that provides
- * some basic data accelerations
+ * This is a simple data coprocessor example, using libdcprc to
+ * interact with an NFP card that provides some basic data
+ * accelerations
  *
  */
 
@@ -30,33 +30,32 @@
 #include <string.h> 
 #include <inttypes.h>
 #include <getopt.h>
-#include "nfp_support.h"
+#include <pthread.h>
 #include "timer.h"
-#include "firmware/data_coproc.h"
+#include "dcprc.h"
+#include "dcprc_kernels.h"
+#include "dcprc_hybrid.h"
+#include "dcprc_pattern.h"
 
-/*a Types */
-/*t data_coproc_work_queue */
-/**
- **/
-struct data_coproc_work_queue {
-    struct dcprc_workq_entry *entries;
-    uint64_t phys_addr;
-    int      max_entries;
-    int      wptr;
-    int      rptr;
-};
+/*a Defines
+ */
+/* Work data is in one huge page of shared memory */
+#define DATA_SPACE_SIZE (2*1024*1024)
 
-/*t data_coproc */
-/**
- **/
-struct data_coproc {
-    struct nfp *nfp;
-    struct nfp_cppid cls_workq;
-    void *shm_base;
-    uint64_t phys_addr[1];
-    struct data_coproc_work_queue work_queues[1];
-};
+/* Time to wait for any one work item to complete */
+#define WORK_TIMEOUT_US (1000*1000)
 
+/* Completions taken from a work queue at a time */
+#define DATA_COPROC_REAP_BATCH 32
+
+/* Most patterns read from a patterns file */
+#define DATA_COPROC_MAX_PATTERNS 4096
+
+/* Most benchmark submitter threads; one work queue each, of those the
+ * firmware scans */
+#define DCPRC_BENCHMARK_MAX_THREADS DCPRC_SCANNED_WORKQS
+
+/*a Types */
 /*t data_coproc_options */
 /**
  */
@@ -67,13 +66,50 @@ struct data_coproc_options {
     const char *firmware;
     const char *data_filename;
     const char *log_filename;
+    const char *patterns_filename;
+    const char *latency_filename;
+    int stage_timestamps;
+    double me_mhz;
     int data_size;
+    int workq_size;
+    int threads;
+    int sg_entries;
+    int verify_work_type;
+    int cpu_reference_work_type;
+    int hybrid_work_type;
+    int wptr_mirror;
+    int auto_commit;
+    struct dcprc_commit_policy commit_policy;
+};
+
+/*t data_coproc_submitter */
+/**
+ * A submitter thread of the benchmark, owning its own work queue
+ */
+struct data_coproc_submitter {
+    struct dcprc *dcprc;
+    struct data_coproc_options *data_coproc_options;
+    pthread_barrier_t *barrier;
+    pthread_t thread;
+    uint64_t phys_addr;
+    int      data_size;
+    int      items;
+    uint64_t doorbells;
+    int      error;
 };
 
 /*a Global variables */
-static const char *shm_filename="/tmp/nfp_dcb_shm.lock";
-static int shm_key = 0x0d0c0b0a;
-static const char *options = "b:d:f:i:hD:S:L:";
+static const struct {
+    const char *name;
+    int work_type;
+} work_types[] = {
+    {"null",      DCPRC_WORK_TYPE_NULL},
+    {"fetch_sum", DCPRC_WORK_TYPE_FETCH_SUM},
+    {"digest",    DCPRC_WORK_TYPE_DIGEST},
+    {"pattern",   DCPRC_WORK_TYPE_PATTERN},
+    {NULL, 0}
+};
+static const char *options = "b:d:f:i:hD:S:L:Q:T:c:w:rmG:V:C:H:P:J:tM:";
 static struct option long_options[] = {
     {"help",       no_argument, 0,  'h' },
     {"batch-size", required_argument, 0, 'b' },
@@ -83,216 +119,292 @@ static struct option long_options[] = {
     {"data-file",  required_argument, 0, 'D' },
     {"data-size",  required_argument, 0, 'S' },
     {"log-file",   required_argument, 0, 'L' },
+    {"workq-size", required_argument, 0, 'Q' },
+    {"threads",    required_argument, 0, 'T' },
+    {"commit-items",    required_argument, 0, 'c' },
+    {"commit-delay-us", required_argument, 0, 'w' },
+    {"commit-drain",    no_argument,       0, 'r' },
+    {"wptr-mirror",     no_argument,       0, 'm' },
+    {"sg-entries",      required_argument, 0, 'G' },
+    {"verify",          required_argument, 0, 'V' },
+    {"cpu-reference",   required_argument, 0, 'C' },
+    {"hybrid",          required_argument, 0, 'H' },
+    {"patterns",        required_argument, 0, 'P' },
+    {"latency-file",    required_argument, 0, 'J' },
+    {"stage-times",     no_argument,       0, 't' },
+    {"mhz",             required_argument, 0, 'M' },
     {0,         0,                 0,  0 }
     };
 
 /*a Functions
  */
-/*f data_coproc_initialize */
+/*f usage */
 /**
- * @brief Initialize data coprocessor - nfp, shm, firmware
- *
- * @param data_coproc Data coprocessor structure to fill out
- *
- * @param dev_num Device number of NFP to use
- *
- * @param shm_size Amount of shared memory to allocate
- *
- * @returns Zero on success, non-zero on error (with an error message
- * printed)
+ * Display help
+ */
+static int
+usage(int error)
+{
+    printf("Help goes here\n");
+    if (error)
+        return 4;
+    return 0;
+}
+
+/*f work_type_from_name */
+/**
+ * @brief Find a work type from its name (as in dcprc_worker_<name>.c)
  *
- * Initialize the NFP and load the firmware; get everything that is
- * needed to interact (run-time symbols); allocate shared memory (to
- * get memory that can be shared with the NFP)
+ * @returns Work type, or -1 if unknown
  *
- **/
+ */
 static int
-data_coproc_initialize(struct data_coproc *data_coproc,
-                       struct data_coproc_options *data_coproc_options,
-                       size_t shm_size)
+work_type_from_name(const char *name)
 {
-    data_coproc->nfp = nfp_init(data_coproc_options->dev_num, 1);
-    if (!data_coproc->nfp) {
-        fprintf(stderr, "Failed to open NFP\n");
-        return 1;
+    int i;
+    for (i=0; work_types[i].name; i++) {
+        if (!strcmp(name, work_types[i].name))
+            return work_types[i].work_type;
     }
+    return -1;
+}
 
-    if (nfp_fw_load(data_coproc->nfp, data_coproc_options->firmware) < 0) {
-        fprintf(stderr, "Failed to load NFP firmware\n");
-        return 2;
+/*f work_type_name */
+/**
+ * @brief Get the name of a work type, for reports
+ *
+ */
+static const char *
+work_type_name(int work_type)
+{
+    int i;
+    for (i=0; work_types[i].name; i++) {
+        if (work_types[i].work_type == work_type)
+            return work_types[i].name;
     }
+    return "unknown";
+}
 
-    if (nfp_get_rtsym_cppid(data_coproc->nfp, "dcprc_init_csrs_included", NULL)<0) {
-        fprintf(stderr, "Firmware is missing CSR initialization (symbol 'dcprc_init_csrs_included' is missing)\n");
-        return 2;
-    }
+/*f latency_hist_print */
+/**
+ * @brief Print the summary of a histogram, with its values scaled to
+ * microseconds; human-readable to stdout, and as a JSON object member
+ * to a file if given
+ *
+ */
+static void
+latency_hist_print(const t_sl_hist *hist, const char *name,
+                   double clks_per_us, FILE *f, int last)
+{
+    static const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    static const char *fraction_names[] = {"p50", "p90", "p99", "p999"};
+    double min;
+    int i;
 
-    //nfp_show_rtsyms(data_coproc->nfp);
-    if (nfp_sync_resolve(data_coproc->nfp)<0) {
-        fprintf(stderr, "Failed to resolve firmware synchronization configuration - firmware would not start correctly\n");
-        return 3;
+    min = (hist->count == 0) ? 0 : hist->min/clks_per_us;
+    printf("Latency %s: %llu items min %fus mean %fus", name, hist->count,
+           min, sl_hist_mean(hist)/clks_per_us);
+    for (i=0; i<4; i++) {
+        printf(" %s %fus", fraction_names[i],
+               sl_hist_percentile(hist, fractions[i])/clks_per_us);
     }
-
-    if (nfp_get_rtsym_cppid(data_coproc->nfp,
-                            "cls_workq",
-                            &data_coproc->cls_workq) < 0) {
-        fprintf(stderr, "Failed to find necessary symbols\n");
-        return 3;
+    printf(" max %fus\n", hist->max/clks_per_us);
+    if (!f)
+        return;
+    fprintf(f, "  \"%s\": {\"count\": %llu, \"min_us\": %f, \"mean_us\": %f",
+            name, hist->count, min, sl_hist_mean(hist)/clks_per_us);
+    for (i=0; i<4; i++) {
+        fprintf(f, ", \"%s_us\": %f", fraction_names[i],
+                sl_hist_percentile(hist, fractions[i])/clks_per_us);
     }
+    fprintf(f, ", \"max_us\": %f}%s\n", hist->max/clks_per_us, last ? "" : ",");
+}
 
-    if (nfp_shm_alloc(data_coproc->nfp,
-                      shm_filename, shm_key,
-                      shm_size, 1)==0) {
-        return 4;
-    }
+/*f load_patterns */
+/**
+ * @brief Read a file of patterns, one per line, and upload them to
+ * pattern slot 0 for pattern search work
+ *
+ * @returns Pattern set (to destroy after closing the dcprc), or NULL
+ * on error
+ *
+ */
+static struct dcprc_pattern_set *
+load_patterns(struct dcprc *dcprc, const char *filename)
+{
+    struct dcprc_pattern_set *set;
+    char *patterns[DATA_COPROC_MAX_PATTERNS];
+    size_t lengths[DATA_COPROC_MAX_PATTERNS];
+    char line[DCPRC_PATTERN_MAX_LENGTH+2];
+    int num_patterns;
+    FILE *f;
+    int i;
 
-    data_coproc->shm_base = nfp_shm_data(data_coproc->nfp);
-    memset(data_coproc->shm_base, 0, shm_size);
-    data_coproc->phys_addr[0] = nfp_huge_physical_address(data_coproc->nfp,
-                                                         data_coproc->shm_base,
-                                                         0);
-    if (data_coproc->phys_addr[0] == 0) {
-        fprintf(stderr, "Failed to find physical page mapping\n");
-        return 5;
+    f = fopen(filename, "r");
+    if (!f) {
+        fprintf(stderr, "Failed to open patterns file '%s'\n", filename);
+        return NULL;
     }
-
-    data_coproc->work_queues[0].entries   = (struct dcprc_workq_entry *)data_coproc->shm_base;
-    data_coproc->work_queues[0].phys_addr = nfp_huge_physical_address(data_coproc->nfp,
-                                                                      data_coproc->work_queues[0].entries,
-                                                                      0);
-    data_coproc->work_queues[0].max_entries = 256;
-    data_coproc->work_queues[0].wptr = 0;
-    data_coproc->work_queues[0].rptr = 0;
-
-    struct dcprc_workq_buffer_desc workq;
-    workq.host_physical_address = data_coproc->work_queues[0].phys_addr;
-    workq.max_entries           = data_coproc->work_queues[0].max_entries;
-    workq.wptr                  = data_coproc->work_queues[0].wptr;
-
-    if (nfp_write(data_coproc->nfp, &data_coproc->cls_workq, offsetof(struct dcprc_cls_workq, workqs[0]),
-                  &workq, sizeof(workq))<0) {
-        fprintf(stderr,"Failed to configure firmware with work queues\n");
-        return 6;
+    num_patterns = 0;
+    while (fgets(line, sizeof(line), f)) {
+        size_t length;
+        length = strcspn(line, "\r\n");
+        if (length == 0)
+            continue;
+        if (num_patterns >= (int)(sizeof(patterns)/sizeof(patterns[0]))) {
+            fprintf(stderr, "Too many patterns in '%s'\n", filename);
+            break;
+        }
+        patterns[num_patterns] = strndup(line, length);
+        lengths[num_patterns]  = length;
+        num_patterns++;
     }
+    fclose(f);
 
-    if (nfp_fw_start(data_coproc->nfp)<0) {
-        fprintf(stderr,"Failed to start NFP firmware\n");
-        return 7;
+    set = dcprc_pattern_set_create((const char *const *)patterns, lengths, num_patterns);
+    for (i=0; i<num_patterns; i++) {
+        free(patterns[i]);
     }
-    return 0;
+    if (!set)
+        return NULL;
+    if (dcprc_pattern_upload(dcprc, 0, set) != 0) {
+        dcprc_pattern_set_destroy(set);
+        return NULL;
+    }
+    printf("Uploaded %d patterns from '%s'\n", num_patterns, filename);
+    return set;
 }
 
-/*f data_coproc_shutdown */
+/*f workq_open */
 /**
- * @brief data_coproc_shutdown
- *
- * @param data_coproc Data coprocessor structure already initialized
+ * @brief Create a work queue with the options' flags and commit policy
  *
- * Shuts down the NFP
+ * @returns Work queue, or NULL on error
  *
- **/
-static void
-data_coproc_shutdown(struct data_coproc *data_coproc)
+ */
+static struct dcprc_workq *
+workq_open(struct dcprc *dcprc,
+           struct data_coproc_options *data_coproc_options,
+           int queue)
 {
-    struct dcprc_workq_buffer_desc workq;
-    workq.host_physical_address = 0;
-    workq.max_entries = 0;
-    workq.wptr        = -1;
-    nfp_write(data_coproc->nfp, &data_coproc->cls_workq, offsetof(struct dcprc_cls_workq, workqs[0]),
-              &workq, sizeof(workq));
-    // wait
-    // check coprocessor has shut down
-    nfp_shutdown(data_coproc->nfp);
-}
+    struct dcprc_workq *workq;
+    int flags;
 
-/*f data_coproc_add_work */
-static void
-data_coproc_add_work(struct data_coproc *data_coproc,
-                     int queue,
-                     uint64_t host_physical_address,
-                     uint32_t operand_0,
-                     uint32_t operand_1 )
-{
-    int wptr;
-    int mask;
-    struct dcprc_workq_entry *workq_entry;
-    wptr = data_coproc->work_queues[queue].wptr;
-    mask = data_coproc->work_queues[queue].max_entries-1;
-    workq_entry = &(data_coproc->work_queues[queue].entries[wptr&mask]);
-
-    workq_entry->work.host_physical_address = host_physical_address;
-    workq_entry->work.operand_0 = operand_0;
-    workq_entry->__raw[3] = 0x80000000 | operand_1;
-    data_coproc->work_queues[queue].wptr = (wptr+1) & DCPRC_WORKQ_PTR_CLEAR_MASK;
+    flags = 0;
+    if (data_coproc_options->wptr_mirror)
+        flags |= DCPRC_WORKQ_FLAG_WPTR_MIRROR;
+    workq = dcprc_workq_create(dcprc, queue, data_coproc_options->workq_size, flags);
+    if (workq && data_coproc_options->auto_commit)
+        dcprc_workq_set_commit_policy(workq, &data_coproc_options->commit_policy);
+    return workq;
 }
 
-/*f data_coproc_commit_work */
-static void
-data_coproc_commit_work(struct data_coproc *data_coproc,
-                        int queue )
+/*f workq_commit */
+/**
+ * @brief Commit a batch of work explicitly, unless the commit policy
+ * is left to commit it
+ *
+ */
+static int
+workq_commit(struct dcprc_workq *workq,
+             struct data_coproc_options *data_coproc_options)
 {
-    int wptr;
-    wptr = data_coproc->work_queues[queue].wptr;
-    nfp_write(data_coproc->nfp,
-              &data_coproc->cls_workq,
-              offsetof(struct dcprc_cls_workq, workqs[queue].wptr),
-              &wptr, sizeof(wptr));
+    if (data_coproc_options->auto_commit)
+        return 0;
+    return dcprc_commit(workq);
 }
 
-/*f data_coproc_get_results */
-volatile int fred;
-static struct dcprc_workq_entry *
-data_coproc_get_results(struct data_coproc *data_coproc,
-                        int queue)
+/*f data_sgl_build */
+/**
+ * @brief Build a scatter-gather list of the data in as many pieces as
+ * the list has entries; each piece is added separately, so that the
+ * list has that many entries even though the data is contiguous
+ *
+ * @returns Zero on success, non-zero on error
+ *
+ */
+static int
+data_sgl_build(struct dcprc *dcprc, struct dcprc_sgl *sgl,
+               char *data, int data_size)
 {
-    int rptr;
-    int mask;
-    struct dcprc_workq_entry *workq_entry;
-    int iterations;
+    int num_entries;
+    int ofs;
+    int i;
 
-    rptr = data_coproc->work_queues[queue].rptr;
-    mask = data_coproc->work_queues[queue].max_entries-1;
-    workq_entry = &(data_coproc->work_queues[queue].entries[rptr & mask]);
-    iterations = 0;
-    while (workq_entry->result.not_valid) {
-        int i;
-        for (i=0; i<100; i++) {
-            int j=SL_TIMER_CPU_CLOCKS;
-            j = j;//fred += j;
-            //usleep(10);
-        }
-        iterations++;
-        if (iterations>0x80000) {
-            fprintf(stderr,"%08x %08x %08x %08x\n",
-                    workq_entry->__raw[0],
-                    workq_entry->__raw[1],
-                    workq_entry->__raw[2],
-                    workq_entry->__raw[3] );
-            fprintf(stderr,"Timeout waiting for data %d\n",rptr);
-            exit(4);
-        }
-    };
-    rptr += 1;
-    data_coproc->work_queues[queue].rptr = rptr;
-    return workq_entry;
+    num_entries = sgl->max_entries;
+    if (num_entries > data_size)
+        num_entries = data_size;
+    dcprc_sgl_reset(sgl);
+    ofs = 0;
+    for (i=0; i<num_entries; i++) {
+        int size;
+        size = (data_size - ofs) / (num_entries - i);
+        if (dcprc_sgl_add(dcprc, sgl, data + ofs, size) != 0)
+            return 1;
+        ofs += size;
+    }
+    return 0;
 }
 
-/*f usage */
+/*f verify_results */
 /**
- * Display help
+ * @brief Check the results of the work against those of the host
+ * kernel for the work type
+ *
+ * @returns Zero if all match, non-zero (with an error message
+ * printed) if any do not
+ *
  */
 static int
-usage(int error)
+verify_results(enum dcprc_work_type work_type,
+               const struct dcprc_workq_entry *results,
+               int iterations, int batch_size,
+               uint64_t host_physical_address, uint32_t operand_0,
+               const char *data, int data_size)
 {
-    printf("Help goes here\n");
-    if (error)
-        return 4;
+    int errors;
+    int n;
+
+    errors = 0;
+    for (n=0; n<iterations*batch_size; n++) {
+        struct dcprc_workq_entry expected;
+
+        expected.work.host_physical_address = host_physical_address;
+        expected.work.operand_0 = operand_0;
+        expected.__raw[3] = 0x80000000 | (n % batch_size);
+        dcprc_kernel_complete(work_type, &expected, data, data_size);
+        if (memcmp(&expected, &results[n], sizeof(expected)) != 0) {
+            if (errors < 10) {
+                fprintf(stderr, "Mismatch %d:%d: got %08x %08x %08x %08x expected %08x %08x %08x %08x\n",
+                        n / batch_size, n % batch_size,
+                        results[n].__raw[0], results[n].__raw[1],
+                        results[n].__raw[2], results[n].__raw[3],
+                        expected.__raw[0], expected.__raw[1],
+                        expected.__raw[2], expected.__raw[3]);
+            }
+            errors++;
+        }
+    }
+    if (errors > 0) {
+        fprintf(stderr, "%d of %d results did not match the host kernel\n",
+                errors, iterations*batch_size);
+        return 1;
+    }
+    printf("All %d results match the host kernel\n", iterations*batch_size);
     return 0;
 }
 
 /*f run_test */
-static void
-run_test(struct data_coproc *data_coproc,
+/**
+ * @brief Run batches of work through a work queue, timing them
+ *
+ * @returns Zero on success, non-zero on error (with an error message
+ * printed)
+ *
+ */
+static int
+run_test(struct dcprc *dcprc,
+         struct dcprc_workq *workq,
          struct data_coproc_options *data_coproc_options)
 {
     t_sl_timer timer_run_test;
@@ -301,8 +413,12 @@ run_test(struct data_coproc *data_coproc,
     t_sl_timer timer_add_work;
     uint64_t phys_addr;
     char *data_space;
+    struct dcprc_sgl sgl;
     struct dcprc_workq_entry *log_buffer;
     FILE *log_file;
+    unsigned long long *submit_clks;
+    t_sl_hist *latency;
+    t_sl_hist *stage_latency;
 
     int iterations;
     int batch_size;
@@ -329,30 +445,45 @@ run_test(struct data_coproc *data_coproc,
         log_file=fopen(data_coproc_options->log_filename,"w");
         if (!log_file) {
             fprintf(stderr, "Failed to open log file '%s'\n",data_coproc_options->log_filename);
-            usage(1);
-            return;
+            return usage(1);
         }
+    }
+    if (log_file || (data_coproc_options->verify_work_type >= 0)) {
         log_buffer = malloc(sizeof(struct dcprc_workq_entry)*iterations*batch_size);
         if (log_buffer==NULL) {
             fprintf(stderr, "Failed to malloc log buffer\n");
-            usage(1);
-            return;
+            return usage(1);
         }
     }
 
-    data_space = ((char *)data_coproc->shm_base) + 2*1024*1024;
+    submit_clks = malloc(sizeof(*submit_clks)*batch_size);
+    latency = malloc(sizeof(*latency)*3);
+    if (!submit_clks || !latency) {
+        fprintf(stderr, "Failed to malloc latency histograms\n");
+        return usage(1);
+    }
+    stage_latency = latency+1;
+    sl_hist_init(&latency[0]);
+    sl_hist_init(&stage_latency[0]);
+    sl_hist_init(&stage_latency[1]);
+
+    if (data_coproc_options->sg_entries > 0) {
+        if (dcprc_sgl_init(dcprc, &sgl, data_coproc_options->sg_entries) != 0)
+            return 4;
+    }
+    data_space = dcprc_alloc(dcprc, DATA_SPACE_SIZE, &phys_addr);
+    if (!data_space)
+        return 4;
     if (data_coproc_options->data_filename) {
         FILE *f;
         f = fopen(data_coproc_options->data_filename,"rb");
         if (!f) {
             fprintf(stderr,"Failed to open data-file '%s'\n", data_coproc_options->data_filename);
-            usage(1);
-            return;
+            return usage(1);
         }
-        data_size = fread(data_space, 1, 2*1024*1024, f);
+        data_size = fread(data_space, 1, DATA_SPACE_SIZE, f);
         if (data_size==0) {
-            usage(1);
-            return;
+            return usage(1);
         }
         fclose(f);
     } else {
@@ -361,26 +492,54 @@ run_test(struct data_coproc *data_coproc,
             data_space[i] = i;
         }
     }
+    if (data_coproc_options->sg_entries > 0) {
+        if (data_sgl_build(dcprc, &sgl, data_space, data_size) != 0)
+            return 4;
+    }
     SL_TIMER_EXIT(timer_init);
 
     SL_TIMER_ENTRY(timer_run_test);
-    phys_addr = nfp_huge_physical_address(data_coproc->nfp, data_space, 0);
     for (iter=0; iter<iterations; iter++) {
         int i;
         SL_TIMER_ENTRY(timer_add_work);
         for (i=0; i<batch_size; i++) {
-            data_coproc_add_work(data_coproc, 0, phys_addr, data_size, i );
+            submit_clks[i] = SL_TIMER_CPU_CLOCKS;
+            if (data_coproc_options->sg_entries > 0) {
+                dcprc_submit_sgl(workq, &sgl, i, (void *)(uintptr_t)(i+iter*batch_size));
+            } else {
+                dcprc_submit(workq, phys_addr, data_size, i, (void *)(uintptr_t)(i+iter*batch_size));
+            }
         }
         SL_TIMER_EXIT(timer_add_work);
         SL_TIMER_ENTRY(timer_do_work);
-        data_coproc_commit_work(data_coproc, 0);
-        for (i=0; i<batch_size; i++) {
-            struct dcprc_workq_entry *dcprc_workq_entry;
+        if (workq_commit(workq, data_coproc_options) != 0)
+            return 4;
+        i = 0;
+        while (i<batch_size) {
+            struct dcprc_completion completions[DATA_COPROC_REAP_BATCH];
+            unsigned long long reaped_clks;
+            int num, n;
 
-            dcprc_workq_entry = data_coproc_get_results(data_coproc, 0);
-            if (log_buffer) {
-                memcpy(log_buffer+i+iter*batch_size, dcprc_workq_entry, sizeof(*dcprc_workq_entry));
+            num = dcprc_reap_wait(workq, completions, DATA_COPROC_REAP_BATCH, WORK_TIMEOUT_US);
+            if (num <= 0) {
+                fprintf(stderr,"Failed waiting for data %d:%d\n",iter,i);
+                return 4;
+            }
+            reaped_clks = SL_TIMER_CPU_CLOCKS;
+            for (n=0; n<num; n++) {
+                const struct dcprc_workq_entry *result;
+                result = &completions[n].result;
+                sl_hist_record(&latency[0],
+                                    reaped_clks - submit_clks[(uintptr_t)completions[n].cookie % batch_size]);
+                if (data_coproc_options->stage_timestamps) {
+                    sl_hist_record(&stage_latency[0], (uint32_t)(result->__raw[1] - result->__raw[0]));
+                    sl_hist_record(&stage_latency[1], (uint32_t)(result->__raw[2] - result->__raw[1]));
+                }
+                if (log_buffer) {
+                    log_buffer[(uintptr_t)completions[n].cookie] = completions[n].result;
+                }
             }
+            i += num;
         }
         SL_TIMER_EXIT(timer_do_work);
     }
@@ -392,6 +551,70 @@ run_test(struct data_coproc *data_coproc,
     printf("Time doing work (from commit to all work) per work item %fus\n",SL_TIMER_VALUE_US(timer_do_work)/iterations/batch_size);
     printf("Time taken for initialization %fs\n",SL_TIMER_VALUE_US(timer_init)/1000.0/1000.0);
     printf("Time taken for running tests %fs\n",SL_TIMER_VALUE_US(timer_run_test)/1000.0/1000.0);
+    {
+        FILE *f;
+        f = NULL;
+        if (data_coproc_options->latency_filename) {
+            f = fopen(data_coproc_options->latency_filename, "w");
+            if (!f) {
+                fprintf(stderr, "Failed to open latency file '%s'\n", data_coproc_options->latency_filename);
+                return 4;
+            }
+            fprintf(f, "{\n");
+        }
+        latency_hist_print(&latency[0], "submit_to_result", SL_TIMER_x86_CLKS_PER_US, f,
+                           !data_coproc_options->stage_timestamps);
+        if (data_coproc_options->stage_timestamps) {
+            double ticks_per_us = data_coproc_options->me_mhz / DCPRC_STAGE_TICK_CYCLES;
+            latency_hist_print(&stage_latency[0], "gather_to_pickup", ticks_per_us, f, 0);
+            latency_hist_print(&stage_latency[1], "pickup_to_done", ticks_per_us, f, 1);
+        }
+        if (f) {
+            fprintf(f, "}\n");
+            fclose(f);
+        }
+    }
+    free(submit_clks);
+    free(latency);
+    {
+        struct dcprc_workq_stats stats;
+        dcprc_workq_get_stats(workq, &stats);
+        printf("Doorbells %"PRIu64" for %"PRIu64" work items, %f doorbells per work item\n",
+               stats.doorbells, stats.items, ((double)stats.doorbells)/stats.items);
+        printf("Doorbells explicit %"PRIu64" count %"PRIu64" time %"PRIu64" drain %"PRIu64" wait %"PRIu64"\n",
+               stats.flush_explicit, stats.flush_count, stats.flush_time,
+               stats.flush_drain, stats.flush_wait);
+    }
+
+    if (data_coproc_options->cpu_reference_work_type >= 0) {
+        t_sl_timer timer_cpu;
+        struct dcprc_workq_entry entry;
+        int i;
+
+        SL_TIMER_INIT(timer_cpu);
+        SL_TIMER_ENTRY(timer_cpu);
+        for (i=0; i<iterations*batch_size; i++) {
+            entry.work.host_physical_address = phys_addr;
+            entry.work.operand_0 = data_size;
+            entry.__raw[3] = 0x80000000 | (i % batch_size);
+            dcprc_kernel_complete(data_coproc_options->cpu_reference_work_type,
+                                  &entry, data_space, data_size);
+        }
+        SL_TIMER_EXIT(timer_cpu);
+        printf("CPU (%s) %s time per work item %fus\n",
+               dcprc_kernel_isa_name(dcprc_kernel_selected()),
+               work_type_name(data_coproc_options->cpu_reference_work_type),
+               SL_TIMER_VALUE_US(timer_cpu)/iterations/batch_size);
+    }
+
+    if (data_coproc_options->verify_work_type >= 0) {
+        if (verify_results(data_coproc_options->verify_work_type, log_buffer,
+                           iterations, batch_size,
+                           (data_coproc_options->sg_entries > 0) ? sgl.phys_addr : phys_addr,
+                           (data_coproc_options->sg_entries > 0) ? (DCPRC_WORK_SGL | sgl.num_entries) : data_size,
+                           data_space, data_size) != 0)
+            return 4;
+    }
 
     if (log_file) {
         int i, n;
@@ -410,6 +633,270 @@ run_test(struct data_coproc *data_coproc,
         fclose(log_file);
         log_file = NULL;
     }
+    return 0;
+}
+
+/*f run_hybrid_mode */
+/**
+ * @brief Run work items of mixed sizes (from 64 bytes to the data
+ * size, doubling) through a hybrid dispatcher in a mode
+ *
+ * @returns Work items per microsecond, or a negative value on error
+ * (with an error message printed)
+ *
+ */
+static double
+run_hybrid_mode(struct dcprc_workq *workq,
+                struct data_coproc_options *data_coproc_options,
+                enum dcprc_hybrid_mode mode,
+                const char *data_space, uint64_t phys_addr, int data_size)
+{
+    static const char *mode_names[] = {"auto", "NFP only", "CPU only"};
+    struct dcprc_hybrid_config config;
+    struct dcprc_hybrid_stats stats;
+    struct dcprc_hybrid *hybrid;
+    t_sl_timer timer;
+    int total, submitted, reaped;
+    uint32_t size;
+
+    config.work_type           = data_coproc_options->hybrid_work_type;
+    config.mode                = mode;
+    config.max_nfp_outstanding = data_coproc_options->batch_size;
+    config.cpu_max_size        = 0;
+    hybrid = dcprc_hybrid_create(workq, &config);
+    if (!hybrid)
+        return -1;
+
+    total = data_coproc_options->iterations * data_coproc_options->batch_size;
+    submitted = 0;
+    reaped = 0;
+    size = 64;
+    SL_TIMER_INIT(timer);
+    SL_TIMER_ENTRY(timer);
+    while (reaped < total) {
+        struct dcprc_completion completions[DATA_COPROC_REAP_BATCH];
+        int num;
+        int rc;
+
+        rc = 0;
+        while ((submitted < total) && (rc == 0)) {
+            rc = dcprc_hybrid_submit(hybrid, data_space, phys_addr, size, submitted & 0xffff, NULL);
+            if ((rc < 0) || (rc == DCPRC_SUBMIT_NOT_QUEUED))
+                break;
+            /* A failed commit is retried by dcprc_hybrid_commit below */
+            submitted++;
+            size = size*2;
+            if (size > data_size) size = 64;
+        }
+        if (rc < 0) {
+            fprintf(stderr,"Hybrid work type %d is not supported by the CPU\n",config.work_type);
+            break;
+        }
+        if (dcprc_hybrid_commit(hybrid) != 0) {
+            fprintf(stderr,"Failed to commit hybrid work after %d items\n",submitted);
+            break;
+        }
+        num = dcprc_hybrid_reap(hybrid, completions, DATA_COPROC_REAP_BATCH, WORK_TIMEOUT_US);
+        if (num <= 0) {
+            fprintf(stderr,"Failed waiting for hybrid work after %d items\n",reaped);
+            break;
+        }
+        reaped += num;
+    }
+    SL_TIMER_EXIT(timer);
+    dcprc_hybrid_get_stats(hybrid, &stats);
+    dcprc_hybrid_destroy(hybrid);
+    if (reaped < total)
+        return -1;
+
+    printf("Hybrid %s: %f work items per us, NFP %"PRIu64" items %"PRIu64" bytes, CPU %"PRIu64" items (%"PRIu64" for depth) %"PRIu64" bytes, CPU up to size %u\n",
+           mode_names[mode], total/SL_TIMER_VALUE_US(timer),
+           stats.items_nfp, stats.bytes_nfp,
+           stats.items_cpu, stats.items_cpu_depth, stats.bytes_cpu,
+           stats.cpu_max_size);
+    return total/SL_TIMER_VALUE_US(timer);
+}
+
+/*f run_hybrid */
+/**
+ * @brief Run mixed-size work NFP only, CPU only and through the
+ * hybrid dispatcher, reporting the throughput gained
+ *
+ * @returns Zero on success, non-zero on error (with an error message
+ * printed)
+ *
+ */
+static int
+run_hybrid(struct dcprc *dcprc,
+           struct dcprc_workq *workq,
+           struct data_coproc_options *data_coproc_options)
+{
+    double nfp_rate, cpu_rate, hybrid_rate;
+    uint64_t phys_addr;
+    char *data_space;
+    int data_size;
+    int i;
+
+    data_size  = data_coproc_options->data_size;
+    if (data_size<64) data_size=64;
+    if (data_size>DATA_SPACE_SIZE) data_size=DATA_SPACE_SIZE;
+    data_space = dcprc_alloc(dcprc, DATA_SPACE_SIZE, &phys_addr);
+    if (!data_space)
+        return 4;
+    for (i=0; i<data_size; i++) {
+        data_space[i] = i;
+    }
+    printf("CPU kernels %s\n", dcprc_kernel_isa_name(dcprc_kernel_selected()));
+
+    nfp_rate    = run_hybrid_mode(workq, data_coproc_options, DCPRC_HYBRID_NFP_ONLY,
+                                  data_space, phys_addr, data_size);
+    cpu_rate    = run_hybrid_mode(workq, data_coproc_options, DCPRC_HYBRID_CPU_ONLY,
+                                  data_space, phys_addr, data_size);
+    hybrid_rate = run_hybrid_mode(workq, data_coproc_options, DCPRC_HYBRID_AUTO,
+                                  data_space, phys_addr, data_size);
+    dcprc_free(dcprc, data_space, DATA_SPACE_SIZE);
+    if ((nfp_rate < 0) || (cpu_rate < 0) || (hybrid_rate < 0))
+        return 4;
+    printf("Hybrid throughput gain %f over NFP only, %f over CPU only\n",
+           hybrid_rate/nfp_rate, hybrid_rate/cpu_rate);
+    return 0;
+}
+
+/*f submitter_thread */
+/**
+ * @brief Submit batches of work through a work queue owned by the
+ * thread, between the start and stop barriers
+ */
+static void *
+submitter_thread(void *handle)
+{
+    struct data_coproc_submitter *submitter;
+    struct dcprc_workq *workq;
+    int batch_size;
+    int iter;
+
+    submitter = (struct data_coproc_submitter *)handle;
+    batch_size = submitter->data_coproc_options->batch_size;
+    workq = workq_open(submitter->dcprc, submitter->data_coproc_options, -1);
+    if (!workq)
+        submitter->error = 1;
+
+    pthread_barrier_wait(submitter->barrier);
+    for (iter=0; workq && (iter<submitter->data_coproc_options->iterations); iter++) {
+        int i;
+        for (i=0; i<batch_size; i++) {
+            dcprc_add_work(workq, submitter->phys_addr, submitter->data_size, i);
+        }
+        if (workq_commit(workq, submitter->data_coproc_options) != 0) {
+            submitter->error = 2;
+            break;
+        }
+        for (i=0; i<batch_size; i++) {
+            struct dcprc_workq_entry dcprc_workq_entry;
+            if (dcprc_wait_result(workq, &dcprc_workq_entry, WORK_TIMEOUT_US) != 0) {
+                fprintf(stderr,"Timeout waiting for data on work queue %d\n",
+                        dcprc_workq_number(workq));
+                submitter->error = 3;
+                break;
+            }
+            submitter->items++;
+        }
+        if (submitter->error)
+            break;
+    }
+    pthread_barrier_wait(submitter->barrier);
+
+    if (workq) {
+        struct dcprc_workq_stats stats;
+        dcprc_workq_get_stats(workq, &stats);
+        submitter->doorbells = stats.doorbells;
+        dcprc_workq_destroy(workq);
+    }
+    return NULL;
+}
+
+/*f run_benchmark */
+/**
+ * @brief Run the work from 1 to 'threads' submitter threads, each
+ * with its own work queue, reporting the throughput for each
+ *
+ * @returns Zero on success, non-zero on error (with an error message
+ * printed)
+ *
+ */
+static int
+run_benchmark(struct dcprc *dcprc,
+              struct data_coproc_options *data_coproc_options)
+{
+    struct data_coproc_submitter *submitters;
+    pthread_barrier_t barrier;
+    uint64_t phys_addr;
+    char *data_space;
+    int data_size;
+    int threads;
+    int i;
+
+    data_size  = data_coproc_options->data_size;
+    if (data_size<64) data_size=64;
+    if (data_size>DATA_SPACE_SIZE) data_size=DATA_SPACE_SIZE;
+    if (data_coproc_options->iterations<1) data_coproc_options->iterations=1;
+
+    data_space = dcprc_alloc(dcprc, DATA_SPACE_SIZE, &phys_addr);
+    if (!data_space)
+        return 4;
+    for (i=0; i<data_size; i++) {
+        data_space[i] = i;
+    }
+
+    submitters = calloc(data_coproc_options->threads, sizeof(*submitters));
+    if (!submitters)
+        return 4;
+    for (threads=1; threads<=data_coproc_options->threads; threads++) {
+        t_sl_timer timer_run;
+        int items;
+        uint64_t doorbells;
+        int error;
+
+        pthread_barrier_init(&barrier, NULL, threads+1);
+        for (i=0; i<threads; i++) {
+            memset(&submitters[i], 0, sizeof(submitters[i]));
+            submitters[i].dcprc               = dcprc;
+            submitters[i].data_coproc_options = data_coproc_options;
+            submitters[i].barrier             = &barrier;
+            submitters[i].phys_addr           = phys_addr;
+            submitters[i].data_size           = data_size;
+            pthread_create(&submitters[i].thread, NULL, submitter_thread, &submitters[i]);
+        }
+
+        SL_TIMER_INIT(timer_run);
+        pthread_barrier_wait(&barrier);
+        SL_TIMER_ENTRY(timer_run);
+        pthread_barrier_wait(&barrier);
+        SL_TIMER_EXIT(timer_run);
+
+        items = 0;
+        doorbells = 0;
+        error = 0;
+        for (i=0; i<threads; i++) {
+            pthread_join(submitters[i].thread, NULL);
+            items += submitters[i].items;
+            doorbells += submitters[i].doorbells;
+            if (submitters[i].error)
+                error = submitters[i].error;
+        }
+        pthread_barrier_destroy(&barrier);
+        if (error) {
+            fprintf(stderr,"Benchmark failed with %d submitter threads (%d)\n",threads,error);
+            free(submitters);
+            return 4;
+        }
+        printf("Submitter threads %d: %d work items in %fus, %f work items per us, %f doorbells per work item\n",
+               threads, items, SL_TIMER_VALUE_US(timer_run),
+               items/SL_TIMER_VALUE_US(timer_run),
+               ((double)doorbells)/items);
+    }
+    free(submitters);
+    return 0;
 }
 
 /*f read_options */
@@ -424,7 +911,22 @@ read_options(int argc, char **argv, struct data_coproc_options *data_coproc_opti
     data_coproc_options->firmware="firmware/nffw/data_coproc_null_one.nffw";
     data_coproc_options->data_filename=NULL;
     data_coproc_options->log_filename=NULL;
+    data_coproc_options->patterns_filename=NULL;
+    data_coproc_options->latency_filename=NULL;
+    data_coproc_options->stage_timestamps=0;
+    data_coproc_options->me_mhz=1200;
     data_coproc_options->data_size=0;
+    data_coproc_options->workq_size=256;
+    data_coproc_options->threads=0;
+    data_coproc_options->sg_entries=0;
+    data_coproc_options->verify_work_type=-1;
+    data_coproc_options->cpu_reference_work_type=-1;
+    data_coproc_options->hybrid_work_type=-1;
+    data_coproc_options->wptr_mirror=0;
+    data_coproc_options->auto_commit=0;
+    data_coproc_options->commit_policy.max_items=0;
+    data_coproc_options->commit_policy.max_delay_us=-1;
+    data_coproc_options->commit_policy.drain=0;
 
     for (;;) {
         int option_index = 0;
@@ -457,6 +959,60 @@ read_options(int argc, char **argv, struct data_coproc_options *data_coproc_opti
                 return usage(1);
             break;
         }
+        case 'Q': {
+            if (sscanf(optarg,"%d",&data_coproc_options->workq_size)!=1)
+                return usage(1);
+            break;
+        }
+        case 'T': {
+            if (sscanf(optarg,"%d",&data_coproc_options->threads)!=1)
+                return usage(1);
+            break;
+        }
+        case 'c': {
+            if (sscanf(optarg,"%d",&data_coproc_options->commit_policy.max_items)!=1)
+                return usage(1);
+            data_coproc_options->auto_commit = 1;
+            break;
+        }
+        case 'w': {
+            if (sscanf(optarg,"%d",&data_coproc_options->commit_policy.max_delay_us)!=1)
+                return usage(1);
+            data_coproc_options->auto_commit = 1;
+            break;
+        }
+        case 'r': {
+            data_coproc_options->commit_policy.drain = 1;
+            data_coproc_options->auto_commit = 1;
+            break;
+        }
+        case 'm': {
+            data_coproc_options->wptr_mirror = 1;
+            break;
+        }
+        case 'V': {
+            data_coproc_options->verify_work_type = work_type_from_name(optarg);
+            if (data_coproc_options->verify_work_type < 0)
+                return usage(1);
+            break;
+        }
+        case 'H': {
+            data_coproc_options->hybrid_work_type = work_type_from_name(optarg);
+            if (data_coproc_options->hybrid_work_type < 0)
+                return usage(1);
+            break;
+        }
+        case 'C': {
+            data_coproc_options->cpu_reference_work_type = work_type_from_name(optarg);
+            if (data_coproc_options->cpu_reference_work_type < 0)
+                return usage(1);
+            break;
+        }
+        case 'G': {
+            if (sscanf(optarg,"%d",&data_coproc_options->sg_entries)!=1)
+                return usage(1);
+            break;
+        }
         case 'D': {
             data_coproc_options->data_filename = optarg;
             break;
@@ -465,6 +1021,24 @@ read_options(int argc, char **argv, struct data_coproc_options *data_coproc_opti
             data_coproc_options->log_filename = optarg;
             break;
         }
+        case 'P': {
+            data_coproc_options->patterns_filename = optarg;
+            break;
+        }
+        case 'J': {
+            data_coproc_options->latency_filename = optarg;
+            break;
+        }
+        case 't': {
+            data_coproc_options->stage_timestamps = 1;
+            break;
+        }
+        case 'M': {
+            if ((sscanf(optarg,"%lf",&data_coproc_options->me_mhz)!=1) ||
+                (data_coproc_options->me_mhz <= 0))
+                return usage(1);
+            break;
+        }
         case 'h': {
             return usage(0);
         }
@@ -477,7 +1051,22 @@ read_options(int argc, char **argv, struct data_coproc_options *data_coproc_opti
     printf("data_coproc_options->firmware '%s'\n",data_coproc_options->firmware);
     printf("data_coproc_options->data_filename '%s'\n",data_coproc_options->data_filename);
     printf("data_coproc_options->log_filename '%s'\n",data_coproc_options->log_filename);
+    printf("data_coproc_options->patterns_filename '%s'\n",data_coproc_options->patterns_filename);
+    printf("data_coproc_options->latency_filename '%s'\n",data_coproc_options->latency_filename);
+    printf("data_coproc_options->stage_timestamps %d\n",data_coproc_options->stage_timestamps);
+    printf("data_coproc_options->me_mhz %f\n",data_coproc_options->me_mhz);
     printf("data_coproc_options->data_size %d\n",data_coproc_options->data_size);
+    printf("data_coproc_options->workq_size %d\n",data_coproc_options->workq_size);
+    printf("data_coproc_options->threads %d\n",data_coproc_options->threads);
+    printf("data_coproc_options->wptr_mirror %d\n",data_coproc_options->wptr_mirror);
+    printf("data_coproc_options->sg_entries %d\n",data_coproc_options->sg_entries);
+    printf("data_coproc_options->verify_work_type %d\n",data_coproc_options->verify_work_type);
+    printf("data_coproc_options->hybrid_work_type %d\n",data_coproc_options->hybrid_work_type);
+    printf("data_coproc_options->cpu_reference_work_type %d\n",data_coproc_options->cpu_reference_work_type);
+    printf("data_coproc_options->commit_policy %d %d %d\n",
+           data_coproc_options->commit_policy.max_items,
+           data_coproc_options->commit_policy.max_delay_us,
+           data_coproc_options->commit_policy.drain);
     
     return 0;
 }
@@ -491,26 +1080,74 @@ read_options(int argc, char **argv, struct data_coproc_options *data_coproc_opti
 extern int
 main(int argc, char **argv)
 {
-    struct data_coproc data_coproc;
+    struct dcprc_desc dcprc_desc;
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_pattern_set *pattern_set;
     struct data_coproc_options data_coproc_options;
-    size_t shm_size = 16 * 2 * 1024 * 104;
+    int rc;
 
     if (read_options(argc, argv, &data_coproc_options)!=0)
         return 4;
 
-    if (data_coproc_initialize(&data_coproc, &data_coproc_options, shm_size)!=0)
-        return 4;
-
     if ((data_coproc_options.batch_size<1) ||
-        (data_coproc_options.batch_size>data_coproc.work_queues[0].max_entries-1)) {
+        (data_coproc_options.batch_size>data_coproc_options.workq_size)) {
         fprintf(stderr, "Batch size %d out of range 1..%d\n",
                 data_coproc_options.batch_size,
-                data_coproc.work_queues[0].max_entries-1);
+                data_coproc_options.workq_size);
         return 4;
     }
 
-    run_test(&data_coproc, &data_coproc_options);
+    if (data_coproc_options.stage_timestamps &&
+        (data_coproc_options.verify_work_type >= 0)) {
+        fprintf(stderr, "Stage times replace the results, so they cannot be verified\n");
+        return 4;
+    }
 
-    data_coproc_shutdown(&data_coproc);
-    return 0;
+    if ((data_coproc_options.threads<0) ||
+        (data_coproc_options.threads>DCPRC_BENCHMARK_MAX_THREADS)) {
+        fprintf(stderr, "Submitter threads %d out of range 0..%d\n",
+                data_coproc_options.threads,
+                DCPRC_BENCHMARK_MAX_THREADS);
+        return 4;
+    }
+
+    memset(&dcprc_desc, 0, sizeof(dcprc_desc));
+    dcprc_desc.dev_num  = data_coproc_options.dev_num;
+    dcprc_desc.firmware = data_coproc_options.firmware;
+    dcprc_desc.shm_size = 2 * DATA_SPACE_SIZE;
+    dcprc = dcprc_open(&dcprc_desc);
+    if (!dcprc)
+        return 4;
+
+    pattern_set = NULL;
+    if (data_coproc_options.patterns_filename) {
+        pattern_set = load_patterns(dcprc, data_coproc_options.patterns_filename);
+        if (!pattern_set) {
+            dcprc_close(dcprc);
+            return 4;
+        }
+    }
+
+    rc = 4;
+    if (data_coproc_options.threads>0) {
+        rc = run_benchmark(dcprc, &data_coproc_options);
+    } else if (data_coproc_options.hybrid_work_type>=0) {
+        workq = workq_open(dcprc, &data_coproc_options, 0);
+        if (workq) {
+            rc = run_hybrid(dcprc, workq, &data_coproc_options);
+        }
+    } else {
+        workq = workq_open(dcprc, &data_coproc_options, 0);
+        if (workq) {
+            rc = run_test(dcprc, workq, &data_coproc_options);
+        }
+    }
+
+    dcprc_close(dcprc);
+    if (pattern_set) {
+        dcprc_pattern_slot_set(0, NULL);
+        dcprc_pattern_set_destroy(pattern_set);
+    }
+    return rc;
 }
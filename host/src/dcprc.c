@@ -0,0 +1,911 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc.c
+ * @brief         Data coprocessor host library (libdcprc)
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "nfp_support.h"
+#include "timer.h"
+#include "dcprc.h"
+#include "dcprc_pattern.h"
+
+/*a Defines
+ */
+#define DCPRC_DEFAULT_SHM_FILENAME "/tmp/nfp_dcb_shm.lock"
+#define DCPRC_DEFAULT_SHM_KEY      0x0d0c0b0a
+
+/* Physical addresses are contiguous only within a huge page */
+#define DCPRC_HUGE_PAGE_SIZE (2*1024*1024)
+
+/* Bit of __raw[3] of a work queue entry set while the NFP owns it */
+#define DCPRC_ENTRY_VALID_WORK 0x80000000U
+
+/* Space after the work queue entries for the wptr mirror */
+#define DCPRC_WPTR_MIRROR_SIZE 64
+
+/* Completions the completion thread takes from a work queue at a time */
+#define DCPRC_COMPLETION_BATCH 32
+
+/*a Types
+ */
+/*t struct dcprc_ring */
+/**
+ * Ring memory for a work queue number, kept for reuse when the work
+ * queue is destroyed
+ */
+struct dcprc_ring {
+    struct dcprc_workq_entry *entries;
+    uint64_t phys_addr;
+    int      max_entries;
+};
+
+/*t struct dcprc */
+/**
+ * 'workq_ptr' is the firmware's read pointer for each work queue
+ * number when no work queue of that number exists; a new work queue
+ * must start from it
+ *
+ * The mutex covers the shared memory allocation and the work queue
+ * table; work queues themselves are used without locks, except that
+ * the completion thread reaps work queues with callbacks with the
+ * mutex held
+ */
+struct dcprc {
+    pthread_mutex_t mutex;
+    pthread_t completion_thread;
+    int      completion_thread_running;
+    int      completion_thread_stop;
+    struct nfp *nfp;
+    struct nfp_cppid cls_workq;
+    char    *shm_base;
+    size_t   shm_size;
+    size_t   shm_used;
+    struct dcprc_workq *workqs[DCPRC_MAX_WORKQS];
+    struct dcprc_ring   rings[DCPRC_MAX_WORKQS];
+    uint32_t workq_ptr[DCPRC_MAX_WORKQS];
+};
+
+/*t struct dcprc_workq */
+/**
+ * Pointers are free-running; the firmware is given them masked with
+ * DCPRC_WORKQ_PTR_CLEAR_MASK, and an entry is at (ptr & (max_entries-1))
+ *
+ * Entries from rptr to committed belong to the firmware; from
+ * committed to wptr they are added but not yet committed.
+ * 'doorbell_inflight' is the number of entries the firmware had when
+ * last committed to.
+ *
+ * Entries from rptr to committed may be completed and reaped out of
+ * order, with 'reaped' set for them; rptr moves on past reaped
+ * entries. With a callback the completion thread reaps, and so rptr
+ * (and committed) are shared between two threads.
+ */
+struct dcprc_workq {
+    struct dcprc *dcprc;
+    int      queue;
+    int      flags;
+    struct dcprc_workq_entry *entries;
+    uint32_t *wptr_mirror;
+    void   **cookies;
+    uint8_t *reaped;
+    dcprc_completion_fn callback;
+    void    *callback_handle;
+    uint32_t max_entries;
+    uint32_t wptr;
+    uint32_t rptr;
+    uint32_t committed;
+    uint32_t doorbell_inflight;
+    unsigned long long pending_clks; /* When the oldest uncommitted entry was added */
+    struct dcprc_commit_policy policy;
+    struct dcprc_workq_stats stats;
+};
+
+/*a Static functions
+ */
+/*f cpu_relax */
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*f workq_rptr */
+static inline uint32_t
+workq_rptr(const struct dcprc_workq *workq)
+{
+    return __atomic_load_n(&workq->rptr, __ATOMIC_ACQUIRE);
+}
+
+/*f write_workq_desc */
+/**
+ * @brief Write the cluster scratch descriptor of a work queue
+ */
+static int
+write_workq_desc(struct dcprc *dcprc, int queue, uint64_t phys_addr,
+                 uint32_t max_entries, uint32_t wptr)
+{
+    struct dcprc_workq_buffer_desc workq_desc;
+    workq_desc.host_physical_address = phys_addr;
+    workq_desc.max_entries           = max_entries;
+    workq_desc.wptr                  = wptr;
+    if (nfp_write(dcprc->nfp, &dcprc->cls_workq,
+                  offsetof(struct dcprc_cls_workq, workqs[queue]),
+                  &workq_desc, sizeof(workq_desc)) < 0) {
+        fprintf(stderr,"Failed to configure firmware work queue %d\n",queue);
+        return 1;
+    }
+    return 0;
+}
+
+/*f workq_flush */
+/**
+ * @brief Commit the entries added to a work queue, if there are any
+ *
+ * @param workq  Work queue
+ *
+ * @param reason Counter in the work queue stats of flushes for the reason
+ *
+ */
+static int
+workq_flush(struct dcprc_workq *workq, uint64_t *reason)
+{
+    uint32_t wptr;
+
+    if (workq->committed == workq->wptr)
+        return 0;
+    wptr = workq->wptr & DCPRC_WORKQ_PTR_CLEAR_MASK;
+    if (workq->wptr_mirror) {
+        __atomic_store_n(workq->wptr_mirror, wptr, __ATOMIC_RELEASE);
+    } else {
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        if (nfp_write(workq->dcprc->nfp,
+                      &workq->dcprc->cls_workq,
+                      offsetof(struct dcprc_cls_workq, workqs[workq->queue].wptr),
+                      &wptr, sizeof(wptr)) < 0) {
+            fprintf(stderr,"Failed to commit work to work queue %d\n",workq->queue);
+            return 1;
+        }
+    }
+    __atomic_store_n(&workq->committed, workq->wptr, __ATOMIC_RELEASE);
+    workq->doorbell_inflight = workq->committed - workq_rptr(workq);
+    workq->stats.doorbells++;
+    (*reason)++;
+    return 0;
+}
+
+/*f workq_apply_commit_policy */
+/**
+ * @brief Commit the entries added to a work queue if the commit
+ * policy time or drain threshold is reached
+ */
+static int
+workq_apply_commit_policy(struct dcprc_workq *workq)
+{
+    if (workq->committed == workq->wptr)
+        return 0;
+    if ((workq->policy.max_delay_us >= 0) &&
+        (SL_TIMER_CPU_CLOCKS - workq->pending_clks >=
+         ((unsigned long long)workq->policy.max_delay_us) * SL_TIMER_x86_CLKS_PER_US))
+        return workq_flush(workq, &workq->stats.flush_time);
+    if (workq->policy.drain &&
+        ((workq->committed - workq_rptr(workq))*2 <= workq->doorbell_inflight))
+        return workq_flush(workq, &workq->stats.flush_drain);
+    return 0;
+}
+
+/*f workq_reap */
+/**
+ * @brief Take the results of completed work from a work queue in any
+ * order, and free the ring entries that have been taken
+ *
+ * @returns Number of completions taken
+ *
+ */
+static int
+workq_reap(struct dcprc_workq *workq,
+           struct dcprc_completion *completions,
+           int max_completions)
+{
+    uint32_t committed;
+    uint32_t rptr;
+    uint32_t mask;
+    uint32_t ptr;
+    int num;
+
+    committed = __atomic_load_n(&workq->committed, __ATOMIC_ACQUIRE);
+    rptr = workq->rptr;
+    mask = workq->max_entries-1;
+    num = 0;
+    for (ptr=rptr; (ptr!=committed) && (num<max_completions); ptr++) {
+        struct dcprc_workq_entry *workq_entry;
+
+        if (workq->reaped[ptr & mask])
+            continue;
+        workq_entry = &workq->entries[ptr & mask];
+        if (__atomic_load_n(&workq_entry->__raw[3], __ATOMIC_ACQUIRE) & DCPRC_ENTRY_VALID_WORK)
+            continue;
+        completions[num].cookie = workq->cookies[ptr & mask];
+        completions[num].result = *workq_entry;
+        workq->reaped[ptr & mask] = 1;
+        num++;
+    }
+    while ((rptr != committed) && workq->reaped[rptr & mask]) {
+        workq->reaped[rptr & mask] = 0;
+        rptr++;
+    }
+    __atomic_store_n(&workq->rptr, rptr, __ATOMIC_RELEASE);
+    return num;
+}
+
+/*f completion_thread */
+/**
+ * @brief Reap the work queues that have callbacks, and invoke the
+ * callbacks without the mutex held
+ */
+static void *
+completion_thread(void *handle)
+{
+    struct dcprc *dcprc;
+    struct dcprc_completion completions[DCPRC_COMPLETION_BATCH];
+    dcprc_completion_fn callbacks[DCPRC_COMPLETION_BATCH];
+    void *callback_handles[DCPRC_COMPLETION_BATCH];
+
+    dcprc = (struct dcprc *)handle;
+    while (!__atomic_load_n(&dcprc->completion_thread_stop, __ATOMIC_ACQUIRE)) {
+        int total;
+        int i;
+
+        total = 0;
+        for (i=0; i<DCPRC_MAX_WORKQS; i++) {
+            struct dcprc_workq *workq;
+            int num;
+            int j;
+
+            num = 0;
+            pthread_mutex_lock(&dcprc->mutex);
+            workq = dcprc->workqs[i];
+            if (workq && workq->callback) {
+                num = workq_reap(workq, completions, DCPRC_COMPLETION_BATCH);
+                for (j=0; j<num; j++) {
+                    callbacks[j]        = workq->callback;
+                    callback_handles[j] = workq->callback_handle;
+                }
+            }
+            pthread_mutex_unlock(&dcprc->mutex);
+            for (j=0; j<num; j++) {
+                callbacks[j](callback_handles[j], &completions[j]);
+            }
+            total += num;
+        }
+        if (total == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+/*a External functions
+ */
+/*f dcprc_open */
+extern struct dcprc *
+dcprc_open(const struct dcprc_desc *desc)
+{
+    struct dcprc *dcprc;
+    struct dcprc_cls_workq cls_workq;
+    const char *shm_filename;
+    int shm_key;
+    int i;
+
+    dcprc = calloc(1, sizeof(*dcprc));
+    if (!dcprc)
+        return NULL;
+    pthread_mutex_init(&dcprc->mutex, NULL);
+
+    dcprc->nfp = nfp_init(desc->dev_num, 1);
+    if (!dcprc->nfp) {
+        fprintf(stderr, "Failed to open NFP\n");
+        pthread_mutex_destroy(&dcprc->mutex);
+        free(dcprc);
+        return NULL;
+    }
+
+    if (nfp_fw_load(dcprc->nfp, desc->firmware) < 0) {
+        fprintf(stderr, "Failed to load NFP firmware\n");
+        goto fail;
+    }
+
+    if (nfp_get_rtsym_cppid(dcprc->nfp, "dcprc_init_csrs_included", NULL)<0) {
+        fprintf(stderr, "Firmware is missing CSR initialization (symbol 'dcprc_init_csrs_included' is missing)\n");
+        goto fail;
+    }
+
+    if (nfp_sync_resolve(dcprc->nfp)<0) {
+        fprintf(stderr, "Failed to resolve firmware synchronization configuration - firmware would not start correctly\n");
+        goto fail;
+    }
+
+    if (nfp_get_rtsym_cppid(dcprc->nfp, "cls_workq", &dcprc->cls_workq) < 0) {
+        fprintf(stderr, "Failed to find necessary symbols\n");
+        goto fail;
+    }
+
+    shm_filename = desc->shm_filename;
+    shm_key      = desc->shm_key;
+    if (!shm_filename) {
+        shm_filename = DCPRC_DEFAULT_SHM_FILENAME;
+        shm_key      = DCPRC_DEFAULT_SHM_KEY;
+    }
+    if (nfp_shm_alloc(dcprc->nfp, shm_filename, shm_key, desc->shm_size, 1)==0) {
+        goto fail;
+    }
+    dcprc->shm_base = nfp_shm_data(dcprc->nfp);
+    dcprc->shm_size = desc->shm_size;
+    memset(dcprc->shm_base, 0, dcprc->shm_size);
+
+    /* All work queues are disabled until created */
+    for (i=0; i<DCPRC_MAX_WORKQS; i++) {
+        cls_workq.workqs[i].host_physical_address = 0;
+        cls_workq.workqs[i].max_entries           = 0;
+        cls_workq.workqs[i].wptr                  = -1;
+    }
+    if (nfp_write(dcprc->nfp, &dcprc->cls_workq, 0, &cls_workq, sizeof(cls_workq))<0) {
+        fprintf(stderr,"Failed to configure firmware with work queues\n");
+        goto fail;
+    }
+
+    if (nfp_fw_start(dcprc->nfp)<0) {
+        fprintf(stderr,"Failed to start NFP firmware\n");
+        goto fail;
+    }
+    return dcprc;
+
+fail:
+    nfp_shutdown(dcprc->nfp);
+    pthread_mutex_destroy(&dcprc->mutex);
+    free(dcprc);
+    return NULL;
+}
+
+/*f dcprc_close */
+extern void
+dcprc_close(struct dcprc *dcprc)
+{
+    int i;
+    dcprc_completion_thread_stop(dcprc);
+    for (i=0; i<DCPRC_MAX_WORKQS; i++) {
+        if (dcprc->workqs[i])
+            dcprc_workq_destroy(dcprc->workqs[i]);
+    }
+    nfp_shutdown(dcprc->nfp);
+    pthread_mutex_destroy(&dcprc->mutex);
+    free(dcprc);
+}
+
+/*f shm_alloc */
+/**
+ * @brief Allocate from the shared memory, with the mutex held
+ */
+static void *
+shm_alloc(struct dcprc *dcprc, size_t size, uint64_t *phys_addr)
+{
+    size_t ofs;
+    void *ptr;
+
+    if ((size == 0) || (size > DCPRC_HUGE_PAGE_SIZE))
+        return NULL;
+    ofs = (dcprc->shm_used + 63) &~ 63;
+    if ((ofs % DCPRC_HUGE_PAGE_SIZE) + size > DCPRC_HUGE_PAGE_SIZE)
+        ofs = (ofs + DCPRC_HUGE_PAGE_SIZE-1) &~ (size_t)(DCPRC_HUGE_PAGE_SIZE-1);
+    if (ofs + size > dcprc->shm_size) {
+        fprintf(stderr,"Data coprocessor shared memory exhausted\n");
+        return NULL;
+    }
+    ptr = dcprc->shm_base + ofs;
+    *phys_addr = nfp_huge_physical_address(dcprc->nfp, ptr, 0);
+    if (*phys_addr == 0) {
+        fprintf(stderr, "Failed to find physical page mapping\n");
+        return NULL;
+    }
+    dcprc->shm_used = ofs + size;
+    return ptr;
+}
+
+/*f dcprc_alloc */
+extern void *
+dcprc_alloc(struct dcprc *dcprc, size_t size, uint64_t *phys_addr)
+{
+    void *ptr;
+    pthread_mutex_lock(&dcprc->mutex);
+    ptr = shm_alloc(dcprc, size, phys_addr);
+    pthread_mutex_unlock(&dcprc->mutex);
+    return ptr;
+}
+
+/*f dcprc_free */
+extern void
+dcprc_free(struct dcprc *dcprc, void *ptr, size_t size)
+{
+    pthread_mutex_lock(&dcprc->mutex);
+    if ((char *)ptr + size == dcprc->shm_base + dcprc->shm_used)
+        dcprc->shm_used = (char *)ptr - dcprc->shm_base;
+    pthread_mutex_unlock(&dcprc->mutex);
+}
+
+/*f dcprc_pattern_upload */
+extern int
+dcprc_pattern_upload(struct dcprc *dcprc, int slot,
+                     const struct dcprc_pattern_set *set)
+{
+    const struct dcprc_pattern_automaton *automaton;
+    struct nfp_cppid patterns;
+
+    if ((slot < 0) || (slot >= DCPRC_PATTERN_SLOTS)) {
+        fprintf(stderr, "Pattern slot %d out of range\n", slot);
+        return 1;
+    }
+    if (nfp_get_rtsym_cppid(dcprc->nfp, "dcprc_patterns", &patterns) < 0) {
+        fprintf(stderr, "Firmware has no pattern search automata (symbol 'dcprc_patterns' is missing)\n");
+        return 1;
+    }
+    automaton = dcprc_pattern_set_automaton(set);
+    if (nfp_write(dcprc->nfp, &patterns, slot*DCPRC_PATTERN_SLOT_SIZE,
+                  (void *)automaton, automaton->size) < 0) {
+        fprintf(stderr, "Failed to write pattern search automaton\n");
+        return 1;
+    }
+    dcprc_pattern_slot_set(slot, set);
+    return 0;
+}
+
+/*f dcprc_sgl_init */
+extern int
+dcprc_sgl_init(struct dcprc *dcprc, struct dcprc_sgl *sgl, int max_entries)
+{
+    memset(sgl, 0, sizeof(*sgl));
+    if (max_entries < 1)
+        return 1;
+    sgl->entries = dcprc_alloc(dcprc, max_entries*sizeof(struct dcprc_sg_entry),
+                               &sgl->phys_addr);
+    if (!sgl->entries)
+        return 1;
+    sgl->max_entries = max_entries;
+    return 0;
+}
+
+/*f dcprc_sgl_reset */
+extern void
+dcprc_sgl_reset(struct dcprc_sgl *sgl)
+{
+    sgl->num_entries = 0;
+    sgl->size        = 0;
+}
+
+/*f dcprc_sgl_add */
+extern int
+dcprc_sgl_add(struct dcprc *dcprc, struct dcprc_sgl *sgl, void *ptr, size_t size)
+{
+    char *data;
+    size_t page_size;
+    int num_entries;
+
+    data = (char *)ptr;
+    page_size = getpagesize();
+    if ((data >= dcprc->shm_base) && (data + size <= dcprc->shm_base + dcprc->shm_size))
+        page_size = DCPRC_HUGE_PAGE_SIZE;
+
+    num_entries = sgl->num_entries;
+    while (size > 0) {
+        struct dcprc_sg_entry *sg_entry;
+        uint64_t phys_addr;
+        size_t chunk;
+
+        chunk = page_size - (((uintptr_t)data) & (page_size-1));
+        if (chunk > size)
+            chunk = size;
+        phys_addr = nfp_huge_physical_address(dcprc->nfp, data, 0);
+        if (phys_addr == 0) {
+            fprintf(stderr, "Failed to find physical page mapping for SGL at %p\n", data);
+            sgl->num_entries = num_entries;
+            return 1;
+        }
+        sg_entry = NULL;
+        if (sgl->num_entries > num_entries) {
+            sg_entry = &sgl->entries[sgl->num_entries-1];
+            if ((sg_entry->host_physical_address + sg_entry->size != phys_addr) ||
+                (sg_entry->size + chunk > DCPRC_HUGE_PAGE_SIZE))
+                sg_entry = NULL;
+        }
+        if (sg_entry) {
+            sg_entry->size += chunk;
+        } else {
+            if (sgl->num_entries >= sgl->max_entries) {
+                fprintf(stderr, "Scatter-gather list full (%d entries)\n", sgl->max_entries);
+                sgl->num_entries = num_entries;
+                return 1;
+            }
+            sg_entry = &sgl->entries[sgl->num_entries++];
+            sg_entry->host_physical_address = phys_addr;
+            sg_entry->size                  = chunk;
+            sg_entry->__reserved            = 0;
+        }
+        data += chunk;
+        size -= chunk;
+    }
+    for (; num_entries < sgl->num_entries; num_entries++)
+        sgl->size += sgl->entries[num_entries].size;
+    return 0;
+}
+
+/*f workq_free */
+static void
+workq_free(struct dcprc_workq *workq)
+{
+    free(workq->cookies);
+    free(workq->reaped);
+    free(workq);
+}
+
+/*f workq_create */
+/**
+ * @brief Create a work queue, with the mutex held
+ */
+static struct dcprc_workq *
+workq_create(struct dcprc *dcprc, int queue, int max_entries, int flags)
+{
+    struct dcprc_workq *workq;
+    struct dcprc_ring *ring;
+    uint32_t desc_max_entries;
+
+    if ((max_entries < DCPRC_WORKQ_MIN_ENTRIES) ||
+        (max_entries > DCPRC_WORKQ_MAX_ENTRIES) ||
+        (max_entries & (max_entries-1))) {
+        fprintf(stderr,"Work queue size %d is not a power of two from %d to %d\n",
+                max_entries, DCPRC_WORKQ_MIN_ENTRIES, DCPRC_WORKQ_MAX_ENTRIES);
+        return NULL;
+    }
+    if (queue < 0) {
+        for (queue=0; queue<DCPRC_SCANNED_WORKQS; queue++) {
+            if (!dcprc->workqs[queue])
+                break;
+        }
+        if (queue >= DCPRC_SCANNED_WORKQS) {
+            fprintf(stderr,"No work queue free of the %d the firmware scans\n",
+                    DCPRC_SCANNED_WORKQS);
+            return NULL;
+        }
+    }
+    if ((queue >= DCPRC_SCANNED_WORKQS) || dcprc->workqs[queue]) {
+        fprintf(stderr,"Work queue %d is not available\n",queue);
+        return NULL;
+    }
+
+    ring = &dcprc->rings[queue];
+    if (ring->max_entries < max_entries) {
+        ring->entries = shm_alloc(dcprc,
+                                  max_entries*sizeof(struct dcprc_workq_entry) + DCPRC_WPTR_MIRROR_SIZE,
+                                  &ring->phys_addr);
+        if (!ring->entries)
+            return NULL;
+        ring->max_entries = max_entries;
+    }
+
+    workq = calloc(1, sizeof(*workq));
+    if (!workq)
+        return NULL;
+    workq->cookies = calloc(max_entries, sizeof(void *));
+    workq->reaped  = calloc(max_entries, sizeof(uint8_t));
+    if (!workq->cookies || !workq->reaped) {
+        workq_free(workq);
+        return NULL;
+    }
+    workq->dcprc       = dcprc;
+    workq->queue       = queue;
+    workq->flags       = flags;
+    workq->entries     = ring->entries;
+    workq->max_entries = max_entries;
+    workq->wptr        = dcprc->workq_ptr[queue];
+    workq->rptr        = workq->wptr;
+    workq->committed   = workq->wptr;
+    dcprc_workq_set_commit_policy(workq, NULL);
+    desc_max_entries   = max_entries;
+    if (flags & DCPRC_WORKQ_FLAG_WPTR_MIRROR) {
+        workq->wptr_mirror = (uint32_t *)&workq->entries[max_entries];
+        __atomic_store_n(workq->wptr_mirror, workq->wptr & DCPRC_WORKQ_PTR_CLEAR_MASK,
+                         __ATOMIC_RELEASE);
+        desc_max_entries |= DCPRC_WORKQ_WPTR_MIRROR;
+    }
+    if (write_workq_desc(dcprc, queue, ring->phys_addr, desc_max_entries,
+                         workq->wptr & DCPRC_WORKQ_PTR_CLEAR_MASK) != 0) {
+        workq_free(workq);
+        return NULL;
+    }
+    dcprc->workqs[queue] = workq;
+    return workq;
+}
+
+/*f dcprc_workq_create */
+extern struct dcprc_workq *
+dcprc_workq_create(struct dcprc *dcprc, int queue, int max_entries, int flags)
+{
+    struct dcprc_workq *workq;
+    pthread_mutex_lock(&dcprc->mutex);
+    workq = workq_create(dcprc, queue, max_entries, flags);
+    pthread_mutex_unlock(&dcprc->mutex);
+    return workq;
+}
+
+/*f dcprc_workq_destroy */
+extern void
+dcprc_workq_destroy(struct dcprc_workq *workq)
+{
+    struct dcprc *dcprc;
+
+    dcprc = workq->dcprc;
+    pthread_mutex_lock(&dcprc->mutex);
+    write_workq_desc(dcprc, workq->queue, 0, 0, -1);
+    dcprc->workq_ptr[workq->queue] = workq->wptr & DCPRC_WORKQ_PTR_CLEAR_MASK;
+    dcprc->workqs[workq->queue] = NULL;
+    pthread_mutex_unlock(&dcprc->mutex);
+    workq_free(workq);
+}
+
+/*f dcprc_workq_set_commit_policy */
+extern void
+dcprc_workq_set_commit_policy(struct dcprc_workq *workq,
+                              const struct dcprc_commit_policy *policy)
+{
+    if (policy) {
+        workq->policy = *policy;
+    } else {
+        workq->policy.max_items    = 0;
+        workq->policy.max_delay_us = -1;
+        workq->policy.drain        = 0;
+    }
+}
+
+/*f dcprc_workq_set_callback */
+extern void
+dcprc_workq_set_callback(struct dcprc_workq *workq,
+                         dcprc_completion_fn callback,
+                         void *handle)
+{
+    pthread_mutex_lock(&workq->dcprc->mutex);
+    workq->callback        = callback;
+    workq->callback_handle = handle;
+    pthread_mutex_unlock(&workq->dcprc->mutex);
+}
+
+/*f dcprc_completion_thread_start */
+extern int
+dcprc_completion_thread_start(struct dcprc *dcprc)
+{
+    if (dcprc->completion_thread_running)
+        return 0;
+    dcprc->completion_thread_stop = 0;
+    if (pthread_create(&dcprc->completion_thread, NULL, completion_thread, dcprc) != 0) {
+        fprintf(stderr,"Failed to start data coprocessor completion thread\n");
+        return 1;
+    }
+    dcprc->completion_thread_running = 1;
+    return 0;
+}
+
+/*f dcprc_completion_thread_stop */
+extern void
+dcprc_completion_thread_stop(struct dcprc *dcprc)
+{
+    if (!dcprc->completion_thread_running)
+        return;
+    __atomic_store_n(&dcprc->completion_thread_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(dcprc->completion_thread, NULL);
+    dcprc->completion_thread_running = 0;
+}
+
+/*f dcprc_workq_get_stats */
+extern void
+dcprc_workq_get_stats(const struct dcprc_workq *workq,
+                      struct dcprc_workq_stats *stats)
+{
+    *stats = workq->stats;
+}
+
+/*f dcprc_workq_number */
+extern int
+dcprc_workq_number(const struct dcprc_workq *workq)
+{
+    return workq->queue;
+}
+
+/*f dcprc_workq_max_entries */
+extern int
+dcprc_workq_max_entries(const struct dcprc_workq *workq)
+{
+    return workq->max_entries;
+}
+
+/*f dcprc_workq_outstanding */
+extern int
+dcprc_workq_outstanding(const struct dcprc_workq *workq)
+{
+    return workq->wptr - workq_rptr(workq);
+}
+
+/*f dcprc_add_work */
+extern int
+dcprc_add_work(struct dcprc_workq *workq,
+               uint64_t host_physical_address,
+               uint32_t operand_0,
+               uint32_t operand_1)
+{
+    return dcprc_submit(workq, host_physical_address, operand_0, operand_1, NULL);
+}
+
+/*f dcprc_submit */
+extern int
+dcprc_submit(struct dcprc_workq *workq,
+             uint64_t host_physical_address,
+             uint32_t operand_0,
+             uint32_t operand_1,
+             void *cookie)
+{
+    struct dcprc_workq_entry *workq_entry;
+    int rc;
+
+    if (workq->wptr - workq_rptr(workq) >= workq->max_entries)
+        return DCPRC_SUBMIT_NOT_QUEUED;
+    workq->cookies[workq->wptr & (workq->max_entries-1)] = cookie;
+    workq_entry = &workq->entries[workq->wptr & (workq->max_entries-1)];
+    workq_entry->work.host_physical_address = host_physical_address;
+    workq_entry->work.operand_0 = operand_0;
+    workq_entry->__raw[3] = DCPRC_ENTRY_VALID_WORK | operand_1;
+    if (workq->committed == workq->wptr)
+        workq->pending_clks = SL_TIMER_CPU_CLOCKS;
+    workq->wptr++;
+    workq->stats.items++;
+    if ((workq->policy.max_items > 0) &&
+        (workq->wptr - workq->committed >= (uint32_t)workq->policy.max_items)) {
+        rc = workq_flush(workq, &workq->stats.flush_count);
+    } else {
+        rc = workq_apply_commit_policy(workq);
+    }
+    return (rc != 0) ? DCPRC_SUBMIT_NOT_COMMITTED : 0;
+}
+
+/*f dcprc_submit_sgl */
+extern int
+dcprc_submit_sgl(struct dcprc_workq *workq,
+                 const struct dcprc_sgl *sgl,
+                 uint32_t operand_1,
+                 void *cookie)
+{
+    if (sgl->num_entries == 0)
+        return DCPRC_SUBMIT_NOT_QUEUED;
+    return dcprc_submit(workq, sgl->phys_addr, DCPRC_WORK_SGL | sgl->num_entries,
+                        operand_1, cookie);
+}
+
+/*f dcprc_commit */
+extern int
+dcprc_commit(struct dcprc_workq *workq)
+{
+    return workq_flush(workq, &workq->stats.flush_explicit);
+}
+
+/*f dcprc_poll_result */
+extern int
+dcprc_poll_result(struct dcprc_workq *workq,
+                  struct dcprc_workq_entry *result)
+{
+    struct dcprc_workq_entry *workq_entry;
+
+    if (workq->wptr == workq->rptr)
+        return -1;
+    if (workq_apply_commit_policy(workq) != 0)
+        return -1;
+    if (workq->committed == workq->rptr)
+        return 1;
+    workq_entry = &workq->entries[workq->rptr & (workq->max_entries-1)];
+    if (__atomic_load_n(&workq_entry->__raw[3], __ATOMIC_ACQUIRE) & DCPRC_ENTRY_VALID_WORK)
+        return 1;
+    *result = *workq_entry;
+    __atomic_store_n(&workq->rptr, workq->rptr+1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*f dcprc_wait_result */
+extern int
+dcprc_wait_result(struct dcprc_workq *workq,
+                  struct dcprc_workq_entry *result,
+                  int timeout_us)
+{
+    unsigned long long start_clks;
+    unsigned long long timeout_clks;
+    int rc;
+
+    rc = dcprc_poll_result(workq, result);
+    if (rc != 1)
+        return rc;
+    if (workq->committed == workq->rptr) {
+        if (workq_flush(workq, &workq->stats.flush_wait) != 0)
+            return -1;
+    }
+    start_clks   = SL_TIMER_CPU_CLOCKS;
+    timeout_clks = ((unsigned long long)timeout_us) * SL_TIMER_x86_CLKS_PER_US;
+    for (;;) {
+        cpu_relax();
+        rc = dcprc_poll_result(workq, result);
+        if (rc != 1)
+            return rc;
+        if ((timeout_us >= 0) &&
+            (SL_TIMER_CPU_CLOCKS - start_clks > timeout_clks))
+            return 1;
+    }
+}
+
+/*f dcprc_reap */
+extern int
+dcprc_reap(struct dcprc_workq *workq,
+           struct dcprc_completion *completions,
+           int max_completions)
+{
+    if (workq_apply_commit_policy(workq) != 0)
+        return -1;
+    return workq_reap(workq, completions, max_completions);
+}
+
+/*f dcprc_reap_wait */
+extern int
+dcprc_reap_wait(struct dcprc_workq *workq,
+                struct dcprc_completion *completions,
+                int max_completions,
+                int timeout_us)
+{
+    unsigned long long start_clks;
+    unsigned long long timeout_clks;
+    int num;
+
+    if (workq->wptr == workq->rptr)
+        return 0;
+    if (workq->committed == workq->rptr) {
+        if (workq_flush(workq, &workq->stats.flush_wait) != 0)
+            return -1;
+    }
+    start_clks   = SL_TIMER_CPU_CLOCKS;
+    timeout_clks = ((unsigned long long)timeout_us) * SL_TIMER_x86_CLKS_PER_US;
+    for (;;) {
+        num = workq_reap(workq, completions, max_completions);
+        if (num > 0)
+            return num;
+        if ((timeout_us >= 0) &&
+            (SL_TIMER_CPU_CLOCKS - start_clks > timeout_clks)) {
+            fprintf(stderr,"Timeout waiting for %d work items on work queue %d\n",
+                    workq->wptr - workq->rptr, workq->queue);
+            return -1;
+        }
+        cpu_relax();
+    }
+}
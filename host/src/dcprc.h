@@ -0,0 +1,570 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc.h
+ * @brief         Data coprocessor host library (libdcprc)
+ *
+ * The data coprocessor firmware takes work from up to
+ * DCPRC_MAX_WORKQS host work queues; each work queue is a circular
+ * buffer of struct dcprc_workq_entry in host memory, whose base,
+ * size and write pointer are given to the firmware through the
+ * 'cls_workq' cluster scratch descriptors. The firmware writes each
+ * work queue entry back with its results when the work completes.
+ *
+ * This library loads and starts the firmware, manages the shared
+ * memory that the NFP accesses (work queues and work data), and
+ * provides work queues that may be created and destroyed while the
+ * firmware runs.
+ *
+ * Each submitting thread should own a work queue: a work queue is
+ * used by one thread at a time, and adding work, committing it (a
+ * write of the queue's own write pointer descriptor) and taking
+ * results need no locks. Opening, closing, allocation and work queue
+ * creation and destruction are thread-safe.
+ *
+ * Work added to a work queue is given to the firmware when it is
+ * committed; each commit (a 'doorbell') is a CPP write of the work
+ * queue wptr to the NFP. Commits may be explicit, or made by the
+ * library following a per-work-queue commit policy, so that work
+ * added a little at a time is given to the firmware in batches. With
+ * DCPRC_WORKQ_FLAG_WPTR_MIRROR a commit is just a store to host
+ * memory, which the firmware polls by DMA.
+ *
+ * Results may be taken in submission order (dcprc_poll_result,
+ * dcprc_wait_result), or as a completion queue: each work item
+ * carries a cookie, and dcprc_reap returns every completed item in
+ * whatever order the workers finished. Alternatively a callback may
+ * be set for a work queue, and the completion thread reaps it and
+ * invokes the callback for each completion. Only one of these should
+ * be used for a work queue. Ring entries are freed as soon as they
+ * are reaped, up to the oldest incomplete work item.
+ *
+ * Work data that is not physically contiguous may be given as a
+ * scatter-gather list (SGL); an SGL is built in shared memory from
+ * the physical addresses of each page of the data, and a work item
+ * refers to the SGL. Data need not then be copied into the shared
+ * memory, but it must stay resident (locked, or huge pages) until the
+ * work completes.
+ *
+ * Note that the data_coproc_host.c firmware scans only the first
+ * DCPRC_SCANNED_WORKQS work queue descriptors, so only those work
+ * queues may be created.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _DCPRC_H_
+#define _DCPRC_H_
+
+/*a Includes
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "firmware/data_coproc.h"
+
+/*a Defines
+ */
+/* Work queue sizes; the firmware fetches work in runs that do not
+ * cross a 32-entry boundary, and pointers are 16 bits */
+#define DCPRC_WORKQ_MIN_ENTRIES 32
+#define DCPRC_WORKQ_MAX_ENTRIES ((DCPRC_WORKQ_PTR_CLEAR_MASK+1)/2)
+
+/* Timeout for dcprc_wait_result to wait forever */
+#define DCPRC_WAIT_FOREVER (-1)
+
+/* Flags for dcprc_workq_create */
+#define DCPRC_WORKQ_FLAG_WPTR_MIRROR 1
+
+/* Returns from dcprc_submit: the item was not added (ring full, or
+ * empty list), or it was added but committing it failed; in the
+ * latter case a later dcprc_commit retries the commit */
+#define DCPRC_SUBMIT_NOT_QUEUED    1
+#define DCPRC_SUBMIT_NOT_COMMITTED 2
+
+/*a Types
+ */
+/*t struct dcprc_pattern_set */
+/**
+ * Compiled pattern set, see dcprc_pattern.h
+ */
+struct dcprc_pattern_set;
+
+/*t struct dcprc */
+/**
+ * Opaque handle of a data coprocessor (an NFP running the firmware)
+ */
+struct dcprc;
+
+/*t struct dcprc_workq */
+/**
+ * Opaque handle of a host work queue
+ */
+struct dcprc_workq;
+
+/*t struct dcprc_completion */
+/**
+ * A completed work item: the cookie given with it, and the work
+ * queue entry as written back by the firmware
+ */
+struct dcprc_completion {
+    void *cookie;
+    struct dcprc_workq_entry result;
+};
+
+/*t dcprc_completion_fn */
+/**
+ * Callback invoked from the completion thread for each completion
+ */
+typedef void (*dcprc_completion_fn)(void *handle,
+                                    const struct dcprc_completion *completion);
+
+/*t struct dcprc_sgl */
+/**
+ * A scatter-gather list in shared memory, for work items whose data
+ * is not physically contiguous
+ */
+struct dcprc_sgl {
+    struct dcprc_sg_entry *entries;
+    uint64_t phys_addr;   /* Physical address of 'entries' */
+    int      max_entries;
+    int      num_entries;
+    uint64_t size;        /* Total bytes described */
+};
+
+/*t struct dcprc_desc */
+/**
+ * Description of the data coprocessor to open
+ */
+struct dcprc_desc {
+    int         dev_num;      /* NFP device number */
+    const char *firmware;     /* Data coprocessor nffw to load */
+    size_t      shm_size;     /* Shared memory for work queues and data */
+    const char *shm_filename; /* NULL for the default */
+    int         shm_key;      /* Used with shm_filename */
+};
+
+/*t struct dcprc_commit_policy */
+/**
+ * When the library commits work added to a work queue; work is
+ * committed when any enabled threshold is reached. The thresholds
+ * are checked when work is added and when results are polled for.
+ * With no thresholds enabled (the default) work is committed only by
+ * dcprc_commit, or when dcprc_wait_result waits for uncommitted work.
+ */
+struct dcprc_commit_policy {
+    int max_items;    /* Uncommitted items to commit at; 0 for none */
+    int max_delay_us; /* Age of the oldest uncommitted item to commit at; -1 for none */
+    int drain;        /* Non-zero to commit when half of the work the
+                         firmware had at the last commit has completed */
+};
+
+/*t struct dcprc_workq_stats */
+/**
+ * Work queue statistics; doorbells/items is the doorbells per work item
+ */
+struct dcprc_workq_stats {
+    uint64_t items;          /* Work items added */
+    uint64_t doorbells;      /* Commits made */
+    uint64_t flush_explicit; /* Commits by dcprc_commit */
+    uint64_t flush_count;    /* Commits for max_items */
+    uint64_t flush_time;     /* Commits for max_delay_us */
+    uint64_t flush_drain;    /* Commits for drain */
+    uint64_t flush_wait;     /* Commits by dcprc_wait_result */
+};
+
+/*a Functions
+ */
+/*f dcprc_open */
+/**
+ * @brief Open an NFP, load and start the data coprocessor firmware,
+ * and allocate the shared memory
+ *
+ * @param desc Description of the data coprocessor
+ *
+ * @returns Data coprocessor handle, or NULL on error (with an error
+ * message printed)
+ *
+ */
+extern struct dcprc *dcprc_open(const struct dcprc_desc *desc);
+
+/*f dcprc_close */
+/**
+ * @brief Destroy any remaining work queues and shut down the NFP
+ *
+ */
+extern void dcprc_close(struct dcprc *dcprc);
+
+/*f dcprc_alloc */
+/**
+ * @brief Allocate memory that the NFP can access from the shared memory
+ *
+ * @param dcprc     Data coprocessor
+ *
+ * @param size      Size in bytes; at most a huge page
+ *
+ * @param phys_addr Physical address of the memory, for work items
+ *
+ * @returns Virtual address of the memory, 64B aligned and not
+ * crossing a huge page, or NULL if there is not enough shared memory
+ *
+ * Memory is allocated for the lifetime of the data coprocessor,
+ * unless it is freed with dcprc_free.
+ *
+ */
+extern void *dcprc_alloc(struct dcprc *dcprc, size_t size, uint64_t *phys_addr);
+
+/*f dcprc_free */
+/**
+ * @brief Return memory from dcprc_alloc to the shared memory
+ *
+ * @param dcprc Data coprocessor
+ *
+ * @param ptr   Memory, as returned by dcprc_alloc
+ *
+ * @param size  Size in bytes, as given to dcprc_alloc
+ *
+ * The shared memory is allocated in order, so only the most recent
+ * allocation is returned for reuse; other memory stays allocated
+ * until the data coprocessor is closed. Memory should be freed in the
+ * reverse order of its allocation.
+ *
+ */
+extern void dcprc_free(struct dcprc *dcprc, void *ptr, size_t size);
+
+/*f dcprc_pattern_upload */
+/**
+ * @brief Upload the automaton of a pattern set (dcprc_pattern.h) to a
+ * slot in NFP memory, for pattern search work
+ *
+ * @param dcprc Data coprocessor
+ *
+ * @param slot  Slot, 0 to DCPRC_PATTERN_SLOTS-1
+ *
+ * @param set   Pattern set; it must outlive its use in the slot
+ *
+ * @returns Zero on success, non-zero on error (with an error message
+ * printed)
+ *
+ * No pattern search work should be outstanding for the slot.
+ *
+ */
+extern int dcprc_pattern_upload(struct dcprc *dcprc, int slot,
+                                const struct dcprc_pattern_set *set);
+
+/*f dcprc_workq_create */
+/**
+ * @brief Create a work queue and hand it to the firmware
+ *
+ * @param dcprc       Data coprocessor
+ *
+ * @param queue       Work queue number, below DCPRC_SCANNED_WORKQS,
+ *                    or -1 for any free queue
+ *
+ * @param max_entries Ring size; a power of two from
+ *                    DCPRC_WORKQ_MIN_ENTRIES to DCPRC_WORKQ_MAX_ENTRIES
+ *
+ * @param flags       DCPRC_WORKQ_FLAG_*
+ *
+ * @returns Work queue handle, or NULL on error
+ *
+ */
+extern struct dcprc_workq *dcprc_workq_create(struct dcprc *dcprc,
+                                              int queue,
+                                              int max_entries,
+                                              int flags);
+
+/*f dcprc_workq_destroy */
+/**
+ * @brief Take a work queue away from the firmware and free the handle
+ *
+ * Work outstanding on the queue should have completed first. The
+ * ring memory is kept for a later work queue of the same number.
+ *
+ */
+extern void dcprc_workq_destroy(struct dcprc_workq *workq);
+
+/*f dcprc_workq_set_commit_policy */
+/**
+ * @brief Set the commit policy of a work queue
+ *
+ * @param workq  Work queue
+ *
+ * @param policy Commit policy, or NULL for explicit commits only
+ *
+ */
+extern void dcprc_workq_set_commit_policy(struct dcprc_workq *workq,
+                                          const struct dcprc_commit_policy *policy);
+
+/*f dcprc_workq_set_callback */
+/**
+ * @brief Set (or, with NULL, clear) the completion callback of a work
+ * queue
+ *
+ * While a callback is set, the completion thread (if started) reaps
+ * the work queue; the owning thread only submits and commits, and
+ * the commit policy time threshold is checked only as work is added.
+ *
+ */
+extern void dcprc_workq_set_callback(struct dcprc_workq *workq,
+                                     dcprc_completion_fn callback,
+                                     void *handle);
+
+/*f dcprc_completion_thread_start */
+/**
+ * @brief Start the completion thread, which invokes the work queue
+ * callbacks
+ *
+ * @returns Zero on success, non-zero on error
+ *
+ */
+extern int dcprc_completion_thread_start(struct dcprc *dcprc);
+
+/*f dcprc_completion_thread_stop */
+/**
+ * @brief Stop the completion thread, if started
+ *
+ */
+extern void dcprc_completion_thread_stop(struct dcprc *dcprc);
+
+/*f dcprc_workq_get_stats */
+/**
+ * @brief Get the statistics of a work queue
+ *
+ */
+extern void dcprc_workq_get_stats(const struct dcprc_workq *workq,
+                                  struct dcprc_workq_stats *stats);
+
+/*f dcprc_workq_number */
+/**
+ * @brief Get the firmware work queue number of a work queue
+ *
+ */
+extern int dcprc_workq_number(const struct dcprc_workq *workq);
+
+/*f dcprc_workq_max_entries */
+/**
+ * @brief Get the ring size of a work queue
+ *
+ */
+extern int dcprc_workq_max_entries(const struct dcprc_workq *workq);
+
+/*f dcprc_workq_outstanding */
+/**
+ * @brief Get the number of work items added whose results have not
+ * been taken
+ *
+ */
+extern int dcprc_workq_outstanding(const struct dcprc_workq *workq);
+
+/*f dcprc_add_work */
+/**
+ * @brief Add a work item to a work queue, committing it if the commit
+ * policy requires
+ *
+ * @param workq                 Work queue
+ *
+ * @param host_physical_address Physical address of the work data
+ *
+ * @param operand_0             First operand
+ *
+ * @param operand_1             Second operand (31 bits)
+ *
+ * @returns Zero on success, DCPRC_SUBMIT_NOT_QUEUED if the ring is
+ * full, DCPRC_SUBMIT_NOT_COMMITTED if the item was added but a commit
+ * failed
+ *
+ */
+extern int dcprc_add_work(struct dcprc_workq *workq,
+                          uint64_t host_physical_address,
+                          uint32_t operand_0,
+                          uint32_t operand_1);
+
+/*f dcprc_submit */
+/**
+ * @brief Add a work item with a cookie to a work queue, committing it
+ * if the commit policy requires
+ *
+ * @param cookie Returned with the completion of the work item
+ *
+ * @returns Zero on success, DCPRC_SUBMIT_NOT_QUEUED if the ring is
+ * full, DCPRC_SUBMIT_NOT_COMMITTED if the item was added but a commit
+ * failed
+ *
+ */
+extern int dcprc_submit(struct dcprc_workq *workq,
+                        uint64_t host_physical_address,
+                        uint32_t operand_0,
+                        uint32_t operand_1,
+                        void *cookie);
+
+/*f dcprc_sgl_init */
+/**
+ * @brief Allocate the entries of a scatter-gather list from the
+ * shared memory, and empty it
+ *
+ * @param dcprc       Data coprocessor
+ *
+ * @param sgl         Scatter-gather list to initialize
+ *
+ * @param max_entries Most entries the list may hold
+ *
+ * @returns Zero on success, non-zero if there is not enough shared
+ * memory
+ *
+ * The entries are allocated for the lifetime of the data coprocessor;
+ * the list may be emptied and reused with dcprc_sgl_reset.
+ *
+ */
+extern int dcprc_sgl_init(struct dcprc *dcprc, struct dcprc_sgl *sgl, int max_entries);
+
+/*f dcprc_sgl_reset */
+/**
+ * @brief Empty a scatter-gather list
+ *
+ */
+extern void dcprc_sgl_reset(struct dcprc_sgl *sgl);
+
+/*f dcprc_sgl_add */
+/**
+ * @brief Add a buffer to the end of a scatter-gather list
+ *
+ * @param dcprc Data coprocessor
+ *
+ * @param sgl   Scatter-gather list
+ *
+ * @param ptr   Virtual address of the buffer; in the shared memory, or
+ *              any resident memory
+ *
+ * @param size  Size of the buffer in bytes
+ *
+ * @returns Zero on success, non-zero (with the list unchanged and an
+ * error message printed) if the list is full or a page is not mapped
+ *
+ * The buffer is translated a page at a time (a huge page at a time
+ * within the shared memory); physically adjacent pages are merged in
+ * to one entry.
+ *
+ */
+extern int dcprc_sgl_add(struct dcprc *dcprc, struct dcprc_sgl *sgl,
+                         void *ptr, size_t size);
+
+/*f dcprc_submit_sgl */
+/**
+ * @brief Add a work item whose data is a scatter-gather list to a
+ * work queue, committing it if the commit policy requires
+ *
+ * @param workq     Work queue
+ *
+ * @param sgl       Scatter-gather list; it must not be changed until
+ *                  the work completes
+ *
+ * @param operand_1 Second operand (31 bits); operand_0 is the
+ *                  DCPRC_WORK_SGL flag and number of entries
+ *
+ * @param cookie    Returned with the completion of the work item
+ *
+ * @returns Zero on success, DCPRC_SUBMIT_NOT_QUEUED if the list is
+ * empty or the ring is full, DCPRC_SUBMIT_NOT_COMMITTED if the item
+ * was added but a commit failed
+ *
+ */
+extern int dcprc_submit_sgl(struct dcprc_workq *workq,
+                            const struct dcprc_sgl *sgl,
+                            uint32_t operand_1,
+                            void *cookie);
+
+/*f dcprc_commit */
+/**
+ * @brief Give the work added to a work queue to the firmware, if
+ * there is any not yet given
+ *
+ * @returns Zero on success, non-zero on error
+ *
+ */
+extern int dcprc_commit(struct dcprc_workq *workq);
+
+/*f dcprc_poll_result */
+/**
+ * @brief Take the result of the oldest work item if it has completed
+ *
+ * @param workq  Work queue
+ *
+ * @param result Copy of the completed work queue entry
+ *
+ * @returns Zero if a result was taken, 1 if the oldest work item has
+ * not completed, -1 if no work is outstanding or a commit failed
+ *
+ */
+extern int dcprc_poll_result(struct dcprc_workq *workq,
+                             struct dcprc_workq_entry *result);
+
+/*f dcprc_wait_result */
+/**
+ * @brief Wait for the oldest work item to complete and take its result
+ *
+ * @param workq      Work queue
+ *
+ * @param result     Copy of the completed work queue entry
+ *
+ * @param timeout_us Timeout in microseconds, or DCPRC_WAIT_FOREVER
+ *
+ * @returns Zero if a result was taken, 1 on timeout, -1 if no work is
+ * outstanding or a commit failed
+ *
+ * If the oldest work item has not been committed, it is committed.
+ *
+ */
+extern int dcprc_wait_result(struct dcprc_workq *workq,
+                             struct dcprc_workq_entry *result,
+                             int timeout_us);
+
+/*f dcprc_reap */
+/**
+ * @brief Take every completed work item from a work queue, in any
+ * order
+ *
+ * @param workq           Work queue
+ *
+ * @param completions     Array to fill with the completions
+ *
+ * @param max_completions Size of @p completions
+ *
+ * @returns Number of completions taken, or -1 if a commit failed
+ *
+ */
+extern int dcprc_reap(struct dcprc_workq *workq,
+                      struct dcprc_completion *completions,
+                      int max_completions);
+
+/*f dcprc_reap_wait */
+/**
+ * @brief Wait for at least one work item to complete, and take every
+ * completed work item
+ *
+ * @param timeout_us Timeout in microseconds, or DCPRC_WAIT_FOREVER
+ *
+ * @returns Number of completions taken, zero if no work is
+ * outstanding, or -1 on timeout (with an error message printed) or
+ * if a commit failed
+ *
+ */
+extern int dcprc_reap_wait(struct dcprc_workq *workq,
+                           struct dcprc_completion *completions,
+                           int max_completions,
+                           int timeout_us);
+
+/*a Close guard
+ */
+#endif /* _DCPRC_H_ */
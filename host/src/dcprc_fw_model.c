@@ -0,0 +1,353 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_fw_model.c
+ * @brief         Emulation of the data coprocessor firmware for host tests
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "nfp_support.h"
+#include "dcprc_fw_model.h"
+#include "dcprc_kernels.h"
+#include "dcprc_pattern.h"
+
+/*a Defines
+ */
+#define DCPRC_FW_MODEL_HUGE_PAGE_SIZE (2*1024*1024)
+
+/* CPP ids the model gives symbols, to tell them apart in nfp_write */
+#define DCPRC_FW_MODEL_CPPID_CLS_WORKQ 0
+#define DCPRC_FW_MODEL_CPPID_PATTERNS  1
+
+/*a Types
+ */
+/*t struct dcprc_fw_model_pending */
+/**
+ * A work queue entry gathered from the host, and where it came from
+ */
+struct dcprc_fw_model_pending {
+    struct dcprc_workq_entry *host_entry;
+    struct dcprc_workq_entry  work;
+};
+
+/*t struct nfp */
+/**
+ * The model stands in for the NFP
+ */
+struct nfp {
+    pthread_mutex_t mutex;  /* Covers cls */
+    pthread_t thread;
+    int      running;
+    int      stop;
+    struct dcprc_fw_model_config config;
+    struct dcprc_cls_workq cls;
+    uint32_t rptr[DCPRC_MAX_WORKQS];
+    struct dcprc_fw_model_pending pending[DCPRC_FW_MODEL_MAX_PENDING];
+    int      num_pending;
+    void    *shm;
+    char     patterns[DCPRC_PATTERN_SLOTS*DCPRC_PATTERN_SLOT_SIZE];
+};
+
+/*a Static variables
+ */
+static struct dcprc_fw_model_config model_config = { 1, 0, 1, NULL };
+static struct dcprc_fw_model_stats  model_stats;
+
+/* The current model, for its worker functions */
+static struct nfp *model_nfp;
+
+/*a Static functions
+ */
+/*f model_complete */
+/**
+ * @brief Complete a random pending entry, writing it back to the host
+ * with the valid_work bit written last
+ */
+static void
+model_complete(struct nfp *nfp)
+{
+    struct dcprc_fw_model_pending pending;
+    int n;
+
+    n = rand_r(&nfp->config.seed) % nfp->num_pending;
+    pending = nfp->pending[n];
+    nfp->pending[n] = nfp->pending[nfp->num_pending-1];
+    nfp->num_pending--;
+
+    if (nfp->config.work_fn)
+        nfp->config.work_fn(&pending.work);
+    pending.host_entry->__raw[0] = pending.work.__raw[0];
+    pending.host_entry->__raw[1] = pending.work.__raw[1];
+    pending.host_entry->__raw[2] = pending.work.__raw[2];
+    __atomic_store_n(&pending.host_entry->__raw[3], pending.work.__raw[3] &~ (1U<<31),
+                     __ATOMIC_RELEASE);
+    __atomic_add_fetch(&model_stats.completed, 1, __ATOMIC_RELAXED);
+}
+
+/*f model_gather */
+/**
+ * @brief Gather entries from a host work queue, as the workq manager
+ * and gatherer do
+ *
+ * @returns Number of entries gathered
+ *
+ */
+static int
+model_gather(struct nfp *nfp, int queue)
+{
+    struct dcprc_workq_buffer_desc workq_desc;
+    struct dcprc_workq_entry *entries;
+    uint32_t max_entries;
+    uint32_t wptr;
+    int num;
+
+    pthread_mutex_lock(&nfp->mutex);
+    workq_desc = nfp->cls.workqs[queue];
+    pthread_mutex_unlock(&nfp->mutex);
+
+    if (workq_desc.wptr & (1U<<31))
+        return 0;
+    entries = (struct dcprc_workq_entry *)(uintptr_t)workq_desc.host_physical_address;
+    max_entries = workq_desc.max_entries &~ DCPRC_WORKQ_WPTR_MIRROR;
+    if (!entries || (max_entries == 0))
+        return 0;
+    wptr = workq_desc.wptr;
+    if (workq_desc.max_entries & DCPRC_WORKQ_WPTR_MIRROR)
+        wptr = __atomic_load_n((uint32_t *)&entries[max_entries], __ATOMIC_ACQUIRE);
+    wptr &= DCPRC_WORKQ_PTR_CLEAR_MASK;
+
+    num = 0;
+    while ((nfp->rptr[queue] != wptr) &&
+           (nfp->num_pending < nfp->config.max_pending)) {
+        struct dcprc_fw_model_pending *pending;
+        pending = &nfp->pending[nfp->num_pending++];
+        pending->host_entry = &entries[nfp->rptr[queue] & (max_entries-1)];
+        pending->work       = *pending->host_entry;
+        nfp->rptr[queue] = (nfp->rptr[queue]+1) & DCPRC_WORKQ_PTR_CLEAR_MASK;
+        num++;
+    }
+    return num;
+}
+
+/*f model_thread */
+static void *
+model_thread(void *handle)
+{
+    struct nfp *nfp;
+
+    nfp = (struct nfp *)handle;
+    while (!__atomic_load_n(&nfp->stop, __ATOMIC_ACQUIRE)) {
+        int gathered;
+        int i;
+
+        gathered = 0;
+        for (i=0; i<DCPRC_FW_MODEL_WORKQS; i++) {
+            gathered += model_gather(nfp, i);
+        }
+        if (!nfp->config.stall) {
+            while ((nfp->num_pending > 0) &&
+                   ((nfp->num_pending >= nfp->config.max_pending) || (gathered == 0))) {
+                model_complete(nfp);
+            }
+        }
+        if (gathered == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+/*a Model functions
+ */
+/*f dcprc_fw_model_configure */
+extern void
+dcprc_fw_model_configure(const struct dcprc_fw_model_config *config)
+{
+    model_config = *config;
+    if (model_config.max_pending < 1)
+        model_config.max_pending = 1;
+    if (model_config.max_pending > DCPRC_FW_MODEL_MAX_PENDING)
+        model_config.max_pending = DCPRC_FW_MODEL_MAX_PENDING;
+}
+
+/*f dcprc_fw_model_get_stats */
+extern void
+dcprc_fw_model_get_stats(struct dcprc_fw_model_stats *stats)
+{
+    stats->wptr_writes = __atomic_load_n(&model_stats.wptr_writes, __ATOMIC_RELAXED);
+    stats->completed   = __atomic_load_n(&model_stats.completed, __ATOMIC_RELAXED);
+}
+
+/*f dcprc_fw_model_work_digest */
+extern void
+dcprc_fw_model_work_digest(struct dcprc_workq_entry *entry)
+{
+    /* The digest worker does not take scatter-gather lists */
+    if (entry->work.operand_0 & DCPRC_WORK_SGL) {
+        entry->__raw[0] = 0;
+        entry->__raw[1] = 0;
+        entry->__raw[2] = 0;
+        return;
+    }
+    dcprc_kernel_complete(DCPRC_WORK_TYPE_DIGEST, entry,
+                          (const void *)(uintptr_t)entry->work.host_physical_address,
+                          entry->work.operand_0);
+}
+
+/*f dcprc_fw_model_work_pattern */
+extern void
+dcprc_fw_model_work_pattern(struct dcprc_workq_entry *entry)
+{
+    const struct dcprc_pattern_automaton *automaton;
+    const void *data;
+    uint32_t size;
+    uint32_t slot;
+
+    slot = ((entry->__raw[3] &~ (1U<<31)) >> DCPRC_PATTERN_SLOT_SHIFT) % DCPRC_PATTERN_SLOTS;
+    automaton = (const struct dcprc_pattern_automaton *)
+        (model_nfp->patterns + slot*DCPRC_PATTERN_SLOT_SIZE);
+    data = (const void *)(uintptr_t)entry->work.host_physical_address;
+    size = entry->work.operand_0;
+    entry->__raw[0] = 0;
+    entry->__raw[1] = DCPRC_PATTERN_NO_MATCH;
+    entry->__raw[2] = 0;
+    if ((size & DCPRC_WORK_SGL) || (automaton->num_states == 0))
+        return;
+    dcprc_pattern_search_automaton(automaton, data, size,
+                                   &entry->__raw[0], &entry->__raw[1]);
+}
+
+/*a nfp_support functions
+ */
+/*f nfp_init */
+extern struct nfp *
+nfp_init(int device_num, int sig_term)
+{
+    struct nfp *nfp;
+
+    nfp = calloc(1, sizeof(*nfp));
+    if (!nfp)
+        return NULL;
+    pthread_mutex_init(&nfp->mutex, NULL);
+    nfp->config = model_config;
+    memset(&model_stats, 0, sizeof(model_stats));
+    model_nfp = nfp;
+    return nfp;
+}
+
+/*f nfp_shutdown */
+extern void
+nfp_shutdown(struct nfp *nfp)
+{
+    if (nfp->running) {
+        __atomic_store_n(&nfp->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(nfp->thread, NULL);
+    }
+    pthread_mutex_destroy(&nfp->mutex);
+    free(nfp->shm);
+    free(nfp);
+}
+
+/*f nfp_fw_load */
+extern int
+nfp_fw_load(struct nfp *nfp, const char *filename)
+{
+    return 0;
+}
+
+/*f nfp_fw_start */
+extern int
+nfp_fw_start(struct nfp *nfp)
+{
+    if (pthread_create(&nfp->thread, NULL, model_thread, nfp) != 0)
+        return -1;
+    nfp->running = 1;
+    return 0;
+}
+
+/*f nfp_shm_alloc */
+extern int
+nfp_shm_alloc(struct nfp *nfp, const char *shm_filename,
+              int shm_key, size_t size, int create)
+{
+    size = (size + DCPRC_FW_MODEL_HUGE_PAGE_SIZE-1) &~ (size_t)(DCPRC_FW_MODEL_HUGE_PAGE_SIZE-1);
+    if (posix_memalign(&nfp->shm, DCPRC_FW_MODEL_HUGE_PAGE_SIZE, size) != 0)
+        return 0;
+    return size;
+}
+
+/*f nfp_shm_data */
+extern void *
+nfp_shm_data(struct nfp *nfp)
+{
+    return nfp->shm;
+}
+
+/*f nfp_huge_physical_address */
+extern uint64_t
+nfp_huge_physical_address(struct nfp *nfp, void *ptr, uint64_t ofs)
+{
+    return (uint64_t)(uintptr_t)(((char *)ptr) + ofs);
+}
+
+/*f nfp_get_rtsym_cppid */
+extern int
+nfp_get_rtsym_cppid(struct nfp *nfp, const char *sym_name, struct nfp_cppid *cppid)
+{
+    if (cppid) {
+        memset(cppid, 0, sizeof(*cppid));
+        if (!strcmp(sym_name, "dcprc_patterns"))
+            cppid->cpp_id = DCPRC_FW_MODEL_CPPID_PATTERNS;
+    }
+    return 0;
+}
+
+/*f nfp_sync_resolve */
+extern int
+nfp_sync_resolve(struct nfp *nfp)
+{
+    return 0;
+}
+
+/*f nfp_write */
+/**
+ * libdcprc writes the cls_workq symbol, and dcprc_patterns
+ */
+extern int
+nfp_write(struct nfp *nfp, struct nfp_cppid *cppid, int offset, void *data, ssize_t size)
+{
+    if (cppid->cpp_id == DCPRC_FW_MODEL_CPPID_PATTERNS) {
+        if ((offset < 0) || (offset + size > sizeof(nfp->patterns)))
+            return -1;
+        memcpy(nfp->patterns + offset, data, size);
+        return 0;
+    }
+    if ((offset < 0) || (offset + size > sizeof(nfp->cls)))
+        return -1;
+    if ((size == sizeof(uint32_t)) &&
+        ((offset % sizeof(struct dcprc_workq_buffer_desc)) ==
+         offsetof(struct dcprc_workq_buffer_desc, wptr)))
+        __atomic_add_fetch(&model_stats.wptr_writes, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&nfp->mutex);
+    memcpy(((char *)&nfp->cls) + offset, data, size);
+    pthread_mutex_unlock(&nfp->mutex);
+    return 0;
+}
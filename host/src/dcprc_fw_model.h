@@ -0,0 +1,113 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_fw_model.h
+ * @brief         Emulation of the data coprocessor firmware for host tests
+ *
+ * This provides the nfp_support functions that libdcprc uses, backed
+ * by a thread that does what the data coprocessor firmware does:
+ * scan the 'cls_workq' descriptors (reading the wptr mirror in host
+ * memory where flagged), gather work queue entries from the host
+ * rings, and write each entry back with its result. Up to a number of
+ * gathered entries may be completed in a random order, as the many
+ * worker threads of the firmware do.
+ *
+ * Link with this (and dcprc_kernels.o) instead of nfp_support.o.
+ * Host 'physical' addresses are virtual addresses.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _DCPRC_FW_MODEL_H_
+#define _DCPRC_FW_MODEL_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include "firmware/data_coproc.h"
+
+/*a Defines
+ */
+/* Most entries gathered but not completed */
+#define DCPRC_FW_MODEL_MAX_PENDING 64
+
+/* Work queues scanned, as data_coproc_host.c */
+#define DCPRC_FW_MODEL_WORKQS DCPRC_SCANNED_WORKQS
+
+/*a Types
+ */
+/*t dcprc_fw_model_work_fn */
+/**
+ * Worker function: fill in the result of a work queue entry (whose
+ * valid_work bit the model clears afterwards); NULL for the null
+ * worker, which returns the work unchanged
+ */
+typedef void (*dcprc_fw_model_work_fn)(struct dcprc_workq_entry *entry);
+
+/*t struct dcprc_fw_model_config */
+/**
+ * Configuration of the model for the next nfp_init
+ */
+struct dcprc_fw_model_config {
+    int      max_pending;  /* Entries gathered before completing; 1 is in-order */
+    int      stall;        /* Non-zero to gather work but never complete it */
+    unsigned seed;         /* For the completion order */
+    dcprc_fw_model_work_fn work_fn;
+};
+
+/*t struct dcprc_fw_model_stats */
+/**
+ * What the host did to the model
+ */
+struct dcprc_fw_model_stats {
+    uint64_t wptr_writes;  /* CPP writes of a descriptor wptr alone */
+    uint64_t completed;    /* Work queue entries completed */
+};
+
+/*a Functions
+ */
+/*f dcprc_fw_model_configure */
+/**
+ * @brief Set the configuration the model uses from the next nfp_init
+ *
+ */
+extern void dcprc_fw_model_configure(const struct dcprc_fw_model_config *config);
+
+/*f dcprc_fw_model_get_stats */
+/**
+ * @brief Get the statistics of the current (or last) model
+ *
+ */
+extern void dcprc_fw_model_get_stats(struct dcprc_fw_model_stats *stats);
+
+/*f dcprc_fw_model_work_digest */
+/**
+ * @brief Worker function doing what dcprc_worker_digest.c does, with
+ * the host kernels
+ *
+ */
+extern void dcprc_fw_model_work_digest(struct dcprc_workq_entry *entry);
+
+/*f dcprc_fw_model_work_pattern */
+/**
+ * @brief Worker function doing what dcprc_worker_pattern.c does,
+ * running the automaton uploaded to the model's 'dcprc_patterns'
+ *
+ */
+extern void dcprc_fw_model_work_pattern(struct dcprc_workq_entry *entry);
+
+/*a Close guard
+ */
+#endif /* _DCPRC_FW_MODEL_H_ */
@@ -0,0 +1,365 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_hybrid.c
+ * @brief         Dispatch of data coprocessor work to the NFP or the CPU
+ *
+ * The cost of an item on the CPU is the time the kernel takes, as the
+ * submitting thread does nothing else meanwhile. The cost of an item
+ * on the NFP is its share of the NFP's time: its latency from
+ * submission to reaping divided by the number of items on the NFP
+ * when it was submitted (including itself), as those items are
+ * worked on together.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "timer.h"
+#include "dcprc_hybrid.h"
+
+/*a Defines
+ */
+/* Bit of __raw[3] of a work queue entry set while the NFP owns it */
+#define DCPRC_ENTRY_VALID_WORK 0x80000000U
+
+/* Items of a size class sent to each path before routing by cost */
+#define DCPRC_HYBRID_EXPLORE 8
+
+/* One in this many items of a size class goes to the costlier path,
+ * to keep its measurement current */
+#define DCPRC_HYBRID_PROBE_INTERVAL 32
+
+/* Weight of a new measurement in a cost, as 1/2^n */
+#define DCPRC_HYBRID_COST_SHIFT 3
+
+/*a Types
+ */
+/*t struct dcprc_hybrid_slot */
+/**
+ * An item on the NFP; the slot is its cookie on the work queue
+ */
+struct dcprc_hybrid_slot {
+    void    *cookie;
+    unsigned long long submit_clks;
+    uint32_t nfp_depth;  /* Items on the NFP when submitted, including this */
+    int      size_class;
+    int      next_free;
+};
+
+/*t struct dcprc_hybrid_cost */
+/**
+ * Measured costs of a size class, in CPU clocks
+ */
+struct dcprc_hybrid_cost {
+    uint64_t cpu_clks;
+    uint64_t nfp_clks;
+    uint32_t cpu_samples;
+    uint32_t nfp_samples;
+    uint32_t decisions;
+};
+
+/*t struct dcprc_hybrid */
+struct dcprc_hybrid {
+    struct dcprc_workq *workq;
+    struct dcprc_hybrid_config config;
+    struct dcprc_hybrid_slot *slots;
+    int      free_slot;
+    int      nfp_outstanding;
+    struct dcprc_completion cpu_completions[DCPRC_HYBRID_CPU_QUEUE];
+    int      cpu_head;   /* Next to reap */
+    int      cpu_count;
+    struct dcprc_hybrid_cost costs[DCPRC_HYBRID_SIZE_CLASSES];
+    struct dcprc_hybrid_stats stats;
+};
+
+/*a Static functions
+ */
+/*f size_class */
+static inline int
+size_class(uint32_t size)
+{
+    if (size == 0)
+        return 0;
+    return 32 - __builtin_clz(size);
+}
+
+/*f cost_update */
+static void
+cost_update(uint64_t *cost, uint32_t *samples, uint64_t clks)
+{
+    if (*samples == 0) {
+        *cost = clks;
+    } else {
+        int64_t delta;
+        delta = (int64_t)clks - (int64_t)*cost;
+        *cost = (uint64_t)((int64_t)*cost + delta / (1<<DCPRC_HYBRID_COST_SHIFT));
+    }
+    (*samples)++;
+}
+
+/*f route_to_cpu */
+/**
+ * @brief Decide if an item should be done on the CPU, by size and
+ * cost; queue depths are considered by the caller
+ */
+static int
+route_to_cpu(struct dcprc_hybrid *hybrid, uint32_t size)
+{
+    struct dcprc_hybrid_cost *cost;
+    int to_cpu;
+
+    switch (hybrid->config.mode) {
+    case DCPRC_HYBRID_NFP_ONLY: return 0;
+    case DCPRC_HYBRID_CPU_ONLY: return 1;
+    default: break;
+    }
+    if (hybrid->config.cpu_max_size > 0)
+        return (size <= hybrid->config.cpu_max_size);
+
+    cost = &hybrid->costs[size_class(size)];
+    if (cost->nfp_samples < DCPRC_HYBRID_EXPLORE)
+        return 0;
+    if (cost->cpu_samples < DCPRC_HYBRID_EXPLORE)
+        return 1;
+    to_cpu = (cost->cpu_clks <= cost->nfp_clks);
+    cost->decisions++;
+    if ((cost->decisions % DCPRC_HYBRID_PROBE_INTERVAL) == 0)
+        to_cpu = !to_cpu;
+    return to_cpu;
+}
+
+/*f submit_cpu */
+/**
+ * @brief Complete a work item on the CPU, queueing its completion
+ *
+ * @returns Zero on success, -1 if the CPU does not support the work
+ * type (nothing is then queued)
+ */
+static int
+submit_cpu(struct dcprc_hybrid *hybrid, const void *data, uint64_t phys_addr,
+           uint32_t size, uint32_t operand_1, void *cookie)
+{
+    struct dcprc_completion *completion;
+    struct dcprc_hybrid_cost *cost;
+    unsigned long long clks;
+
+    completion = &hybrid->cpu_completions[(hybrid->cpu_head + hybrid->cpu_count) %
+                                          DCPRC_HYBRID_CPU_QUEUE];
+    completion->cookie = cookie;
+    completion->result.work.host_physical_address = phys_addr;
+    completion->result.work.operand_0 = size;
+    completion->result.__raw[3] = DCPRC_ENTRY_VALID_WORK | operand_1;
+    clks = SL_TIMER_CPU_CLOCKS;
+    if (dcprc_kernel_complete(hybrid->config.work_type, &completion->result, data, size) != 0)
+        return -1;
+    clks = SL_TIMER_CPU_CLOCKS - clks;
+    hybrid->cpu_count++;
+
+    cost = &hybrid->costs[size_class(size)];
+    cost_update(&cost->cpu_clks, &cost->cpu_samples, clks);
+    hybrid->stats.items_cpu++;
+    hybrid->stats.bytes_cpu += size;
+    return 0;
+}
+
+/*f submit_nfp */
+static int
+submit_nfp(struct dcprc_hybrid *hybrid, uint64_t phys_addr,
+           uint32_t size, uint32_t operand_1, void *cookie)
+{
+    struct dcprc_hybrid_slot *slot;
+    int rc;
+
+    slot = &hybrid->slots[hybrid->free_slot];
+    slot->cookie      = cookie;
+    slot->submit_clks = SL_TIMER_CPU_CLOCKS;
+    slot->nfp_depth   = hybrid->nfp_outstanding + 1;
+    slot->size_class  = size_class(size);
+
+    /* The item is added even if its commit then fails, so the slot is
+     * in use; the failure is returned, and dcprc_hybrid_commit retries */
+    rc = dcprc_submit(hybrid->workq, phys_addr, size, operand_1, slot);
+    if (rc == DCPRC_SUBMIT_NOT_QUEUED)
+        return rc;
+    hybrid->free_slot = slot->next_free;
+    hybrid->nfp_outstanding++;
+    hybrid->stats.items_nfp++;
+    hybrid->stats.bytes_nfp += size;
+    return rc;
+}
+
+/*f reap_nfp */
+/**
+ * @brief Replace the slots of reaped NFP completions with the
+ * submitters' cookies, measuring the NFP cost
+ */
+static void
+reap_nfp(struct dcprc_hybrid *hybrid, struct dcprc_completion *completions, int num)
+{
+    unsigned long long now;
+    int i;
+
+    now = SL_TIMER_CPU_CLOCKS;
+    for (i=0; i<num; i++) {
+        struct dcprc_hybrid_slot *slot;
+        struct dcprc_hybrid_cost *cost;
+
+        slot = (struct dcprc_hybrid_slot *)completions[i].cookie;
+        completions[i].cookie = slot->cookie;
+        cost = &hybrid->costs[slot->size_class];
+        cost_update(&cost->nfp_clks, &cost->nfp_samples,
+                    (now - slot->submit_clks) / slot->nfp_depth);
+        slot->next_free = hybrid->free_slot;
+        hybrid->free_slot = slot - hybrid->slots;
+        hybrid->nfp_outstanding--;
+    }
+}
+
+/*a External functions
+ */
+/*f dcprc_hybrid_create */
+extern struct dcprc_hybrid *
+dcprc_hybrid_create(struct dcprc_workq *workq, const struct dcprc_hybrid_config *config)
+{
+    struct dcprc_hybrid *hybrid;
+    int max_entries;
+    int i;
+
+    hybrid = calloc(1, sizeof(*hybrid));
+    if (!hybrid)
+        return NULL;
+    max_entries = dcprc_workq_max_entries(workq);
+    hybrid->slots = calloc(max_entries, sizeof(struct dcprc_hybrid_slot));
+    if (!hybrid->slots) {
+        free(hybrid);
+        return NULL;
+    }
+    for (i=0; i<max_entries; i++)
+        hybrid->slots[i].next_free = i+1;
+    hybrid->workq  = workq;
+    hybrid->config = *config;
+    if ((hybrid->config.max_nfp_outstanding <= 0) ||
+        (hybrid->config.max_nfp_outstanding > max_entries))
+        hybrid->config.max_nfp_outstanding = max_entries;
+    return hybrid;
+}
+
+/*f dcprc_hybrid_destroy */
+extern void
+dcprc_hybrid_destroy(struct dcprc_hybrid *hybrid)
+{
+    free(hybrid->slots);
+    free(hybrid);
+}
+
+/*f dcprc_hybrid_submit */
+extern int
+dcprc_hybrid_submit(struct dcprc_hybrid *hybrid,
+                    const void *data,
+                    uint64_t phys_addr,
+                    uint32_t size,
+                    uint32_t operand_1,
+                    void *cookie)
+{
+    int nfp_room;
+    int cpu_room;
+    int to_cpu;
+
+    nfp_room = ((hybrid->config.mode != DCPRC_HYBRID_CPU_ONLY) &&
+                (hybrid->nfp_outstanding < hybrid->config.max_nfp_outstanding));
+    cpu_room = ((hybrid->config.mode != DCPRC_HYBRID_NFP_ONLY) &&
+                (hybrid->cpu_count < DCPRC_HYBRID_CPU_QUEUE));
+    if (!nfp_room && !cpu_room)
+        return DCPRC_SUBMIT_NOT_QUEUED;
+
+    to_cpu = route_to_cpu(hybrid, size);
+    if (!to_cpu && !nfp_room) {
+        to_cpu = 1;
+        hybrid->stats.items_cpu_depth++;
+    }
+    if (to_cpu && !cpu_room)
+        to_cpu = 0;
+
+    if (to_cpu)
+        return submit_cpu(hybrid, data, phys_addr, size, operand_1, cookie);
+    return submit_nfp(hybrid, phys_addr, size, operand_1, cookie);
+}
+
+/*f dcprc_hybrid_commit */
+extern int
+dcprc_hybrid_commit(struct dcprc_hybrid *hybrid)
+{
+    return dcprc_commit(hybrid->workq);
+}
+
+/*f dcprc_hybrid_outstanding */
+extern int
+dcprc_hybrid_outstanding(const struct dcprc_hybrid *hybrid)
+{
+    return hybrid->nfp_outstanding + hybrid->cpu_count;
+}
+
+/*f dcprc_hybrid_reap */
+extern int
+dcprc_hybrid_reap(struct dcprc_hybrid *hybrid,
+                  struct dcprc_completion *completions,
+                  int max_completions,
+                  int timeout_us)
+{
+    int num;
+    int n;
+
+    num = 0;
+    while ((hybrid->cpu_count > 0) && (num < max_completions)) {
+        completions[num++] = hybrid->cpu_completions[hybrid->cpu_head];
+        hybrid->cpu_head = (hybrid->cpu_head + 1) % DCPRC_HYBRID_CPU_QUEUE;
+        hybrid->cpu_count--;
+    }
+    if ((num == max_completions) || (hybrid->nfp_outstanding == 0))
+        return num;
+
+    if ((num > 0) || (timeout_us == 0)) {
+        n = dcprc_reap(hybrid->workq, completions+num, max_completions-num);
+    } else {
+        n = dcprc_reap_wait(hybrid->workq, completions, max_completions, timeout_us);
+    }
+    if (n < 0)
+        return (num > 0) ? num : -1;
+    reap_nfp(hybrid, completions+num, n);
+    return num + n;
+}
+
+/*f dcprc_hybrid_get_stats */
+extern void
+dcprc_hybrid_get_stats(const struct dcprc_hybrid *hybrid,
+                       struct dcprc_hybrid_stats *stats)
+{
+    int i;
+
+    *stats = hybrid->stats;
+    stats->cpu_max_size = 0;
+    for (i=0; i<DCPRC_HYBRID_SIZE_CLASSES; i++) {
+        const struct dcprc_hybrid_cost *cost;
+        cost = &hybrid->costs[i];
+        if ((cost->cpu_samples >= DCPRC_HYBRID_EXPLORE) &&
+            (cost->nfp_samples >= DCPRC_HYBRID_EXPLORE) &&
+            (cost->cpu_clks <= cost->nfp_clks))
+            stats->cpu_max_size = (i == 32) ? 0xffffffff : ((1U<<i) - 1);
+    }
+}
@@ -0,0 +1,207 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_hybrid.h
+ * @brief         Dispatch of data coprocessor work to the NFP or the CPU
+ *
+ * A hybrid dispatcher takes work items for one work type and does
+ * each either on the NFP, through a work queue, or on the submitting
+ * thread's CPU with the host kernel (dcprc_kernels.h); completions
+ * from both are taken together with dcprc_hybrid_reap.
+ *
+ * Each item is routed by its size, the NFP queue depth and the
+ * measured cost of each path for items of that size. Sizes are in
+ * power-of-two classes; for each class the dispatcher measures the
+ * CPU time to do an item, and the NFP latency from submission to
+ * reaping. An item goes to the CPU if its class is cheaper there, or
+ * if the NFP already has the most outstanding work permitted;
+ * otherwise it goes to the NFP. The first few items of each class
+ * are sent to each path to measure them, and a few percent of items
+ * keep being sent to the slower path so that the measurements
+ * follow the load.
+ *
+ * A dispatcher is used by one thread, as its work queue is.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _DCPRC_HYBRID_H_
+#define _DCPRC_HYBRID_H_
+
+/*a Includes
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "dcprc.h"
+#include "dcprc_kernels.h"
+
+/*a Defines
+ */
+/* Size classes: class n is sizes from 2^(n-1) to 2^n-1 */
+#define DCPRC_HYBRID_SIZE_CLASSES 33
+
+/* Completions done on the CPU that may await reaping */
+#define DCPRC_HYBRID_CPU_QUEUE 256
+
+/*a Types
+ */
+/*t dcprc_hybrid_mode */
+/**
+ * Which paths a dispatcher uses
+ */
+enum dcprc_hybrid_mode {
+    DCPRC_HYBRID_AUTO,
+    DCPRC_HYBRID_NFP_ONLY,
+    DCPRC_HYBRID_CPU_ONLY,
+};
+
+/*t struct dcprc_hybrid */
+/**
+ * Opaque handle of a hybrid dispatcher
+ */
+struct dcprc_hybrid;
+
+/*t struct dcprc_hybrid_config */
+/**
+ * Configuration of a hybrid dispatcher
+ */
+struct dcprc_hybrid_config {
+    enum dcprc_work_type   work_type;
+    enum dcprc_hybrid_mode mode;
+    int      max_nfp_outstanding; /* Items on the NFP before more go to the
+                                     CPU; 0 for the work queue size */
+    uint32_t cpu_max_size;        /* Items up to this size go to the CPU and
+                                     larger to the NFP; 0 to measure */
+};
+
+/*t struct dcprc_hybrid_stats */
+/**
+ * Dispatcher statistics
+ */
+struct dcprc_hybrid_stats {
+    uint64_t items_nfp;       /* Items given to the NFP */
+    uint64_t items_cpu;       /* Items done on the CPU */
+    uint64_t items_cpu_depth; /* ...of which because the NFP was at its depth */
+    uint64_t bytes_nfp;
+    uint64_t bytes_cpu;
+    uint32_t cpu_max_size;    /* Largest size class now routed to the CPU
+                                 (by cost), or 0 if none */
+};
+
+/*a Functions
+ */
+/*f dcprc_hybrid_create */
+/**
+ * @brief Create a hybrid dispatcher using a work queue
+ *
+ * @param workq  Work queue for the NFP path; it should not be used
+ *               other than through the dispatcher
+ *
+ * @param config Configuration
+ *
+ * @returns Dispatcher, or NULL on error
+ *
+ */
+extern struct dcprc_hybrid *dcprc_hybrid_create(struct dcprc_workq *workq,
+                                                const struct dcprc_hybrid_config *config);
+
+/*f dcprc_hybrid_destroy */
+/**
+ * @brief Free a dispatcher; its work should have been reaped
+ *
+ */
+extern void dcprc_hybrid_destroy(struct dcprc_hybrid *hybrid);
+
+/*f dcprc_hybrid_submit */
+/**
+ * @brief Do a work item on the NFP or the CPU
+ *
+ * @param hybrid    Dispatcher
+ *
+ * @param data      Virtual address of the work data, for the CPU
+ *
+ * @param phys_addr Physical address of the work data, for the NFP
+ *
+ * @param size      Size of the work data (operand_0)
+ *
+ * @param operand_1 Second operand (31 bits)
+ *
+ * @param cookie    Returned with the completion of the work item
+ *
+ * @returns Zero if the item was submitted; DCPRC_SUBMIT_NOT_QUEUED if
+ * neither path can take it (the NFP work queue and CPU completions are
+ * full); DCPRC_SUBMIT_NOT_COMMITTED if it was given to the NFP but a
+ * commit failed; -1 if it was given to the CPU and the CPU does not
+ * support the work type
+ *
+ * Work given to the NFP is committed by the work queue's commit
+ * policy, or by dcprc_hybrid_commit; if a commit by the policy fails
+ * the item is still submitted, and dcprc_hybrid_commit retries the
+ * commit. Only on DCPRC_SUBMIT_NOT_QUEUED or -1 is there no completion
+ * for the item.
+ *
+ */
+extern int dcprc_hybrid_submit(struct dcprc_hybrid *hybrid,
+                               const void *data,
+                               uint64_t phys_addr,
+                               uint32_t size,
+                               uint32_t operand_1,
+                               void *cookie);
+
+/*f dcprc_hybrid_commit */
+/**
+ * @brief Commit the work given to the NFP
+ *
+ * @returns Zero on success, non-zero on error
+ *
+ */
+extern int dcprc_hybrid_commit(struct dcprc_hybrid *hybrid);
+
+/*f dcprc_hybrid_outstanding */
+/**
+ * @brief Get the number of work items submitted but not reaped
+ *
+ */
+extern int dcprc_hybrid_outstanding(const struct dcprc_hybrid *hybrid);
+
+/*f dcprc_hybrid_reap */
+/**
+ * @brief Take completed work items from both paths, waiting for at
+ * least one if there are none
+ *
+ * @param timeout_us Timeout in microseconds, DCPRC_WAIT_FOREVER, or
+ *                   zero to not wait
+ *
+ * @returns Number of completions taken (zero if none are outstanding,
+ * or none have completed and @p timeout_us is zero), or -1 on timeout
+ * or error
+ *
+ */
+extern int dcprc_hybrid_reap(struct dcprc_hybrid *hybrid,
+                             struct dcprc_completion *completions,
+                             int max_completions,
+                             int timeout_us);
+
+/*f dcprc_hybrid_get_stats */
+/**
+ * @brief Get the statistics of a dispatcher
+ *
+ */
+extern void dcprc_hybrid_get_stats(const struct dcprc_hybrid *hybrid,
+                                   struct dcprc_hybrid_stats *stats);
+
+/*a Close guard
+ */
+#endif /* _DCPRC_HYBRID_H_ */
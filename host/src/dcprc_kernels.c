@@ -0,0 +1,619 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_kernels.c
+ * @brief         Host implementations of the data coprocessor work types
+ *
+ * The AVX2 and AVX-512 implementations are compiled with target
+ * attributes, so the rest of the host code needs no special flags;
+ * they are only called if the CPU supports them.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "dcprc_kernels.h"
+#include "dcprc_pattern.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DCPRC_KERNELS_X86
+#endif
+
+/*a Defines
+ */
+/* Bit of __raw[3] of a work queue entry set while the NFP owns it */
+#define DCPRC_ENTRY_VALID_WORK 0x80000000U
+
+/* 64-bit words the scalar fetch_sum may add before its 16-bit lanes
+ * could overflow */
+#define FETCH_SUM_SCALAR_FOLD_WORDS 128
+
+/* CRC32C polynomial, bit-reflected */
+#define CRC32C_POLY 0x82f63b78U
+
+/* Bytes of each of the three interleaved CRC32 streams (long and
+ * short) of the SSE4.2 CRC32C */
+#define CRC32C_STREAM_LONG  1024
+#define CRC32C_STREAM_SHORT 128
+
+/* XXH64 primes */
+#define XXH64_PRIME_1 0x9E3779B185EBCA87ULL
+#define XXH64_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define XXH64_PRIME_3 0x165667B19E3779F9ULL
+#define XXH64_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define XXH64_PRIME_5 0x27D4EB2F165667C5ULL
+
+/*a Types
+ */
+/*t fetch_sum_fn */
+typedef uint32_t (*fetch_sum_fn)(uint32_t sum_so_far, const uint8_t *data, size_t size);
+
+/*t crc32c_fn */
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *data, size_t size);
+
+/*a Static variables
+ */
+/* Slicing-by-8 tables for the scalar CRC32C, built at load */
+static uint32_t crc32c_table[8][256];
+
+/* Multipliers to advance a CRC32C over 1 and 2 streams of zeros, for
+ * the SSE4.2 CRC32C (long and short streams) */
+static uint64_t crc32c_stream_shift[2][2];
+
+/*a Scalar kernels
+ */
+/*f fetch_sum_scalar */
+/**
+ * @brief Sum bytes eight at a time, as pairs of bytes in 16-bit lanes
+ * as the firmware does in 32-bit words
+ */
+static uint32_t
+fetch_sum_scalar(uint32_t sum_so_far, const uint8_t *data, size_t size)
+{
+    uint64_t sum;
+
+    sum = sum_so_far;
+    while (size >= 8) {
+        uint64_t lanes;
+        int n;
+
+        lanes = 0;
+        for (n=0; (n<FETCH_SUM_SCALAR_FOLD_WORDS) && (size>=8); n++) {
+            uint64_t w;
+            memcpy(&w, data, sizeof(w));
+            lanes += (w & 0x00ff00ff00ff00ffULL) + ((w>>8) & 0x00ff00ff00ff00ffULL);
+            data += 8;
+            size -= 8;
+        }
+        sum += ((lanes >>  0) & 0xffff) + ((lanes >> 16) & 0xffff) +
+               ((lanes >> 32) & 0xffff) + ((lanes >> 48) & 0xffff);
+    }
+    while (size > 0) {
+        sum += *data++;
+        size--;
+    }
+    return sum & 0xff;
+}
+
+/*f crc32c_multiply */
+/**
+ * @brief Multiply two bit-reflected polynomials modulo the CRC32C
+ * polynomial
+ */
+static uint32_t
+crc32c_multiply(uint32_t a, uint32_t b)
+{
+    uint32_t m;
+    uint32_t p;
+
+    m = 1U<<31;
+    p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m-1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? ((b>>1) ^ CRC32C_POLY) : (b>>1);
+    }
+    return p;
+}
+
+/*f crc32c_x_pow */
+/**
+ * @brief Get x^n modulo the CRC32C polynomial, bit-reflected
+ */
+static uint32_t
+crc32c_x_pow(uint32_t n)
+{
+    uint32_t p;
+    uint32_t x;
+
+    p = 1U<<31;
+    x = 1U<<30;
+    while (n > 0) {
+        if (n & 1)
+            p = crc32c_multiply(x, p);
+        x = crc32c_multiply(x, x);
+        n >>= 1;
+    }
+    return p;
+}
+
+/*f crc32c_init_tables */
+/**
+ * @brief Build the CRC32C tables at load, so that kernels may be used
+ * from any thread without further initialization
+ */
+__attribute__((constructor))
+static void
+crc32c_init_tables(void)
+{
+    uint32_t crc;
+    int i, j;
+
+    for (i=0; i<256; i++) {
+        crc = i;
+        for (j=0; j<8; j++)
+            crc = (crc & 1) ? ((crc>>1) ^ CRC32C_POLY) : (crc>>1);
+        crc32c_table[0][i] = crc;
+    }
+    for (i=0; i<256; i++) {
+        crc = crc32c_table[0][i];
+        for (j=1; j<8; j++) {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc>>8);
+            crc32c_table[j][i] = crc;
+        }
+    }
+    /* The CRC32 instruction of a carry-less product a.k gives
+     * a.k.x^33, so k is x^(bits-33) to advance a by 'bits' of zeros */
+    crc32c_stream_shift[0][0] = crc32c_x_pow(8*CRC32C_STREAM_LONG-33);
+    crc32c_stream_shift[0][1] = crc32c_x_pow(16*CRC32C_STREAM_LONG-33);
+    crc32c_stream_shift[1][0] = crc32c_x_pow(8*CRC32C_STREAM_SHORT-33);
+    crc32c_stream_shift[1][1] = crc32c_x_pow(16*CRC32C_STREAM_SHORT-33);
+}
+
+/*f crc32c_scalar */
+/**
+ * @brief CRC32C eight bytes at a time, slicing-by-8
+ */
+static uint32_t
+crc32c_scalar(uint32_t crc, const uint8_t *data, size_t size)
+{
+    crc = ~crc;
+    while (size >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, data, sizeof(lo));
+        memcpy(&hi, data+4, sizeof(hi));
+        lo ^= crc;
+        crc = (crc32c_table[7][(lo>> 0)&0xff] ^ crc32c_table[6][(lo>> 8)&0xff] ^
+               crc32c_table[5][(lo>>16)&0xff] ^ crc32c_table[4][(lo>>24)     ] ^
+               crc32c_table[3][(hi>> 0)&0xff] ^ crc32c_table[2][(hi>> 8)&0xff] ^
+               crc32c_table[1][(hi>>16)&0xff] ^ crc32c_table[0][(hi>>24)     ]);
+        data += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        crc = crc32c_table[0][(crc ^ *data++) & 0xff] ^ (crc>>8);
+        size--;
+    }
+    return ~crc;
+}
+
+/*f xxh64_round */
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t lane)
+{
+    acc += lane * XXH64_PRIME_2;
+    acc  = (acc << 31) | (acc >> 33);
+    return acc * XXH64_PRIME_1;
+}
+
+/*f xxh64_merge_round */
+static inline uint64_t
+xxh64_merge_round(uint64_t acc, uint64_t v)
+{
+    acc ^= xxh64_round(0, v);
+    return acc * XXH64_PRIME_1 + XXH64_PRIME_4;
+}
+
+/*f xxh64 */
+/**
+ * @brief XXH64 (little-endian lanes, as the reference implementation)
+ *
+ * Four independent 64-bit multiply chains already keep a core's
+ * multipliers busy, so there is one implementation for all ISAs.
+ */
+static uint64_t
+xxh64(uint64_t seed, const uint8_t *data, size_t size)
+{
+    uint64_t h;
+    size_t total;
+
+    total = size;
+    if (size >= 32) {
+        uint64_t v1, v2, v3, v4;
+        v1 = seed + XXH64_PRIME_1 + XXH64_PRIME_2;
+        v2 = seed + XXH64_PRIME_2;
+        v3 = seed;
+        v4 = seed - XXH64_PRIME_1;
+        while (size >= 32) {
+            uint64_t lanes[4];
+            memcpy(lanes, data, sizeof(lanes));
+            v1 = xxh64_round(v1, lanes[0]);
+            v2 = xxh64_round(v2, lanes[1]);
+            v3 = xxh64_round(v3, lanes[2]);
+            v4 = xxh64_round(v4, lanes[3]);
+            data += 32;
+            size -= 32;
+        }
+        h = (((v1 << 1) | (v1 >> 63)) + ((v2 << 7) | (v2 >> 57)) +
+             ((v3 << 12) | (v3 >> 52)) + ((v4 << 18) | (v4 >> 46)));
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    } else {
+        h = seed + XXH64_PRIME_5;
+    }
+    h += total;
+    while (size >= 8) {
+        uint64_t lane;
+        memcpy(&lane, data, sizeof(lane));
+        h ^= xxh64_round(0, lane);
+        h  = ((h << 27) | (h >> 37)) * XXH64_PRIME_1 + XXH64_PRIME_4;
+        data += 8;
+        size -= 8;
+    }
+    if (size >= 4) {
+        uint32_t lane;
+        memcpy(&lane, data, sizeof(lane));
+        h ^= lane * XXH64_PRIME_1;
+        h  = ((h << 23) | (h >> 41)) * XXH64_PRIME_2 + XXH64_PRIME_3;
+        data += 4;
+        size -= 4;
+    }
+    while (size > 0) {
+        h ^= (*data++) * XXH64_PRIME_5;
+        h  = ((h << 11) | (h >> 53)) * XXH64_PRIME_1;
+        size--;
+    }
+    h ^= h >> 33;
+    h *= XXH64_PRIME_2;
+    h ^= h >> 29;
+    h *= XXH64_PRIME_3;
+    h ^= h >> 32;
+    return h;
+}
+
+#ifdef DCPRC_KERNELS_X86
+/*a SSE4.2 kernels
+ */
+/*f crc32c_sse42_shift */
+/**
+ * @brief Advance a CRC32C state over zeros, by a carry-less multiply
+ * and a CRC32 of the product
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint64_t
+crc32c_sse42_shift(uint64_t crc, uint64_t k)
+{
+    __m128i p;
+    p = _mm_clmulepi64_si128(_mm_cvtsi64_si128(crc), _mm_cvtsi64_si128(k), 0);
+    return _mm_crc32_u64(0, _mm_cvtsi128_si64(p));
+}
+
+/*f crc32c_sse42_streams */
+/**
+ * @brief CRC32C of blocks of three consecutive streams, interleaving
+ * the three CRC32 dependency chains and combining them
+ */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint64_t
+crc32c_sse42_streams(uint64_t crc0, const uint8_t **data_ptr, size_t *size_ptr,
+                     size_t stream, const uint64_t *shift)
+{
+    const uint8_t *data;
+    size_t size;
+
+    data = *data_ptr;
+    size = *size_ptr;
+    while (size >= 3*stream) {
+        uint64_t crc1, crc2;
+        size_t i;
+
+        crc1 = 0;
+        crc2 = 0;
+        for (i=0; i<stream; i+=8) {
+            uint64_t a, b, c;
+            memcpy(&a, data+i, sizeof(a));
+            memcpy(&b, data+stream+i, sizeof(b));
+            memcpy(&c, data+2*stream+i, sizeof(c));
+            crc0 = _mm_crc32_u64(crc0, a);
+            crc1 = _mm_crc32_u64(crc1, b);
+            crc2 = _mm_crc32_u64(crc2, c);
+        }
+        crc0 = (crc32c_sse42_shift(crc0, shift[1]) ^
+                crc32c_sse42_shift(crc1, shift[0]) ^ crc2);
+        data += 3*stream;
+        size -= 3*stream;
+    }
+    *data_ptr = data;
+    *size_ptr = size;
+    return crc0;
+}
+
+/*f crc32c_sse42 */
+/**
+ * @brief CRC32C with the CRC32 instruction, three streams at a time
+ * to cover its latency
+ */
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *data, size_t size)
+{
+    uint64_t crc0;
+
+    crc0 = (uint32_t)~crc;
+    crc0 = crc32c_sse42_streams(crc0, &data, &size, CRC32C_STREAM_LONG,  crc32c_stream_shift[0]);
+    crc0 = crc32c_sse42_streams(crc0, &data, &size, CRC32C_STREAM_SHORT, crc32c_stream_shift[1]);
+    while (size >= 8) {
+        uint64_t w;
+        memcpy(&w, data, sizeof(w));
+        crc0 = _mm_crc32_u64(crc0, w);
+        data += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        crc0 = _mm_crc32_u8(crc0, *data++);
+        size--;
+    }
+    return ~(uint32_t)crc0;
+}
+
+/*a AVX2 kernels
+ */
+/*f fetch_sum_avx2 */
+/**
+ * @brief Sum bytes 128 at a time with VPSADBW, into four 64-bit lanes
+ */
+__attribute__((target("avx2")))
+static uint32_t
+fetch_sum_avx2(uint32_t sum_so_far, const uint8_t *data, size_t size)
+{
+    __m256i zero;
+    __m256i acc;
+    uint64_t lanes[4];
+
+    zero = _mm256_setzero_si256();
+    acc  = _mm256_setzero_si256();
+    while (size >= 128) {
+        __m256i a, b, c, d;
+        a = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(data+ 0)), zero);
+        b = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(data+32)), zero);
+        c = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(data+64)), zero);
+        d = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(data+96)), zero);
+        acc = _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_add_epi64(a, b),
+                                                     _mm256_add_epi64(c, d)));
+        data += 128;
+        size -= 128;
+    }
+    while (size >= 32) {
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)data), zero));
+        data += 32;
+        size -= 32;
+    }
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    sum_so_far += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return fetch_sum_scalar(sum_so_far, data, size);
+}
+
+/*a AVX-512 kernels
+ */
+/*f fetch_sum_avx512 */
+/**
+ * @brief Sum bytes 256 at a time with VPSADBW, finishing with a
+ * masked load
+ */
+__attribute__((target("avx512f,avx512bw")))
+static uint32_t
+fetch_sum_avx512(uint32_t sum_so_far, const uint8_t *data, size_t size)
+{
+    __m512i zero;
+    __m512i acc;
+
+    zero = _mm512_setzero_si512();
+    acc  = _mm512_setzero_si512();
+    while (size >= 256) {
+        __m512i a, b, c, d;
+        a = _mm512_sad_epu8(_mm512_loadu_si512((const void *)(data+  0)), zero);
+        b = _mm512_sad_epu8(_mm512_loadu_si512((const void *)(data+ 64)), zero);
+        c = _mm512_sad_epu8(_mm512_loadu_si512((const void *)(data+128)), zero);
+        d = _mm512_sad_epu8(_mm512_loadu_si512((const void *)(data+192)), zero);
+        acc = _mm512_add_epi64(acc, _mm512_add_epi64(_mm512_add_epi64(a, b),
+                                                     _mm512_add_epi64(c, d)));
+        data += 256;
+        size -= 256;
+    }
+    while (size >= 64) {
+        acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_loadu_si512((const void *)data), zero));
+        data += 64;
+        size -= 64;
+    }
+    if (size > 0) {
+        __mmask64 mask;
+        mask = (~0ULL) >> (64-size);
+        acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_maskz_loadu_epi8(mask, data), zero));
+    }
+    sum_so_far += _mm512_reduce_add_epi64(acc);
+    return sum_so_far & 0xff;
+}
+#endif
+
+/*a Selected implementations
+ */
+static enum dcprc_kernel_isa selected_isa;
+static fetch_sum_fn          fetch_sum_impl;
+static crc32c_fn             crc32c_impl;
+
+/*a External functions
+ */
+/*f dcprc_kernel_isa_supported */
+extern int
+dcprc_kernel_isa_supported(enum dcprc_kernel_isa isa)
+{
+    switch (isa) {
+    case DCPRC_KERNEL_ISA_SCALAR:
+        return 1;
+#ifdef DCPRC_KERNELS_X86
+    case DCPRC_KERNEL_ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case DCPRC_KERNEL_ISA_AVX512:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+        break;
+    }
+    return 0;
+}
+
+/*f dcprc_kernel_isa_name */
+extern const char *
+dcprc_kernel_isa_name(enum dcprc_kernel_isa isa)
+{
+    switch (isa) {
+    case DCPRC_KERNEL_ISA_SCALAR: return "scalar";
+    case DCPRC_KERNEL_ISA_AVX2:   return "avx2";
+    case DCPRC_KERNEL_ISA_AVX512: return "avx512";
+    default: break;
+    }
+    return "best";
+}
+
+/*f dcprc_kernel_select */
+extern int
+dcprc_kernel_select(enum dcprc_kernel_isa isa)
+{
+    if (isa == DCPRC_KERNEL_ISA_BEST) {
+        isa = DCPRC_KERNEL_ISA_SCALAR;
+        if (dcprc_kernel_isa_supported(DCPRC_KERNEL_ISA_AVX2))
+            isa = DCPRC_KERNEL_ISA_AVX2;
+        if (dcprc_kernel_isa_supported(DCPRC_KERNEL_ISA_AVX512))
+            isa = DCPRC_KERNEL_ISA_AVX512;
+    }
+    if (!dcprc_kernel_isa_supported(isa))
+        return -1;
+    crc32c_impl = crc32c_scalar;
+    switch (isa) {
+#ifdef DCPRC_KERNELS_X86
+    case DCPRC_KERNEL_ISA_AVX2:
+        fetch_sum_impl = fetch_sum_avx2;
+        break;
+    case DCPRC_KERNEL_ISA_AVX512:
+        fetch_sum_impl = fetch_sum_avx512;
+        break;
+#endif
+    default:
+        fetch_sum_impl = fetch_sum_scalar;
+        break;
+    }
+#ifdef DCPRC_KERNELS_X86
+    if ((isa != DCPRC_KERNEL_ISA_SCALAR) &&
+        __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul"))
+        crc32c_impl = crc32c_sse42;
+#endif
+    selected_isa = isa;
+    return isa;
+}
+
+/*f dcprc_kernel_selected */
+extern enum dcprc_kernel_isa
+dcprc_kernel_selected(void)
+{
+    if (!fetch_sum_impl)
+        dcprc_kernel_select(DCPRC_KERNEL_ISA_BEST);
+    return selected_isa;
+}
+
+/*f dcprc_kernel_fetch_sum */
+extern uint32_t
+dcprc_kernel_fetch_sum(uint32_t sum_so_far, const void *data, size_t size)
+{
+    if (!fetch_sum_impl)
+        dcprc_kernel_select(DCPRC_KERNEL_ISA_BEST);
+    return fetch_sum_impl(sum_so_far, (const uint8_t *)data, size);
+}
+
+/*f dcprc_kernel_crc32c */
+extern uint32_t
+dcprc_kernel_crc32c(uint32_t crc, const void *data, size_t size)
+{
+    if (!crc32c_impl)
+        dcprc_kernel_select(DCPRC_KERNEL_ISA_BEST);
+    return crc32c_impl(crc, (const uint8_t *)data, size);
+}
+
+/*f dcprc_kernel_xxhash64 */
+extern uint64_t
+dcprc_kernel_xxhash64(uint64_t seed, const void *data, size_t size)
+{
+    return xxh64(seed, (const uint8_t *)data, size);
+}
+
+/*f dcprc_kernel_complete */
+extern int
+dcprc_kernel_complete(enum dcprc_work_type work_type,
+                      struct dcprc_workq_entry *entry,
+                      const void *data,
+                      size_t size)
+{
+    switch (work_type) {
+    case DCPRC_WORK_TYPE_NULL:
+        entry->__raw[3] &= ~DCPRC_ENTRY_VALID_WORK;
+        return 0;
+    case DCPRC_WORK_TYPE_FETCH_SUM:
+        entry->__raw[3] = dcprc_kernel_fetch_sum(0, data, size);
+        return 0;
+    case DCPRC_WORK_TYPE_DIGEST: {
+        uint64_t hash;
+        hash = dcprc_kernel_xxhash64(0, data, size);
+        entry->__raw[0] = dcprc_kernel_crc32c(0, data, size);
+        entry->__raw[1] = (uint32_t)hash;
+        entry->__raw[2] = (uint32_t)(hash >> 32);
+        entry->__raw[3] &= ~DCPRC_ENTRY_VALID_WORK;
+        return 0;
+    }
+    case DCPRC_WORK_TYPE_PATTERN: {
+        const struct dcprc_pattern_set *set;
+        uint32_t count, first;
+        set = dcprc_pattern_slot(((entry->__raw[3] &~ DCPRC_ENTRY_VALID_WORK) >>
+                                  DCPRC_PATTERN_SLOT_SHIFT));
+        if (!set)
+            return 1;
+        dcprc_pattern_search(set, data, size, &count, &first);
+        entry->__raw[0] = count;
+        entry->__raw[1] = first;
+        entry->__raw[2] = 0;
+        entry->__raw[3] &= ~DCPRC_ENTRY_VALID_WORK;
+        return 0;
+    }
+    default:
+        break;
+    }
+    return 1;
+}
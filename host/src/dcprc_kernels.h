@@ -0,0 +1,180 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_kernels.h
+ * @brief         Host implementations of the data coprocessor work types
+ *
+ * Each data coprocessor worker type has a host implementation here
+ * that produces the same result as the firmware, to check the results
+ * of the NFP and to do the work on the CPU when that is better.
+ *
+ * Kernels have a scalar implementation and, on x86-64, AVX2 and
+ * AVX-512 implementations; the best the CPU supports is selected when
+ * a kernel is first used, or one may be selected explicitly (for
+ * testing and benchmarking). CRC32C uses the SSE4.2 CRC32 and
+ * PCLMULQDQ instructions with either of AVX2 or AVX-512 selected (if
+ * the CPU has them).
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _DCPRC_KERNELS_H_
+#define _DCPRC_KERNELS_H_
+
+/*a Includes
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "firmware/data_coproc.h"
+
+/*a Types
+ */
+/*t dcprc_work_type */
+/**
+ * Work types, one per worker firmware (dcprc_worker_<type>.c)
+ */
+enum dcprc_work_type {
+    DCPRC_WORK_TYPE_NULL,      /* Returns the work unchanged */
+    DCPRC_WORK_TYPE_FETCH_SUM, /* Sum of the data bytes, modulo 256 */
+    DCPRC_WORK_TYPE_DIGEST,    /* CRC32C and XXH64 of the data */
+    DCPRC_WORK_TYPE_PATTERN,   /* Count and first offset of patterns */
+};
+
+/*t dcprc_kernel_isa */
+/**
+ * Instruction set extensions a kernel implementation may use
+ */
+enum dcprc_kernel_isa {
+    DCPRC_KERNEL_ISA_SCALAR,
+    DCPRC_KERNEL_ISA_AVX2,
+    DCPRC_KERNEL_ISA_AVX512, /* AVX-512F and AVX-512BW */
+    DCPRC_KERNEL_ISA_BEST,   /* For dcprc_kernel_select */
+};
+
+/*a Functions
+ */
+/*f dcprc_kernel_isa_supported */
+/**
+ * @brief Determine if the CPU (and this build) supports an ISA
+ *
+ */
+extern int dcprc_kernel_isa_supported(enum dcprc_kernel_isa isa);
+
+/*f dcprc_kernel_isa_name */
+/**
+ * @brief Get the name of an ISA, for reports
+ *
+ */
+extern const char *dcprc_kernel_isa_name(enum dcprc_kernel_isa isa);
+
+/*f dcprc_kernel_select */
+/**
+ * @brief Select the implementations the kernels use
+ *
+ * @param isa ISA to use, or DCPRC_KERNEL_ISA_BEST for the best supported
+ *
+ * @returns The ISA selected, or -1 if @p isa is not supported (and
+ * the selection is unchanged)
+ *
+ */
+extern int dcprc_kernel_select(enum dcprc_kernel_isa isa);
+
+/*f dcprc_kernel_selected */
+/**
+ * @brief Get the ISA the kernels use
+ *
+ */
+extern enum dcprc_kernel_isa dcprc_kernel_selected(void);
+
+/*f dcprc_kernel_fetch_sum */
+/**
+ * @brief Add the bytes of data to a sum so far, modulo 256, as the
+ * sum_memory() of dcprc_worker_fetch_sum.c
+ *
+ * @param sum_so_far Sum of preceding data (zero to start)
+ *
+ * @param data       Data to sum
+ *
+ * @param size       Size of data in bytes
+ *
+ * @returns Sum so far plus the bytes of data, modulo 256
+ *
+ */
+extern uint32_t dcprc_kernel_fetch_sum(uint32_t sum_so_far, const void *data, size_t size);
+
+/*f dcprc_kernel_crc32c */
+/**
+ * @brief Add data to a CRC32C (Castagnoli, as iSCSI and ext4)
+ *
+ * @param crc  CRC32C of preceding data (zero to start)
+ *
+ * @param data Data
+ *
+ * @param size Size of data in bytes
+ *
+ * @returns CRC32C of the preceding data followed by @p data
+ *
+ */
+extern uint32_t dcprc_kernel_crc32c(uint32_t crc, const void *data, size_t size);
+
+/*f dcprc_kernel_xxhash64 */
+/**
+ * @brief Get the XXH64 hash of data
+ *
+ * @param seed Seed of the hash (the digest worker uses zero)
+ *
+ * @param data Data
+ *
+ * @param size Size of data in bytes
+ *
+ * @returns XXH64 hash of @p data
+ *
+ */
+extern uint64_t dcprc_kernel_xxhash64(uint64_t seed, const void *data, size_t size);
+
+/*f dcprc_kernel_complete */
+/**
+ * @brief Do the work of a work queue entry on the CPU, writing the
+ * result as the worker firmware of the type does
+ *
+ * @param work_type Work type
+ *
+ * @param entry     Work queue entry, with its work; the result is
+ *                  written to it and valid_work is cleared (for
+ *                  DCPRC_WORK_TYPE_DIGEST, result data_0 is the
+ *                  CRC32C and data_1/data_2 the low/high halves of
+ *                  the XXH64, with flags unchanged; for
+ *                  DCPRC_WORK_TYPE_PATTERN, data_0 is the count and
+ *                  data_1 the first offset, searching with the
+ *                  pattern set of the slot in operand_1, see
+ *                  dcprc_pattern.h)
+ *
+ * @param data      Virtual address of the work data (unused for
+ *                  DCPRC_WORK_TYPE_NULL)
+ *
+ * @param size      Size of the work data
+ *
+ * @returns Zero on success, non-zero for an unknown work type (or a
+ * pattern slot with no pattern set)
+ *
+ */
+extern int dcprc_kernel_complete(enum dcprc_work_type work_type,
+                                 struct dcprc_workq_entry *entry,
+                                 const void *data,
+                                 size_t size);
+
+/*a Close guard
+ */
+#endif /* _DCPRC_KERNELS_H_ */
@@ -0,0 +1,454 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_kernels_test.c
+ * @brief         Test for the host data coprocessor kernels
+ *
+ * Every implementation the CPU supports is checked against a byte at
+ * a time (or bit at a time) reference, for all alignments and many
+ * sizes, and the digests against published check values. Pattern
+ * searches are checked against comparing every pattern at every
+ * offset.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "dcprc_kernels.h"
+#include "dcprc_pattern.h"
+#include "timer.h"
+
+/*a Defines
+ */
+#define TEST_DATA_SIZE (1024*1024+64)
+
+/*a Useful functions
+ */
+/*f reference_sum */
+static uint32_t
+reference_sum(uint32_t sum, const uint8_t *data, size_t size)
+{
+    while (size-- > 0)
+        sum += *data++;
+    return sum & 0xff;
+}
+
+/*f reference_crc32c */
+static uint32_t
+reference_crc32c(uint32_t crc, const uint8_t *data, size_t size)
+{
+    int i;
+    crc = ~crc;
+    while (size-- > 0) {
+        crc ^= *data++;
+        for (i=0; i<8; i++)
+            crc = (crc & 1) ? ((crc>>1) ^ 0x82f63b78) : (crc>>1);
+    }
+    return ~crc;
+}
+
+/*f reference_pattern_search */
+static void
+reference_pattern_search(const char *const *patterns, const size_t *lengths, int num_patterns,
+                         const uint8_t *data, size_t size, uint32_t *count, uint32_t *first)
+{
+    size_t ofs;
+    int i;
+    *count = 0;
+    *first = DCPRC_PATTERN_NO_MATCH;
+    for (ofs=0; ofs<size; ofs++) {
+        for (i=0; i<num_patterns; i++) {
+            if ((ofs+lengths[i] <= size) && !memcmp(data+ofs, patterns[i], lengths[i])) {
+                if (*count == 0)
+                    *first = ofs;
+                *count += 1;
+            }
+        }
+    }
+}
+
+/*a Tests
+ */
+/*f test_fetch_sum */
+/**
+ * @brief Check fetch_sum for one ISA (if supported)
+ *
+ * @returns Zero on success (or if unsupported), else an error indication
+ *
+ */
+static int
+test_fetch_sum(enum dcprc_kernel_isa isa)
+{
+    uint8_t *data;
+    size_t size;
+    int ofs;
+    int err;
+    int i;
+
+    if (!dcprc_kernel_isa_supported(isa)) {
+        fprintf(stderr, "ISA %s not supported; skipped\n", dcprc_kernel_isa_name(isa));
+        return 0;
+    }
+    if (dcprc_kernel_select(isa) != isa)
+        return 1;
+    data = malloc(TEST_DATA_SIZE);
+    srand(isa+1);
+    for (i=0; i<TEST_DATA_SIZE; i++)
+        data[i] = rand();
+    err = 0;
+    for (ofs=0; !err && (ofs<64); ofs++) {
+        for (size=0; !err && (size<1100); size++) {
+            if (dcprc_kernel_fetch_sum(0, data+ofs, size) != reference_sum(0, data+ofs, size))
+                err = 2;
+        }
+    }
+    size = TEST_DATA_SIZE-64;
+    if (!err && (dcprc_kernel_fetch_sum(0, data+3, size) != reference_sum(0, data+3, size)))
+        err = 3;
+    if (!err && (dcprc_kernel_fetch_sum(0x1234, data+5, 999) != reference_sum(0x1234, data+5, 999)))
+        err = 4;
+    memset(data, 0xff, TEST_DATA_SIZE);
+    if (!err && (dcprc_kernel_fetch_sum(0, data, TEST_DATA_SIZE) != reference_sum(0, data, TEST_DATA_SIZE)))
+        err = 5;
+    free(data);
+    dcprc_kernel_select(DCPRC_KERNEL_ISA_BEST);
+    return err;
+}
+
+/*f test_crc32c */
+/**
+ * @brief Check CRC32C for one ISA (if supported)
+ *
+ * @returns Zero on success (or if unsupported), else an error indication
+ *
+ */
+static int
+test_crc32c(enum dcprc_kernel_isa isa)
+{
+    uint8_t *data;
+    size_t size;
+    int ofs;
+    int err;
+    int i;
+
+    if (!dcprc_kernel_isa_supported(isa)) {
+        fprintf(stderr, "ISA %s not supported; skipped\n", dcprc_kernel_isa_name(isa));
+        return 0;
+    }
+    if (dcprc_kernel_select(isa) != isa)
+        return 1;
+    err = 0;
+    if (dcprc_kernel_crc32c(0, "123456789", 9) != 0xe3069283)
+        err = 2;
+    data = malloc(TEST_DATA_SIZE);
+    srand(isa+100);
+    for (i=0; i<TEST_DATA_SIZE; i++)
+        data[i] = rand();
+    for (ofs=0; !err && (ofs<16); ofs++) {
+        for (size=0; !err && (size<1100); size++) {
+            if (dcprc_kernel_crc32c(0, data+ofs, size) != reference_crc32c(0, data+ofs, size))
+                err = 3;
+        }
+    }
+    for (size=3000; !err && (size<10000); size+=331) {
+        if (dcprc_kernel_crc32c(0, data+1, size) != reference_crc32c(0, data+1, size))
+            err = 4;
+    }
+    size = TEST_DATA_SIZE-64;
+    if (!err && (dcprc_kernel_crc32c(0, data+3, size) != reference_crc32c(0, data+3, size)))
+        err = 5;
+    if (!err && (dcprc_kernel_crc32c(dcprc_kernel_crc32c(0, data, 5000), data+5000, 7777) !=
+                 reference_crc32c(0, data, 12777)))
+        err = 6;
+    free(data);
+    dcprc_kernel_select(DCPRC_KERNEL_ISA_BEST);
+    return err;
+}
+
+/*f test_xxhash64 */
+/**
+ * @brief Check XXH64 against published values, and that it does not
+ * depend on alignment
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_xxhash64(void)
+{
+    uint64_t aligned[32];
+    uint8_t data[256+8];
+    int i;
+
+    if (dcprc_kernel_xxhash64(0, "", 0) != 0xef46db3751d8e999ULL)
+        return 1;
+    if (dcprc_kernel_xxhash64(0, "abc", 3) != 0x44bc2cf5ad770999ULL)
+        return 2;
+    for (i=0; i<256; i++)
+        data[i+5] = i;
+    memcpy(aligned, data+5, 256);
+    for (i=0; i<256; i++) {
+        if (dcprc_kernel_xxhash64(i, data+5, i) != dcprc_kernel_xxhash64(i, aligned, i))
+            return 3;
+    }
+    return 0;
+}
+
+/*f test_pattern_search */
+/**
+ * @brief Check pattern searches for one ISA (if supported), with sets
+ * of patterns over a small alphabet (so that there are many matches,
+ * overlapping and duplicated), some too large for Teddy
+ *
+ * @returns Zero on success (or if unsupported), else an error indication
+ *
+ */
+static int
+test_pattern_search(enum dcprc_kernel_isa isa)
+{
+    static const int set_sizes[] = {1, 2, 7, 40, 64, 65, 300};
+    char pattern_data[300][8];
+    const char *patterns[300];
+    size_t lengths[300];
+    uint8_t *data;
+    int err;
+    int n, i;
+
+    if (!dcprc_kernel_isa_supported(isa)) {
+        fprintf(stderr, "ISA %s not supported; skipped\n", dcprc_kernel_isa_name(isa));
+        return 0;
+    }
+    if (dcprc_kernel_select(isa) != isa)
+        return 1;
+    data = malloc(5000);
+    srand(isa+200);
+    err = 0;
+    for (n=0; !err && (n<sizeof(set_sizes)/sizeof(int)); n++) {
+        struct dcprc_pattern_set *set;
+        int num_patterns;
+
+        num_patterns = set_sizes[n];
+        for (i=0; i<num_patterns; i++) {
+            int j;
+            lengths[i] = 1 + (rand() % 8);
+            if (num_patterns > 2)
+                lengths[i] += 2;
+            if (lengths[i] > 8)
+                lengths[i] = 8;
+            for (j=0; j<lengths[i]; j++)
+                pattern_data[i][j] = 'a' + (rand() % 4);
+            patterns[i] = pattern_data[i];
+        }
+        set = dcprc_pattern_set_create(patterns, lengths, num_patterns);
+        if (!set) {
+            err = 2;
+            break;
+        }
+        for (i=0; i<5000; i++)
+            data[i] = 'a' + (rand() % ((n & 1) ? 4 : 5));
+        for (i=0; !err && (i<200); i++) {
+            uint32_t count, first;
+            uint32_t ref_count, ref_first;
+            size_t ofs, size;
+
+            ofs  = rand() % 64;
+            size = (i < 100) ? i : (rand() % (5000-64));
+            reference_pattern_search(patterns, lengths, num_patterns, data+ofs, size,
+                                     &ref_count, &ref_first);
+            dcprc_pattern_search(set, data+ofs, size, &count, &first);
+            if ((count != ref_count) || (first != ref_first))
+                err = 3;
+            dcprc_pattern_search_automaton(dcprc_pattern_set_automaton(set),
+                                           data+ofs, size, &count, &first);
+            if ((count != ref_count) || (first != ref_first))
+                err = 4;
+            if (err)
+                fprintf(stderr, "Set of %d, size %zu: got %u/%u, expected %u/%u\n",
+                        num_patterns, size, count, first, ref_count, ref_first);
+        }
+        dcprc_pattern_set_destroy(set);
+    }
+    free(data);
+    dcprc_kernel_select(DCPRC_KERNEL_ISA_BEST);
+    return err;
+}
+
+/*f test_complete */
+/**
+ * @brief Check work queue entries are completed as the firmware does
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_complete(void)
+{
+    struct dcprc_workq_entry entry;
+    uint8_t data[256];
+    int i;
+
+    for (i=0; i<256; i++)
+        data[i] = i;
+    entry.work.host_physical_address = 0x12345678;
+    entry.work.operand_0  = 97;
+    entry.__raw[3]        = 0x80000000 | 5;
+    if (dcprc_kernel_complete(DCPRC_WORK_TYPE_NULL, &entry, NULL, 0) != 0)
+        return 1;
+    if ((entry.__raw[3] != 5) || (entry.work.operand_0 != 97))
+        return 2;
+    entry.__raw[3] = 0x80000000 | 5;
+    if (dcprc_kernel_complete(DCPRC_WORK_TYPE_FETCH_SUM, &entry, data, 97) != 0)
+        return 3;
+    if (entry.__raw[3] != ((97*96/2) & 0xff))
+        return 4;
+    entry.work.host_physical_address = 0x12345678;
+    entry.__raw[3] = 0x80000000 | 5;
+    if (dcprc_kernel_complete(DCPRC_WORK_TYPE_DIGEST, &entry, data, 97) != 0)
+        return 5;
+    if ((entry.result.data_0 != dcprc_kernel_crc32c(0, data, 97)) ||
+        (entry.result.data_1 != (uint32_t)dcprc_kernel_xxhash64(0, data, 97)) ||
+        (entry.result.data_2 != (uint32_t)(dcprc_kernel_xxhash64(0, data, 97)>>32)) ||
+        (entry.__raw[3] != 5))
+        return 6;
+    if (dcprc_kernel_complete((enum dcprc_work_type)99, &entry, data, 97) == 0)
+        return 7;
+    {
+        struct dcprc_pattern_set *set;
+        const char *patterns[] = {"\x10\x11", "\x30"};
+        size_t lengths[] = {2, 1};
+        int err;
+        set = dcprc_pattern_set_create(patterns, lengths, 2);
+        if (!set)
+            return 8;
+        entry.__raw[3] = 0x80000000 | (3 << DCPRC_PATTERN_SLOT_SHIFT) | 5;
+        err = 0;
+        if (dcprc_kernel_complete(DCPRC_WORK_TYPE_PATTERN, &entry, data, 97) == 0)
+            err = 9;
+        dcprc_pattern_slot_set(3, set);
+        if (!err && (dcprc_kernel_complete(DCPRC_WORK_TYPE_PATTERN, &entry, data, 97) != 0))
+            err = 10;
+        if (!err && ((entry.result.data_0 != 2) || (entry.result.data_1 != 0x10) ||
+                     (entry.__raw[3] != ((3 << DCPRC_PATTERN_SLOT_SHIFT) | 5))))
+            err = 11;
+        dcprc_pattern_slot_set(3, NULL);
+        dcprc_pattern_set_destroy(set);
+        if (err)
+            return err;
+    }
+    return 0;
+}
+
+/*f test_throughput */
+/**
+ * @brief Report fetch_sum throughput of each supported ISA
+ *
+ * @returns Zero
+ *
+ */
+static int
+test_throughput(void)
+{
+    uint8_t *data;
+    int isa;
+
+    data = calloc(1, TEST_DATA_SIZE);
+    for (isa=DCPRC_KERNEL_ISA_SCALAR; isa<DCPRC_KERNEL_ISA_BEST; isa++) {
+        t_sl_timer timer;
+        uint32_t sum;
+        int i;
+
+        if (dcprc_kernel_select(isa) != isa)
+            continue;
+        SL_TIMER_INIT(timer);
+        SL_TIMER_ENTRY(timer);
+        sum = 0;
+        for (i=0; i<16; i++)
+            sum = dcprc_kernel_fetch_sum(sum, data, TEST_DATA_SIZE);
+        SL_TIMER_EXIT(timer);
+        fprintf(stderr, "fetch_sum %s: %f bytes per us\n", dcprc_kernel_isa_name(isa),
+                16.0*TEST_DATA_SIZE/SL_TIMER_VALUE_US(timer));
+        SL_TIMER_INIT(timer);
+        SL_TIMER_ENTRY(timer);
+        for (i=0; i<16; i++)
+            sum = dcprc_kernel_crc32c(sum, data, TEST_DATA_SIZE);
+        SL_TIMER_EXIT(timer);
+        fprintf(stderr, "crc32c %s: %f bytes per us\n", dcprc_kernel_isa_name(isa),
+                16.0*TEST_DATA_SIZE/SL_TIMER_VALUE_US(timer));
+    }
+    dcprc_kernel_select(DCPRC_KERNEL_ISA_BEST);
+    {
+        t_sl_timer timer;
+        uint64_t hash;
+        int i;
+        SL_TIMER_INIT(timer);
+        SL_TIMER_ENTRY(timer);
+        hash = 0;
+        for (i=0; i<16; i++)
+            hash = dcprc_kernel_xxhash64(hash, data, TEST_DATA_SIZE);
+        SL_TIMER_EXIT(timer);
+        fprintf(stderr, "xxhash64: %f bytes per us (%016llx)\n",
+                16.0*TEST_DATA_SIZE/SL_TIMER_VALUE_US(timer), (unsigned long long)hash);
+    }
+    free(data);
+    return 0;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("fetch_sum scalar",test_fetch_sum(DCPRC_KERNEL_ISA_SCALAR));
+    TEST_RUN("fetch_sum AVX2",test_fetch_sum(DCPRC_KERNEL_ISA_AVX2));
+    TEST_RUN("fetch_sum AVX-512",test_fetch_sum(DCPRC_KERNEL_ISA_AVX512));
+    TEST_RUN("CRC32C scalar",test_crc32c(DCPRC_KERNEL_ISA_SCALAR));
+    TEST_RUN("CRC32C AVX2 (SSE4.2)",test_crc32c(DCPRC_KERNEL_ISA_AVX2));
+    TEST_RUN("CRC32C AVX-512 (SSE4.2)",test_crc32c(DCPRC_KERNEL_ISA_AVX512));
+    TEST_RUN("XXH64",test_xxhash64());
+    TEST_RUN("Pattern search scalar",test_pattern_search(DCPRC_KERNEL_ISA_SCALAR));
+    TEST_RUN("Pattern search AVX2",test_pattern_search(DCPRC_KERNEL_ISA_AVX2));
+    TEST_RUN("Complete work queue entries",test_complete());
+    TEST_RUN("Kernel throughput",test_throughput());
+    return failures;
+}
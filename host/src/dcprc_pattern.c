@@ -0,0 +1,524 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_pattern.c
+ * @brief         Pattern sets for the data coprocessor pattern search
+ *
+ * The automaton is built as a trie of the patterns over byte classes
+ * (bytes in no pattern share one class), and then made a DFA by
+ * filling in each missing transition with that of the state's
+ * failure state, in breadth-first order.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "dcprc_pattern.h"
+#include "dcprc_kernels.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DCPRC_PATTERN_X86
+#endif
+
+/*a Defines
+ */
+#define TEDDY_BUCKETS 8
+
+/*a Types
+ */
+/*t struct dcprc_pattern_teddy */
+/**
+ * Teddy masks: bit n of lo1[b&15] and hi1[b>>4] is set if a pattern
+ * in bucket n may start with b, and of lo2/hi2 for its second byte
+ * (all set for patterns of one byte)
+ */
+struct dcprc_pattern_teddy {
+    uint8_t lo1[16];
+    uint8_t hi1[16];
+    uint8_t lo2[16];
+    uint8_t hi2[16];
+    int     bucket_start[TEDDY_BUCKETS+1]; /* Into 'order' */
+};
+
+/*t struct dcprc_pattern_set */
+struct dcprc_pattern_set {
+    int       num_patterns;
+    uint8_t **patterns;
+    size_t   *lengths;
+    int      *order;        /* Pattern numbers by bucket, for Teddy */
+    int       teddy_ok;
+    struct dcprc_pattern_teddy teddy;
+    struct dcprc_pattern_automaton *automaton;
+};
+
+/*a Static variables
+ */
+static const struct dcprc_pattern_set *slot_sets[DCPRC_PATTERN_SLOTS];
+
+/*a Static functions
+ */
+/*f automaton_classes */
+static const uint32_t *
+automaton_classes(const struct dcprc_pattern_automaton *automaton)
+{
+    return (const uint32_t *)(automaton+1);
+}
+
+/*f automaton_transitions */
+static const uint32_t *
+automaton_transitions(const struct dcprc_pattern_automaton *automaton)
+{
+    return automaton_classes(automaton) + 64;
+}
+
+/*f build_automaton */
+/**
+ * @brief Build the automaton of a set's patterns
+ *
+ * @returns Zero on success, non-zero on error (with an error message
+ * printed)
+ *
+ */
+static int
+build_automaton(struct dcprc_pattern_set *set)
+{
+    uint8_t   classes[256];
+    int       num_classes;
+    int       max_states, num_states;
+    int32_t  *delta;
+    int      *fail, *queue;
+    uint32_t *own_count, *out_count;
+    uint32_t *own_len,   *out_len;
+    uint32_t *transitions;
+    size_t    size;
+    int       err;
+    int       i, s, c;
+
+    memset(classes, 0, sizeof(classes));
+    num_classes = 1;
+    max_states = 1;
+    for (i=0; i<set->num_patterns; i++) {
+        size_t j;
+        for (j=0; j<set->lengths[i]; j++) {
+            if (classes[set->patterns[i][j]] == 0)
+                classes[set->patterns[i][j]] = num_classes++;
+        }
+        max_states += set->lengths[i];
+    }
+
+    delta     = malloc(sizeof(int32_t)*max_states*num_classes);
+    fail      = calloc(max_states, sizeof(int));
+    queue     = calloc(max_states, sizeof(int));
+    own_count = calloc(max_states, sizeof(uint32_t));
+    out_count = calloc(max_states, sizeof(uint32_t));
+    own_len   = calloc(max_states, sizeof(uint32_t));
+    out_len   = calloc(max_states, sizeof(uint32_t));
+    err = 0;
+    if (!delta || !fail || !queue || !own_count || !out_count || !own_len || !out_len) {
+        fprintf(stderr, "Out of memory compiling pattern set\n");
+        err = 1;
+        goto done;
+    }
+
+    /* Trie */
+    memset(delta, 0xff, sizeof(int32_t)*max_states*num_classes);
+    num_states = 1;
+    for (i=0; i<set->num_patterns; i++) {
+        size_t j;
+        s = 0;
+        for (j=0; j<set->lengths[i]; j++) {
+            c = classes[set->patterns[i][j]];
+            if (delta[s*num_classes+c] < 0)
+                delta[s*num_classes+c] = num_states++;
+            s = delta[s*num_classes+c];
+        }
+        own_count[s]++;
+        own_len[s] = set->lengths[i];
+    }
+    if (num_states > DCPRC_PATTERN_MAX_STATES) {
+        fprintf(stderr, "Pattern set needs %d states, more than %d\n",
+                num_states, DCPRC_PATTERN_MAX_STATES);
+        err = 1;
+        goto done;
+    }
+
+    /* Breadth first: failure states, outputs and missing transitions */
+    {
+        int head, tail;
+        head = 0;
+        tail = 0;
+        queue[tail++] = 0;
+        while (head < tail) {
+            s = queue[head++];
+            if (s != 0) {
+                out_count[s] = own_count[s] + out_count[fail[s]];
+                out_len[s]   = (own_len[s] > out_len[fail[s]]) ? own_len[s] : out_len[fail[s]];
+            }
+            if (out_count[s] > 255) {
+                fprintf(stderr, "Pattern set has more than 255 patterns ending together\n");
+                err = 1;
+                goto done;
+            }
+            for (c=0; c<num_classes; c++) {
+                int32_t t;
+                t = delta[s*num_classes+c];
+                if (t >= 0) {
+                    fail[t] = (s == 0) ? 0 : delta[fail[s]*num_classes+c];
+                    queue[tail++] = t;
+                } else {
+                    delta[s*num_classes+c] = (s == 0) ? 0 : delta[fail[s]*num_classes+c];
+                }
+            }
+        }
+    }
+
+    size = (sizeof(struct dcprc_pattern_automaton) + 64*sizeof(uint32_t) +
+            (size_t)num_states*num_classes*sizeof(uint32_t));
+    if (size > DCPRC_PATTERN_SLOT_SIZE) {
+        fprintf(stderr, "Pattern set automaton of %zu bytes is larger than a slot (%d bytes)\n",
+                size, DCPRC_PATTERN_SLOT_SIZE);
+        err = 1;
+        goto done;
+    }
+    set->automaton = calloc(1, size);
+    if (!set->automaton) {
+        err = 1;
+        goto done;
+    }
+    set->automaton->num_states  = num_states;
+    set->automaton->num_classes = num_classes;
+    set->automaton->size        = size;
+    for (i=0; i<256; i++) {
+        ((uint32_t *)automaton_classes(set->automaton))[i>>2] |= classes[i] << (8*(i&3));
+    }
+    transitions = (uint32_t *)automaton_transitions(set->automaton);
+    for (i=0; i<num_states*num_classes; i++) {
+        s = delta[i];
+        transitions[i] = s | (out_count[s]<<16) | (out_len[s]<<24);
+    }
+
+done:
+    free(delta);
+    free(fail);
+    free(queue);
+    free(own_count);
+    free(out_count);
+    free(own_len);
+    free(out_len);
+    return err;
+}
+
+/*f compare_keys */
+static int
+compare_keys(const void *a, const void *b)
+{
+    uint64_t ka, kb;
+    ka = *(const uint64_t *)a;
+    kb = *(const uint64_t *)b;
+    return (ka > kb) - (ka < kb);
+}
+
+/*f build_teddy */
+/**
+ * @brief Put patterns into buckets, those with similar first bytes
+ * together, and build the Teddy masks
+ *
+ * @returns Zero on success, non-zero if out of memory
+ */
+static int
+build_teddy(struct dcprc_pattern_set *set)
+{
+    struct dcprc_pattern_teddy *teddy;
+    uint64_t *keys;
+    int bucket;
+    int i, j;
+
+    teddy = &set->teddy;
+    memset(teddy, 0, sizeof(*teddy));
+    keys = malloc(set->num_patterns*sizeof(uint64_t));
+    if (!keys)
+        return 1;
+    for (i=0; i<set->num_patterns; i++) {
+        const uint8_t *p;
+        p = set->patterns[i];
+        keys[i] = ((uint64_t)p[0]<<40) | ((uint64_t)((set->lengths[i]>1) ? p[1] : 0)<<32) | i;
+    }
+    qsort(keys, set->num_patterns, sizeof(uint64_t), compare_keys);
+    for (i=0; i<set->num_patterns; i++)
+        set->order[i] = (uint32_t)keys[i];
+    free(keys);
+    for (bucket=0; bucket<=TEDDY_BUCKETS; bucket++)
+        teddy->bucket_start[bucket] = (bucket*set->num_patterns) / TEDDY_BUCKETS;
+    for (bucket=0; bucket<TEDDY_BUCKETS; bucket++) {
+        for (i=teddy->bucket_start[bucket]; i<teddy->bucket_start[bucket+1]; i++) {
+            const uint8_t *p;
+            p = set->patterns[set->order[i]];
+            teddy->lo1[p[0]&15] |= 1<<bucket;
+            teddy->hi1[p[0]>>4] |= 1<<bucket;
+            if (set->lengths[set->order[i]] > 1) {
+                teddy->lo2[p[1]&15] |= 1<<bucket;
+                teddy->hi2[p[1]>>4] |= 1<<bucket;
+            } else {
+                for (j=0; j<16; j++) {
+                    teddy->lo2[j] |= 1<<bucket;
+                    teddy->hi2[j] |= 1<<bucket;
+                }
+            }
+        }
+    }
+    set->teddy_ok = (set->num_patterns <= DCPRC_PATTERN_TEDDY_MAX);
+    return 0;
+}
+
+/*f teddy_verify */
+/**
+ * @brief Compare the patterns of candidate buckets at an offset
+ */
+static inline void
+teddy_verify(const struct dcprc_pattern_set *set, const uint8_t *data, size_t size,
+             size_t ofs, uint32_t buckets, uint32_t *count, uint32_t *first)
+{
+    while (buckets) {
+        int bucket;
+        int i;
+        bucket = __builtin_ctz(buckets);
+        buckets &= buckets-1;
+        for (i=set->teddy.bucket_start[bucket]; i<set->teddy.bucket_start[bucket+1]; i++) {
+            int p;
+            p = set->order[i];
+            if ((ofs+set->lengths[p] <= size) &&
+                (memcmp(data+ofs, set->patterns[p], set->lengths[p]) == 0)) {
+                if (*count == 0)
+                    *first = ofs;
+                *count += 1;
+            }
+        }
+    }
+}
+
+/*f teddy_scalar */
+/**
+ * @brief Teddy one offset at a time, for the end of the data
+ */
+static void
+teddy_scalar(const struct dcprc_pattern_set *set, const uint8_t *data, size_t size,
+             size_t ofs, uint32_t *count, uint32_t *first)
+{
+    const struct dcprc_pattern_teddy *teddy;
+    teddy = &set->teddy;
+    for (; ofs<size; ofs++) {
+        uint32_t buckets;
+        buckets = teddy->lo1[data[ofs]&15] & teddy->hi1[data[ofs]>>4];
+        if (ofs+1 < size)
+            buckets &= teddy->lo2[data[ofs+1]&15] & teddy->hi2[data[ofs+1]>>4];
+        if (buckets)
+            teddy_verify(set, data, size, ofs, buckets, count, first);
+    }
+}
+
+#ifdef DCPRC_PATTERN_X86
+/*f teddy_avx2 */
+/**
+ * @brief Teddy 32 offsets at a time
+ */
+__attribute__((target("avx2")))
+static void
+teddy_avx2(const struct dcprc_pattern_set *set, const uint8_t *data, size_t size,
+           uint32_t *count, uint32_t *first)
+{
+    const struct dcprc_pattern_teddy *teddy;
+    __m256i lo1, hi1, lo2, hi2, nibble;
+    size_t ofs;
+
+    teddy  = &set->teddy;
+    lo1    = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)teddy->lo1));
+    hi1    = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)teddy->hi1));
+    lo2    = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)teddy->lo2));
+    hi2    = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)teddy->hi2));
+    nibble = _mm256_set1_epi8(15);
+    for (ofs=0; ofs+33<=size; ofs+=32) {
+        __m256i d0, d1, m;
+        uint32_t candidates;
+        uint8_t  buckets[32];
+
+        d0 = _mm256_loadu_si256((const __m256i *)(data+ofs));
+        d1 = _mm256_loadu_si256((const __m256i *)(data+ofs+1));
+        m  = _mm256_and_si256(_mm256_shuffle_epi8(lo1, _mm256_and_si256(d0, nibble)),
+                              _mm256_shuffle_epi8(hi1, _mm256_and_si256(_mm256_srli_epi16(d0, 4), nibble)));
+        m  = _mm256_and_si256(m, _mm256_shuffle_epi8(lo2, _mm256_and_si256(d1, nibble)));
+        m  = _mm256_and_si256(m, _mm256_shuffle_epi8(hi2, _mm256_and_si256(_mm256_srli_epi16(d1, 4), nibble)));
+        candidates = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+        if (candidates == 0)
+            continue;
+        _mm256_storeu_si256((__m256i *)buckets, m);
+        while (candidates) {
+            int i;
+            i = __builtin_ctz(candidates);
+            candidates &= candidates-1;
+            teddy_verify(set, data, size, ofs+i, buckets[i], count, first);
+        }
+    }
+    teddy_scalar(set, data, size, ofs, count, first);
+}
+#endif
+
+/*a External functions
+ */
+/*f dcprc_pattern_set_create */
+extern struct dcprc_pattern_set *
+dcprc_pattern_set_create(const char *const *patterns,
+                         const size_t *lengths,
+                         int num_patterns)
+{
+    struct dcprc_pattern_set *set;
+    int i;
+
+    if (num_patterns < 1) {
+        fprintf(stderr, "Pattern set has no patterns\n");
+        return NULL;
+    }
+    for (i=0; i<num_patterns; i++) {
+        if ((lengths[i] < 1) || (lengths[i] > DCPRC_PATTERN_MAX_LENGTH)) {
+            fprintf(stderr, "Pattern %d has length %zu; patterns must be 1 to %d bytes\n",
+                    i, lengths[i], DCPRC_PATTERN_MAX_LENGTH);
+            return NULL;
+        }
+    }
+    set = calloc(1, sizeof(*set));
+    if (!set)
+        return NULL;
+    set->num_patterns = num_patterns;
+    set->patterns = calloc(num_patterns, sizeof(uint8_t *));
+    set->lengths  = calloc(num_patterns, sizeof(size_t));
+    set->order    = calloc(num_patterns, sizeof(int));
+    if (!set->patterns || !set->lengths || !set->order)
+        goto fail;
+    for (i=0; i<num_patterns; i++) {
+        set->patterns[i] = malloc(lengths[i]);
+        if (!set->patterns[i])
+            goto fail;
+        memcpy(set->patterns[i], patterns[i], lengths[i]);
+        set->lengths[i] = lengths[i];
+    }
+    if (build_automaton(set) != 0)
+        goto fail;
+    if (build_teddy(set) != 0)
+        goto fail;
+    return set;
+
+fail:
+    dcprc_pattern_set_destroy(set);
+    return NULL;
+}
+
+/*f dcprc_pattern_set_destroy */
+extern void
+dcprc_pattern_set_destroy(struct dcprc_pattern_set *set)
+{
+    int i;
+    if (set->patterns) {
+        for (i=0; i<set->num_patterns; i++)
+            free(set->patterns[i]);
+    }
+    free(set->patterns);
+    free(set->lengths);
+    free(set->order);
+    free(set->automaton);
+    free(set);
+}
+
+/*f dcprc_pattern_set_automaton */
+extern const struct dcprc_pattern_automaton *
+dcprc_pattern_set_automaton(const struct dcprc_pattern_set *set)
+{
+    return set->automaton;
+}
+
+/*f dcprc_pattern_search_automaton */
+extern void
+dcprc_pattern_search_automaton(const struct dcprc_pattern_automaton *automaton,
+                               const void *data, size_t size,
+                               uint32_t *count, uint32_t *first)
+{
+    const uint32_t *classes;
+    const uint32_t *transitions;
+    const uint8_t *bytes;
+    uint32_t num_classes;
+    uint32_t state;
+    uint32_t n;
+    size_t ofs;
+
+    classes     = automaton_classes(automaton);
+    transitions = automaton_transitions(automaton);
+    num_classes = automaton->num_classes;
+    bytes = (const uint8_t *)data;
+    state = 0;
+    n = 0;
+    *first = DCPRC_PATTERN_NO_MATCH;
+    for (ofs=0; ofs<size; ofs++) {
+        uint32_t b, t;
+        b = bytes[ofs];
+        t = transitions[state*num_classes + ((classes[b>>2] >> (8*(b&3))) & 0xff)];
+        state = DCPRC_PATTERN_NEXT_STATE(t);
+        if (DCPRC_PATTERN_MATCHES(t)) {
+            uint32_t start;
+            n += DCPRC_PATTERN_MATCHES(t);
+            start = ofs + 1 - DCPRC_PATTERN_MAX_MATCH(t);
+            if (start < *first)
+                *first = start;
+        }
+    }
+    *count = n;
+}
+
+/*f dcprc_pattern_search */
+extern void
+dcprc_pattern_search(const struct dcprc_pattern_set *set,
+                     const void *data, size_t size,
+                     uint32_t *count, uint32_t *first)
+{
+#ifdef DCPRC_PATTERN_X86
+    if (set->teddy_ok &&
+        (dcprc_kernel_selected() != DCPRC_KERNEL_ISA_SCALAR)) {
+        *count = 0;
+        *first = DCPRC_PATTERN_NO_MATCH;
+        teddy_avx2(set, (const uint8_t *)data, size, count, first);
+        return;
+    }
+#endif
+    dcprc_pattern_search_automaton(set->automaton, data, size, count, first);
+}
+
+/*f dcprc_pattern_slot_set */
+extern int
+dcprc_pattern_slot_set(int slot, const struct dcprc_pattern_set *set)
+{
+    if ((slot < 0) || (slot >= DCPRC_PATTERN_SLOTS))
+        return 1;
+    __atomic_store_n(&slot_sets[slot], set, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*f dcprc_pattern_slot */
+extern const struct dcprc_pattern_set *
+dcprc_pattern_slot(int slot)
+{
+    if ((slot < 0) || (slot >= DCPRC_PATTERN_SLOTS))
+        return NULL;
+    return __atomic_load_n(&slot_sets[slot], __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,142 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_pattern.h
+ * @brief         Pattern sets for the data coprocessor pattern search
+ *
+ * A pattern set is a number of literal byte strings, compiled once
+ * into an automaton (struct dcprc_pattern_automaton) that the pattern
+ * search worker (dcprc_worker_pattern.c) runs over work data. The
+ * automaton is uploaded to a slot in NFP memory with
+ * dcprc_pattern_upload (dcprc.h), and work refers to the slot in its
+ * operand_1.
+ *
+ * A search counts every occurrence of every pattern (overlapping
+ * ones, and each of duplicate patterns) and finds the lowest offset
+ * at which any occurrence starts.
+ *
+ * On the host a search either runs the automaton, as the firmware
+ * does, or for sets of up to DCPRC_PATTERN_TEDDY_MAX patterns uses an
+ * AVX2 'Teddy' search: the low and high nibbles of each pair of bytes
+ * select, by byte shuffles, which of eight buckets of patterns may
+ * start there, and only those patterns are compared.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _DCPRC_PATTERN_H_
+#define _DCPRC_PATTERN_H_
+
+/*a Includes
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "firmware/data_coproc.h"
+
+/*a Defines
+ */
+/* Most patterns in a set searched by Teddy on the host */
+#define DCPRC_PATTERN_TEDDY_MAX 64
+
+/*a Types
+ */
+/*t struct dcprc_pattern_set */
+/**
+ * Opaque compiled pattern set
+ */
+struct dcprc_pattern_set;
+
+/*a Functions
+ */
+/*f dcprc_pattern_set_create */
+/**
+ * @brief Compile a pattern set
+ *
+ * @param patterns     Patterns (copied)
+ *
+ * @param lengths      Length of each pattern, 1 to DCPRC_PATTERN_MAX_LENGTH
+ *
+ * @param num_patterns Number of patterns
+ *
+ * @returns Pattern set, or NULL on error (with an error message
+ * printed), including if the automaton would not fit a slot
+ *
+ */
+extern struct dcprc_pattern_set *dcprc_pattern_set_create(const char *const *patterns,
+                                                          const size_t *lengths,
+                                                          int num_patterns);
+
+/*f dcprc_pattern_set_destroy */
+/**
+ * @brief Free a pattern set; it should not be in a slot
+ *
+ */
+extern void dcprc_pattern_set_destroy(struct dcprc_pattern_set *set);
+
+/*f dcprc_pattern_set_automaton */
+/**
+ * @brief Get the automaton of a pattern set, to upload
+ *
+ * @returns Automaton, of automaton->size bytes
+ *
+ */
+extern const struct dcprc_pattern_automaton *dcprc_pattern_set_automaton(const struct dcprc_pattern_set *set);
+
+/*f dcprc_pattern_search */
+/**
+ * @brief Search data for a pattern set on the host, with Teddy if
+ * the selected kernels (dcprc_kernels.h) are not scalar and the set
+ * is small enough
+ *
+ * @param count Number of occurrences of patterns
+ *
+ * @param first Lowest offset of an occurrence, or DCPRC_PATTERN_NO_MATCH
+ *
+ */
+extern void dcprc_pattern_search(const struct dcprc_pattern_set *set,
+                                 const void *data, size_t size,
+                                 uint32_t *count, uint32_t *first);
+
+/*f dcprc_pattern_search_automaton */
+/**
+ * @brief Search data by running an automaton, as the firmware does
+ *
+ */
+extern void dcprc_pattern_search_automaton(const struct dcprc_pattern_automaton *automaton,
+                                           const void *data, size_t size,
+                                           uint32_t *count, uint32_t *first);
+
+/*f dcprc_pattern_slot_set */
+/**
+ * @brief Record the pattern set in a slot, for host searches of work
+ * (dcprc_kernel_complete); dcprc_pattern_upload does this
+ *
+ * @param set Pattern set, or NULL to empty the slot
+ *
+ * @returns Zero on success, non-zero for a bad slot
+ *
+ */
+extern int dcprc_pattern_slot_set(int slot, const struct dcprc_pattern_set *set);
+
+/*f dcprc_pattern_slot */
+/**
+ * @brief Get the pattern set in a slot, or NULL
+ *
+ */
+extern const struct dcprc_pattern_set *dcprc_pattern_slot(int slot);
+
+/*a Close guard
+ */
+#endif /* _DCPRC_PATTERN_H_ */
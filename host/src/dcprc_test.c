@@ -0,0 +1,1066 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          dcprc_test.c
+ * @brief         Test for libdcprc against the emulated firmware
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "dcprc.h"
+#include "dcprc_kernels.h"
+#include "dcprc_hybrid.h"
+#include "dcprc_pattern.h"
+#include "dcprc_fw_model.h"
+
+/*a Defines
+ */
+#define TEST_SHM_SIZE     (4*1024*1024)
+#define TEST_TIMEOUT_US   (1000*1000)
+#define TEST_MAX_ITEMS    4096
+#define TEST_MAX_THREADS  4
+
+/*a Types
+ */
+/*t struct test_submitter */
+/**
+ * A submitter thread whose results arrive by callback
+ */
+struct test_submitter {
+    struct dcprc *dcprc;
+    pthread_t thread;
+    int      num_items;
+    int      completed[TEST_MAX_ITEMS];
+    int      num_completed;
+    int      error;
+};
+
+/*a Useful functions
+ */
+/*f sum_bytes */
+static uint32_t
+sum_bytes(uint32_t sum, const uint8_t *data, size_t size)
+{
+    while (size-- > 0)
+        sum += *data++;
+    return sum;
+}
+
+/*f fetch_sum_work */
+/**
+ * @brief Worker as dcprc_worker_fetch_sum.c; host 'physical' addresses
+ * are virtual addresses in the model
+ */
+static void
+fetch_sum_work(struct dcprc_workq_entry *entry)
+{
+    uint32_t sum;
+
+    if (entry->work.operand_0 & DCPRC_WORK_SGL) {
+        const struct dcprc_sg_entry *sg_entries;
+        uint32_t i;
+
+        sg_entries = (const struct dcprc_sg_entry *)(uintptr_t)entry->work.host_physical_address;
+        sum = 0;
+        for (i=0; i<(entry->work.operand_0 & DCPRC_WORK_SGL_ENTRIES_MASK); i++) {
+            sum = sum_bytes(sum, (const uint8_t *)(uintptr_t)sg_entries[i].host_physical_address,
+                            sg_entries[i].size);
+        }
+    } else {
+        sum = sum_bytes(0, (const uint8_t *)(uintptr_t)entry->work.host_physical_address,
+                        entry->work.operand_0);
+    }
+    entry->__raw[3] = sum & 0xff;
+}
+
+/*f test_open_worker */
+static struct dcprc *
+test_open_worker(int max_pending, int stall, dcprc_fw_model_work_fn work_fn)
+{
+    struct dcprc_fw_model_config config;
+    struct dcprc_desc desc;
+
+    config.max_pending = max_pending;
+    config.stall       = stall;
+    config.seed        = 1234;
+    config.work_fn     = work_fn;
+    dcprc_fw_model_configure(&config);
+
+    memset(&desc, 0, sizeof(desc));
+    desc.firmware = "model";
+    desc.shm_size = TEST_SHM_SIZE;
+    return dcprc_open(&desc);
+}
+
+/*f test_open */
+static struct dcprc *
+test_open(int max_pending, int stall)
+{
+    return test_open_worker(max_pending, stall, NULL);
+}
+
+/*f submit_items */
+/**
+ * @brief Submit items first..first+num-1, with the item number as the
+ * cookie and operand_1
+ */
+static int
+submit_items(struct dcprc_workq *workq, int first, int num)
+{
+    int i;
+    for (i=first; i<first+num; i++) {
+        if (dcprc_submit(workq, 0, 0, i, (void *)(uintptr_t)i) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*f check_completion */
+/**
+ * @brief Check a completion against its cookie, counting it in @p seen
+ */
+static int
+check_completion(const struct dcprc_completion *completion, int *seen, int num_items)
+{
+    int item;
+
+    item = (int)(uintptr_t)completion->cookie;
+    if ((item < 0) || (item >= num_items))
+        return 1;
+    if (completion->result.__raw[3] != (uint32_t)item)
+        return 2;
+    seen[item]++;
+    return 0;
+}
+
+/*f completion_callback */
+static void
+completion_callback(void *handle, const struct dcprc_completion *completion)
+{
+    struct test_submitter *ts;
+
+    ts = (struct test_submitter *)handle;
+    if (check_completion(completion, ts->completed, ts->num_items) != 0)
+        ts->error = 1;
+    __atomic_add_fetch(&ts->num_completed, 1, __ATOMIC_RELEASE);
+}
+
+/*f submitter_thread */
+static void *
+submitter_thread(void *handle)
+{
+    struct test_submitter *ts;
+    struct dcprc_workq *workq;
+    int i;
+
+    ts = (struct test_submitter *)handle;
+    workq = dcprc_workq_create(ts->dcprc, -1, 64, 0);
+    if (!workq) {
+        ts->error = 2;
+        return NULL;
+    }
+    dcprc_workq_set_callback(workq, completion_callback, ts);
+    for (i=0; i<ts->num_items; i++) {
+        while (dcprc_workq_outstanding(workq) >= dcprc_workq_max_entries(workq))
+            sched_yield();
+        if (submit_items(workq, i, 1) != 0) {
+            ts->error = 3;
+            break;
+        }
+        if ((i%8) == 7)
+            dcprc_commit(workq);
+    }
+    dcprc_commit(workq);
+    while (__atomic_load_n(&ts->num_completed, __ATOMIC_ACQUIRE) < ts->num_items) {
+        if (ts->error)
+            break;
+        sched_yield();
+    }
+    dcprc_workq_destroy(workq);
+    return NULL;
+}
+
+/*a Tests
+ */
+/*f test_alloc */
+/**
+ * @brief Check that freeing the most recent shared memory allocation
+ * returns it for reuse, and that freeing any other does not
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_alloc(void)
+{
+    struct dcprc *dcprc;
+    uint64_t phys_addr;
+    char *a, *b, *c;
+    int err;
+
+    dcprc = test_open(1, 0);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    a = dcprc_alloc(dcprc, 4096, &phys_addr);
+    b = dcprc_alloc(dcprc, 4096, &phys_addr);
+    if (!a || !b || (b < a + 4096))
+        err = 2;
+    if (!err) {
+        dcprc_free(dcprc, b, 4096);
+        c = dcprc_alloc(dcprc, 4096, &phys_addr);
+        if (c != b)
+            err = 3;
+    }
+    if (!err) {
+        dcprc_free(dcprc, a, 4096);
+        c = dcprc_alloc(dcprc, 4096, &phys_addr);
+        if (!c || (c < b + 4096))
+            err = 4;
+    }
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_workq_alloc */
+/**
+ * @brief Create every work queue the firmware scans, checking that
+ * any free queue is one of them and that no others may be created
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_workq_alloc(void)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workqs[DCPRC_SCANNED_WORKQS];
+    int err;
+    int i, n;
+
+    dcprc = test_open(1, 0);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    for (n=0; n<DCPRC_SCANNED_WORKQS; n++) {
+        workqs[n] = dcprc_workq_create(dcprc, -1, 32, 0);
+        if (!workqs[n]) {
+            err = 2;
+            break;
+        }
+        if (dcprc_workq_number(workqs[n]) != n)
+            err = 3;
+    }
+    if (!err && (dcprc_workq_create(dcprc, -1, 32, 0) != NULL))
+        err = 4;
+    for (i=0; i<n; i++)
+        dcprc_workq_destroy(workqs[i]);
+    if (!err && (dcprc_workq_create(dcprc, DCPRC_SCANNED_WORKQS, 32, 0) != NULL))
+        err = 5;
+    if (!err && (dcprc_workq_create(dcprc, DCPRC_MAX_WORKQS-1, 32, 0) != NULL))
+        err = 6;
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_in_order */
+/**
+ * @brief Take results in submission order, wrapping the ring
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_in_order(void)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_workq_entry result;
+    int err;
+    int i, j;
+
+    dcprc = test_open(1, 0);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    workq = dcprc_workq_create(dcprc, -1, 32, 0);
+    if (!workq)
+        err = 2;
+    for (i=0; !err && (i<20); i++) {
+        for (j=0; j<24; j++) {
+            if (dcprc_add_work(workq, 0, 0, i*24+j) != 0)
+                err = 3;
+        }
+        if (!err && (dcprc_commit(workq) != 0))
+            err = 4;
+        for (j=0; !err && (j<24); j++) {
+            if (dcprc_wait_result(workq, &result, TEST_TIMEOUT_US) != 0)
+                err = 5;
+            else if (result.__raw[3] != (uint32_t)(i*24+j))
+                err = 6;
+        }
+    }
+    if (!err && (dcprc_poll_result(workq, &result) != -1))
+        err = 7;
+    if (workq)
+        dcprc_workq_destroy(workq);
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_reap */
+/**
+ * @brief Reap work completed out of order, with every cookie returned
+ * once and ring entries reused before the oldest item completes
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_reap(void)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_completion completions[32];
+    int seen[TEST_MAX_ITEMS];
+    int submitted, reaped;
+    int err;
+    int i;
+
+    dcprc = test_open(16, 0);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    memset(seen, 0, sizeof(seen));
+    workq = dcprc_workq_create(dcprc, -1, 64, 0);
+    if (!workq)
+        err = 2;
+    submitted = 0;
+    reaped = 0;
+    while (!err && (reaped < TEST_MAX_ITEMS)) {
+        int space;
+        int num;
+
+        space = dcprc_workq_max_entries(workq) - dcprc_workq_outstanding(workq);
+        if (space > TEST_MAX_ITEMS - submitted)
+            space = TEST_MAX_ITEMS - submitted;
+        if (submit_items(workq, submitted, space) != 0)
+            err = 3;
+        submitted += space;
+        if (!err && (dcprc_commit(workq) != 0))
+            err = 4;
+        num = dcprc_reap_wait(workq, completions, 32, TEST_TIMEOUT_US);
+        if (!err && (num <= 0))
+            err = 5;
+        for (i=0; !err && (i<num); i++) {
+            if (check_completion(&completions[i], seen, TEST_MAX_ITEMS) != 0)
+                err = 6;
+        }
+        reaped += num;
+    }
+    for (i=0; !err && (i<TEST_MAX_ITEMS); i++) {
+        if (seen[i] != 1)
+            err = 7;
+    }
+    if (!err && (dcprc_reap_wait(workq, completions, 32, TEST_TIMEOUT_US) != 0))
+        err = 8;
+    if (workq)
+        dcprc_workq_destroy(workq);
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_commit_policy */
+/**
+ * @brief Check the doorbells made for a count threshold, and that a
+ * wptr mirror needs none
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_commit_policy(int flags)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_commit_policy policy;
+    struct dcprc_workq_stats stats;
+    struct dcprc_fw_model_stats model_stats;
+    struct dcprc_completion completions[64];
+    uint64_t wptr_writes;
+    int err;
+    int reaped;
+
+    dcprc = test_open(8, 0);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    dcprc_fw_model_get_stats(&model_stats);
+    wptr_writes = model_stats.wptr_writes;
+    workq = dcprc_workq_create(dcprc, -1, 64, flags);
+    if (!workq)
+        err = 2;
+    policy.max_items    = 8;
+    policy.max_delay_us = -1;
+    policy.drain        = 0;
+    if (!err)
+        dcprc_workq_set_commit_policy(workq, &policy);
+    if (!err && (submit_items(workq, 0, 64) != 0))
+        err = 3;
+    reaped = 0;
+    while (!err && (reaped < 64)) {
+        int num;
+        num = dcprc_reap_wait(workq, completions, 64, TEST_TIMEOUT_US);
+        if (num <= 0)
+            err = 4;
+        reaped += num;
+    }
+    if (!err) {
+        dcprc_workq_get_stats(workq, &stats);
+        if ((stats.items != 64) || (stats.doorbells != 8) || (stats.flush_count != 8))
+            err = 5;
+    }
+    dcprc_fw_model_get_stats(&model_stats);
+    wptr_writes = model_stats.wptr_writes - wptr_writes;
+    if (!err && (flags & DCPRC_WORKQ_FLAG_WPTR_MIRROR) && (wptr_writes != 0))
+        err = 6;
+    if (!err && !(flags & DCPRC_WORKQ_FLAG_WPTR_MIRROR) && (wptr_writes != 8))
+        err = 7;
+    if (workq)
+        dcprc_workq_destroy(workq);
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_callbacks */
+/**
+ * @brief Submit from several threads with results delivered by
+ * callbacks from the completion thread
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_callbacks(int num_threads)
+{
+    struct dcprc *dcprc;
+    struct test_submitter *ts;
+    int err;
+    int i, j;
+
+    dcprc = test_open(32, 0);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    ts = calloc(num_threads, sizeof(*ts));
+    if (dcprc_completion_thread_start(dcprc) != 0)
+        err = 2;
+    for (i=0; !err && (i<num_threads); i++) {
+        ts[i].dcprc     = dcprc;
+        ts[i].num_items = TEST_MAX_ITEMS;
+        pthread_create(&ts[i].thread, NULL, submitter_thread, &ts[i]);
+    }
+    for (i=0; !err && (i<num_threads); i++) {
+        pthread_join(ts[i].thread, NULL);
+    }
+    dcprc_completion_thread_stop(dcprc);
+    for (i=0; !err && (i<num_threads); i++) {
+        if (ts[i].error)
+            err = 10+ts[i].error;
+        for (j=0; !err && (j<TEST_MAX_ITEMS); j++) {
+            if (ts[i].completed[j] != 1)
+                err = 20;
+        }
+    }
+    free(ts);
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_timeout */
+/**
+ * @brief Check that work that never completes is reported as an error
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_timeout(void)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_completion completions[4];
+    struct dcprc_workq_entry result;
+    int err;
+
+    dcprc = test_open(4, 1);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    workq = dcprc_workq_create(dcprc, -1, 32, 0);
+    if (!workq)
+        err = 2;
+    if (!err && (submit_items(workq, 0, 4) != 0))
+        err = 3;
+    if (!err && (dcprc_reap_wait(workq, completions, 4, 10*1000) != -1))
+        err = 4;
+    if (!err && (dcprc_wait_result(workq, &result, 10*1000) != 1))
+        err = 5;
+    if (!err && (dcprc_workq_outstanding(workq) != 4))
+        err = 6;
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_sgl */
+/**
+ * @brief Sum data scattered over shared memory and a user buffer
+ * through a scatter-gather list
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_sgl(void)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_sgl sgl;
+    struct dcprc_workq_entry result;
+    uint8_t *shm_data[2];
+    uint8_t *user_data;
+    uint64_t phys_addr;
+    uint32_t sum;
+    int err;
+    int i;
+
+    dcprc = test_open_worker(4, 0, fetch_sum_work);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    user_data = malloc(20000);
+    shm_data[0] = dcprc_alloc(dcprc, 1000, &phys_addr);
+    shm_data[1] = dcprc_alloc(dcprc, 3000, &phys_addr);
+    if (!shm_data[0] || !shm_data[1])
+        err = 2;
+    for (i=0; !err && (i<20000); i++) {
+        user_data[i] = i*7;
+        if (i<1000) shm_data[0][i] = i*3;
+        if (i<3000) shm_data[1][i] = i*5;
+    }
+    if (!err && (dcprc_sgl_init(dcprc, &sgl, 8) != 0))
+        err = 3;
+
+    /* Adjacent pieces of one buffer merge; separate buffers do not */
+    if (!err && (dcprc_sgl_add(dcprc, &sgl, shm_data[0], 1000) != 0))
+        err = 4;
+    if (!err && (dcprc_sgl_add(dcprc, &sgl, user_data+1, 19999) != 0))
+        err = 5;
+    if (!err && (dcprc_sgl_add(dcprc, &sgl, shm_data[1]+100, 2900) != 0))
+        err = 6;
+    if (!err && ((sgl.num_entries != 3) || (sgl.size != 1000+19999+2900)))
+        err = 7;
+    sum = sum_bytes(0, shm_data[0], 1000);
+    sum = sum_bytes(sum, user_data+1, 19999);
+    sum = sum_bytes(sum, shm_data[1]+100, 2900) & 0xff;
+
+    workq = NULL;
+    if (!err)
+        workq = dcprc_workq_create(dcprc, -1, 32, 0);
+    if (!err && !workq)
+        err = 8;
+    for (i=0; !err && (i<10); i++) {
+        if (dcprc_submit_sgl(workq, &sgl, 0, NULL) != 0)
+            err = 9;
+    }
+    if (!err && (dcprc_add_work(workq, phys_addr, 3000, 0) != 0))
+        err = 10;
+    if (!err && (dcprc_commit(workq) != 0))
+        err = 11;
+    for (i=0; !err && (i<10); i++) {
+        if (dcprc_wait_result(workq, &result, TEST_TIMEOUT_US) != 0)
+            err = 12;
+        else if (result.__raw[3] != sum)
+            err = 13;
+    }
+    if (!err && (dcprc_wait_result(workq, &result, TEST_TIMEOUT_US) != 0))
+        err = 14;
+    if (!err && (result.__raw[3] != (sum_bytes(0, shm_data[1], 3000) & 0xff)))
+        err = 15;
+
+    /* A full list is left unchanged */
+    if (!err) {
+        dcprc_sgl_reset(&sgl);
+        for (i=0; i<8; i++)
+            dcprc_sgl_add(dcprc, &sgl, user_data+i*100, 10);
+        if ((sgl.num_entries != 8) || (dcprc_sgl_add(dcprc, &sgl, user_data, 10) == 0))
+            err = 16;
+        else if ((sgl.num_entries != 8) || (sgl.size != 80))
+            err = 17;
+    }
+    if (workq)
+        dcprc_workq_destroy(workq);
+    free(user_data);
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_digest */
+/**
+ * @brief Digest work of many sizes through the emulated digest worker
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_digest(void)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_completion completions[32];
+    uint8_t *data;
+    uint64_t phys_addr;
+    int reaped;
+    int err;
+    int i;
+
+    dcprc = test_open_worker(16, 0, dcprc_fw_model_work_digest);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    workq = NULL;
+    data = dcprc_alloc(dcprc, 65536, &phys_addr);
+    if (!data)
+        err = 2;
+    for (i=0; !err && (i<65536); i++)
+        data[i] = i*13 + (i>>8);
+    if (!err)
+        workq = dcprc_workq_create(dcprc, -1, 128, 0);
+    if (!err && !workq)
+        err = 3;
+    /* Item i is the i*509 bytes at offset i */
+    for (i=0; !err && (i<100); i++) {
+        if (dcprc_submit(workq, phys_addr+i, i*509, i, (void *)(uintptr_t)i) != 0)
+            err = 4;
+    }
+    if (!err && (dcprc_commit(workq) != 0))
+        err = 5;
+    reaped = 0;
+    while (!err && (reaped<100)) {
+        int num;
+        num = dcprc_reap_wait(workq, completions, 32, TEST_TIMEOUT_US);
+        if (num <= 0)
+            err = 6;
+        for (i=0; !err && (i<num); i++) {
+            const struct dcprc_workq_entry *result;
+            uint64_t hash;
+            int n;
+            n = (int)(uintptr_t)completions[i].cookie;
+            result = &completions[i].result;
+            hash = dcprc_kernel_xxhash64(0, data+n, n*509);
+            if ((result->result.data_0 != dcprc_kernel_crc32c(0, data+n, n*509)) ||
+                (result->result.data_1 != (uint32_t)hash) ||
+                (result->result.data_2 != (uint32_t)(hash>>32)) ||
+                (result->__raw[3] != n))
+                err = 7;
+        }
+        reaped += num;
+    }
+    if (workq)
+        dcprc_workq_destroy(workq);
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_pattern */
+/**
+ * @brief Pattern search work with two pattern sets uploaded to the
+ * emulated firmware, checked against the host search
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_pattern(void)
+{
+    static const char *const patterns[2][3] = {{"ERROR", "WARN", "ERR"},
+                                               {"timeout", "out", "\n"}};
+    static const size_t lengths[2][3] = {{5, 4, 3}, {7, 3, 1}};
+    static const char *const words[] = {"ERROR ", "WARNING ", "timeout ", "ok ", "\n", "about "};
+    struct dcprc_pattern_set *sets[2];
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_workq_entry result;
+    char *data;
+    uint64_t phys_addr;
+    size_t size;
+    int err;
+    int i;
+
+    sets[0] = dcprc_pattern_set_create(patterns[0], lengths[0], 3);
+    sets[1] = dcprc_pattern_set_create(patterns[1], lengths[1], 3);
+    if (!sets[0] || !sets[1])
+        return 1;
+    dcprc = test_open_worker(1, 0, dcprc_fw_model_work_pattern);
+    if (!dcprc)
+        return 2;
+    err = 0;
+    workq = NULL;
+    data = dcprc_alloc(dcprc, 65536, &phys_addr);
+    if (!data)
+        err = 3;
+    for (size=0; !err && (size<60000); ) {
+        const char *word;
+        word = words[rand() % 6];
+        memcpy(data+size, word, strlen(word));
+        size += strlen(word);
+    }
+    if (!err && (dcprc_pattern_upload(dcprc, 1, sets[0]) != 0))
+        err = 4;
+    if (!err && (dcprc_pattern_upload(dcprc, DCPRC_PATTERN_SLOTS-1, sets[1]) != 0))
+        err = 5;
+    if (!err && (dcprc_pattern_upload(dcprc, DCPRC_PATTERN_SLOTS, sets[1]) == 0))
+        err = 6;
+    if (!err)
+        workq = dcprc_workq_create(dcprc, -1, 32, 0);
+    if (!err && !workq)
+        err = 7;
+    for (i=0; !err && (i<20); i++) {
+        uint32_t count, first;
+        uint32_t ofs, slot;
+        slot = (i & 1) ? 1 : (DCPRC_PATTERN_SLOTS-1);
+        ofs  = i*1111;
+        if (dcprc_add_work(workq, phys_addr+ofs, size-ofs, (slot << DCPRC_PATTERN_SLOT_SHIFT) | i) != 0)
+            err = 8;
+        else if (dcprc_commit(workq) != 0)
+            err = 9;
+        else if (dcprc_wait_result(workq, &result, TEST_TIMEOUT_US) != 0)
+            err = 10;
+        if (err)
+            break;
+        dcprc_pattern_search(dcprc_pattern_slot(slot), data+ofs, size-ofs, &count, &first);
+        if ((result.result.data_0 != count) || (result.result.data_1 != first) || (count == 0))
+            err = 11;
+    }
+    if (workq)
+        dcprc_workq_destroy(workq);
+    dcprc_close(dcprc);
+    dcprc_pattern_slot_set(1, NULL);
+    dcprc_pattern_slot_set(DCPRC_PATTERN_SLOTS-1, NULL);
+    dcprc_pattern_set_destroy(sets[0]);
+    dcprc_pattern_set_destroy(sets[1]);
+    return err;
+}
+
+/*f test_hybrid_depth */
+/**
+ * @brief Route by a fixed size, with work beyond the NFP depth done
+ * on the CPU while the NFP is stalled
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_hybrid_depth(void)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_hybrid *hybrid;
+    struct dcprc_hybrid_config config;
+    struct dcprc_hybrid_stats stats;
+    struct dcprc_completion completions[32];
+    uint8_t *data;
+    uint64_t phys_addr;
+    int err;
+    int num;
+    int i;
+
+    dcprc = test_open(4, 1);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    data = dcprc_alloc(dcprc, 4096, &phys_addr);
+    workq = dcprc_workq_create(dcprc, -1, 32, 0);
+    if (!data || !workq)
+        err = 2;
+    config.work_type           = DCPRC_WORK_TYPE_FETCH_SUM;
+    config.mode                = DCPRC_HYBRID_AUTO;
+    config.max_nfp_outstanding = 4;
+    config.cpu_max_size        = 1024;
+    hybrid = NULL;
+    if (!err)
+        hybrid = dcprc_hybrid_create(workq, &config);
+    if (!err && !hybrid)
+        err = 3;
+    for (i=0; !err && (i<4096); i++)
+        data[i] = i;
+    /* 4 small items to the CPU, 4 large to the NFP, 4 large to the CPU */
+    for (i=0; !err && (i<12); i++) {
+        if (dcprc_hybrid_submit(hybrid, data, phys_addr, (i<4) ? 100 : 4096, i,
+                                (void *)(uintptr_t)i) != 0)
+            err = 4;
+    }
+    if (!err && (dcprc_hybrid_commit(hybrid) != 0))
+        err = 5;
+    dcprc_hybrid_get_stats(hybrid, &stats);
+    if (!err && ((stats.items_cpu != 8) || (stats.items_nfp != 4) || (stats.items_cpu_depth != 4)))
+        err = 6;
+    num = dcprc_hybrid_reap(hybrid, completions, 32, 0);
+    if (!err && (num != 8))
+        err = 7;
+    for (i=0; !err && (i<num); i++) {
+        uint32_t expected;
+        int item;
+        item = (int)(uintptr_t)completions[i].cookie;
+        expected = (item<4) ? ((100*99/2) & 0xff) : 0;
+        if ((item != ((i<4) ? i : i+4)) || (completions[i].result.__raw[3] != expected))
+            err = 8;
+    }
+    if (!err && (dcprc_hybrid_outstanding(hybrid) != 4))
+        err = 9;
+    if (!err && (dcprc_hybrid_reap(hybrid, completions, 32, 10*1000) != -1))
+        err = 10;
+    if (hybrid)
+        dcprc_hybrid_destroy(hybrid);
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_hybrid_auto */
+/**
+ * @brief Route a mix of sizes by measured cost, checking every result
+ * is returned once and correct
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_hybrid_auto(enum dcprc_hybrid_mode mode)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_hybrid *hybrid;
+    struct dcprc_hybrid_config config;
+    struct dcprc_hybrid_stats stats;
+    struct dcprc_completion completions[32];
+    uint32_t sums[TEST_MAX_ITEMS];
+    int seen[TEST_MAX_ITEMS];
+    uint8_t *data;
+    uint64_t phys_addr;
+    int submitted, reaped;
+    int err;
+    int i;
+
+    dcprc = test_open_worker(16, 0, fetch_sum_work);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    data = dcprc_alloc(dcprc, 65536, &phys_addr);
+    workq = dcprc_workq_create(dcprc, -1, 64, 0);
+    if (!data || !workq)
+        err = 2;
+    config.work_type           = DCPRC_WORK_TYPE_FETCH_SUM;
+    config.mode                = mode;
+    config.max_nfp_outstanding = 0;
+    config.cpu_max_size        = 0;
+    hybrid = NULL;
+    if (!err)
+        hybrid = dcprc_hybrid_create(workq, &config);
+    if (!err && !hybrid)
+        err = 3;
+    for (i=0; !err && (i<65536); i++)
+        data[i] = i*13;
+    memset(seen, 0, sizeof(seen));
+    submitted = 0;
+    reaped = 0;
+    while (!err && (reaped < TEST_MAX_ITEMS)) {
+        int num;
+        while (submitted < TEST_MAX_ITEMS) {
+            uint32_t size;
+            size = 16 << (submitted % 13);
+            sums[submitted] = sum_bytes(0, data, size) & 0xff;
+            if (dcprc_hybrid_submit(hybrid, data, phys_addr, size, 0,
+                                    (void *)(uintptr_t)submitted) != 0)
+                break;
+            submitted++;
+        }
+        if (dcprc_hybrid_commit(hybrid) != 0)
+            err = 4;
+        num = dcprc_hybrid_reap(hybrid, completions, 32, TEST_TIMEOUT_US);
+        if (!err && (num <= 0))
+            err = 5;
+        for (i=0; !err && (i<num); i++) {
+            int item;
+            item = (int)(uintptr_t)completions[i].cookie;
+            if ((item < 0) || (item >= submitted))
+                err = 6;
+            else if (completions[i].result.__raw[3] != sums[item])
+                err = 7;
+            else
+                seen[item]++;
+        }
+        reaped += num;
+    }
+    for (i=0; !err && (i<TEST_MAX_ITEMS); i++) {
+        if (seen[i] != 1)
+            err = 8;
+    }
+    if (hybrid) {
+        dcprc_hybrid_get_stats(hybrid, &stats);
+        if (!err && (stats.items_cpu + stats.items_nfp != TEST_MAX_ITEMS))
+            err = 9;
+        if (!err && (mode == DCPRC_HYBRID_NFP_ONLY) && (stats.items_cpu != 0))
+            err = 10;
+        if (!err && (mode == DCPRC_HYBRID_CPU_ONLY) && (stats.items_nfp != 0))
+            err = 11;
+        if (!err && (mode == DCPRC_HYBRID_AUTO) &&
+            ((stats.items_cpu == 0) || (stats.items_nfp == 0)))
+            err = 12;
+        dcprc_hybrid_destroy(hybrid);
+    }
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*f test_submit_errors */
+/**
+ * @brief Check a full ring refuses work without queueing it, and the
+ * hybrid dispatcher refuses work the CPU cannot do without producing
+ * a completion
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_submit_errors(void)
+{
+    struct dcprc *dcprc;
+    struct dcprc_workq *workq;
+    struct dcprc_workq_entry result;
+    struct dcprc_hybrid *hybrid;
+    struct dcprc_hybrid_config config;
+    struct dcprc_hybrid_stats stats;
+    struct dcprc_completion completions[4];
+    uint8_t data[64];
+    int err;
+    int i;
+
+    dcprc = test_open(1, 0);
+    if (!dcprc)
+        return 1;
+    err = 0;
+    workq = dcprc_workq_create(dcprc, -1, 32, 0);
+    if (!workq)
+        err = 2;
+    for (i=0; !err && (i<32); i++) {
+        if (dcprc_add_work(workq, 0, 0, i) != 0)
+            err = 3;
+    }
+    if (!err && (dcprc_add_work(workq, 0, 0, 32) != DCPRC_SUBMIT_NOT_QUEUED))
+        err = 4;
+    if (!err && (dcprc_workq_outstanding(workq) != 32))
+        err = 5;
+    if (!err && (dcprc_commit(workq) != 0))
+        err = 6;
+    for (i=0; !err && (i<32); i++) {
+        if (dcprc_wait_result(workq, &result, TEST_TIMEOUT_US) != 0)
+            err = 7;
+        else if (result.__raw[3] != (uint32_t)i)
+            err = 8;
+    }
+
+    memset(data, 0, sizeof(data));
+    config.work_type           = (enum dcprc_work_type)99;
+    config.mode                = DCPRC_HYBRID_CPU_ONLY;
+    config.max_nfp_outstanding = 0;
+    config.cpu_max_size        = 0;
+    hybrid = NULL;
+    if (!err)
+        hybrid = dcprc_hybrid_create(workq, &config);
+    if (!err && !hybrid)
+        err = 9;
+    if (!err && (dcprc_hybrid_submit(hybrid, data, 0, sizeof(data), 0, NULL) >= 0))
+        err = 10;
+    if (!err && (dcprc_hybrid_outstanding(hybrid) != 0))
+        err = 11;
+    if (!err && (dcprc_hybrid_reap(hybrid, completions, 4, 0) != 0))
+        err = 12;
+    if (hybrid) {
+        dcprc_hybrid_get_stats(hybrid, &stats);
+        if (!err && (stats.items_cpu != 0))
+            err = 13;
+        dcprc_hybrid_destroy(hybrid);
+    }
+    if (workq)
+        dcprc_workq_destroy(workq);
+    dcprc_close(dcprc);
+    return err;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Shared memory freed for reuse",test_alloc());
+    TEST_RUN("Work queues allocated from those scanned",test_workq_alloc());
+    TEST_RUN("Results in order",test_in_order());
+    TEST_RUN("Reap out-of-order completions",test_reap());
+    TEST_RUN("Commit policy doorbells",test_commit_policy(0));
+    TEST_RUN("Commit policy with wptr mirror",test_commit_policy(DCPRC_WORKQ_FLAG_WPTR_MIRROR));
+    TEST_RUN("Callbacks from 1 submitter",test_callbacks(1));
+    TEST_RUN("Callbacks from 4 submitters",test_callbacks(TEST_MAX_THREADS));
+    TEST_RUN("Timeout reported as error",test_timeout());
+    TEST_RUN("Scatter-gather list work",test_sgl());
+    TEST_RUN("Digest work",test_digest());
+    TEST_RUN("Pattern search work",test_pattern());
+    TEST_RUN("Refused work not queued",test_submit_errors());
+    TEST_RUN("Hybrid dispatch beyond NFP depth",test_hybrid_depth());
+    TEST_RUN("Hybrid dispatch NFP only",test_hybrid_auto(DCPRC_HYBRID_NFP_ONLY));
+    TEST_RUN("Hybrid dispatch CPU only",test_hybrid_auto(DCPRC_HYBRID_CPU_ONLY));
+    TEST_RUN("Hybrid dispatch by cost",test_hybrid_auto(DCPRC_HYBRID_AUTO));
+    return failures;
+}
@@ -51,6 +51,7 @@ struct nfp_rtsym {
     int target;
     int domain;
     uint64_t addr;
+    uint64_t size;
 };
 
 /*a Functions from /usr/include/hugetlbfs.h
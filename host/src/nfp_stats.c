@@ -0,0 +1,304 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          nfp_stats.c
+ * @brief         Scraping of firmware counter blocks
+ *
+ * The block instances are kept in the order they are added, each
+ * with the index of its first counter. Before the first poll they are
+ * grouped into reads: the blocks are sorted by CPP id and address,
+ * and a block is added to the previous read if it has the same CPP id
+ * and the read would stay within NFP_STATS_MAX_READ bytes. Reads are
+ * of whole 8-byte words.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "nfp_stats.h"
+
+/*a Defines
+ */
+#define NFP_STATS_MAX_TYPES 16
+
+/*a Types
+ */
+/*t struct nfp_stats_block */
+/**
+ * An instance of a counter block
+ */
+struct nfp_stats_block {
+    const struct nfp_stats_type *type;
+    struct nfp_cppid cppid;
+    int      first_counter;
+    int      read;          /* Read containing the block */
+};
+
+/*t struct nfp_stats_read */
+/**
+ * A CPP read covering one or more blocks
+ */
+struct nfp_stats_read {
+    struct nfp_cppid cppid; /* 8-byte aligned start */
+    size_t   size;          /* Multiple of 8 bytes */
+};
+
+/*t struct nfp_stats */
+struct nfp_stats {
+    nfp_stats_read_fn read;
+    void    *read_handle;
+    uint64_t interval_ns;
+    uint64_t last_ns;
+    int      num_polls;
+
+    const struct nfp_stats_type *types[NFP_STATS_MAX_TYPES];
+    int      num_types;
+
+    struct nfp_stats_block blocks[NFP_STATS_MAX_BLOCKS];
+    int      num_blocks;
+
+    struct nfp_stats_read reads[NFP_STATS_MAX_BLOCKS];
+    int      num_reads;     /* -1 until the reads are built */
+
+    struct nfp_stats_counter counters[NFP_STATS_MAX_COUNTERS];
+    int      num_counters;
+
+    uint32_t data[NFP_STATS_MAX_BLOCKS][NFP_STATS_MAX_READ/sizeof(uint32_t)];
+};
+
+/*a Static functions
+ */
+/*f block_compare */
+/**
+ * @brief qsort comparison of pointers to blocks, by CPP id and address
+ */
+static int
+block_compare(const void *a, const void *b)
+{
+    const struct nfp_stats_block *ba = *(const struct nfp_stats_block * const *)a;
+    const struct nfp_stats_block *bb = *(const struct nfp_stats_block * const *)b;
+
+    if (ba->cppid.cpp_id != bb->cppid.cpp_id)
+        return (ba->cppid.cpp_id < bb->cppid.cpp_id) ? -1 : 1;
+    if (ba->cppid.addr != bb->cppid.addr)
+        return (ba->cppid.addr < bb->cppid.addr) ? -1 : 1;
+    return 0;
+}
+
+/*f build_reads */
+/**
+ * @brief Group the blocks into as few reads as possible
+ */
+static void
+build_reads(struct nfp_stats *stats)
+{
+    struct nfp_stats_block *sorted[NFP_STATS_MAX_BLOCKS];
+    struct nfp_stats_read *read;
+    int i;
+
+    for (i=0; i<stats->num_blocks; i++)
+        sorted[i] = &stats->blocks[i];
+    qsort(sorted, stats->num_blocks, sizeof(sorted[0]), block_compare);
+
+    read = NULL;
+    stats->num_reads = 0;
+    for (i=0; i<stats->num_blocks; i++) {
+        struct nfp_stats_block *block;
+        uint64_t end;
+
+        block = sorted[i];
+        end = (block->cppid.addr + NFP_STATS_BLOCK_SIZE(block->type->num_counters) + 7) &~ 7ULL;
+        if (read &&
+            (read->cppid.cpp_id == block->cppid.cpp_id) &&
+            (end - read->cppid.addr <= NFP_STATS_MAX_READ)) {
+            if (end - read->cppid.addr > read->size)
+                read->size = end - read->cppid.addr;
+        } else {
+            read = &stats->reads[stats->num_reads++];
+            read->cppid.cpp_id = block->cppid.cpp_id;
+            read->cppid.addr   = block->cppid.addr &~ 7ULL;
+            read->size         = end - read->cppid.addr;
+        }
+        block->read = stats->num_reads-1;
+    }
+}
+
+/*a External functions
+ */
+/*f nfp_stats_create */
+extern struct nfp_stats *
+nfp_stats_create(nfp_stats_read_fn read, void *read_handle, uint64_t interval_ns)
+{
+    struct nfp_stats *stats;
+
+    stats = malloc(sizeof(*stats));
+    if (!stats)
+        return NULL;
+    memset(stats, 0, sizeof(*stats));
+    stats->read        = read;
+    stats->read_handle = read_handle;
+    stats->interval_ns = interval_ns;
+    stats->num_reads   = -1;
+    return stats;
+}
+
+/*f nfp_stats_destroy */
+extern void
+nfp_stats_destroy(struct nfp_stats *stats)
+{
+    free(stats);
+}
+
+/*f nfp_stats_add_type */
+extern int
+nfp_stats_add_type(struct nfp_stats *stats, const struct nfp_stats_type *type)
+{
+    if (stats->num_types >= NFP_STATS_MAX_TYPES)
+        return 1;
+    stats->types[stats->num_types++] = type;
+    return 0;
+}
+
+/*f nfp_stats_add_symbol */
+extern int
+nfp_stats_add_symbol(void *handle, const char *sym_name,
+                     const struct nfp_cppid *cppid, uint64_t size)
+{
+    struct nfp_stats *stats;
+    const struct nfp_stats_type *type;
+    struct nfp_stats_block *block;
+    size_t name_len, symbol_len;
+    int prefix_len;
+    int i;
+
+    stats = (struct nfp_stats *)handle;
+    name_len = strlen(sym_name);
+    type = NULL;
+    prefix_len = 0;
+    for (i=0; i<stats->num_types; i++) {
+        symbol_len = strlen(stats->types[i]->symbol);
+        if (name_len < symbol_len)
+            continue;
+        if (strcmp(sym_name + name_len - symbol_len, stats->types[i]->symbol))
+            continue;
+        if ((name_len > symbol_len) && (sym_name[name_len - symbol_len - 1] != '.'))
+            continue;
+        type = stats->types[i];
+        prefix_len = (int)(name_len - symbol_len);
+        break;
+    }
+    if (!type)
+        return 0;
+
+    if (size < NFP_STATS_BLOCK_SIZE(type->num_counters)) {
+        fprintf(stderr,"Counter block '%s' is smaller than its %d counters\n",
+                sym_name, type->num_counters);
+        return -1;
+    }
+    if ((stats->num_blocks >= NFP_STATS_MAX_BLOCKS) ||
+        (stats->num_counters + type->num_counters > NFP_STATS_MAX_COUNTERS)) {
+        fprintf(stderr,"Too many counter blocks to add '%s'\n", sym_name);
+        return -1;
+    }
+
+    block = &stats->blocks[stats->num_blocks++];
+    block->type          = type;
+    block->cppid         = *cppid;
+    block->first_counter = stats->num_counters;
+    for (i=0; i<type->num_counters; i++) {
+        struct nfp_stats_counter *counter;
+        counter = &stats->counters[stats->num_counters++];
+        memset(counter, 0, sizeof(*counter));
+        snprintf(counter->name, sizeof(counter->name), "%.*s%s.%s",
+                 prefix_len, sym_name, type->symbol, type->names[i]);
+    }
+    stats->num_reads = -1;
+    return 1;
+}
+
+/*f nfp_stats_poll */
+extern int
+nfp_stats_poll(struct nfp_stats *stats, uint64_t now_ns)
+{
+    uint64_t elapsed_ns;
+    int i, j;
+
+    elapsed_ns = now_ns - stats->last_ns;
+    if ((stats->num_polls > 0) && (elapsed_ns < stats->interval_ns))
+        return 0;
+    if (stats->num_reads < 0)
+        build_reads(stats);
+
+    for (i=0; i<stats->num_reads; i++) {
+        if (stats->read(stats->read_handle, &stats->reads[i].cppid,
+                        stats->data[i], stats->reads[i].size) != 0)
+            return -1;
+    }
+
+    for (i=0; i<stats->num_blocks; i++) {
+        const struct nfp_stats_block *block;
+        const uint32_t *data;
+
+        block = &stats->blocks[i];
+        data = stats->data[block->read];
+        data += (block->cppid.addr - stats->reads[block->read].cppid.addr) / sizeof(uint32_t);
+        for (j=0; j<block->type->num_counters; j++) {
+            struct nfp_stats_counter *counter;
+            uint32_t delta;
+
+            counter = &stats->counters[block->first_counter + j];
+            if (stats->num_polls == 0) {
+                counter->total = data[j];
+                counter->rate  = 0;
+            } else {
+                delta = data[j] - counter->last;
+                counter->total += delta;
+                counter->rate   = (elapsed_ns > 0) ? (delta * 1000000000ULL) / elapsed_ns : 0;
+            }
+            counter->last = data[j];
+        }
+    }
+    stats->last_ns = now_ns;
+    stats->num_polls++;
+    return 1;
+}
+
+/*f nfp_stats_num_counters */
+extern int
+nfp_stats_num_counters(const struct nfp_stats *stats)
+{
+    return stats->num_counters;
+}
+
+/*f nfp_stats_counter */
+extern const struct nfp_stats_counter *
+nfp_stats_counter(const struct nfp_stats *stats, int n)
+{
+    if ((n < 0) || (n >= stats->num_counters))
+        return NULL;
+    return &stats->counters[n];
+}
+
+/*f nfp_stats_num_reads */
+extern int
+nfp_stats_num_reads(struct nfp_stats *stats)
+{
+    if (stats->num_reads < 0)
+        build_reads(stats);
+    return stats->num_reads;
+}
@@ -0,0 +1,189 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          nfp_stats.h
+ * @brief         Scraping of firmware counter blocks
+ *
+ * Firmware exports counters in blocks of 32-bit counters
+ * (firmware/nfp_stats.h). An application describes each kind of
+ * block it knows (struct nfp_stats_type) and passes the run-time
+ * symbols to nfp_stats_add_symbol, usually with nfp_find_rtsyms;
+ * every instance of a known block (one per island, for island-scope
+ * blocks) is then read at an interval by nfp_stats_poll.
+ *
+ * Blocks in the same CPP target and close together are read with a
+ * single CPP read, so that the common case of several blocks in an
+ * island's CLS costs one read per island. The 32-bit counters are
+ * extended to 64-bit totals, and a rate is kept for each over the
+ * last interval.
+ *
+ * The module does not access the NFP itself; blocks are read through
+ * a callback, so that the same code runs against emulated firmware in
+ * the tests.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _NFP_STATS_H_
+#define _NFP_STATS_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "nfp_support.h"
+#include "firmware/nfp_stats.h"
+
+/*a Defines
+ */
+/* Most block instances and counters that are scraped */
+#define NFP_STATS_MAX_BLOCKS   64
+#define NFP_STATS_MAX_COUNTERS 256
+
+/* Length of a counter name, including the terminating NUL */
+#define NFP_STATS_NAME_LEN 48
+
+/* Largest single CPP read covering several blocks */
+#define NFP_STATS_MAX_READ 1024
+
+/*a Types
+ */
+/*t struct nfp_stats_type */
+/**
+ * A kind of counter block, as defined by the firmware application's
+ * shared header
+ */
+struct nfp_stats_type {
+    const char *symbol;          /* Block name, e.g. PCAP_STATS_SYMBOL */
+    int         num_counters;
+    const char *const *names;    /* Name of each counter */
+};
+
+/*t struct nfp_stats_counter */
+/**
+ * A counter of a block instance; the name is
+ * '<island>.<block>.<counter>', or '<block>.<counter>' for a global
+ * block
+ */
+struct nfp_stats_counter {
+    char     name[NFP_STATS_NAME_LEN];
+    uint64_t total;   /* Value, extended to 64 bits */
+    uint64_t rate;    /* Per second, over the last interval */
+    uint32_t last;    /* Value at the last read */
+};
+
+/*t nfp_stats_read_fn */
+/**
+ * Callback to read @p size bytes from the NFP at @p cppid; returns
+ * zero on success
+ */
+typedef int (*nfp_stats_read_fn)(void *handle, const struct nfp_cppid *cppid,
+                                 void *data, size_t size);
+
+/*t struct nfp_stats */
+/**
+ * Opaque counter scraping state
+ */
+struct nfp_stats;
+
+/*a Functions
+ */
+/*f nfp_stats_create */
+/**
+ * @brief Create counter scraping state
+ *
+ * @param read        Callback to read the NFP
+ *
+ * @param read_handle Handle for @p read
+ *
+ * @param interval_ns Interval between reads of the counters
+ *
+ * @returns State, or NULL if out of memory
+ *
+ */
+extern struct nfp_stats *nfp_stats_create(nfp_stats_read_fn read,
+                                          void *read_handle,
+                                          uint64_t interval_ns);
+
+/*f nfp_stats_destroy */
+/**
+ * @brief Free counter scraping state
+ *
+ */
+extern void nfp_stats_destroy(struct nfp_stats *stats);
+
+/*f nfp_stats_add_type */
+/**
+ * @brief Add a kind of block to look for; the type must remain valid
+ *
+ * @returns Zero on success, non-zero if too many types are added
+ *
+ */
+extern int nfp_stats_add_type(struct nfp_stats *stats, const struct nfp_stats_type *type);
+
+/*f nfp_stats_add_symbol */
+/**
+ * @brief Add a run-time symbol if it is an instance of a known block;
+ * an nfp_rtsym_fn, for nfp_find_rtsyms with the state as its handle
+ *
+ * @returns 1 if the symbol was added, 0 if it is not a known block,
+ * and -1 if it is a known block that is too small or if there are
+ * too many blocks or counters
+ *
+ */
+extern int nfp_stats_add_symbol(void *handle, const char *sym_name,
+                                const struct nfp_cppid *cppid, uint64_t size);
+
+/*f nfp_stats_poll */
+/**
+ * @brief Read all the counters if the interval has passed since the
+ * last read
+ *
+ * The first read sets the totals to the counter values, with zero rates.
+ *
+ * @param now_ns Current time, e.g. CLOCK_MONOTONIC
+ *
+ * @returns 1 if the counters were read, 0 if not yet due, -1 if a
+ * read failed (the counters are then unchanged)
+ *
+ */
+extern int nfp_stats_poll(struct nfp_stats *stats, uint64_t now_ns);
+
+/*f nfp_stats_num_counters */
+/**
+ * @brief Get the number of counters of all the blocks added
+ *
+ */
+extern int nfp_stats_num_counters(const struct nfp_stats *stats);
+
+/*f nfp_stats_counter */
+/**
+ * @brief Get a counter, in the order the blocks were added
+ *
+ * @returns Counter, or NULL if @p n is out of range
+ *
+ */
+extern const struct nfp_stats_counter *nfp_stats_counter(const struct nfp_stats *stats, int n);
+
+/*f nfp_stats_num_reads */
+/**
+ * @brief Get the number of CPP reads each poll makes
+ *
+ */
+extern int nfp_stats_num_reads(struct nfp_stats *stats);
+
+/*a Close guard
+ */
+#endif /* _NFP_STATS_H_ */
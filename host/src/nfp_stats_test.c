@@ -0,0 +1,265 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          nfp_stats_test.c
+ * @brief         Test for scraping of firmware counter blocks
+ *
+ * Counter blocks are placed in an emulated memory per CPP target,
+ * and read through a callback that checks each read is of whole
+ * aligned 8-byte words within the memory.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "nfp_stats.h"
+#include "firmware/pcap.h"
+
+/*a Defines
+ */
+#define TEST_NUM_TARGETS 4
+#define TEST_MEM_SIZE    4096
+#define TEST_INTERVAL_NS (100*1000*1000)
+
+/*a Types
+ */
+/*t struct test_nfp */
+/**
+ * Emulated memory of each CPP target (cpp_id is the target number)
+ */
+struct test_nfp {
+    uint32_t mem[TEST_NUM_TARGETS][TEST_MEM_SIZE/sizeof(uint32_t)];
+    int      num_reads;
+    int      bad_reads;
+    int      fail_reads;
+};
+
+/*a Static variables
+ */
+static const char *const pcap_stats_names[PCAP_STATS_NUM_COUNTERS] = {
+    PCAP_STATS_NAMES
+};
+static const struct nfp_stats_type pcap_stats_type = {
+    PCAP_STATS_SYMBOL, PCAP_STATS_NUM_COUNTERS, pcap_stats_names
+};
+static const char *const other_stats_names[3] = {"a", "b", "c"};
+static const struct nfp_stats_type other_stats_type = {
+    "other_stats", 3, other_stats_names
+};
+
+/*a Useful functions
+ */
+/*f test_read */
+static int
+test_read(void *handle, const struct nfp_cppid *cppid, void *data, size_t size)
+{
+    struct test_nfp *nfp;
+
+    nfp = (struct test_nfp *)handle;
+    nfp->num_reads++;
+    if (nfp->fail_reads)
+        return 1;
+    if ((cppid->cpp_id >= TEST_NUM_TARGETS) ||
+        (cppid->addr & 7) || (size & 7) ||
+        (cppid->addr + size > TEST_MEM_SIZE)) {
+        nfp->bad_reads++;
+        return 1;
+    }
+    memcpy(data, ((char *)nfp->mem[cppid->cpp_id]) + cppid->addr, size);
+    return 0;
+}
+
+/*f add_block */
+static int
+add_block(struct nfp_stats *stats, const char *name, int target, uint64_t addr, uint64_t size)
+{
+    struct nfp_cppid cppid;
+    cppid.cpp_id = target;
+    cppid.addr   = addr;
+    return nfp_stats_add_symbol(stats, name, &cppid, size);
+}
+
+/*f create */
+static struct nfp_stats *
+create(struct test_nfp *nfp)
+{
+    struct nfp_stats *stats;
+
+    memset(nfp, 0, sizeof(*nfp));
+    stats = nfp_stats_create(test_read, nfp, TEST_INTERVAL_NS);
+    if (!stats)
+        return NULL;
+    nfp_stats_add_type(stats, &pcap_stats_type);
+    nfp_stats_add_type(stats, &other_stats_type);
+    return stats;
+}
+
+/*a Tests
+ */
+/*f test_symbols */
+/**
+ * @brief Only instances of known blocks are added, with their names
+ */
+static int
+test_symbols(void)
+{
+    struct test_nfp *nfp;
+    struct nfp_stats *stats;
+    const struct nfp_stats_counter *counter;
+    int err;
+
+    err = 0;
+    nfp = malloc(sizeof(*nfp));
+    stats = create(nfp);
+    if (!stats) { free(nfp); return 1; }
+    if (add_block(stats, "i32.pcap_stats", 0, 0, 32) != 1) err = 2;
+    if (add_block(stats, "i33.pcap_stats", 1, 0, 32) != 1) err = 3;
+    if (add_block(stats, "other_stats",    2, 0, 16) != 1) err = 4;
+    if (add_block(stats, "i32.pcap_stats_ring", 0, 64, 32) != 0) err = 5;
+    if (add_block(stats, "i32.xpcap_stats",     0, 64, 32) != 0) err = 6;
+    if (add_block(stats, "stats",               0, 64, 32) != 0) err = 7;
+    if (add_block(stats, "i34.pcap_stats", 2, 64, 28) != -1) err = 8;
+    if (nfp_stats_num_counters(stats) != 2*PCAP_STATS_NUM_COUNTERS + 3) err = 9;
+    counter = nfp_stats_counter(stats, PCAP_STATS_NUM_COUNTERS + PCAP_STATS_CTM_DMAS);
+    if (!counter || strcmp(counter->name, "i33.pcap_stats.ctm_dmas")) err = 10;
+    counter = nfp_stats_counter(stats, 2*PCAP_STATS_NUM_COUNTERS + 2);
+    if (!counter || strcmp(counter->name, "other_stats.c")) err = 11;
+    if (nfp_stats_counter(stats, 2*PCAP_STATS_NUM_COUNTERS + 3) != NULL) err = 12;
+    nfp_stats_destroy(stats);
+    free(nfp);
+    return err;
+}
+
+/*f test_batching */
+/**
+ * @brief Blocks close together in the same target share a read
+ */
+static int
+test_batching(void)
+{
+    struct test_nfp *nfp;
+    struct nfp_stats *stats;
+    const struct nfp_stats_counter *counter;
+    int err;
+
+    err = 0;
+    nfp = malloc(sizeof(*nfp));
+    stats = create(nfp);
+    if (!stats) { free(nfp); return 1; }
+    /* Target 0: two blocks, one unaligned, added out of order - one read */
+    add_block(stats, "i32.other_stats", 0, 0x124, 12);
+    add_block(stats, "i32.pcap_stats",  0, 0x100, 32);
+    /* Target 1: two blocks too far apart for one read */
+    add_block(stats, "i33.pcap_stats",  1, 0x000, 32);
+    add_block(stats, "i33.other_stats", 1, 0x800, 12);
+    if (nfp_stats_num_reads(stats) != 3) err = 2;
+
+    nfp->mem[0][0x124/4 + 1] = 11;
+    nfp->mem[0][0x100/4 + PCAP_STATS_PKTS_RX] = 22;
+    nfp->mem[1][0x800/4 + 2] = 33;
+    if (nfp_stats_poll(stats, 1000) != 1) err = 3;
+    if (nfp->num_reads != 3) err = 4;
+    if (nfp->bad_reads != 0) err = 5;
+    counter = nfp_stats_counter(stats, 1);
+    if (!counter || strcmp(counter->name, "i32.other_stats.b") || (counter->total != 11)) err = 6;
+    counter = nfp_stats_counter(stats, 3 + PCAP_STATS_PKTS_RX);
+    if (!counter || (counter->total != 22)) err = 7;
+    counter = nfp_stats_counter(stats, 3 + 2*PCAP_STATS_NUM_COUNTERS + 2);
+    if (!counter || (counter->total != 33)) err = 8;
+    nfp_stats_destroy(stats);
+    free(nfp);
+    return err;
+}
+
+/*f test_rates */
+/**
+ * @brief Counters wrap into 64-bit totals, with rates over the interval
+ */
+static int
+test_rates(void)
+{
+    struct test_nfp *nfp;
+    struct nfp_stats *stats;
+    const struct nfp_stats_counter *counter;
+    int err;
+
+    err = 0;
+    nfp = malloc(sizeof(*nfp));
+    stats = create(nfp);
+    if (!stats) { free(nfp); return 1; }
+    add_block(stats, "i32.pcap_stats", 0, 0, 32);
+
+    nfp->mem[0][PCAP_STATS_PCIE_DMAS] = 0xfffffff0;
+    if (nfp_stats_poll(stats, 5000) != 1) err = 2;
+    counter = nfp_stats_counter(stats, PCAP_STATS_PCIE_DMAS);
+    if ((counter->total != 0xfffffff0) || (counter->rate != 0)) err = 3;
+
+    nfp->mem[0][PCAP_STATS_PCIE_DMAS] = 0x10;
+    if (nfp_stats_poll(stats, 5000 + TEST_INTERVAL_NS/2) != 0) err = 4;
+    if (nfp->num_reads != 1) err = 5;
+    if (nfp_stats_poll(stats, 5000 + TEST_INTERVAL_NS) != 1) err = 6;
+    if ((counter->total != 0x100000010ULL) || (counter->rate != 0x20*10)) err = 7;
+
+    nfp->mem[0][PCAP_STATS_PCIE_DMAS] = 0x20;
+    nfp->fail_reads = 1;
+    if (nfp_stats_poll(stats, 5000 + 2*TEST_INTERVAL_NS) != -1) err = 8;
+    if (counter->total != 0x100000010ULL) err = 9;
+    nfp->fail_reads = 0;
+    if (nfp_stats_poll(stats, 5000 + 3*TEST_INTERVAL_NS) != 1) err = 10;
+    if ((counter->total != 0x100000020ULL) || (counter->rate != 0x10*5)) err = 11;
+    nfp_stats_destroy(stats);
+    free(nfp);
+    return err;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Symbol matching",test_symbols());
+    TEST_RUN("Batched reads",test_batching());
+    TEST_RUN("Wrap and rates",test_rates());
+    return failures;
+}
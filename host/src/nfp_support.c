@@ -83,6 +83,7 @@ struct nfp {
     struct nfp_device *dev;
     struct nfp_cpp    *cpp;
     uint8_t firmware_id;
+    int firmware_loaded; /* Set if this loaded the firmware */
 };
 
 /*a Statics
@@ -201,6 +202,7 @@ nfp_init(int device_num, int sig_term)
     nfp->dev   = NULL;
     nfp->cpp   = NULL;
     nfp->shm.file = NULL;
+    nfp->firmware_loaded = 0;
 
     if (!exit_handler_registered) {
         exit_handler_registered=1;
@@ -240,7 +242,9 @@ err:
 
 /*f nfp_shutdown
  *
- * Shutdown the NFP, unloading firmware before closing the device
+ * Shutdown the NFP, unloading firmware before closing the device if
+ * it was loaded with nfp_fw_load; firmware of another process (for
+ * example, when attached to read its memory) is left running
  * Performs an incremental shutdown of the activated components, and can
  * be performed many times successively without failure
  * Removes the NFP from the list to be shutdown at exit
@@ -253,7 +257,8 @@ nfp_shutdown(struct nfp *nfp)
 {
     if (!nfp) return;
     if (nfp->dev) {
-        nfp_fw_unload(nfp);
+        if (nfp->firmware_loaded)
+            nfp_fw_unload(nfp);
         nfp_device_close(nfp->dev);
         nfp->dev = NULL;
     }
@@ -285,6 +290,7 @@ nfp_fw_load(struct nfp *nfp, const char *filename)
 
     err=nfp_nffw_load(nfp->dev, nffw, nffw_size, &nfp->firmware_id);
     free(nffw);
+    if (err>=0) nfp->firmware_loaded=1;
     return err;
 }
 
@@ -526,6 +532,40 @@ nfp_get_rtsym_cppid(struct nfp *nfp, const char *sym_name, struct nfp_cppid *cpp
     return 0;
 }
 
+/*f nfp_find_rtsyms
+ *
+ * Invoke a callback for every run-time symbol
+ *
+ * @param nfp      Nfp with loaded firmware whose run-time symbols are to be interrogated
+ * @param callback Callback for each symbol
+ * @param handle   Handle for the callback
+ *
+ */
+extern int
+nfp_find_rtsyms(struct nfp *nfp, nfp_rtsym_fn callback, void *handle)
+{
+    const struct nfp_rtsym *rtsym;
+    struct nfp_cppid cppid;
+    int i, num_symbols;
+    int used, num_used;
+
+    if ((!nfp) || (!nfp->dev)) return -1;
+    nfp_rtsym_reload(nfp->dev);
+    num_symbols=nfp_rtsym_count(nfp->dev);
+
+    num_used = 0;
+    for (i=0; i<num_symbols; i++) {
+        rtsym = nfp_rtsym_get(nfp->dev,i);
+        if (!rtsym) continue;
+        cppid.cpp_id = NFP_CPP_ISLAND_ID(rtsym->target, NFP_CPP_ACTION_RW, 0, rtsym->domain);
+        cppid.addr   = rtsym->addr;
+        used = callback(handle, rtsym->name, &cppid, rtsym->size);
+        if (used < 0) return -1;
+        if (used > 0) num_used++;
+    }
+    return num_used;
+}
+
 /*a Firmware sync support */
 /*f nfp_sync_resolve */
 extern int
@@ -24,6 +24,11 @@
  *
  */
 
+/*a Open guard
+ */
+#ifndef _NFP_SUPPORT_H_
+#define _NFP_SUPPORT_H_
+
 /*a Includes
  */
 #include <stdio.h>
@@ -51,6 +56,15 @@ struct nfp_cppid {
     uint64_t addr;
 };
 
+/*f nfp_rtsym_fn */
+/**
+ * Callback for each run-time symbol found by nfp_find_rtsyms; returns
+ * a positive value if the symbol is used, 0 if not, and negative on
+ * error
+ */
+typedef int (*nfp_rtsym_fn)(void *handle, const char *sym_name,
+                            const struct nfp_cppid *cppid, uint64_t size);
+
 /*a Functions
  */
 /*f nfp_init */
@@ -84,7 +98,8 @@ extern struct nfp *nfp_init(int device_num, int sig_term);
  *
  * @param nfp    NFP structure of device to shut down
  *
- * Shutdown the NFP, unloading firmware before closing the device
+ * Shutdown the NFP, unloading firmware before closing the device if
+ * it was loaded with nfp_fw_load
  * Performs an incremental shutdown of the activated components, and can
  * be performed many times successively without failure
  * Removes the NFP from the list to be shutdown at exit
@@ -273,6 +288,26 @@ extern void nfp_show_rtsyms(struct nfp *nfp);
 extern int nfp_get_rtsym_cppid(struct nfp *nfp,
                                const char *sym_name, struct nfp_cppid *cppid);
 
+/*f nfp_find_rtsyms */
+/**
+ *
+ * @brief Invoke a callback for every run-time symbol of the firmware
+ *
+ * @param nfp      Nfp with loaded firmware whose run-time symbols are to be interrogated
+ *
+ * @param callback Callback invoked with the name, nfp_cppid and size of each symbol
+ *
+ * @param handle   Handle passed to @p callback
+ *
+ * @returns -1 on failure (including the callback failing), else the
+ * number of symbols the callback used
+ *
+ * This is used to discover, for example, the firmware counter blocks
+ * (firmware/nfp_stats.h) of every island.
+ *
+ */
+extern int nfp_find_rtsyms(struct nfp *nfp, nfp_rtsym_fn callback, void *handle);
+
 /*f nfp_sync_resolve */
 /**
  * @brief Resolve NFP sync library memory contents based on run-time
@@ -338,3 +373,7 @@ extern int nfp_write(struct nfp *nfp, struct nfp_cppid *cppid, int offset, void
  *
   */
 extern int nfp_read(struct nfp *nfp, struct nfp_cppid *cppid, int offset, void *data, ssize_t size);
+
+/*a Close guard
+ */
+#endif /* _NFP_SUPPORT_H_ */
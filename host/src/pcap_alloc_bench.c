@@ -0,0 +1,260 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file  pcap_alloc_bench.c
+ * @brief Benchmark of the packet capture MU buffer allocator model
+ *
+ * Threads allocate packets with the pcap_alloc_model, as the capture
+ * threads of the firmware do, with packet sizes from a distribution;
+ * the fill of the buffers, where the rest of them goes, and the
+ * retries of the allocation are reported for each distribution. The
+ * buffer geometry may be changed from that of the firmware to find
+ * its effect before changing the firmware.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include "pcap_alloc_model.h"
+
+/*a Defines
+ */
+#define PCAP_ALLOC_BENCH_MAX_THREADS 64
+
+/*a Types */
+/*t struct bench_dist */
+/**
+ * Packet size distribution, as lengths picked from uniformly
+ */
+struct bench_dist {
+    const char *name;
+    int num_lengths;
+    uint32_t lengths[12];
+};
+
+/*t struct bench_thread */
+/**
+ * A thread allocating packets
+ */
+struct bench_thread {
+    pthread_t thread;
+    pthread_barrier_t *barrier;
+    struct pcap_alloc_model *model;
+    const struct bench_dist *dist;
+    uint64_t num_pkts;
+    uint32_t seed;
+    struct pcap_alloc_model_stats stats;
+};
+
+/*a Global variables */
+static const struct bench_dist dists[] = {
+    /* Simple IMIX, 7:4:1 of frames carrying 40B, 576B and 1500B IP */
+    {"imix",  12, {64, 64, 64, 64, 64, 64, 64, 594, 594, 594, 594, 1518}},
+    {"64",    1,  {64}},
+    {"jumbo", 1,  {9018}},
+};
+static const char *options = "t:n:d:b:f:m:l:h";
+static struct option long_options[] = {
+    {"threads",   required_argument, 0, 't'},
+    {"packets",   required_argument, 0, 'n'},
+    {"dist",      required_argument, 0, 'd'},
+    {"buf_kb",    required_argument, 0, 'b'},
+    {"first",     required_argument, 0, 'f'},
+    {"max_pkts",  required_argument, 0, 'm'},
+    {"new_buf_ns",required_argument, 0, 'l'},
+    {"help",      no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+};
+
+/*a Functions
+ */
+/*f usage */
+static void
+usage(void)
+{
+    printf("Usage: pcap_alloc_bench [options]\n"
+           "    -t, --threads <n>     allocating threads (default 8)\n"
+           "    -n, --packets <n>     packets per thread (default 1000000)\n"
+           "    -d, --dist <name>     imix, 64 or jumbo (default all)\n"
+           "    -b, --buf_kb <kB>     MU buffer size (default %d)\n"
+           "    -f, --first <bytes>   first packet offset (default %d)\n"
+           "    -m, --max_pkts <n>    packets per buffer (default %d)\n"
+           "    -l, --new_buf_ns <ns> time to get a new buffer (default 300)\n"
+           "    -h, --help            print this help\n",
+           PCAP_ALLOC_MODEL_BUF_SIZE/1024, PCAP_BUF_FIRST_PKT_OFFSET, PCAP_BUF_MAX_PKT);
+}
+
+/*f time_ns */
+static uint64_t
+time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+
+/*f bench_thread */
+static void *
+bench_thread(void *handle)
+{
+    struct bench_thread *bt = (struct bench_thread *)handle;
+    struct pcap_alloc_model_pkt pkt;
+    uint32_t r;
+    uint64_t i;
+
+    r = bt->seed;
+    pthread_barrier_wait(bt->barrier);
+    for (i=0; i<bt->num_pkts; i++) {
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+        pcap_alloc_model_alloc(bt->model, &bt->stats,
+                               bt->dist->lengths[r % bt->dist->num_lengths],
+                               &pkt);
+    }
+    pthread_barrier_wait(bt->barrier);
+    return NULL;
+}
+
+/*f run_dist */
+/**
+ * @brief Run the threads with a distribution, and print the results
+ */
+static int
+run_dist(const struct pcap_alloc_model_config *config,
+         const struct bench_dist *dist, int threads, uint64_t num_pkts)
+{
+    struct pcap_alloc_model model;
+    struct pcap_alloc_model_stats total;
+    struct bench_thread bt[PCAP_ALLOC_BENCH_MAX_THREADS];
+    pthread_barrier_t barrier;
+    uint64_t start_ns, elapsed_ns;
+    double buffer_bytes;
+    int i;
+
+    if (pcap_alloc_model_init(&model, config) != 0)
+        return 1;
+    pthread_barrier_init(&barrier, NULL, threads+1);
+    for (i=0; i<threads; i++) {
+        memset(&bt[i], 0, sizeof(bt[i]));
+        bt[i].barrier  = &barrier;
+        bt[i].model    = &model;
+        bt[i].dist     = dist;
+        bt[i].num_pkts = num_pkts;
+        bt[i].seed     = 0x9e3779b9 * (i+1);
+        pthread_create(&bt[i].thread, NULL, bench_thread, &bt[i]);
+    }
+    pthread_barrier_wait(&barrier);
+    start_ns = time_ns();
+    pthread_barrier_wait(&barrier);
+    elapsed_ns = time_ns() - start_ns;
+    memset(&total, 0, sizeof(total));
+    for (i=0; i<threads; i++) {
+        pthread_join(bt[i].thread, NULL);
+        pcap_alloc_model_stats_add(&total, &bt[i].stats);
+    }
+    pthread_barrier_destroy(&barrier);
+    pcap_alloc_model_flush(&model, &total);
+
+    buffer_bytes = (double)total.buffers * config->buf_size;
+    printf("%-6s %10" PRIu64 " %8.2f %8" PRIu64 " %8.1f %6.2f%% %6.2f%% %6.2f%% %6.2f%% %9.0f %8.5f %8.5f\n",
+           dist->name, total.packets,
+           total.packets * 1.0E3 / elapsed_ns,
+           total.buffers,
+           (double)total.packets / total.buffers,
+           100.0 * total.packet_bytes / buffer_bytes,
+           100.0 * total.buffers * config->first_pkt_offset / buffer_bytes,
+           100.0 * (total.blocks*64 - total.packet_bytes) / buffer_bytes,
+           100.0 * total.tail_bytes / buffer_bytes,
+           (double)total.tail_bytes / total.buffers,
+           (double)total.retries / total.packets,
+           (double)total.cas_failures / total.packets);
+    return 0;
+}
+
+/*f main */
+/**
+ * @brief Run the benchmark for the distributions
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    struct pcap_alloc_model_config config;
+    struct pcap_alloc_model model;
+    const char *dist_name;
+    uint64_t num_pkts;
+    int threads;
+    int i, run;
+
+    pcap_alloc_model_config_default(&config);
+    config.new_buf_delay_ns = 300;
+    threads = 8;
+    num_pkts = 1000000;
+    dist_name = NULL;
+    for (;;) {
+        int c;
+        c = getopt_long(argc, argv, options, long_options, NULL);
+        if (c == -1)
+            break;
+        switch (c) {
+        case 't': threads = atoi(optarg); break;
+        case 'n': num_pkts = strtoull(optarg, NULL, 0); break;
+        case 'd': dist_name = optarg; break;
+        case 'b': config.buf_size = atoi(optarg)*1024; break;
+        case 'f': config.first_pkt_offset = atoi(optarg); break;
+        case 'm': config.max_pkts = atoi(optarg); break;
+        case 'l': config.new_buf_delay_ns = atoi(optarg); break;
+        case 'h': usage(); return 0;
+        default: usage(); return 1;
+        }
+    }
+    if ((threads < 1) || (threads > PCAP_ALLOC_BENCH_MAX_THREADS)) {
+        fprintf(stderr,"Threads must be 1 to %d\n", PCAP_ALLOC_BENCH_MAX_THREADS);
+        return 1;
+    }
+    if (pcap_alloc_model_init(&model, &config) != 0) {
+        fprintf(stderr,"Invalid buffer configuration; the first packet offset must be "
+                "past the packet descriptors, and sizes multiples of 64B\n");
+        return 1;
+    }
+
+    printf("buffer %uB, first packet at %uB, %u packets, new buffer %uns, %d threads\n",
+           config.buf_size, config.first_pkt_offset, config.max_pkts,
+           config.new_buf_delay_ns, threads);
+    printf("%-6s %10s %8s %8s %8s %7s %7s %7s %7s %9s %8s %8s\n",
+           "dist", "packets", "Mpkt/s", "buffers", "pkts/buf", "fill",
+           "header", "pad", "tail", "tail_B", "retry/pk", "cas/pkt");
+    run = 0;
+    for (i=0; i<sizeof(dists)/sizeof(dists[0]); i++) {
+        if (dist_name && strcmp(dist_name, dists[i].name))
+            continue;
+        if (run_dist(&config, &dists[i], threads, num_pkts) != 0)
+            return 1;
+        run++;
+    }
+    if (run == 0) {
+        fprintf(stderr,"Unknown distribution '%s'\n", dist_name);
+        return 1;
+    }
+    return 0;
+}
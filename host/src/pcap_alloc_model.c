@@ -0,0 +1,276 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_alloc_model.c
+ * @brief         Host model of the packet capture MU buffer allocator
+ *
+ * The mu_buf_desc is held as two 32-bit words as the firmware has
+ * them: word 0 (the top of the 64-bit atomic) has the 24-bit offset in
+ * 64B blocks above 8 bits of pad, and word 1 has the 16-bit packet
+ * number above the 16-bit buffer number. The MU test_addsat adds to each
+ * word independently, saturating; C11 has no such atomic, so it is a
+ * compare-and-swap loop here, whose failures are host contention only.
+ *
+ * pkt_buffer_alloc_from_current, pkt_buffer_alloc_from_new and
+ * pkt_buffer_alloc follow the firmware functions of the same names.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
+#include "pcap_alloc_model.h"
+
+/*a Defines
+ */
+#define DESC(offset,number,mu_buf) \
+    ((((uint64_t)(offset))<<40) | (((uint64_t)(number))<<16) | (mu_buf))
+#define DESC_OFFSET(desc)      ((uint32_t)((desc)>>40) & 0xffffff)
+#define DESC_NUMBER(desc)      ((uint32_t)((desc)>>16) & 0xffff)
+#define DESC_MU_BUF(desc)      ((uint32_t)(desc) & 0xffff)
+
+/*a Types
+ */
+/*t enum alloc_result */
+enum alloc_result {
+    PKT_BUF_NOT_INIT,
+    PKT_BUF_OVERFLOWED,
+    PKT_BUF_ALLOCKED
+};
+
+/*a Static functions
+ */
+/*f addsat32 */
+static uint32_t
+addsat32(uint32_t a, uint32_t b)
+{
+    uint32_t sum;
+    sum = a + b;
+    return (sum < a) ? 0xffffffff : sum;
+}
+
+/*f desc_test_addsat */
+/**
+ * @brief Saturating add to each word of the descriptor, returning its
+ * previous value, as mem[test_addsat]
+ */
+static uint64_t
+desc_test_addsat(struct pcap_alloc_model *model,
+                 struct pcap_alloc_model_stats *stats,
+                 uint64_t add)
+{
+    uint64_t old, new;
+
+    old = atomic_load_explicit(&model->desc, memory_order_relaxed);
+    for (;;) {
+        new = (((uint64_t)addsat32(old>>32, add>>32))<<32) | addsat32(old, add);
+        if (atomic_compare_exchange_weak_explicit(&model->desc, &old, new,
+                                                  memory_order_acq_rel,
+                                                  memory_order_relaxed))
+            return old;
+        stats->cas_failures++;
+    }
+}
+
+/*f delay_ns */
+static void
+delay_ns(uint32_t ns)
+{
+    struct timespec ts;
+    uint64_t end, now;
+
+    if (ns == 0)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    end = ts.tv_sec*1000000000ULL + ts.tv_nsec + ns;
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = ts.tv_sec*1000000000ULL + ts.tv_nsec;
+    } while (now < end);
+}
+
+/*f pkt_mu_buf_desc_complete */
+/**
+ * @brief Complete a buffer, given the descriptor as the allocation
+ * that overflowed it found it
+ */
+static void
+pkt_mu_buf_desc_complete(struct pcap_alloc_model *model,
+                         struct pcap_alloc_model_stats *stats,
+                         uint64_t desc)
+{
+    stats->buffers++;
+    stats->tail_bytes += model->config.buf_size - (DESC_OFFSET(desc)<<6);
+}
+
+/*f pkt_buffer_alloc_from_current */
+static enum alloc_result
+pkt_buffer_alloc_from_current(struct pcap_alloc_model *model,
+                              struct pcap_alloc_model_stats *stats,
+                              struct pcap_alloc_model_pkt *pkt,
+                              uint64_t *desc)
+{
+    uint32_t buffer_end, offset, number;
+    int pkt_starts_okay, pkt_ends_okay, pkt_num_okay, pkt_num_max;
+
+    buffer_end = model->config.buf_size >> 6;
+    for (;;) {
+        *desc = desc_test_addsat(model, stats, DESC(pkt->num_blocks, 1, 0));
+        offset = DESC_OFFSET(*desc);
+        number = DESC_NUMBER(*desc);
+        if (DESC_MU_BUF(*desc) == 0) {
+            if (offset == 0) return PKT_BUF_NOT_INIT;
+            stats->retries++;
+            sched_yield();
+            continue;
+        }
+
+        pkt_starts_okay = (offset <= buffer_end);
+        pkt_ends_okay   = ((offset + pkt->num_blocks) <= buffer_end);
+        pkt_num_okay    = (number < model->config.max_pkts);
+        pkt_num_max     = (number == model->config.max_pkts);
+
+        if (pkt_ends_okay && pkt_num_okay) {
+            pkt->mu_num      = number;
+            pkt->mu_buf      = DESC_MU_BUF(*desc);
+            pkt->mu_offset   = offset << 6;
+            return PKT_BUF_ALLOCKED;
+        }
+        if (pkt_starts_okay && (pkt_num_max || pkt_num_okay))
+            return PKT_BUF_OVERFLOWED;
+
+        stats->retries++;
+        sched_yield();
+    }
+}
+
+/*f pkt_buffer_alloc_from_new */
+static void
+pkt_buffer_alloc_from_new(struct pcap_alloc_model *model,
+                          struct pcap_alloc_model_pkt *pkt)
+{
+    uint32_t buf;
+
+    /* Buffers from the recycler; mu_buf of 0 means uninitialized */
+    buf = atomic_fetch_add_explicit(&model->next_buf, 1, memory_order_relaxed);
+    delay_ns(model->config.new_buf_delay_ns);
+
+    pkt->mu_buf      = (buf % 0xffff) + 1;
+    pkt->mu_offset   = model->config.first_pkt_offset;
+    pkt->mu_num      = 0;
+    atomic_store_explicit(&model->desc,
+                          DESC((model->config.first_pkt_offset>>6) + pkt->num_blocks,
+                               1, pkt->mu_buf),
+                          memory_order_release);
+}
+
+/*a External functions
+ */
+/*f pcap_alloc_model_config_default */
+extern void
+pcap_alloc_model_config_default(struct pcap_alloc_model_config *config)
+{
+    config->buf_size         = PCAP_ALLOC_MODEL_BUF_SIZE;
+    config->first_pkt_offset = PCAP_BUF_FIRST_PKT_OFFSET;
+    config->max_pkts         = PCAP_BUF_MAX_PKT;
+    config->new_buf_delay_ns = 0;
+}
+
+/*f pcap_alloc_model_init */
+extern int
+pcap_alloc_model_init(struct pcap_alloc_model *model,
+                      const struct pcap_alloc_model_config *config)
+{
+    if ((config->buf_size & 63) || (config->first_pkt_offset & 63))
+        return 1;
+    if ((config->max_pkts < 1) || (config->max_pkts > PCAP_ALLOC_MODEL_MAX_PKTS))
+        return 1;
+    if ((config->buf_size >> 6) >= (1<<24))
+        return 1;
+    /* Header, packet bitmask, and packet descriptors */
+    if (config->first_pkt_offset < PCAP_BUF_MIN_FIRST_PKT_OFFSET(config->max_pkts))
+        return 1;
+    if (config->first_pkt_offset >= config->buf_size)
+        return 1;
+    memset(model, 0, sizeof(*model));
+    model->config = *config;
+    atomic_init(&model->desc, 0);
+    atomic_init(&model->next_buf, 0);
+    return 0;
+}
+
+/*f pcap_alloc_model_num_blocks */
+extern uint32_t
+pcap_alloc_model_num_blocks(uint32_t length)
+{
+    return (length + PCAP_ALLOC_MODEL_CTM_PKT_OFFSET + 63) >> 6;
+}
+
+/*f pcap_alloc_model_alloc */
+extern void
+pcap_alloc_model_alloc(struct pcap_alloc_model *model,
+                       struct pcap_alloc_model_stats *stats,
+                       uint32_t length,
+                       struct pcap_alloc_model_pkt *pkt)
+{
+    enum alloc_result alloc;
+    uint64_t desc;
+
+    pkt->num_blocks = pcap_alloc_model_num_blocks(length);
+    stats->packets++;
+    stats->packet_bytes += length;
+    stats->blocks       += pkt->num_blocks;
+
+    alloc = pkt_buffer_alloc_from_current(model, stats, pkt, &desc);
+    if (alloc == PKT_BUF_ALLOCKED) return;
+    if (alloc == PKT_BUF_OVERFLOWED) {
+        stats->overflows++;
+        pkt_mu_buf_desc_complete(model, stats, desc);
+    } else {
+        stats->not_init++;
+    }
+    pkt_buffer_alloc_from_new(model, pkt);
+}
+
+/*f pcap_alloc_model_flush */
+extern void
+pcap_alloc_model_flush(struct pcap_alloc_model *model,
+                       struct pcap_alloc_model_stats *stats)
+{
+    uint64_t desc;
+
+    desc = atomic_exchange(&model->desc, 0);
+    if (DESC_MU_BUF(desc) != 0)
+        pkt_mu_buf_desc_complete(model, stats, desc);
+}
+
+/*f pcap_alloc_model_stats_add */
+extern void
+pcap_alloc_model_stats_add(struct pcap_alloc_model_stats *total,
+                           const struct pcap_alloc_model_stats *stats)
+{
+    total->packets      += stats->packets;
+    total->packet_bytes += stats->packet_bytes;
+    total->blocks       += stats->blocks;
+    total->retries      += stats->retries;
+    total->overflows    += stats->overflows;
+    total->not_init     += stats->not_init;
+    total->cas_failures += stats->cas_failures;
+    total->buffers      += stats->buffers;
+    total->tail_bytes   += stats->tail_bytes;
+}
@@ -0,0 +1,170 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_alloc_model.h
+ * @brief         Host model of the packet capture MU buffer allocator
+ *
+ * This models pkt_buffer_alloc in the pcap firmware: capture threads
+ * allocate space for each packet in the current MU buffer with a
+ * saturating test-and-add on the two-word mu_buf_desc, and the thread
+ * whose allocation overflows it completes the buffer and starts a new
+ * one, while other threads retry. Here the mu_buf_desc is a C11 atomic
+ * 64-bit word, so any number of host threads may allocate at once.
+ *
+ * The model allocates space only; the buffer geometry is configurable,
+ * so that the fill of the buffers can be measured for different
+ * buffer sizes, first packet offsets and packet limits before the
+ * firmware is changed.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_ALLOC_MODEL_H_
+#define _PCAP_ALLOC_MODEL_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <stdatomic.h>
+#include "firmware/pcap.h"
+
+/*a Defines
+ */
+/* Default size of MU buffer in the firmware */
+#define PCAP_ALLOC_MODEL_BUF_SIZE (1<<PCAP_BUF_SIZE_SHIFT)
+
+/* Packet metadata DMAed ahead of the packet, as CTM_PKT_OFFSET in the firmware */
+#define PCAP_ALLOC_MODEL_CTM_PKT_OFFSET 64
+
+/* Largest max_pkts, as the firmware allows */
+#define PCAP_ALLOC_MODEL_MAX_PKTS PCAP_BUF_MAX_PKTS_LIMIT
+
+/*a Types
+ */
+/*t struct pcap_alloc_model_config */
+/**
+ * Buffer geometry; all byte sizes are multiples of 64
+ */
+struct pcap_alloc_model_config {
+    uint32_t buf_size;         /* PCAP_ALLOC_MODEL_BUF_SIZE */
+    uint32_t first_pkt_offset; /* PCAP_BUF_FIRST_PKT_OFFSET */
+    uint32_t max_pkts;         /* PCAP_BUF_MAX_PKT */
+    uint32_t new_buf_delay_ns; /* Time to get a new buffer from the recycler */
+};
+
+/*t struct pcap_alloc_model */
+/**
+ * Allocator state shared by all threads
+ */
+struct pcap_alloc_model {
+    struct pcap_alloc_model_config config;
+    _Atomic uint64_t desc;     /* mu_buf_desc_store */
+    _Atomic uint32_t next_buf; /* Buffers taken from the recycler */
+};
+
+/*t struct pcap_alloc_model_pkt */
+/**
+ * Allocation of a packet, as in struct pkt_buf_desc
+ */
+struct pcap_alloc_model_pkt {
+    uint32_t num_blocks;  /* 64B blocks required */
+    uint32_t mu_buf;      /* Buffer, numbered from 1 */
+    uint32_t mu_offset;   /* Byte offset in the buffer */
+    uint32_t mu_num;      /* Packet number in the buffer */
+};
+
+/*t struct pcap_alloc_model_stats */
+/**
+ * Statistics of a thread's allocations; bytes in a buffer are either
+ * its header (first_pkt_offset), allocated to packets (blocks), or
+ * the unused tail
+ */
+struct pcap_alloc_model_stats {
+    uint64_t packets;
+    uint64_t packet_bytes;   /* Of the packets themselves */
+    uint64_t blocks;         /* 64B blocks allocated to packets */
+    uint64_t retries;        /* Failed allocations waiting for a new buffer */
+    uint64_t overflows;      /* Allocations completing a full buffer */
+    uint64_t not_init;       /* Allocations starting the first buffer */
+    uint64_t cas_failures;   /* Host contention on the descriptor */
+    uint64_t buffers;        /* Buffers completed */
+    uint64_t tail_bytes;     /* Unused at the end of completed buffers */
+};
+
+/*a Functions
+ */
+/*f pcap_alloc_model_config_default */
+/**
+ * @brief Get the default configuration of the firmware
+ *
+ */
+extern void pcap_alloc_model_config_default(struct pcap_alloc_model_config *config);
+
+/*f pcap_alloc_model_init */
+/**
+ * @brief Initialize the model, with the mu_buf_desc uninitialized as
+ * at firmware start
+ *
+ * @returns Zero on success, non-zero if the configuration is invalid,
+ * including if the first packet offset leaves too little room for the
+ * buffer header, bitmask and max_pkts packet descriptors
+ *
+ */
+extern int pcap_alloc_model_init(struct pcap_alloc_model *model,
+                                 const struct pcap_alloc_model_config *config);
+
+/*f pcap_alloc_model_num_blocks */
+/**
+ * @brief Get the 64B blocks a packet of @p length bytes takes, as the
+ * firmware does
+ *
+ */
+extern uint32_t pcap_alloc_model_num_blocks(uint32_t length);
+
+/*f pcap_alloc_model_alloc */
+/**
+ * @brief Allocate space for a packet; may be called by many threads
+ *
+ * @param stats   Statistics of the calling thread
+ *
+ * @param length  Packet length in bytes
+ *
+ * @param pkt     Allocation made
+ *
+ */
+extern void pcap_alloc_model_alloc(struct pcap_alloc_model *model,
+                                   struct pcap_alloc_model_stats *stats,
+                                   uint32_t length,
+                                   struct pcap_alloc_model_pkt *pkt);
+
+/*f pcap_alloc_model_flush */
+/**
+ * @brief Complete the current buffer, when no thread is allocating
+ *
+ */
+extern void pcap_alloc_model_flush(struct pcap_alloc_model *model,
+                                   struct pcap_alloc_model_stats *stats);
+
+/*f pcap_alloc_model_stats_add */
+/**
+ * @brief Add the statistics of @p stats to @p total
+ *
+ */
+extern void pcap_alloc_model_stats_add(struct pcap_alloc_model_stats *total,
+                                       const struct pcap_alloc_model_stats *stats);
+
+/*a Close guard
+ */
+#endif /* _PCAP_ALLOC_MODEL_H_ */
@@ -0,0 +1,337 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_alloc_model_test.c
+ * @brief         Test for the packet capture MU buffer allocator model
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "pcap_alloc_model.h"
+
+/*a Defines
+ */
+#define TEST_THREADS         8
+#define TEST_PKTS_PER_THREAD 20000
+
+/*a Types
+ */
+/*t struct test_thread */
+struct test_thread {
+    pthread_t thread;
+    struct pcap_alloc_model *model;
+    struct pcap_alloc_model_stats stats;
+    struct pcap_alloc_model_pkt *pkts;
+    int seed;
+};
+
+/*a Useful functions
+ */
+/*f check_accounting */
+/**
+ * @brief Check every byte of the completed buffers is header, packet or tail
+ */
+static int
+check_accounting(const struct pcap_alloc_model *model,
+                 const struct pcap_alloc_model_stats *stats)
+{
+    uint64_t used;
+    used = stats->buffers * model->config.first_pkt_offset +
+        stats->blocks * 64 + stats->tail_bytes;
+    return (used != stats->buffers * model->config.buf_size);
+}
+
+/*f compare_pkts */
+static int
+compare_pkts(const void *a, const void *b)
+{
+    const struct pcap_alloc_model_pkt *pa = a;
+    const struct pcap_alloc_model_pkt *pb = b;
+    if (pa->mu_buf != pb->mu_buf)
+        return (pa->mu_buf < pb->mu_buf) ? -1 : 1;
+    if (pa->mu_offset != pb->mu_offset)
+        return (pa->mu_offset < pb->mu_offset) ? -1 : 1;
+    return 0;
+}
+
+/*f check_pkts */
+/**
+ * @brief Check allocations lie in their buffers without overlapping,
+ * numbered from 0 in order
+ */
+static int
+check_pkts(const struct pcap_alloc_model *model,
+           struct pcap_alloc_model_pkt *pkts, int num_pkts)
+{
+    const struct pcap_alloc_model_pkt *pkt;
+    uint32_t end, number;
+    int i;
+
+    qsort(pkts, num_pkts, sizeof(*pkts), compare_pkts);
+    end = 0;
+    number = 0;
+    for (i=0; i<num_pkts; i++) {
+        pkt = &pkts[i];
+        if ((i == 0) || (pkt->mu_buf != pkts[i-1].mu_buf)) {
+            end = model->config.first_pkt_offset;
+            number = 0;
+        }
+        if (pkt->mu_offset != end) return 1;
+        if (pkt->mu_num != number) return 1;
+        if (pkt->mu_num >= model->config.max_pkts) return 1;
+        end += pkt->num_blocks << 6;
+        number++;
+        if (end > model->config.buf_size) return 1;
+    }
+    return 0;
+}
+
+/*f alloc_thread */
+static void *
+alloc_thread(void *handle)
+{
+    struct test_thread *tt = (struct test_thread *)handle;
+    static const uint32_t lengths[] = {60, 64, 100, 576, 1500, 9000};
+    uint32_t r;
+    int i;
+
+    r = tt->seed;
+    for (i=0; i<TEST_PKTS_PER_THREAD; i++) {
+        r = r*1103515245 + 12345;
+        pcap_alloc_model_alloc(tt->model, &tt->stats,
+                               lengths[(r>>16) % (sizeof(lengths)/sizeof(lengths[0]))],
+                               &tt->pkts[i]);
+    }
+    return NULL;
+}
+
+/*a Tests
+ */
+/*f test_config */
+/**
+ * @brief The firmware configuration is valid, and too small a first
+ * packet offset is not
+ */
+static int
+test_config(void)
+{
+    struct pcap_alloc_model model;
+    struct pcap_alloc_model_config config;
+
+    pcap_alloc_model_config_default(&config);
+    if (pcap_alloc_model_init(&model, &config) != 0) return 1;
+    config.first_pkt_offset = 8*1024;
+    if (pcap_alloc_model_init(&model, &config) == 0) return 2;
+    pcap_alloc_model_config_default(&config);
+    config.max_pkts = 2048;
+    if (pcap_alloc_model_init(&model, &config) == 0) return 3;
+    config.first_pkt_offset = PCAP_BUF_MIN_FIRST_PKT_OFFSET(2048);
+    if (pcap_alloc_model_init(&model, &config) != 0) return 5;
+    config.max_pkts = PCAP_BUF_MAX_PKTS_LIMIT+1;
+    config.buf_size = 1<<PCAP_BUF_SIZE_SHIFT_MAX;
+    config.first_pkt_offset = PCAP_BUF_MIN_FIRST_PKT_OFFSET(PCAP_BUF_MAX_PKTS_LIMIT+1);
+    if (pcap_alloc_model_init(&model, &config) == 0) return 6;
+    config.max_pkts = 64;
+    config.buf_size = 64*1024 + 32;
+    if (pcap_alloc_model_init(&model, &config) == 0) return 4;
+    return 0;
+}
+
+/*f test_limits */
+/**
+ * @brief Buffers are completed at the packet limit for small packets,
+ * and when full for large packets
+ */
+static int
+test_limits(void)
+{
+    struct pcap_alloc_model model;
+    struct pcap_alloc_model_config config;
+    struct pcap_alloc_model_stats stats;
+    struct pcap_alloc_model_pkt *pkts;
+    int i, num_pkts;
+    int err;
+
+    err = 0;
+    pcap_alloc_model_config_default(&config);
+    num_pkts = 3*PCAP_BUF_MAX_PKT + 10;
+    pkts = malloc(num_pkts * sizeof(*pkts));
+    if (!pkts) return 1;
+
+    /* 64B packets take 2 blocks; PCAP_BUF_MAX_PKT fill 255kB */
+    pcap_alloc_model_init(&model, &config);
+    memset(&stats, 0, sizeof(stats));
+    for (i=0; i<num_pkts; i++)
+        pcap_alloc_model_alloc(&model, &stats, 64, &pkts[i]);
+    if ((stats.not_init != 1) || (stats.overflows != 3) || (stats.buffers != 3)) err = 2;
+    if (stats.tail_bytes != 3*(config.buf_size - config.first_pkt_offset - PCAP_BUF_MAX_PKT*128)) err = 3;
+    if (pkts[PCAP_BUF_MAX_PKT].mu_buf != pkts[0].mu_buf+1) err = 4;
+    if (check_pkts(&model, pkts, num_pkts)) err = 5;
+    pcap_alloc_model_flush(&model, &stats);
+    if ((stats.buffers != 4) || check_accounting(&model, &stats)) err = 6;
+    if (stats.retries != 0) err = 7;
+
+    /* 1500B packets take 25 blocks; 151 fill all but 64B of 236kB */
+    pcap_alloc_model_init(&model, &config);
+    memset(&stats, 0, sizeof(stats));
+    for (i=0; i<1000; i++)
+        pcap_alloc_model_alloc(&model, &stats, 1500, &pkts[i]);
+    if ((stats.overflows != 1000/151) || (stats.tail_bytes != (1000/151)*64)) err = 8;
+    if (check_pkts(&model, pkts, 1000)) err = 9;
+    pcap_alloc_model_flush(&model, &stats);
+    if (check_accounting(&model, &stats)) err = 10;
+    free(pkts);
+    return err;
+}
+
+/*f test_geometry */
+/**
+ * @brief Small packets fill 2MB buffers by space, with the most
+ * packets in a buffer, and 64kB buffers by packet count
+ */
+static int
+test_geometry(void)
+{
+    struct pcap_alloc_model model;
+    struct pcap_alloc_model_config config;
+    struct pcap_alloc_model_stats stats;
+    struct pcap_alloc_model_pkt *pkts;
+    uint32_t per_buf;
+    int i, num_pkts;
+    int err;
+
+    err = 0;
+    num_pkts = 2*14320 + 1;
+    pkts = malloc(num_pkts * sizeof(*pkts));
+    if (!pkts) return 1;
+
+    /* 2MB, first packet at 258kB; 14320 64B packets fill it */
+    pcap_alloc_model_config_default(&config);
+    config.buf_size         = 2*1024*1024;
+    config.max_pkts         = PCAP_BUF_MAX_PKTS_LIMIT;
+    config.first_pkt_offset = PCAP_BUF_MIN_FIRST_PKT_OFFSET(config.max_pkts);
+    if (pcap_alloc_model_init(&model, &config) != 0) err = 2;
+    per_buf = (config.buf_size - config.first_pkt_offset) / 128;
+    if (per_buf != 14320) err = 3;
+    memset(&stats, 0, sizeof(stats));
+    for (i=0; i<num_pkts; i++)
+        pcap_alloc_model_alloc(&model, &stats, 64, &pkts[i]);
+    if ((stats.overflows != 2) || (stats.tail_bytes != 0)) err = 4;
+    if (pkts[per_buf].mu_buf != pkts[0].mu_buf+1) err = 5;
+    if (check_pkts(&model, pkts, num_pkts)) err = 6;
+    pcap_alloc_model_flush(&model, &stats);
+    if (check_accounting(&model, &stats)) err = 7;
+
+    /* 64kB, 255 packets of 64B leave 28kB */
+    config.buf_size         = 64*1024;
+    config.max_pkts         = 255;
+    config.first_pkt_offset = PCAP_BUF_MIN_FIRST_PKT_OFFSET(config.max_pkts);
+    if (pcap_alloc_model_init(&model, &config) != 0) err = 8;
+    memset(&stats, 0, sizeof(stats));
+    for (i=0; i<3*255+1; i++)
+        pcap_alloc_model_alloc(&model, &stats, 64, &pkts[i]);
+    if ((stats.overflows != 3) || (stats.tail_bytes != 3*(65536-6208-255*128))) err = 9;
+    if (check_pkts(&model, pkts, 3*255+1)) err = 10;
+    free(pkts);
+    return err;
+}
+
+/*f test_threads */
+/**
+ * @brief Threads allocating at once get distinct space in each buffer,
+ * and every buffer is completed once
+ */
+static int
+test_threads(void)
+{
+    struct pcap_alloc_model model;
+    struct pcap_alloc_model_config config;
+    struct pcap_alloc_model_stats total;
+    struct test_thread tt[TEST_THREADS];
+    struct pcap_alloc_model_pkt *pkts;
+    int i;
+    int err;
+
+    err = 0;
+    pcap_alloc_model_config_default(&config);
+    config.new_buf_delay_ns = 1000;
+    pcap_alloc_model_init(&model, &config);
+    pkts = malloc(TEST_THREADS * TEST_PKTS_PER_THREAD * sizeof(*pkts));
+    if (!pkts) return 1;
+    for (i=0; i<TEST_THREADS; i++) {
+        memset(&tt[i], 0, sizeof(tt[i]));
+        tt[i].model = &model;
+        tt[i].pkts  = &pkts[i*TEST_PKTS_PER_THREAD];
+        tt[i].seed  = i;
+        pthread_create(&tt[i].thread, NULL, alloc_thread, &tt[i]);
+    }
+    memset(&total, 0, sizeof(total));
+    for (i=0; i<TEST_THREADS; i++) {
+        pthread_join(tt[i].thread, NULL);
+        pcap_alloc_model_stats_add(&total, &tt[i].stats);
+    }
+    pcap_alloc_model_flush(&model, &total);
+    if (total.packets != TEST_THREADS*TEST_PKTS_PER_THREAD) err = 2;
+    if (total.not_init != 1) err = 3;
+    if (total.buffers != total.overflows + 1) err = 4;
+    if (total.buffers != atomic_load(&model.next_buf)) err = 5;
+    if (check_accounting(&model, &total)) err = 6;
+    if (check_pkts(&model, pkts, TEST_THREADS*TEST_PKTS_PER_THREAD)) err = 7;
+    free(pkts);
+    return err;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Configuration",test_config());
+    TEST_RUN("Packet and space limits",test_limits());
+    TEST_RUN("Buffer geometries",test_geometry());
+    TEST_RUN("Concurrent allocation",test_threads());
+    return failures;
+}
@@ -0,0 +1,263 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_consumers.c
+ * @brief         Fan-out of capture buffers to multiple capture consumers
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "pcap_consumers.h"
+
+/*a Static functions
+ */
+/*f inflight_push */
+static void
+inflight_push(struct pcap_consumers *pc, const int *buffers, int num)
+{
+    int i;
+    for (i=0; i<num; i++) {
+        int n;
+        n = (pc->inflight_rptr + pc->num_inflight) % PCAP_CONSUMERS_MAX_BUFFERS;
+        pc->inflight[n] = buffers[i];
+        pc->num_inflight++;
+    }
+}
+
+/*f consumer_take */
+/**
+ * @brief Pop buffers from a consumer's ring and add to a batch those
+ * the consumer holds, dropping (and counting) any other index so that
+ * one bad return cannot lose the rest of the batch
+ */
+static int
+consumer_take(struct pcap_consumers *pc, int consumer, struct pcap_ring *ring,
+              int *batch, int num)
+{
+    int popped;
+    int i;
+
+    popped = num + pcap_ring_pop(ring, batch+num, PCAP_CONSUMERS_MAX_BUFFERS-num);
+    for (i=num; i<popped; i++) {
+        int buffer;
+        buffer = batch[i];
+        if ((buffer < 0) || (buffer >= pc->num_buffers) ||
+            (pc->held_by[buffer] != consumer+1)) {
+            pc->bad_returns++;
+            continue;
+        }
+        pc->held_by[buffer] = 0;
+        batch[num++] = buffer;
+    }
+    return num;
+}
+
+/*f consumer_gather_returned */
+/**
+ * @brief Add the buffers returned by a consumer to a batch
+ */
+static int
+consumer_gather_returned(struct pcap_consumers *pc, int consumer, int *batch, int num)
+{
+    return consumer_take(pc, consumer, &pc->shm->consumers[consumer].returned,
+                         batch, num);
+}
+
+/*f count_completed */
+/**
+ * @brief Add a completed buffer to the statistics and sequence check;
+ * the buffer is not given back to the NFP until a consumer returns it,
+ * so it is stable even once published
+ */
+static void
+count_completed(struct pcap_consumers *pc, const struct pcap_buffer *pcap_buffer)
+{
+    uint32_t total_packets;
+    uint32_t i;
+
+    total_packets = pcap_buffer->hdr.total_packets;
+    if (total_packets > pc->geometry.max_pkts)
+        total_packets = pc->geometry.max_pkts;
+    pc->buffers_completed++;
+    pc->packets_completed += total_packets;
+    for (i=0; i<total_packets; i++) {
+        pc->blocks_completed += pcap_buffer->pkt_desc[i].num_blocks;
+    }
+    pcap_seq_check_buffer(&pc->seq_check, pcap_buffer, total_packets);
+}
+
+/*a External functions
+ */
+/*f pcap_consumers_init */
+extern void
+pcap_consumers_init(struct pcap_consumers *pc,
+                    struct pktgen_pcap_shm *shm,
+                    const struct pcap_buf_geometry *geometry,
+                    void * const *buffer_virt,
+                    int num_buffers,
+                    int assign,
+                    pcap_consumers_give_fn give,
+                    void *give_handle)
+{
+    int i;
+
+    memset(pc, 0, sizeof(*pc));
+    pc->shm         = shm;
+    pc->geometry    = *geometry;
+    pc->buffer_virt = buffer_virt;
+    pc->num_buffers = num_buffers;
+    pc->assign      = assign;
+    pc->give        = give;
+    pc->give_handle = give_handle;
+    pcap_seq_check_init(&pc->seq_check);
+    for (i=0; i<PKTGEN_PCAP_MAX_CONSUMERS; i++) {
+        pcap_ring_init(&shm->consumers[i].completed);
+        pcap_ring_init(&shm->consumers[i].returned);
+    }
+    shm->geometry = *geometry;
+}
+
+/*f pcap_consumers_give */
+extern int
+pcap_consumers_give(struct pcap_consumers *pc, const int *buffers, int num)
+{
+    int i;
+
+    if (num == 0)
+        return 0;
+    if (pc->num_inflight + num > PCAP_CONSUMERS_MAX_BUFFERS) {
+        fprintf(stderr,"Attempt to give more capture buffers than can be in flight\n");
+        return 1;
+    }
+    for (i=0; i<num; i++) {
+        if ((buffers[i] < 0) || (buffers[i] >= pc->num_buffers)) {
+            fprintf(stderr,"Attempt to give capture buffer %d which is out of range\n",buffers[i]);
+            return 1;
+        }
+    }
+    if (pc->give(pc->give_handle, buffers, num) != 0)
+        return 1;
+    inflight_push(pc, buffers, num);
+    pc->buffers_given += num;
+    return 0;
+}
+
+/*f pcap_consumers_attach */
+extern int
+pcap_consumers_attach(struct pcap_consumers *pc)
+{
+    int i;
+
+    for (i=0; i<PKTGEN_PCAP_MAX_CONSUMERS; i++) {
+        if (!pc->attached[i]) {
+            pcap_ring_init(&pc->shm->consumers[i].completed);
+            pcap_ring_init(&pc->shm->consumers[i].returned);
+            pc->attached[i] = 1;
+            pc->num_attached++;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*f pcap_consumers_detach */
+extern int
+pcap_consumers_detach(struct pcap_consumers *pc, int consumer)
+{
+    int batch[PCAP_CONSUMERS_MAX_BUFFERS];
+    int num;
+
+    if ((consumer < 0) || (consumer >= PKTGEN_PCAP_MAX_CONSUMERS) ||
+        !pc->attached[consumer])
+        return 1;
+    num = consumer_gather_returned(pc, consumer, batch, 0);
+    num = consumer_take(pc, consumer, &pc->shm->consumers[consumer].completed,
+                        batch, num);
+    pc->attached[consumer] = 0;
+    pc->num_attached--;
+    return pcap_consumers_give(pc, batch, num);
+}
+
+/*f pcap_consumers_assignment */
+extern int
+pcap_consumers_assignment(struct pcap_consumers *pc,
+                          const struct pcap_buf_hdr *hdr)
+{
+    int n;
+    int i;
+
+    if (pc->num_attached == 0)
+        return -1;
+    if (pc->assign == PCAP_CONSUMERS_ASSIGN_HASH) {
+        n = ((hdr->buf_seq * 0x9e3779b1U) >> 16) % pc->num_attached;
+        for (i=0; i<PKTGEN_PCAP_MAX_CONSUMERS; i++) {
+            if (pc->attached[i] && (n-- == 0))
+                return i;
+        }
+        return -1;
+    }
+    for (i=0; i<PKTGEN_PCAP_MAX_CONSUMERS; i++) {
+        n = (pc->next_consumer + i) % PKTGEN_PCAP_MAX_CONSUMERS;
+        if (pc->attached[n]) {
+            pc->next_consumer = (n+1) % PKTGEN_PCAP_MAX_CONSUMERS;
+            return n;
+        }
+    }
+    return -1;
+}
+
+/*f pcap_consumers_poll */
+extern int
+pcap_consumers_poll(struct pcap_consumers *pc)
+{
+    int batch[PCAP_CONSUMERS_MAX_BUFFERS];
+    int num;
+    int err;
+    int i;
+
+    num = 0;
+    for (i=0; i<PKTGEN_PCAP_MAX_CONSUMERS; i++) {
+        if (pc->attached[i])
+            num = consumer_gather_returned(pc, i, batch, num);
+    }
+    err = pcap_consumers_give(pc, batch, num);
+
+    /* The NFP DMAs a buffer header last, so a non-zero total_packets
+     * indicates a complete buffer */
+    while (pc->num_inflight > 0) {
+        struct pcap_buffer *pcap_buffer;
+        int buffer;
+        int consumer;
+
+        buffer = pc->inflight[pc->inflight_rptr];
+        pcap_buffer = (struct pcap_buffer *)pc->buffer_virt[buffer];
+        if (__atomic_load_n(&pcap_buffer->hdr.total_packets, __ATOMIC_ACQUIRE) == 0)
+            break;
+        consumer = pcap_consumers_assignment(pc, &pcap_buffer->hdr);
+        if ((consumer < 0) ||
+            (pcap_ring_push(&pc->shm->consumers[consumer].completed, &buffer, 1) == 0)) {
+            pc->stalls++;
+            break;
+        }
+        pc->held_by[buffer] = consumer+1;
+        count_completed(pc, pcap_buffer);
+        pc->inflight_rptr = (pc->inflight_rptr+1) % PCAP_CONSUMERS_MAX_BUFFERS;
+        pc->num_inflight--;
+    }
+    return err;
+}
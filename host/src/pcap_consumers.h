@@ -0,0 +1,184 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_consumers.h
+ * @brief         Fan-out of capture buffers to multiple capture consumers
+ *
+ * Capture buffers are given to the NFP in order, and the NFP fills
+ * and completes them in that order. This module keeps the buffers in
+ * flight in that order, and as each completes assigns it to one of
+ * the attached consumers, pushing it to that consumer's completed
+ * ring. Buffers returned by all the consumers are gathered and given
+ * back to the NFP as a single batch; a consumer may only return a
+ * buffer it holds, and any other returned index is dropped.
+ *
+ * The module does not access the NFP itself; buffers are given to
+ * the NFP through a callback, so that the same code runs against the
+ * emulated firmware in the tests.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_CONSUMERS_H_
+#define _PCAP_CONSUMERS_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include "firmware/pcap.h"
+#include "pktgencap.h"
+#include "pcap_seq_check.h"
+
+/*a Defines
+ */
+#define PCAP_CONSUMERS_ASSIGN_ROUND_ROBIN 0
+#define PCAP_CONSUMERS_ASSIGN_HASH        1
+
+/* Maximum number of buffers in flight; the NFP CLS ring size */
+#define PCAP_CONSUMERS_MAX_BUFFERS PCAP_HOST_CLS_RING_SIZE_ENTRIES
+
+/*a Types
+ */
+/*t pcap_consumers_give_fn */
+/**
+ * Callback to give buffers to the NFP and commit them; returns
+ * non-zero on error
+ */
+typedef int (*pcap_consumers_give_fn)(void *handle, const int *buffers, int num);
+
+/*t struct pcap_consumers */
+/**
+ * Fan-out state; the buffers in flight are the 'num_inflight' entries
+ * of 'inflight' from 'inflight_rptr'
+ */
+struct pcap_consumers {
+    struct pktgen_pcap_shm *shm;
+    struct pcap_buf_geometry geometry;
+    void * const *buffer_virt;
+    int      num_buffers;
+    int      assign;
+    pcap_consumers_give_fn give;
+    void    *give_handle;
+
+    int      inflight[PCAP_CONSUMERS_MAX_BUFFERS];
+    int      inflight_rptr;
+    int      num_inflight;
+
+    uint8_t  held_by[PCAP_CONSUMERS_MAX_BUFFERS]; /* Consumer+1 holding
+                                                   * each buffer, 0 if none */
+
+    int      attached[PKTGEN_PCAP_MAX_CONSUMERS];
+    int      num_attached;
+    int      next_consumer; /* For round-robin assignment */
+
+    /* Statistics since initialization */
+    uint64_t buffers_given;
+    uint64_t buffers_completed;
+    uint64_t packets_completed;
+    uint64_t blocks_completed;  /* 64B blocks of completed packets */
+    uint64_t stalls;            /* Polls where a completed buffer could
+                                 * not be handed to a consumer */
+    uint64_t bad_returns;       /* Returned indices dropped as out of
+                                 * range or not held by the consumer */
+    struct pcap_seq_check seq_check; /* Of every completed buffer */
+};
+
+/*a Functions
+ */
+/*f pcap_consumers_init */
+/**
+ * @brief Initialize the fan-out, and the consumer rings and buffer
+ * geometry in shared memory
+ *
+ * @param pc          Fan-out state to initialize
+ *
+ * @param shm         Consumer rings in shared memory
+ *
+ * @param geometry    Geometry of the capture buffers, as given to the NFP
+ *
+ * @param buffer_virt Virtual addresses of the capture buffers
+ *
+ * @param num_buffers Number of capture buffers, at most
+ *                    PCAP_CONSUMERS_MAX_BUFFERS
+ *
+ * @param assign      PCAP_CONSUMERS_ASSIGN_*
+ *
+ * @param give        Callback to give buffers to the NFP
+ *
+ * @param give_handle Handle for @p give
+ *
+ */
+extern void pcap_consumers_init(struct pcap_consumers *pc,
+                                struct pktgen_pcap_shm *shm,
+                                const struct pcap_buf_geometry *geometry,
+                                void * const *buffer_virt,
+                                int num_buffers,
+                                int assign,
+                                pcap_consumers_give_fn give,
+                                void *give_handle);
+
+/*f pcap_consumers_give */
+/**
+ * @brief Give buffers to the NFP, adding them to the buffers in flight
+ *
+ * @returns Zero on success, non-zero on error
+ *
+ */
+extern int pcap_consumers_give(struct pcap_consumers *pc, const int *buffers, int num);
+
+/*f pcap_consumers_attach */
+/**
+ * @brief Attach a new consumer
+ *
+ * @returns Consumer number, or -1 if all are in use
+ *
+ */
+extern int pcap_consumers_attach(struct pcap_consumers *pc);
+
+/*f pcap_consumers_detach */
+/**
+ * @brief Detach a consumer, recycling the buffers it returned or never took
+ *
+ * @returns Zero on success, non-zero on error
+ *
+ */
+extern int pcap_consumers_detach(struct pcap_consumers *pc, int consumer);
+
+/*f pcap_consumers_assignment */
+/**
+ * @brief Determine the consumer to get a completed buffer
+ *
+ * @param pc  Fan-out state
+ *
+ * @param hdr Header of the completed buffer
+ *
+ * @returns Consumer number, or -1 if no consumer is attached
+ *
+ */
+extern int pcap_consumers_assignment(struct pcap_consumers *pc,
+                                     const struct pcap_buf_hdr *hdr);
+
+/*f pcap_consumers_poll */
+/**
+ * @brief Recycle returned buffers and publish completed buffers
+ *
+ * @returns Zero on success, non-zero if giving buffers failed
+ *
+ */
+extern int pcap_consumers_poll(struct pcap_consumers *pc);
+
+/*a Close guard
+ */
+#endif /* _PCAP_CONSUMERS_H_ */
@@ -0,0 +1,452 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_consumers_test.c
+ * @brief         Test for capture buffer fan-out to multiple consumers
+ *
+ * The fan-out runs as in pktgencap, but giving buffers to the emulated
+ * capture firmware; consumers run in their own threads and talk to
+ * the fan-out only through their shared-memory rings.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "pcap_consumers.h"
+#include "pcap_fw_model.h"
+
+/*a Defines
+ */
+#define TEST_NUM_BUFFERS 16
+#define TEST_BUF_SIZE    (1<<PCAP_BUF_SIZE_SHIFT)
+#define TEST_MAX_BUF_SEQ 4096
+#define TEST_MAX_POLLS   (1<<26)
+
+/*a Types
+ */
+/*t struct test_system */
+/**
+ * Fan-out, emulated firmware, and buffers
+ */
+struct test_system {
+    struct pktgen_pcap_shm *shm;
+    void *buffer_virt[TEST_NUM_BUFFERS];
+    struct pcap_fw_model model;
+    struct pcap_consumers pc;
+    int received_by[TEST_MAX_BUF_SEQ];
+    int times_received[TEST_MAX_BUF_SEQ];
+    int stop;
+};
+
+/*t struct test_consumer */
+/**
+ * A consumer thread
+ */
+struct test_consumer {
+    struct test_system *sys;
+    int      consumer;
+    pthread_t thread;
+    int      num_buffers;
+    int      error;
+};
+
+/*a Useful functions
+ */
+/*f system_init */
+static void
+system_init(struct test_system *sys, int assign)
+{
+    int buffers[TEST_NUM_BUFFERS];
+    int i;
+
+    memset(sys, 0, sizeof(*sys));
+    if (posix_memalign((void **)&sys->shm, 64, sizeof(*sys->shm))!=0)
+        exit(4);
+    for (i=0; i<TEST_NUM_BUFFERS; i++) {
+        sys->buffer_virt[i] = calloc(1, TEST_BUF_SIZE);
+        buffers[i] = i;
+    }
+    pcap_fw_model_init(&sys->model, sys->buffer_virt, TEST_NUM_BUFFERS);
+    pcap_consumers_init(&sys->pc, sys->shm, &sys->model.geometry,
+                        sys->buffer_virt, TEST_NUM_BUFFERS,
+                        assign, pcap_fw_model_give, &sys->model);
+    if (pcap_consumers_give(&sys->pc, buffers, TEST_NUM_BUFFERS) != 0)
+        exit(4);
+}
+
+/*f system_free */
+static void
+system_free(struct test_system *sys)
+{
+    int i;
+    for (i=0; i<TEST_NUM_BUFFERS; i++)
+        free(sys->buffer_virt[i]);
+    free(sys->shm);
+}
+
+/*f check_buffer */
+/**
+ * @brief Check a completed buffer has the packets the model placed in it
+ */
+static int
+check_buffer(const struct pcap_buffer *pcap_buffer)
+{
+    uint32_t seq;
+    uint32_t i;
+
+    if (pcap_buffer->hdr.total_packets == 0)
+        return 1;
+    memcpy(&seq, ((const char *)pcap_buffer) + (pcap_buffer->pkt_desc[0].offset<<6) + 64,
+           sizeof(seq));
+    for (i=0; i<pcap_buffer->hdr.total_packets; i++) {
+        uint32_t data_seq;
+        memcpy(&data_seq,
+               ((const char *)pcap_buffer) + (pcap_buffer->pkt_desc[i].offset<<6) + 64,
+               sizeof(data_seq));
+        if (pcap_buffer->pkt_desc[i].seq != PCAP_PKT_SEQ_WORD(0, seq+i))
+            return 2;
+        if (data_seq != seq+i)
+            return 3;
+    }
+    return 0;
+}
+
+/*f consumer_thread */
+/**
+ * @brief Take completed buffers in bulk, check them, and return them
+ */
+static void *
+consumer_thread(void *handle)
+{
+    struct test_consumer *tc;
+    struct pktgen_pcap_consumer *rings;
+    int last_buf_seq;
+
+    tc = (struct test_consumer *)handle;
+    rings = &tc->sys->shm->consumers[tc->consumer];
+    last_buf_seq = -1;
+    for (;;) {
+        int buffers[8];
+        int num;
+        int i;
+
+        num = pcap_ring_pop(&rings->completed, buffers, 8);
+        if (num == 0) {
+            if (__atomic_load_n(&tc->sys->stop, __ATOMIC_ACQUIRE))
+                break;
+            sched_yield();
+            continue;
+        }
+        for (i=0; i<num; i++) {
+            const struct pcap_buffer *pcap_buffer;
+            int buf_seq;
+
+            pcap_buffer = (const struct pcap_buffer *)tc->sys->buffer_virt[buffers[i]];
+            buf_seq = pcap_buffer->hdr.buf_seq;
+            if (check_buffer(pcap_buffer) != 0)
+                tc->error = 1;
+            if ((buf_seq <= last_buf_seq) || (buf_seq >= TEST_MAX_BUF_SEQ)) {
+                tc->error = 2;
+                continue;
+            }
+            last_buf_seq = buf_seq;
+            tc->sys->received_by[buf_seq] = tc->consumer;
+            __atomic_add_fetch(&tc->sys->times_received[buf_seq], 1, __ATOMIC_RELAXED);
+            tc->num_buffers++;
+        }
+        if (pcap_ring_push(&rings->returned, buffers, num) != num)
+            tc->error = 3;
+    }
+    return NULL;
+}
+
+/*f system_run */
+/**
+ * @brief Run the firmware model and fan-out until @p num_buffers
+ * buffers have been captured and all have been returned
+ */
+static int
+system_run(struct test_system *sys, int num_buffers, int pkts_per_buffer, int pkt_length)
+{
+    int filled;
+    int polls;
+
+    filled = 0;
+    for (polls=0; polls<TEST_MAX_POLLS; polls++) {
+        if (filled < num_buffers) {
+            if (pcap_fw_model_fill_buffer(&sys->model, pkts_per_buffer, pkt_length) >= 0)
+                filled++;
+        }
+        if (pcap_consumers_poll(&sys->pc) != 0)
+            return 1;
+        if ((filled == num_buffers) && (sys->pc.num_inflight == TEST_NUM_BUFFERS) &&
+            (sys->model.wptr - sys->model.rptr == TEST_NUM_BUFFERS))
+            return 0;
+    }
+    return 2;
+}
+
+/*a Tests
+ */
+/*f test_fanout */
+/**
+ * @brief Capture through @p num_consumers consumer threads
+ *
+ * @param num_consumers Number of consumers to attach
+ *
+ * @param assign        PCAP_CONSUMERS_ASSIGN_*
+ *
+ * @param num_buffers   Number of buffers to capture
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_fanout(int num_consumers, int assign, int num_buffers)
+{
+    struct test_system *sys;
+    struct test_consumer tc[PKTGEN_PCAP_MAX_CONSUMERS];
+    int err;
+    int i;
+
+    sys = malloc(sizeof(*sys));
+    system_init(sys, assign);
+    for (i=0; i<num_consumers; i++) {
+        tc[i].sys         = sys;
+        tc[i].consumer    = pcap_consumers_attach(&sys->pc);
+        tc[i].num_buffers = 0;
+        tc[i].error       = 0;
+        if (tc[i].consumer != i)
+            return 1;
+    }
+    for (i=0; i<num_consumers; i++)
+        pthread_create(&tc[i].thread, NULL, consumer_thread, &tc[i]);
+
+    err = system_run(sys, num_buffers, 37+num_consumers, 60+num_consumers*100);
+
+    __atomic_store_n(&sys->stop, 1, __ATOMIC_RELEASE);
+    for (i=0; i<num_consumers; i++) {
+        pthread_join(tc[i].thread, NULL);
+        if (!err && tc[i].error)
+            err = 10+tc[i].error;
+    }
+    for (i=0; !err && (i<num_buffers); i++) {
+        struct pcap_buf_hdr hdr;
+        int expected;
+
+        hdr.buf_seq = i;
+        expected = i % num_consumers;
+        if (assign == PCAP_CONSUMERS_ASSIGN_HASH)
+            expected = pcap_consumers_assignment(&sys->pc, &hdr);
+        if (sys->times_received[i] != 1)
+            err = 20;
+        else if (sys->received_by[i] != expected)
+            err = 21;
+    }
+    if (!err && ((sys->pc.buffers_completed != num_buffers) ||
+                 (sys->pc.packets_completed != num_buffers*(37+num_consumers)) ||
+                 (sys->pc.buffers_given != TEST_NUM_BUFFERS+num_buffers)))
+        err = 22;
+    if (!err && ((sys->pc.blocks_completed == 0) ||
+                 (sys->pc.blocks_completed % sys->pc.packets_completed != 0)))
+        err = 23;
+    if (!err && ((sys->pc.seq_check.stats.packets != sys->pc.packets_completed) ||
+                 (sys->pc.seq_check.stats.buffers != num_buffers) ||
+                 sys->pc.seq_check.stats.buf_gaps || sys->pc.seq_check.stats.buf_reorders ||
+                 sys->pc.seq_check.stats.pkt_gaps || sys->pc.seq_check.stats.pkt_reorders))
+        err = 24;
+    for (i=0; i<num_consumers; i++) {
+        if (!err && (pcap_consumers_detach(&sys->pc, tc[i].consumer) != 0))
+            err = 30;
+    }
+    if (!err && (sys->pc.num_inflight != TEST_NUM_BUFFERS))
+        err = 40;
+    system_free(sys);
+    free(sys);
+    return err;
+}
+
+/*f test_detach */
+/**
+ * @brief Detach a consumer holding completed buffers it never took
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_detach(void)
+{
+    struct test_system *sys;
+    int consumer[2];
+    int buffers[TEST_NUM_BUFFERS];
+    int num;
+    int err;
+    int i;
+
+    sys = malloc(sizeof(*sys));
+    system_init(sys, PCAP_CONSUMERS_ASSIGN_ROUND_ROBIN);
+    consumer[0] = pcap_consumers_attach(&sys->pc);
+    consumer[1] = pcap_consumers_attach(&sys->pc);
+    err = 0;
+    for (i=0; i<TEST_NUM_BUFFERS; i++) {
+        if (pcap_fw_model_fill_buffer(&sys->model, 10, 64) < 0)
+            err = 1;
+    }
+    if (!err && (pcap_consumers_poll(&sys->pc) != 0))
+        err = 2;
+    if (!err && (sys->pc.num_inflight != 0))
+        err = 3;
+
+    /* Consumer 0 takes its buffers and returns one; consumer 1 takes none */
+    num = pcap_ring_pop(&sys->shm->consumers[consumer[0]].completed, buffers, TEST_NUM_BUFFERS);
+    if (!err && (num != TEST_NUM_BUFFERS/2))
+        err = 4;
+    if (!err && (pcap_ring_push(&sys->shm->consumers[consumer[0]].returned, buffers, 1) != 1))
+        err = 5;
+    if (!err && (pcap_consumers_detach(&sys->pc, consumer[1]) != 0))
+        err = 6;
+    if (!err && (sys->pc.num_inflight != TEST_NUM_BUFFERS/2))
+        err = 7;
+    if (!err && (pcap_consumers_detach(&sys->pc, consumer[1]) == 0))
+        err = 8;
+    if (!err && (pcap_consumers_poll(&sys->pc) != 0))
+        err = 9;
+    if (!err && (sys->pc.num_inflight != TEST_NUM_BUFFERS/2+1))
+        err = 10;
+    if (!err && (sys->model.wptr - sys->model.rptr != TEST_NUM_BUFFERS/2+1))
+        err = 11;
+    system_free(sys);
+    free(sys);
+    return err;
+}
+
+/*f test_bad_returns */
+/**
+ * @brief Return bad, duplicate and other consumers' buffer indices
+ * alongside good ones, checking only the bad ones are dropped
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_bad_returns(void)
+{
+    struct test_system *sys;
+    int consumer[2];
+    int buffers[TEST_NUM_BUFFERS];
+    int returned[7];
+    int other;
+    int num;
+    int err;
+    int i;
+
+    sys = malloc(sizeof(*sys));
+    system_init(sys, PCAP_CONSUMERS_ASSIGN_ROUND_ROBIN);
+    consumer[0] = pcap_consumers_attach(&sys->pc);
+    consumer[1] = pcap_consumers_attach(&sys->pc);
+    err = 0;
+    for (i=0; i<TEST_NUM_BUFFERS; i++) {
+        if (pcap_fw_model_fill_buffer(&sys->model, 10, 64) < 0)
+            err = 1;
+    }
+    if (!err && (pcap_consumers_poll(&sys->pc) != 0))
+        err = 2;
+    num = pcap_ring_pop(&sys->shm->consumers[consumer[0]].completed, buffers, TEST_NUM_BUFFERS);
+    if (!err && (num != TEST_NUM_BUFFERS/2))
+        err = 3;
+    if (!err && (pcap_ring_pop(&sys->shm->consumers[consumer[1]].completed, &other, 1) != 1))
+        err = 4;
+
+    /* Consumer 0 returns two of its buffers among bad indices */
+    returned[0] = buffers[0];
+    returned[1] = -1;
+    returned[2] = TEST_NUM_BUFFERS;
+    returned[3] = buffers[0];
+    returned[4] = other;
+    returned[5] = buffers[1];
+    returned[6] = buffers[1];
+    if (!err && (pcap_ring_push(&sys->shm->consumers[consumer[0]].returned, returned, 7) != 7))
+        err = 5;
+    if (!err && (pcap_consumers_poll(&sys->pc) != 0))
+        err = 6;
+    if (!err && ((sys->pc.num_inflight != 2) || (sys->pc.bad_returns != 5)))
+        err = 7;
+
+    /* A buffer back with the NFP cannot be returned again */
+    if (!err && (pcap_ring_push(&sys->shm->consumers[consumer[0]].returned, buffers, 1) != 1))
+        err = 8;
+    if (!err && (pcap_consumers_poll(&sys->pc) != 0))
+        err = 9;
+    if (!err && ((sys->pc.num_inflight != 2) || (sys->pc.bad_returns != 6)))
+        err = 10;
+
+    /* The buffer consumer 0 returned for consumer 1 is still held by 1 */
+    if (!err && (pcap_ring_push(&sys->shm->consumers[consumer[1]].returned, &other, 1) != 1))
+        err = 11;
+    if (!err && (pcap_consumers_poll(&sys->pc) != 0))
+        err = 12;
+    if (!err && ((sys->pc.num_inflight != 3) || (sys->pc.bad_returns != 6)))
+        err = 13;
+    if (!err && (sys->model.wptr - sys->model.rptr != 3))
+        err = 14;
+    system_free(sys);
+    free(sys);
+    return err;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Single consumer",test_fanout(1,PCAP_CONSUMERS_ASSIGN_ROUND_ROBIN,500));
+    TEST_RUN("Round-robin to 3 consumers",test_fanout(3,PCAP_CONSUMERS_ASSIGN_ROUND_ROBIN,2000));
+    TEST_RUN("Round-robin to 8 consumers",test_fanout(8,PCAP_CONSUMERS_ASSIGN_ROUND_ROBIN,4000));
+    TEST_RUN("Hash to 4 consumers",test_fanout(4,PCAP_CONSUMERS_ASSIGN_HASH,4000));
+    TEST_RUN("Detach with buffers outstanding",test_detach());
+    TEST_RUN("Bad buffer returns dropped",test_bad_returns());
+    return failures;
+}
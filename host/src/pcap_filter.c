@@ -0,0 +1,1205 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_filter.c
+ * @brief         Classic BPF packet filters for captured packets
+ *
+ * An expression is parsed into a tree whose leaves are single tests,
+ * each a load (of the packet, or of the packet at the IPv4 header
+ * length), an optional mask, and a compare. Code is generated from
+ * the end of the program backwards: accept and reject returns first,
+ * then each node given the (already generated) instructions to go to
+ * if it is true and if it is false. Classic BPF jumps only forward,
+ * so every target is known when a jump is generated; a target more
+ * than 255 instructions on is reached through a 'ja'.
+ *
+ * Every test reloads what it needs, so no register carries between
+ * tests; the programs are a little longer than libpcap's optimized
+ * ones, but are simple to get right.
+ *
+ * pcap_filter_run interprets a program for one packet; pcap_filter_index
+ * runs it over batches of an index's packets, decoding each
+ * instruction once per batch rather than once per packet, which is
+ * where a per-packet interpreter spends most of its time. Scratch
+ * memory starts zeroed, so a load before a store reads zero.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include "pcap_filter.h"
+
+/*a Defines
+ */
+#define MAX_NODES      1024
+#define MAX_TOKEN      64
+
+/* Packets run through a program together by pcap_filter_index; at
+ * most 32, as a batch's packets are tracked in word masks */
+#define PCAP_FILTER_BATCH 32
+
+
+/* Ethernet frame offsets */
+#define ETH_TYPE       12
+#define ETH_TYPE_IPV4  0x0800
+#define ETH_TYPE_ARP   0x0806
+#define ETH_TYPE_IPV6  0x86dd
+#define IPV4_HDR       14
+#define IPV4_FRAG      20
+#define IPV4_PROTO     23
+#define IPV4_SRC       26
+#define IPV4_DST       30
+#define IPV6_NEXT_HDR  20
+#define IPV6_SRC_PORT  54
+#define IPV6_DST_PORT  56
+
+#define IP_PROTO_ICMP  1
+#define IP_PROTO_TCP   6
+#define IP_PROTO_UDP   17
+
+/*a Types
+ */
+/*t enum token */
+enum token {
+    TOK_END,
+    TOK_WORD,
+    TOK_REL,
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_NOT,
+    TOK_AND,
+    TOK_OR,
+};
+
+/*t enum node_type */
+enum node_type {
+    NODE_TRUE,
+    NODE_TEST,
+    NODE_NOT,
+    NODE_AND,
+    NODE_OR,
+};
+
+/*t struct node */
+/**
+ * Node of an expression tree; a test loads with @p load (the IPv4
+ * header length in X first if it is indexed), masks with @p mask if
+ * not zero, and jumps with @p jump against @p value
+ */
+struct node {
+    enum node_type type;
+    int      left, right;
+    uint16_t load;
+    uint32_t offset;
+    uint32_t mask;
+    uint16_t jump;
+    uint32_t value;
+};
+
+/*t struct compiler */
+struct compiler {
+    const char *pos;
+    enum token  token;
+    char        text[MAX_TOKEN];
+    struct node nodes[MAX_NODES];
+    int         num_nodes;
+    struct pcap_filter_insn insns[PCAP_FILTER_MAX_INSNS];
+    int         num_insns; /* Generated, from the end of the program */
+    char       *error;
+    size_t      error_size;
+    int         failed;
+};
+
+/*t struct filter_batch */
+/**
+ * Packets of an index being run through a program together, with
+ * the machine state of each
+ */
+struct filter_batch {
+    uint32_t num;
+    const unsigned char **data;
+    const uint32_t *caplen;
+    const uint32_t *length;
+    uint32_t a[PCAP_FILTER_BATCH];
+    uint32_t x[PCAP_FILTER_BATCH];
+    uint32_t ret[PCAP_FILTER_BATCH];
+    uint32_t mem[PCAP_FILTER_BATCH][PCAP_FILTER_MEMWORDS];
+    uint32_t running;      /* Mask of packets whose program has not returned */
+    uint32_t pending[PCAP_FILTER_MAX_INSNS]; /* Mask of packets at each instruction */
+};
+
+/*a Validation and interpretation
+ */
+/*f insn_known */
+static int
+insn_known(uint16_t code)
+{
+    switch (code) {
+    case PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_ABS:
+    case PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_ABS:
+    case PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_ABS:
+    case PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_IND:
+    case PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_IND:
+    case PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_IND:
+    case PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_LEN:
+    case PCAP_BPF_LD|PCAP_BPF_IMM:
+    case PCAP_BPF_LD|PCAP_BPF_MEM:
+    case PCAP_BPF_LDX|PCAP_BPF_W|PCAP_BPF_IMM:
+    case PCAP_BPF_LDX|PCAP_BPF_W|PCAP_BPF_MEM:
+    case PCAP_BPF_LDX|PCAP_BPF_W|PCAP_BPF_LEN:
+    case PCAP_BPF_LDX|PCAP_BPF_B|PCAP_BPF_MSH:
+    case PCAP_BPF_ST:
+    case PCAP_BPF_STX:
+    case PCAP_BPF_ALU|PCAP_BPF_NEG:
+    case PCAP_BPF_JMP|PCAP_BPF_JA:
+    case PCAP_BPF_RET|PCAP_BPF_K:
+    case PCAP_BPF_RET|PCAP_BPF_A:
+    case PCAP_BPF_MISC|PCAP_BPF_TAX:
+    case PCAP_BPF_MISC|PCAP_BPF_TXA:
+        return 1;
+    default:
+        break;
+    }
+    if (PCAP_BPF_CLASS(code) == PCAP_BPF_ALU) {
+        switch (code & ~PCAP_BPF_X) {
+        case PCAP_BPF_ALU|PCAP_BPF_ADD: case PCAP_BPF_ALU|PCAP_BPF_SUB:
+        case PCAP_BPF_ALU|PCAP_BPF_MUL: case PCAP_BPF_ALU|PCAP_BPF_DIV:
+        case PCAP_BPF_ALU|PCAP_BPF_OR:  case PCAP_BPF_ALU|PCAP_BPF_AND:
+        case PCAP_BPF_ALU|PCAP_BPF_LSH: case PCAP_BPF_ALU|PCAP_BPF_RSH:
+        case PCAP_BPF_ALU|PCAP_BPF_MOD: case PCAP_BPF_ALU|PCAP_BPF_XOR:
+            return 1;
+        default:
+            break;
+        }
+    }
+    if (PCAP_BPF_CLASS(code) == PCAP_BPF_JMP) {
+        switch (code & ~PCAP_BPF_X) {
+        case PCAP_BPF_JMP|PCAP_BPF_JEQ: case PCAP_BPF_JMP|PCAP_BPF_JGT:
+        case PCAP_BPF_JMP|PCAP_BPF_JGE: case PCAP_BPF_JMP|PCAP_BPF_JSET:
+            return 1;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+/*f insn_valid */
+/**
+ * @brief Check instruction @p i of a program of @p num_insns
+ *
+ * @returns Non-zero if valid
+ */
+static int
+insn_valid(const struct pcap_filter_insn *insn, int i, int num_insns)
+{
+    uint32_t after;
+
+    if (!insn_known(insn->code))
+        return 0;
+    after = num_insns - i - 1; /* Instructions after this one */
+    switch (PCAP_BPF_CLASS(insn->code)) {
+    case PCAP_BPF_LD:
+    case PCAP_BPF_LDX:
+        if ((PCAP_BPF_MODE(insn->code) == PCAP_BPF_MEM) && (insn->k >= PCAP_FILTER_MEMWORDS))
+            return 0;
+        break;
+    case PCAP_BPF_ST:
+    case PCAP_BPF_STX:
+        if (insn->k >= PCAP_FILTER_MEMWORDS)
+            return 0;
+        break;
+    case PCAP_BPF_ALU:
+        if ((PCAP_BPF_SRC(insn->code) == PCAP_BPF_K) && (insn->k == 0) &&
+            ((PCAP_BPF_OP(insn->code) == PCAP_BPF_DIV) || (PCAP_BPF_OP(insn->code) == PCAP_BPF_MOD)))
+            return 0;
+        break;
+    case PCAP_BPF_JMP:
+        if (PCAP_BPF_OP(insn->code) == PCAP_BPF_JA)
+            return (insn->k < after);
+        return (insn->jt < after) && (insn->jf < after);
+    default:
+        break;
+    }
+    return 1;
+}
+
+/*f load_word, load_half */
+static inline uint32_t
+load_word(const unsigned char *p)
+{
+    return (((uint32_t)p[0])<<24) | (((uint32_t)p[1])<<16) | (((uint32_t)p[2])<<8) | p[3];
+}
+static inline uint32_t
+load_half(const unsigned char *p)
+{
+    return (((uint32_t)p[0])<<8) | p[1];
+}
+
+/*f insn_exec */
+/**
+ * Execute one instruction for a packet, returning the number of
+ * instructions to skip after it, or -1 (with @p ret set) if it returns
+ */
+static inline int
+insn_exec(const struct pcap_filter_insn *insn,
+          const unsigned char *data,
+          uint32_t caplen,
+          uint32_t length,
+          uint32_t *a_p,
+          uint32_t *x_p,
+          uint32_t *mem,
+          uint32_t *ret)
+{
+    uint32_t a, x, k;
+
+    a = *a_p;
+    x = *x_p;
+    k = insn->k;
+    *ret = 0;
+    switch (insn->code) {
+    case PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_IND:
+        k += x;
+        if (k < x) return -1;
+        /* Fall through */
+    case PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_ABS:
+        if ((k >= caplen) || (caplen - k < 4)) return -1;
+        a = load_word(data + k);
+        break;
+    case PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_IND:
+        k += x;
+        if (k < x) return -1;
+        /* Fall through */
+    case PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_ABS:
+        if ((k >= caplen) || (caplen - k < 2)) return -1;
+        a = load_half(data + k);
+        break;
+    case PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_IND:
+        k += x;
+        if (k < x) return -1;
+        /* Fall through */
+    case PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_ABS:
+        if (k >= caplen) return -1;
+        a = data[k];
+        break;
+    case PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_LEN:  a = length; break;
+    case PCAP_BPF_LD|PCAP_BPF_IMM:             a = k; break;
+    case PCAP_BPF_LD|PCAP_BPF_MEM:             a = mem[k]; break;
+    case PCAP_BPF_LDX|PCAP_BPF_W|PCAP_BPF_IMM: x = k; break;
+    case PCAP_BPF_LDX|PCAP_BPF_W|PCAP_BPF_MEM: x = mem[k]; break;
+    case PCAP_BPF_LDX|PCAP_BPF_W|PCAP_BPF_LEN: x = length; break;
+    case PCAP_BPF_LDX|PCAP_BPF_B|PCAP_BPF_MSH:
+        if (k >= caplen) return -1;
+        x = (data[k] & 0xf) << 2;
+        break;
+    case PCAP_BPF_ST:  mem[k] = a; break;
+    case PCAP_BPF_STX: mem[k] = x; break;
+
+    case PCAP_BPF_ALU|PCAP_BPF_ADD|PCAP_BPF_X: a += x; break;
+    case PCAP_BPF_ALU|PCAP_BPF_SUB|PCAP_BPF_X: a -= x; break;
+    case PCAP_BPF_ALU|PCAP_BPF_MUL|PCAP_BPF_X: a *= x; break;
+    case PCAP_BPF_ALU|PCAP_BPF_DIV|PCAP_BPF_X: if (x == 0) return -1; a /= x; break;
+    case PCAP_BPF_ALU|PCAP_BPF_MOD|PCAP_BPF_X: if (x == 0) return -1; a %= x; break;
+    case PCAP_BPF_ALU|PCAP_BPF_AND|PCAP_BPF_X: a &= x; break;
+    case PCAP_BPF_ALU|PCAP_BPF_OR|PCAP_BPF_X:  a |= x; break;
+    case PCAP_BPF_ALU|PCAP_BPF_XOR|PCAP_BPF_X: a ^= x; break;
+    case PCAP_BPF_ALU|PCAP_BPF_LSH|PCAP_BPF_X: a = (x < 32) ? (a << x) : 0; break;
+    case PCAP_BPF_ALU|PCAP_BPF_RSH|PCAP_BPF_X: a = (x < 32) ? (a >> x) : 0; break;
+    case PCAP_BPF_ALU|PCAP_BPF_ADD|PCAP_BPF_K: a += k; break;
+    case PCAP_BPF_ALU|PCAP_BPF_SUB|PCAP_BPF_K: a -= k; break;
+    case PCAP_BPF_ALU|PCAP_BPF_MUL|PCAP_BPF_K: a *= k; break;
+    case PCAP_BPF_ALU|PCAP_BPF_DIV|PCAP_BPF_K: a /= k; break;
+    case PCAP_BPF_ALU|PCAP_BPF_MOD|PCAP_BPF_K: a %= k; break;
+    case PCAP_BPF_ALU|PCAP_BPF_AND|PCAP_BPF_K: a &= k; break;
+    case PCAP_BPF_ALU|PCAP_BPF_OR|PCAP_BPF_K:  a |= k; break;
+    case PCAP_BPF_ALU|PCAP_BPF_XOR|PCAP_BPF_K: a ^= k; break;
+    case PCAP_BPF_ALU|PCAP_BPF_LSH|PCAP_BPF_K: a = (k < 32) ? (a << k) : 0; break;
+    case PCAP_BPF_ALU|PCAP_BPF_RSH|PCAP_BPF_K: a = (k < 32) ? (a >> k) : 0; break;
+    case PCAP_BPF_ALU|PCAP_BPF_NEG:            a = -a; break;
+
+    case PCAP_BPF_JMP|PCAP_BPF_JA:             return k;
+    case PCAP_BPF_JMP|PCAP_BPF_JEQ|PCAP_BPF_K:  return (a == k) ? insn->jt : insn->jf;
+    case PCAP_BPF_JMP|PCAP_BPF_JGT|PCAP_BPF_K:  return (a > k) ? insn->jt : insn->jf;
+    case PCAP_BPF_JMP|PCAP_BPF_JGE|PCAP_BPF_K:  return (a >= k) ? insn->jt : insn->jf;
+    case PCAP_BPF_JMP|PCAP_BPF_JSET|PCAP_BPF_K: return (a & k) ? insn->jt : insn->jf;
+    case PCAP_BPF_JMP|PCAP_BPF_JEQ|PCAP_BPF_X:  return (a == x) ? insn->jt : insn->jf;
+    case PCAP_BPF_JMP|PCAP_BPF_JGT|PCAP_BPF_X:  return (a > x) ? insn->jt : insn->jf;
+    case PCAP_BPF_JMP|PCAP_BPF_JGE|PCAP_BPF_X:  return (a >= x) ? insn->jt : insn->jf;
+    case PCAP_BPF_JMP|PCAP_BPF_JSET|PCAP_BPF_X: return (a & x) ? insn->jt : insn->jf;
+
+    case PCAP_BPF_RET|PCAP_BPF_K: *ret = k; return -1;
+    case PCAP_BPF_RET|PCAP_BPF_A: *ret = a; return -1;
+    case PCAP_BPF_MISC|PCAP_BPF_TAX: x = a; break;
+    case PCAP_BPF_MISC|PCAP_BPF_TXA: a = x; break;
+    default:
+        /* Programs are validated when set */
+        return -1;
+    }
+    *a_p = a;
+    *x_p = x;
+    return 0;
+}
+
+/*a Batch interpretation
+ */
+/*f batch_load */
+/**
+ * Load a word, half or byte at @p k (plus X if @p ind) of the packets
+ * of a batch in @p mask at instruction @p p; a packet too short for
+ * it rejects
+ */
+static inline void
+batch_load(struct filter_batch *batch, uint32_t mask, uint32_t p, uint32_t k, uint32_t size, int ind)
+{
+    uint32_t j, ofs, all, next;
+
+    all  = mask;
+    next = 0;
+    while (mask) {
+        j = __builtin_ctz(mask);
+        mask &= mask - 1;
+        ofs = k;
+        if (ind) {
+            ofs += batch->x[j];
+            if (ofs < k)
+                continue;
+        }
+        if ((ofs >= batch->caplen[j]) || (batch->caplen[j] - ofs < size))
+            continue;
+        if (size == 4)
+            batch->a[j] = load_word(batch->data[j] + ofs);
+        else if (size == 2)
+            batch->a[j] = load_half(batch->data[j] + ofs);
+        else
+            batch->a[j] = batch->data[j][ofs];
+        next |= 1U << j;
+    }
+    batch->pending[p+1] |= next;
+    batch->running &= ~(all & ~next);
+}
+
+/*f batch_jump */
+/**
+ * Compare A of the packets of a batch in @p mask at instruction @p p
+ * with K (or X) and jump on the result
+ */
+static inline void
+batch_jump(struct filter_batch *batch, uint32_t mask, uint32_t p,
+           const struct pcap_filter_insn *insn, int op, int use_x)
+{
+    uint32_t j, a, k, taken, all;
+
+    all   = mask;
+    taken = 0;
+    while (mask) {
+        j = __builtin_ctz(mask);
+        mask &= mask - 1;
+        a = batch->a[j];
+        k = use_x ? batch->x[j] : insn->k;
+        switch (op) {
+        case PCAP_BPF_JEQ: a = (a == k); break;
+        case PCAP_BPF_JGT: a = (a > k);  break;
+        case PCAP_BPF_JGE: a = (a >= k); break;
+        default:           a = ((a & k) != 0); break;
+        }
+        taken |= a << j;
+    }
+    batch->pending[p+1+insn->jt] |= taken;
+    batch->pending[p+1+insn->jf] |= all & ~taken;
+}
+
+/*f batch_run */
+/**
+ * Run a program over a batch of packets
+ *
+ * Classic BPF jumps only forward, so the program is swept once from
+ * the start, with a mask per instruction of the packets whose program
+ * counter is at it: each instruction reached is decoded once and
+ * executed for the packets in its mask, which then join the masks of
+ * the instructions they go on to. The instructions compiled programs
+ * are mostly made of (packet loads, compares and returns) have their
+ * own loops over the batch, which keep a batch's packet loads
+ * independent of each other; the rest go through insn_exec.
+ *
+ * The masks of the batch must be clear on entry, and are left clear.
+ */
+static void
+batch_run(const struct pcap_filter *filter, struct filter_batch *batch, int uses_mem)
+{
+    const struct pcap_filter_insn *insn;
+    uint32_t p, j, mask;
+    int skip;
+
+    for (j=0; j<batch->num; j++) {
+        batch->a[j]   = 0;
+        batch->x[j]   = 0;
+        batch->ret[j] = 0;
+    }
+    if (uses_mem)
+        memset(batch->mem, 0, batch->num * sizeof(batch->mem[0]));
+    batch->running    = (batch->num < 32) ? ((1U << batch->num) - 1) : ~0U;
+    batch->pending[0] = batch->running;
+    for (p=0; batch->running; p++) {
+        mask = batch->pending[p];
+        if (mask == 0)
+            continue;
+        insn = &filter->insns[p];
+        switch (insn->code) {
+        case PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_ABS: batch_load(batch, mask, p, insn->k, 4, 0); break;
+        case PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_ABS: batch_load(batch, mask, p, insn->k, 2, 0); break;
+        case PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_ABS: batch_load(batch, mask, p, insn->k, 1, 0); break;
+        case PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_IND: batch_load(batch, mask, p, insn->k, 4, 1); break;
+        case PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_IND: batch_load(batch, mask, p, insn->k, 2, 1); break;
+        case PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_IND: batch_load(batch, mask, p, insn->k, 1, 1); break;
+
+        case PCAP_BPF_JMP|PCAP_BPF_JEQ|PCAP_BPF_K:  batch_jump(batch, mask, p, insn, PCAP_BPF_JEQ, 0); break;
+        case PCAP_BPF_JMP|PCAP_BPF_JGT|PCAP_BPF_K:  batch_jump(batch, mask, p, insn, PCAP_BPF_JGT, 0); break;
+        case PCAP_BPF_JMP|PCAP_BPF_JGE|PCAP_BPF_K:  batch_jump(batch, mask, p, insn, PCAP_BPF_JGE, 0); break;
+        case PCAP_BPF_JMP|PCAP_BPF_JSET|PCAP_BPF_K: batch_jump(batch, mask, p, insn, PCAP_BPF_JSET, 0); break;
+        case PCAP_BPF_JMP|PCAP_BPF_JA:              batch->pending[p+1+insn->k] |= mask; break;
+
+        case PCAP_BPF_RET|PCAP_BPF_K:
+            batch->running &= ~mask;
+            while (mask) {
+                j = __builtin_ctz(mask);
+                mask &= mask - 1;
+                batch->ret[j] = insn->k;
+            }
+            break;
+
+        default:
+            while (mask) {
+                j = __builtin_ctz(mask);
+                mask &= mask - 1;
+                skip = insn_exec(insn, batch->data[j], batch->caplen[j], batch->length[j],
+                                 &batch->a[j], &batch->x[j], batch->mem[j], &batch->ret[j]);
+                if (skip < 0)
+                    batch->running &= ~(1U << j);
+                else
+                    batch->pending[p+1+skip] |= 1U << j;
+            }
+            break;
+        }
+        batch->pending[p] = 0;
+    }
+}
+
+/*a Compiler - lexer and parser
+ */
+/*f compile_error */
+static int
+compile_error(struct compiler *c, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (!c->failed && c->error && (c->error_size > 0)) {
+        va_start(ap, fmt);
+        vsnprintf(c->error, c->error_size, fmt, ap);
+        va_end(ap);
+    }
+    c->failed = 1;
+    return -1;
+}
+
+/*f next_token */
+static void
+next_token(struct compiler *c)
+{
+    const char *p;
+    size_t n;
+
+    p = c->pos;
+    while (isspace((unsigned char)*p))
+        p++;
+    c->text[0] = 0;
+    if (*p == 0) {
+        c->token = TOK_END;
+        c->pos = p;
+        return;
+    }
+    c->token = TOK_REL;
+    if ((p[0] == '&') && (p[1] == '&')) {
+        c->token = TOK_AND; p += 2;
+    } else if ((p[0] == '|') && (p[1] == '|')) {
+        c->token = TOK_OR; p += 2;
+    } else if ((p[0] == '!') && (p[1] != '=')) {
+        c->token = TOK_NOT; p++;
+    } else if (p[0] == '(') {
+        c->token = TOK_LPAREN; p++;
+    } else if (p[0] == ')') {
+        c->token = TOK_RPAREN; p++;
+    } else if (strchr("<>=!", p[0])) {
+        n = (p[1] == '=') ? 2 : 1;
+        memcpy(c->text, p, n);
+        c->text[n] = 0;
+        p += n;
+    } else {
+        n = 0;
+        while (isalnum((unsigned char)p[n]) || (p[n] && strchr("./:_-", p[n])))
+            n++;
+        if ((n == 0) || (n >= MAX_TOKEN)) {
+            c->token = TOK_END;
+            c->pos = p;
+            compile_error(c, "unexpected '%.16s'", p);
+            return;
+        }
+        memcpy(c->text, p, n);
+        c->text[n] = 0;
+        p += n;
+        c->token = TOK_WORD;
+        if (!strcmp(c->text, "and"))      c->token = TOK_AND;
+        else if (!strcmp(c->text, "or"))  c->token = TOK_OR;
+        else if (!strcmp(c->text, "not")) c->token = TOK_NOT;
+    }
+    c->pos = p;
+}
+
+/*f word_is */
+static int
+word_is(struct compiler *c, const char *word)
+{
+    return (c->token == TOK_WORD) && !strcmp(c->text, word);
+}
+
+/*f node_add */
+static int
+node_add(struct compiler *c, enum node_type type, int left, int right)
+{
+    struct node *node;
+
+    if ((left < 0) || (right < 0))
+        return -1;
+    if (c->num_nodes >= MAX_NODES)
+        return compile_error(c, "expression too complex");
+    node = &c->nodes[c->num_nodes];
+    memset(node, 0, sizeof(*node));
+    node->type  = type;
+    node->left  = left;
+    node->right = right;
+    return c->num_nodes++;
+}
+
+/*f node_test */
+static int
+node_test(struct compiler *c, uint16_t load, uint32_t offset, uint32_t mask,
+          uint16_t jump, uint32_t value)
+{
+    int n;
+
+    n = node_add(c, NODE_TEST, 0, 0);
+    if (n < 0)
+        return n;
+    c->nodes[n].load   = load;
+    c->nodes[n].offset = offset;
+    c->nodes[n].mask   = mask;
+    c->nodes[n].jump   = jump;
+    c->nodes[n].value  = value;
+    return n;
+}
+
+/*f node_and, node_or, node_not */
+static int
+node_and(struct compiler *c, int left, int right)
+{
+    return node_add(c, NODE_AND, left, right);
+}
+static int
+node_or(struct compiler *c, int left, int right)
+{
+    return node_add(c, NODE_OR, left, right);
+}
+static int
+node_not(struct compiler *c, int left)
+{
+    return node_add(c, NODE_NOT, left, 0);
+}
+
+/*f node_ethertype */
+static int
+node_ethertype(struct compiler *c, uint32_t type)
+{
+    return node_test(c, PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_ABS, ETH_TYPE, 0,
+                     PCAP_BPF_JMP|PCAP_BPF_JEQ, type);
+}
+
+/*f node_ip_proto */
+/**
+ * @brief Test for an IP protocol, or TCP or UDP if @p proto is -1,
+ * in an IPv4 header (@p ipv6 zero) or IPv6 header
+ */
+static int
+node_ip_proto(struct compiler *c, int ipv6, int proto)
+{
+    uint32_t offset;
+    int test;
+
+    offset = ipv6 ? IPV6_NEXT_HDR : IPV4_PROTO;
+    if (proto < 0) {
+        test = node_or(c,
+                       node_test(c, PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_ABS, offset, 0,
+                                 PCAP_BPF_JMP|PCAP_BPF_JEQ, IP_PROTO_TCP),
+                       node_test(c, PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_ABS, offset, 0,
+                                 PCAP_BPF_JMP|PCAP_BPF_JEQ, IP_PROTO_UDP));
+    } else {
+        test = node_test(c, PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_ABS, offset, 0,
+                         PCAP_BPF_JMP|PCAP_BPF_JEQ, proto);
+    }
+    return node_and(c, node_ethertype(c, ipv6 ? ETH_TYPE_IPV6 : ETH_TYPE_IPV4), test);
+}
+
+/*f node_src_dst */
+/**
+ * @brief Test of source (@p dir 1), destination (@p dir 2) or either
+ * (@p dir 0) of a pair of fields
+ */
+static int
+node_src_dst(struct compiler *c, int dir, uint16_t load,
+             uint32_t src, uint32_t dst, uint32_t mask, uint32_t value)
+{
+    if (dir == 1)
+        return node_test(c, load, src, mask, PCAP_BPF_JMP|PCAP_BPF_JEQ, value);
+    if (dir == 2)
+        return node_test(c, load, dst, mask, PCAP_BPF_JMP|PCAP_BPF_JEQ, value);
+    return node_or(c,
+                   node_test(c, load, src, mask, PCAP_BPF_JMP|PCAP_BPF_JEQ, value),
+                   node_test(c, load, dst, mask, PCAP_BPF_JMP|PCAP_BPF_JEQ, value));
+}
+
+/*f parse_number */
+static int
+parse_number(struct compiler *c, uint32_t *value)
+{
+    char *end;
+    unsigned long v;
+
+    if (c->token != TOK_WORD)
+        return compile_error(c, "expected a number");
+    v = strtoul(c->text, &end, 0);
+    if ((*end != 0) || (v > 0xffffffffUL))
+        return compile_error(c, "bad number '%s'", c->text);
+    *value = v;
+    next_token(c);
+    return 0;
+}
+
+/*f parse_ipv4 */
+/**
+ * @brief Parse A.B.C.D, or A.B.C.D/len if @p prefix_len is not NULL
+ */
+static int
+parse_ipv4(struct compiler *c, uint32_t *addr, uint32_t *prefix_len)
+{
+    unsigned int a[4], len;
+    int n;
+
+    len = 32;
+    n = 0;
+    if (c->token == TOK_WORD) {
+        if (prefix_len && strchr(c->text, '/')) {
+            if (sscanf(c->text, "%u.%u.%u.%u/%u%n", &a[0], &a[1], &a[2], &a[3], &len, &n) != 5)
+                n = 0;
+        } else if (sscanf(c->text, "%u.%u.%u.%u%n", &a[0], &a[1], &a[2], &a[3], &n) != 4) {
+            n = 0;
+        }
+    }
+    if ((n == 0) || (c->text[n] != 0) ||
+        (a[0] > 255) || (a[1] > 255) || (a[2] > 255) || (a[3] > 255) || (len > 32))
+        return compile_error(c, "bad IPv4 %s '%s'", prefix_len ? "net" : "host", c->text);
+    *addr = (a[0]<<24) | (a[1]<<16) | (a[2]<<8) | a[3];
+    if (prefix_len)
+        *prefix_len = len;
+    next_token(c);
+    return 0;
+}
+
+/*f parse_len */
+/**
+ * @brief Parse a relation and number following 'len'
+ */
+static int
+parse_len(struct compiler *c)
+{
+    char rel[3];
+    uint32_t value;
+    uint16_t jump;
+    int negate, test;
+
+    if (c->token != TOK_REL)
+        return compile_error(c, "expected a relation after 'len'");
+    strcpy(rel, c->text);
+    next_token(c);
+    if (parse_number(c, &value) < 0)
+        return -1;
+    negate = 0;
+    if (!strcmp(rel, ">"))       { jump = PCAP_BPF_JGT; }
+    else if (!strcmp(rel, ">=")) { jump = PCAP_BPF_JGE; }
+    else if (!strcmp(rel, "<"))  { jump = PCAP_BPF_JGE; negate = 1; }
+    else if (!strcmp(rel, "<=")) { jump = PCAP_BPF_JGT; negate = 1; }
+    else if (!strcmp(rel, "!=")) { jump = PCAP_BPF_JEQ; negate = 1; }
+    else                         { jump = PCAP_BPF_JEQ; }
+    test = node_test(c, PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_LEN, 0, 0, PCAP_BPF_JMP|jump, value);
+    return negate ? node_not(c, test) : test;
+}
+
+/*f parse_primitive */
+/**
+ * @brief Parse [proto] [src|dst] [host|net|port] [value], or less,
+ * greater or len
+ */
+static int
+parse_primitive(struct compiler *c)
+{
+    static const struct { const char *name; int ethertype; int proto; } protos[] = {
+        {"ip",   ETH_TYPE_IPV4, -2},
+        {"ip6",  ETH_TYPE_IPV6, -2},
+        {"arp",  ETH_TYPE_ARP,  -2},
+        {"tcp",  0, IP_PROTO_TCP},
+        {"udp",  0, IP_PROTO_UDP},
+        {"icmp", 0, IP_PROTO_ICMP},
+        {NULL, 0, 0}
+    };
+    uint32_t value, addr, prefix_len, mask;
+    int p, dir, proto, type;
+
+    if (c->token != TOK_WORD)
+        return compile_error(c, "expected a primitive");
+    if (word_is(c, "less") || word_is(c, "greater")) {
+        int less;
+        less = word_is(c, "less");
+        next_token(c);
+        if (parse_number(c, &value) < 0)
+            return -1;
+        if (less)
+            return node_not(c, node_test(c, PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_LEN, 0, 0,
+                                         PCAP_BPF_JMP|PCAP_BPF_JGT, value));
+        return node_test(c, PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_LEN, 0, 0,
+                         PCAP_BPF_JMP|PCAP_BPF_JGE, value);
+    }
+    if (word_is(c, "len")) {
+        next_token(c);
+        return parse_len(c);
+    }
+
+    p = -1;
+    for (proto=0; protos[proto].name; proto++) {
+        if (word_is(c, protos[proto].name)) {
+            p = proto;
+            next_token(c);
+            break;
+        }
+    }
+    dir = 0;
+    if (word_is(c, "src") || word_is(c, "dst")) {
+        dir = word_is(c, "src") ? 1 : 2;
+        next_token(c);
+    }
+    if (word_is(c, "host") || word_is(c, "net") || word_is(c, "port")) {
+        type = c->text[0];
+        next_token(c);
+    } else if (dir != 0) {
+        type = 'h'; /* 'src A.B.C.D' is 'src host A.B.C.D' */
+    } else {
+        if (p < 0)
+            return compile_error(c, "unknown primitive '%s'", c->text);
+        if (protos[p].ethertype)
+            return node_ethertype(c, protos[p].ethertype);
+        if (protos[p].proto == IP_PROTO_ICMP)
+            return node_ip_proto(c, 0, IP_PROTO_ICMP);
+        return node_or(c, node_ip_proto(c, 0, protos[p].proto),
+                       node_ip_proto(c, 1, protos[p].proto));
+    }
+
+    if (type == 'p') {
+        int ipv4, ipv6;
+        if ((p >= 0) && (protos[p].proto != IP_PROTO_TCP) && (protos[p].proto != IP_PROTO_UDP))
+            return compile_error(c, "'port' is not supported with '%s'", protos[p].name);
+        if (parse_number(c, &value) < 0)
+            return -1;
+        if (value > 0xffff)
+            return compile_error(c, "port %u out of range", value);
+        proto = (p < 0) ? -1 : protos[p].proto;
+        /* Only the first fragment of an IPv4 datagram has the ports */
+        ipv4 = node_and(c, node_ip_proto(c, 0, proto),
+                        node_and(c,
+                                 node_not(c, node_test(c, PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_ABS,
+                                                       IPV4_FRAG, 0,
+                                                       PCAP_BPF_JMP|PCAP_BPF_JSET, 0x1fff)),
+                                 node_src_dst(c, dir, PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_IND,
+                                              IPV4_HDR, IPV4_HDR+2, 0, value)));
+        ipv6 = node_and(c, node_ip_proto(c, 1, proto),
+                        node_src_dst(c, dir, PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_ABS,
+                                     IPV6_SRC_PORT, IPV6_DST_PORT, 0, value));
+        return node_or(c, ipv4, ipv6);
+    }
+
+    if ((p >= 0) && strcmp(protos[p].name, "ip"))
+        return compile_error(c, "'%s' is not supported with '%s'",
+                             (type == 'n') ? "net" : "host", protos[p].name);
+    mask = 0;
+    if (type == 'n') {
+        if (parse_ipv4(c, &addr, &prefix_len) < 0)
+            return -1;
+        if (prefix_len == 0)
+            return node_ethertype(c, ETH_TYPE_IPV4);
+        if (prefix_len < 32)
+            mask = 0xffffffffU << (32 - prefix_len);
+        if (mask && (addr & ~mask))
+            return compile_error(c, "net has bits set beyond its /%u", prefix_len);
+    } else {
+        if (parse_ipv4(c, &addr, NULL) < 0)
+            return -1;
+    }
+    return node_and(c, node_ethertype(c, ETH_TYPE_IPV4),
+                    node_src_dst(c, dir, PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_ABS,
+                                 IPV4_SRC, IPV4_DST, mask, addr));
+}
+
+/*f parse_unary */
+static int parse_expression(struct compiler *c);
+static int
+parse_unary(struct compiler *c)
+{
+    int n;
+
+    if (c->token == TOK_NOT) {
+        next_token(c);
+        return node_not(c, parse_unary(c));
+    }
+    if (c->token == TOK_LPAREN) {
+        next_token(c);
+        n = parse_expression(c);
+        if (n < 0)
+            return -1;
+        if (c->token != TOK_RPAREN)
+            return compile_error(c, "expected ')'");
+        next_token(c);
+        return n;
+    }
+    return parse_primitive(c);
+}
+
+/*f parse_expression */
+/**
+ * @brief Parse an expression; as in tcpdump, 'and' and 'or' have the
+ * same precedence and associate to the left
+ */
+static int
+parse_expression(struct compiler *c)
+{
+    enum token op;
+    int n;
+
+    n = parse_unary(c);
+    while ((n >= 0) && ((c->token == TOK_AND) || (c->token == TOK_OR))) {
+        op = c->token;
+        next_token(c);
+        n = node_add(c, (op == TOK_AND) ? NODE_AND : NODE_OR, n, parse_unary(c));
+    }
+    return n;
+}
+
+/*a Compiler - code generation
+ */
+/*f emit */
+/**
+ * @brief Generate the instruction ahead of those already generated
+ *
+ * @returns Its position counted from the end of the program, or -1
+ */
+static int
+emit(struct compiler *c, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+    struct pcap_filter_insn *insn;
+
+    if (c->num_insns >= PCAP_FILTER_MAX_INSNS)
+        return compile_error(c, "program too long");
+    insn = &c->insns[c->num_insns];
+    insn->code = code;
+    insn->jt   = jt;
+    insn->jf   = jf;
+    insn->k    = k;
+    return c->num_insns++;
+}
+
+/*f gen_test */
+static int
+gen_test(struct compiler *c, const struct node *node, int t, int f)
+{
+    /* Jumps of more than 255 go through a 'ja' next to the test */
+    for (;;) {
+        if (c->num_insns - t - 1 > 255)
+            t = emit(c, PCAP_BPF_JMP|PCAP_BPF_JA, 0, 0, c->num_insns - t - 1);
+        else if (c->num_insns - f - 1 > 255)
+            f = emit(c, PCAP_BPF_JMP|PCAP_BPF_JA, 0, 0, c->num_insns - f - 1);
+        else
+            break;
+        if ((t < 0) || (f < 0))
+            return -1;
+    }
+    if (emit(c, node->jump|PCAP_BPF_K, c->num_insns - t - 1, c->num_insns - f - 1, node->value) < 0)
+        return -1;
+    if (node->mask && (emit(c, PCAP_BPF_ALU|PCAP_BPF_AND|PCAP_BPF_K, 0, 0, node->mask) < 0))
+        return -1;
+    if (emit(c, node->load, 0, 0, node->offset) < 0)
+        return -1;
+    if (PCAP_BPF_MODE(node->load) == PCAP_BPF_IND)
+        return emit(c, PCAP_BPF_LDX|PCAP_BPF_B|PCAP_BPF_MSH, 0, 0, IPV4_HDR);
+    return c->num_insns - 1;
+}
+
+/*f gen */
+/**
+ * @brief Generate code for a node that continues at @p t if it is
+ * true and at @p f if it is false
+ *
+ * @returns Position of the code for the node, or -1 on error
+ */
+static int
+gen(struct compiler *c, int n, int t, int f)
+{
+    const struct node *node;
+
+    node = &c->nodes[n];
+    switch (node->type) {
+    case NODE_TRUE:
+        return t;
+    case NODE_TEST:
+        return gen_test(c, node, t, f);
+    case NODE_NOT:
+        return gen(c, node->left, f, t);
+    case NODE_AND:
+        n = gen(c, node->right, t, f);
+        return (n < 0) ? -1 : gen(c, node->left, n, f);
+    case NODE_OR:
+        n = gen(c, node->right, t, f);
+        return (n < 0) ? -1 : gen(c, node->left, t, n);
+    }
+    return -1;
+}
+
+/*a External functions
+ */
+/*f pcap_filter_set */
+extern int
+pcap_filter_set(struct pcap_filter *filter,
+                const struct pcap_filter_insn *insns,
+                int num_insns)
+{
+    struct pcap_filter_insn *copy;
+    int i;
+
+    if ((num_insns < 1) || (num_insns > PCAP_FILTER_MAX_INSNS))
+        return 1;
+    for (i=0; i<num_insns; i++) {
+        if (!insn_valid(&insns[i], i, num_insns))
+            return 1;
+    }
+    if (PCAP_BPF_CLASS(insns[num_insns-1].code) != PCAP_BPF_RET)
+        return 1;
+    copy = malloc(num_insns * sizeof(*copy));
+    if (!copy)
+        return 1;
+    memcpy(copy, insns, num_insns * sizeof(*copy));
+    free(filter->insns);
+    filter->insns     = copy;
+    filter->num_insns = num_insns;
+    return 0;
+}
+
+/*f pcap_filter_compile */
+extern int
+pcap_filter_compile(struct pcap_filter *filter,
+                    const char *expression,
+                    char *error,
+                    size_t error_size)
+{
+    struct pcap_filter_insn *insns;
+    struct compiler *c;
+    int root, entry;
+    int i, err;
+
+    c = calloc(1, sizeof(*c));
+    if (!c)
+        return 1;
+    c->pos        = expression;
+    c->error      = error;
+    c->error_size = error_size;
+    next_token(c);
+    if (c->token == TOK_END) {
+        root = c->failed ? -1 : node_add(c, NODE_TRUE, 0, 0);
+    } else {
+        root = parse_expression(c);
+        if ((root >= 0) && (c->token != TOK_END))
+            root = compile_error(c, "unexpected '%s'", c->text);
+    }
+    if (c->failed)
+        root = -1;
+    entry = -1;
+    if ((root >= 0) &&
+        (emit(c, PCAP_BPF_RET|PCAP_BPF_K, 0, 0, 0) >= 0) &&
+        (emit(c, PCAP_BPF_RET|PCAP_BPF_K, 0, 0, PCAP_FILTER_ACCEPT) >= 0)) {
+        entry = gen(c, root, 1, 0);
+    }
+    if ((entry >= 0) && (entry != c->num_insns - 1))
+        entry = emit(c, PCAP_BPF_JMP|PCAP_BPF_JA, 0, 0, c->num_insns - entry - 1);
+    if (entry < 0) {
+        free(c);
+        return 1;
+    }
+
+    insns = malloc(c->num_insns * sizeof(*insns));
+    if (!insns) {
+        free(c);
+        return 1;
+    }
+    for (i=0; i<c->num_insns; i++)
+        insns[i] = c->insns[c->num_insns - 1 - i];
+    err = pcap_filter_set(filter, insns, c->num_insns);
+    if (err)
+        compile_error(c, "generated an invalid program");
+    free(insns);
+    free(c);
+    return err;
+}
+
+/*f pcap_filter_load */
+extern int
+pcap_filter_load(struct pcap_filter *filter, const char *text)
+{
+    struct pcap_filter_insn *insns;
+    unsigned long count, v[4];
+    char *end;
+    int i, j, err;
+
+    count = strtoul(text, &end, 10);
+    if ((end == text) || (count < 1) || (count > PCAP_FILTER_MAX_INSNS))
+        return 1;
+    insns = malloc(count * sizeof(*insns));
+    if (!insns)
+        return 1;
+    err = 0;
+    for (i=0; (i<count) && !err; i++) {
+        for (j=0; j<4; j++) {
+            text = end;
+            while (isspace((unsigned char)*text))
+                text++;
+            if (!isdigit((unsigned char)*text)) {
+                err = 1;
+                break;
+            }
+            v[j] = strtoul(text, &end, 10);
+        }
+        if (err || (v[0] > 0xffff) || (v[1] > 255) || (v[2] > 255) || (v[3] > 0xffffffffUL)) {
+            err = 1;
+            break;
+        }
+        insns[i].code = v[0];
+        insns[i].jt   = v[1];
+        insns[i].jf   = v[2];
+        insns[i].k    = v[3];
+    }
+    while (!err && isspace((unsigned char)*end))
+        end++;
+    if (!err && (*end != 0))
+        err = 1;
+    if (!err)
+        err = pcap_filter_set(filter, insns, count);
+    free(insns);
+    return err;
+}
+
+/*f pcap_filter_free */
+extern void
+pcap_filter_free(struct pcap_filter *filter)
+{
+    free(filter->insns);
+    filter->insns     = NULL;
+    filter->num_insns = 0;
+}
+
+/*f pcap_filter_run */
+extern uint32_t
+pcap_filter_run(const struct pcap_filter *filter,
+                const unsigned char *data,
+                uint32_t caplen,
+                uint32_t length)
+{
+    const struct pcap_filter_insn *pc;
+    uint32_t mem[PCAP_FILTER_MEMWORDS];
+    uint32_t a, x, ret;
+    int skip;
+
+    memset(mem, 0, sizeof(mem));
+    a = 0;
+    x = 0;
+    for (pc=filter->insns; ; pc+=skip+1) {
+        skip = insn_exec(pc, data, caplen, length, &a, &x, mem, &ret);
+        if (skip < 0)
+            return ret;
+    }
+}
+
+/*f pcap_filter_index */
+extern uint32_t
+pcap_filter_index(const struct pcap_filter *filter,
+                  const struct pcap_index *in,
+                  struct pcap_index *out,
+                  uint32_t first,
+                  uint32_t num)
+{
+    struct filter_batch batch;
+    uint32_t i, j, n, end, prefetch;
+    int uses_mem;
+
+    uses_mem = 0;
+    for (i=0; i<(uint32_t)filter->num_insns; i++) {
+        uint16_t code = filter->insns[i].code;
+        if ((PCAP_BPF_CLASS(code) == PCAP_BPF_ST) || (PCAP_BPF_CLASS(code) == PCAP_BPF_STX) ||
+            (((PCAP_BPF_CLASS(code) == PCAP_BPF_LD) || (PCAP_BPF_CLASS(code) == PCAP_BPF_LDX)) &&
+             (PCAP_BPF_MODE(code) == PCAP_BPF_MEM)))
+            uses_mem = 1;
+    }
+    memset(batch.pending, 0, filter->num_insns * sizeof(batch.pending[0]));
+    end = first + num;
+    for (i=first; (i<first+PCAP_FILTER_BATCH) && (i<end); i++)
+        pcap_index_prefetch(in, i);
+    n = first;
+    for (i=first; i<end; i+=batch.num) {
+        batch.num    = (end - i < PCAP_FILTER_BATCH) ? (end - i) : PCAP_FILTER_BATCH;
+        batch.data   = in->data + i;
+        batch.caplen = in->caplen + i;
+        batch.length = in->length + i;
+        /* Only the packets of this range are prefetched, as another
+         * worker may be filtering the packets after it in place */
+        for (prefetch=i+PCAP_FILTER_BATCH; (prefetch<i+2*PCAP_FILTER_BATCH) && (prefetch<end); prefetch++)
+            pcap_index_prefetch(in, prefetch);
+        batch_run(filter, &batch, uses_mem);
+        for (j=0; j<batch.num; j++) {
+            if (batch.ret[j] == 0)
+                continue;
+            out->data[n]   = in->data[i+j];
+            out->caplen[n] = in->caplen[i+j];
+            out->length[n] = in->length[i+j];
+            out->seq[n]    = in->seq[i+j];
+            n++;
+        }
+    }
+    return n - first;
+}
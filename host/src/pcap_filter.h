@@ -0,0 +1,250 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_filter.h
+ * @brief         Classic BPF packet filters for captured packets
+ *
+ * A filter is a classic BPF program, as libpcap and the Linux socket
+ * filter use, on Ethernet frames. It may be compiled here from a
+ * tcpdump-style expression, or loaded from the output of 'tcpdump
+ * -ddd' so that any expression libpcap can compile may be used
+ * without linking libpcap. Programs are validated when set, so the
+ * interpreter need not check jumps or scratch memory indices.
+ *
+ * The compiler supports the subset of the tcpdump language that
+ * capture filtering mostly needs:
+ *
+ *   ip, ip6, arp, tcp, udp, icmp
+ *   [src|dst] host A.B.C.D
+ *   [src|dst] net A.B.C.D/len
+ *   [tcp|udp] [src|dst] port N
+ *   less N, greater N, len <op> N
+ *   not, and, or (and !, &&, ||) and parentheses
+ *
+ * Hosts and nets are IPv4; ports are of IPv4 (unfragmented) or IPv6
+ * (without extension headers) TCP and UDP.
+ *
+ * pcap_filter_index filters a range of a packet index into a dense
+ * output index; pcap_filter_pool runs it on worker threads.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_FILTER_H_
+#define _PCAP_FILTER_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap_index.h"
+
+/*a Defines
+ */
+/* Largest program accepted, as the Linux BPF_MAXINSNS */
+#define PCAP_FILTER_MAX_INSNS 4096
+
+/* Words of scratch memory of a program */
+#define PCAP_FILTER_MEMWORDS 16
+
+/* Value returned by compiled programs to accept a packet */
+#define PCAP_FILTER_ACCEPT 262144
+
+/* Instruction classes, sizes, modes, operations and sources, as bpf.h */
+#define PCAP_BPF_CLASS(code) ((code) & 0x07)
+#define PCAP_BPF_LD   0x00
+#define PCAP_BPF_LDX  0x01
+#define PCAP_BPF_ST   0x02
+#define PCAP_BPF_STX  0x03
+#define PCAP_BPF_ALU  0x04
+#define PCAP_BPF_JMP  0x05
+#define PCAP_BPF_RET  0x06
+#define PCAP_BPF_MISC 0x07
+
+#define PCAP_BPF_SIZE(code) ((code) & 0x18)
+#define PCAP_BPF_W    0x00
+#define PCAP_BPF_H    0x08
+#define PCAP_BPF_B    0x10
+
+#define PCAP_BPF_MODE(code) ((code) & 0xe0)
+#define PCAP_BPF_IMM  0x00
+#define PCAP_BPF_ABS  0x20
+#define PCAP_BPF_IND  0x40
+#define PCAP_BPF_MEM  0x60
+#define PCAP_BPF_LEN  0x80
+#define PCAP_BPF_MSH  0xa0
+
+#define PCAP_BPF_OP(code) ((code) & 0xf0)
+#define PCAP_BPF_ADD  0x00
+#define PCAP_BPF_SUB  0x10
+#define PCAP_BPF_MUL  0x20
+#define PCAP_BPF_DIV  0x30
+#define PCAP_BPF_OR   0x40
+#define PCAP_BPF_AND  0x50
+#define PCAP_BPF_LSH  0x60
+#define PCAP_BPF_RSH  0x70
+#define PCAP_BPF_NEG  0x80
+#define PCAP_BPF_MOD  0x90
+#define PCAP_BPF_XOR  0xa0
+
+#define PCAP_BPF_JA   0x00
+#define PCAP_BPF_JEQ  0x10
+#define PCAP_BPF_JGT  0x20
+#define PCAP_BPF_JGE  0x30
+#define PCAP_BPF_JSET 0x40
+
+#define PCAP_BPF_SRC(code) ((code) & 0x08)
+#define PCAP_BPF_K    0x00
+#define PCAP_BPF_X    0x08
+
+#define PCAP_BPF_RVAL(code) ((code) & 0x18)
+#define PCAP_BPF_A    0x10
+
+#define PCAP_BPF_MISCOP(code) ((code) & 0xf8)
+#define PCAP_BPF_TAX  0x00
+#define PCAP_BPF_TXA  0x80
+
+/*a Types
+ */
+/*t struct pcap_filter_insn */
+/**
+ * Classic BPF instruction, as struct bpf_insn
+ */
+struct pcap_filter_insn {
+    uint16_t code;
+    uint8_t  jt;
+    uint8_t  jf;
+    uint32_t k;
+};
+
+/*t struct pcap_filter */
+/**
+ * Validated filter program
+ */
+struct pcap_filter {
+    int num_insns;
+    struct pcap_filter_insn *insns;
+};
+
+/*a Functions
+ */
+/*f pcap_filter_set */
+/**
+ * @brief Set a filter to a copy of a program, if the program is valid
+ *
+ * @param filter    Filter to set, replacing any program it had
+ *
+ * @param insns     Program
+ *
+ * @param num_insns Number of instructions in the program
+ *
+ * @returns Zero on success, non-zero if the program is not valid (it
+ * is empty or too long, has an unknown instruction, a jump out of the
+ * program, a scratch memory index out of range or a division by a
+ * constant zero, or does not end with a return) or the allocation
+ * fails
+ *
+ */
+extern int pcap_filter_set(struct pcap_filter *filter,
+                           const struct pcap_filter_insn *insns,
+                           int num_insns);
+
+/*f pcap_filter_compile */
+/**
+ * @brief Compile a tcpdump-style expression into a filter
+ *
+ * @param filter     Filter to set
+ *
+ * @param expression Expression; empty (or only spaces) accepts all
+ *
+ * @param error      Buffer for a description of an error, or NULL
+ *
+ * @param error_size Size of @p error
+ *
+ * @returns Zero on success, non-zero on error
+ *
+ */
+extern int pcap_filter_compile(struct pcap_filter *filter,
+                               const char *expression,
+                               char *error,
+                               size_t error_size);
+
+/*f pcap_filter_load */
+/**
+ * @brief Load a filter from the text of 'tcpdump -ddd', a count of
+ * instructions followed by 'code jt jf k' for each in decimal
+ *
+ * @returns Zero on success, non-zero if the text is malformed or the
+ * program is not valid
+ *
+ */
+extern int pcap_filter_load(struct pcap_filter *filter, const char *text);
+
+/*f pcap_filter_free */
+/**
+ * @brief Free the program of a filter
+ *
+ */
+extern void pcap_filter_free(struct pcap_filter *filter);
+
+/*f pcap_filter_run */
+/**
+ * @brief Run a filter on a packet
+ *
+ * @param filter Filter
+ *
+ * @param data   Packet data
+ *
+ * @param caplen Bytes of packet data captured; loads beyond them
+ * reject the packet
+ *
+ * @param length Original length of the packet, as loaded by 'len'
+ *
+ * @returns Value the program returns; zero rejects the packet
+ *
+ */
+extern uint32_t pcap_filter_run(const struct pcap_filter *filter,
+                                const unsigned char *data,
+                                uint32_t caplen,
+                                uint32_t length);
+
+/*f pcap_filter_index */
+/**
+ * @brief Filter packets @p first to @p first+@p num-1 of an index,
+ * storing those accepted densely in @p out from entry @p first
+ *
+ * The program is run over batches of packets at a time; only packets
+ * of the range are touched (or prefetched), so workers may filter
+ * disjoint ranges of one index in place.
+ *
+ * @param filter Filter
+ *
+ * @param in     Index to filter
+ *
+ * @param out    Index for the packets accepted; its arrays must have
+ * room for those of @p in, and it may be @p in
+ *
+ * @returns Number of packets accepted
+ *
+ */
+extern uint32_t pcap_filter_index(const struct pcap_filter *filter,
+                                  const struct pcap_index *in,
+                                  struct pcap_index *out,
+                                  uint32_t first,
+                                  uint32_t num);
+
+/*a Close guard
+ */
+#endif /* _PCAP_FILTER_H_ */
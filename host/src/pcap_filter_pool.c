@@ -0,0 +1,238 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_filter_pool.c
+ * @brief         Worker threads filtering capture buffer packet indices
+ *
+ * Each run is a generation: the caller sets up the slices, bumps the
+ * generation and broadcasts; worker w filters slice w+1 if there is
+ * one, and the caller waits until all the slices handed out are done.
+ * Workers without a slice in a generation just wait for the next.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pcap_filter_pool.h"
+
+/*a Types
+ */
+/*t struct pcap_filter_slice */
+struct pcap_filter_slice {
+    uint32_t first;
+    uint32_t num;
+    uint32_t accepted;
+};
+
+/*t struct pcap_filter_worker */
+struct pcap_filter_worker {
+    struct pcap_filter_pool *pool;
+    int       slice;
+    pthread_t thread;
+};
+
+/*t struct pcap_filter_pool */
+struct pcap_filter_pool {
+    int num_threads;
+    struct pcap_filter_worker workers[PCAP_FILTER_POOL_MAX_THREADS];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t  start;   /* Broadcast when a generation starts */
+    pthread_cond_t  done;    /* Signalled when the last slice is done */
+    uint64_t generation;
+    int      stopping;
+    int      pending;        /* Slices of workers not yet done */
+
+    const struct pcap_filter *filter;
+    const struct pcap_index  *in;
+    struct pcap_index        *out;
+    int      num_slices;
+    struct pcap_filter_slice slices[PCAP_FILTER_POOL_MAX_THREADS+1];
+};
+
+/*a Static functions
+ */
+/*f slice_filter */
+static void
+slice_filter(struct pcap_filter_pool *pool, struct pcap_filter_slice *slice)
+{
+    slice->accepted = pcap_filter_index(pool->filter, pool->in, pool->out,
+                                        slice->first, slice->num);
+}
+
+/*f worker_thread */
+static void *
+worker_thread(void *handle)
+{
+    struct pcap_filter_worker *worker;
+    struct pcap_filter_pool *pool;
+    uint64_t generation;
+
+    worker = (struct pcap_filter_worker *)handle;
+    pool = worker->pool;
+    /* Workers start before the first generation, which may be
+     * started before they run */
+    generation = 0;
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->stopping && (pool->generation == generation))
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        if (pool->stopping)
+            break;
+        generation = pool->generation;
+        if (worker->slice >= pool->num_slices)
+            continue;
+        pthread_mutex_unlock(&pool->mutex);
+        slice_filter(pool, &pool->slices[worker->slice]);
+        pthread_mutex_lock(&pool->mutex);
+        pool->pending--;
+        if (pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+/*f index_move */
+/**
+ * @brief Move @p num entries of an index from @p from to @p to
+ */
+static void
+index_move(struct pcap_index *index, uint32_t to, uint32_t from, uint32_t num)
+{
+    if ((to == from) || (num == 0))
+        return;
+    memmove(index->data + to,   index->data + from,   num * sizeof(*index->data));
+    memmove(index->caplen + to, index->caplen + from, num * sizeof(uint32_t));
+    memmove(index->length + to, index->length + from, num * sizeof(uint32_t));
+    memmove(index->seq + to,    index->seq + from,    num * sizeof(uint32_t));
+}
+
+/*a External functions
+ */
+/*f pcap_filter_pool_create */
+extern struct pcap_filter_pool *
+pcap_filter_pool_create(int num_threads)
+{
+    struct pcap_filter_pool *pool;
+    int i;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+    if (num_threads < 0)
+        num_threads = 0;
+    if (num_threads > PCAP_FILTER_POOL_MAX_THREADS)
+        num_threads = PCAP_FILTER_POOL_MAX_THREADS;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (i=0; i<num_threads; i++) {
+        pool->workers[i].pool  = pool;
+        pool->workers[i].slice = i+1;
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_thread, &pool->workers[i])!=0)
+            break;
+        pool->num_threads++;
+    }
+    if (pool->num_threads < num_threads) {
+        pcap_filter_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/*f pcap_filter_pool_run */
+extern int
+pcap_filter_pool_run(struct pcap_filter_pool *pool,
+                     const struct pcap_filter *filter,
+                     const struct pcap_index *in,
+                     struct pcap_index *out)
+{
+    uint32_t num_pkts, per_slice, first, n;
+    int num_slices, s;
+
+    num_pkts = in->num_pkts;
+    if (out->geometry.max_pkts < num_pkts)
+        return -1;
+    out->buffer  = in->buffer;
+    out->buf_seq = in->buf_seq;
+    out->num_bad = in->num_bad;
+
+    num_slices = (num_pkts + PCAP_FILTER_POOL_MIN_SLICE - 1) / PCAP_FILTER_POOL_MIN_SLICE;
+    if (num_slices > pool->num_threads + 1)
+        num_slices = pool->num_threads + 1;
+    if (num_slices < 1)
+        num_slices = 1;
+    per_slice = (num_pkts + num_slices - 1) / num_slices;
+    first = 0;
+    for (s=0; s<num_slices; s++) {
+        pool->slices[s].first    = first;
+        pool->slices[s].num      = (num_pkts - first < per_slice) ? (num_pkts - first) : per_slice;
+        pool->slices[s].accepted = 0;
+        first += pool->slices[s].num;
+    }
+
+    if (num_slices > 1) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->filter     = filter;
+        pool->in         = in;
+        pool->out        = out;
+        pool->num_slices = num_slices;
+        pool->pending    = num_slices - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->mutex);
+    } else {
+        pool->filter = filter;
+        pool->in     = in;
+        pool->out    = out;
+    }
+    slice_filter(pool, &pool->slices[0]);
+    if (num_slices > 1) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->pending > 0)
+            pthread_cond_wait(&pool->done, &pool->mutex);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    n = pool->slices[0].accepted;
+    for (s=1; s<num_slices; s++) {
+        index_move(out, n, pool->slices[s].first, pool->slices[s].accepted);
+        n += pool->slices[s].accepted;
+    }
+    out->num_pkts = n;
+    return (int)n;
+}
+
+/*f pcap_filter_pool_destroy */
+extern void
+pcap_filter_pool_destroy(struct pcap_filter_pool *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+    for (i=0; i<pool->num_threads; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
@@ -0,0 +1,97 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_filter_pool.h
+ * @brief         Worker threads filtering capture buffer packet indices
+ *
+ * A 2MB buffer of small packets has thousands of them, and one core
+ * running a filter over them all cannot keep up with a 40G capture.
+ * The pool splits the index of a buffer into slices of at least
+ * PCAP_FILTER_POOL_MIN_SLICE packets, one per worker thread and one
+ * for the calling thread; each slice is filtered into the output
+ * index in place, and the caller then closes up the gaps between
+ * the slices so the output is dense.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_FILTER_POOL_H_
+#define _PCAP_FILTER_POOL_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include "pcap_filter.h"
+#include "pcap_index.h"
+
+/*a Defines
+ */
+#define PCAP_FILTER_POOL_MAX_THREADS 32
+
+/* Fewest packets worth handing to a worker thread */
+#define PCAP_FILTER_POOL_MIN_SLICE   512
+
+/*a Types
+ */
+/*t struct pcap_filter_pool */
+struct pcap_filter_pool;
+
+/*a Functions
+ */
+/*f pcap_filter_pool_create */
+/**
+ * @brief Create a pool of worker threads
+ *
+ * @param num_threads Number of worker threads, in addition to the
+ * thread running the filter; zero filters on the calling thread only,
+ * and more than PCAP_FILTER_POOL_MAX_THREADS is limited to that
+ *
+ * @returns Pool handle, or NULL on error
+ *
+ */
+extern struct pcap_filter_pool *pcap_filter_pool_create(int num_threads);
+
+/*f pcap_filter_pool_run */
+/**
+ * @brief Filter the packets of an index into a dense output index
+ *
+ * @param pool   Pool handle
+ *
+ * @param filter Filter to run
+ *
+ * @param in     Index of a buffer
+ *
+ * @param out    Index for the packets accepted, of the same geometry
+ * as @p in (it may be @p in); its buffer, buf_seq and num_bad are
+ * those of @p in
+ *
+ * @returns Number of packets accepted, or -1 if @p out is too small
+ *
+ */
+extern int pcap_filter_pool_run(struct pcap_filter_pool *pool,
+                                const struct pcap_filter *filter,
+                                const struct pcap_index *in,
+                                struct pcap_index *out);
+
+/*f pcap_filter_pool_destroy */
+/**
+ * @brief Stop the worker threads of a pool and free it
+ *
+ */
+extern void pcap_filter_pool_destroy(struct pcap_filter_pool *pool);
+
+/*a Close guard
+ */
+#endif /* _PCAP_FILTER_POOL_H_ */
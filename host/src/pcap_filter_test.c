@@ -0,0 +1,672 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_filter_test.c
+ * @brief         Test for the capture packet filters and filter pool
+ *
+ * Compiled expressions are run on a set of packets and checked against
+ * the packets they should accept; a program as 'tcpdump -ddd' gives it
+ * is loaded and checked against the compiled expression; invalid
+ * programs are checked to be rejected; programs using the registers
+ * and scratch memory, filtering an index in batches, are checked
+ * against running them packet by packet, as is the pool; and the
+ * rate of the pool is reported, and checked to beat filtering packet
+ * by packet.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pcap_filter.h"
+#include "pcap_filter_pool.h"
+#include "timer.h"
+
+/*a Defines
+ */
+#define NUM_TEST_PKTS 8
+
+/* Runs of the throughput test, of which the best is taken */
+#define TEST_THROUGHPUT_RUNS 50
+
+#define IPV4(a,b,c,d) ((((uint32_t)(a))<<24) | ((b)<<16) | ((c)<<8) | (d))
+
+/*a Types
+ */
+/*t struct test_pkt */
+struct test_pkt {
+    uint16_t ethertype;
+    uint8_t  proto;
+    uint8_t  ihl;
+    uint32_t src, dst;
+    uint16_t sport, dport;
+    uint16_t frag;
+    uint32_t length;
+    uint32_t caplen;
+};
+
+/*a Static variables
+ */
+static const struct test_pkt test_pkts[NUM_TEST_PKTS] = {
+    {0x0800,  6, 5, IPV4(10,0,0,1),    IPV4(10,0,0,2),    1234,   80,   0,   60,   60},
+    {0x0800, 17, 5, IPV4(192,168,1,1), IPV4(10,0,0,1),      53, 5353,   0,  100,  100},
+    {0x0800,  1, 5, IPV4(10,1,2,3),    IPV4(192,168,1,1),    0,    0,   0,   98,   98},
+    {0x86dd,  6, 0, 0, 0,                                  443,   80,   0, 1500, 1500},
+    {0x0806,  0, 0, 0, 0,                                    0,    0,   0,   60,   60},
+    {0x0800,  6, 5, IPV4(10,0,0,1),    IPV4(10,0,0,2),    1234,   80, 100, 1000, 1000},
+    {0x0800,  6, 6, IPV4(10,0,0,3),    IPV4(10,0,0,4),      80,   22,   0,   70,   70},
+    {0x0800,  6, 5, IPV4(10,0,0,1),    IPV4(10,0,0,2),    1234,   80,   0,   60,   30},
+};
+
+/* 'tcpdump -ddd tcp port 80' */
+static const char *tcp_port_80_ddd =
+    "20\n"
+    "40 0 0 12\n"   "21 0 6 34525\n" "48 0 0 20\n"  "21 0 15 6\n"
+    "40 0 0 54\n"   "21 12 0 80\n"   "40 0 0 56\n"  "21 10 11 80\n"
+    "21 0 10 2048\n" "48 0 0 23\n"   "21 0 8 6\n"   "40 0 0 20\n"
+    "69 6 0 8191\n" "177 0 0 14\n"   "72 0 0 14\n"  "21 2 0 80\n"
+    "72 0 0 16\n"   "21 0 1 80\n"    "6 0 0 262144\n" "6 0 0 0\n";
+
+/*a Useful functions
+ */
+/*f put16, put32 */
+static void
+put16(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+static void
+put32(unsigned char *p, uint32_t v)
+{
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+/*f packet_build */
+/**
+ * @brief Build the Ethernet frame of a test packet
+ */
+static void
+packet_build(unsigned char *data, const struct test_pkt *pkt)
+{
+    unsigned char *l4;
+
+    memset(data, 0, 1514);
+    memset(data, 0x02, 12);
+    put16(data + 12, pkt->ethertype);
+    l4 = NULL;
+    if (pkt->ethertype == 0x0800) {
+        data[14] = 0x40 | pkt->ihl;
+        put16(data + 16, pkt->length - 14);
+        put16(data + 20, pkt->frag);
+        data[22] = 64;
+        data[23] = pkt->proto;
+        put32(data + 26, pkt->src);
+        put32(data + 30, pkt->dst);
+        l4 = data + 14 + 4*pkt->ihl;
+    } else if (pkt->ethertype == 0x86dd) {
+        data[14] = 0x60;
+        put16(data + 18, pkt->length - 54);
+        data[20] = pkt->proto;
+        data[21] = 64;
+        l4 = data + 54;
+    }
+    if (l4) {
+        put16(l4, pkt->sport);
+        put16(l4 + 2, pkt->dport);
+    }
+}
+
+/*f filter_test_pkts */
+/**
+ * @brief Run a filter on the test packets
+ *
+ * @returns Mask of the packets accepted, as a string of 0s and 1s
+ */
+static const char *
+filter_test_pkts(const struct pcap_filter *filter)
+{
+    static char accepted[NUM_TEST_PKTS+1];
+    unsigned char data[1514];
+    int i;
+
+    for (i=0; i<NUM_TEST_PKTS; i++) {
+        packet_build(data, &test_pkts[i]);
+        accepted[i] = pcap_filter_run(filter, data, test_pkts[i].caplen,
+                                      test_pkts[i].length) ? '1' : '0';
+    }
+    accepted[NUM_TEST_PKTS] = 0;
+    return accepted;
+}
+
+/*f index_build */
+/**
+ * @brief Fill an index with @p num_pkts packets chosen at random from
+ * the test packets, built in @p pkt_data
+ */
+static void
+index_build(struct pcap_index *index, unsigned char *pkt_data, uint32_t num_pkts)
+{
+    uint32_t i;
+
+    for (i=0; i<NUM_TEST_PKTS; i++)
+        packet_build(pkt_data + 1536*i, &test_pkts[i]);
+    for (i=0; i<num_pkts; i++) {
+        int p;
+        p = rand() % NUM_TEST_PKTS;
+        index->data[i]   = pkt_data + 1536*p;
+        index->caplen[i] = test_pkts[p].caplen;
+        index->length[i] = test_pkts[p].length;
+        index->seq[i]    = i;
+    }
+    index->num_pkts = num_pkts;
+    index->num_bad  = 0;
+}
+
+/*a Tests
+ */
+/*f test_compile */
+/**
+ * @brief Compile expressions and check the test packets they accept
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_compile(void)
+{
+    static const struct { const char *expression; const char *accepted; } tests[] = {
+        {"",                          "11111111"},
+        {"ip",                        "11100111"},
+        {"ip6",                       "00010000"},
+        {"arp",                       "00001000"},
+        {"tcp",                       "10010111"},
+        {"udp",                       "01000000"},
+        {"icmp",                      "00100000"},
+        {"host 10.0.0.1",             "11000101"},
+        {"ip host 10.0.0.1",          "11000101"},
+        {"src host 10.0.0.1",         "10000101"},
+        {"dst 10.0.0.1",              "01000000"},
+        {"net 10.0.0.0/8",            "11100111"},
+        {"src net 192.168.0.0/16",    "01000000"},
+        {"port 80",                   "10010010"},
+        {"tcp dst port 80",           "10010000"},
+        {"udp port 53",               "01000000"},
+        {"tcp port 22",               "00000010"},
+        {"not tcp",                   "01101000"},
+        {"tcp and port 80 or udp",    "11010010"},
+        {"tcp and (port 80 or udp)",  "10010010"},
+        {"udp or tcp and port 80",    "10010010"},
+        {"less 64",                   "10001001"},
+        {"greater 1000",              "00010100"},
+        {"len >= 100 && len < 1000",  "01000000"},
+        {"len != 60",                 "01110110"},
+        {"!ip && !ip6",               "00001000"},
+        {"icmp || arp",               "00101000"},
+        {NULL, NULL}
+    };
+    struct pcap_filter filter = {0, NULL};
+    char error[128];
+    const char *accepted;
+    int i;
+
+    for (i=0; tests[i].expression; i++) {
+        if (pcap_filter_compile(&filter, tests[i].expression, error, sizeof(error)) != 0) {
+            fprintf(stderr, "'%s': %s\n", tests[i].expression, error);
+            return 1;
+        }
+        accepted = filter_test_pkts(&filter);
+        if (strcmp(accepted, tests[i].accepted)) {
+            fprintf(stderr, "'%s' accepted %s expected %s\n",
+                    tests[i].expression, accepted, tests[i].accepted);
+            pcap_filter_free(&filter);
+            return 2;
+        }
+    }
+    pcap_filter_free(&filter);
+    return 0;
+}
+
+/*f test_compile_errors */
+/**
+ * @brief Check that bad expressions fail to compile, with an error
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_compile_errors(void)
+{
+    static const char *expressions[] = {
+        "host", "host 1.2.3", "host 1.2.3.256", "port 70000", "net 10.0.0.1/8",
+        "icmp port 80", "arp host 1.2.3.4", "(tcp", "tcp)", "foo", "tcp and",
+        "len 5", "tcp $", "not", NULL
+    };
+    struct pcap_filter filter = {0, NULL};
+    char error[128];
+    int i;
+
+    for (i=0; expressions[i]; i++) {
+        error[0] = 0;
+        if (pcap_filter_compile(&filter, expressions[i], error, sizeof(error)) == 0) {
+            fprintf(stderr, "'%s' compiled\n", expressions[i]);
+            pcap_filter_free(&filter);
+            return 1;
+        }
+        if (error[0] == 0)
+            return 2;
+    }
+    return 0;
+}
+
+/*f test_far_jumps */
+/**
+ * @brief Compile an expression too long for 8-bit jump offsets, and
+ * its negation, and check them
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_far_jumps(void)
+{
+    struct pcap_filter filter = {0, NULL};
+    char expression[8192];
+    char error[128];
+    size_t n;
+    int i, neg;
+
+    for (neg=0; neg<2; neg++) {
+        n = sprintf(expression, "%s(", neg ? "not " : "");
+        for (i=100; i>0; i--)
+            n += sprintf(expression+n, "dst host 192.168.%d.%d or ", i, i);
+        sprintf(expression+n, "src net 10.0.0.0/24)");
+        if (pcap_filter_compile(&filter, expression, error, sizeof(error)) != 0) {
+            fprintf(stderr, "%s\n", error);
+            return 1;
+        }
+        if (filter.num_insns < 256)
+            return 2;
+        if (strcmp(filter_test_pkts(&filter), neg ? "01011000" : "10100110"))
+            return 3;
+        pcap_filter_free(&filter);
+    }
+    return 0;
+}
+
+/*f test_load */
+/**
+ * @brief Load 'tcpdump -ddd' output and check it against the compiled
+ * expression; check that malformed text is rejected
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_load(void)
+{
+    struct pcap_filter filter = {0, NULL};
+    char error[128];
+    char loaded[NUM_TEST_PKTS+1];
+
+    if (pcap_filter_load(&filter, tcp_port_80_ddd) != 0)
+        return 1;
+    if (filter.num_insns != 20)
+        return 2;
+    strcpy(loaded, filter_test_pkts(&filter));
+    if (pcap_filter_compile(&filter, "tcp port 80", error, sizeof(error)) != 0)
+        return 3;
+    if (strcmp(loaded, filter_test_pkts(&filter)) || strcmp(loaded, "10010010"))
+        return 4;
+    if ((pcap_filter_load(&filter, "") == 0) ||
+        (pcap_filter_load(&filter, "2\n6 0 0 1\n") == 0) ||
+        (pcap_filter_load(&filter, "1\n6 0 0 1\n6 0 0 1\n") == 0) ||
+        (pcap_filter_load(&filter, "1\n6 0 0 x\n") == 0))
+        return 5;
+    pcap_filter_free(&filter);
+    return 0;
+}
+
+/*f test_validate */
+/**
+ * @brief Check that invalid programs are rejected
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_validate(void)
+{
+    static const struct pcap_filter_insn ok[] = {
+        {PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_LEN, 0, 0, 0},
+        {PCAP_BPF_ST, 0, 0, 15},
+        {PCAP_BPF_JMP|PCAP_BPF_JGT|PCAP_BPF_K, 0, 1, 64},
+        {PCAP_BPF_RET|PCAP_BPF_A, 0, 0, 0},
+        {PCAP_BPF_RET|PCAP_BPF_K, 0, 0, 0},
+    };
+    static const struct { int at; struct pcap_filter_insn insn; } bad[] = {
+        {2, {PCAP_BPF_JMP|PCAP_BPF_JGT|PCAP_BPF_K, 0, 2, 64}},  /* Jump out */
+        {2, {PCAP_BPF_JMP|PCAP_BPF_JA, 0, 0, 2}},               /* Jump out */
+        {1, {PCAP_BPF_ST, 0, 0, 16}},                           /* Memory */
+        {1, {PCAP_BPF_ALU|PCAP_BPF_DIV|PCAP_BPF_K, 0, 0, 0}},   /* Divide by 0 */
+        {1, {0xff, 0, 0, 0}},                                   /* Unknown */
+        {4, {PCAP_BPF_MISC|PCAP_BPF_TAX, 0, 0, 0}},             /* No return */
+        {-1, {0, 0, 0, 0}}
+    };
+    struct pcap_filter_insn insns[5];
+    struct pcap_filter filter = {0, NULL};
+    unsigned char data[64];
+    int i;
+
+    if (pcap_filter_set(&filter, ok, 5) != 0)
+        return 1;
+    if ((pcap_filter_run(&filter, data, 64, 100) != 100) ||
+        (pcap_filter_run(&filter, data, 64, 64) != 0))
+        return 2;
+    if (pcap_filter_set(&filter, ok, 0) == 0)
+        return 3;
+    for (i=0; bad[i].at>=0; i++) {
+        memcpy(insns, ok, sizeof(insns));
+        insns[bad[i].at] = bad[i].insn;
+        if (pcap_filter_set(&filter, insns, 5) == 0)
+            return 10+i;
+    }
+    pcap_filter_free(&filter);
+    return 0;
+}
+
+/*f test_pool */
+/**
+ * @brief Filter indices with pools of 0 to 7 threads, into another
+ * index and in place, and check them against filtering each packet
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_pool(void)
+{
+    struct pcap_buf_geometry geometry = {PCAP_BUF_GEOMETRY_MAGIC, 21, 14000,
+                                         PCAP_BUF_MIN_FIRST_PKT_OFFSET(14000), 0};
+    struct pcap_filter filter = {0, NULL};
+    struct pcap_index in, out, *dest;
+    unsigned char *pkt_data;
+    char error[128];
+    int threads, num_pkts, in_place;
+    int err;
+
+    pkt_data = malloc(1536*NUM_TEST_PKTS);
+    if (!pkt_data ||
+        (pcap_index_init(&in, &geometry) != 0) ||
+        (pcap_index_init(&out, &geometry) != 0) ||
+        (pcap_filter_compile(&filter, "tcp port 80 or udp", error, sizeof(error)) != 0))
+        return 1;
+    srand(1);
+    err = 0;
+    for (threads=0; (threads<8) && !err; threads++) {
+        struct pcap_filter_pool *pool;
+        pool = pcap_filter_pool_create(threads);
+        if (!pool) {
+            err = 2;
+            break;
+        }
+        for (num_pkts=0; (num_pkts<=14000) && !err; num_pkts+=(num_pkts<2000)?333:4000) {
+            for (in_place=0; (in_place<2) && !err; in_place++) {
+                uint32_t i, n, expected[14000];
+                index_build(&in, pkt_data, num_pkts);
+                n = 0;
+                for (i=0; i<in.num_pkts; i++) {
+                    if (pcap_filter_run(&filter, in.data[i], in.caplen[i], in.length[i]))
+                        expected[n++] = i;
+                }
+                dest = in_place ? &in : &out;
+                if (pcap_filter_pool_run(pool, &filter, &in, dest) != n) {
+                    err = 3;
+                    break;
+                }
+                for (i=0; i<n; i++) {
+                    if (dest->seq[i] != expected[i])
+                        err = 4;
+                }
+            }
+        }
+        pcap_filter_pool_destroy(pool);
+    }
+    pcap_filter_free(&filter);
+    pcap_index_free(&out);
+    pcap_index_free(&in);
+    free(pkt_data);
+    return err;
+}
+
+/*f test_batch */
+/**
+ * @brief Filter an index with programs using the registers, scratch
+ * memory and ALU, and loads that fail, and check the packets accepted
+ * against running each program on each packet; one program reads
+ * scratch memory before storing to it, which must read zero
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_batch(void)
+{
+    static const struct pcap_filter_insn alu[] = {
+        {PCAP_BPF_LDX|PCAP_BPF_B|PCAP_BPF_MSH, 0, 0, 14},
+        {PCAP_BPF_LD|PCAP_BPF_H|PCAP_BPF_IND, 0, 0, 14},
+        {PCAP_BPF_ST, 0, 0, 3},
+        {PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_LEN, 0, 0, 0},
+        {PCAP_BPF_ALU|PCAP_BPF_SUB|PCAP_BPF_K, 0, 0, 60},
+        {PCAP_BPF_MISC|PCAP_BPF_TAX, 0, 0, 0},
+        {PCAP_BPF_LD|PCAP_BPF_MEM, 0, 0, 3},
+        {PCAP_BPF_ALU|PCAP_BPF_ADD|PCAP_BPF_X, 0, 0, 0},
+        {PCAP_BPF_JMP|PCAP_BPF_JSET|PCAP_BPF_K, 1, 0, 1},
+        {PCAP_BPF_ALU|PCAP_BPF_AND|PCAP_BPF_K, 0, 0, 6},
+        {PCAP_BPF_RET|PCAP_BPF_A, 0, 0, 0},
+    };
+    static const struct pcap_filter_insn div[] = {
+        {PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_ABS, 0, 0, 23},
+        {PCAP_BPF_MISC|PCAP_BPF_TAX, 0, 0, 0},
+        {PCAP_BPF_LD|PCAP_BPF_W|PCAP_BPF_LEN, 0, 0, 0},
+        {PCAP_BPF_ALU|PCAP_BPF_DIV|PCAP_BPF_X, 0, 0, 0},
+        {PCAP_BPF_JMP|PCAP_BPF_JGE|PCAP_BPF_X, 0, 2, 0},
+        {PCAP_BPF_LDX|PCAP_BPF_W|PCAP_BPF_IMM, 0, 0, 0xfffffff0},
+        {PCAP_BPF_LD|PCAP_BPF_B|PCAP_BPF_IND, 0, 0, 0x20},
+        {PCAP_BPF_ALU|PCAP_BPF_MOD|PCAP_BPF_K, 0, 0, 7},
+        {PCAP_BPF_RET|PCAP_BPF_A, 0, 0, 0},
+    };
+    static const struct pcap_filter_insn mem_zero[] = {
+        {PCAP_BPF_LD|PCAP_BPF_MEM, 0, 0, 5},
+        {PCAP_BPF_JMP|PCAP_BPF_JEQ|PCAP_BPF_K, 0, 3, 0},
+        {PCAP_BPF_LDX|PCAP_BPF_W|PCAP_BPF_LEN, 0, 0, 0},
+        {PCAP_BPF_STX, 0, 0, 5},
+        {PCAP_BPF_RET|PCAP_BPF_K, 0, 0, 1},
+        {PCAP_BPF_RET|PCAP_BPF_K, 0, 0, 0},
+    };
+    static const struct { const struct pcap_filter_insn *insns; int num_insns; } programs[] = {
+        {alu, sizeof(alu)/sizeof(alu[0])},
+        {div, sizeof(div)/sizeof(div[0])},
+        {mem_zero, sizeof(mem_zero)/sizeof(mem_zero[0])},
+        {NULL, 0}
+    };
+    struct pcap_buf_geometry geometry = {PCAP_BUF_GEOMETRY_MAGIC, 21, 2000,
+                                         PCAP_BUF_MIN_FIRST_PKT_OFFSET(2000), 0};
+    struct pcap_filter filter = {0, NULL};
+    struct pcap_index in, out;
+    unsigned char *pkt_data;
+    uint32_t i, n, first, num, expected[2000];
+    int p;
+
+    pkt_data = malloc(1536*NUM_TEST_PKTS);
+    if (!pkt_data ||
+        (pcap_index_init(&in, &geometry) != 0) ||
+        (pcap_index_init(&out, &geometry) != 0))
+        return 1;
+    srand(2);
+    index_build(&in, pkt_data, 2000);
+    /* An odd range, so that batches are partial */
+    first = 3;
+    num   = in.num_pkts - 10;
+    for (p=0; programs[p].insns; p++) {
+        if (pcap_filter_set(&filter, programs[p].insns, programs[p].num_insns) != 0)
+            return 10+p;
+        n = 0;
+        for (i=first; i<first+num; i++) {
+            if (pcap_filter_run(&filter, in.data[i], in.caplen[i], in.length[i]))
+                expected[n++] = i;
+        }
+        if (programs[p].insns == mem_zero) {
+            if (n != num)
+                return 20+p;
+        } else if ((n == 0) || (n == num)) {
+            return 30+p;
+        }
+        if (pcap_filter_index(&filter, &in, &out, first, num) != n)
+            return 40+p;
+        for (i=0; i<n; i++) {
+            if (out.seq[first+i] != expected[i])
+                return 50+p;
+        }
+    }
+    pcap_filter_free(&filter);
+    pcap_index_free(&out);
+    pcap_index_free(&in);
+    free(pkt_data);
+    return 0;
+}
+
+/*f test_throughput */
+/**
+ * @brief Report the filtering rate of 'tcp port 80' on an index of
+ * 14000 packets packet by packet, and for pools of 0, 1 and 3
+ * threads, taking the best of several runs; with no worker threads
+ * the rate must be faster than running the filter packet by packet
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_throughput(void)
+{
+    struct pcap_buf_geometry geometry = {PCAP_BUF_GEOMETRY_MAGIC, 21, 14000,
+                                         PCAP_BUF_MIN_FIRST_PKT_OFFSET(14000), 0};
+    static const int threads[] = {0, 1, 3, -1};
+    struct pcap_filter filter = {0, NULL};
+    struct pcap_index in, out;
+    unsigned char *pkt_data;
+    char error[128];
+    double rate, per_pkt_rate, pool_rate;
+    t_sl_timer timer;
+    uint32_t accepted;
+    int r, t, i;
+
+    pkt_data = malloc(1536*NUM_TEST_PKTS);
+    if (!pkt_data ||
+        (pcap_index_init(&in, &geometry) != 0) ||
+        (pcap_index_init(&out, &geometry) != 0) ||
+        (pcap_filter_compile(&filter, "tcp port 80", error, sizeof(error)) != 0))
+        return 1;
+    index_build(&in, pkt_data, 14000);
+
+    per_pkt_rate = 0;
+    SL_TIMER_INIT(timer);
+    for (r=0; r<TEST_THROUGHPUT_RUNS; r++) {
+        accepted = 0;
+        SL_TIMER_ENTRY(timer);
+        for (i=0; i<in.num_pkts; i++)
+            accepted += (pcap_filter_run(&filter, in.data[i], in.caplen[i], in.length[i]) != 0);
+        SL_TIMER_EXIT(timer);
+        rate = in.num_pkts/SL_TIMER_DELTA_VALUE_US(timer);
+        if (rate > per_pkt_rate)
+            per_pkt_rate = rate;
+    }
+    fprintf(stderr, "filter packet by packet: %f packets per us\n", per_pkt_rate);
+
+    pool_rate = 0;
+    for (t=0; threads[t]>=0; t++) {
+        struct pcap_filter_pool *pool;
+
+        pool = pcap_filter_pool_create(threads[t]);
+        if (!pool)
+            return 2;
+        pool_rate = 0;
+        SL_TIMER_INIT(timer);
+        for (r=0; r<TEST_THROUGHPUT_RUNS; r++) {
+            SL_TIMER_ENTRY(timer);
+            if (pcap_filter_pool_run(pool, &filter, &in, &out) != accepted)
+                return 3;
+            SL_TIMER_EXIT(timer);
+            rate = in.num_pkts/SL_TIMER_DELTA_VALUE_US(timer);
+            if (rate > pool_rate)
+                pool_rate = rate;
+        }
+        fprintf(stderr, "filter with %d worker threads: %f packets per us\n", threads[t],
+                pool_rate);
+        pcap_filter_pool_destroy(pool);
+        if ((threads[t] == 0) && (pool_rate <= per_pkt_rate))
+            return 4;
+    }
+    pcap_filter_free(&filter);
+    pcap_index_free(&out);
+    pcap_index_free(&in);
+    free(pkt_data);
+    return 0;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Filter compile",test_compile());
+    TEST_RUN("Filter compile errors",test_compile_errors());
+    TEST_RUN("Filter far jumps",test_far_jumps());
+    TEST_RUN("Filter load",test_load());
+    TEST_RUN("Filter validate",test_validate());
+    TEST_RUN("Filter pool",test_pool());
+    TEST_RUN("Filter batch",test_batch());
+    TEST_RUN("Filter throughput",test_throughput());
+    return failures;
+}
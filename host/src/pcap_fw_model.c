@@ -0,0 +1,116 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_fw_model.c
+ * @brief         Emulation of the packet capture firmware for host tests
+ *
+ */
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <string.h>
+#include "pcap_fw_model.h"
+
+/*a Defines
+ */
+/* Offset of packet data in the CTM buffer region DMAed, as
+ * CTM_PKT_OFFSET in the firmware */
+#define PCAP_FW_MODEL_CTM_PKT_OFFSET 64
+
+/*a Functions
+ */
+/*f pcap_fw_model_init */
+extern void
+pcap_fw_model_init(struct pcap_fw_model *model,
+                   void * const *buffer_virt,
+                   int num_buffers)
+{
+    struct pcap_buf_geometry geometry = PCAP_BUF_GEOMETRY_DEFAULT;
+
+    memset(model, 0, sizeof(*model));
+    model->geometry    = geometry;
+    model->buffer_virt = buffer_virt;
+    model->num_buffers = num_buffers;
+}
+
+/*f pcap_fw_model_give */
+extern int
+pcap_fw_model_give(void *handle, const int *buffers, int num)
+{
+    struct pcap_fw_model *model;
+    int i;
+
+    model = (struct pcap_fw_model *)handle;
+    if ((model->wptr - model->rptr) + num > PCAP_HOST_CLS_RING_SIZE_ENTRIES)
+        return 1;
+    for (i=0; i<num; i++) {
+        memset(model->buffer_virt[buffers[i]], 0,
+               PCAP_BUF_MIN_FIRST_PKT_OFFSET(model->geometry.max_pkts));
+        model->ring[(model->wptr+i) % PCAP_HOST_CLS_RING_SIZE_ENTRIES] = buffers[i];
+    }
+    __atomic_store_n(&model->wptr, model->wptr+num, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*f pcap_fw_model_fill_buffer */
+extern int
+pcap_fw_model_fill_buffer(struct pcap_fw_model *model,
+                          int num_pkts,
+                          int pkt_length)
+{
+    struct pcap_buffer *pcap_buffer;
+    uint32_t offset;
+    uint32_t num_blocks;
+    int caplen;
+    int buffer;
+    int i;
+
+    if (__atomic_load_n(&model->wptr, __ATOMIC_ACQUIRE) == model->rptr)
+        return -1;
+    buffer = model->ring[model->rptr % PCAP_HOST_CLS_RING_SIZE_ENTRIES];
+    model->rptr++;
+
+    pcap_buffer = (struct pcap_buffer *)model->buffer_virt[buffer];
+    caplen = pkt_length;
+    if ((model->geometry.snaplen != 0) && (caplen > model->geometry.snaplen))
+        caplen = model->geometry.snaplen;
+    num_blocks = (caplen + PCAP_FW_MODEL_CTM_PKT_OFFSET + 63) >> 6;
+    offset = model->geometry.first_pkt_offset >> 6;
+    for (i=0; i<num_pkts; i++) {
+        unsigned char *data;
+        int j;
+
+        if ((i >= model->geometry.max_pkts) ||
+            ((offset + num_blocks) > (1U << (model->geometry.buf_size_shift - 6))))
+            break;
+        data = ((unsigned char *)pcap_buffer) + (offset << 6) + PCAP_FW_MODEL_CTM_PKT_OFFSET;
+        memcpy(data, &model->pkt_seq, sizeof(uint32_t));
+        for (j=sizeof(uint32_t); j<caplen; j++)
+            data[j] = (model->pkt_seq + j) & 0xff;
+        pcap_buffer->pkt_desc[i].offset     = offset;
+        pcap_buffer->pkt_desc[i].num_blocks = num_blocks;
+        pcap_buffer->pkt_desc[i].seq        = PCAP_PKT_SEQ_WORD(0, model->pkt_seq);
+        pcap_buffer->pkt_desc[i].length     = pkt_length;
+        pcap_buffer->pkt_desc[i].caplen     = caplen;
+        pcap_buffer->pkt_bitmask[i/32]     |= 1U << (i%32);
+        offset += num_blocks;
+        model->pkt_seq++;
+    }
+
+    /* The firmware DMAs the header last */
+    pcap_buffer->hdr.buf_seq = model->buf_seq++;
+    __atomic_store_n(&pcap_buffer->hdr.total_packets, i, __ATOMIC_RELEASE);
+    return buffer;
+}
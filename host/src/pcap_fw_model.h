@@ -0,0 +1,112 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_fw_model.h
+ * @brief         Emulation of the packet capture firmware for host tests
+ *
+ * This models what the pcap firmware does to the host capture buffers:
+ * buffers are taken in order from the host CLS ring (here, a ring of
+ * buffer numbers rather than PCIe addresses), filled with packet data
+ * and descriptors in the firmware layout, and completed by writing
+ * the buffer header last.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_FW_MODEL_H_
+#define _PCAP_FW_MODEL_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include "firmware/pcap.h"
+
+/*a Types
+ */
+/*t struct pcap_fw_model */
+/**
+ * State of the emulated capture firmware
+ */
+struct pcap_fw_model {
+    struct pcap_buf_geometry geometry; /* As given by the host */
+    void * const *buffer_virt;
+    int      num_buffers;
+    int      ring[PCAP_HOST_CLS_RING_SIZE_ENTRIES];
+    uint32_t wptr;      /* As committed through pcap_cls_host */
+    uint32_t rptr;
+    uint32_t buf_seq;   /* Sequence number of the next buffer */
+    uint32_t pkt_seq;   /* Sequence number of the next packet */
+};
+
+/*a Functions
+ */
+/*f pcap_fw_model_init */
+/**
+ * @brief Initialize the model with no buffers given, and the default
+ * buffer geometry; the geometry may be changed before buffers are
+ * given
+ *
+ * @param model       Model to initialize
+ *
+ * @param buffer_virt Virtual addresses of the host capture buffers
+ *
+ * @param num_buffers Number of host capture buffers
+ *
+ */
+extern void pcap_fw_model_init(struct pcap_fw_model *model,
+                               void * const *buffer_virt,
+                               int num_buffers);
+
+/*f pcap_fw_model_give */
+/**
+ * @brief Give buffers to the model and commit them, as pktgencap does
+ *
+ * @param handle  Model (as a pcap_consumers_give_fn)
+ *
+ * @param buffers Buffer numbers to give
+ *
+ * @param num     Number of buffers to give
+ *
+ * @returns Zero on success, non-zero if the ring would overflow
+ *
+ */
+extern int pcap_fw_model_give(void *handle, const int *buffers, int num);
+
+/*f pcap_fw_model_fill_buffer */
+/**
+ * @brief Capture packets into the next given buffer and complete it
+ *
+ * @param model      Model
+ *
+ * @param num_pkts   Number of packets to place in the buffer (fewer
+ *                   if the buffer fills)
+ *
+ * @param pkt_length Length of each packet; only the geometry snaplen
+ *                   of it is captured
+ *
+ * @returns Buffer number completed, or -1 if no buffer has been given
+ *
+ * Packet n of the capture has descriptor seq n (as the 16-bit sequence
+ * number of sequencer 0), and its data starts with n as a 32-bit
+ * little-endian value followed by bytes (n+i)&0xff.
+ *
+ */
+extern int pcap_fw_model_fill_buffer(struct pcap_fw_model *model,
+                                     int num_pkts,
+                                     int pkt_length);
+
+/*a Close guard
+ */
+#endif /* _PCAP_FW_MODEL_H_ */
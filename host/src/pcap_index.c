@@ -0,0 +1,317 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_index.c
+ * @brief         Dense packet index of a completed capture buffer
+ *
+ * A descriptor is valid if its packet starts at or after the first
+ * packet offset, ends within the buffer, has room for its metadata
+ * and caplen bytes in its blocks, and has a caplen no more than its
+ * length.
+ *
+ * The AVX2 build gathers words 0 (offset and num_blocks), 1 (seq) and
+ * 2 (caplen and length) of eight descriptors, checks them together,
+ * and uses the mask of valid descriptors to look up a permutation
+ * that compresses them to the front of the vectors; the vectors are
+ * stored whole at the end of the arrays, which have room for eight
+ * more entries than packets, and the end advances by the number
+ * valid.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcap_index.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PCAP_INDEX_X86
+#endif
+
+/*a Defines
+ */
+/* Entries the AVX2 build may store beyond the packets indexed */
+#define PCAP_INDEX_SLACK 8
+
+/*a Types
+ */
+/*t index_build_fn */
+typedef uint32_t (*index_build_fn)(struct pcap_index *index,
+                                   const struct pcap_buffer *pcap_buffer,
+                                   uint32_t total_packets);
+
+/*a Static variables
+ */
+/* Permutations compressing the lanes set in an 8-bit mask to the
+ * front of a vector, one byte per lane, built at load */
+static uint64_t compress_lut[256];
+
+/*a Scalar build
+ */
+/*f index_range_scalar */
+/**
+ * @brief Index descriptors @p first to @p total_packets-1, appending
+ * the valid ones to the index from @p n
+ *
+ * @returns Number of packets in the index
+ */
+static uint32_t
+index_range_scalar(struct pcap_index *index,
+                   const struct pcap_buffer *pcap_buffer,
+                   uint32_t first,
+                   uint32_t total_packets,
+                   uint32_t n)
+{
+    uint32_t first_block, end_block;
+    uint32_t i;
+
+    first_block = index->geometry.first_pkt_offset >> 6;
+    end_block   = 1U << (index->geometry.buf_size_shift - 6);
+    for (i=first; i<total_packets; i++) {
+        const struct pcap_pkt_buf_desc *desc;
+        desc = &pcap_buffer->pkt_desc[i];
+        if ((desc->offset < first_block) ||
+            (desc->offset + desc->num_blocks > end_block) ||
+            (desc->caplen + PCAP_INDEX_PKT_DATA_OFFSET > (desc->num_blocks << 6)) ||
+            (desc->caplen > desc->length))
+            continue;
+        index->data[n]   = ((const unsigned char *)pcap_buffer +
+                            (desc->offset << 6) + PCAP_INDEX_PKT_DATA_OFFSET);
+        index->caplen[n] = desc->caplen;
+        index->length[n] = desc->length;
+        index->seq[n]    = desc->seq;
+        n++;
+    }
+    return n;
+}
+
+/*f index_build_scalar */
+static uint32_t
+index_build_scalar(struct pcap_index *index,
+                   const struct pcap_buffer *pcap_buffer,
+                   uint32_t total_packets)
+{
+    return index_range_scalar(index, pcap_buffer, 0, total_packets, 0);
+}
+
+/*f compress_lut_init */
+__attribute__((constructor))
+static void
+compress_lut_init(void)
+{
+    int mask, lane, n;
+
+    for (mask=0; mask<256; mask++) {
+        uint64_t perm;
+        perm = 0;
+        n = 0;
+        for (lane=0; lane<8; lane++) {
+            if (mask & (1<<lane))
+                perm |= ((uint64_t)lane) << (8*n++);
+        }
+        compress_lut[mask] = perm;
+    }
+}
+
+#ifdef PCAP_INDEX_X86
+/*a AVX2 build
+ */
+/*f index_build_avx2 */
+/**
+ * @brief Index eight descriptors at a time with gathers, compressing
+ * the valid ones with VPERMD; the last few are done by the scalar
+ * build
+ */
+__attribute__((target("avx2")))
+static uint32_t
+index_build_avx2(struct pcap_index *index,
+                 const struct pcap_buffer *pcap_buffer,
+                 uint32_t total_packets)
+{
+    const int *desc_words;
+    __m256i vindex, lo16, data_offset, first_block, end_block;
+    __m256i base;
+    uint32_t i, n;
+
+    desc_words  = (const int *)pcap_buffer->pkt_desc;
+    vindex      = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    lo16        = _mm256_set1_epi32(0xffff);
+    data_offset = _mm256_set1_epi32(PCAP_INDEX_PKT_DATA_OFFSET);
+    first_block = _mm256_set1_epi32(index->geometry.first_pkt_offset >> 6);
+    end_block   = _mm256_set1_epi32(1U << (index->geometry.buf_size_shift - 6));
+    base        = _mm256_set1_epi64x((int64_t)(uintptr_t)pcap_buffer);
+    n = 0;
+    for (i=0; i+8<=total_packets; i+=8) {
+        __m256i w0, seq, w2;
+        __m256i num_blocks, offset, caplen, length, bad, perm, data;
+        uint32_t valid;
+
+        w0  = _mm256_i32gather_epi32(desc_words + 4*i + 0, vindex, 4);
+        seq = _mm256_i32gather_epi32(desc_words + 4*i + 1, vindex, 4);
+        w2  = _mm256_i32gather_epi32(desc_words + 4*i + 2, vindex, 4);
+        num_blocks = _mm256_and_si256(w0, lo16);
+        offset     = _mm256_srli_epi32(w0, 16);
+        caplen     = _mm256_and_si256(w2, lo16);
+        length     = _mm256_srli_epi32(w2, 16);
+
+        /* All values are below 1<<24, so signed compares will do */
+        bad = _mm256_cmpgt_epi32(first_block, offset);
+        bad = _mm256_or_si256(bad, _mm256_cmpgt_epi32(_mm256_add_epi32(offset, num_blocks),
+                                                      end_block));
+        bad = _mm256_or_si256(bad, _mm256_cmpgt_epi32(_mm256_add_epi32(caplen, data_offset),
+                                                      _mm256_slli_epi32(num_blocks, 6)));
+        bad = _mm256_or_si256(bad, _mm256_cmpgt_epi32(caplen, length));
+        valid = (~_mm256_movemask_ps(_mm256_castsi256_ps(bad))) & 0xff;
+
+        perm = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&compress_lut[valid]));
+        _mm256_storeu_si256((__m256i *)(index->caplen + n), _mm256_permutevar8x32_epi32(caplen, perm));
+        _mm256_storeu_si256((__m256i *)(index->length + n), _mm256_permutevar8x32_epi32(length, perm));
+        _mm256_storeu_si256((__m256i *)(index->seq + n),    _mm256_permutevar8x32_epi32(seq, perm));
+        data = _mm256_add_epi32(_mm256_slli_epi32(offset, 6), data_offset);
+        data = _mm256_permutevar8x32_epi32(data, perm);
+        _mm256_storeu_si256((__m256i *)(index->data + n),
+                            _mm256_add_epi64(base, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(data))));
+        _mm256_storeu_si256((__m256i *)(index->data + n + 4),
+                            _mm256_add_epi64(base, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(data, 1))));
+        n += __builtin_popcount(valid);
+    }
+    return index_range_scalar(index, pcap_buffer, i, total_packets, n);
+}
+#endif
+
+/*a Selected implementation
+ */
+static index_build_fn index_build_impl;
+
+/*a External functions
+ */
+/*f pcap_index_isa_supported */
+extern int
+pcap_index_isa_supported(enum pcap_index_isa isa)
+{
+    switch (isa) {
+    case PCAP_INDEX_ISA_SCALAR:
+        return 1;
+#ifdef PCAP_INDEX_X86
+    case PCAP_INDEX_ISA_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        break;
+    }
+    return 0;
+}
+
+/*f pcap_index_isa_name */
+extern const char *
+pcap_index_isa_name(enum pcap_index_isa isa)
+{
+    switch (isa) {
+    case PCAP_INDEX_ISA_SCALAR: return "scalar";
+    case PCAP_INDEX_ISA_AVX2:   return "avx2";
+    default: break;
+    }
+    return "best";
+}
+
+/*f pcap_index_select */
+extern int
+pcap_index_select(enum pcap_index_isa isa)
+{
+    if (isa == PCAP_INDEX_ISA_BEST) {
+        isa = PCAP_INDEX_ISA_SCALAR;
+        if (pcap_index_isa_supported(PCAP_INDEX_ISA_AVX2))
+            isa = PCAP_INDEX_ISA_AVX2;
+    }
+    if (!pcap_index_isa_supported(isa))
+        return -1;
+    switch (isa) {
+#ifdef PCAP_INDEX_X86
+    case PCAP_INDEX_ISA_AVX2:
+        index_build_impl = index_build_avx2;
+        break;
+#endif
+    default:
+        index_build_impl = index_build_scalar;
+        break;
+    }
+    return isa;
+}
+
+/*f pcap_index_init */
+extern int
+pcap_index_init(struct pcap_index *index,
+                const struct pcap_buf_geometry *geometry)
+{
+    size_t num;
+
+    memset(index, 0, sizeof(*index));
+    if ((geometry->magic != PCAP_BUF_GEOMETRY_MAGIC) ||
+        !PCAP_BUF_GEOMETRY_VALID(geometry->buf_size_shift,
+                                 geometry->max_pkts,
+                                 geometry->first_pkt_offset))
+        return 1;
+    index->geometry = *geometry;
+    num = geometry->max_pkts + PCAP_INDEX_SLACK;
+    index->data   = malloc(num * sizeof(*index->data));
+    index->caplen = malloc(num * sizeof(uint32_t));
+    index->length = malloc(num * sizeof(uint32_t));
+    index->seq    = malloc(num * sizeof(uint32_t));
+    if (!index->data || !index->caplen || !index->length || !index->seq) {
+        pcap_index_free(index);
+        return 1;
+    }
+    return 0;
+}
+
+/*f pcap_index_free */
+extern void
+pcap_index_free(struct pcap_index *index)
+{
+    free(index->data);
+    free(index->caplen);
+    free(index->length);
+    free(index->seq);
+    index->data   = NULL;
+    index->caplen = NULL;
+    index->length = NULL;
+    index->seq    = NULL;
+    index->num_pkts = 0;
+}
+
+/*f pcap_index_build */
+extern int
+pcap_index_build(struct pcap_index *index,
+                 const struct pcap_buffer *pcap_buffer)
+{
+    uint32_t total_packets;
+    uint32_t i;
+
+    if (!index_build_impl)
+        pcap_index_select(PCAP_INDEX_ISA_BEST);
+    index->buffer   = pcap_buffer;
+    index->buf_seq  = pcap_buffer->hdr.buf_seq;
+    index->num_pkts = 0;
+    index->num_bad  = 0;
+    total_packets = pcap_buffer->hdr.total_packets;
+    if (total_packets > index->geometry.max_pkts)
+        return -1;
+    index->num_pkts = index_build_impl(index, pcap_buffer, total_packets);
+    index->num_bad  = total_packets - index->num_pkts;
+    for (i=0; (i<PCAP_INDEX_PREFETCH_PKTS) && (i<index->num_pkts); i++)
+        __builtin_prefetch(index->data[i]);
+    return (int)index->num_pkts;
+}
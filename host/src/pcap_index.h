@@ -0,0 +1,168 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_index.h
+ * @brief         Dense packet index of a completed capture buffer
+ *
+ * A completed capture buffer has total_packets descriptors, each
+ * giving where its packet is in the buffer. The index is built from
+ * them in one pass: the packet data pointers, captured and original
+ * lengths, and sequence numbers, each in its own dense array, so that
+ * packet parsers (and the filter and sequence checks) work on batches
+ * rather than chasing the descriptors.
+ *
+ * Descriptors that do not fit the buffer geometry are skipped and
+ * counted. The firmware does not DMA the packet bitmask to the host,
+ * so every descriptor below total_packets is indexed.
+ *
+ * The index has a scalar implementation and, on x86-64, an AVX2
+ * implementation that gathers eight descriptors at a time and
+ * compresses the valid ones into the arrays; the best the CPU
+ * supports is selected when an index is first built, or one may be
+ * selected explicitly (for testing and benchmarking).
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_INDEX_H_
+#define _PCAP_INDEX_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include "firmware/pcap.h"
+
+/*a Defines
+ */
+/* Bytes of metadata ahead of the packet data in the buffer, as the
+ * firmware CTM_PKT_OFFSET */
+#define PCAP_INDEX_PKT_DATA_OFFSET 64
+
+/* Packet heads prefetched when an index is built */
+#define PCAP_INDEX_PREFETCH_PKTS 16
+
+/*a Types
+ */
+/*t pcap_index_isa */
+/**
+ * Instruction set extensions the index build may use
+ */
+enum pcap_index_isa {
+    PCAP_INDEX_ISA_SCALAR,
+    PCAP_INDEX_ISA_AVX2,
+    PCAP_INDEX_ISA_BEST,   /* For pcap_index_select */
+};
+
+/*t struct pcap_index */
+/**
+ * Index of the packets of a capture buffer; packet i of the index has
+ * data[i], caplen[i], length[i] and seq[i]
+ */
+struct pcap_index {
+    struct pcap_buf_geometry geometry;
+    const struct pcap_buffer *buffer; /* Buffer indexed */
+    uint32_t buf_seq;      /* Of the buffer indexed */
+    uint32_t num_pkts;     /* Packets indexed */
+    uint32_t num_bad;      /* Descriptors skipped as bad */
+    const unsigned char **data; /* Packet data */
+    uint32_t *caplen;      /* Bytes of packet data captured */
+    uint32_t *length;      /* Original length of the packet */
+    uint32_t *seq;         /* NBI sequence number of the packet */
+};
+
+/*a Functions
+ */
+/*f pcap_index_isa_supported */
+/**
+ * @brief Determine if the CPU (and this build) supports an ISA
+ *
+ */
+extern int pcap_index_isa_supported(enum pcap_index_isa isa);
+
+/*f pcap_index_isa_name */
+/**
+ * @brief Get the name of an ISA, for reports
+ *
+ */
+extern const char *pcap_index_isa_name(enum pcap_index_isa isa);
+
+/*f pcap_index_select */
+/**
+ * @brief Select the implementation the index build uses
+ *
+ * @param isa ISA to use, or PCAP_INDEX_ISA_BEST for the best supported
+ *
+ * @returns The ISA selected, or -1 if @p isa is not supported (and
+ * the selection is unchanged)
+ *
+ */
+extern int pcap_index_select(enum pcap_index_isa isa);
+
+/*f pcap_index_init */
+/**
+ * @brief Initialize an index, allocating its arrays for the packets
+ * of a buffer of a geometry
+ *
+ * @param index    Index to initialize
+ *
+ * @param geometry Geometry of the buffers to index
+ *
+ * @returns Zero on success, non-zero if the geometry is not valid or
+ * the allocation fails
+ *
+ */
+extern int pcap_index_init(struct pcap_index *index,
+                           const struct pcap_buf_geometry *geometry);
+
+/*f pcap_index_free */
+/**
+ * @brief Free the arrays of an index
+ *
+ */
+extern void pcap_index_free(struct pcap_index *index);
+
+/*f pcap_index_build */
+/**
+ * @brief Index the packets of a completed capture buffer, and
+ * prefetch the heads of the first PCAP_INDEX_PREFETCH_PKTS of them
+ *
+ * @param index       Index, replacing any buffer indexed before
+ *
+ * @param pcap_buffer Completed capture buffer
+ *
+ * @returns Number of packets indexed, or -1 if the buffer claims more
+ * packets than the geometry allows (and nothing is indexed)
+ *
+ */
+extern int pcap_index_build(struct pcap_index *index,
+                            const struct pcap_buffer *pcap_buffer);
+
+/*f pcap_index_prefetch */
+/**
+ * @brief Prefetch the head of packet @p i of an index, if there is
+ * one; a consumer working through the index calls this for the packet
+ * PCAP_INDEX_PREFETCH_PKTS ahead
+ *
+ */
+static inline void
+pcap_index_prefetch(const struct pcap_index *index, uint32_t i)
+{
+    if (i < index->num_pkts)
+        __builtin_prefetch(index->data[i]);
+}
+
+/*a Close guard
+ */
+#endif /* _PCAP_INDEX_H_ */
@@ -0,0 +1,297 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_index_test.c
+ * @brief         Test for the capture buffer packet index
+ *
+ * Every implementation the CPU supports indexes buffers of random
+ * packets, with some bad descriptors among them, and is checked
+ * against walking the descriptors one at a time; the rate of each is
+ * reported for a 2MB buffer of 64B packets.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pcap_index.h"
+#include "timer.h"
+
+/*a Defines
+ */
+#define TEST_BUF_SIZE (1<<PCAP_BUF_SIZE_SHIFT_MAX)
+
+/*a Useful functions
+ */
+/*f buffer_build */
+/**
+ * @brief Fill a buffer with random packets, making about one in
+ * @p bad_one_in of the descriptors bad (if not zero)
+ *
+ * @returns Number of descriptors that are good
+ */
+static int
+buffer_build(struct pcap_buffer *pcap_buffer,
+             const struct pcap_buf_geometry *geometry,
+             int num_pkts, int max_length, int bad_one_in)
+{
+    uint32_t offset, end;
+    int num_good;
+    int i;
+
+    memset(pcap_buffer, 0, PCAP_BUF_MIN_FIRST_PKT_OFFSET(geometry->max_pkts));
+    offset = geometry->first_pkt_offset >> 6;
+    end    = 1U << (geometry->buf_size_shift - 6);
+    num_good = 0;
+    for (i=0; i<num_pkts; i++) {
+        struct pcap_pkt_buf_desc *desc;
+        uint32_t length, caplen;
+
+        desc = &pcap_buffer->pkt_desc[i];
+        length = 60 + (rand() % (max_length - 59));
+        caplen = length;
+        if ((geometry->snaplen != 0) && (caplen > geometry->snaplen))
+            caplen = geometry->snaplen;
+        desc->num_blocks = (caplen + PCAP_INDEX_PKT_DATA_OFFSET + 63) >> 6;
+        desc->offset     = offset;
+        desc->seq        = rand();
+        desc->length     = length;
+        desc->caplen     = caplen;
+        if (offset + desc->num_blocks > end)
+            desc->offset = end - desc->num_blocks;
+        else
+            offset += desc->num_blocks;
+        if (bad_one_in && ((rand() % bad_one_in) == 0)) {
+            switch (rand() % 5) {
+            case 0: desc->offset = (geometry->first_pkt_offset >> 6) - 1; break;
+            case 1: desc->offset = end - desc->num_blocks + 1; break;
+            case 2: desc->caplen = (desc->num_blocks << 6) - PCAP_INDEX_PKT_DATA_OFFSET + 1; break;
+            case 3: desc->length = desc->caplen - 1; break;
+            default: desc->num_blocks = 0; break;
+            }
+        }
+        if ((desc->offset >= (geometry->first_pkt_offset >> 6)) &&
+            (desc->offset + desc->num_blocks <= end) &&
+            (desc->caplen + PCAP_INDEX_PKT_DATA_OFFSET <= (desc->num_blocks << 6)) &&
+            (desc->caplen <= desc->length))
+            num_good++;
+    }
+    pcap_buffer->hdr.buf_seq       = rand();
+    pcap_buffer->hdr.total_packets = num_pkts;
+    return num_good;
+}
+
+/*f check_index */
+/**
+ * @brief Check an index against walking the descriptors
+ *
+ * @returns Zero if it matches, else an error indication
+ */
+static int
+check_index(const struct pcap_index *index, const struct pcap_buffer *pcap_buffer,
+            int num_good)
+{
+    uint32_t i, n;
+
+    if ((index->num_pkts != num_good) ||
+        (index->num_pkts + index->num_bad != pcap_buffer->hdr.total_packets) ||
+        (index->buf_seq != pcap_buffer->hdr.buf_seq))
+        return 1;
+    n = 0;
+    for (i=0; i<pcap_buffer->hdr.total_packets; i++) {
+        const struct pcap_pkt_buf_desc *desc;
+        const unsigned char *data;
+
+        desc = &pcap_buffer->pkt_desc[i];
+        data = ((const unsigned char *)pcap_buffer) + (desc->offset << 6) + PCAP_INDEX_PKT_DATA_OFFSET;
+        if ((n < index->num_pkts) &&
+            (index->data[n] == data) &&
+            (index->caplen[n] == desc->caplen) &&
+            (index->length[n] == desc->length) &&
+            (index->seq[n] == desc->seq))
+            n++;
+    }
+    if (n != index->num_pkts)
+        return 2;
+    return 0;
+}
+
+/*a Tests
+ */
+/*f test_build */
+/**
+ * @brief Check the index of one ISA (if supported) for buffers of
+ * 0 to 40 packets, and full buffers, of 64kB and 2MB geometries
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_build(enum pcap_index_isa isa)
+{
+    struct pcap_buf_geometry geometries[2] = {
+        {PCAP_BUF_GEOMETRY_MAGIC, 16, 255, PCAP_BUF_MIN_FIRST_PKT_OFFSET(255), 128},
+        {PCAP_BUF_GEOMETRY_MAGIC, 21, 12000, PCAP_BUF_MIN_FIRST_PKT_OFFSET(12000), 0},
+    };
+    struct pcap_buffer *pcap_buffer;
+    struct pcap_index index;
+    int g, num_pkts;
+    int err;
+
+    if (!pcap_index_isa_supported(isa)) {
+        fprintf(stderr, "ISA %s not supported; skipped\n", pcap_index_isa_name(isa));
+        return 0;
+    }
+    if (pcap_index_select(isa) != isa)
+        return 1;
+    pcap_buffer = malloc(TEST_BUF_SIZE);
+    if (!pcap_buffer)
+        return 2;
+    srand(isa+1);
+    err = 0;
+    for (g=0; (g<2) && !err; g++) {
+        if (pcap_index_init(&index, &geometries[g]) != 0) {
+            err = 3;
+            break;
+        }
+        for (num_pkts=0; (num_pkts<=40) && !err; num_pkts++) {
+            int num_good;
+            num_good = buffer_build(pcap_buffer, &geometries[g], num_pkts, 1514, 4);
+            if (pcap_index_build(&index, pcap_buffer) != num_good)
+                err = 4;
+            else if (check_index(&index, pcap_buffer, num_good))
+                err = 5;
+        }
+        for (num_pkts=geometries[g].max_pkts-9; (num_pkts<=geometries[g].max_pkts) && !err; num_pkts++) {
+            int num_good;
+            num_good = buffer_build(pcap_buffer, &geometries[g], num_pkts, 128, 100);
+            if (pcap_index_build(&index, pcap_buffer) != num_good)
+                err = 6;
+            else if (check_index(&index, pcap_buffer, num_good))
+                err = 7;
+        }
+        pcap_buffer->hdr.total_packets = geometries[g].max_pkts+1;
+        if (!err && (pcap_index_build(&index, pcap_buffer) != -1))
+            err = 8;
+        pcap_index_free(&index);
+    }
+    free(pcap_buffer);
+    pcap_index_select(PCAP_INDEX_ISA_BEST);
+    return err;
+}
+
+/*f test_geometry */
+/**
+ * @brief An index is not initialized with an invalid geometry
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_geometry(void)
+{
+    struct pcap_buf_geometry geometry = PCAP_BUF_GEOMETRY_DEFAULT;
+    struct pcap_index index;
+
+    geometry.magic = 0;
+    if (pcap_index_init(&index, &geometry) == 0)
+        return 1;
+    geometry.magic = PCAP_BUF_GEOMETRY_MAGIC;
+    geometry.max_pkts = PCAP_BUF_MAX_PKTS_LIMIT+1;
+    if (pcap_index_init(&index, &geometry) == 0)
+        return 2;
+    return 0;
+}
+
+/*f test_throughput */
+/**
+ * @brief Report the indexing rate of each supported ISA for a full
+ * 2MB buffer of 64B packets
+ *
+ * @returns Zero
+ *
+ */
+static int
+test_throughput(void)
+{
+    struct pcap_buf_geometry geometry = {PCAP_BUF_GEOMETRY_MAGIC, 21, 14000,
+                                         PCAP_BUF_MIN_FIRST_PKT_OFFSET(14000), 0};
+    struct pcap_buffer *pcap_buffer;
+    struct pcap_index index;
+    int isa;
+
+    pcap_buffer = malloc(TEST_BUF_SIZE);
+    if (!pcap_buffer || (pcap_index_init(&index, &geometry) != 0))
+        return 1;
+    buffer_build(pcap_buffer, &geometry, geometry.max_pkts, 64, 0);
+    for (isa=PCAP_INDEX_ISA_SCALAR; isa<PCAP_INDEX_ISA_BEST; isa++) {
+        t_sl_timer timer;
+        int i;
+
+        if (pcap_index_select(isa) != isa)
+            continue;
+        SL_TIMER_INIT(timer);
+        SL_TIMER_ENTRY(timer);
+        for (i=0; i<100; i++)
+            pcap_index_build(&index, pcap_buffer);
+        SL_TIMER_EXIT(timer);
+        fprintf(stderr, "index %s: %f packets per us\n", pcap_index_isa_name(isa),
+                100.0*geometry.max_pkts/SL_TIMER_VALUE_US(timer));
+    }
+    pcap_index_select(PCAP_INDEX_ISA_BEST);
+    pcap_index_free(&index);
+    free(pcap_buffer);
+    return 0;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Index scalar",test_build(PCAP_INDEX_ISA_SCALAR));
+    TEST_RUN("Index AVX2",test_build(PCAP_INDEX_ISA_AVX2));
+    TEST_RUN("Index geometry",test_geometry());
+    TEST_RUN("Index throughput",test_throughput());
+    return failures;
+}
@@ -0,0 +1,493 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_journal.c
+ * @brief         Drain and decode of the packet capture debug journal
+ *
+ * Entries written since the host last cleared the journal form a
+ * single run, circularly, as the firmware writes them in order. To
+ * find where the firmware is writing, the whole journal is scanned:
+ * the run starts at an entry whose predecessor is clear, or, if every
+ * entry is written, at the point where the timestamps step back.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include "pcap_journal.h"
+
+/*a Defines
+ */
+#define ENTRY_SIZE sizeof(struct pcap_journal_entry)
+
+/*a Static variables
+ */
+static const char *const type_names[PCAP_JOURNAL_NUM_TYPES] = {
+    PCAP_JOURNAL_NAMES
+};
+
+/*a Static functions
+ */
+/*f entry_valid */
+static inline int
+entry_valid(const struct pcap_journal_entry *entry)
+{
+    return PCAP_JOURNAL_ID_MARK(entry->id) == PCAP_JOURNAL_MARK;
+}
+
+/*f ts_before */
+/**
+ * @brief Return true if timestamp @p b is more than the reorder
+ * window before @p a
+ */
+static inline int
+ts_before(uint32_t a, uint32_t b)
+{
+    return ((int32_t)(b - a)) < -PCAP_JOURNAL_REORDER_TICKS;
+}
+
+/*f journal_scan */
+/**
+ * @brief Scan the whole journal for the run of entries not yet drained
+ *
+ * @param oldest     First entry of the run
+ * @param newest     Last entry of the run
+ * @param newest_ts  Timestamp of the last entry
+ *
+ * @returns Number of entries in the run, or -1 on a read failure
+ *
+ */
+static int
+journal_scan(struct pcap_journal *journal, int *oldest, int *newest, uint32_t *newest_ts)
+{
+    uint32_t *ts;
+    uint8_t *valid;
+    int n, p, q, i, count, num_valid;
+
+    n = journal->num_entries;
+    ts = malloc(n * sizeof(uint32_t));
+    valid = malloc(n);
+    if (!ts || !valid) {
+        free(ts);
+        free(valid);
+        return -1;
+    }
+
+    num_valid = 0;
+    for (p=0; p<n; p+=count) {
+        count = n - p;
+        if (count > PCAP_JOURNAL_BATCH_ENTRIES)
+            count = PCAP_JOURNAL_BATCH_ENTRIES;
+        journal->num_reads++;
+        if (journal->read(journal->handle, p*ENTRY_SIZE, journal->batch, count*ENTRY_SIZE) != 0) {
+            free(ts);
+            free(valid);
+            return -1;
+        }
+        for (i=0; i<count; i++) {
+            valid[p+i] = entry_valid(&journal->batch[i]);
+            ts[p+i]    = journal->batch[i].timestamp;
+            num_valid += valid[p+i];
+        }
+    }
+
+    count = 0;
+    if (num_valid > 0) {
+        *oldest = -1;
+        for (p=0; (p<n) && (*oldest<0); p++) {
+            if (valid[p] && !valid[(p+n-1)%n])
+                *oldest = p;
+        }
+        for (p=0; (p<n) && (*oldest<0); p++) {
+            if (ts_before(ts[(p+n-1)%n], ts[p]))
+                *oldest = p;
+        }
+        if (*oldest < 0)
+            *oldest = 0;
+        q = *oldest;
+        for (count=1; count<n; count++) {
+            p = (*oldest + count) % n;
+            if (!valid[p] || ts_before(ts[q], ts[p]))
+                break;
+            q = p;
+        }
+        *newest    = q;
+        *newest_ts = ts[q];
+    }
+    free(ts);
+    free(valid);
+    return count;
+}
+
+/*f chrome_record */
+/**
+ * @brief Add a record to a Chrome trace export
+ */
+static void
+chrome_record(struct pcap_journal_chrome *chrome, const char *format, ...)
+{
+    va_list ap;
+
+    fprintf(chrome->f, "%s\n", (chrome->num_records > 0) ? "," : "");
+    va_start(ap, format);
+    vfprintf(chrome->f, format, ap);
+    va_end(ap);
+    chrome->num_records++;
+}
+
+/*f chrome_us */
+static inline double
+chrome_us(const struct pcap_journal_chrome *chrome, uint64_t ticks)
+{
+    return ((int64_t)(ticks - chrome->first_ticks)) * chrome->us_per_tick;
+}
+
+/*f chrome_buffer */
+/**
+ * @brief Find the timeline of an MU buffer, adding it if new
+ *
+ * @returns Index of the buffer, or -1 if too many buffers
+ *
+ */
+static int
+chrome_buffer(struct pcap_journal_chrome *chrome, uint32_t mu_base_s8)
+{
+    int i;
+
+    for (i=0; i<chrome->num_buffers; i++) {
+        if (chrome->buffers[i].mu_base_s8 == mu_base_s8)
+            return i;
+    }
+    if (chrome->num_buffers >= PCAP_JOURNAL_CHROME_MAX_BUFFERS)
+        return -1;
+    i = chrome->num_buffers++;
+    memset(&chrome->buffers[i], 0, sizeof(chrome->buffers[i]));
+    chrome->buffers[i].mu_base_s8 = mu_base_s8;
+    chrome_record(chrome,
+                  "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+                  "\"args\":{\"name\":\"MU buffer 0x%08x\"}}",
+                  i+1, mu_base_s8);
+    return i;
+}
+
+/*f chrome_buffer_event */
+/**
+ * @brief Move an MU buffer timeline on, adding a span for the state
+ * it leaves
+ */
+static void
+chrome_buffer_event(struct pcap_journal_chrome *chrome, const struct pcap_journal_event *event)
+{
+    struct pcap_journal_chrome_buffer *buffer;
+    const char *span;
+    int type, i;
+
+    type = PCAP_JOURNAL_ID_TYPE(event->id);
+    i = chrome_buffer(chrome, event->a);
+    if (i < 0)
+        return;
+    buffer = &chrome->buffers[i];
+    switch (buffer->state) {
+    case PCAP_JOURNAL_MU_BUF_ADDED: span = "queued";  break;
+    case PCAP_JOURNAL_MU_BUF_TAKEN: span = "filling"; break;
+    case PCAP_JOURNAL_MU_BUF_FULL:  span = "dma";     break;
+    case PCAP_JOURNAL_MU_BUF_DMAED: span = "recycle"; break;
+    default: span = NULL; break;
+    }
+    if (span && (event->ticks >= buffer->since_ticks)) {
+        chrome_record(chrome,
+                      "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+                      "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"buf_seq\":%u}}",
+                      span, i+1, chrome_us(chrome, buffer->since_ticks),
+                      (event->ticks - buffer->since_ticks) * chrome->us_per_tick,
+                      buffer->buf_seq);
+    }
+    if (type == PCAP_JOURNAL_MU_BUF_ADDED)
+        buffer->buf_seq = event->b;
+    buffer->state       = type;
+    buffer->since_ticks = event->ticks;
+}
+
+/*a External functions
+ */
+/*f pcap_journal_init */
+extern void
+pcap_journal_init(struct pcap_journal *journal, int num_entries,
+                  pcap_journal_read_fn read, pcap_journal_write_fn write,
+                  void *handle)
+{
+    memset(journal, 0, sizeof(*journal));
+    journal->read        = read;
+    journal->write       = write;
+    journal->handle      = handle;
+    journal->num_entries = num_entries;
+}
+
+/*f pcap_journal_attach */
+extern int
+pcap_journal_attach(struct pcap_journal *journal)
+{
+    int oldest, newest, num_valid;
+    int p, count;
+    uint32_t newest_ts;
+
+    num_valid = journal_scan(journal, &oldest, &newest, &newest_ts);
+    if (num_valid < 0)
+        return 1;
+    for (p=0; p<journal->num_entries; p+=count) {
+        count = journal->num_entries - p;
+        if (count > PCAP_JOURNAL_BATCH_ENTRIES)
+            count = PCAP_JOURNAL_BATCH_ENTRIES;
+        if (journal->write(journal->handle, p*ENTRY_SIZE, journal->zeros, count*ENTRY_SIZE) != 0)
+            return 1;
+    }
+    journal->rptr     = 0;
+    journal->synced   = 0;
+    journal->have_ref = 0;
+    journal->overrun  = 0;
+    if (num_valid > 0) {
+        journal->rptr      = (newest+1) % journal->num_entries;
+        journal->synced    = 1;
+        journal->have_ref  = 1;
+        journal->ref_ts    = newest_ts;
+        journal->ref_ticks = newest_ts;
+    }
+    return 0;
+}
+
+/*f pcap_journal_drain */
+extern int
+pcap_journal_drain(struct pcap_journal *journal,
+                   pcap_journal_event_fn callback, void *handle)
+{
+    struct pcap_journal_event event;
+    uint64_t last_ticks, max_ticks;
+    uint32_t max_ts;
+    int64_t offset;
+    int drained, count, i;
+
+    if (!journal->synced) {
+        int oldest, newest, num_valid;
+        uint32_t newest_ts;
+        num_valid = journal_scan(journal, &oldest, &newest, &newest_ts);
+        if (num_valid < 0)
+            return -1;
+        if (num_valid == 0)
+            return 0;
+        if ((journal->num_events > 0) && (oldest != journal->rptr))
+            journal->overrun = 1;
+        journal->rptr   = oldest;
+        journal->synced = 1;
+    }
+
+    drained = 0;
+    last_ticks = journal->ref_ticks;
+    max_ticks  = journal->ref_ticks;
+    max_ts     = journal->ref_ts;
+    while (drained < journal->num_entries) {
+        count = journal->num_entries - journal->rptr;
+        if (count > journal->num_entries - drained)
+            count = journal->num_entries - drained;
+        if (count > PCAP_JOURNAL_BATCH_ENTRIES)
+            count = PCAP_JOURNAL_BATCH_ENTRIES;
+        journal->num_reads++;
+        if (journal->read(journal->handle, journal->rptr*ENTRY_SIZE,
+                          journal->batch, count*ENTRY_SIZE) != 0)
+            return -1;
+        for (i=0; i<count; i++) {
+            const struct pcap_journal_entry *entry;
+            entry = &journal->batch[i];
+            if (!entry_valid(entry))
+                break;
+            if (!journal->have_ref) {
+                journal->have_ref  = 1;
+                journal->ref_ts    = entry->timestamp;
+                journal->ref_ticks = entry->timestamp;
+                last_ticks = max_ticks = journal->ref_ticks;
+                max_ts = journal->ref_ts;
+            }
+            offset = (int32_t)(entry->timestamp - journal->ref_ts);
+            if (offset < -PCAP_JOURNAL_REORDER_TICKS)
+                offset = (uint32_t)(entry->timestamp - journal->ref_ts);
+            event.ticks = journal->ref_ticks + offset;
+            event.id    = entry->id;
+            event.a     = entry->a;
+            event.b     = entry->b;
+            event.flags = 0;
+            if (journal->overrun ||
+                (event.ticks + PCAP_JOURNAL_REORDER_TICKS < last_ticks)) {
+                event.flags |= PCAP_JOURNAL_EVENT_OVERRUN;
+                journal->num_overruns++;
+                journal->overrun = 0;
+            }
+            last_ticks = event.ticks;
+            if (event.ticks > max_ticks) {
+                max_ticks = event.ticks;
+                max_ts    = entry->timestamp;
+            }
+            journal->num_events++;
+            if (callback && (callback(handle, &event) != 0))
+                return -1;
+        }
+        if (i > 0) {
+            if (journal->write(journal->handle, journal->rptr*ENTRY_SIZE,
+                               journal->zeros, i*ENTRY_SIZE) != 0)
+                return -1;
+        }
+        journal->rptr = (journal->rptr + i) % journal->num_entries;
+        drained += i;
+        if (i < count)
+            break;
+    }
+    journal->ref_ticks = max_ticks;
+    journal->ref_ts    = max_ts;
+    if (drained == journal->num_entries) {
+        /* Lapped: where the firmware is writing is not known */
+        journal->overrun = 1;
+        journal->synced  = 0;
+    }
+    if (drained > 0) {
+        journal->idle_drains = 0;
+    } else if (++journal->idle_drains >= PCAP_JOURNAL_RESYNC_IDLE) {
+        journal->idle_drains = 0;
+        journal->synced = 0;
+    }
+    return drained;
+}
+
+/*f pcap_journal_type_name */
+extern const char *
+pcap_journal_type_name(const struct pcap_journal_event *event)
+{
+    int type;
+    type = PCAP_JOURNAL_ID_TYPE(event->id);
+    if (type >= PCAP_JOURNAL_NUM_TYPES)
+        return "unknown";
+    return type_names[type];
+}
+
+/*f pcap_journal_event_print */
+extern void
+pcap_journal_event_print(FILE *f, const struct pcap_journal_event *event,
+                         double us_per_tick)
+{
+    fprintf(f, "%16.3f i%-2d me%-2d ctx%d %-14s 0x%08x 0x%08x%s\n",
+            event->ticks * us_per_tick,
+            PCAP_JOURNAL_ID_ISLAND(event->id),
+            PCAP_JOURNAL_ID_ME(event->id),
+            PCAP_JOURNAL_ID_CTX(event->id),
+            pcap_journal_type_name(event),
+            event->a, event->b,
+            (event->flags & PCAP_JOURNAL_EVENT_OVERRUN) ? " (after overrun)" : "");
+}
+
+/*f pcap_journal_trace_write_hdr */
+extern int
+pcap_journal_trace_write_hdr(FILE *f, uint32_t tick_ps)
+{
+    struct pcap_journal_trace_hdr hdr;
+
+    hdr.magic       = PCAP_JOURNAL_TRACE_MAGIC;
+    hdr.version     = PCAP_JOURNAL_TRACE_VERSION;
+    hdr.record_size = sizeof(struct pcap_journal_event);
+    hdr.tick_ps     = tick_ps;
+    return (fwrite(&hdr, sizeof(hdr), 1, f) == 1) ? 0 : 1;
+}
+
+/*f pcap_journal_trace_read_hdr */
+extern int
+pcap_journal_trace_read_hdr(FILE *f, struct pcap_journal_trace_hdr *hdr)
+{
+    if (fread(hdr, sizeof(*hdr), 1, f) != 1)
+        return 1;
+    if ((hdr->magic != PCAP_JOURNAL_TRACE_MAGIC) ||
+        (hdr->version != PCAP_JOURNAL_TRACE_VERSION) ||
+        (hdr->record_size != sizeof(struct pcap_journal_event)) ||
+        (hdr->tick_ps == 0))
+        return 1;
+    return 0;
+}
+
+/*f pcap_journal_chrome_open */
+extern void
+pcap_journal_chrome_open(struct pcap_journal_chrome *chrome, FILE *f,
+                         double us_per_tick)
+{
+    memset(chrome, 0, sizeof(*chrome));
+    chrome->f = f;
+    chrome->us_per_tick = us_per_tick;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    chrome_record(chrome,
+                  "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+                  "\"args\":{\"name\":\"MU buffers\"}}");
+}
+
+/*f pcap_journal_chrome_event */
+extern int
+pcap_journal_chrome_event(void *handle, const struct pcap_journal_event *event)
+{
+    struct pcap_journal_chrome *chrome;
+    int island, thread, type;
+
+    chrome = (struct pcap_journal_chrome *)handle;
+    if (!chrome->have_first) {
+        chrome->have_first  = 1;
+        chrome->first_ticks = event->ticks;
+    }
+    island = PCAP_JOURNAL_ID_ISLAND(event->id);
+    thread = event->id & 0x7f;
+    if (!(chrome->islands_named & (1ULL<<island))) {
+        chrome->islands_named |= 1ULL<<island;
+        chrome_record(chrome,
+                      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                      "\"args\":{\"name\":\"island %d\"}}",
+                      island, island);
+    }
+    if (!(chrome->threads_named[island][thread>>6] & (1ULL<<(thread&63)))) {
+        chrome->threads_named[island][thread>>6] |= 1ULL<<(thread&63);
+        chrome_record(chrome,
+                      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                      "\"args\":{\"name\":\"me%d ctx%d\"}}",
+                      island, thread,
+                      PCAP_JOURNAL_ID_ME(event->id), PCAP_JOURNAL_ID_CTX(event->id));
+    }
+    chrome_record(chrome,
+                  "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,"
+                  "\"ts\":%.3f,\"args\":{\"a\":%u,\"b\":%u%s}}",
+                  pcap_journal_type_name(event), island, thread,
+                  chrome_us(chrome, event->ticks), event->a, event->b,
+                  (event->flags & PCAP_JOURNAL_EVENT_OVERRUN) ? ",\"overrun\":1" : "");
+
+    type = PCAP_JOURNAL_ID_TYPE(event->id);
+    if ((type == PCAP_JOURNAL_MU_BUF_ADDED) ||
+        (type == PCAP_JOURNAL_MU_BUF_TAKEN) ||
+        (type == PCAP_JOURNAL_MU_BUF_FULL) ||
+        (type == PCAP_JOURNAL_MU_BUF_DMAED))
+        chrome_buffer_event(chrome, event);
+    return 0;
+}
+
+/*f pcap_journal_chrome_close */
+extern void
+pcap_journal_chrome_close(struct pcap_journal_chrome *chrome)
+{
+    fprintf(chrome->f, "\n]}\n");
+    fflush(chrome->f);
+}
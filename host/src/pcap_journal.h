@@ -0,0 +1,266 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_journal.h
+ * @brief         Drain and decode of the packet capture debug journal
+ *
+ * The capture firmware adds struct pcap_journal_entry to an MU ring
+ * journal (PCAP_JOURNAL_* in firmware/pcap.h), which it overwrites as
+ * it wraps, and which it has no read pointer for. The host drains it
+ * by reading entries from its own read pointer, in batches of up to
+ * PCAP_JOURNAL_BATCH_ENTRIES, until it finds one not yet written, and
+ * writing back zeros over those it has taken; so the firmware never
+ * waits, and the host never sees an entry twice.
+ *
+ * Attaching to a journal finds where the firmware is writing from the
+ * entries it holds, and discards them. As the journal memory is not
+ * cleared at load, this can be misled by stale data; so after
+ * PCAP_JOURNAL_RESYNC_IDLE drains finding nothing, the next drain
+ * scans the whole journal again for entries. If the firmware laps the host
+ * between drains, the entries it overwrote are lost, and the first
+ * event after the gap is flagged PCAP_JOURNAL_EVENT_OVERRUN.
+ *
+ * The 32-bit ME timestamps are extended to 64 bits, so drains must be
+ * less than 2^31 ticks apart (about 28 seconds at 1.2GHz). Entries of
+ * different threads may be up to PCAP_JOURNAL_REORDER_TICKS out of
+ * order in the journal.
+ *
+ * Drained events may be written to a binary trace, a header and then
+ * struct pcap_journal_event records, and to Chrome trace JSON (for
+ * chrome://tracing or Perfetto) with a track per thread and a track
+ * per MU buffer showing it queued, filling, DMAing and recycling.
+ *
+ * As with nfp_stats, the journal is accessed through callbacks, so
+ * the same code runs against an emulated journal in the tests.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_JOURNAL_H_
+#define _PCAP_JOURNAL_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "firmware/pcap.h"
+
+/*a Defines
+ */
+#define PCAP_JOURNAL_BATCH_ENTRIES 1024
+#define PCAP_JOURNAL_REORDER_TICKS (1<<16)
+#define PCAP_JOURNAL_RESYNC_IDLE   64
+
+/* Event flags */
+#define PCAP_JOURNAL_EVENT_OVERRUN 1
+
+/* Binary trace header */
+#define PCAP_JOURNAL_TRACE_MAGIC   0x4a544350 /* 'PCTJ' */
+#define PCAP_JOURNAL_TRACE_VERSION 1
+
+/* Most MU buffers tracked in Chrome trace export */
+#define PCAP_JOURNAL_CHROME_MAX_BUFFERS 256
+
+/*a Types
+ */
+/*t struct pcap_journal_event */
+/**
+ * A decoded journal entry; also the binary trace record
+ */
+struct pcap_journal_event {
+    uint64_t ticks;   /* ME timestamp, extended to 64 bits */
+    uint32_t id;      /* PCAP_JOURNAL_ID: type, island, ME, context */
+    uint32_t a;
+    uint32_t b;
+    uint32_t flags;   /* PCAP_JOURNAL_EVENT_* */
+};
+
+/*t struct pcap_journal_trace_hdr */
+/**
+ * Binary trace header, followed by struct pcap_journal_event records
+ */
+struct pcap_journal_trace_hdr {
+    uint32_t magic;        /* PCAP_JOURNAL_TRACE_MAGIC */
+    uint32_t version;      /* PCAP_JOURNAL_TRACE_VERSION */
+    uint32_t record_size;  /* sizeof(struct pcap_journal_event) */
+    uint32_t tick_ps;      /* Picoseconds per ME timestamp tick */
+};
+
+/*t pcap_journal_read_fn, pcap_journal_write_fn */
+/**
+ * Callbacks to read and write the journal memory at a byte offset;
+ * return zero on success
+ */
+typedef int (*pcap_journal_read_fn)(void *handle, uint32_t offset, void *data, size_t size);
+typedef int (*pcap_journal_write_fn)(void *handle, uint32_t offset, const void *data, size_t size);
+
+/*t pcap_journal_event_fn */
+/**
+ * Callback for each event drained; returns zero to continue
+ */
+typedef int (*pcap_journal_event_fn)(void *handle, const struct pcap_journal_event *event);
+
+/*t struct pcap_journal */
+/**
+ * Journal drain state
+ */
+struct pcap_journal {
+    pcap_journal_read_fn  read;
+    pcap_journal_write_fn write;
+    void    *handle;
+    int      num_entries;
+    int      rptr;          /* Next entry to drain */
+    int      synced;        /* Set once rptr follows the firmware */
+    int      have_ref;      /* Set once ref_ts/ref_ticks are valid */
+    int      overrun;       /* Set if the next event follows lost entries */
+    int      idle_drains;   /* Successive drains finding nothing */
+    uint32_t ref_ts;        /* Latest timestamp drained */
+    uint64_t ref_ticks;     /* ... and its extension */
+    uint64_t num_events;
+    uint64_t num_overruns;
+    uint64_t num_reads;
+    struct pcap_journal_entry batch[PCAP_JOURNAL_BATCH_ENTRIES];
+    struct pcap_journal_entry zeros[PCAP_JOURNAL_BATCH_ENTRIES];
+};
+
+/*t struct pcap_journal_chrome_buffer */
+/**
+ * Timeline state of an MU buffer in a Chrome trace export
+ */
+struct pcap_journal_chrome_buffer {
+    uint32_t mu_base_s8;
+    uint32_t buf_seq;
+    int      state;         /* PCAP_JOURNAL_* of the last buffer event */
+    uint64_t since_ticks;
+};
+
+/*t struct pcap_journal_chrome */
+/**
+ * Chrome trace JSON export state
+ */
+struct pcap_journal_chrome {
+    FILE    *f;
+    double   us_per_tick;
+    int      num_records;
+    int      have_first;
+    uint64_t first_ticks;
+    uint64_t islands_named;     /* Bit per island */
+    uint64_t threads_named[64][2]; /* Bit per ME/context, per island */
+    int      num_buffers;
+    struct pcap_journal_chrome_buffer buffers[PCAP_JOURNAL_CHROME_MAX_BUFFERS];
+};
+
+/*a Functions
+ */
+/*f pcap_journal_init */
+/**
+ * @brief Initialize journal drain state; the journal must then be
+ * attached
+ *
+ * @param num_entries Entries in the journal (PCAP_JOURNAL_NUM_ENTRIES)
+ *
+ */
+extern void pcap_journal_init(struct pcap_journal *journal, int num_entries,
+                              pcap_journal_read_fn read, pcap_journal_write_fn write,
+                              void *handle);
+
+/*f pcap_journal_attach */
+/**
+ * @brief Attach to a journal, discarding the entries it holds
+ *
+ * If the journal holds no entries, the firmware's position is found
+ * from the first entries it adds, before they are drained.
+ *
+ * @returns Zero on success, non-zero if the journal cannot be read or
+ * written
+ *
+ */
+extern int pcap_journal_attach(struct pcap_journal *journal);
+
+/*f pcap_journal_drain */
+/**
+ * @brief Drain the entries added since the last drain, at most one
+ * journal's worth, calling @p callback for each in journal order
+ *
+ * @returns Number of events drained, or -1 on a read or write failure
+ * or if the callback returns non-zero
+ *
+ */
+extern int pcap_journal_drain(struct pcap_journal *journal,
+                              pcap_journal_event_fn callback, void *handle);
+
+/*f pcap_journal_type_name */
+/**
+ * @brief Get the name of an event's type
+ *
+ */
+extern const char *pcap_journal_type_name(const struct pcap_journal_event *event);
+
+/*f pcap_journal_event_print */
+/**
+ * @brief Print an event as a line of text
+ *
+ */
+extern void pcap_journal_event_print(FILE *f, const struct pcap_journal_event *event,
+                                     double us_per_tick);
+
+/*f pcap_journal_trace_write_hdr */
+/**
+ * @brief Write a binary trace header
+ *
+ * @returns Zero on success
+ *
+ */
+extern int pcap_journal_trace_write_hdr(FILE *f, uint32_t tick_ps);
+
+/*f pcap_journal_trace_read_hdr */
+/**
+ * @brief Read and check a binary trace header
+ *
+ * @returns Zero on success, non-zero if not a trace of this version
+ *
+ */
+extern int pcap_journal_trace_read_hdr(FILE *f, struct pcap_journal_trace_hdr *hdr);
+
+/*f pcap_journal_chrome_open */
+/**
+ * @brief Start a Chrome trace JSON export to @p f
+ *
+ * @param us_per_tick Microseconds per ME timestamp tick
+ *
+ */
+extern void pcap_journal_chrome_open(struct pcap_journal_chrome *chrome, FILE *f,
+                                     double us_per_tick);
+
+/*f pcap_journal_chrome_event */
+/**
+ * @brief Add an event to a Chrome trace export; a pcap_journal_event_fn
+ *
+ * @returns Zero
+ *
+ */
+extern int pcap_journal_chrome_event(void *handle, const struct pcap_journal_event *event);
+
+/*f pcap_journal_chrome_close */
+/**
+ * @brief Complete a Chrome trace export; the file is not closed
+ *
+ */
+extern void pcap_journal_chrome_close(struct pcap_journal_chrome *chrome);
+
+/*a Close guard
+ */
+#endif /* _PCAP_JOURNAL_H_ */
@@ -0,0 +1,398 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_journal_test.c
+ * @brief         Test for the packet capture debug journal drain
+ *
+ * The firmware journal is emulated as a ring of entries that is
+ * written in order, wrapping, as the MU ring journal does.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pcap_journal.h"
+
+/*a Defines
+ */
+#define TEST_NUM_ENTRIES 4096
+#define TEST_MAX_EVENTS  (2*TEST_NUM_ENTRIES)
+
+/*a Types
+ */
+/*t struct test_journal */
+/**
+ * Emulated journal, and the events drained from it
+ */
+struct test_journal {
+    struct pcap_journal_entry ring[TEST_NUM_ENTRIES];
+    int      wptr;
+    uint32_t timestamp;
+    int      num_events;
+    struct pcap_journal_event events[TEST_MAX_EVENTS];
+    struct pcap_journal journal;
+};
+
+/*a Useful functions
+ */
+/*f test_read */
+static int
+test_read(void *handle, uint32_t offset, void *data, size_t size)
+{
+    struct test_journal *tj = (struct test_journal *)handle;
+    if (offset + size > sizeof(tj->ring))
+        return 1;
+    memcpy(data, ((char *)tj->ring) + offset, size);
+    return 0;
+}
+
+/*f test_write */
+static int
+test_write(void *handle, uint32_t offset, const void *data, size_t size)
+{
+    struct test_journal *tj = (struct test_journal *)handle;
+    if (offset + size > sizeof(tj->ring))
+        return 1;
+    memcpy(((char *)tj->ring) + offset, data, size);
+    return 0;
+}
+
+/*f test_event */
+static int
+test_event(void *handle, const struct pcap_journal_event *event)
+{
+    struct test_journal *tj = (struct test_journal *)handle;
+    if (tj->num_events >= TEST_MAX_EVENTS)
+        return 1;
+    tj->events[tj->num_events++] = *event;
+    return 0;
+}
+
+/*f fw_journal */
+/**
+ * @brief Add entries to the emulated journal as the firmware does,
+ * 'ticks' apart, with 'a' counting from 'first'
+ */
+static void
+fw_journal(struct test_journal *tj, int type, int n, uint32_t first, uint32_t ticks)
+{
+    struct pcap_journal_entry *entry;
+    int i;
+
+    for (i=0; i<n; i++) {
+        entry = &tj->ring[tj->wptr];
+        tj->timestamp += ticks;
+        entry->id        = PCAP_JOURNAL_ID(type, (32<<25) | (5<<3) | 2);
+        entry->timestamp = tj->timestamp;
+        entry->a         = first + i;
+        entry->b         = 0;
+        tj->wptr = (tj->wptr + 1) % TEST_NUM_ENTRIES;
+    }
+}
+
+/*f create */
+static struct test_journal *
+create(void)
+{
+    struct test_journal *tj;
+    int i;
+
+    tj = malloc(sizeof(*tj));
+    if (!tj)
+        return NULL;
+    memset(tj, 0, sizeof(*tj));
+    /* Memory is not clear at load, but has no marks unless asked */
+    for (i=0; i<TEST_NUM_ENTRIES; i++) {
+        tj->ring[i].id = i * 0x01010101;
+        if (PCAP_JOURNAL_ID_MARK(tj->ring[i].id) == PCAP_JOURNAL_MARK)
+            tj->ring[i].id ^= 0x01000000;
+    }
+    pcap_journal_init(&tj->journal, TEST_NUM_ENTRIES, test_read, test_write, tj);
+    return tj;
+}
+
+/*f check_events */
+/**
+ * @brief Check drained events have 'a' counting from 'first', with
+ * increasing times
+ */
+static int
+check_events(struct test_journal *tj, int from, int n, uint32_t first)
+{
+    int i;
+    for (i=0; i<n; i++) {
+        if (tj->events[from+i].a != first+i)
+            return 1;
+        if ((i>0) && (tj->events[from+i].ticks <= tj->events[from+i-1].ticks))
+            return 1;
+        if (PCAP_JOURNAL_ID_ISLAND(tj->events[from+i].id) != 32)
+            return 1;
+        if (PCAP_JOURNAL_ID_ME(tj->events[from+i].id) != 5)
+            return 1;
+        if (PCAP_JOURNAL_ID_CTX(tj->events[from+i].id) != 2)
+            return 1;
+    }
+    return 0;
+}
+
+/*a Tests
+ */
+/*f test_attach */
+/**
+ * @brief Entries before attaching are discarded; later ones are
+ * drained once, in order
+ */
+static int
+test_attach(void)
+{
+    struct test_journal *tj;
+    int err;
+
+    tj = create();
+    if (!tj) return 1;
+    err = 0;
+    fw_journal(tj, PCAP_JOURNAL_SLAVE_DMA, 100, 0, 10);
+    if (pcap_journal_attach(&tj->journal) != 0) err = 2;
+    if (tj->journal.rptr != 100) err = 3;
+    fw_journal(tj, PCAP_JOURNAL_SLAVE_DMA, 50, 100, 10);
+    if (pcap_journal_drain(&tj->journal, test_event, tj) != 50) err = 4;
+    if ((tj->num_events != 50) || check_events(tj, 0, 50, 100)) err = 5;
+    if (pcap_journal_drain(&tj->journal, test_event, tj) != 0) err = 6;
+    if (tj->events[0].ticks != tj->timestamp - 490) err = 7;
+    if (tj->journal.num_overruns != 0) err = 8;
+    free(tj);
+    return err;
+}
+
+/*f test_wrap */
+/**
+ * @brief Attach to an empty journal, then drain in batches across the
+ * end of the journal
+ */
+static int
+test_wrap(void)
+{
+    struct test_journal *tj;
+    uint64_t reads;
+    int err;
+
+    tj = create();
+    if (!tj) return 1;
+    err = 0;
+    if (pcap_journal_attach(&tj->journal) != 0) err = 2;
+    if (pcap_journal_drain(&tj->journal, test_event, tj) != 0) err = 3;
+    tj->wptr = 1000; /* Firmware had been writing; host cleared it */
+    fw_journal(tj, PCAP_JOURNAL_MU_BUF_TAKEN, 3000, 0, 3);
+    if (pcap_journal_drain(&tj->journal, test_event, tj) != 3000) err = 4;
+    reads = tj->journal.num_reads;
+    fw_journal(tj, PCAP_JOURNAL_MU_BUF_TAKEN, 300, 3000, 3);
+    if (pcap_journal_drain(&tj->journal, test_event, tj) != 300) err = 5;
+    if (tj->journal.num_reads - reads != 2) err = 6;
+    if ((tj->num_events != 3300) || check_events(tj, 0, 3300, 0)) err = 7;
+    if (tj->journal.num_overruns != 0) err = 8;
+    free(tj);
+    return err;
+}
+
+/*f test_resync */
+/**
+ * @brief Attaching to stale data that looks like entries is recovered
+ * from once the journal has been idle
+ */
+static int
+test_resync(void)
+{
+    struct test_journal *tj;
+    int i, drained;
+    int err;
+
+    tj = create();
+    if (!tj) return 1;
+    err = 0;
+    tj->ring[165].id = PCAP_JOURNAL_ID(PCAP_JOURNAL_MU_BUF_FULL, 0);
+    if (pcap_journal_attach(&tj->journal) != 0) err = 2;
+    if (tj->journal.rptr != 166) err = 3;
+    tj->wptr = 2000;
+    fw_journal(tj, PCAP_JOURNAL_MU_BUF_TAKEN, 100, 0, 3);
+    drained = 0;
+    for (i=0; i<=PCAP_JOURNAL_RESYNC_IDLE; i++)
+        drained += pcap_journal_drain(&tj->journal, test_event, tj);
+    if ((drained != 100) || check_events(tj, 0, 100, 0)) err = 4;
+    if (tj->journal.rptr != 2100) err = 5;
+    free(tj);
+    return err;
+}
+
+/*f test_timestamps */
+/**
+ * @brief Timestamps are extended across a 32-bit wrap, and entries a
+ * little out of order keep their order in time
+ */
+static int
+test_timestamps(void)
+{
+    struct test_journal *tj;
+    int err;
+
+    tj = create();
+    if (!tj) return 1;
+    err = 0;
+    tj->timestamp = 0xffff0000;
+    if (pcap_journal_attach(&tj->journal) != 0) err = 2;
+    fw_journal(tj, PCAP_JOURNAL_MU_BUF_FULL, 1, 0, 0);
+    fw_journal(tj, PCAP_JOURNAL_MU_BUF_FULL, 1000, 1, 0x100);
+    tj->timestamp -= 0x180;
+    fw_journal(tj, PCAP_JOURNAL_MU_BUF_FULL, 1, 1001, 0);
+    if (pcap_journal_drain(&tj->journal, test_event, tj) != 1002) err = 3;
+    if (check_events(tj, 0, 1001, 0)) err = 4;
+    if (tj->events[1000].ticks != 0xffff0000ULL + 1000*0x100) err = 5;
+    if (tj->events[1001].ticks != tj->events[1000].ticks - 0x180) err = 6;
+    fw_journal(tj, PCAP_JOURNAL_MU_BUF_FULL, 1, 1002, 0x1000);
+    if (pcap_journal_drain(&tj->journal, test_event, tj) != 1) err = 7;
+    if (tj->events[1002].ticks != tj->events[1000].ticks + 0x1000 - 0x180) err = 8;
+    if (tj->journal.num_overruns != 0) err = 9;
+    free(tj);
+    return err;
+}
+
+/*f test_overrun */
+/**
+ * @brief Entries lost when the firmware laps the host are flagged
+ */
+static int
+test_overrun(void)
+{
+    struct test_journal *tj;
+    int i, flagged;
+    int err;
+
+    tj = create();
+    if (!tj) return 1;
+    err = 0;
+    fw_journal(tj, PCAP_JOURNAL_SLAVE_DMA, 10, 0, 100);
+    if (pcap_journal_attach(&tj->journal) != 0) err = 2;
+    fw_journal(tj, PCAP_JOURNAL_SLAVE_DMA, TEST_NUM_ENTRIES+20, 0, 100);
+    if (pcap_journal_drain(&tj->journal, test_event, tj) != TEST_NUM_ENTRIES) err = 3;
+    if (check_events(tj, 0, 20, TEST_NUM_ENTRIES)) err = 4;
+    if (check_events(tj, 20, TEST_NUM_ENTRIES-20, 20)) err = 5;
+    flagged = 0;
+    for (i=0; i<tj->num_events; i++) {
+        if (tj->events[i].flags & PCAP_JOURNAL_EVENT_OVERRUN)
+            flagged++;
+    }
+    if ((flagged != 1) || !(tj->events[20].flags & PCAP_JOURNAL_EVENT_OVERRUN)) err = 6;
+    fw_journal(tj, PCAP_JOURNAL_SLAVE_DMA, 5, TEST_NUM_ENTRIES+20, 100);
+    if (pcap_journal_drain(&tj->journal, test_event, tj) != 5) err = 7;
+    if (check_events(tj, TEST_NUM_ENTRIES, 5, TEST_NUM_ENTRIES+20)) err = 8;
+    free(tj);
+    return err;
+}
+
+/*f test_export */
+/**
+ * @brief Binary trace header and Chrome trace buffer timelines
+ */
+static int
+test_export(void)
+{
+    static const int types[] = {
+        PCAP_JOURNAL_MU_BUF_ADDED, PCAP_JOURNAL_MU_BUF_TAKEN,
+        PCAP_JOURNAL_SLAVE_DMA, PCAP_JOURNAL_MU_BUF_FULL,
+        PCAP_JOURNAL_MU_BUF_DMAED, PCAP_JOURNAL_MU_BUF_ADDED };
+    struct pcap_journal_trace_hdr hdr;
+    struct pcap_journal_chrome *chrome;
+    struct pcap_journal_event event;
+    char *json;
+    size_t json_size;
+    FILE *f;
+    int i;
+    int err;
+
+    err = 0;
+    f = tmpfile();
+    if (!f) return 1;
+    if (pcap_journal_trace_write_hdr(f, 13333) != 0) err = 2;
+    rewind(f);
+    if ((pcap_journal_trace_read_hdr(f, &hdr) != 0) || (hdr.tick_ps != 13333)) err = 3;
+    fclose(f);
+
+    chrome = malloc(sizeof(*chrome));
+    f = open_memstream(&json, &json_size);
+    if (!chrome || !f) return 4;
+    pcap_journal_chrome_open(chrome, f, 0.01);
+    for (i=0; i<sizeof(types)/sizeof(types[0]); i++) {
+        event.ticks = 1000 + i*100;
+        event.id    = PCAP_JOURNAL_ID(types[i], (33<<25) | (7<<3) | 1);
+        event.a     = 0x12340;
+        event.b     = 7;
+        event.flags = 0;
+        pcap_journal_chrome_event(chrome, &event);
+    }
+    pcap_journal_chrome_close(chrome);
+    fclose(f);
+    if (strncmp(json, "{\"displayTimeUnit\"", 18) || strcmp(json + json_size - 4, "\n]}\n")) err = 5;
+    if (!strstr(json, "\"name\":\"queued\",\"ph\":\"X\",\"pid\":0,\"tid\":1,\"ts\":0.000,\"dur\":1.000")) err = 6;
+    if (!strstr(json, "\"name\":\"filling\",\"ph\":\"X\",\"pid\":0,\"tid\":1,\"ts\":1.000,\"dur\":2.000")) err = 7;
+    if (!strstr(json, "\"name\":\"dma\"")) err = 8;
+    if (!strstr(json, "\"name\":\"recycle\"")) err = 9;
+    if (!strstr(json, "\"name\":\"slave_dma\",\"ph\":\"i\",\"s\":\"t\",\"pid\":33,\"tid\":57")) err = 10;
+    if (!strstr(json, "\"name\":\"me7 ctx1\"")) err = 11;
+    free(json);
+    free(chrome);
+    return err;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Attach and drain",test_attach());
+    TEST_RUN("Batched drain across the end of the journal",test_wrap());
+    TEST_RUN("Resync after attaching to stale data",test_resync());
+    TEST_RUN("Timestamp extension",test_timestamps());
+    TEST_RUN("Overrun by the firmware",test_overrun());
+    TEST_RUN("Binary and Chrome trace export",test_export());
+    return failures;
+}
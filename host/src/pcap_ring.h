@@ -0,0 +1,133 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_ring.h
+ * @brief         Single-producer single-consumer ring of capture buffer indices
+ *
+ * These rings live in the shared memory between pktgencap and its
+ * capture clients. Each ring has exactly one producer process and one
+ * consumer process; the producer owns wptr and the consumer owns
+ * rptr, each on its own cache line, so no locks are needed. Pointers
+ * are free-running and wrap modulo 2^32.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_RING_H_
+#define _PCAP_RING_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+
+/*a Defines
+ */
+/* Must be a power of two, at least the number of capture buffers */
+#define PCAP_RING_ENTRIES 256
+
+/*a Types
+ */
+/*t struct pcap_ring */
+/**
+ * SPSC ring of buffer indices
+ */
+struct pcap_ring {
+    uint32_t wptr;         /* Written only by the producer */
+    uint32_t pad_w[15];
+    uint32_t rptr;         /* Written only by the consumer */
+    uint32_t pad_r[15];
+    int32_t  entries[PCAP_RING_ENTRIES];
+};
+
+/*a Functions
+ */
+/*f pcap_ring_init */
+/**
+ * @brief Empty a ring; only valid when neither side is using it
+ */
+static inline void
+pcap_ring_init(struct pcap_ring *ring)
+{
+    __atomic_store_n(&ring->wptr, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->rptr, 0, __ATOMIC_RELEASE);
+}
+
+/*f pcap_ring_push */
+/**
+ * @brief Producer: add up to @p num entries to the ring
+ *
+ * @param ring    Ring to add to
+ *
+ * @param entries Buffer indices to add
+ *
+ * @param num     Number of buffer indices to add
+ *
+ * @returns Number of entries added (less than @p num if the ring fills)
+ *
+ */
+static inline int
+pcap_ring_push(struct pcap_ring *ring, const int *entries, int num)
+{
+    uint32_t wptr;
+    uint32_t rptr;
+    int space;
+    int i;
+
+    wptr = ring->wptr;
+    rptr = __atomic_load_n(&ring->rptr, __ATOMIC_ACQUIRE);
+    space = PCAP_RING_ENTRIES - (int)(wptr - rptr);
+    if (num > space)
+        num = space;
+    for (i=0; i<num; i++)
+        ring->entries[(wptr+i) & (PCAP_RING_ENTRIES-1)] = entries[i];
+    __atomic_store_n(&ring->wptr, wptr+num, __ATOMIC_RELEASE);
+    return num;
+}
+
+/*f pcap_ring_pop */
+/**
+ * @brief Consumer: remove up to @p max entries from the ring
+ *
+ * @param ring    Ring to remove from
+ *
+ * @param entries Array to fill with buffer indices
+ *
+ * @param max     Size of @p entries
+ *
+ * @returns Number of entries removed
+ *
+ */
+static inline int
+pcap_ring_pop(struct pcap_ring *ring, int *entries, int max)
+{
+    uint32_t wptr;
+    uint32_t rptr;
+    int num;
+    int i;
+
+    rptr = ring->rptr;
+    wptr = __atomic_load_n(&ring->wptr, __ATOMIC_ACQUIRE);
+    num = (int)(wptr - rptr);
+    if (num > max)
+        num = max;
+    for (i=0; i<num; i++)
+        entries[i] = ring->entries[(rptr+i) & (PCAP_RING_ENTRIES-1)];
+    __atomic_store_n(&ring->rptr, rptr+num, __ATOMIC_RELEASE);
+    return num;
+}
+
+/*a Close guard
+ */
+#endif /* _PCAP_RING_H_ */
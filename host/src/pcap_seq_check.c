@@ -0,0 +1,481 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_seq_check.c
+ * @brief         Online sequence checks of completed capture buffers
+ *
+ * The packet check runs over a strided array of sequence words, so
+ * the same loop walks the descriptors of a buffer (stride of a
+ * descriptor) and the sequence numbers of an index (stride of one).
+ * The expected word of a sequencer carries the sequencer, so the
+ * scalar fast path is one compare of the whole word, with the
+ * expected words held in a local array; the word expected next is
+ * the word plus one, which at the wrap of the sequence number carries
+ * into the sequencer bits and so sends the next packet to the slow
+ * path, which does the wrap.
+ *
+ * The AVX2 check takes the sequence words of eight packets at a time
+ * and keeps, a lane for each sequencer, the word before the one
+ * expected next. A nibble per sequencer set in each lane of the
+ * packets and summed across the lanes gives each packet the count of
+ * the packets of its sequencer up to and including it; the packet is
+ * in order if its word is the word of its sequencer's lane plus that
+ * count, in 16 bits (the top 16 bits match the sequencer lane only if
+ * the word has no bits above the sequencer). The counts of the eighth
+ * lane then move the sequencer lanes on, which is the only dependence
+ * from one eight packets to the next. A block of packets is in order
+ * if all its packets are and no sequencer not yet seen moved on; the
+ * lanes that moved are then written back as the next words expected,
+ * as the scalar check would leave them. Otherwise the block is checked
+ * again by the scalar check, from the state before it.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <string.h>
+#include "pcap_seq_check.h"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PCAP_SEQ_CHECK_X86
+#endif
+
+/*a Defines
+ */
+/* Packets checked by the AVX2 check before the lanes are checked and
+ * written back; far fewer than wrap a sequence number */
+#define PCAP_SEQ_CHECK_BLOCK 256
+
+/* Bits of a valid sequence word */
+#define SEQ_WORD_MASK ((PCAP_PKT_SEQR_MASK << PCAP_PKT_SEQR_SHIFT) | PCAP_PKT_SEQ_MASK)
+
+/* Sequence word following a word of the same sequencer */
+#define SEQ_WORD_NEXT(word) (((word) & ~PCAP_PKT_SEQ_MASK) | (((word)+1) & PCAP_PKT_SEQ_MASK))
+
+/* Words of a descriptor, of which the sequence word is the second */
+#define SEQ_DESC_WORDS (sizeof(struct pcap_pkt_buf_desc) / sizeof(uint32_t))
+
+/*a Types
+ */
+/*t check_pkts_fn */
+typedef uint32_t (*check_pkts_fn)(struct pcap_seq_check *check,
+                                  const uint32_t *seq, uint32_t stride,
+                                  uint32_t num, uint32_t buf_seq);
+
+/*a Static functions
+ */
+/*f range_record */
+static void
+range_record(struct pcap_seq_check *check, uint32_t kind, uint32_t seqr,
+             uint32_t buf_seq, uint32_t first, uint32_t num)
+{
+    struct pcap_seq_range *range;
+
+    range = &check->ranges[check->num_ranges % PCAP_SEQ_CHECK_RANGES];
+    range->kind    = kind;
+    range->seqr    = seqr;
+    range->buf_seq = buf_seq;
+    range->first   = first;
+    range->num     = num;
+    check->num_ranges++;
+}
+
+/*f buf_seen_set */
+/**
+ * @brief Set whether a buffer of the window has been seen
+ */
+static void
+buf_seen_set(struct pcap_seq_check *check, uint32_t buf_seq, int seen)
+{
+    uint32_t bit;
+
+    bit = buf_seq % PCAP_SEQ_CHECK_REORDER_WINDOW;
+    if (seen) {
+        check->buf_seen[bit/32] |= 1U << (bit%32);
+    } else {
+        check->buf_seen[bit/32] &= ~(1U << (bit%32));
+    }
+}
+
+/*f buf_seen */
+static int
+buf_seen(const struct pcap_seq_check *check, uint32_t buf_seq)
+{
+    uint32_t bit;
+
+    bit = buf_seq % PCAP_SEQ_CHECK_REORDER_WINDOW;
+    return (check->buf_seen[bit/32] >> (bit%32)) & 1;
+}
+
+/*f buf_resync */
+/**
+ * @brief Expect the buffer after @p buf_seq, with the rest of the
+ * window before it all missing or, if not counted as missing, all seen
+ */
+static void
+buf_resync(struct pcap_seq_check *check, uint32_t buf_seq, int missing)
+{
+    memset(check->buf_seen, missing ? 0 : 0xff, sizeof(check->buf_seen));
+    buf_seen_set(check, buf_seq, 1);
+    check->next_buf_seq = buf_seq + 1;
+}
+
+/*f check_buf_seq */
+/**
+ * @brief Check the sequence number of a buffer
+ *
+ * @returns 1 if it follows a gap or restart, else 0
+ */
+static uint32_t
+check_buf_seq(struct pcap_seq_check *check, uint32_t buf_seq)
+{
+    uint32_t skipped, late;
+    uint32_t i;
+
+    check->stats.buffers++;
+    if (!check->buf_started) {
+        check->buf_started = 1;
+        buf_resync(check, buf_seq, 0);
+        return 0;
+    }
+    skipped = buf_seq - check->next_buf_seq;
+    if (skipped == 0) {
+        buf_seen_set(check, buf_seq, 1);
+        check->next_buf_seq++;
+        return 0;
+    }
+    if ((int32_t)skipped < 0) {
+        late = check->next_buf_seq - buf_seq;
+        if (late <= PCAP_SEQ_CHECK_REORDER_WINDOW) {
+            check->stats.buf_reorders++;
+            if (!buf_seen(check, buf_seq)) {
+                buf_seen_set(check, buf_seq, 1);
+                check->stats.bufs_missing--;
+            }
+            return 0;
+        }
+        check->stats.buf_gaps++;
+        range_record(check, PCAP_SEQ_RANGE_BUFFERS, 0, buf_seq, check->next_buf_seq, 0);
+        buf_resync(check, buf_seq, 0);
+        return 1;
+    }
+    check->stats.buf_gaps++;
+    check->stats.bufs_missing += skipped;
+    range_record(check, PCAP_SEQ_RANGE_BUFFERS, 0, buf_seq, check->next_buf_seq, skipped);
+    if (skipped >= PCAP_SEQ_CHECK_REORDER_WINDOW) {
+        buf_resync(check, buf_seq, 1);
+        return 1;
+    }
+    for (i=0; i<skipped; i++)
+        buf_seen_set(check, check->next_buf_seq+i, 0);
+    buf_seen_set(check, buf_seq, 1);
+    check->next_buf_seq = buf_seq + 1;
+    return 1;
+}
+
+/*f check_pkt_slow */
+/**
+ * @brief Check a packet sequence word that is not the one expected
+ * of its sequencer
+ *
+ * @returns 1 if it follows a gap, else 0
+ */
+static uint32_t
+check_pkt_slow(struct pcap_seq_check *check, uint32_t word, uint32_t buf_seq)
+{
+    struct pcap_seq_check_seqr_stats *seqr_stats;
+    uint32_t seqr, expected, skipped;
+
+    word &= SEQ_WORD_MASK;
+    seqr = PCAP_PKT_SEQR(word);
+    seqr_stats = &check->stats.seqr[seqr];
+    expected = check->expected[seqr];
+    skipped = (word - expected) & PCAP_PKT_SEQ_MASK;
+    if ((expected == PCAP_SEQ_CHECK_IDLE(seqr)) || (skipped == 0)) {
+        check->expected[seqr] = SEQ_WORD_NEXT(word);
+        return 0;
+    }
+    if (skipped > PCAP_PKT_SEQ_MASK - PCAP_SEQ_CHECK_REORDER_WINDOW) {
+        check->stats.pkt_reorders++;
+        seqr_stats->reorders++;
+        if (seqr_stats->missing > 0) {
+            seqr_stats->missing--;
+            check->stats.pkts_missing--;
+        }
+        return 0;
+    }
+    check->stats.pkt_gaps++;
+    check->stats.pkts_missing += skipped;
+    seqr_stats->gaps++;
+    seqr_stats->missing += skipped;
+    range_record(check, PCAP_SEQ_RANGE_PACKETS, seqr, buf_seq,
+                 PCAP_PKT_SEQ(expected), skipped);
+    check->expected[seqr] = SEQ_WORD_NEXT(word);
+    return 1;
+}
+
+/*a Scalar check
+ */
+/*f check_pkts_scalar */
+/**
+ * @brief Check @p num packet sequence words, @p stride words apart
+ *
+ * @returns Number of gaps found
+ */
+static uint32_t
+check_pkts_scalar(struct pcap_seq_check *check, const uint32_t *seq, uint32_t stride,
+                  uint32_t num, uint32_t buf_seq)
+{
+    uint32_t expected[PCAP_PKT_NUM_SEQRS];
+    uint32_t gaps;
+    uint32_t i;
+
+    memcpy(expected, check->expected, sizeof(expected));
+    gaps = 0;
+    for (i=0; i<num; i++, seq+=stride) {
+        uint32_t word;
+        uint32_t seqr;
+        word = *seq;
+        seqr = PCAP_PKT_SEQR(word);
+        if (__builtin_expect(word == expected[seqr], 1)) {
+            expected[seqr] = word + 1;
+            continue;
+        }
+        memcpy(check->expected, expected, sizeof(expected));
+        gaps += check_pkt_slow(check, word, buf_seq);
+        expected[seqr] = check->expected[seqr];
+    }
+    memcpy(check->expected, expected, sizeof(expected));
+    return gaps;
+}
+
+#ifdef PCAP_SEQ_CHECK_X86
+/*a AVX2 check
+ */
+/*f load_words_avx2 */
+/**
+ * @brief Load the sequence words of eight packets, either contiguous
+ * or the second words of eight descriptors
+ */
+__attribute__((target("avx2")))
+static inline __m256i
+load_words_avx2(const uint32_t *seq, uint32_t stride)
+{
+    __m256i d01, d23, d45, d67;
+    __m256i s0246_1357;
+
+    if (stride == 1)
+        return _mm256_loadu_si256((const __m256i *)seq);
+    d01 = _mm256_loadu_si256((const __m256i *)(seq-1));
+    d23 = _mm256_loadu_si256((const __m256i *)(seq+7));
+    d45 = _mm256_loadu_si256((const __m256i *)(seq+15));
+    d67 = _mm256_loadu_si256((const __m256i *)(seq+23));
+    s0246_1357 = _mm256_unpackhi_epi64(_mm256_unpacklo_epi32(d01, d23),
+                                       _mm256_unpacklo_epi32(d45, d67));
+    return _mm256_permutevar8x32_epi32(s0246_1357, _mm256_setr_epi32(0,4,1,5,2,6,3,7));
+}
+
+/*f check_block_avx2 */
+/**
+ * @brief Check a block of @p num packet sequence words, a multiple of
+ * eight, and if it is in order move the expected words on
+ *
+ * @returns 1 if the block is in order, else 0 (with no change)
+ */
+__attribute__((target("avx2")))
+static int
+check_block_avx2(struct pcap_seq_check *check, const uint32_t *seq, uint32_t stride,
+                 uint32_t num)
+{
+    uint32_t lanes[PCAP_PKT_NUM_SEQRS];
+    __m256i seqr_nibble, nibble, lane_hi, lane_7, lane_shift;
+    __m256i start, prev, errors;
+    uint32_t i;
+    int seqr;
+
+    for (seqr=0; seqr<PCAP_PKT_NUM_SEQRS; seqr++)
+        lanes[seqr] = PCAP_PKT_SEQ_WORD(seqr, check->expected[seqr] - 1);
+    start  = _mm256_loadu_si256((const __m256i *)lanes);
+    prev   = start;
+    errors = _mm256_setzero_si256();
+    seqr_nibble = _mm256_set1_epi32(PCAP_PKT_SEQR_MASK << 2);
+    nibble      = _mm256_set1_epi32(0xf);
+    lane_hi     = _mm256_setr_epi32(0,0,0,0,-1,-1,-1,-1);
+    lane_7      = _mm256_set1_epi32(7);
+    lane_shift  = _mm256_setr_epi32(0,4,8,12,16,20,24,28);
+    for (i=0; i<num; i+=8, seq+=8*stride) {
+        __m256i words, shift, counts, carry, own, expect, totals;
+
+        /* Nibble of the sequencer of each packet, summed across lanes */
+        words  = load_words_avx2(seq, stride);
+        shift  = _mm256_and_si256(_mm256_srli_epi32(words, PCAP_PKT_SEQR_SHIFT-2), seqr_nibble);
+        counts = _mm256_sllv_epi32(_mm256_set1_epi32(1), shift);
+        counts = _mm256_add_epi32(counts, _mm256_slli_si256(counts, 4));
+        counts = _mm256_add_epi32(counts, _mm256_slli_si256(counts, 8));
+        carry  = _mm256_permutevar8x32_epi32(counts, _mm256_set1_epi32(3));
+        counts = _mm256_add_epi32(counts, _mm256_and_si256(carry, lane_hi));
+
+        /* Word expected is the sequencer lane plus the packet's count */
+        own    = _mm256_and_si256(_mm256_srlv_epi32(counts, shift), nibble);
+        expect = _mm256_permutevar8x32_epi32(prev, _mm256_srli_epi32(words, PCAP_PKT_SEQR_SHIFT));
+        errors = _mm256_or_si256(errors, _mm256_sub_epi16(_mm256_sub_epi16(words, expect), own));
+
+        /* Move the sequencer lanes on by the counts of the last packet */
+        totals = _mm256_permutevar8x32_epi32(counts, lane_7);
+        totals = _mm256_and_si256(_mm256_srlv_epi32(totals, lane_shift), nibble);
+        prev   = _mm256_add_epi16(prev, totals);
+    }
+    if (!_mm256_testz_si256(errors, errors))
+        return 0;
+    _mm256_storeu_si256((__m256i *)lanes, prev);
+    for (seqr=0; seqr<PCAP_PKT_NUM_SEQRS; seqr++) {
+        if (lanes[seqr] == PCAP_PKT_SEQ_WORD(seqr, check->expected[seqr] - 1))
+            continue;
+        if (check->expected[seqr] == PCAP_SEQ_CHECK_IDLE(seqr))
+            return 0;
+    }
+    for (seqr=0; seqr<PCAP_PKT_NUM_SEQRS; seqr++) {
+        if (lanes[seqr] != PCAP_PKT_SEQ_WORD(seqr, check->expected[seqr] - 1))
+            check->expected[seqr] = lanes[seqr] + 1;
+    }
+    return 1;
+}
+
+/*f check_pkts_avx2 */
+/**
+ * @brief Check blocks of up to PCAP_SEQ_CHECK_BLOCK packet sequence
+ * words eight at a time, falling back to the scalar check for a block
+ * that is not all in order and for the last few packets
+ *
+ * The descriptors of a buffer are loaded whole, so a @p stride of a
+ * descriptor is taken as @p seq being its second word; a stride
+ * other than that or one is left to the scalar check.
+ *
+ * @returns Number of gaps found
+ */
+__attribute__((target("avx2")))
+static uint32_t
+check_pkts_avx2(struct pcap_seq_check *check, const uint32_t *seq, uint32_t stride,
+                uint32_t num, uint32_t buf_seq)
+{
+    uint32_t gaps;
+    uint32_t n;
+
+    if ((stride != 1) && (stride != SEQ_DESC_WORDS))
+        return check_pkts_scalar(check, seq, stride, num, buf_seq);
+    gaps = 0;
+    while (num >= 8) {
+        n = num & ~7;
+        if (n > PCAP_SEQ_CHECK_BLOCK)
+            n = PCAP_SEQ_CHECK_BLOCK;
+        if (!check_block_avx2(check, seq, stride, n))
+            gaps += check_pkts_scalar(check, seq, stride, n, buf_seq);
+        seq += n*stride;
+        num -= n;
+    }
+    return gaps + check_pkts_scalar(check, seq, stride, num, buf_seq);
+}
+#endif
+
+/*a Selected implementation
+ */
+static check_pkts_fn check_pkts_impl;
+
+/*f check_pkts */
+/**
+ * @brief Check @p num packet sequence words, @p stride words apart,
+ * with the selected implementation
+ *
+ * @returns Number of gaps found
+ */
+static uint32_t
+check_pkts(struct pcap_seq_check *check, const uint32_t *seq, uint32_t stride,
+           uint32_t num, uint32_t buf_seq)
+{
+    if (!check_pkts_impl)
+        pcap_seq_check_select(PCAP_INDEX_ISA_BEST);
+    check->stats.packets += num;
+    return check_pkts_impl(check, seq, stride, num, buf_seq);
+}
+
+/*a External functions
+ */
+/*f pcap_seq_check_select */
+extern int
+pcap_seq_check_select(enum pcap_index_isa isa)
+{
+    if (isa == PCAP_INDEX_ISA_BEST) {
+        isa = PCAP_INDEX_ISA_SCALAR;
+        if (pcap_index_isa_supported(PCAP_INDEX_ISA_AVX2))
+            isa = PCAP_INDEX_ISA_AVX2;
+    }
+    if (!pcap_index_isa_supported(isa))
+        return -1;
+    switch (isa) {
+#ifdef PCAP_SEQ_CHECK_X86
+    case PCAP_INDEX_ISA_AVX2:
+        check_pkts_impl = check_pkts_avx2;
+        break;
+#endif
+    default:
+        check_pkts_impl = check_pkts_scalar;
+        break;
+    }
+    return isa;
+}
+
+/*f pcap_seq_check_init */
+extern void
+pcap_seq_check_init(struct pcap_seq_check *check)
+{
+    int i;
+
+    memset(check, 0, sizeof(*check));
+    for (i=0; i<PCAP_PKT_NUM_SEQRS; i++)
+        check->expected[i] = PCAP_SEQ_CHECK_IDLE(i);
+}
+
+/*f pcap_seq_check_buffer */
+extern uint32_t
+pcap_seq_check_buffer(struct pcap_seq_check *check,
+                      const struct pcap_buffer *pcap_buffer,
+                      uint32_t num_pkts)
+{
+    uint32_t buf_seq;
+
+    buf_seq = pcap_buffer->hdr.buf_seq;
+    return check_buf_seq(check, buf_seq) +
+        check_pkts(check, &pcap_buffer->pkt_desc[0].seq,
+                   SEQ_DESC_WORDS,
+                   num_pkts, buf_seq);
+}
+
+/*f pcap_seq_check_index */
+extern uint32_t
+pcap_seq_check_index(struct pcap_seq_check *check,
+                     const struct pcap_index *index)
+{
+    return check_buf_seq(check, index->buf_seq) +
+        check_pkts(check, index->seq, 1, index->num_pkts, index->buf_seq);
+}
+
+/*f pcap_seq_check_range */
+extern const struct pcap_seq_range *
+pcap_seq_check_range(const struct pcap_seq_check *check, uint32_t n)
+{
+    if ((n >= PCAP_SEQ_CHECK_RANGES) || (n >= check->num_ranges))
+        return NULL;
+    return &check->ranges[(check->num_ranges - 1 - n) % PCAP_SEQ_CHECK_RANGES];
+}
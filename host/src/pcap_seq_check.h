@@ -0,0 +1,203 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_seq_check.h
+ * @brief         Online sequence checks of completed capture buffers
+ *
+ * Completed capture buffers carry two sequence numbers that let the
+ * host see what it has lost: the buffer sequence number of each
+ * buffer, which the firmware numbers contiguously as it takes host
+ * buffers, and the NBI sequencer and sequence number of each packet
+ * (PCAP_PKT_SEQ_WORD), which each sequencer numbers contiguously.
+ *
+ * The check keeps the next sequence number expected of the buffers
+ * and of each sequencer. A packet that is the one expected costs a
+ * compare and a store; anything else goes to a slow path that counts
+ * a gap (numbers skipped, which are packets or buffers lost) or a
+ * reorder (a number from up to PCAP_SEQ_CHECK_REORDER_WINDOW behind
+ * the one expected, which arrived late or twice), and records the
+ * range of each gap in a ring of the most recent gaps.
+ *
+ * A gap moves the number expected on, so a sequencer that restarts is
+ * a single gap; the first packet of a sequencer, and the first
+ * buffer, only set the number expected. The buffers seen of the
+ * window are kept, so only a late buffer that was missing reduces the
+ * buffers missing, and a buffer further back than the window is a
+ * restart of the buffer numbering: a gap of no buffers, from which
+ * the check resynchronizes.
+ *
+ * The packet check has a scalar implementation and, on x86-64, an
+ * AVX2 implementation that checks eight packets at a time and leaves
+ * any block of packets not in order to the scalar check; the best the
+ * CPU supports is selected (with the ISAs of pcap_index.h) when a
+ * buffer is first checked, or one may be selected explicitly (for
+ * testing and benchmarking). The check is on the capture path of
+ * every packet, so it is built optimized (Makefile.apps).
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_SEQ_CHECK_H_
+#define _PCAP_SEQ_CHECK_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include "firmware/pcap.h"
+#include "pcap_index.h"
+
+/*a Defines
+ */
+/* Gap ranges kept; older ones are overwritten */
+#define PCAP_SEQ_CHECK_RANGES         16
+
+/* Packets up to this far behind the one expected are reorders; any
+ * further is taken as a gap round the 16-bit sequence space */
+#define PCAP_SEQ_CHECK_REORDER_WINDOW 1024
+
+/* Expected sequence word of a sequencer not yet seen; it has the bits
+ * of another sequencer, so no word looked up by its sequencer matches */
+#define PCAP_SEQ_CHECK_IDLE(seqr)     ((uint32_t)~PCAP_PKT_SEQ_WORD(seqr,0))
+
+#define PCAP_SEQ_RANGE_BUFFERS 0
+#define PCAP_SEQ_RANGE_PACKETS 1
+
+/*a Types
+ */
+/*t struct pcap_seq_range */
+/**
+ * Range of sequence numbers found missing
+ */
+struct pcap_seq_range {
+    uint32_t kind;    /* PCAP_SEQ_RANGE_* */
+    uint32_t seqr;    /* NBI sequencer, for a range of packets */
+    uint32_t buf_seq; /* Buffer in which the gap was found */
+    uint32_t first;   /* First sequence number missing */
+    uint32_t num;     /* Sequence numbers missing */
+};
+
+/*t struct pcap_seq_check_seqr_stats */
+/**
+ * Statistics of the packets of one NBI sequencer
+ */
+struct pcap_seq_check_seqr_stats {
+    uint64_t gaps;
+    uint64_t missing;
+    uint64_t reorders;
+};
+
+/*t struct pcap_seq_check_stats */
+/**
+ * Statistics since initialization; 'missing' counts are of the
+ * numbers skipped by gaps less those that arrived later as reorders
+ */
+struct pcap_seq_check_stats {
+    uint64_t buffers;
+    uint64_t buf_gaps;
+    uint64_t bufs_missing;
+    uint64_t buf_reorders;
+    uint64_t packets;
+    uint64_t pkt_gaps;
+    uint64_t pkts_missing;
+    uint64_t pkt_reorders;
+    struct pcap_seq_check_seqr_stats seqr[PCAP_PKT_NUM_SEQRS];
+};
+
+/*t struct pcap_seq_check */
+/**
+ * Sequence check state; the gap ranges are the last of 'num_ranges'
+ * recorded, range n in ranges[n % PCAP_SEQ_CHECK_RANGES]. A range of
+ * no buffers is a restart of the buffer numbering.
+ */
+struct pcap_seq_check {
+    uint32_t expected[PCAP_PKT_NUM_SEQRS]; /* Next sequence word of each sequencer */
+    uint32_t next_buf_seq;
+    int      buf_started;
+    /* Bit (buf_seq % window) set for the buffers seen of the window
+     * before next_buf_seq */
+    uint32_t buf_seen[PCAP_SEQ_CHECK_REORDER_WINDOW/32];
+    struct pcap_seq_check_stats stats;
+    uint64_t num_ranges;
+    struct pcap_seq_range ranges[PCAP_SEQ_CHECK_RANGES];
+};
+
+/*a Functions
+ */
+/*f pcap_seq_check_select */
+/**
+ * @brief Select the implementation the packet check uses
+ *
+ * @param isa ISA to use, or PCAP_INDEX_ISA_BEST for the best supported
+ *
+ * @returns The ISA selected, or -1 if @p isa is not supported (and
+ * the selection is unchanged)
+ *
+ */
+extern int pcap_seq_check_select(enum pcap_index_isa isa);
+
+/*f pcap_seq_check_init */
+/**
+ * @brief Initialize a sequence check, with no buffer or packet seen
+ *
+ */
+extern void pcap_seq_check_init(struct pcap_seq_check *check);
+
+/*f pcap_seq_check_buffer */
+/**
+ * @brief Check the buffer and packet sequence numbers of a completed
+ * capture buffer, working through its descriptors
+ *
+ * @param check       Sequence check state
+ *
+ * @param pcap_buffer Completed capture buffer
+ *
+ * @param num_pkts    Packets of the buffer to check; its total_packets,
+ * limited to the geometry
+ *
+ * @returns Number of gaps found in the buffer
+ *
+ */
+extern uint32_t pcap_seq_check_buffer(struct pcap_seq_check *check,
+                                      const struct pcap_buffer *pcap_buffer,
+                                      uint32_t num_pkts);
+
+/*f pcap_seq_check_index */
+/**
+ * @brief Check the buffer and packet sequence numbers of an indexed
+ * capture buffer, working through the sequence numbers of the index
+ *
+ * @returns Number of gaps found in the buffer
+ *
+ */
+extern uint32_t pcap_seq_check_index(struct pcap_seq_check *check,
+                                     const struct pcap_index *index);
+
+/*f pcap_seq_check_range */
+/**
+ * @brief Get one of the most recent gap ranges
+ *
+ * @param check Sequence check state
+ *
+ * @param n     Gap to get; 0 for the most recent
+ *
+ * @returns The range, or NULL if fewer than @p n+1 are kept
+ *
+ */
+extern const struct pcap_seq_range *pcap_seq_check_range(const struct pcap_seq_check *check,
+                                                         uint32_t n);
+
+/*a Close guard
+ */
+#endif /* _PCAP_SEQ_CHECK_H_ */
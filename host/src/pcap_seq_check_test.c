@@ -0,0 +1,538 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_seq_check_test.c
+ * @brief         Test for the capture sequence checks
+ *
+ * Buffers of descriptors are built with chosen sequence words, and
+ * the gaps, reorders and ranges the check finds with each
+ * implementation the CPU supports are compared with those made, and
+ * with each other for a long run of packets with random drops and
+ * late packets; the cost per packet of each is reported for a 2MB
+ * buffer of 64B packets from all the sequencers, and the check
+ * selected must be no slower than the scalar check.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pcap_seq_check.h"
+#include "timer.h"
+
+/*a Defines
+ */
+#define TEST_MAX_PKTS 14000
+
+/* Buffers checked for the cost per packet, of which the best is taken */
+#define TEST_THROUGHPUT_BUFFERS 200
+
+/*a Useful functions
+ */
+/*f buffer_alloc */
+/**
+ * @brief Allocate a buffer with room for the descriptors of
+ * TEST_MAX_PKTS packets
+ */
+static struct pcap_buffer *
+buffer_alloc(void)
+{
+    return calloc(1, PCAP_BUF_MIN_FIRST_PKT_OFFSET(TEST_MAX_PKTS));
+}
+
+/*f buffer_fill */
+/**
+ * @brief Set the buffer sequence number and packet sequence words of
+ * a buffer
+ */
+static void
+buffer_fill(struct pcap_buffer *pcap_buffer, uint32_t buf_seq,
+            const uint32_t *words, int num_pkts)
+{
+    int i;
+
+    pcap_buffer->hdr.buf_seq       = buf_seq;
+    pcap_buffer->hdr.total_packets = num_pkts;
+    for (i=0; i<num_pkts; i++)
+        pcap_buffer->pkt_desc[i].seq = words[i];
+}
+
+/*f check_range */
+/**
+ * @brief Check gap range @p n of a check is as expected
+ *
+ * @returns Zero if it is, else non-zero
+ */
+static int
+check_range(const struct pcap_seq_check *check, uint32_t n, uint32_t kind,
+            uint32_t seqr, uint32_t buf_seq, uint32_t first, uint32_t num)
+{
+    const struct pcap_seq_range *range;
+
+    range = pcap_seq_check_range(check, n);
+    if (!range)
+        return 1;
+    if ((range->kind != kind) || (range->seqr != seqr) ||
+        (range->buf_seq != buf_seq) || (range->first != first) ||
+        (range->num != num)) {
+        fprintf(stderr, "Range %u: kind %u seqr %u buf_seq %u first %u num %u\n",
+                n, range->kind, range->seqr, range->buf_seq, range->first, range->num);
+        return 1;
+    }
+    return 0;
+}
+
+/*f isa_select */
+/**
+ * @brief Select an ISA for the packet check
+ *
+ * @returns Zero if it is supported, else non-zero
+ */
+static int
+isa_select(enum pcap_index_isa isa)
+{
+    if (pcap_seq_check_select(isa) == isa)
+        return 0;
+    fprintf(stderr, "ISA %s not supported; skipped\n", pcap_index_isa_name(isa));
+    return 1;
+}
+
+/*a Tests
+ */
+/*f test_in_order */
+/**
+ * @brief Two interleaved sequencers wrapping their 16-bit sequence
+ * numbers, checked through buffers and through indices with an ISA,
+ * have no gaps
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_in_order(enum pcap_index_isa isa)
+{
+    struct pcap_seq_check check;
+    struct pcap_buffer *pcap_buffer;
+    struct pcap_index index;
+    uint32_t words[500];
+    uint32_t seq[2];
+    uint32_t buf_seq;
+    int i, j;
+
+    if (isa_select(isa))
+        return 0;
+    pcap_buffer = buffer_alloc();
+    if (!pcap_buffer)
+        return 1;
+    pcap_seq_check_init(&check);
+    seq[0] = 0xff00;
+    seq[1] = 0x1234;
+    buf_seq = 0xfffffff0;
+    for (i=0; i<300; i++) {
+        for (j=0; j<500; j++) {
+            int seqr = (j % 3 == 2) ? 5 : 2;
+            words[j] = PCAP_PKT_SEQ_WORD(seqr, seq[seqr==5]++);
+        }
+        if (i & 1) {
+            memset(&index, 0, sizeof(index));
+            index.buf_seq  = buf_seq;
+            index.num_pkts = 500;
+            index.seq      = words;
+            if (pcap_seq_check_index(&check, &index) != 0)
+                return 2;
+        } else {
+            buffer_fill(pcap_buffer, buf_seq, words, 500);
+            if (pcap_seq_check_buffer(&check, pcap_buffer, 500) != 0)
+                return 3;
+        }
+        buf_seq++;
+    }
+    if ((check.stats.buffers != 300) || (check.stats.packets != 150000))
+        return 4;
+    if (check.stats.buf_gaps || check.stats.buf_reorders ||
+        check.stats.pkt_gaps || check.stats.pkt_reorders ||
+        check.stats.pkts_missing || (check.num_ranges != 0))
+        return 5;
+    free(pcap_buffer);
+    return 0;
+}
+
+/*f test_pkt_gaps */
+/**
+ * @brief Packet gaps, late packets and a sequencer restart are counted
+ * against their sequencer by the check with an ISA, and the gaps
+ * recorded as ranges
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_pkt_gaps(enum pcap_index_isa isa)
+{
+    struct pcap_seq_check check;
+    struct pcap_buffer *pcap_buffer;
+    uint32_t words[64];
+    int n, i;
+
+    if (isa_select(isa))
+        return 0;
+    pcap_buffer = buffer_alloc();
+    if (!pcap_buffer)
+        return 1;
+    pcap_seq_check_init(&check);
+
+    /* Sequencer 3: 10-19, gap of 20-24, 25-27, 22 late, 28 */
+    n = 0;
+    for (i=10; i<20; i++) words[n++] = PCAP_PKT_SEQ_WORD(3,i);
+    for (i=25; i<28; i++) words[n++] = PCAP_PKT_SEQ_WORD(3,i);
+    words[n++] = PCAP_PKT_SEQ_WORD(3,22);
+    words[n++] = PCAP_PKT_SEQ_WORD(3,28);
+    /* Sequencer 1: 0xfffe, gap of 0xffff-0x0001 round the wrap, 2 */
+    words[n++] = PCAP_PKT_SEQ_WORD(1,0xfffe);
+    words[n++] = PCAP_PKT_SEQ_WORD(1,2);
+    buffer_fill(pcap_buffer, 100, words, n);
+    if (pcap_seq_check_buffer(&check, pcap_buffer, n) != 2)
+        return 2;
+    if ((check.stats.pkt_gaps != 2) || (check.stats.pkts_missing != 7) ||
+        (check.stats.pkt_reorders != 1) || (check.stats.packets != n))
+        return 3;
+    if ((check.stats.seqr[3].gaps != 1) || (check.stats.seqr[3].missing != 4) ||
+        (check.stats.seqr[3].reorders != 1))
+        return 4;
+    if ((check.stats.seqr[1].gaps != 1) || (check.stats.seqr[1].missing != 3) ||
+        (check.stats.seqr[1].reorders != 0))
+        return 5;
+    if (check_range(&check, 0, PCAP_SEQ_RANGE_PACKETS, 1, 100, 0xffff, 3) ||
+        check_range(&check, 1, PCAP_SEQ_RANGE_PACKETS, 3, 100, 20, 5) ||
+        (pcap_seq_check_range(&check, 2) != NULL))
+        return 6;
+
+    /* Sequencer 3 restarts from 5, far behind 29; then continues */
+    n = 0;
+    words[n++] = PCAP_PKT_SEQ_WORD(3,29);
+    words[n++] = PCAP_PKT_SEQ_WORD(3,29+PCAP_SEQ_CHECK_REORDER_WINDOW+6);
+    words[n++] = PCAP_PKT_SEQ_WORD(3,29+PCAP_SEQ_CHECK_REORDER_WINDOW+7);
+    buffer_fill(pcap_buffer, 101, words, n);
+    if (pcap_seq_check_buffer(&check, pcap_buffer, n) != 1)
+        return 7;
+    n = 0;
+    words[n++] = PCAP_PKT_SEQ_WORD(3,5);
+    words[n++] = PCAP_PKT_SEQ_WORD(3,6);
+    buffer_fill(pcap_buffer, 102, words, n);
+    if (pcap_seq_check_buffer(&check, pcap_buffer, n) != 1)
+        return 8;
+    if ((check.stats.seqr[3].gaps != 3) || (check.stats.seqr[3].reorders != 1) ||
+        (check.stats.buf_gaps != 0))
+        return 9;
+    if (check_range(&check, 0, PCAP_SEQ_RANGE_PACKETS, 3, 102,
+                    29+PCAP_SEQ_CHECK_REORDER_WINDOW+8,
+                    0x10000 + 5 - (29+PCAP_SEQ_CHECK_REORDER_WINDOW+8)))
+        return 10;
+    free(pcap_buffer);
+    return 0;
+}
+
+/*f test_buf_gaps */
+/**
+ * @brief Buffer gaps and a late buffer are counted and recorded
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_buf_gaps(void)
+{
+    static const uint32_t buf_seqs[] = {7, 8, 10, 9, 11, 15, 16};
+    struct pcap_seq_check check;
+    struct pcap_buffer *pcap_buffer;
+    uint32_t gaps;
+    uint32_t word;
+    int i;
+
+    pcap_buffer = buffer_alloc();
+    if (!pcap_buffer)
+        return 1;
+    pcap_seq_check_init(&check);
+    gaps = 0;
+    word = 0;
+    for (i=0; i<sizeof(buf_seqs)/sizeof(buf_seqs[0]); i++) {
+        buffer_fill(pcap_buffer, buf_seqs[i], &word, 1);
+        word++;
+        gaps += pcap_seq_check_buffer(&check, pcap_buffer, 1);
+    }
+    if ((gaps != 2) || (check.stats.buffers != 7))
+        return 2;
+    if ((check.stats.buf_gaps != 2) || (check.stats.bufs_missing != 3) ||
+        (check.stats.buf_reorders != 1) || (check.stats.pkt_gaps != 0))
+        return 3;
+    if (check_range(&check, 0, PCAP_SEQ_RANGE_BUFFERS, 0, 15, 12, 3) ||
+        check_range(&check, 1, PCAP_SEQ_RANGE_BUFFERS, 0, 10, 9, 1))
+        return 4;
+    free(pcap_buffer);
+    return 0;
+}
+
+/*f test_buf_restart */
+/**
+ * @brief A restart of the buffer numbering is a single gap, of no
+ * buffers, after which gaps are found again; and a buffer seen twice
+ * does not reduce the buffers missing
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_buf_restart(void)
+{
+    static const uint32_t buf_seqs[] = {0, 1, 2, 5, 5, 3, 3};
+    struct pcap_seq_check check;
+    struct pcap_buffer *pcap_buffer;
+    uint32_t gaps;
+    uint32_t word;
+    int i;
+
+    pcap_buffer = buffer_alloc();
+    if (!pcap_buffer)
+        return 1;
+    pcap_seq_check_init(&check);
+    gaps = 0;
+    word = 0;
+    for (i=0; i<3000; i++) {
+        buffer_fill(pcap_buffer, i, &word, 1);
+        word++;
+        gaps += pcap_seq_check_buffer(&check, pcap_buffer, 1);
+    }
+    for (i=0; i<sizeof(buf_seqs)/sizeof(buf_seqs[0]); i++) {
+        buffer_fill(pcap_buffer, buf_seqs[i], &word, 1);
+        word++;
+        gaps += pcap_seq_check_buffer(&check, pcap_buffer, 1);
+    }
+    if ((gaps != 2) || (check.stats.buffers != 3007))
+        return 2;
+    if ((check.stats.buf_gaps != 2) || (check.stats.bufs_missing != 1) ||
+        (check.stats.buf_reorders != 3) || (check.stats.pkt_gaps != 0))
+        return 3;
+    if (check_range(&check, 0, PCAP_SEQ_RANGE_BUFFERS, 0, 5, 3, 2) ||
+        check_range(&check, 1, PCAP_SEQ_RANGE_BUFFERS, 0, 0, 3000, 0))
+        return 4;
+    free(pcap_buffer);
+    return 0;
+}
+
+/*f test_ranges */
+/**
+ * @brief Only the most recent PCAP_SEQ_CHECK_RANGES gaps are kept
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_ranges(void)
+{
+    struct pcap_seq_check check;
+    struct pcap_buffer *pcap_buffer;
+    uint32_t num_bufs;
+    uint32_t word;
+    uint32_t i;
+
+    pcap_buffer = buffer_alloc();
+    if (!pcap_buffer)
+        return 1;
+    pcap_seq_check_init(&check);
+    num_bufs = PCAP_SEQ_CHECK_RANGES+5;
+    for (i=0; i<num_bufs; i++) {
+        word = PCAP_PKT_SEQ_WORD(0, 10*i);
+        buffer_fill(pcap_buffer, i, &word, 1);
+        pcap_seq_check_buffer(&check, pcap_buffer, 1);
+    }
+    if (check.num_ranges != num_bufs-1)
+        return 2;
+    for (i=0; i<PCAP_SEQ_CHECK_RANGES; i++) {
+        uint32_t b;
+        b = num_bufs-1-i;
+        if (check_range(&check, i, PCAP_SEQ_RANGE_PACKETS, 0, b, 10*(b-1)+1, 9))
+            return 3;
+    }
+    if (pcap_seq_check_range(&check, PCAP_SEQ_CHECK_RANGES) != NULL)
+        return 4;
+    free(pcap_buffer);
+    return 0;
+}
+
+/*f test_agree */
+/**
+ * @brief The checks with all the supported ISAs find the same gaps,
+ * reorders and ranges in buffers of packets from all the sequencers
+ * with random drops and late packets
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_agree(void)
+{
+    struct pcap_seq_check check[PCAP_INDEX_ISA_BEST];
+    struct pcap_buffer *pcap_buffer;
+    uint32_t seq[PCAP_PKT_NUM_SEQRS];
+    uint32_t gaps[PCAP_INDEX_ISA_BEST];
+    int isa, i, j, n;
+    int err;
+
+    pcap_buffer = buffer_alloc();
+    if (!pcap_buffer)
+        return 1;
+    for (isa=0; isa<PCAP_INDEX_ISA_BEST; isa++)
+        pcap_seq_check_init(&check[isa]);
+    for (i=0; i<PCAP_PKT_NUM_SEQRS; i++)
+        seq[i] = 0x10000 - 1000*(i+1);
+    srand(1);
+    err = 0;
+    for (i=0; !err && (i<200); i++) {
+        n = 0;
+        for (j=0; j<2000; j++) {
+            int seqr = rand() % PCAP_PKT_NUM_SEQRS;
+            switch (rand() % 1000) {
+            case 0: seq[seqr] += 1 + (rand() % 50); break;
+            case 1: pcap_buffer->pkt_desc[n++].seq = PCAP_PKT_SEQ_WORD(seqr, seq[seqr]-2); break;
+            default: break;
+            }
+            pcap_buffer->pkt_desc[n++].seq = PCAP_PKT_SEQ_WORD(seqr, seq[seqr]++);
+        }
+        pcap_buffer->hdr.buf_seq = i + ((i%50)==49);
+        for (isa=0; isa<PCAP_INDEX_ISA_BEST; isa++) {
+            if (pcap_seq_check_select(isa) != isa)
+                continue;
+            gaps[isa] = pcap_seq_check_buffer(&check[isa], pcap_buffer, n);
+            if (gaps[isa] != gaps[0])
+                err = 2;
+        }
+    }
+    for (isa=1; !err && (isa<PCAP_INDEX_ISA_BEST); isa++) {
+        if (pcap_seq_check_select(isa) != isa)
+            continue;
+        if (memcmp(&check[isa], &check[0], sizeof(check[0])) != 0)
+            err = 3;
+    }
+    if (!err && ((check[0].stats.pkt_gaps == 0) || (check[0].stats.pkt_reorders == 0) ||
+                 (check[0].stats.buf_gaps == 0)))
+        err = 4;
+    pcap_seq_check_select(PCAP_INDEX_ISA_BEST);
+    free(pcap_buffer);
+    return err;
+}
+
+/*f test_throughput */
+/**
+ * @brief Report the cost per packet of checking a full 2MB buffer of
+ * 64B packets from all the sequencers in order with each supported
+ * ISA, taking the best of many buffers; the check selected must be
+ * no slower than the scalar check
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_throughput(void)
+{
+    struct pcap_seq_check check;
+    struct pcap_buffer *pcap_buffer;
+    uint32_t seq[PCAP_PKT_NUM_SEQRS];
+    double ns_per_pkt[PCAP_INDEX_ISA_BEST];
+    int isa, best, i, j;
+
+    pcap_buffer = buffer_alloc();
+    if (!pcap_buffer)
+        return 1;
+    best = pcap_seq_check_select(PCAP_INDEX_ISA_BEST);
+    for (isa=PCAP_INDEX_ISA_SCALAR; isa<PCAP_INDEX_ISA_BEST; isa++) {
+        t_sl_timer timer;
+
+        if (pcap_seq_check_select(isa) != isa)
+            continue;
+        pcap_seq_check_init(&check);
+        memset(seq, 0, sizeof(seq));
+        SL_TIMER_INIT(timer);
+        ns_per_pkt[isa] = 0;
+        for (i=0; i<TEST_THROUGHPUT_BUFFERS; i++) {
+            double ns;
+            for (j=0; j<TEST_MAX_PKTS; j++) {
+                int seqr = (j*7) % PCAP_PKT_NUM_SEQRS;
+                pcap_buffer->pkt_desc[j].seq = PCAP_PKT_SEQ_WORD(seqr, seq[seqr]++);
+            }
+            pcap_buffer->hdr.buf_seq = i;
+            SL_TIMER_ENTRY(timer);
+            pcap_seq_check_buffer(&check, pcap_buffer, TEST_MAX_PKTS);
+            SL_TIMER_EXIT(timer);
+            ns = 1000.0*SL_TIMER_DELTA_VALUE_US(timer)/TEST_MAX_PKTS;
+            if ((i == 0) || (ns < ns_per_pkt[isa]))
+                ns_per_pkt[isa] = ns;
+        }
+        fprintf(stderr, "sequence check %s: %f ns per packet\n", pcap_index_isa_name(isa),
+                ns_per_pkt[isa]);
+        if (check.stats.pkt_gaps || check.stats.pkt_reorders || check.stats.buf_gaps)
+            return 2;
+    }
+    pcap_seq_check_select(PCAP_INDEX_ISA_BEST);
+    free(pcap_buffer);
+    if (ns_per_pkt[best] > ns_per_pkt[PCAP_INDEX_ISA_SCALAR])
+        return 3;
+    return 0;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Sequence in order scalar",test_in_order(PCAP_INDEX_ISA_SCALAR));
+    TEST_RUN("Sequence in order AVX2",test_in_order(PCAP_INDEX_ISA_AVX2));
+    TEST_RUN("Sequence packet gaps scalar",test_pkt_gaps(PCAP_INDEX_ISA_SCALAR));
+    TEST_RUN("Sequence packet gaps AVX2",test_pkt_gaps(PCAP_INDEX_ISA_AVX2));
+    pcap_seq_check_select(PCAP_INDEX_ISA_BEST);
+    TEST_RUN("Sequence buffer gaps",test_buf_gaps());
+    TEST_RUN("Sequence buffer restart",test_buf_restart());
+    TEST_RUN("Sequence gap ranges",test_ranges());
+    TEST_RUN("Sequence implementations agree",test_agree());
+    TEST_RUN("Sequence check throughput",test_throughput());
+    return failures;
+}
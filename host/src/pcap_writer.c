@@ -0,0 +1,529 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_writer.c
+ * @brief         pcap/pcapng file writer for captured host buffers
+ *
+ * Records are appended to the current chunk, a large 4kB-aligned
+ * buffer; a record may straddle two chunks, since the file is just a
+ * byte stream. Full chunks are queued to the writer thread, which
+ * writes each with a single write() call and then returns it to the
+ * free list. The last chunk is padded to a 4kB multiple (as required
+ * for O_DIRECT) and the file truncated to the real length on close.
+ *
+ * A pcap_buffer descriptor holds only the number of 64B blocks
+ * DMAed for a packet, not its length, so the recorded length of a
+ * packet is the block-rounded length of packet data. The DMA starts
+ * at CTM_PKT_OFFSET within the CTM packet buffer, one 64B block ahead
+ * of the packet data, and that block is skipped. The NFP also does
+ * not timestamp packets, so all packets in a buffer are given the
+ * timestamp passed in.
+ *
+ */
+
+/*a Includes
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "pcap_writer.h"
+#include "pcap_index.h"
+#include "pcap_filter_pool.h"
+
+/*a Defines
+ */
+#define PCAP_WRITER_ALIGN              4096
+#define PCAP_WRITER_DEFAULT_CHUNK_SIZE (4<<20)
+#define PCAP_WRITER_DEFAULT_NUM_CHUNKS 8
+#define PCAP_WRITER_DEFAULT_SNAPLEN    65535
+
+/* pcap and pcapng constants */
+#define PCAP_MAGIC_NS         0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAPNG_BLOCK_SHB      0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB      0x00000001
+#define PCAPNG_BLOCK_EPB      0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_END        0
+#define PCAPNG_OPT_IF_TSRESOL 9
+
+/*a Types
+ */
+/*t struct pcap_writer_chunk */
+/**
+ * A chunk of file data, and the number of valid bytes in it
+ */
+struct pcap_writer_chunk {
+    char   *data;
+    size_t  length;
+};
+
+/*t struct pcap_writer */
+/**
+ * Writer state; chunks are used strictly in ring order, so the
+ * num_queued chunks from next_write are full (queued to the writer
+ * thread), followed by the current chunk, and the rest are free
+ */
+struct pcap_writer {
+    int      fd;
+    int      format;
+    uint32_t snaplen;
+    struct pcap_buf_geometry geometry;
+    struct pcap_index index; /* Of the buffer being added */
+    const struct pcap_filter *filter;
+    struct pcap_filter_pool  *filter_pool;
+    size_t   chunk_size;
+    int      num_chunks;
+    struct pcap_writer_chunk *chunks;
+
+    int      current;        /* Chunk being filled by the producer */
+    size_t   file_length;    /* Bytes of records passed to the writer */
+
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  queued;  /* Signalled when a chunk is queued */
+    pthread_cond_t  freed;   /* Signalled when a chunk is written */
+    int      next_write;     /* Next chunk for the writer thread */
+    int      num_queued;
+    int      num_free;
+    int      closing;
+    int      write_error;
+
+    struct pcap_writer_stats stats;
+};
+
+/*a Writer thread
+ */
+/*f writer_write_chunk */
+/**
+ * @brief Write a whole chunk to the file, padding to the alignment
+ */
+static int
+writer_write_chunk(struct pcap_writer *writer, struct pcap_writer_chunk *chunk)
+{
+    size_t length;
+    size_t done;
+
+    length = (chunk->length + PCAP_WRITER_ALIGN-1) & ~(size_t)(PCAP_WRITER_ALIGN-1);
+    memset(chunk->data+chunk->length, 0, length-chunk->length);
+    for (done=0; done<length;) {
+        ssize_t n;
+        n = write(writer->fd, chunk->data+done, length-done);
+        if (n<0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr,"pcap_writer: write failed: %s\n",strerror(errno));
+            return 1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/*f writer_thread */
+/**
+ * @brief Writer thread: write queued chunks in order until closed
+ */
+static void *
+writer_thread(void *handle)
+{
+    struct pcap_writer *writer;
+
+    writer = (struct pcap_writer *)handle;
+    pthread_mutex_lock(&writer->mutex);
+    for (;;) {
+        int chunk;
+        int err;
+
+        while ((writer->num_queued == 0) && !writer->closing)
+            pthread_cond_wait(&writer->queued, &writer->mutex);
+        if (writer->num_queued == 0)
+            break;
+        chunk = writer->next_write;
+        pthread_mutex_unlock(&writer->mutex);
+
+        err = 0;
+        if (!writer->write_error)
+            err = writer_write_chunk(writer, &writer->chunks[chunk]);
+
+        pthread_mutex_lock(&writer->mutex);
+        if (err)
+            writer->write_error = 1;
+        writer->chunks[chunk].length = 0;
+        writer->next_write = (chunk+1) % writer->num_chunks;
+        writer->num_queued--;
+        writer->num_free++;
+        writer->stats.chunks_written++;
+        pthread_cond_signal(&writer->freed);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    return NULL;
+}
+
+/*a Chunk handling
+ */
+/*f writer_queue_current */
+/**
+ * @brief Queue the current chunk to the writer thread, and wait for
+ * the next chunk to be free
+ */
+static int
+writer_queue_current(struct pcap_writer *writer, int wait_for_next)
+{
+    int err;
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->stats.bytes += writer->chunks[writer->current].length;
+    writer->num_queued++;
+    pthread_cond_signal(&writer->queued);
+    if (wait_for_next) {
+        if (writer->num_free == 0)
+            writer->stats.stalls++;
+        while (writer->num_free == 0)
+            pthread_cond_wait(&writer->freed, &writer->mutex);
+        writer->num_free--;
+        writer->current = (writer->current+1) % writer->num_chunks;
+    }
+    err = writer->write_error;
+    pthread_mutex_unlock(&writer->mutex);
+    return err;
+}
+
+/*f writer_append */
+/**
+ * @brief Append bytes to the file, queueing chunks as they fill
+ */
+static int
+writer_append(struct pcap_writer *writer, const void *data, size_t length)
+{
+    const char *src;
+
+    src = (const char *)data;
+    writer->file_length += length;
+    while (length > 0) {
+        struct pcap_writer_chunk *chunk;
+        size_t n;
+
+        chunk = &writer->chunks[writer->current];
+        n = writer->chunk_size - chunk->length;
+        if (n > length)
+            n = length;
+        memcpy(chunk->data+chunk->length, src, n);
+        chunk->length += n;
+        src += n;
+        length -= n;
+        if (chunk->length == writer->chunk_size) {
+            if (writer_queue_current(writer, 1))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/*a File format
+ */
+/*f writer_file_header */
+/**
+ * @brief Append the pcap file header or the pcapng SHB and IDB
+ */
+static int
+writer_file_header(struct pcap_writer *writer)
+{
+    if (writer->format == PCAP_WRITER_FORMAT_PCAPNG) {
+        uint32_t shb[7];
+        uint32_t idb[8];
+
+        shb[0] = PCAPNG_BLOCK_SHB;
+        shb[1] = sizeof(shb);
+        shb[2] = PCAPNG_BYTE_ORDER_MAGIC;
+        shb[3] = 1 | (0<<16);          /* Version 1.0 */
+        shb[4] = 0xffffffff;           /* Section length unknown */
+        shb[5] = 0xffffffff;
+        shb[6] = sizeof(shb);
+
+        idb[0] = PCAPNG_BLOCK_IDB;
+        idb[1] = sizeof(idb);
+        idb[2] = PCAP_LINKTYPE_ETHERNET; /* Reserved is zero */
+        idb[3] = writer->snaplen;
+        idb[4] = PCAPNG_OPT_IF_TSRESOL | (1<<16);
+        idb[5] = 9;                    /* 10^-9 resolution, padded */
+        idb[6] = PCAPNG_OPT_END;
+        idb[7] = sizeof(idb);
+        if (writer_append(writer, shb, sizeof(shb)))
+            return 1;
+        return writer_append(writer, idb, sizeof(idb));
+    } else {
+        uint32_t hdr[6];
+        hdr[0] = PCAP_MAGIC_NS;
+        hdr[1] = 2 | (4<<16);          /* Version 2.4 */
+        hdr[2] = 0;                    /* thiszone */
+        hdr[3] = 0;                    /* sigfigs */
+        hdr[4] = writer->snaplen;
+        hdr[5] = PCAP_LINKTYPE_ETHERNET;
+        return writer_append(writer, hdr, sizeof(hdr));
+    }
+}
+
+/*f pcap_writer_add_packet */
+extern int
+pcap_writer_add_packet(struct pcap_writer *writer,
+                       const void *data,
+                       uint32_t caplen,
+                       uint32_t len,
+                       uint64_t timestamp_ns)
+{
+    if (caplen > writer->snaplen)
+        caplen = writer->snaplen;
+    if (caplen > len)
+        caplen = len;
+
+    if (writer->format == PCAP_WRITER_FORMAT_PCAPNG) {
+        uint32_t epb[7];
+        uint32_t pad;
+        uint32_t zero;
+
+        pad = (4 - (caplen & 3)) & 3;
+        epb[0] = PCAPNG_BLOCK_EPB;
+        epb[1] = sizeof(epb) + caplen + pad + sizeof(uint32_t);
+        epb[2] = 0;                    /* Interface ID */
+        epb[3] = (uint32_t)(timestamp_ns >> 32);
+        epb[4] = (uint32_t)timestamp_ns;
+        epb[5] = caplen;
+        epb[6] = len;
+        zero = 0;
+        if (writer_append(writer, epb, sizeof(epb)) ||
+            writer_append(writer, data, caplen) ||
+            writer_append(writer, &zero, pad) ||
+            writer_append(writer, &epb[1], sizeof(uint32_t)))
+            return 1;
+    } else {
+        uint32_t rec[4];
+        rec[0] = (uint32_t)(timestamp_ns / 1000000000);
+        rec[1] = (uint32_t)(timestamp_ns % 1000000000);
+        rec[2] = caplen;
+        rec[3] = len;
+        if (writer_append(writer, rec, sizeof(rec)) ||
+            writer_append(writer, data, caplen))
+            return 1;
+    }
+    writer->stats.packets++;
+    return 0;
+}
+
+/*f pcap_writer_add_buffer */
+extern int
+pcap_writer_add_buffer(struct pcap_writer *writer,
+                       const struct pcap_buffer *pcap_buffer,
+                       uint64_t timestamp_ns)
+{
+    struct pcap_index *index;
+    uint32_t num_pkts;
+    uint32_t i;
+
+    index = &writer->index;
+    if (pcap_index_build(index, pcap_buffer) < 0) {
+        fprintf(stderr,"pcap_writer: buffer %u claims %u packets\n",
+                pcap_buffer->hdr.buf_seq, pcap_buffer->hdr.total_packets);
+        return -1;
+    }
+    if (index->num_bad > 0) {
+        fprintf(stderr,"pcap_writer: buffer %u has %u bad packet descriptors\n",
+                index->buf_seq, index->num_bad);
+    }
+    if (writer->filter) {
+        num_pkts = index->num_pkts;
+        (void) pcap_filter_pool_run(writer->filter_pool, writer->filter, index, index);
+        writer->stats.filtered += num_pkts - index->num_pkts;
+    }
+    for (i=0; i<index->num_pkts; i++) {
+        pcap_index_prefetch(index, i + PCAP_INDEX_PREFETCH_PKTS);
+        if (pcap_writer_add_packet(writer, index->data[i], index->caplen[i],
+                                   index->length[i], timestamp_ns))
+            return -1;
+    }
+    return (int)pcap_buffer->hdr.total_packets;
+}
+
+/*a Open and close
+ */
+/*f pcap_writer_open */
+extern struct pcap_writer *
+pcap_writer_open(const struct pcap_writer_desc *desc)
+{
+    struct pcap_writer *writer;
+    struct pcap_buf_geometry default_geometry = PCAP_BUF_GEOMETRY_DEFAULT;
+    int open_flags;
+    int i;
+
+    writer = calloc(1, sizeof(*writer));
+    if (!writer)
+        return NULL;
+    writer->geometry = desc->geometry;
+    if (writer->geometry.magic == 0)
+        writer->geometry = default_geometry;
+    if ((writer->geometry.magic != PCAP_BUF_GEOMETRY_MAGIC) ||
+        !PCAP_BUF_GEOMETRY_VALID(writer->geometry.buf_size_shift,
+                                 writer->geometry.max_pkts,
+                                 writer->geometry.first_pkt_offset)) {
+        fprintf(stderr,"pcap_writer: invalid capture buffer geometry\n");
+        free(writer);
+        return NULL;
+    }
+    if (pcap_index_init(&writer->index, &writer->geometry) != 0) {
+        free(writer);
+        return NULL;
+    }
+    writer->format     = desc->format;
+    writer->snaplen    = desc->snaplen    ? desc->snaplen    : PCAP_WRITER_DEFAULT_SNAPLEN;
+    if ((writer->geometry.snaplen != 0) && (writer->geometry.snaplen < writer->snaplen))
+        writer->snaplen = writer->geometry.snaplen;
+    writer->chunk_size = desc->chunk_size ? desc->chunk_size : PCAP_WRITER_DEFAULT_CHUNK_SIZE;
+    writer->num_chunks = desc->num_chunks ? desc->num_chunks : PCAP_WRITER_DEFAULT_NUM_CHUNKS;
+    if ((writer->chunk_size % PCAP_WRITER_ALIGN) != 0) {
+        fprintf(stderr,"pcap_writer: chunk size must be a multiple of %d\n",PCAP_WRITER_ALIGN);
+        pcap_index_free(&writer->index);
+        free(writer);
+        return NULL;
+    }
+    if (writer->num_chunks < 2)
+        writer->num_chunks = 2;
+
+    writer->chunks = calloc(writer->num_chunks, sizeof(struct pcap_writer_chunk));
+    if (!writer->chunks) {
+        pcap_index_free(&writer->index);
+        free(writer);
+        return NULL;
+    }
+    for (i=0; i<writer->num_chunks; i++) {
+        if (posix_memalign((void **)&writer->chunks[i].data, PCAP_WRITER_ALIGN, writer->chunk_size)!=0) {
+            fprintf(stderr,"pcap_writer: failed to allocate chunks\n");
+            for (i--; i>=0; i--)
+                free(writer->chunks[i].data);
+            free(writer->chunks);
+            pcap_index_free(&writer->index);
+            free(writer);
+            return NULL;
+        }
+    }
+
+    /* Not all filesystems support O_DIRECT; they reject it with EINVAL */
+    open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    writer->fd = -1;
+    if (desc->flags & PCAP_WRITER_FLAG_DIRECT_IO) {
+        writer->fd = open(desc->filename, open_flags | O_DIRECT, 0644);
+    }
+    if (writer->fd < 0)
+        writer->fd = open(desc->filename, open_flags, 0644);
+    if (writer->fd < 0) {
+        fprintf(stderr,"pcap_writer: failed to open '%s': %s\n",desc->filename,strerror(errno));
+        for (i=0; i<writer->num_chunks; i++)
+            free(writer->chunks[i].data);
+        free(writer->chunks);
+        pcap_index_free(&writer->index);
+        free(writer);
+        return NULL;
+    }
+
+    writer->filter = desc->filter;
+    if (writer->filter) {
+        writer->filter_pool = pcap_filter_pool_create(desc->filter_threads);
+        if (!writer->filter_pool) {
+            fprintf(stderr,"pcap_writer: failed to start filter threads\n");
+            close(writer->fd);
+            for (i=0; i<writer->num_chunks; i++)
+                free(writer->chunks[i].data);
+            free(writer->chunks);
+            pcap_index_free(&writer->index);
+            free(writer);
+            return NULL;
+        }
+    }
+
+    writer->current    = 0;
+    writer->next_write = 0;
+    writer->num_queued = 0;
+    writer->num_free   = writer->num_chunks-1;
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->queued, NULL);
+    pthread_cond_init(&writer->freed, NULL);
+    if (pthread_create(&writer->thread, NULL, writer_thread, writer)!=0) {
+        fprintf(stderr,"pcap_writer: failed to start writer thread\n");
+        if (writer->filter_pool)
+            pcap_filter_pool_destroy(writer->filter_pool);
+        close(writer->fd);
+        for (i=0; i<writer->num_chunks; i++)
+            free(writer->chunks[i].data);
+        free(writer->chunks);
+        pcap_index_free(&writer->index);
+        free(writer);
+        return NULL;
+    }
+
+    (void) writer_file_header(writer);
+    return writer;
+}
+
+/*f pcap_writer_get_stats */
+extern void
+pcap_writer_get_stats(struct pcap_writer *writer, struct pcap_writer_stats *stats)
+{
+    pthread_mutex_lock(&writer->mutex);
+    *stats = writer->stats;
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+/*f pcap_writer_close */
+extern int
+pcap_writer_close(struct pcap_writer *writer)
+{
+    int err;
+    int i;
+
+    if (writer->chunks[writer->current].length > 0)
+        (void) writer_queue_current(writer, 0);
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->closing = 1;
+    pthread_cond_signal(&writer->queued);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+
+    err = writer->write_error;
+    if (ftruncate(writer->fd, writer->file_length)!=0) {
+        fprintf(stderr,"pcap_writer: failed to truncate file: %s\n",strerror(errno));
+        err = 1;
+    }
+    if (close(writer->fd)!=0)
+        err = 1;
+
+    pthread_cond_destroy(&writer->freed);
+    pthread_cond_destroy(&writer->queued);
+    pthread_mutex_destroy(&writer->mutex);
+    if (writer->filter_pool)
+        pcap_filter_pool_destroy(writer->filter_pool);
+    for (i=0; i<writer->num_chunks; i++)
+        free(writer->chunks[i].data);
+    free(writer->chunks);
+    pcap_index_free(&writer->index);
+    free(writer);
+    return err;
+}
@@ -0,0 +1,167 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_writer.h
+ * @brief         pcap/pcapng file writer for captured host buffers
+ *
+ * The writer formats the packets of completed pcap_buffer host
+ * buffers into pcap or pcapng records with nanosecond timestamps. The
+ * records are copied into large aligned chunks which a dedicated
+ * writer thread writes to the file (using O_DIRECT if possible), so
+ * that a capture buffer may be returned to the NFP as soon as
+ * pcap_writer_add_buffer returns.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PCAP_WRITER_H_
+#define _PCAP_WRITER_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "firmware/pcap.h"
+#include "pcap_filter.h"
+
+/*a Defines
+ */
+#define PCAP_WRITER_FORMAT_PCAP   0
+#define PCAP_WRITER_FORMAT_PCAPNG 1
+
+/* Flags for pcap_writer_desc */
+#define PCAP_WRITER_FLAG_DIRECT_IO 1
+
+/*a Types
+ */
+/*t struct pcap_writer */
+struct pcap_writer;
+
+/*t struct pcap_writer_desc */
+/**
+ * Description of a writer to open; zero chunk_size, num_chunks,
+ * snaplen or geometry magic select the defaults. The snaplen recorded
+ * is at most that of the geometry, as the capture truncated packets
+ * to it. A filter (which must outlive the writer) is run on the
+ * packets of each buffer added, by the adding thread and
+ * filter_threads workers.
+ */
+struct pcap_writer_desc {
+    const char *filename;
+    int      format;     /* PCAP_WRITER_FORMAT_* */
+    int      flags;      /* PCAP_WRITER_FLAG_* */
+    size_t   chunk_size; /* Size of each write; multiple of 4kB */
+    int      num_chunks; /* Number of chunks to buffer */
+    uint32_t snaplen;    /* Maximum bytes of each packet to record */
+    struct pcap_buf_geometry geometry; /* Of the capture buffers */
+    const struct pcap_filter *filter; /* Packets of buffers to record, or NULL */
+    int      filter_threads; /* Worker threads running the filter */
+};
+
+/*t struct pcap_writer_stats */
+/**
+ * Statistics of a writer
+ */
+struct pcap_writer_stats {
+    uint64_t packets;        /* Packets recorded */
+    uint64_t bytes;          /* Bytes passed to the writer thread */
+    uint64_t chunks_written; /* Chunks written to the file */
+    uint64_t stalls;         /* Times a producer waited for a free chunk */
+    uint64_t filtered;       /* Packets of buffers the filter rejected */
+};
+
+/*a Functions
+ */
+/*f pcap_writer_open */
+/**
+ * @brief Open a pcap or pcapng file and start its writer thread
+ *
+ * @param desc Description of the writer
+ *
+ * @returns Writer handle, or NULL on error
+ *
+ */
+extern struct pcap_writer *pcap_writer_open(const struct pcap_writer_desc *desc);
+
+/*f pcap_writer_add_packet */
+/**
+ * @brief Add a packet record to the file
+ *
+ * @param writer       Writer handle
+ *
+ * @param data         Packet data
+ *
+ * @param caplen       Bytes of packet data available at @p data
+ *
+ * @param len          Original length of the packet
+ *
+ * @param timestamp_ns Timestamp of the packet in nanoseconds
+ *
+ * @returns Zero on success, non-zero if the writer has failed
+ *
+ */
+extern int pcap_writer_add_packet(struct pcap_writer *writer,
+                                  const void *data,
+                                  uint32_t caplen,
+                                  uint32_t len,
+                                  uint64_t timestamp_ns);
+
+/*f pcap_writer_add_buffer */
+/**
+ * @brief Add the packets of a completed capture buffer that the
+ * writer's filter (if any) accepts to the file
+ *
+ * @param writer       Writer handle
+ *
+ * @param pcap_buffer  Completed host capture buffer
+ *
+ * @param timestamp_ns Timestamp for the packets of the buffer
+ *
+ * @returns Number of packets in the buffer, or -1 on error
+ *
+ * The packet data is copied out of the buffer before returning, so
+ * the buffer may then be given back to the NFP immediately.
+ *
+ */
+extern int pcap_writer_add_buffer(struct pcap_writer *writer,
+                                  const struct pcap_buffer *pcap_buffer,
+                                  uint64_t timestamp_ns);
+
+/*f pcap_writer_get_stats */
+/**
+ * @brief Get the statistics of a writer
+ *
+ * @param writer Writer handle
+ *
+ * @param stats  Statistics to fill out
+ *
+ */
+extern void pcap_writer_get_stats(struct pcap_writer *writer,
+                                  struct pcap_writer_stats *stats);
+
+/*f pcap_writer_close */
+/**
+ * @brief Flush all records to the file, stop the writer thread and close
+ *
+ * @param writer Writer handle
+ *
+ * @returns Zero on success, non-zero if any write failed
+ *
+ */
+extern int pcap_writer_close(struct pcap_writer *writer);
+
+/*a Close guard
+ */
+#endif /* _PCAP_WRITER_H_ */
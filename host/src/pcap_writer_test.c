@@ -0,0 +1,385 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pcap_writer_test.c
+ * @brief         Test for the pcap/pcapng file writer
+ *
+ * Fills synthetic capture buffers as the NFP would, writes them with
+ * small chunks (so records straddle chunks and the producer stalls),
+ * and parses the resulting file back.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "pcap_writer.h"
+
+/*a Defines
+ */
+#define TEST_FILENAME "/tmp/pcap_writer_test.pcap"
+#define TEST_BUF_SIZE (1<<PCAP_BUF_SIZE_SHIFT)
+#define TEST_TIMESTAMP 1234567890123456789ULL
+
+/*a Useful functions
+ */
+/*f buffer_build */
+/**
+ * @brief Build a completed capture buffer with packets of varying length
+ *
+ * Packet i has length 60+i*13 bytes (mod 1500), filled with (i+j)&0xff,
+ * and is captured up to @p snaplen bytes if that is not zero
+ */
+static struct pcap_buffer *
+buffer_build(int num_pkts, uint32_t buf_seq, uint32_t first_pkt_offset, uint32_t snaplen)
+{
+    struct pcap_buffer *pcap_buffer;
+    uint32_t offset;
+    int i;
+
+    pcap_buffer = calloc(1, TEST_BUF_SIZE);
+    offset = first_pkt_offset >> 6;
+    for (i=0; i<num_pkts; i++) {
+        uint32_t length;
+        uint32_t caplen;
+        unsigned char *data;
+        int j;
+
+        length = 60 + ((i*13) % 1500);
+        caplen = ((snaplen != 0) && (length > snaplen)) ? snaplen : length;
+        pcap_buffer->pkt_desc[i].offset     = offset;
+        pcap_buffer->pkt_desc[i].num_blocks = (caplen+64+63)>>6;
+        pcap_buffer->pkt_desc[i].seq        = i;
+        pcap_buffer->pkt_desc[i].length     = length;
+        pcap_buffer->pkt_desc[i].caplen     = caplen;
+        data = ((unsigned char *)pcap_buffer) + (offset<<6) + 64;
+        for (j=0; j<caplen; j++)
+            data[j] = (i+j) & 0xff;
+        offset += pcap_buffer->pkt_desc[i].num_blocks;
+    }
+    pcap_buffer->hdr.buf_seq       = buf_seq;
+    pcap_buffer->hdr.total_packets = num_pkts;
+    return pcap_buffer;
+}
+
+/*f file_read */
+static unsigned char *
+file_read(const char *filename, long *length)
+{
+    unsigned char *data;
+    FILE *f;
+
+    f = fopen(filename, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    *length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = malloc(*length);
+    if (fread(data, 1, *length, f) != *length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+/*f check_packet */
+/**
+ * @brief Check a packet record against what buffer_build created
+ */
+static int
+check_packet(int i, const unsigned char *data, uint32_t caplen, uint32_t len,
+             uint32_t snaplen)
+{
+    uint32_t length;
+    int j;
+
+    length = 60 + ((i*13) % 1500);
+    if (len != length)
+        return 1;
+    if ((snaplen != 0) && (length > snaplen))
+        length = snaplen;
+    if (caplen != length)
+        return 2;
+    for (j=0; j<length; j++) {
+        if (data[j] != ((i+j) & 0xff))
+            return 3;
+    }
+    return 0;
+}
+
+/*a Tests
+ */
+/*f test_write */
+/**
+ * @brief Write @p num_buffers buffers and check the resulting file
+ *
+ * @param format     PCAP_WRITER_FORMAT_*
+ *
+ * @param flags      PCAP_WRITER_FLAG_*
+ *
+ * @param num_buffers Number of capture buffers to write
+ *
+ * @param snaplen    Snaplen of the capture geometry, or 0
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_write(int format, int flags, int num_buffers, uint32_t snaplen)
+{
+    struct pcap_buf_geometry geometry = PCAP_BUF_GEOMETRY_DEFAULT;
+    struct pcap_writer_desc desc;
+    struct pcap_writer_stats stats;
+    struct pcap_writer *writer;
+    struct pcap_buffer *pcap_buffer;
+    unsigned char *data;
+    const uint32_t *w;
+    long length;
+    long pos;
+    int num_pkts;
+    int i;
+
+    num_pkts = 100;
+    memset(&desc, 0, sizeof(desc));
+    desc.filename   = TEST_FILENAME;
+    desc.format     = format;
+    desc.flags      = flags;
+    desc.chunk_size = 8192;
+    desc.num_chunks = 3;
+    desc.snaplen    = 0;
+    desc.geometry   = geometry;
+    desc.geometry.snaplen = snaplen;
+    writer = pcap_writer_open(&desc);
+    if (!writer)
+        return 1;
+    pcap_buffer = buffer_build(num_pkts, 0, PCAP_BUF_FIRST_PKT_OFFSET, snaplen);
+    for (i=0; i<num_buffers; i++) {
+        if (pcap_writer_add_buffer(writer, pcap_buffer, TEST_TIMESTAMP+i) != num_pkts)
+            return 2;
+    }
+    free(pcap_buffer);
+    pcap_writer_get_stats(writer, &stats);
+    if (stats.packets != num_pkts*num_buffers)
+        return 3;
+    if (pcap_writer_close(writer) != 0)
+        return 4;
+
+    data = file_read(TEST_FILENAME, &length);
+    if (!data)
+        return 5;
+    w = (const uint32_t *)data;
+    if (format == PCAP_WRITER_FORMAT_PCAP) {
+        if ((w[0] != 0xa1b23c4d) || (w[1] != (2 | (4<<16))) || (w[5] != 1))
+            return 10;
+        if (snaplen && (w[4] != snaplen))
+            return 16;
+        pos = 24;
+    } else {
+        if ((w[0] != 0x0a0d0d0a) || (w[2] != 0x1a2b3c4d) || (w[7] != 0x00000001))
+            return 10;
+        pos = w[1] + w[w[1]/4+1];
+    }
+    for (i=0; i<num_pkts*num_buffers; i++) {
+        uint64_t ts;
+        uint32_t caplen, len;
+        int err;
+
+        if (pos+16 > length)
+            return 11;
+        w = (const uint32_t *)(data+pos);
+        if (format == PCAP_WRITER_FORMAT_PCAP) {
+            ts = w[0]*1000000000ULL + w[1];
+            caplen = w[2];
+            len = w[3];
+            err = check_packet(i % num_pkts, data+pos+16, caplen, len, snaplen);
+            pos += 16 + caplen;
+        } else {
+            if (w[0] != 0x00000006)
+                return 12;
+            ts = (((uint64_t)w[3])<<32) | w[4];
+            caplen = w[5];
+            len = w[6];
+            err = check_packet(i % num_pkts, data+pos+28, caplen, len, snaplen);
+            if (*(const uint32_t *)(data+pos+w[1]-4) != w[1])
+                return 13;
+            pos += w[1];
+        }
+        if (err)
+            return 20+err;
+        if (ts != TEST_TIMESTAMP + (i / num_pkts))
+            return 14;
+    }
+    free(data);
+    unlink(TEST_FILENAME);
+    if (pos != length)
+        return 15;
+    return 0;
+}
+
+/*f test_geometry */
+/**
+ * @brief Packets of a buffer are checked against a 64kB buffer
+ * geometry, and the buffer against its packet limit
+ *
+ */
+static int
+test_geometry(void)
+{
+    struct pcap_buf_geometry geometry = {PCAP_BUF_GEOMETRY_MAGIC, 16, 255,
+                                         PCAP_BUF_MIN_FIRST_PKT_OFFSET(255)};
+    struct pcap_writer_desc desc;
+    struct pcap_writer_stats stats;
+    struct pcap_writer *writer;
+    struct pcap_buffer *pcap_buffer;
+    uint32_t end;
+    int num_fit;
+    int i;
+    int err;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.filename = TEST_FILENAME;
+    desc.format   = PCAP_WRITER_FORMAT_PCAP;
+    desc.geometry = geometry;
+    desc.geometry.max_pkts = PCAP_BUF_MAX_PKTS_LIMIT+1;
+    writer = pcap_writer_open(&desc);
+    if (writer)
+        return 1;
+    desc.geometry = geometry;
+    writer = pcap_writer_open(&desc);
+    if (!writer)
+        return 2;
+
+    /* Packets beyond 64kB are dropped as bad descriptors */
+    pcap_buffer = buffer_build(100, 0, geometry.first_pkt_offset, 0);
+    num_fit = 0;
+    for (i=0; i<100; i++) {
+        end = (pcap_buffer->pkt_desc[i].offset + pcap_buffer->pkt_desc[i].num_blocks) << 6;
+        if (end <= 65536)
+            num_fit++;
+    }
+    err = 0;
+    if ((num_fit == 0) || (num_fit == 100)) err = 3;
+    if (pcap_writer_add_buffer(writer, pcap_buffer, TEST_TIMESTAMP) != 100) err = 4;
+    pcap_writer_get_stats(writer, &stats);
+    if (stats.packets != num_fit) err = 5;
+    pcap_buffer->hdr.total_packets = 256;
+    if (pcap_writer_add_buffer(writer, pcap_buffer, TEST_TIMESTAMP) >= 0) err = 6;
+    free(pcap_buffer);
+    if (pcap_writer_close(writer) != 0) err = 7;
+    unlink(TEST_FILENAME);
+    return err;
+}
+
+/*f test_filter */
+/**
+ * @brief Packets of buffers are recorded only if a filter accepts them
+ *
+ */
+static int
+test_filter(void)
+{
+    struct pcap_writer_desc desc;
+    struct pcap_writer_stats stats;
+    struct pcap_writer *writer;
+    struct pcap_buffer *pcap_buffer;
+    struct pcap_filter filter = {0, NULL};
+    long length, expected_length;
+    unsigned char *data;
+    int num_accepted;
+    int i;
+    int err;
+
+    if (pcap_filter_compile(&filter, "greater 800", NULL, 0) != 0)
+        return 1;
+    memset(&desc, 0, sizeof(desc));
+    desc.filename       = TEST_FILENAME;
+    desc.format         = PCAP_WRITER_FORMAT_PCAP;
+    desc.filter         = &filter;
+    desc.filter_threads = 2;
+    writer = pcap_writer_open(&desc);
+    if (!writer)
+        return 2;
+    pcap_buffer = buffer_build(200, 0, PCAP_BUF_FIRST_PKT_OFFSET, 0);
+    num_accepted = 0;
+    expected_length = 24;
+    for (i=0; i<200; i++) {
+        if (pcap_buffer->pkt_desc[i].length >= 800) {
+            num_accepted++;
+            expected_length += 16 + pcap_buffer->pkt_desc[i].length;
+        }
+    }
+    err = 0;
+    if (pcap_writer_add_buffer(writer, pcap_buffer, TEST_TIMESTAMP) != 200) err = 3;
+    free(pcap_buffer);
+    pcap_writer_get_stats(writer, &stats);
+    if (stats.packets != num_accepted) err = 4;
+    if (stats.filtered != 200 - num_accepted) err = 5;
+    if (pcap_writer_close(writer) != 0) err = 6;
+    pcap_filter_free(&filter);
+    data = file_read(TEST_FILENAME, &length);
+    if (!data) return 7;
+    if (!err && (length != expected_length)) err = 8;
+    free(data);
+    unlink(TEST_FILENAME);
+    return err;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("pcap of 1 buffer",test_write(PCAP_WRITER_FORMAT_PCAP,0,1,0));
+    TEST_RUN("pcap of 20 buffers",test_write(PCAP_WRITER_FORMAT_PCAP,0,20,0));
+    TEST_RUN("pcap of 20 buffers with O_DIRECT",test_write(PCAP_WRITER_FORMAT_PCAP,PCAP_WRITER_FLAG_DIRECT_IO,20,0));
+    TEST_RUN("pcapng of 1 buffer",test_write(PCAP_WRITER_FORMAT_PCAPNG,0,1,0));
+    TEST_RUN("pcapng of 20 buffers with O_DIRECT",test_write(PCAP_WRITER_FORMAT_PCAPNG,PCAP_WRITER_FLAG_DIRECT_IO,20,0));
+    TEST_RUN("pcap of 20 buffers with 128B snaplen",test_write(PCAP_WRITER_FORMAT_PCAP,0,20,128));
+    TEST_RUN("pcapng of 1 buffer with 128B snaplen",test_write(PCAP_WRITER_FORMAT_PCAPNG,0,1,128));
+    TEST_RUN("64kB buffer geometry",test_geometry());
+    TEST_RUN("Filtered buffer",test_filter());
+    return failures;
+}
@@ -437,29 +437,27 @@ find_data_region_allocation(struct pktgen_mem_layout *layout,
     return pktgen_mem_get_mu(layout, data_region+REGION_DATA, region_offset_s8<<8);
 }
 
-/** patch_schedule
+/** pktgen_mem_patch_sched_entries
  *
- * Patch up a schedule's packet pointers based on alloacted memory. 
+ * Patch up schedule entries' packet pointers based on allocated memory.
  *
- * @param layout  Memory layout previously allocated
- * @param region  Schedule region to patch
- * @param mem     Memory containing the schedule
+ * @param layout       Memory layout previously allocated and loaded
+ * @param sched_entry  Schedule entries to patch
+ * @param num_entries  Number of schedule entries to patch
  *
- * Invoked just prior to loading the schedule region.
+ * Return 0 on success, non-zero on error
  *
  */
-static int
-patch_schedule(struct pktgen_mem_layout *layout,
-               struct pktgen_mem_region *region,
-               char *mem)
+extern int
+pktgen_mem_patch_sched_entries(struct pktgen_mem_layout *layout,
+                               struct pktgen_sched_entry *sched_entry,
+                               int num_entries)
 {
     int i;
-    struct pktgen_sched_entry *sched_entry;
-    for (i=64; i<region->data_size; i+=sizeof(*sched_entry)) {
+    for (i=0; i<num_entries; i++, sched_entry++) {
         int data_region;
         uint32_t region_offset_s8;
         uint32_t mu_base_s8;
-        sched_entry = (struct pktgen_sched_entry *)(mem + i);
         if (sched_entry->mu_base_s8 != 0) {
             data_region   = sched_entry->mu_base_s8 >> 28;
             region_offset_s8 = sched_entry->mu_base_s8 & 0xfffffff;
@@ -477,6 +475,29 @@ patch_schedule(struct pktgen_mem_layout *layout,
     return 0;
 }
 
+/** patch_schedule
+ *
+ * Patch up a schedule's packet pointers based on alloacted memory. 
+ *
+ * @param layout  Memory layout previously allocated
+ * @param region  Schedule region to patch
+ * @param mem     Memory containing the schedule
+ *
+ * Invoked just prior to loading the schedule region.
+ *
+ */
+static int
+patch_schedule(struct pktgen_mem_layout *layout,
+               struct pktgen_mem_region *region,
+               char *mem)
+{
+    if (region->data_size <= 64)
+        return 0;
+    return pktgen_mem_patch_sched_entries(layout,
+                                          (struct pktgen_sched_entry *)(mem + 64),
+                                          (region->data_size - 64) / sizeof(struct pktgen_sched_entry));
+}
+
 /** load_allocation
  *
  * Load an allocatin of a region into NFP memory
@@ -152,3 +152,21 @@ extern void pktgen_mem_close(struct pktgen_mem_layout *layout);
 extern uint64_t pktgen_mem_get_mu(struct pktgen_mem_layout *layout,
                                   int region,
                                   uint64_t ofs );
+
+/** pktgen_mem_patch_sched_entries
+ *
+ * @param layout       Memory layout previously allocated and loaded
+ * @param sched_entry  Schedule entries to patch
+ * @param num_entries  Number of schedule entries to patch
+ *
+ * Returns 0 on success, non-zero on error
+ *
+ * Patch the packet addresses of schedule entries (data region and
+ * offset, as in a schedule file) to the MU addresses of the loaded
+ * packet data; used for schedule entries streamed from a file
+ *
+ */
+struct pktgen_sched_entry;
+extern int pktgen_mem_patch_sched_entries(struct pktgen_mem_layout *layout,
+                                          struct pktgen_sched_entry *sched_entry,
+                                          int num_entries);
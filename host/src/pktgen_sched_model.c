@@ -0,0 +1,125 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pktgen_sched_model.c
+ * @brief         Host model of packet generator schedule playback
+ *
+ * The firmware pktgen_master distributes a schedule as batches of 8
+ * entries, once per playback loop, with a base time that advances by
+ * the scaled loop offset on every loop; the batch distributors add
+ * the scaled entry time to the batch base time. This code follows the
+ * same steps using the same arithmetic.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdint.h>
+#include "pktgen_sched_model.h"
+
+/*a Functions
+ */
+/*f playback_time_scale */
+static uint32_t
+playback_time_scale(const struct pktgen_sched_model_playback *playback)
+{
+    if (playback->time_scale == 0)
+        return PKTGEN_TIME_SCALE_ONE;
+    return playback->time_scale;
+}
+
+/*f playback_loop_offset */
+static uint64_t
+playback_loop_offset(const struct pktgen_sched_model_playback *playback)
+{
+    return pktgen_scale_tx_time((uint32_t)playback->loop_offset,
+                                (uint32_t)(playback->loop_offset >> 32),
+                                playback_time_scale(playback));
+}
+
+/*f pktgen_sched_model_tx_time */
+extern uint64_t
+pktgen_sched_model_tx_time(const struct pktgen_sched_model_playback *playback,
+                           uint64_t base_time,
+                           uint32_t loop,
+                           const struct pktgen_sched_entry *entry)
+{
+    uint64_t tx_time;
+
+    tx_time  = base_time + loop * playback_loop_offset(playback);
+    tx_time += pktgen_scale_tx_time(entry->tx_time_lo, entry->tx_time_hi,
+                                    playback_time_scale(playback));
+    return tx_time & PKTGEN_TX_TIME_MASK;
+}
+
+/*f pktgen_sched_model_run */
+extern int
+pktgen_sched_model_run(const struct pktgen_sched_entry *sched,
+                       int total_pkts,
+                       const struct pktgen_sched_model_playback *playback,
+                       uint64_t base_time,
+                       uint32_t *tx_seq,
+                       pktgen_sched_model_callback callback,
+                       void *handle)
+{
+    uint32_t time_scale;
+    uint32_t loop_count;
+    uint64_t loop_offset;
+    uint32_t loop;
+
+    time_scale  = playback_time_scale(playback);
+    loop_offset = playback_loop_offset(playback);
+    loop_count  = playback->loop_count;
+    if (loop_count == 0)
+        loop_count = 1;
+
+    for (loop=0; loop<loop_count; loop++) {
+        uint64_t batch_time;
+        uint32_t seq;
+        int pkts_left;
+        int batch;
+
+        batch_time = base_time & PKTGEN_TX_TIME_MASK;
+        seq = *tx_seq;
+        *tx_seq += total_pkts;
+        pkts_left = total_pkts;
+        for (batch=0; pkts_left>0; batch++) {
+            int num_valid_pkts;
+            int i;
+
+            num_valid_pkts = (pkts_left < 8) ? pkts_left : 8;
+            for (i=0; i<num_valid_pkts; i++) {
+                struct pktgen_sched_model_pkt pkt;
+                const struct pktgen_sched_entry *entry;
+                int err;
+
+                entry = &sched[batch*8+i];
+                pkt.tx_time = batch_time + pktgen_scale_tx_time(entry->tx_time_lo,
+                                                                entry->tx_time_hi,
+                                                                time_scale);
+                pkt.tx_time &= PKTGEN_TX_TIME_MASK;
+                pkt.tx_seq = seq + i;
+                pkt.loop   = loop;
+                pkt.entry  = batch*8+i;
+                err = callback(handle, &pkt);
+                if (err)
+                    return err;
+            }
+            seq += 8;
+            pkts_left -= 8;
+        }
+        base_time += loop_offset;
+    }
+    return 0;
+}
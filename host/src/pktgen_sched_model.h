@@ -0,0 +1,118 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pktgen_sched_model.h
+ * @brief         Host model of packet generator schedule playback
+ *
+ * This models the pktgen_master and batch distributor firmware
+ * handling of a schedule, so that the transmit time and sequence
+ * arithmetic (time scaling, looping, 40-bit wrapping) can be tested
+ * on the host.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PKTGEN_SCHED_MODEL_H_
+#define _PKTGEN_SCHED_MODEL_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include "firmware/pktgen.h"
+
+/*a Types
+ */
+/*t struct pktgen_sched_model_playback */
+/**
+ * Playback mode, as given to the firmware by PKTGEN_HOST_CMD_PLAYBACK
+ */
+struct pktgen_sched_model_playback {
+    uint32_t time_scale;  /* PKTGEN_TIME_SCALE_ONE is real-time */
+    uint32_t loop_count;  /* Number of plays of the schedule; 0 is 1 */
+    uint64_t loop_offset; /* Schedule time between starts of loops */
+};
+
+/*t struct pktgen_sched_model_pkt */
+/**
+ * A packet as handed to a TX slave by the batch distributor
+ */
+struct pktgen_sched_model_pkt {
+    uint64_t tx_time; /* 40-bit transmit time */
+    uint32_t tx_seq;  /* Full transmit sequence (firmware carries 16 bits) */
+    uint32_t loop;    /* Loop of the schedule the packet is in */
+    int      entry;   /* Schedule entry number */
+};
+
+/*t pktgen_sched_model_callback */
+/**
+ * Callback invoked for each packet; a non-zero return aborts the model
+ */
+typedef int (*pktgen_sched_model_callback)(void *handle,
+                                           const struct pktgen_sched_model_pkt *pkt);
+
+/*a Functions
+ */
+/*f pktgen_sched_model_tx_time */
+/**
+ * @brief Determine the transmit time of a schedule entry
+ *
+ * @param playback   Playback mode
+ *
+ * @param base_time  Base time of the schedule (firmware time plus base delay)
+ *
+ * @param loop       Loop of the schedule
+ *
+ * @param entry      Schedule entry
+ *
+ * @returns 40-bit transmit time for the entry
+ *
+ */
+extern uint64_t pktgen_sched_model_tx_time(const struct pktgen_sched_model_playback *playback,
+                                           uint64_t base_time,
+                                           uint32_t loop,
+                                           const struct pktgen_sched_entry *entry);
+
+/*f pktgen_sched_model_run */
+/**
+ * @brief Model the distribution of a schedule as a PKTGEN_HOST_CMD_PKT
+ *
+ * @param sched       Schedule entries (starting after the 64B header)
+ *
+ * @param total_pkts  Number of packets in the schedule
+ *
+ * @param playback    Playback mode
+ *
+ * @param base_time   Base time of the schedule
+ *
+ * @param tx_seq      Transmit sequence number, updated as the firmware does
+ *
+ * @param callback    Callback invoked for every packet in transmit order
+ *
+ * @param handle      Handle passed to @p callback
+ *
+ * @returns Zero on success, else the non-zero value returned by @p callback
+ *
+ */
+extern int pktgen_sched_model_run(const struct pktgen_sched_entry *sched,
+                                  int total_pkts,
+                                  const struct pktgen_sched_model_playback *playback,
+                                  uint64_t base_time,
+                                  uint32_t *tx_seq,
+                                  pktgen_sched_model_callback callback,
+                                  void *handle);
+
+/*a Close guard
+ */
+#endif /* _PKTGEN_SCHED_MODEL_H_ */
@@ -0,0 +1,272 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pktgen_sched_model_test.c
+ * @brief         Test for the packet generator schedule playback model
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pktgen_sched_model.h"
+
+/*a Types
+ */
+/*t struct test_check */
+/**
+ * Expected values checked by the model callback
+ */
+struct test_check {
+    const struct pktgen_sched_model_playback *playback;
+    const struct pktgen_sched_entry *sched;
+    uint64_t base_time;
+    uint32_t first_seq;
+    int      total_pkts;
+    int      num_pkts;
+    uint64_t last_tx_time;
+};
+
+/*a Useful functions
+ */
+/*f sched_build */
+/**
+ * @brief Build a schedule with a packet every @p interval from @p start
+ */
+static struct pktgen_sched_entry *
+sched_build(int total_pkts, uint64_t start, uint64_t interval)
+{
+    struct pktgen_sched_entry *sched;
+    int i;
+
+    sched = calloc((total_pkts+7)&~7, sizeof(*sched));
+    for (i=0; i<total_pkts; i++) {
+        uint64_t t;
+        t = start + i*interval;
+        sched[i].tx_time_lo = (uint32_t)t;
+        sched[i].tx_time_hi = (t >> 32) & 0xff;
+        sched[i].length     = 64;
+    }
+    return sched;
+}
+
+/*f check_callback */
+/**
+ * @brief Check each packet is in order with the expected time and sequence
+ */
+static int
+check_callback(void *handle, const struct pktgen_sched_model_pkt *pkt)
+{
+    struct test_check *check;
+    uint64_t tx_time;
+
+    check = (struct test_check *)handle;
+    if (pkt->tx_seq != check->first_seq + check->num_pkts)
+        return 1;
+    if (pkt->entry != (check->num_pkts % check->total_pkts))
+        return 2;
+    tx_time = pktgen_sched_model_tx_time(check->playback, check->base_time,
+                                         pkt->loop, &check->sched[pkt->entry]);
+    if (pkt->tx_time != tx_time)
+        return 3;
+    if (pkt->tx_time > PKTGEN_TX_TIME_MASK)
+        return 4;
+    check->last_tx_time = pkt->tx_time;
+    check->num_pkts++;
+    return 0;
+}
+
+/*f run_check */
+/**
+ * @brief Run the model with @p check_callback for a whole schedule
+ */
+static int
+run_check(struct test_check *check, uint32_t *tx_seq)
+{
+    int err;
+    check->first_seq = *tx_seq;
+    check->num_pkts = 0;
+    err = pktgen_sched_model_run(check->sched, check->total_pkts,
+                                 check->playback, check->base_time,
+                                 tx_seq, check_callback, check);
+    if (err)
+        return err;
+    if (*tx_seq != check->first_seq + check->num_pkts)
+        return 10;
+    return 0;
+}
+
+/*a Tests
+ */
+/*f test_realtime */
+/**
+ * @brief Test real-time single playback, including carry into tx_time_hi
+ *
+ * @param total_pkts Number of packets in the schedule
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_realtime(int total_pkts)
+{
+    struct pktgen_sched_model_playback playback;
+    struct test_check check;
+    uint32_t tx_seq;
+    int err;
+
+    playback.time_scale  = PKTGEN_TIME_SCALE_ONE;
+    playback.loop_count  = 1;
+    playback.loop_offset = 0;
+    check.playback   = &playback;
+    check.sched      = sched_build(total_pkts, 0xfffff000ULL, 0x100);
+    check.base_time  = 0x12fffff000ULL;
+    check.total_pkts = total_pkts;
+    tx_seq = 0xfff0;
+    err = run_check(&check, &tx_seq);
+    if (!err && (check.num_pkts != total_pkts))
+        err = 20;
+    if (!err && (check.last_tx_time != 0x12fffff000ULL + 0xfffff000ULL + (total_pkts-1)*0x100))
+        err = 21;
+    free((void *)check.sched);
+    return err;
+}
+
+/*f test_scaled */
+/**
+ * @brief Test scaled playback against the expected arithmetic
+ *
+ * @param speed Playback speed (2.0 plays twice as fast)
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_scaled(double speed)
+{
+    struct pktgen_sched_model_playback playback;
+    struct test_check check;
+    uint32_t tx_seq;
+    uint64_t expected;
+    int total_pkts;
+    int err;
+
+    total_pkts = 1001;
+    playback.time_scale  = (uint32_t)(PKTGEN_TIME_SCALE_ONE / speed);
+    playback.loop_count  = 1;
+    playback.loop_offset = 0;
+    check.playback   = &playback;
+    check.sched      = sched_build(total_pkts, 0x10000000ULL, 0x20000);
+    check.base_time  = 1000;
+    check.total_pkts = total_pkts;
+    tx_seq = 0;
+    err = run_check(&check, &tx_seq);
+    expected  = 0x10000000ULL + (total_pkts-1)*0x20000ULL;
+    expected  = (expected * playback.time_scale) >> PKTGEN_TIME_SCALE_SHIFT;
+    expected += 1000;
+    if (!err && (check.last_tx_time != expected))
+        err = 20;
+    free((void *)check.sched);
+    return err;
+}
+
+/*f test_loop */
+/**
+ * @brief Test looped playback, with sequence numbers beyond 16 bits and time wrap
+ *
+ * @param total_pkts Number of packets in the schedule
+ *
+ * @param loop_count Number of times to play the schedule
+ *
+ * @param time_scale Playback time scale
+ *
+ * @returns Zero on success, else an error indication
+ *
+ */
+static int
+test_loop(int total_pkts, uint32_t loop_count, uint32_t time_scale)
+{
+    struct pktgen_sched_model_playback playback;
+    struct test_check check;
+    uint32_t tx_seq;
+    uint64_t loop_offset;
+    uint64_t expected;
+    int err;
+
+    playback.time_scale  = time_scale;
+    playback.loop_count  = loop_count;
+    playback.loop_offset = total_pkts * 0x1000ULL;
+    check.playback   = &playback;
+    check.sched      = sched_build(total_pkts, 0, 0x1000);
+    check.base_time  = PKTGEN_TX_TIME_MASK - 0x100000;
+    check.total_pkts = total_pkts;
+    tx_seq = 0;
+    err = run_check(&check, &tx_seq);
+    if (!err && (check.num_pkts != total_pkts*loop_count))
+        err = 20;
+    loop_offset = pktgen_scale_tx_time((uint32_t)playback.loop_offset, 0, time_scale);
+    expected  = check.base_time + (loop_count-1) * loop_offset;
+    expected += pktgen_scale_tx_time((total_pkts-1)*0x1000, 0, time_scale);
+    expected &= PKTGEN_TX_TIME_MASK;
+    if (!err && (check.last_tx_time != expected))
+        err = 21;
+    free((void *)check.sched);
+    return err;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Real-time playback of 1 packet",test_realtime(1));
+    TEST_RUN("Real-time playback of 57 packets",test_realtime(57));
+
+    TEST_RUN("Playback at 2x speed",test_scaled(2.0));
+    TEST_RUN("Playback at 0.5x speed",test_scaled(0.5));
+    TEST_RUN("Playback at 3x speed",test_scaled(3.0));
+
+    TEST_RUN("Real-time loop 57 packets 3 times",test_loop(57,3,PKTGEN_TIME_SCALE_ONE));
+    TEST_RUN("Real-time loop 1000 packets 100 times",test_loop(1000,100,PKTGEN_TIME_SCALE_ONE));
+    TEST_RUN("2x speed loop 999 packets 70 times",test_loop(999,70,PKTGEN_TIME_SCALE_ONE/2));
+    return failures;
+}
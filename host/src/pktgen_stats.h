@@ -0,0 +1,268 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pktgen_stats.h
+ * @brief         Live statistics block in the pktgencap shared memory
+ *
+ * pktgencap keeps its statistics in a private struct pktgen_stats and
+ * publishes it every few hundred microseconds to the block at
+ * PKTGEN_STATS_SHM_OFFSET in its shared memory. Any number of readers
+ * (pktgencap_stat, python/pktgencap_stat.py) may take snapshots of the
+ * block at any rate without the server ever waiting for them.
+ *
+ * The block is protected by a sequence lock: the server makes 'seq'
+ * odd, stores the body, then makes 'seq' even again. A reader copies
+ * the body between two reads of 'seq', and retries if they differ or
+ * are odd. The body is all 64-bit words, stored and loaded as relaxed
+ * atomics so that a torn copy is detected rather than undefined.
+ *
+ * New fields are only ever added at the end, with 'size' telling a
+ * reader how much of the block the server fills; a change to the
+ * meaning of a field changes PKTGEN_STATS_VERSION.
+ *
+ */
+
+/*a Open guard
+ */
+#ifndef _PKTGEN_STATS_H_
+#define _PKTGEN_STATS_H_
+
+/*a Includes
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sched.h>
+
+/*a Defines
+ */
+#define PKTGEN_STATS_MAGIC   0x54534750 /* 'PGST' */
+#define PKTGEN_STATS_VERSION 1
+
+/* Attempts a reader makes to get a consistent copy before giving up;
+ * it yields the CPU every PKTGEN_STATS_READ_SPINS attempts, in case
+ * the server has been preempted part way through an update */
+#define PKTGEN_STATS_READ_TRIES 100000
+#define PKTGEN_STATS_READ_SPINS 64
+
+/* Firmware counters carried in the block (see nfp_stats.h) */
+#define PKTGEN_STATS_MAX_FW_COUNTERS 64
+#define PKTGEN_STATS_FW_NAME_LEN     48
+
+/* Capture sequence checks carried in the block (see pcap_seq_check.h);
+ * NBI sequencers (PCAP_PKT_NUM_SEQRS) and most recent gap ranges */
+#define PKTGEN_STATS_SEQ_NUM_SEQRS   8
+#define PKTGEN_STATS_SEQ_RANGES      16
+
+/*a Types
+ */
+/*t struct pktgen_stats_fw_counter */
+/**
+ * A firmware counter, as scraped by nfp_stats
+ */
+struct pktgen_stats_fw_counter {
+    char     name[PKTGEN_STATS_FW_NAME_LEN]; /* '<island>.<block>.<counter>' */
+    uint64_t total;              /* Total, extended to 64 bits */
+    uint64_t rate;               /* Per second, over the last scrape interval */
+};
+
+/*t struct pktgen_stats_seqr */
+/**
+ * Sequence check counters of an NBI sequencer
+ */
+struct pktgen_stats_seqr {
+    uint64_t gaps;               /* Gaps in its packet sequence */
+    uint64_t missing;            /* Packets skipped by them, less late ones */
+    uint64_t reorders;           /* Packets arriving late or twice */
+};
+
+/*t struct pktgen_stats_seq_range */
+/**
+ * Range of sequence numbers found missing, as a struct pcap_seq_range
+ */
+struct pktgen_stats_seq_range {
+    uint64_t kind;               /* PCAP_SEQ_RANGE_BUFFERS or _PACKETS */
+    uint64_t seqr;               /* NBI sequencer, for a range of packets */
+    uint64_t buf_seq;            /* Buffer in which the gap was found */
+    uint64_t first;              /* First sequence number missing */
+    uint64_t num;                /* Sequence numbers missing */
+};
+
+/*t struct pktgen_stats */
+/**
+ * Statistics block; counters are totals since the server started,
+ * gauges are values at update_ns
+ */
+struct pktgen_stats {
+    uint32_t magic;              /* PKTGEN_STATS_MAGIC once initialized */
+    uint32_t version;            /* PKTGEN_STATS_VERSION */
+    uint32_t size;               /* Bytes of the block filled by the server */
+    uint32_t seq;                /* Sequence lock; odd during an update */
+
+    uint64_t update_ns;          /* CLOCK_MONOTONIC of the last update */
+    uint64_t start_ns;           /* CLOCK_MONOTONIC when the server started */
+
+    /* Counters */
+    uint64_t poll_loops;         /* Iterations of the server polling loop */
+    uint64_t capture_buffers;    /* Capture buffers completed by the NFP */
+    uint64_t capture_packets;    /* Packets in completed capture buffers */
+    uint64_t capture_bytes;      /* DMAed for those packets, in 64B blocks */
+    uint64_t capture_stalls;     /* Polls with a completed buffer that no
+                                  * consumer could take */
+    uint64_t buffers_given;      /* Capture buffers given to the NFP */
+    uint64_t poll_ns;            /* Time in nfp_ipc_server_poll */
+    uint64_t recycle_ns;         /* Time recycling and publishing buffers */
+    uint64_t give_buffer_ns;     /* Time giving buffers to the NFP */
+
+    /* Gauges */
+    uint64_t buffers_total;      /* Capture buffers in shared memory */
+    uint64_t buffers_nfp;        /* Given to the NFP and not yet published */
+    uint64_t buffers_consumers;  /* Published to consumers, not yet returned */
+    uint64_t consumers_attached; /* Attached capture consumers */
+
+    /* Firmware counters */
+    uint64_t fw_update_ns;       /* CLOCK_MONOTONIC of the last scrape */
+    uint64_t fw_num_counters;    /* Valid entries of fw_counters */
+    struct pktgen_stats_fw_counter fw_counters[PKTGEN_STATS_MAX_FW_COUNTERS];
+
+    /* Capture sequence checks */
+    uint64_t seq_buf_gaps;       /* Gaps and restarts of the buffer sequence */
+    uint64_t seq_bufs_missing;   /* Buffers skipped by gaps, less late ones */
+    uint64_t seq_buf_reorders;   /* Buffers arriving late or twice */
+    uint64_t seq_pkt_gaps;       /* Gaps in the packet sequences */
+    uint64_t seq_pkts_missing;   /* Packets skipped by them, less late ones */
+    uint64_t seq_pkt_reorders;   /* Packets arriving late or twice */
+    struct pktgen_stats_seqr seq_seqrs[PKTGEN_STATS_SEQ_NUM_SEQRS];
+    uint64_t seq_num_ranges;     /* Gaps found; the most recent are first
+                                  * in seq_ranges */
+    struct pktgen_stats_seq_range seq_ranges[PKTGEN_STATS_SEQ_RANGES];
+};
+
+/* The body is the 64-bit words after the fixed header */
+#define PKTGEN_STATS_BODY_OFFSET offsetof(struct pktgen_stats, update_ns)
+
+/*a Functions
+ */
+/*f pktgen_stats_init */
+/**
+ * @brief Server: initialize a private statistics block
+ */
+static inline void
+pktgen_stats_init(struct pktgen_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->magic   = PKTGEN_STATS_MAGIC;
+    stats->version = PKTGEN_STATS_VERSION;
+    stats->size    = sizeof(*stats);
+}
+
+/*f pktgen_stats_publish */
+/**
+ * @brief Server: copy a private statistics block to the shared block;
+ * there must be only one server publishing to a shared block
+ *
+ * @param shared Block in shared memory
+ *
+ * @param stats  Private block to publish
+ *
+ */
+static inline void
+pktgen_stats_publish(struct pktgen_stats *shared, const struct pktgen_stats *stats)
+{
+    const uint64_t *src;
+    uint64_t *dst;
+    uint32_t seq;
+    size_t i;
+
+    seq = shared->seq;
+    if ((shared->magic != PKTGEN_STATS_MAGIC) || (seq & 1)) {
+        seq = 0;
+        __atomic_store_n(&shared->seq, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        shared->version = stats->version;
+        shared->size    = stats->size;
+        __atomic_store_n(&shared->magic, PKTGEN_STATS_MAGIC, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&shared->seq, seq+1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+    src = (const uint64_t *)(((const char *)stats) + PKTGEN_STATS_BODY_OFFSET);
+    dst = (uint64_t *)(((char *)shared) + PKTGEN_STATS_BODY_OFFSET);
+    for (i=0; i<(sizeof(*stats)-PKTGEN_STATS_BODY_OFFSET)/sizeof(uint64_t); i++) {
+        __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&shared->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+/*f pktgen_stats_read */
+/**
+ * @brief Reader: take a consistent snapshot of the shared block
+ *
+ * Fields the server does not fill (if it is older than the reader)
+ * are zero in the snapshot.
+ *
+ * @param shared Block in shared memory
+ *
+ * @param stats  Snapshot to fill
+ *
+ * @returns Zero on success, 1 if no server has published a block of
+ * this version, 2 if no consistent copy could be taken
+ *
+ */
+static inline int
+pktgen_stats_read(const struct pktgen_stats *shared, struct pktgen_stats *stats)
+{
+    const uint64_t *src;
+    uint64_t *dst;
+    uint32_t seq, seq_end;
+    size_t size;
+    size_t i;
+    int tries;
+
+    if ((__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != PKTGEN_STATS_MAGIC) ||
+        (shared->version != PKTGEN_STATS_VERSION))
+        return 1;
+    size = shared->size;
+    if (size > sizeof(*stats))
+        size = sizeof(*stats);
+    memset(stats, 0, sizeof(*stats));
+    src = (const uint64_t *)(((const char *)shared) + PKTGEN_STATS_BODY_OFFSET);
+    dst = (uint64_t *)(((char *)stats) + PKTGEN_STATS_BODY_OFFSET);
+    for (tries=0; tries<PKTGEN_STATS_READ_TRIES; tries++) {
+        if ((tries % PKTGEN_STATS_READ_SPINS) == PKTGEN_STATS_READ_SPINS-1)
+            sched_yield();
+        seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            __builtin_ia32_pause();
+            continue;
+        }
+        for (i=0; i<(size-PKTGEN_STATS_BODY_OFFSET)/sizeof(uint64_t); i++) {
+            dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq_end = __atomic_load_n(&shared->seq, __ATOMIC_RELAXED);
+        if (seq_end == seq) {
+            stats->magic   = PKTGEN_STATS_MAGIC;
+            stats->version = PKTGEN_STATS_VERSION;
+            stats->size    = size;
+            stats->seq     = seq;
+            return 0;
+        }
+    }
+    return 2;
+}
+
+/*a Close guard
+ */
+#endif /* _PKTGEN_STATS_H_ */
@@ -0,0 +1,228 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pktgen_stats_test.c
+ * @brief         Test for the pktgencap statistics sequence lock
+ *
+ * A writer thread publishes blocks whose body words all hold the same
+ * value, as fast as it can, while reader threads take snapshots; every
+ * snapshot must have all its words equal, and never go backwards.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "pktgen_stats.h"
+
+/*a Defines
+ */
+#define TEST_NUM_READERS 3
+#define TEST_PUBLISHES   2000000
+
+/*a Types
+ */
+/*t struct test_reader */
+struct test_reader {
+    const struct pktgen_stats *shared;
+    const int *stop;
+    pthread_t thread;
+    int      snapshots;
+    int      error;
+};
+
+/*a Useful functions
+ */
+/*f stats_fill */
+/**
+ * @brief Set every body word of a block to @p value
+ */
+static void
+stats_fill(struct pktgen_stats *stats, uint64_t value)
+{
+    uint64_t *words;
+    size_t i;
+
+    words = (uint64_t *)(((char *)stats) + PKTGEN_STATS_BODY_OFFSET);
+    for (i=0; i<(sizeof(*stats)-PKTGEN_STATS_BODY_OFFSET)/sizeof(uint64_t); i++)
+        words[i] = value;
+}
+
+/*f reader_thread */
+/**
+ * @brief Take snapshots until stopped, checking each is consistent
+ */
+static void *
+reader_thread(void *handle)
+{
+    struct test_reader *tr;
+    struct pktgen_stats stats;
+    uint64_t last;
+
+    tr = (struct test_reader *)handle;
+    last = 0;
+    while (!__atomic_load_n(tr->stop, __ATOMIC_ACQUIRE)) {
+        const uint64_t *words;
+        size_t i;
+
+        if (pktgen_stats_read(tr->shared, &stats) != 0) {
+            tr->error = 1;
+            break;
+        }
+        words = (const uint64_t *)(((const char *)&stats) + PKTGEN_STATS_BODY_OFFSET);
+        for (i=1; i<(sizeof(stats)-PKTGEN_STATS_BODY_OFFSET)/sizeof(uint64_t); i++) {
+            if (words[i] != words[0])
+                tr->error = 2;
+        }
+        if (words[0] < last)
+            tr->error = 3;
+        last = words[0];
+        tr->snapshots++;
+    }
+    return NULL;
+}
+
+/*a Tests
+ */
+/*f test_uninitialized */
+/**
+ * @brief A block that has never been published is not read
+ */
+static int
+test_uninitialized(void)
+{
+    struct pktgen_stats shared, stats;
+
+    memset(&shared, 0, sizeof(shared));
+    if (pktgen_stats_read(&shared, &stats) != 1)
+        return 1;
+    pktgen_stats_init(&stats);
+    stats_fill(&stats, 5);
+    pktgen_stats_publish(&shared, &stats);
+    if ((pktgen_stats_read(&shared, &stats) != 0) ||
+        (stats.update_ns != 5) || (stats.seq != 2))
+        return 2;
+    return 0;
+}
+
+/*f test_older_server */
+/**
+ * @brief Fields beyond the size a server fills read as zero
+ */
+static int
+test_older_server(void)
+{
+    struct pktgen_stats shared, stats;
+
+    pktgen_stats_init(&stats);
+    stats_fill(&stats, 7);
+    memset(&shared, 0, sizeof(shared));
+    pktgen_stats_publish(&shared, &stats);
+    shared.size = offsetof(struct pktgen_stats, buffers_total);
+    if (pktgen_stats_read(&shared, &stats) != 0)
+        return 1;
+    if ((stats.capture_packets != 7) || (stats.give_buffer_ns != 7) ||
+        (stats.buffers_total != 0) || (stats.consumers_attached != 0))
+        return 2;
+    return 0;
+}
+
+/*f test_concurrent */
+/**
+ * @brief Publish continuously with readers sampling concurrently
+ */
+static int
+test_concurrent(void)
+{
+    struct pktgen_stats *shared;
+    struct pktgen_stats stats;
+    struct test_reader tr[TEST_NUM_READERS];
+    int stop;
+    int err;
+    int i;
+
+    if (posix_memalign((void **)&shared, 64, sizeof(*shared)) != 0)
+        return 1;
+    memset(shared, 0, sizeof(*shared));
+    pktgen_stats_init(&stats);
+    stats_fill(&stats, 0);
+    pktgen_stats_publish(shared, &stats);
+
+    stop = 0;
+    for (i=0; i<TEST_NUM_READERS; i++) {
+        tr[i].shared    = shared;
+        tr[i].stop      = &stop;
+        tr[i].snapshots = 0;
+        tr[i].error     = 0;
+        pthread_create(&tr[i].thread, NULL, reader_thread, &tr[i]);
+    }
+    for (i=1; i<=TEST_PUBLISHES; i++) {
+        stats_fill(&stats, i);
+        pktgen_stats_publish(shared, &stats);
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    err = 0;
+    for (i=0; i<TEST_NUM_READERS; i++) {
+        pthread_join(tr[i].thread, NULL);
+        if (!err && tr[i].error)
+            err = 10+tr[i].error;
+        if (!err && (tr[i].snapshots == 0))
+            err = 20;
+    }
+    if (!err && (shared->seq != 2*(TEST_PUBLISHES+1)))
+        err = 30;
+    free(shared);
+    return err;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Unpublished block",test_uninitialized());
+    TEST_RUN("Block from an older server",test_older_server());
+    TEST_RUN("Concurrent publish and read",test_concurrent());
+    return failures;
+}
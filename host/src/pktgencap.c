@@ -24,12 +24,16 @@
 #include <stdint.h> 
 #include <string.h> 
 #include <inttypes.h>
+#include <time.h>
+#include <getopt.h>
 #include "nfp_support.h"
 #include "pktgen_mem.h"
 #include "nfp_ipc.h"
 #include "firmware/pktgen.h"
 #include "firmware/pcap.h"
 #include "pktgencap.h"
+#include "pcap_consumers.h"
+#include "nfp_stats.h"
 #include "timer.h"
 
 /** Defines
@@ -38,6 +42,13 @@
 #define PCIE_HUGEPAGE_SIZE (1<<20)
 #define MAX_NFP_IPC_CLIENTS 32
 #define PCAP_HOST_PHYS_ENTRIES 64
+#define PCAP_HOST_BUFFER_MEMORY (1<<20)
+#define PCAP_HOST_MIN_BUFFERS 4
+#define PKTGEN_STREAM_RING_BATCHES_LOG2 10
+#define PKTGEN_STREAM_RING_ENTRIES (PKTGEN_STREAM_BATCH_ENTRIES<<PKTGEN_STREAM_RING_BATCHES_LOG2)
+#define PKTGEN_STREAM_MAX_ENTRIES_PER_POLL 256
+#define PKTGEN_STATS_PUBLISH_US 250
+#define PKTGEN_STATS_FW_INTERVAL_NS (100*1000*1000)
 
 /** struct pcap_host_phys_buffer
  */
@@ -64,6 +75,8 @@ struct pktgen_nfp {
         t_sl_timer poll_pcap_buffer_recycle;
         /** a */
         t_sl_timer polling_loop;
+        /** Distribution of pcap_give_pcie_buffer times */
+        t_sl_hist pcap_give_pcie_buffer_hist;
     } timers;
     struct {
         /** a */
@@ -84,26 +97,64 @@ struct pktgen_nfp {
         uint32_t rptr;
         /** a */
         uint32_t ack;
+        /** a */
+        uint32_t tx_seq;
     } host;
     struct {
+        /** Schedule file being streamed, NULL if not streaming */
+        FILE *file;
+        /** MU address of stream ring, 0 if not allocated */
+        uint64_t ring_mu_base;
+        /** Number of entries written to the stream ring */
+        uint32_t wptr;
+        /** tx_seq of the first packet of the stream */
+        uint32_t base_seq;
+        /** Set if the firmware may still be running a stream */
+        int needs_ack;
+        /** Set once an ack has been issued behind a finished stream */
+        int ack_issued;
+    } stream;
+    struct {
+        /** Geometry of the buffers, given to the NFP before it starts */
+        struct pcap_buf_geometry geometry;
         /** a */
         int num_buffers;
         /** a */
         struct pcap_host_phys_buffer buffers[PCAP_HOST_PHYS_ENTRIES];
+        /** Virtual addresses of buffers, for the consumer fan-out */
+        void *virt_addrs[PCAP_HOST_PHYS_ENTRIES];
         /** a */
         int ring_wptr;
+        /** Buffers in flight and the consumers they are handed to */
+        struct pcap_consumers consumers;
+    } pcap;
+    struct {
+        /** Statistics, published to 'shared' */
+        struct pktgen_stats stats;
+        /** Statistics block in shared memory */
+        struct pktgen_stats *shared;
+        /** Timer clocks accumulated before the timers were last reset */
+        unsigned long long poll_clks;
         /** a */
-        int ring_entries;
-        /** a */
-        int ring_rptr;
+        unsigned long long recycle_clks;
         /** a */
-        int buffers_given[PCAP_HOST_CLS_RING_SIZE_ENTRIES];
-    } pcap;
+        unsigned long long give_buffer_clks;
+        /** Timestamp counter when the statistics were last published */
+        unsigned long long publish_clks;
+        /** Firmware counter scraping, NULL if there are no counters */
+        struct nfp_stats *fw;
+    } stats;
     struct pktgen_mem_layout *mem_layout;
 };
 
 /** Static variables
  */
+static const char *const pcap_stats_names[PCAP_STATS_NUM_COUNTERS] = {
+    PCAP_STATS_NAMES
+};
+static const struct nfp_stats_type pcap_stats_type = {
+    PCAP_STATS_SYMBOL, PCAP_STATS_NUM_COUNTERS, pcap_stats_names
+};
 static const char *shm_filename="/tmp/nfp_shm.lock";
 static int shm_key = 'x';
 
@@ -205,11 +256,16 @@ pktgen_load_nfp(struct pktgen_nfp *pktgen_nfp,
 }
 
 /** pktgen_alloc_shm
+ *
+ * Allocate the shared memory, with room for the capture buffers
  */
 static int
 pktgen_alloc_shm(struct pktgen_nfp *pktgen_nfp)
 {
-    pktgen_nfp->shm.size = PCIE_HUGEPAGE_SIZE * MAX_PAGES;
+    pktgen_nfp->shm.size = PKTGEN_PCAP_BUFFER_SHM(pktgen_nfp->pcap.geometry.buf_size_shift,
+                                                  pktgen_nfp->pcap.num_buffers);
+    if (pktgen_nfp->shm.size < PCIE_HUGEPAGE_SIZE * MAX_PAGES)
+        pktgen_nfp->shm.size = PCIE_HUGEPAGE_SIZE * MAX_PAGES;
     if (nfp_shm_alloc(pktgen_nfp->nfp,
                       shm_filename, shm_key,
                       pktgen_nfp->shm.size, 1)==0) {
@@ -272,9 +328,9 @@ pktgen_issue_cmd(struct pktgen_nfp *pktgen_nfp,
     return 0;
 }
 
-/** pktgen_issue_ack_and_wait
+/** pktgen_issue_ack
  * 
- * Issue an ack to the packet generator firmware and wait for it
+ * Issue an ack to the packet generator firmware, without waiting for it
  *
  * @param pktgen_nfp  Packet generator NFP structure
  *
@@ -282,63 +338,106 @@ pktgen_issue_cmd(struct pktgen_nfp *pktgen_nfp,
  *
  */
 static int
-pktgen_issue_ack_and_wait(struct pktgen_nfp *pktgen_nfp)
+pktgen_issue_ack(struct pktgen_nfp *pktgen_nfp)
 {
     struct pktgen_host_cmd host_cmd;
     host_cmd.ack_cmd.cmd_type = PKTGEN_HOST_CMD_ACK;
     host_cmd.ack_cmd.data     = ++pktgen_nfp->host.ack;
-    if (pktgen_issue_cmd(pktgen_nfp, &host_cmd) != 0)
+    return pktgen_issue_cmd(pktgen_nfp, &host_cmd);
+}
+
+/** pktgen_check_ack
+ * 
+ * Check if the firmware has returned the last ack issued
+ *
+ * @param pktgen_nfp  Packet generator NFP structure
+ * @param acked       Set to 1 if it has, else 0
+ *
+ * Returns 0 on success, non-zero on failure
+ *
+ */
+static int
+pktgen_check_ack(struct pktgen_nfp *pktgen_nfp, int *acked)
+{
+    uint32_t ack_data;
+    if (nfp_read(pktgen_nfp->nfp,
+                 &pktgen_nfp->pktgen_cls_host,
+                 offsetof(struct pktgen_cls_host, ack_data),
+                 (void *)&ack_data,
+                 sizeof(ack_data)) != 0)
+        return 1;
+    *acked = (ack_data == pktgen_nfp->host.ack);
+    return 0;
+}
+
+/** pktgen_issue_ack_and_wait
+ * 
+ * Issue an ack to the packet generator firmware and wait for it
+ *
+ * @param pktgen_nfp  Packet generator NFP structure
+ *
+ * Returns 0 on success, non-zero on failure
+ *
+ */
+static int
+pktgen_issue_ack_and_wait(struct pktgen_nfp *pktgen_nfp)
+{
+    if (pktgen_issue_ack(pktgen_nfp) != 0)
         return 1;
     for (;;) {
-        uint32_t ack_data;
-        if (nfp_read(pktgen_nfp->nfp,
-                     &pktgen_nfp->pktgen_cls_host,
-                     offsetof(struct pktgen_cls_host, ack_data),
-                     (void *)&ack_data,
-                     sizeof(ack_data)) != 0)
+        int acked;
+        if (pktgen_check_ack(pktgen_nfp, &acked) != 0)
             return 1;
-        if (ack_data == pktgen_nfp->host.ack)
+        if (acked)
             return 0;
         /* Backoff ?*/
     }
     return 1;
 }
 
-/** pcap_give_pcie_buffer
+/** pcap_give_pcie_buffers
+ *
+ * Give a batch of buffers to the NFP through the CLS ring, writing
+ * the ring entries with as few CPP writes as possible; the new ring
+ * write pointer is not committed to the NFP. The buffer numbers and
+ * ring space are checked by pcap_consumers_give.
  */
-static int pcap_give_pcie_buffer(struct pktgen_nfp *pktgen_nfp, int buffer)
+static int pcap_give_pcie_buffers(struct pktgen_nfp *pktgen_nfp, const int *buffers, int num)
 {
+    uint64_t phys_addrs[PCAP_HOST_CLS_RING_SIZE_ENTRIES];
     int ring_offset;
-    int err;
-    void *virt_addr;
-    uint64_t phys_addr;
+    int i;
 
     SL_TIMER_ENTRY(pktgen_nfp->timers.pcap_give_pcie_buffer);
-
-    if ((buffer<0) || (buffer>pktgen_nfp->pcap.num_buffers)) {
-        fprintf(stderr,"Attempt to add a buffer to the PCIe that is out of range\n");
-        return 1;
-    }
     ring_offset = pktgen_nfp->pcap.ring_wptr % (PCAP_HOST_CLS_RING_SIZE_ENTRIES);
+    for (i=0; i<num; i++) {
+        int buffer;
+        buffer = buffers[i];
+        memset(pktgen_nfp->pcap.buffers[buffer].virt_addr,0,
+               PCAP_BUF_MIN_FIRST_PKT_OFFSET(pktgen_nfp->pcap.geometry.max_pkts));
+        phys_addrs[i] = pktgen_nfp->pcap.buffers[buffer].phys_addr;
+    }
 
-    phys_addr = pktgen_nfp->pcap.buffers[buffer].phys_addr;
-    virt_addr = pktgen_nfp->pcap.buffers[buffer].virt_addr;
-    memset(virt_addr,0,sizeof(struct pcap_buffer));
-
-    err = nfp_write(pktgen_nfp->nfp,
-                    &pktgen_nfp->pcap_cls_ring,
-                    ring_offset*sizeof(phys_addr),
-                    (void *)&phys_addr, sizeof(phys_addr));
-
-    if (err)
-        return err;
-
-    pktgen_nfp->pcap.buffers_given[ring_offset] = buffer;
+    for (i=0; i<num;) {
+        int n;
+        int err;
+        n = PCAP_HOST_CLS_RING_SIZE_ENTRIES - ring_offset;
+        if (n > num-i)
+            n = num-i;
+        err = nfp_write(pktgen_nfp->nfp,
+                        &pktgen_nfp->pcap_cls_ring,
+                        ring_offset*sizeof(uint64_t),
+                        (void *)&phys_addrs[i], n*sizeof(uint64_t));
+        if (err)
+            return err;
+        i += n;
+        ring_offset = 0;
+    }
 
-    pktgen_nfp->pcap.ring_wptr++;
-    pktgen_nfp->pcap.ring_entries++;
+    pktgen_nfp->pcap.ring_wptr += num;
 
-    SL_TIMER_EXIT(pktgen_nfp->timers.pcap_give_pcie_buffer);
+    SL_TIMER_EXIT_HIST(pktgen_nfp->timers.pcap_give_pcie_buffer,
+                       pktgen_nfp->timers.pcap_give_pcie_buffer_hist);
     return 0;
 }
 
@@ -358,47 +457,332 @@ static int pcap_commit_pcie_buffers(struct pktgen_nfp *pktgen_nfp)
     return 0;
 }
 
-/** pcap_give_pcie_buffers
+/** pcap_give_and_commit_pcie_buffers
+ *
+ * Callback for the consumer fan-out to give a batch of buffers to the
+ * NFP, with a single commit
  */
-static int pcap_give_pcie_buffers(struct pktgen_nfp *pktgen_nfp)
+static int pcap_give_and_commit_pcie_buffers(void *handle, const int *buffers, int num)
 {
+    struct pktgen_nfp *pktgen_nfp;
     int err;
+
+    pktgen_nfp = (struct pktgen_nfp *)handle;
+    err = pcap_give_pcie_buffers(pktgen_nfp, buffers, num);
+    if (pcap_commit_pcie_buffers(pktgen_nfp) != 0)
+        err = 1;
+    return err;
+}
+
+/** pcap_set_geometry
+ *
+ * Set the capture buffer geometry and number of buffers; zero
+ * arguments select the defaults. The packets in a buffer default to
+ * PCAP_BUF_MAX_PKT scaled with the buffer size, or with a snaplen to
+ * as many packets truncated to it as fit, and the buffers to
+ * PCAP_HOST_BUFFER_MEMORY of them.
+ *
+ * Returns 0 on success, 1 if the geometry is not valid
+ */
+static int pcap_set_geometry(struct pktgen_nfp *pktgen_nfp, int buf_kb, int max_pkts, int num_buffers,
+                             int snaplen)
+{
+    struct pcap_buf_geometry default_geometry = PCAP_BUF_GEOMETRY_DEFAULT;
+    struct pcap_buf_geometry *geometry;
+    int shift;
+
+    geometry = &pktgen_nfp->pcap.geometry;
+    *geometry = default_geometry;
+    if ((snaplen < 0) || (snaplen > PCAP_BUF_SNAPLEN_MAX)) {
+        fprintf(stderr,"Capture snaplen must be 0 (whole packets) to %d\n", PCAP_BUF_SNAPLEN_MAX);
+        return 1;
+    }
+    if (buf_kb || max_pkts || snaplen) {
+        shift = PCAP_BUF_SIZE_SHIFT;
+        if (buf_kb) {
+            for (shift=10; (shift<31) && ((1<<(shift-10)) < buf_kb); shift++);
+            if ((1<<(shift-10)) != buf_kb) {
+                fprintf(stderr,"Capture buffer size must be a power of 2 kB\n");
+                return 1;
+            }
+        }
+        if ((max_pkts == 0) && snaplen) {
+            max_pkts = (((1ULL << shift) - PCAP_BUF_PKT_DESC_OFFSET) /
+                        ((((snaplen + 64 + 63) >> 6) << 6) + PCAP_PKT_BUF_DESC_SIZE));
+        } else if (max_pkts == 0) {
+            max_pkts = (((uint64_t)PCAP_BUF_MAX_PKT) << shift) >> PCAP_BUF_SIZE_SHIFT;
+        }
+        if (max_pkts > PCAP_BUF_MAX_PKTS_LIMIT)
+            max_pkts = PCAP_BUF_MAX_PKTS_LIMIT;
+        geometry->buf_size_shift   = shift;
+        geometry->max_pkts         = max_pkts;
+        geometry->first_pkt_offset = PCAP_BUF_MIN_FIRST_PKT_OFFSET(max_pkts);
+        geometry->snaplen          = snaplen;
+    }
+    if ((max_pkts < 0) ||
+        !PCAP_BUF_GEOMETRY_VALID(geometry->buf_size_shift,
+                                 geometry->max_pkts,
+                                 geometry->first_pkt_offset)) {
+        fprintf(stderr,"Capture buffers must be %dkB to %dkB, with 1 to %d packets and room for them\n",
+                1<<(PCAP_BUF_SIZE_SHIFT_MIN-10), 1<<(PCAP_BUF_SIZE_SHIFT_MAX-10),
+                PCAP_BUF_MAX_PKTS_LIMIT);
+        return 1;
+    }
+
+    if (num_buffers == 0) {
+        num_buffers = PCAP_HOST_BUFFER_MEMORY >> geometry->buf_size_shift;
+        if (num_buffers < PCAP_HOST_MIN_BUFFERS)
+            num_buffers = PCAP_HOST_MIN_BUFFERS;
+    }
+    if ((num_buffers < 1) ||
+        (num_buffers > PCAP_HOST_CLS_RING_SIZE_ENTRIES) ||
+        (num_buffers > PCAP_HOST_PHYS_ENTRIES)) {
+        fprintf(stderr,"Capture buffers must number 1 to %d\n",
+                (PCAP_HOST_PHYS_ENTRIES < PCAP_HOST_CLS_RING_SIZE_ENTRIES) ?
+                PCAP_HOST_PHYS_ENTRIES : PCAP_HOST_CLS_RING_SIZE_ENTRIES);
+        return 1;
+    }
+    pktgen_nfp->pcap.num_buffers = num_buffers;
+    return 0;
+}
+
+/** pcap_init_pcie_buffers
+ *
+ * Set up the capture buffers and consumer fan-out, give the buffer
+ * geometry to the NFP, and give all the buffers to the NFP
+ */
+static int pcap_init_pcie_buffers(struct pktgen_nfp *pktgen_nfp, int assign)
+{
+    int buffers[PCAP_HOST_PHYS_ENTRIES];
     int i;
     uint64_t offset;
     uint64_t phys_addr;
+    uint64_t buf_size;
 
-    pktgen_nfp->pcap.ring_wptr = 0;
-    pktgen_nfp->pcap.ring_rptr = 0;
-    pktgen_nfp->pcap.ring_entries = 0;
-    pktgen_nfp->pcap.num_buffers = (pktgen_nfp->shm.size - PCIE_HUGEPAGE_SIZE)>>18;
-
-    if (pktgen_nfp->pcap.num_buffers >= PCAP_HOST_CLS_RING_SIZE_ENTRIES) {
-        pktgen_nfp->pcap.num_buffers = PCAP_HOST_CLS_RING_SIZE_ENTRIES;
-    }
-    if (pktgen_nfp->pcap.num_buffers > PCAP_HOST_PHYS_ENTRIES) {
-        pktgen_nfp->pcap.num_buffers = PCAP_HOST_PHYS_ENTRIES;
+    if ((nfp_ipc_size() > PKTGEN_PCAP_SHM_OFFSET) ||
+        (PKTGEN_PCAP_SHM_OFFSET + sizeof(struct pktgen_pcap_shm) > 512*1024)) {
+        fprintf(stderr,"Pcap consumer rings overlap other shared memory\n");
+        return 1;
     }
 
+    pktgen_nfp->pcap.ring_wptr = 0;
+    buf_size = 1ULL << pktgen_nfp->pcap.geometry.buf_size_shift;
+
     for (i=0; i<pktgen_nfp->pcap.num_buffers; i++) {
-        offset = PCIE_HUGEPAGE_SIZE;
-        offset += i << 18;
+        offset = PKTGEN_PCAP_BUFFER_SHM(pktgen_nfp->pcap.geometry.buf_size_shift, i);
         phys_addr = nfp_huge_physical_address(pktgen_nfp->nfp,
                                               pktgen_nfp->shm.base,
                                               offset);
+        if (nfp_huge_physical_address(pktgen_nfp->nfp,
+                                      pktgen_nfp->shm.base,
+                                      offset + buf_size - 1) != phys_addr + buf_size - 1) {
+            fprintf(stderr,"Capture buffer %d is not physically contiguous; huge pages must be at least the buffer size\n",i);
+            return 1;
+        }
         pktgen_nfp->pcap.buffers[i].phys_addr = phys_addr;
         pktgen_nfp->pcap.buffers[i].virt_addr = pktgen_nfp->shm.base+offset;
+        pktgen_nfp->pcap.virt_addrs[i] = pktgen_nfp->shm.base+offset;
+        buffers[i] = i;
     }
 
-    for (i=0; i<pktgen_nfp->pcap.num_buffers; i++) {
-        err = pcap_give_pcie_buffer(pktgen_nfp, i);
-        if (err) break;
+    if (nfp_write(pktgen_nfp->nfp,
+                  &pktgen_nfp->pcap_cls_host,offsetof(struct pcap_cls_host,geometry),
+                  (void *)&pktgen_nfp->pcap.geometry,sizeof(pktgen_nfp->pcap.geometry)) != 0) {
+        fprintf(stderr,"Failed to write capture buffer geometry to NFP memory\n");
+        return 1;
     }
-    if (err) {
-        (void) pcap_commit_pcie_buffers(pktgen_nfp);
-        return err;
+
+    pcap_consumers_init(&pktgen_nfp->pcap.consumers,
+                        (struct pktgen_pcap_shm *)(pktgen_nfp->shm.base + PKTGEN_PCAP_SHM_OFFSET),
+                        &pktgen_nfp->pcap.geometry,
+                        pktgen_nfp->pcap.virt_addrs,
+                        pktgen_nfp->pcap.num_buffers,
+                        assign,
+                        pcap_give_and_commit_pcie_buffers,
+                        (void *)pktgen_nfp);
+    return pcap_consumers_give(&pktgen_nfp->pcap.consumers, buffers, pktgen_nfp->pcap.num_buffers);
+}
+
+/** monotonic_ns
+ */
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec)*1000*1000*1000 + ts.tv_nsec;
+}
+
+/** pktgen_stats_fw_read
+ *
+ * Read callback for the firmware counter scraping
+ */
+static int pktgen_stats_fw_read(void *handle, const struct nfp_cppid *cppid,
+                                void *data, size_t size)
+{
+    struct nfp_cppid read_cppid;
+    read_cppid = *cppid;
+    return nfp_read((struct nfp *)handle, &read_cppid, 0, data, size);
+}
+
+/** pktgen_stats_init_fw
+ *
+ * Find the firmware counter blocks; the statistics carry no firmware
+ * counters if there are none
+ */
+static int pktgen_stats_init_fw(struct pktgen_nfp *pktgen_nfp)
+{
+    int num_blocks;
+
+    pktgen_nfp->stats.fw = nfp_stats_create(pktgen_stats_fw_read,
+                                            pktgen_nfp->nfp,
+                                            PKTGEN_STATS_FW_INTERVAL_NS);
+    if (!pktgen_nfp->stats.fw)
+        return 1;
+    nfp_stats_add_type(pktgen_nfp->stats.fw, &pcap_stats_type);
+    num_blocks = nfp_find_rtsyms(pktgen_nfp->nfp, nfp_stats_add_symbol, pktgen_nfp->stats.fw);
+    if (num_blocks < 0) {
+        fprintf(stderr,"Failed to find firmware counter blocks\n");
+        return 1;
+    }
+    if (num_blocks == 0) {
+        nfp_stats_destroy(pktgen_nfp->stats.fw);
+        pktgen_nfp->stats.fw = NULL;
+        return 0;
     }
+    fprintf(stderr,"Scraping %d firmware counters from %d blocks in %d reads\n",
+            nfp_stats_num_counters(pktgen_nfp->stats.fw), num_blocks,
+            nfp_stats_num_reads(pktgen_nfp->stats.fw));
+    return 0;
+}
+
+/** pktgen_stats_update_fw
+ *
+ * Scrape the firmware counters, if due, into the statistics
+ */
+static void pktgen_stats_update_fw(struct pktgen_nfp *pktgen_nfp, uint64_t now_ns)
+{
+    struct pktgen_stats *stats;
+    const struct nfp_stats_counter *counter;
+    int i, num_counters;
+
+    if (!pktgen_nfp->stats.fw)
+        return;
+    if (nfp_stats_poll(pktgen_nfp->stats.fw, now_ns) <= 0)
+        return;
+    stats = &pktgen_nfp->stats.stats;
+    num_counters = nfp_stats_num_counters(pktgen_nfp->stats.fw);
+    if (num_counters > PKTGEN_STATS_MAX_FW_COUNTERS)
+        num_counters = PKTGEN_STATS_MAX_FW_COUNTERS;
+    for (i=0; i<num_counters; i++) {
+        counter = nfp_stats_counter(pktgen_nfp->stats.fw, i);
+        strncpy(stats->fw_counters[i].name, counter->name, PKTGEN_STATS_FW_NAME_LEN-1);
+        stats->fw_counters[i].total = counter->total;
+        stats->fw_counters[i].rate  = counter->rate;
+    }
+    stats->fw_num_counters = num_counters;
+    stats->fw_update_ns    = now_ns;
+}
 
-    return pcap_commit_pcie_buffers(pktgen_nfp);
+/** pktgen_stats_update_seq
+ *
+ * Copy the capture sequence check counters and most recent gap
+ * ranges into the statistics
+ */
+static void pktgen_stats_update_seq(struct pktgen_stats *stats, const struct pcap_seq_check *check)
+{
+    const struct pcap_seq_range *range;
+    int i;
+
+    stats->seq_buf_gaps     = check->stats.buf_gaps;
+    stats->seq_bufs_missing = check->stats.bufs_missing;
+    stats->seq_buf_reorders = check->stats.buf_reorders;
+    stats->seq_pkt_gaps     = check->stats.pkt_gaps;
+    stats->seq_pkts_missing = check->stats.pkts_missing;
+    stats->seq_pkt_reorders = check->stats.pkt_reorders;
+    for (i=0; (i<PKTGEN_STATS_SEQ_NUM_SEQRS) && (i<PCAP_PKT_NUM_SEQRS); i++) {
+        stats->seq_seqrs[i].gaps     = check->stats.seqr[i].gaps;
+        stats->seq_seqrs[i].missing  = check->stats.seqr[i].missing;
+        stats->seq_seqrs[i].reorders = check->stats.seqr[i].reorders;
+    }
+    stats->seq_num_ranges = check->num_ranges;
+    for (i=0; i<PKTGEN_STATS_SEQ_RANGES; i++) {
+        range = pcap_seq_check_range(check, i);
+        if (!range)
+            break;
+        stats->seq_ranges[i].kind    = range->kind;
+        stats->seq_ranges[i].seqr    = range->seqr;
+        stats->seq_ranges[i].buf_seq = range->buf_seq;
+        stats->seq_ranges[i].first   = range->first;
+        stats->seq_ranges[i].num     = range->num;
+    }
+}
+
+/** pktgen_stats_init_shm
+ *
+ * Initialize the statistics and publish them to the shared memory
+ */
+static int pktgen_stats_init_shm(struct pktgen_nfp *pktgen_nfp)
+{
+    if ((PKTGEN_PCAP_SHM_OFFSET + sizeof(struct pktgen_pcap_shm) > PKTGEN_STATS_SHM_OFFSET) ||
+        (PKTGEN_STATS_SHM_OFFSET + sizeof(struct pktgen_stats) > 512*1024)) {
+        fprintf(stderr,"Statistics block overlaps other shared memory\n");
+        return 1;
+    }
+    if (pktgen_stats_init_fw(pktgen_nfp) != 0)
+        return 1;
+    pktgen_nfp->stats.shared = (struct pktgen_stats *)(pktgen_nfp->shm.base + PKTGEN_STATS_SHM_OFFSET);
+    pktgen_stats_init(&pktgen_nfp->stats.stats);
+    pktgen_nfp->stats.stats.start_ns = monotonic_ns();
+    pktgen_nfp->stats.poll_clks = 0;
+    pktgen_nfp->stats.recycle_clks = 0;
+    pktgen_nfp->stats.give_buffer_clks = 0;
+    pktgen_nfp->stats.publish_clks = SL_TIMER_CPU_CLOCKS;
+    pktgen_nfp->stats.stats.update_ns = pktgen_nfp->stats.stats.start_ns;
+    pktgen_stats_publish(pktgen_nfp->stats.shared, &pktgen_nfp->stats.stats);
+    return 0;
+}
+
+/** pktgen_stats_update
+ *
+ * Fill in the statistics from the capture fan-out and timers, and
+ * publish them; called every poll, but only does so every
+ * PKTGEN_STATS_PUBLISH_US
+ */
+static void pktgen_stats_update(struct pktgen_nfp *pktgen_nfp)
+{
+    struct pktgen_stats *stats;
+    const struct pcap_consumers *pc;
+    unsigned long long now;
+    double ns_per_clk;
+
+    stats = &pktgen_nfp->stats.stats;
+    stats->poll_loops++;
+    now = SL_TIMER_CPU_CLOCKS;
+    if (now - pktgen_nfp->stats.publish_clks < SL_TIMER_x86_CLKS_PER_US*PKTGEN_STATS_PUBLISH_US)
+        return;
+    pktgen_nfp->stats.publish_clks = now;
+
+    pc = &pktgen_nfp->pcap.consumers;
+    ns_per_clk = 1000.0 / SL_TIMER_x86_CLKS_PER_US;
+    stats->update_ns          = monotonic_ns();
+    stats->capture_buffers    = pc->buffers_completed;
+    stats->capture_packets    = pc->packets_completed;
+    stats->capture_bytes      = pc->blocks_completed << 6;
+    stats->capture_stalls     = pc->stalls;
+    stats->buffers_given      = pc->buffers_given;
+    stats->poll_ns            = ns_per_clk * (pktgen_nfp->stats.poll_clks +
+                                              SL_TIMER_VALUE(pktgen_nfp->timers.nfp_ipc_server_poll));
+    stats->recycle_ns         = ns_per_clk * (pktgen_nfp->stats.recycle_clks +
+                                              SL_TIMER_VALUE(pktgen_nfp->timers.poll_pcap_buffer_recycle));
+    stats->give_buffer_ns     = ns_per_clk * (pktgen_nfp->stats.give_buffer_clks +
+                                              SL_TIMER_VALUE(pktgen_nfp->timers.pcap_give_pcie_buffer));
+    stats->buffers_total      = pc->num_buffers;
+    stats->buffers_nfp        = pc->num_inflight;
+    stats->buffers_consumers  = pc->num_buffers - pc->num_inflight;
+    stats->consumers_attached = pc->num_attached;
+    pktgen_stats_update_seq(stats, &pc->seq_check);
+    pktgen_stats_update_fw(pktgen_nfp, stats->update_ns);
+    pktgen_stats_publish(pktgen_nfp->stats.shared, stats);
 }
 
 /** pcap_dump_pcie_buffers
@@ -408,8 +792,8 @@ static void pcap_dump_pcie_buffers(struct pktgen_nfp *pktgen_nfp)
     int i;
     uint64_t phys_offset;
 
-    phys_offset = PCIE_HUGEPAGE_SIZE;
     for (i=0; i<pktgen_nfp->pcap.num_buffers; i++) {
+        phys_offset = PKTGEN_PCAP_BUFFER_SHM(pktgen_nfp->pcap.geometry.buf_size_shift, i);
         if (1) {
             uint64_t phys_addr;
             phys_addr = nfp_huge_physical_address(pktgen_nfp->nfp,
@@ -424,7 +808,7 @@ static void pcap_dump_pcie_buffers(struct pktgen_nfp *pktgen_nfp)
             int j;
             struct pcap_buffer *pcap_buffer;
             pcap_buffer = (struct pcap_buffer *)(pktgen_nfp->shm.base + phys_offset);
-            for (j=0; j<PCAP_BUF_MAX_PKT; j++) {
+            for (j=0; j<pktgen_nfp->pcap.geometry.max_pkts; j++) {
                 if (pcap_buffer->pkt_desc[j].offset==0)
                     break;
                 printf("%d: %04x %04x %08x\n",j,
@@ -435,7 +819,6 @@ static void pcap_dump_pcie_buffers(struct pktgen_nfp *pktgen_nfp)
                 mem_dump(((char *)pcap_buffer) + (pcap_buffer->pkt_desc[j].offset<<6), 64);
             }
         }
-        phys_offset += 1 << 18;
     }
 }
 
@@ -446,14 +829,14 @@ static void pcap_show_pcie_buffer_headers(struct pktgen_nfp *pktgen_nfp)
     int i;
     uint64_t phys_offset;
 
-    phys_offset = PCIE_HUGEPAGE_SIZE;
-    printf("PCIe pcap ring is %d entries long (wptr %d rptr %d)\n",
-           pktgen_nfp->pcap.ring_entries,
+    printf("PCIe pcap ring has %d buffers in flight (wptr %d, %d consumers attached)\n",
+           pktgen_nfp->pcap.consumers.num_inflight,
            pktgen_nfp->pcap.ring_wptr,
-           pktgen_nfp->pcap.ring_rptr
+           pktgen_nfp->pcap.consumers.num_attached
         );
     printf("Showing PCIe buffers (total %d)\n",pktgen_nfp->pcap.num_buffers);
     for (i=0; i<pktgen_nfp->pcap.num_buffers; i++) {
+        phys_offset = PKTGEN_PCAP_BUFFER_SHM(pktgen_nfp->pcap.geometry.buf_size_shift, i);
         if (1) {
             uint64_t phys_addr;
             phys_addr = nfp_huge_physical_address(pktgen_nfp->nfp,
@@ -464,7 +847,6 @@ static void pcap_show_pcie_buffer_headers(struct pktgen_nfp *pktgen_nfp)
         if (1) {
             mem_dump( pktgen_nfp->shm.base + phys_offset, 8192 );
         }
-        phys_offset += 1 << 18;
     }
 }
 
@@ -586,14 +968,330 @@ mem_load_callback(void *handle,
     return 0;
 }
 
+/** pktgen_emu_buffer0_mu_base
+ *
+ * Return the MU address of the pktgen_emu_buffer0 symbol
+ *
+ */
+static uint64_t
+pktgen_emu_buffer0_mu_base(struct pktgen_nfp *pktgen_nfp)
+{
+    uint64_t mu_base;
+    mu_base  = ((pktgen_nfp->pktgen_emu_buffer0.cpp_id&0xff)-20L) << 35;
+    mu_base |= pktgen_nfp->pktgen_emu_buffer0.addr;
+    return mu_base;
+}
+
+/** pktgen_stream_write_ctl
+ *
+ * Write the stream write pointer and end indication to the NFP
+ *
+ * Both are written together so the firmware cannot see the end of
+ * the stream without the final write pointer.
+ *
+ * Returns 0 on success, non-zero on failure
+ *
+ */
+static int
+pktgen_stream_write_ctl(struct pktgen_nfp *pktgen_nfp, int stream_end)
+{
+    uint32_t data[2];
+    data[0] = pktgen_nfp->stream.wptr;
+    data[1] = stream_end;
+    return nfp_write(pktgen_nfp->nfp,
+                     &pktgen_nfp->pktgen_cls_host,
+                     offsetof(struct pktgen_cls_host, stream_wptr),
+                     (void *)data, sizeof(data));
+}
+
+/** pktgen_stream_write_entries
+ *
+ * Write schedule entries to the stream ring at the current write
+ * pointer, wrapping at the end of the ring
+ *
+ * Returns 0 on success, non-zero on failure
+ *
+ */
+static int
+pktgen_stream_write_entries(struct pktgen_nfp *pktgen_nfp,
+                            struct pktgen_sched_entry *entries,
+                            int num_entries)
+{
+    uint64_t ring_ofs;
+
+    ring_ofs = pktgen_nfp->stream.ring_mu_base - pktgen_emu_buffer0_mu_base(pktgen_nfp);
+    while (num_entries > 0) {
+        int ring_index;
+        int n;
+        ring_index = pktgen_nfp->stream.wptr % PKTGEN_STREAM_RING_ENTRIES;
+        n = PKTGEN_STREAM_RING_ENTRIES - ring_index;
+        if (n > num_entries)
+            n = num_entries;
+        if (nfp_write(pktgen_nfp->nfp,
+                      &pktgen_nfp->pktgen_emu_buffer0,
+                      ring_ofs + ring_index*sizeof(*entries),
+                      (void *)entries, n*sizeof(*entries)) != 0)
+            return 1;
+        pktgen_nfp->stream.wptr += n;
+        entries += n;
+        num_entries -= n;
+    }
+    return 0;
+}
+
+/** pktgen_stream_drain
+ *
+ * Find when the firmware has finished with a stream whose file has
+ * ended, so that the generator may be reloaded
+ *
+ * @param pktgen_nfp  Packet generator NFP structure
+ *
+ * The firmware may still be reading the stream ring after the end of
+ * the file, so an ack is issued behind the stream; needs_ack is
+ * cleared once the firmware returns it.
+ *
+ * Returns 0 on success, non-zero on failure
+ *
+ */
+static int
+pktgen_stream_drain(struct pktgen_nfp *pktgen_nfp)
+{
+    int acked;
+
+    if (!pktgen_nfp->stream.ack_issued) {
+        if (pktgen_issue_ack(pktgen_nfp) != 0)
+            return 1;
+        pktgen_nfp->stream.ack_issued = 1;
+    }
+    if (pktgen_check_ack(pktgen_nfp, &acked) != 0)
+        return 1;
+    if (acked) {
+        pktgen_nfp->stream.needs_ack  = 0;
+        pktgen_nfp->stream.ack_issued = 0;
+    }
+    return 0;
+}
+
+/** pktgen_stream_poll
+ *
+ * Refill the stream ring from the schedule file, if streaming, or
+ * find when the firmware has finished with the last stream
+ *
+ * Ring entries are free once the packets they describe have been
+ * transmitted, as indicated by last_tx_seq. Entries are only written
+ * in whole batches until the end of the file, and at most
+ * PKTGEN_STREAM_MAX_ENTRIES_PER_POLL are written per call so that the
+ * IPC server continues to be polled.
+ *
+ * Returns 0 on success, non-zero on failure (which ends the stream)
+ *
+ */
+static int
+pktgen_stream_poll(struct pktgen_nfp *pktgen_nfp)
+{
+    struct pktgen_sched_entry entries[PKTGEN_STREAM_MAX_ENTRIES_PER_POLL];
+    uint32_t last_tx_seq;
+    int32_t consumed;
+    int space;
+    int n;
+    int stream_end;
+
+    if (pktgen_nfp->stream.file == NULL) {
+        if (pktgen_nfp->stream.needs_ack)
+            return pktgen_stream_drain(pktgen_nfp);
+        return 0;
+    }
+
+    if (nfp_read(pktgen_nfp->nfp,
+                 &pktgen_nfp->pktgen_cls_host,
+                 offsetof(struct pktgen_cls_host, last_tx_seq),
+                 (void *)&last_tx_seq, sizeof(last_tx_seq)) != 0)
+        goto error;
+
+    consumed = last_tx_seq - pktgen_nfp->stream.base_seq;
+    if (consumed < 0)
+        consumed = 0;
+    space = PKTGEN_STREAM_RING_ENTRIES - (pktgen_nfp->stream.wptr - consumed);
+    if (space > PKTGEN_STREAM_MAX_ENTRIES_PER_POLL)
+        space = PKTGEN_STREAM_MAX_ENTRIES_PER_POLL;
+    space &= ~(PKTGEN_STREAM_BATCH_ENTRIES-1);
+    if (space <= 0)
+        return 0;
+
+    n = fread(entries, sizeof(entries[0]), space, pktgen_nfp->stream.file);
+    stream_end = (n < space);
+    if (stream_end && ferror(pktgen_nfp->stream.file)) {
+        fprintf(stderr,"Failed to read schedule stream file\n");
+        goto error;
+    }
+    if (pktgen_mem_patch_sched_entries(pktgen_nfp->mem_layout, entries, n) != 0) {
+        fprintf(stderr,"Failed to patch streamed schedule entries\n");
+        goto error;
+    }
+    if (pktgen_stream_write_entries(pktgen_nfp, entries, n) != 0)
+        goto error;
+    if (pktgen_stream_write_ctl(pktgen_nfp, stream_end) != 0)
+        goto error;
+    if (stream_end) {
+        fclose(pktgen_nfp->stream.file);
+        pktgen_nfp->stream.file = NULL;
+        pktgen_nfp->host.tx_seq = pktgen_nfp->stream.base_seq + pktgen_nfp->stream.wptr;
+    }
+    return 0;
+
+error:
+    fclose(pktgen_nfp->stream.file);
+    pktgen_nfp->stream.file = NULL;
+    pktgen_nfp->host.tx_seq = pktgen_nfp->stream.base_seq + pktgen_nfp->stream.wptr;
+    (void) pktgen_stream_write_ctl(pktgen_nfp, 1);
+    return 1;
+}
+
+/** pktgen_stream_start
+ *
+ * Start streaming a schedule file through the stream ring
+ *
+ * @param pktgen_nfp  Packet generator NFP structure
+ * @param msg         Stream message with filename, base delay and time scale
+ *
+ * The ring is allocated from NFP memory on first use after a
+ * load. Any previous stream must have completed in the firmware
+ * before the stream write pointer can be reset, so an ack is waited
+ * for if required. The ring is then filled as far as possible before
+ * the stream command is issued.
+ *
+ * Returns 0 on success, non-zero on failure
+ *
+ */
+static int
+pktgen_stream_start(struct pktgen_nfp *pktgen_nfp,
+                    struct msg_stream *msg)
+{
+    struct pktgen_host_cmd host_cmd;
+
+    if (pktgen_nfp->stream.file != NULL) {
+        fprintf(stderr,"ERROR: Attempt to start a stream while one is in progress\n");
+        return 1;
+    }
+    if (pktgen_nfp->stream.needs_ack) {
+        if (pktgen_issue_ack_and_wait(pktgen_nfp) != 0)
+            return 1;
+        pktgen_nfp->stream.needs_ack  = 0;
+        pktgen_nfp->stream.ack_issued = 0;
+    }
+    if (pktgen_nfp->stream.ring_mu_base == 0) {
+        struct pktgen_mem_data data[1];
+        data[0].size = 0;
+        mem_alloc_callback(pktgen_nfp,
+                           PKTGEN_STREAM_RING_ENTRIES*sizeof(struct pktgen_sched_entry),
+                           0, 1, data);
+        if (data[0].size == 0) {
+            fprintf(stderr,"ERROR: Failed to allocate stream ring\n");
+            return 1;
+        }
+        pktgen_nfp->stream.ring_mu_base = ((uint64_t)data[0].mu_base_s8) << 8;
+    }
+
+    msg->filename[PKTGEN_IPC_FILENAME_LEN-1] = 0;
+    pktgen_nfp->stream.file = fopen(msg->filename, "r");
+    if (pktgen_nfp->stream.file == NULL) {
+        fprintf(stderr,"ERROR: Failed to open schedule stream file %s\n", msg->filename);
+        return 1;
+    }
+    if (fseek(pktgen_nfp->stream.file, 64, SEEK_SET) != 0)
+        goto error;
+
+    pktgen_nfp->stream.wptr = 0;
+    pktgen_nfp->stream.base_seq = pktgen_nfp->host.tx_seq;
+    pktgen_nfp->stream.needs_ack  = 1;
+    pktgen_nfp->stream.ack_issued = 0;
+    if (pktgen_stream_write_ctl(pktgen_nfp, 0) != 0)
+        goto error;
+    if (pktgen_stream_poll(pktgen_nfp) != 0)
+        goto error;
+
+    host_cmd.playback_cmd.cmd_type = PKTGEN_HOST_CMD_PLAYBACK;
+    host_cmd.playback_cmd.time_scale = msg->time_scale;
+    host_cmd.playback_cmd.loop_count = 1;
+    host_cmd.playback_cmd.loop_offset_lo = 0;
+    host_cmd.playback_cmd.loop_offset_hi = 0;
+    if (pktgen_issue_cmd(pktgen_nfp, &host_cmd) != 0)
+        goto error;
+
+    host_cmd.stream_cmd.cmd_type = PKTGEN_HOST_CMD_STREAM;
+    host_cmd.stream_cmd.ring_batches_log2 = PKTGEN_STREAM_RING_BATCHES_LOG2;
+    host_cmd.stream_cmd.base_delay = msg->base_delay;
+    host_cmd.stream_cmd.mu_base_s8 = pktgen_nfp->stream.ring_mu_base >> 8;
+    if (pktgen_issue_cmd(pktgen_nfp, &host_cmd) != 0)
+        goto error;
+    return 0;
+
+error:
+    /* The stream poll closes the file itself if it fails */
+    if (pktgen_nfp->stream.file != NULL) {
+        fclose(pktgen_nfp->stream.file);
+        pktgen_nfp->stream.file = NULL;
+    }
+    return 1;
+}
+
 /** Main
     For this we load the firmware and give it packets.
+
+    With '--hash' completed capture buffers are assigned to capture
+    consumers by a hash of their buffer sequence number, rather than
+    round-robin.
+
+    The capture buffers are 256kB of up to 1020 packets by default;
+    '--buf_kb' sets their size (64kB to 2MB, a power of 2), such as
+    2048 for small packets at line rate or 64 for low latency,
+    '--buf_pkts' the packets they may hold, and '--buffers' how many
+    there are. The NFP is given the geometry before it starts.
+
+    '--snaplen' captures only the first bytes of each packet, such as
+    128 for flow monitoring; the MU and PCIe copies are cut to match,
+    and the descriptors keep the original packet length.
  */
 extern int
 main(int argc, char **argv)
 {
+    static struct option long_options[] = {
+        {"hash",     no_argument,       0, 'H'},
+        {"buf_kb",   required_argument, 0, 'b'},
+        {"buf_pkts", required_argument, 0, 'p'},
+        {"buffers",  required_argument, 0, 'n'},
+        {"snaplen",  required_argument, 0, 's'},
+        {0, 0, 0, 0}
+    };
     struct pktgen_nfp pktgen_nfp;
     int pktgen_loaded;
+    int pcap_assign;
+    int buf_kb, buf_pkts, num_buffers, snaplen;
+
+    pcap_assign = PCAP_CONSUMERS_ASSIGN_ROUND_ROBIN;
+    buf_kb = 0;
+    buf_pkts = 0;
+    num_buffers = 0;
+    snaplen = 0;
+    for (;;) {
+        int c;
+        c = getopt_long(argc, argv, "Hb:p:n:s:", long_options, NULL);
+        if (c == -1)
+            break;
+        switch (c) {
+        case 'H': pcap_assign = PCAP_CONSUMERS_ASSIGN_HASH; break;
+        case 'b': buf_kb = atoi(optarg); break;
+        case 'p': buf_pkts = atoi(optarg); break;
+        case 'n': num_buffers = atoi(optarg); break;
+        case 's': snaplen = atoi(optarg); break;
+        default:
+            fprintf(stderr,"Usage: pktgencap [--hash] [--buf_kb <kB>] [--buf_pkts <n>] [--buffers <n>] [--snaplen <bytes>]\n");
+            return 1;
+        }
+    }
+    if (pcap_set_geometry(&pktgen_nfp, buf_kb, buf_pkts, num_buffers, snaplen) != 0) {
+        return 1;
+    }
 
     if (pktgen_load_nfp(&pktgen_nfp, 0, "firmware/nffw/pktgencap.nffw")!=0) {
         fprintf(stderr,"Failed to open and load up NFP with ME code\n");
@@ -609,17 +1307,29 @@ main(int argc, char **argv)
         return 4;
     }
 
-    if (pcap_give_pcie_buffers(&pktgen_nfp) != 0) {
+    if (pcap_init_pcie_buffers(&pktgen_nfp, pcap_assign) != 0) {
         fprintf(stderr,"Failed to give PCIe pcap buffers\n");
         return 4;
     }
 
+    if (pktgen_stats_init_shm(&pktgen_nfp) != 0) {
+        fprintf(stderr,"Failed to set up statistics\n");
+        return 4;
+    }
+
     if (nfp_fw_start(pktgen_nfp.nfp)<0) {
         fprintf(stderr,"Failed to start NFP firmware\n");
         return 4;
     }
 
     pktgen_loaded = 0;
+    pktgen_nfp.host.wptr = 0;
+    pktgen_nfp.host.ack = 0;
+    pktgen_nfp.host.tx_seq = 0;
+    pktgen_nfp.stream.file = NULL;
+    pktgen_nfp.stream.ring_mu_base = 0;
+    pktgen_nfp.stream.needs_ack = 0;
+    pktgen_nfp.stream.ack_issued = 0;
 
     struct nfp_ipc_server_desc nfp_ipc_server_desc;
     nfp_ipc_server_desc.max_clients = MAX_NFP_IPC_CLIENTS;
@@ -629,25 +1339,45 @@ main(int argc, char **argv)
     SL_TIMER_INIT(pktgen_nfp.timers.poll_pcap_buffer_recycle);
     SL_TIMER_INIT(pktgen_nfp.timers.pcap_give_pcie_buffer);
     SL_TIMER_INIT(pktgen_nfp.timers.polling_loop);
+    sl_hist_init(&pktgen_nfp.timers.pcap_give_pcie_buffer_hist);
     SL_TIMER_ENTRY(pktgen_nfp.timers.polling_loop);
     for (;;) {
         int poll;
         struct nfp_ipc_event event;
 
-        if (SL_TIMER_ELAPSED(pktgen_nfp.timers.polling_loop)>1000000000ULL) {
+        if (SL_TIMER_ELAPSED(pktgen_nfp.timers.polling_loop)>SL_TIMER_x86_CLKS_PER_US*1000000) {
             double total_time, poll_time, recycle_time, give_buffer_time;
+            const t_sl_hist *give_buffer_hist;
             SL_TIMER_EXIT(pktgen_nfp.timers.polling_loop);
             total_time = SL_TIMER_VALUE_US(pktgen_nfp.timers.polling_loop);
             poll_time = SL_TIMER_VALUE_US(pktgen_nfp.timers.nfp_ipc_server_poll);
             recycle_time = SL_TIMER_VALUE_US(pktgen_nfp.timers.poll_pcap_buffer_recycle);
             give_buffer_time = SL_TIMER_VALUE_US(pktgen_nfp.timers.pcap_give_pcie_buffer);
             fprintf(stderr,"Polled for %lf poll time %lf recycle time %lf give buffer time %lf\n", total_time, poll_time, recycle_time, give_buffer_time );
+            give_buffer_hist = &pktgen_nfp.timers.pcap_give_pcie_buffer_hist;
+            if (give_buffer_hist->count > 0) {
+                fprintf(stderr,"Give buffer %llu times p50 %lf p99 %lf max %lf\n",
+                        give_buffer_hist->count,
+                        SL_TIMER_US_FROM_CLKS(sl_hist_percentile(give_buffer_hist, 0.5)),
+                        SL_TIMER_US_FROM_CLKS(sl_hist_percentile(give_buffer_hist, 0.99)),
+                        SL_TIMER_US_FROM_CLKS(give_buffer_hist->max));
+            }
+            sl_hist_init(&pktgen_nfp.timers.pcap_give_pcie_buffer_hist);
+            pktgen_nfp.stats.poll_clks += SL_TIMER_VALUE(pktgen_nfp.timers.nfp_ipc_server_poll);
+            pktgen_nfp.stats.recycle_clks += SL_TIMER_VALUE(pktgen_nfp.timers.poll_pcap_buffer_recycle);
+            pktgen_nfp.stats.give_buffer_clks += SL_TIMER_VALUE(pktgen_nfp.timers.pcap_give_pcie_buffer);
             SL_TIMER_INIT(pktgen_nfp.timers.nfp_ipc_server_poll);
             SL_TIMER_INIT(pktgen_nfp.timers.poll_pcap_buffer_recycle);
             SL_TIMER_INIT(pktgen_nfp.timers.pcap_give_pcie_buffer);
             SL_TIMER_INIT(pktgen_nfp.timers.polling_loop);
             SL_TIMER_ENTRY(pktgen_nfp.timers.polling_loop);
         }
+        (void) pktgen_stream_poll(&pktgen_nfp);
+        SL_TIMER_ENTRY(pktgen_nfp.timers.poll_pcap_buffer_recycle);
+        (void) pcap_consumers_poll(&pktgen_nfp.pcap.consumers);
+        SL_TIMER_EXIT(pktgen_nfp.timers.poll_pcap_buffer_recycle);
+        pktgen_stats_update(&pktgen_nfp);
+
         SL_TIMER_ENTRY(pktgen_nfp.timers.nfp_ipc_server_poll);
         poll = nfp_ipc_server_poll(pktgen_nfp.shm.nfp_ipc, 0, &event);
         SL_TIMER_EXIT(pktgen_nfp.timers.nfp_ipc_server_poll);
@@ -663,31 +1393,64 @@ main(int argc, char **argv)
                 nfp_ipc_server_send_msg(pktgen_nfp.shm.nfp_ipc, event.client, event.msg);
                 break;
             } else if (msg->reason == PKTGEN_IPC_LOAD) {
-                pktgen_loaded = 0;
-                emem0_base  = ((pktgen_nfp.pktgen_emu_buffer0.cpp_id&0xff)-20L) << 35;
-                emem0_base |= pktgen_nfp.pktgen_emu_buffer0.addr;
-                if (pktgen_mem_open_directory(pktgen_nfp.mem_layout,
-                                              "../pktgen_data/") != 0) {
-                    fprintf(stderr,"ERROR: Failed to load packet generation data\n");
-                    msg->ack = -2;
-                } else if (pktgen_mem_load(pktgen_nfp.mem_layout) != 0) {
-                    fprintf(stderr,"ERROR: Failed to load generator memory\n");
-                    msg->ack = -3;
+                if (pktgen_nfp.stream.file != NULL) {
+                    fprintf(stderr,"ERROR: Attempt to load while streaming\n");
+                    msg->ack = -4;
+                } else if (pktgen_nfp.stream.needs_ack) {
+                    fprintf(stderr,"ERROR: Attempt to load while a stream is finishing\n");
+                    msg->ack = -4;
                 } else {
-                    pktgen_loaded = 1;
+                    pktgen_loaded = 0;
+                    emem0_base = pktgen_emu_buffer0_mu_base(&pktgen_nfp);
+                    pktgen_nfp.stream.ring_mu_base = 0;
+                    if (pktgen_mem_open_directory(pktgen_nfp.mem_layout,
+                                                  "../pktgen_data/") != 0) {
+                        fprintf(stderr,"ERROR: Failed to load packet generation data\n");
+                        msg->ack = -2;
+                    } else if (pktgen_mem_load(pktgen_nfp.mem_layout) != 0) {
+                        fprintf(stderr,"ERROR: Failed to load generator memory\n");
+                        msg->ack = -3;
+                    } else {
+                        pktgen_loaded = 1;
+                    }
                 }
             } else if (msg->reason == PKTGEN_IPC_HOST_CMD) {
                 if (!pktgen_loaded) {
                     fprintf(stderr,"ERROR: Attempt to generate packets when not loaded\n");
                     msg->ack = -2;
                 } else {
-                    msg->ack = 1;
                     struct pktgen_host_cmd host_cmd;
-                    host_cmd.pkt_cmd.cmd_type = PKTGEN_HOST_CMD_PKT;
-                    host_cmd.pkt_cmd.base_delay = msg->generate.base_delay;
-                    host_cmd.pkt_cmd.total_pkts = msg->generate.total_pkts;
-                    host_cmd.pkt_cmd.mu_base_s8 = pktgen_mem_get_mu(pktgen_nfp.mem_layout,0,0)>>8;
-                    (void) pktgen_issue_cmd(&pktgen_nfp, &host_cmd);
+                    host_cmd.playback_cmd.cmd_type = PKTGEN_HOST_CMD_PLAYBACK;
+                    host_cmd.playback_cmd.time_scale = msg->generate.time_scale;
+                    host_cmd.playback_cmd.loop_count = msg->generate.loop_count;
+                    host_cmd.playback_cmd.loop_offset_lo = msg->generate.loop_offset;
+                    host_cmd.playback_cmd.loop_offset_hi = msg->generate.loop_offset >> 32;
+                    if (pktgen_issue_cmd(&pktgen_nfp, &host_cmd) != 0) {
+                        fprintf(stderr,"ERROR: Failed to issue playback command\n");
+                        msg->ack = -3;
+                    } else {
+                        host_cmd.pkt_cmd.cmd_type = PKTGEN_HOST_CMD_PKT;
+                        host_cmd.pkt_cmd.base_delay = msg->generate.base_delay;
+                        host_cmd.pkt_cmd.total_pkts = msg->generate.total_pkts;
+                        host_cmd.pkt_cmd.mu_base_s8 = pktgen_mem_get_mu(pktgen_nfp.mem_layout,0,0)>>8;
+                        if (pktgen_issue_cmd(&pktgen_nfp, &host_cmd) != 0) {
+                            fprintf(stderr,"ERROR: Failed to issue packet command\n");
+                            msg->ack = -4;
+                        } else {
+                            pktgen_nfp.host.tx_seq += (msg->generate.total_pkts *
+                                                       ((msg->generate.loop_count==0) ? 1 : msg->generate.loop_count));
+                            msg->ack = 1;
+                        }
+                    }
+                }
+            } else if (msg->reason == PKTGEN_IPC_STREAM) {
+                if (!pktgen_loaded) {
+                    fprintf(stderr,"ERROR: Attempt to stream packets when not loaded\n");
+                    msg->ack = -2;
+                } else if (pktgen_stream_start(&pktgen_nfp, &msg->stream) != 0) {
+                    msg->ack = -3;
+                } else {
+                    msg->ack = 1;
                 }
             } else if (msg->reason == PKTGEN_IPC_DUMP_BUFFERS) {
                 pcap_dump_pcie_buffers(&pktgen_nfp);
@@ -695,34 +1458,20 @@ main(int argc, char **argv)
             } else if (msg->reason == PKTGEN_IPC_SHOW_BUFFER_HEADERS) {
                 pcap_show_pcie_buffer_headers(&pktgen_nfp);
                 msg->ack = 1;
-            } else if (msg->reason == PKTGEN_IPC_RETURN_BUFFERS) {
-                int i;
-                SL_TIMER_ENTRY(pktgen_nfp.timers.poll_pcap_buffer_recycle);
-                if (msg->return_buffers.buffers[0]>=0) {
-                    pcap_give_pcie_buffer(&pktgen_nfp,msg->return_buffers.buffers[0]);
-                    if (msg->return_buffers.buffers[1]>=0) {
-                        pcap_give_pcie_buffer(&pktgen_nfp,msg->return_buffers.buffers[1]);
-                    }
-                    pcap_commit_pcie_buffers(&pktgen_nfp);
-                }
-                msg->return_buffers.buffers[0] = -1;
-                msg->return_buffers.buffers[1] = -1;
-                for (i=0; (i<msg->return_buffers.buffers_to_claim) && (i<1); i++) {
-                    int ring_offset;
-                    if (pktgen_nfp.pcap.ring_entries>0) {
-                        ring_offset = pktgen_nfp.pcap.ring_rptr;
-                        msg->return_buffers.buffers[i] = pktgen_nfp.pcap.buffers_given[ring_offset];
-                        ring_offset = (ring_offset+1) % (PCAP_HOST_CLS_RING_SIZE/sizeof(uint64_t));
-                        pktgen_nfp.pcap.ring_rptr = ring_offset;
-                        pktgen_nfp.pcap.ring_entries--;
-                    }
+            } else if (msg->reason == PKTGEN_IPC_PCAP_ATTACH) {
+                msg->pcap_consumer.consumer = pcap_consumers_attach(&pktgen_nfp.pcap.consumers);
+                msg->ack = (msg->pcap_consumer.consumer < 0) ? -2 : 1;
+            } else if (msg->reason == PKTGEN_IPC_PCAP_DETACH) {
+                if (pcap_consumers_detach(&pktgen_nfp.pcap.consumers,
+                                          msg->pcap_consumer.consumer) != 0) {
+                    msg->ack = -2;
+                } else {
+                    msg->ack = 1;
                 }
-                msg->ack = 1;
             } else {
                 msg->ack = -1;
             }
             nfp_ipc_server_send_msg(pktgen_nfp.shm.nfp_ipc, event.client, event.msg);
-            SL_TIMER_EXIT(pktgen_nfp.timers.poll_pcap_buffer_recycle);
         }
     }
 
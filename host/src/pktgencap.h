@@ -37,9 +37,17 @@
  * 
  */
 
+/** Open guard
+ */
+#ifndef _PKTGENCAP_H_
+#define _PKTGENCAP_H_
+
 /** Includes
  */
 #include <stdint.h> 
+#include "firmware/pcap.h"
+#include "pcap_ring.h"
+#include "pktgen_stats.h"
 
 /** PKTGEN_IPC_*
  */
@@ -48,22 +56,93 @@ enum {
     PKTGEN_IPC_HOST_CMD,
     PKTGEN_IPC_DUMP_BUFFERS,
     PKTGEN_IPC_LOAD,
-    PKTGEN_IPC_RETURN_BUFFERS,
+    PKTGEN_IPC_PCAP_ATTACH,
     PKTGEN_IPC_SHOW_BUFFER_HEADERS,
+    PKTGEN_IPC_STREAM,
+    PKTGEN_IPC_PCAP_DETACH,
 };
 
+/** PKTGEN_IPC_FILENAME_LEN
+ */
+#define PKTGEN_IPC_FILENAME_LEN 256
+
 /** struct msg_generate
+ *
+ * time_scale is PKTGEN_TIME_SCALE_ONE for real-time playback (0 is
+ * treated as real-time); the schedule is played loop_count times,
+ * each loop starting loop_offset (schedule time units) after the
+ * previous loop
  */
 struct msg_generate {
     uint64_t base_delay;
     int      total_pkts;
+    uint32_t time_scale;
+    uint32_t loop_count;
+    uint64_t loop_offset;
 };
 
-/** struct msg_return_buffers
+/** struct msg_stream
+ *
+ * Stream a schedule file (in the same format as a loaded schedule,
+ * with packet data already loaded) through a ring in NFP memory
  */
-struct msg_return_buffers {
-    int buffers_to_claim;
-    int buffers[2];
+struct msg_stream {
+    uint64_t base_delay;
+    uint32_t time_scale;
+    char     filename[PKTGEN_IPC_FILENAME_LEN];
+};
+
+/** PKTGEN_PCAP_*
+ *
+ * The capture consumer rings are at PKTGEN_PCAP_SHM_OFFSET in the
+ * pktgencap shared memory, after the NFP IPC structure, and its
+ * live statistics block (struct pktgen_stats) is at
+ * PKTGEN_STATS_SHM_OFFSET; capture buffer i is at
+ * PKTGEN_PCAP_BUFFER_SHM(buf_size_shift,i), from
+ * PKTGEN_PCAP_BUFFER_SHM_OFFSET or the buffer size if larger, so that
+ * every buffer is aligned to its size
+ */
+#define PKTGEN_PCAP_SHM_OFFSET        (256*1024)
+#define PKTGEN_STATS_SHM_OFFSET       (384*1024)
+#define PKTGEN_PCAP_BUFFER_SHM_OFFSET (1<<20)
+#define PKTGEN_PCAP_MAX_CONSUMERS     8
+
+#define PKTGEN_PCAP_BUFFER_SHM(buf_size_shift,i)                        \
+    ((((1ULL<<(buf_size_shift)) > PKTGEN_PCAP_BUFFER_SHM_OFFSET) ?      \
+      (1ULL<<(buf_size_shift)) : PKTGEN_PCAP_BUFFER_SHM_OFFSET) +       \
+     (((uint64_t)(i))<<(buf_size_shift)))
+
+/** struct pktgen_pcap_consumer
+ *
+ * Rings for one capture consumer. pktgencap pushes the indices of
+ * completed capture buffers to 'completed', in the order the NFP
+ * fills them; the consumer pushes the indices of buffers it has
+ * finished with to 'returned', and pktgencap gives them back to the
+ * NFP in batches.
+ */
+struct pktgen_pcap_consumer {
+    struct pcap_ring completed;
+    struct pcap_ring returned;
+};
+
+/** struct pktgen_pcap_shm
+ *
+ * The buffer geometry is that given to the NFP, so consumers find
+ * the buffers and their packets with it
+ */
+struct pktgen_pcap_shm {
+    struct pktgen_pcap_consumer consumers[PKTGEN_PCAP_MAX_CONSUMERS];
+    struct pcap_buf_geometry geometry;
+};
+
+/** struct msg_pcap_consumer
+ *
+ * PKTGEN_IPC_PCAP_ATTACH returns the consumer number to use; a
+ * consumer must return all the buffers it has taken from its
+ * 'completed' ring before PKTGEN_IPC_PCAP_DETACH
+ */
+struct msg_pcap_consumer {
+    int consumer;
 };
 
 /** struct pktgen_ipc_msg
@@ -74,6 +153,11 @@ struct pktgen_ipc_msg {
     int ack;/**< ack */
     union /** fred */ { /** union */
         struct msg_generate generate;/** generate */
-        struct msg_return_buffers return_buffers;/** return_buffers */
+        struct msg_stream stream;/** stream */
+        struct msg_pcap_consumer pcap_consumer;/** pcap_consumer */
     };/**< union */
 };
+
+/** Close guard
+ */
+#endif /* _PKTGENCAP_H_ */
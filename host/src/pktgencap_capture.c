@@ -0,0 +1,334 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pktgencap_capture.c
+ * @brief         Packet capture client writing pcap/pcapng files
+ *
+ * Attaches to pktgencap as a capture consumer, takes completed capture
+ * buffers in bulk from its completed ring in shared memory, hands them
+ * to a pcap_writer and pushes them straight back on its returned ring.
+ * A filter expression (or 'tcpdump -ddd' program) limits the packets
+ * recorded to those it accepts.
+ *
+ */
+
+/** Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "nfp_support.h"
+#include "nfp_ipc.h"
+#include "pktgencap.h"
+#include "pcap_writer.h"
+#include "pcap_filter.h"
+#include "firmware/pcap.h"
+
+/** Defines
+ */
+#define BUFFER_POLL_INTERVAL_US 10
+#define CAPTURE_BATCH 16
+
+/** struct pktgen_nfp
+ */
+struct pktgen_nfp {
+    struct nfp *nfp;
+    struct {
+        /** base */
+        char *base;
+        /** size */
+        size_t size;
+        /** nfp_ipc **/
+        struct nfp_ipc *nfp_ipc;
+    } shm;
+};
+
+/** Static variables
+ */
+static const char *shm_filename="/tmp/nfp_shm.lock";
+static int shm_key = 'x';
+static volatile sig_atomic_t stop_capture;
+
+/** usage
+ */
+static void
+usage(void)
+{
+    printf("Usage: pktgencap_capture [options] <file>\n"
+           "  Capture packets from pktgencap into a pcap file\n"
+           "Options:\n"
+           "    -g          write pcapng rather than pcap\n"
+           "    -b <n>      stop after <n> capture buffers\n"
+           "    -s <len>    snapshot length\n"
+           "    -B          use buffered rather than O_DIRECT writes\n"
+           "    -f <expr>   record only packets matching a filter expression\n"
+           "    -F <file>   record only packets matching 'tcpdump -ddd' output\n"
+           "    -t <n>      run the filter on <n> worker threads as well\n"
+        );
+}
+
+/** handle_sigint
+ */
+static void
+handle_sigint(int sig)
+{
+    stop_capture = 1;
+}
+
+/** pktgen_alloc_shm
+ */
+static int
+pktgen_alloc_shm(struct pktgen_nfp *pktgen_nfp)
+{
+    pktgen_nfp->shm.size = nfp_shm_alloc(pktgen_nfp->nfp,
+                                         shm_filename, shm_key,
+                                         pktgen_nfp->shm.size, 0);
+    if (pktgen_nfp->shm.size == 0) {
+        fprintf(stderr,"Failed to find NFP SHM\n");
+        return -1;
+    }
+
+    pktgen_nfp->shm.base = nfp_shm_data(pktgen_nfp->nfp);
+    pktgen_nfp->shm.nfp_ipc = (struct nfp_ipc *)pktgen_nfp->shm.base;
+    return 0;
+}
+
+/** pcap_consumer_msg
+ *
+ * Send a PKTGEN_IPC_PCAP_ATTACH or _DETACH message and wait for the
+ * response; returns the consumer number from the response, or -1 on
+ * error or server shutdown
+ */
+static int
+pcap_consumer_msg(struct pktgen_nfp *pktgen_nfp, int client, int reason, int consumer)
+{
+    struct pktgen_ipc_msg *pktgen_msg;
+    struct nfp_ipc_msg *msg;
+    struct nfp_ipc_event event;
+
+    msg = nfp_ipc_msg_alloc(pktgen_nfp->shm.nfp_ipc, sizeof(struct pktgen_ipc_msg));
+    if (!msg)
+        return -1;
+    pktgen_msg = (struct pktgen_ipc_msg *)(&msg->data[0]);
+    pktgen_msg->reason = reason;
+    pktgen_msg->ack = 0;
+    pktgen_msg->pcap_consumer.consumer = consumer;
+    nfp_ipc_client_send_msg(pktgen_nfp->shm.nfp_ipc, client, msg);
+
+    for (;;) {
+        int poll;
+        poll = nfp_ipc_client_poll(pktgen_nfp->shm.nfp_ipc, client, 1000*1000, &event);
+        if (poll==NFP_IPC_EVENT_SHUTDOWN)
+            return -1;
+        if (poll==NFP_IPC_EVENT_MESSAGE)
+            break;
+    }
+    pktgen_msg = (struct pktgen_ipc_msg *)&event.msg->data[0];
+    consumer = pktgen_msg->pcap_consumer.consumer;
+    if (pktgen_msg->ack < 0)
+        consumer = -1;
+    nfp_ipc_msg_free(pktgen_nfp->shm.nfp_ipc, event.msg);
+    return consumer;
+}
+
+/** filter_setup
+ *
+ * Compile a filter expression, or load a filter from a file of
+ * 'tcpdump -ddd' output; returns zero on success
+ */
+static int
+filter_setup(struct pcap_filter *filter, const char *expression, const char *filename)
+{
+    char error[256];
+    char *text;
+    FILE *f;
+    long size;
+    int err;
+
+    if (expression) {
+        if (pcap_filter_compile(filter, expression, error, sizeof(error)) != 0) {
+            fprintf(stderr, "Bad filter '%s': %s\n", expression, error);
+            return 1;
+        }
+        return 0;
+    }
+    f = fopen(filename, "r");
+    if (!f) {
+        fprintf(stderr, "Failed to open filter file '%s'\n", filename);
+        return 1;
+    }
+    err = 1;
+    text = NULL;
+    if ((fseek(f, 0, SEEK_END) == 0) && ((size = ftell(f)) >= 0) &&
+        (fseek(f, 0, SEEK_SET) == 0) && ((text = malloc(size+1)) != NULL) &&
+        (fread(text, 1, size, f) == size)) {
+        text[size] = 0;
+        err = pcap_filter_load(filter, text);
+    }
+    if (err)
+        fprintf(stderr, "Bad filter program in '%s'\n", filename);
+    free(text);
+    fclose(f);
+    return err;
+}
+
+/** timestamp_ns
+ */
+static uint64_t
+timestamp_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+
+/** Main
+ */
+extern int
+main(int argc, char **argv)
+{
+    struct pktgen_nfp pktgen_nfp;
+    struct nfp_ipc_client_desc nfp_ipc_client_desc;
+    struct pcap_writer_desc writer_desc;
+    struct pcap_writer_stats stats;
+    struct pcap_writer *writer;
+    struct pcap_filter filter = {0, NULL};
+    const char *filter_expression;
+    const char *filter_filename;
+    struct pktgen_pcap_shm *pcap_shm;
+    struct pktgen_pcap_consumer *rings;
+    int nfp_ipc_client;
+    int consumer;
+    int max_buffers;
+    int num_buffers;
+    int opt;
+    int err;
+
+    memset(&writer_desc, 0, sizeof(writer_desc));
+    writer_desc.format = PCAP_WRITER_FORMAT_PCAP;
+    writer_desc.flags  = PCAP_WRITER_FLAG_DIRECT_IO;
+    max_buffers = -1;
+    filter_expression = NULL;
+    filter_filename = NULL;
+    while ((opt = getopt(argc, argv, "gb:s:Bf:F:t:h")) != -1) {
+        switch (opt) {
+        case 'g': writer_desc.format = PCAP_WRITER_FORMAT_PCAPNG; break;
+        case 'b': max_buffers = atoi(optarg); break;
+        case 's': writer_desc.snaplen = strtoul(optarg, NULL, 0); break;
+        case 'B': writer_desc.flags &= ~PCAP_WRITER_FLAG_DIRECT_IO; break;
+        case 'f': filter_expression = optarg; break;
+        case 'F': filter_filename = optarg; break;
+        case 't': writer_desc.filter_threads = atoi(optarg); break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (optind+1 != argc) {
+        usage();
+        return 1;
+    }
+    writer_desc.filename = argv[optind];
+    if (filter_expression || filter_filename) {
+        if (filter_setup(&filter, filter_expression, filter_filename) != 0)
+            return 1;
+        writer_desc.filter = &filter;
+    }
+
+    pktgen_nfp.nfp = nfp_init(-1,0);
+    pktgen_nfp.shm.size = 0;
+    if (pktgen_alloc_shm(&pktgen_nfp)<0) {
+        fprintf(stderr, "Failed to find pktgencap shared memory\n");
+        return 1;
+    }
+
+    nfp_ipc_client_desc.name = "pktgencap_capture";
+    nfp_ipc_client = nfp_ipc_client_start(pktgen_nfp.shm.nfp_ipc, &nfp_ipc_client_desc);
+    if (nfp_ipc_client < 0) {
+        fprintf(stderr, "Failed to connect to pktgen SHM\n");
+        return 1;
+    }
+
+    pcap_shm = (struct pktgen_pcap_shm *)(pktgen_nfp.shm.base + PKTGEN_PCAP_SHM_OFFSET);
+    writer_desc.geometry = pcap_shm->geometry;
+    writer = pcap_writer_open(&writer_desc);
+    if (!writer) {
+        nfp_ipc_client_stop(pktgen_nfp.shm.nfp_ipc, nfp_ipc_client);
+        return 1;
+    }
+
+    consumer = pcap_consumer_msg(&pktgen_nfp, nfp_ipc_client, PKTGEN_IPC_PCAP_ATTACH, -1);
+    if (consumer < 0) {
+        fprintf(stderr, "Failed to attach to pktgencap as a capture consumer\n");
+        (void) pcap_writer_close(writer);
+        nfp_ipc_client_stop(pktgen_nfp.shm.nfp_ipc, nfp_ipc_client);
+        return 1;
+    }
+    rings = &pcap_shm->consumers[consumer];
+
+    signal(SIGINT, handle_sigint);
+    err = 0;
+    num_buffers = 0;
+    while (!stop_capture && (max_buffers != num_buffers)) {
+        int buffers[CAPTURE_BATCH];
+        int max;
+        int num;
+        int i;
+
+        max = CAPTURE_BATCH;
+        if ((max_buffers >= 0) && (max > max_buffers - num_buffers))
+            max = max_buffers - num_buffers;
+        num = pcap_ring_pop(&rings->completed, buffers, max);
+        if (num == 0) {
+            usleep(BUFFER_POLL_INTERVAL_US);
+            continue;
+        }
+        for (i=0; i<num; i++) {
+            struct pcap_buffer *pcap_buffer;
+            pcap_buffer = (struct pcap_buffer *)(pktgen_nfp.shm.base +
+                                                 PKTGEN_PCAP_BUFFER_SHM(writer_desc.geometry.buf_size_shift,
+                                                                        buffers[i]));
+            if (pcap_writer_add_buffer(writer, pcap_buffer, timestamp_ns()) < 0)
+                err = 1;
+        }
+        /* The ring holds every buffer, so this cannot fill */
+        (void) pcap_ring_push(&rings->returned, buffers, num);
+        num_buffers += num;
+        if (err)
+            break;
+    }
+    if (pcap_consumer_msg(&pktgen_nfp, nfp_ipc_client, PKTGEN_IPC_PCAP_DETACH, consumer) < 0)
+        err = 1;
+
+    pcap_writer_get_stats(writer, &stats);
+    if (pcap_writer_close(writer) != 0)
+        err = 1;
+    printf("Captured %d buffers, %llu packets, %llu bytes in %llu writes (%llu stalls)\n",
+           num_buffers,
+           (unsigned long long)stats.packets,
+           (unsigned long long)stats.bytes,
+           (unsigned long long)stats.chunks_written,
+           (unsigned long long)stats.stalls);
+    if (writer_desc.filter) {
+        printf("Filtered out %llu packets\n", (unsigned long long)stats.filtered);
+        pcap_filter_free(&filter);
+    }
+
+    nfp_ipc_client_stop(pktgen_nfp.shm.nfp_ipc, nfp_ipc_client);
+    return err;
+}
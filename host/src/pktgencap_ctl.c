@@ -26,6 +26,7 @@
 #include <inttypes.h>
 #include "nfp_support.h"
 #include "nfp_ipc.h"
+#include "firmware/pktgen.h"
 #include "pktgencap.h"
 
 /** Defines
@@ -58,6 +59,14 @@ usage(void)
     printf("Usage: pktgencap_ctl <cmd>*, where cmd is one of:\n"
            "    shutdown    shut down the pktgencap main process\n"
            "    pktdump     dump packets received to stdout\n"
+           "    bufshow     show pcap buffer headers\n"
+           "    load        load the packet generator data\n"
+           "    gen         generate packets using the loaded schedule\n"
+           "    stream <file>\n"
+           "                stream a schedule file using the loaded packet data\n"
+           "    scale <f>   play subsequent schedules at <f> times real-time\n"
+           "    loop <n> <offset>\n"
+           "                play subsequent schedules <n> times, <offset> apart\n"
         );
 }
 
@@ -88,6 +97,9 @@ main(int argc, char **argv)
     struct pktgen_nfp pktgen_nfp;
     struct nfp_ipc_client_desc nfp_ipc_client_desc;
     int nfp_ipc_client;
+    uint32_t time_scale;
+    uint32_t loop_count;
+    uint64_t loop_offset;
     int i;
 
     pktgen_nfp.nfp = nfp_init(-1,0);
@@ -104,6 +116,9 @@ main(int argc, char **argv)
         return 1;
     }
 
+    time_scale  = PKTGEN_TIME_SCALE_ONE;
+    loop_count  = 1;
+    loop_offset = 0;
     for (i=1; i<argc; i++) {
         struct pktgen_ipc_msg *pktgen_msg;
         struct nfp_ipc_msg *msg;
@@ -111,6 +126,24 @@ main(int argc, char **argv)
         int timeout;
         int poll;
 
+        if (!strcmp(argv[i],"scale") && (i+1<argc)) {
+            double speed;
+            speed = strtod(argv[++i], NULL);
+            if ((speed <= 0) ||
+                ((PKTGEN_TIME_SCALE_ONE / speed) > PKTGEN_TIME_SCALE_MAX) ||
+                ((PKTGEN_TIME_SCALE_ONE / speed) < 1)) {
+                fprintf(stderr,"Playback speed %s out of range\n",argv[i]);
+                break;
+            }
+            time_scale = (uint32_t)(PKTGEN_TIME_SCALE_ONE / speed);
+            continue;
+        }
+        if (!strcmp(argv[i],"loop") && (i+2<argc)) {
+            loop_count  = strtoul(argv[++i], NULL, 0);
+            loop_offset = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+
         timeout = 1000*1000;
         msg = nfp_ipc_msg_alloc(pktgen_nfp.shm.nfp_ipc, sizeof(struct pktgen_ipc_msg));
         pktgen_msg = (struct pktgen_ipc_msg *)(&msg->data[0]);
@@ -135,6 +168,17 @@ main(int argc, char **argv)
             pktgen_msg->ack = 0;
             pktgen_msg->generate.base_delay = 1<<24;
             pktgen_msg->generate.total_pkts = 57;
+            pktgen_msg->generate.time_scale  = time_scale;
+            pktgen_msg->generate.loop_count  = loop_count;
+            pktgen_msg->generate.loop_offset = loop_offset;
+            nfp_ipc_client_send_msg(pktgen_nfp.shm.nfp_ipc, nfp_ipc_client, msg);
+        } else if (!strcmp(argv[i],"stream") && (i+1<argc)) {
+            pktgen_msg->reason = PKTGEN_IPC_STREAM;
+            pktgen_msg->ack = 0;
+            pktgen_msg->stream.base_delay = 1<<24;
+            pktgen_msg->stream.time_scale = time_scale;
+            strncpy(pktgen_msg->stream.filename, argv[++i], PKTGEN_IPC_FILENAME_LEN-1);
+            pktgen_msg->stream.filename[PKTGEN_IPC_FILENAME_LEN-1] = 0;
             nfp_ipc_client_send_msg(pktgen_nfp.shm.nfp_ipc, nfp_ipc_client, msg);
         } else {
             usage();
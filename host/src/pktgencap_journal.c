@@ -0,0 +1,364 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pktgencap_journal.c
+ * @brief         Stream the packet capture debug journal from the NFP
+ *
+ * Attaches to the NFP running the capture firmware (loaded by
+ * pktgencap), finds its debug journal, and drains it at an interval
+ * (pcap_journal.h), printing each event, writing them to a binary
+ * trace, and/or exporting them as Chrome trace JSON with a timeline
+ * for every MU buffer. A binary trace may later be converted to
+ * Chrome trace JSON with -r, without an NFP.
+ *
+ */
+
+/** Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "nfp_support.h"
+#include "pcap_journal.h"
+
+/** struct journal_output
+ *
+ * Where drained events go
+ */
+struct journal_output {
+    FILE  *trace;
+    struct pcap_journal_chrome *chrome;
+    int    quiet;
+    double us_per_tick;
+};
+
+/** struct journal_nfp
+ *
+ * The journal symbol found in the NFP firmware
+ */
+struct journal_nfp {
+    struct nfp       *nfp;
+    struct nfp_cppid  cppid;
+    uint64_t          size;
+    int               found;
+};
+
+/** Static variables
+ */
+static volatile sig_atomic_t stop;
+
+/** usage
+ */
+static void
+usage(void)
+{
+    printf("Usage: pktgencap_journal [options]\n"
+           "    -d, --device <n>     NFP device number (default 0)\n"
+           "    -o, --output <file>  write events to a binary trace\n"
+           "    -j, --json <file>    write events as Chrome trace JSON\n"
+           "    -r, --read <file>    read events from a binary trace, not the NFP\n"
+           "    -i, --interval <ms>  drain every <ms> milliseconds (default 10)\n"
+           "    -t, --time <s>       stop after <s> seconds (default 0, on SIGINT)\n"
+           "    -m, --mhz <mhz>      ME clock in MHz (default 1200)\n"
+           "    -q, --quiet          do not print events\n"
+           "    -h, --help           print this help\n"
+        );
+}
+
+/** handle_sigint
+ */
+static void
+handle_sigint(int sig)
+{
+    stop = 1;
+}
+
+/** journal_symbol
+ *
+ * nfp_rtsym_fn to find the journal
+ */
+static int
+journal_symbol(void *handle, const char *sym_name,
+               const struct nfp_cppid *cppid, uint64_t size)
+{
+    struct journal_nfp *jn = (struct journal_nfp *)handle;
+    size_t len, sym_len;
+
+    len     = strlen(sym_name);
+    sym_len = strlen(PCAP_JOURNAL_SYMBOL);
+    if (len < sym_len)
+        return 0;
+    if (strcmp(sym_name + len - sym_len, PCAP_JOURNAL_SYMBOL) != 0)
+        return 0;
+    if ((len > sym_len) && (sym_name[len - sym_len - 1] != '.'))
+        return 0;
+    jn->cppid = *cppid;
+    jn->size  = size;
+    jn->found = 1;
+    return 1;
+}
+
+/** journal_read
+ *
+ * pcap_journal_read_fn for the NFP
+ */
+static int
+journal_read(void *handle, uint32_t offset, void *data, size_t size)
+{
+    struct journal_nfp *jn = (struct journal_nfp *)handle;
+    struct nfp_cppid cppid;
+    cppid = jn->cppid;
+    return nfp_read(jn->nfp, &cppid, offset, data, size);
+}
+
+/** journal_write
+ *
+ * pcap_journal_write_fn for the NFP
+ */
+static int
+journal_write(void *handle, uint32_t offset, const void *data, size_t size)
+{
+    struct journal_nfp *jn = (struct journal_nfp *)handle;
+    struct nfp_cppid cppid;
+    cppid = jn->cppid;
+    return nfp_write(jn->nfp, &cppid, offset, (void *)data, size);
+}
+
+/** journal_event
+ *
+ * pcap_journal_event_fn sending an event to the outputs
+ */
+static int
+journal_event(void *handle, const struct pcap_journal_event *event)
+{
+    struct journal_output *output = (struct journal_output *)handle;
+
+    if (!output->quiet)
+        pcap_journal_event_print(stdout, event, output->us_per_tick);
+    if (output->trace) {
+        if (fwrite(event, sizeof(*event), 1, output->trace) != 1)
+            return 1;
+    }
+    if (output->chrome)
+        pcap_journal_chrome_event(output->chrome, event);
+    return 0;
+}
+
+/** time_ns
+ */
+static uint64_t
+time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+
+/** stream_nfp
+ *
+ * Drain the journal from the NFP until stopped
+ *
+ * Returns zero on success
+ */
+static int
+stream_nfp(int device, int interval_ms, int seconds, struct journal_output *output)
+{
+    struct journal_nfp jn;
+    struct pcap_journal *journal;
+    uint64_t end_ns;
+    int err;
+
+    memset(&jn, 0, sizeof(jn));
+    jn.nfp = nfp_init(device, 0);
+    if (!jn.nfp) {
+        fprintf(stderr,"Failed to open NFP %d\n", device);
+        return 1;
+    }
+    err = 1;
+    journal = NULL;
+    if (nfp_find_rtsyms(jn.nfp, journal_symbol, &jn) < 0) {
+        fprintf(stderr,"Failed to read NFP firmware symbols\n");
+        goto out;
+    }
+    if (!jn.found) {
+        fprintf(stderr,"No '%s' in NFP firmware; is pktgencap running?\n", PCAP_JOURNAL_SYMBOL);
+        goto out;
+    }
+    if (jn.size < PCAP_JOURNAL_NUM_ENTRIES*sizeof(struct pcap_journal_entry)) {
+        fprintf(stderr,"Firmware '%s' is smaller than expected\n", PCAP_JOURNAL_SYMBOL);
+        goto out;
+    }
+    journal = malloc(sizeof(*journal));
+    if (!journal)
+        goto out;
+    pcap_journal_init(journal, PCAP_JOURNAL_NUM_ENTRIES, journal_read, journal_write, &jn);
+    if (pcap_journal_attach(journal) != 0) {
+        fprintf(stderr,"Failed to attach to the journal\n");
+        goto out;
+    }
+
+    end_ns = time_ns() + ((uint64_t)seconds)*1000000000ULL;
+    err = 0;
+    while (!stop && ((seconds == 0) || (time_ns() < end_ns))) {
+        if (pcap_journal_drain(journal, journal_event, output) < 0) {
+            fprintf(stderr,"Failed to drain the journal\n");
+            err = 1;
+            break;
+        }
+        usleep(interval_ms*1000);
+    }
+    fprintf(stderr,"%" PRIu64 " events, %" PRIu64 " overruns, %" PRIu64 " reads\n",
+            journal->num_events, journal->num_overruns, journal->num_reads);
+
+out:
+    free(journal);
+    nfp_shutdown(jn.nfp);
+    return err;
+}
+
+/** convert_trace
+ *
+ * Send the events of a binary trace to the outputs
+ *
+ * Returns zero on success
+ */
+static int
+convert_trace(const char *filename, struct journal_output *output)
+{
+    struct pcap_journal_trace_hdr hdr;
+    struct pcap_journal_event event;
+    FILE *f;
+    int err;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        fprintf(stderr,"Failed to open trace '%s'\n", filename);
+        return 1;
+    }
+    err = 0;
+    if (pcap_journal_trace_read_hdr(f, &hdr) != 0) {
+        fprintf(stderr,"'%s' is not a journal trace\n", filename);
+        err = 1;
+    } else {
+        output->us_per_tick = hdr.tick_ps / 1.0E6;
+        if (output->chrome)
+            output->chrome->us_per_tick = output->us_per_tick;
+        while (!err && (fread(&event, sizeof(event), 1, f) == 1))
+            err = journal_event(output, &event);
+    }
+    fclose(f);
+    return err;
+}
+
+/** Main
+ */
+extern int
+main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"device",   required_argument, 0, 'd'},
+        {"output",   required_argument, 0, 'o'},
+        {"json",     required_argument, 0, 'j'},
+        {"read",     required_argument, 0, 'r'},
+        {"interval", required_argument, 0, 'i'},
+        {"time",     required_argument, 0, 't'},
+        {"mhz",      required_argument, 0, 'm'},
+        {"quiet",    no_argument,       0, 'q'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    struct journal_output output;
+    const char *trace_filename;
+    const char *json_filename;
+    const char *read_filename;
+    FILE *json;
+    int device;
+    int interval_ms;
+    int seconds;
+    double mhz;
+    int err;
+
+    memset(&output, 0, sizeof(output));
+    trace_filename = NULL;
+    json_filename = NULL;
+    read_filename = NULL;
+    device = 0;
+    interval_ms = 10;
+    seconds = 0;
+    mhz = 1200;
+    for (;;) {
+        int c;
+        c = getopt_long(argc, argv, "d:o:j:r:i:t:m:qh", long_options, NULL);
+        if (c == -1)
+            break;
+        switch (c) {
+        case 'd': device = atoi(optarg); break;
+        case 'o': trace_filename = optarg; break;
+        case 'j': json_filename = optarg; break;
+        case 'r': read_filename = optarg; break;
+        case 'i': interval_ms = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        case 'm': mhz = atof(optarg); break;
+        case 'q': output.quiet = 1; break;
+        case 'h': usage(); return 0;
+        default: usage(); return 1;
+        }
+    }
+    if ((interval_ms <= 0) || (seconds < 0) || (mhz <= 0)) {
+        usage();
+        return 1;
+    }
+    output.us_per_tick = PCAP_JOURNAL_TICK_CYCLES / mhz;
+
+    if (trace_filename) {
+        output.trace = fopen(trace_filename, "wb");
+        if (!output.trace ||
+            pcap_journal_trace_write_hdr(output.trace, (uint32_t)(output.us_per_tick*1.0E6 + 0.5)) != 0) {
+            fprintf(stderr,"Failed to write trace '%s'\n", trace_filename);
+            return 1;
+        }
+    }
+    json = NULL;
+    if (json_filename) {
+        json = fopen(json_filename, "w");
+        output.chrome = malloc(sizeof(*output.chrome));
+        if (!json || !output.chrome) {
+            fprintf(stderr,"Failed to open '%s'\n", json_filename);
+            return 1;
+        }
+        pcap_journal_chrome_open(output.chrome, json, output.us_per_tick);
+    }
+
+    signal(SIGINT, handle_sigint);
+    if (read_filename) {
+        err = convert_trace(read_filename, &output);
+    } else {
+        err = stream_nfp(device, interval_ms, seconds, &output);
+    }
+
+    if (output.trace)
+        fclose(output.trace);
+    if (output.chrome) {
+        pcap_journal_chrome_close(output.chrome);
+        fclose(json);
+        free(output.chrome);
+    }
+    return err;
+}
@@ -0,0 +1,333 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          pktgencap_stat.c
+ * @brief         Sample the live statistics of packet generator/capture
+ *
+ * Attaches read-only to the pktgencap shared memory and samples its
+ * statistics block (pktgen_stats.h) at an interval, printing the
+ * gauges and the rates since the previous sample, either as a table
+ * or as one JSON object per line. It never talks to pktgencap, so it
+ * may sample as often as wanted, and any number may run at once.
+ * With -f it also prints the firmware counters that pktgencap scrapes
+ * from the NFP (nfp_stats.h), and with -s the buffer and packet
+ * sequence gaps it has found in the capture (pcap_seq_check.h).
+ *
+ */
+
+/** Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "pktgencap.h"
+#include "pktgen_stats.h"
+
+/** Static variables
+ */
+static const char *shm_filename="/tmp/nfp_shm.lock";
+static int shm_key = 'x';
+
+/** usage
+ */
+static void
+usage(void)
+{
+    printf("Usage: pktgencap_stat [options]\n"
+           "    -i, --interval <ms>  sample every <ms> milliseconds (default 1000)\n"
+           "    -n, --count <n>      stop after <n> samples (default 0, forever)\n"
+           "    -j, --json           print each sample as a JSON object\n"
+           "    -f, --firmware       also print the firmware counters\n"
+           "    -s, --seq            also print the capture sequence gaps\n"
+           "    -h, --help           print this help\n"
+        );
+}
+
+/** stats_attach
+ *
+ * Attach read-only to the pktgencap shared memory, which must exist
+ *
+ * Returns the statistics block, or NULL on failure
+ */
+static const struct pktgen_stats *
+stats_attach(void)
+{
+    key_t key;
+    int shm_id;
+    void *base;
+
+    key = ftok(shm_filename, shm_key);
+    if (key == -1) {
+        fprintf(stderr,"Failed to find %s; is pktgencap running?\n", shm_filename);
+        return NULL;
+    }
+    shm_id = shmget(key, 0, 0);
+    if (shm_id == -1) {
+        fprintf(stderr,"Failed to find pktgencap shared memory\n");
+        return NULL;
+    }
+    base = shmat(shm_id, NULL, SHM_RDONLY);
+    if (base == (void *)-1) {
+        fprintf(stderr,"Failed to attach to pktgencap shared memory\n");
+        return NULL;
+    }
+    return (const struct pktgen_stats *)(((const char *)base) + PKTGEN_STATS_SHM_OFFSET);
+}
+
+/** stats_print_fw
+ *
+ * Print the firmware counters of a sample, with their rates over the
+ * last scrape interval, as JSON members or indented lines
+ */
+static void
+stats_print_fw(const struct pktgen_stats *stats, int json)
+{
+    const struct pktgen_stats_fw_counter *counter;
+    uint64_t i, num_counters;
+
+    num_counters = stats->fw_num_counters;
+    if (num_counters > PKTGEN_STATS_MAX_FW_COUNTERS)
+        num_counters = PKTGEN_STATS_MAX_FW_COUNTERS;
+    if (json)
+        printf(",\"fw_counters\":{");
+    for (i=0; i<num_counters; i++) {
+        counter = &stats->fw_counters[i];
+        if (json) {
+            printf("%s\"%.*s\":{\"total\":%" PRIu64 ",\"per_s\":%" PRIu64 "}",
+                   (i>0)?",":"", PKTGEN_STATS_FW_NAME_LEN, counter->name,
+                   counter->total, counter->rate);
+        } else {
+            printf("    %-40.*s %16" PRIu64 " %12" PRIu64 "/s\n",
+                   PKTGEN_STATS_FW_NAME_LEN, counter->name,
+                   counter->total, counter->rate);
+        }
+    }
+    if (json)
+        printf("}");
+}
+
+/** stats_print_seq
+ *
+ * Print the capture sequence checks of a sample, with the gaps of
+ * each NBI sequencer that has had any and the most recent gap ranges,
+ * as JSON members or indented lines
+ */
+static void
+stats_print_seq(const struct pktgen_stats *stats, int json)
+{
+    const struct pktgen_stats_seq_range *range;
+    uint64_t i, num_ranges;
+    int n;
+
+    num_ranges = stats->seq_num_ranges;
+    if (num_ranges > PKTGEN_STATS_SEQ_RANGES)
+        num_ranges = PKTGEN_STATS_SEQ_RANGES;
+    if (json) {
+        printf(",\"seq\":{\"buf_gaps\":%" PRIu64 ",\"bufs_missing\":%" PRIu64 ","
+               "\"buf_reorders\":%" PRIu64 ",\"pkt_gaps\":%" PRIu64 ","
+               "\"pkts_missing\":%" PRIu64 ",\"pkt_reorders\":%" PRIu64 ","
+               "\"num_ranges\":%" PRIu64 ",\"seqrs\":[",
+               stats->seq_buf_gaps, stats->seq_bufs_missing, stats->seq_buf_reorders,
+               stats->seq_pkt_gaps, stats->seq_pkts_missing, stats->seq_pkt_reorders,
+               stats->seq_num_ranges);
+        for (n=0; n<PKTGEN_STATS_SEQ_NUM_SEQRS; n++) {
+            printf("%s{\"gaps\":%" PRIu64 ",\"missing\":%" PRIu64 ",\"reorders\":%" PRIu64 "}",
+                   (n>0)?",":"", stats->seq_seqrs[n].gaps,
+                   stats->seq_seqrs[n].missing, stats->seq_seqrs[n].reorders);
+        }
+        printf("],\"ranges\":[");
+    } else {
+        printf("    buffers: %" PRIu64 " gaps, %" PRIu64 " missing, %" PRIu64 " reordered\n",
+               stats->seq_buf_gaps, stats->seq_bufs_missing, stats->seq_buf_reorders);
+        printf("    packets: %" PRIu64 " gaps, %" PRIu64 " missing, %" PRIu64 " reordered\n",
+               stats->seq_pkt_gaps, stats->seq_pkts_missing, stats->seq_pkt_reorders);
+        for (n=0; n<PKTGEN_STATS_SEQ_NUM_SEQRS; n++) {
+            if ((stats->seq_seqrs[n].gaps == 0) && (stats->seq_seqrs[n].reorders == 0))
+                continue;
+            printf("      seqr %d: %" PRIu64 " gaps, %" PRIu64 " missing, %" PRIu64 " reordered\n",
+                   n, stats->seq_seqrs[n].gaps,
+                   stats->seq_seqrs[n].missing, stats->seq_seqrs[n].reorders);
+        }
+    }
+    for (i=0; i<num_ranges; i++) {
+        range = &stats->seq_ranges[i];
+        if (json) {
+            printf("%s{\"kind\":\"%s\",\"seqr\":%" PRIu64 ",\"buf_seq\":%" PRIu64 ","
+                   "\"first\":%" PRIu64 ",\"num\":%" PRIu64 "}",
+                   (i>0)?",":"", range->kind ? "packets" : "buffers",
+                   range->seqr, range->buf_seq, range->first, range->num);
+        } else if (range->kind) {
+            printf("    buffer %" PRIu64 ": seqr %" PRIu64 " packets %" PRIu64 "+%" PRIu64 " missing\n",
+                   range->buf_seq, range->seqr, range->first, range->num);
+        } else if (range->num) {
+            printf("    buffer %" PRIu64 ": buffers %" PRIu64 "+%" PRIu64 " missing\n",
+                   range->buf_seq, range->first, range->num);
+        } else {
+            printf("    buffer %" PRIu64 ": buffer numbers restarted, %" PRIu64 " expected\n",
+                   range->buf_seq, range->first);
+        }
+    }
+    if (json)
+        printf("]}");
+}
+
+/** stats_print
+ *
+ * Print a sample, with rates since the previous sample
+ */
+static void
+stats_print(const struct pktgen_stats *stats, const struct pktgen_stats *last, int json, int fw, int seq)
+{
+    double secs;
+    double packet_rate, byte_rate, buffer_rate;
+    double poll_util, recycle_util, give_util;
+
+    secs = (stats->update_ns - last->update_ns) / 1.0E9;
+    if (secs <= 0) secs = 1.0E-9;
+    packet_rate  = (stats->capture_packets - last->capture_packets) / secs;
+    byte_rate    = (stats->capture_bytes   - last->capture_bytes)   / secs;
+    buffer_rate  = (stats->capture_buffers - last->capture_buffers) / secs;
+    poll_util    = (stats->poll_ns        - last->poll_ns)        / (secs*1.0E9);
+    recycle_util = (stats->recycle_ns     - last->recycle_ns)     / (secs*1.0E9);
+    give_util    = (stats->give_buffer_ns - last->give_buffer_ns) / (secs*1.0E9);
+
+    if (json) {
+        printf("{\"uptime_s\":%.3f,\"interval_s\":%.6f,"
+               "\"capture_packets\":%" PRIu64 ",\"capture_bytes\":%" PRIu64 ","
+               "\"capture_buffers\":%" PRIu64 ",\"capture_stalls\":%" PRIu64 ","
+               "\"buffers_given\":%" PRIu64 ",\"poll_loops\":%" PRIu64 ","
+               "\"packets_per_s\":%.1f,\"dma_bytes_per_s\":%.1f,\"buffers_per_s\":%.1f,"
+               "\"poll_util\":%.4f,\"recycle_util\":%.4f,\"give_buffer_util\":%.4f,"
+               "\"buffers_total\":%" PRIu64 ",\"buffers_nfp\":%" PRIu64 ","
+               "\"buffers_consumers\":%" PRIu64 ",\"consumers_attached\":%" PRIu64,
+               (stats->update_ns - stats->start_ns) / 1.0E9, secs,
+               stats->capture_packets, stats->capture_bytes,
+               stats->capture_buffers, stats->capture_stalls,
+               stats->buffers_given, stats->poll_loops,
+               packet_rate, byte_rate, buffer_rate,
+               poll_util, recycle_util, give_util,
+               stats->buffers_total, stats->buffers_nfp,
+               stats->buffers_consumers, stats->consumers_attached);
+        if (fw)
+            stats_print_fw(stats, json);
+        if (seq)
+            stats_print_seq(stats, json);
+        printf("}\n");
+    } else {
+        printf("%10.3f %12.0f %9.3f %9.1f %8" PRIu64 " %5" PRIu64 "/%-5" PRIu64 " %5" PRIu64 " %3" PRIu64 " %5.1f%% %5.1f%% %5.1f%%\n",
+               (stats->update_ns - stats->start_ns) / 1.0E9,
+               packet_rate, byte_rate*8/1.0E9, buffer_rate,
+               stats->capture_stalls - last->capture_stalls,
+               stats->buffers_nfp, stats->buffers_total,
+               stats->buffers_consumers, stats->consumers_attached,
+               poll_util*100, recycle_util*100, give_util*100);
+        if (fw)
+            stats_print_fw(stats, json);
+        if (seq)
+            stats_print_seq(stats, json);
+    }
+    fflush(stdout);
+}
+
+/** Main
+ */
+extern int
+main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"interval", required_argument, 0, 'i'},
+        {"count",    required_argument, 0, 'n'},
+        {"json",     no_argument,       0, 'j'},
+        {"firmware", no_argument,       0, 'f'},
+        {"seq",      no_argument,       0, 's'},
+        {"help",     no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+    const struct pktgen_stats *shared;
+    struct pktgen_stats stats, last;
+    int interval_ms;
+    int count;
+    int json;
+    int fw;
+    int seq;
+    int sample;
+    int err;
+
+    interval_ms = 1000;
+    count = 0;
+    json = 0;
+    fw = 0;
+    seq = 0;
+    for (;;) {
+        int c;
+        c = getopt_long(argc, argv, "i:n:jfsh", long_options, NULL);
+        if (c == -1)
+            break;
+        switch (c) {
+        case 'i': interval_ms = atoi(optarg); break;
+        case 'n': count = atoi(optarg); break;
+        case 'j': json = 1; break;
+        case 'f': fw = 1; break;
+        case 's': seq = 1; break;
+        case 'h': usage(); return 0;
+        default: usage(); return 1;
+        }
+    }
+    if (interval_ms <= 0) {
+        fprintf(stderr,"Interval must be at least 1ms\n");
+        return 1;
+    }
+
+    shared = stats_attach();
+    if (!shared)
+        return 1;
+
+    /* The first sample shows the rates since pktgencap started */
+    err = pktgen_stats_read(shared, &last);
+    if (err == 0) {
+        uint64_t start_ns;
+        start_ns = last.start_ns;
+        pktgen_stats_init(&last);
+        last.start_ns  = start_ns;
+        last.update_ns = start_ns;
+    }
+    if (!json && (err == 0)) {
+        printf("%10s %12s %9s %9s %8s %11s %5s %3s %6s %6s %6s\n",
+               "uptime_s", "pkts/s", "Gbps", "bufs/s", "stalls",
+               "nfp/total", "cons", "att", "poll", "recyc", "give");
+    }
+    for (sample=0; (err == 0) && ((count == 0) || (sample < count)); sample++) {
+        if (sample > 0)
+            usleep(interval_ms*1000);
+        err = pktgen_stats_read(shared, &stats);
+        if (err != 0)
+            break;
+        stats_print(&stats, &last, json, fw, seq);
+        last = stats;
+    }
+    if (err == 1) {
+        fprintf(stderr,"No pktgencap statistics (version %d) in shared memory\n", PKTGEN_STATS_VERSION);
+        return 1;
+    } else if (err != 0) {
+        fprintf(stderr,"Failed to read consistent pktgencap statistics\n");
+        return 1;
+    }
+    return 0;
+}
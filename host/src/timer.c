@@ -0,0 +1,191 @@
+/** Copyright (C) 2015-2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          timer.c
+ * @brief         x86 Host timer calibration and histograms
+ *
+ * The timestamp counter is calibrated by reading it together with
+ * CLOCK_MONOTONIC_RAW (which is not slewed by NTP) at two times about
+ * 10ms apart. Each reading is bracketed by two timestamps, and the
+ * tightest of a few brackets is used, so that a preemption or
+ * interrupt during a reading does not skew the rate.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <cpuid.h>
+#include "timer.h"
+
+/*a Defines
+ */
+/* Time over which the timestamp counter is calibrated */
+#define SL_TIMER_CALIBRATE_NS (10*1000*1000)
+
+/* Readings of the timestamp counter and clock taken to find the
+ * tightest */
+#define SL_TIMER_CALIBRATE_TRIES 5
+
+/*a Global variables
+ */
+double sl_timer_calibrated_clks_per_us;
+
+/*a Static functions
+ */
+/*f timespec_ns */
+static long long
+timespec_ns(const struct timespec *ts)
+{
+    return ((long long)ts->tv_sec)*1000*1000*1000 + ts->tv_nsec;
+}
+
+/*f read_clocks */
+/**
+ * @brief Read the timestamp counter and CLOCK_MONOTONIC_RAW together
+ *
+ * @returns Clock in nanoseconds, with @p clks set to the timestamp
+ * counter at the middle of the tightest bracket of it
+ *
+ */
+static long long
+read_clocks(unsigned long long *clks)
+{
+    unsigned long long best_window;
+    long long ns;
+    int i;
+
+    best_window = ~0ULL;
+    ns = 0;
+    for (i=0; i<SL_TIMER_CALIBRATE_TRIES; i++) {
+        struct timespec ts;
+        unsigned long long before, after;
+        before = SL_TIMER_CPU_CLOCKS_START;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        after = SL_TIMER_CPU_CLOCKS_END;
+        if (after - before < best_window) {
+            best_window = after - before;
+            *clks = before + (after - before)/2;
+            ns = timespec_ns(&ts);
+        }
+    }
+    return ns;
+}
+
+/*a External functions
+ */
+/*f sl_timer_tsc_invariant */
+extern int
+sl_timer_tsc_invariant(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || (eax < 0x80000007))
+        return 0;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx >> 8) & 1;
+}
+
+/*f sl_timer_calibrate */
+extern double
+sl_timer_calibrate(void)
+{
+    unsigned long long start_clks, end_clks;
+    long long start_ns, end_ns;
+    const char *env;
+    double clks_per_us;
+
+    env = getenv("SL_TIMER_CLKS_PER_US");
+    if (env && (sscanf(env, "%lf", &clks_per_us) == 1) && (clks_per_us > 0)) {
+        __atomic_store(&sl_timer_calibrated_clks_per_us, &clks_per_us, __ATOMIC_RELEASE);
+        return clks_per_us;
+    }
+
+    if (!sl_timer_tsc_invariant()) {
+        fprintf(stderr, "Warning: CPU timestamp counter is not invariant, so timings may be wrong\n");
+    }
+
+    start_ns = read_clocks(&start_clks);
+    do {
+        end_ns = read_clocks(&end_clks);
+    } while (end_ns - start_ns < SL_TIMER_CALIBRATE_NS);
+
+    clks_per_us = (end_clks - start_clks) / ((end_ns - start_ns) / 1000.0);
+    __atomic_store(&sl_timer_calibrated_clks_per_us, &clks_per_us, __ATOMIC_RELEASE);
+    return clks_per_us;
+}
+
+/*f sl_hist_bucket_value */
+extern unsigned long long
+sl_hist_bucket_value(int bucket)
+{
+    int shift;
+    if (bucket < SL_HIST_SUB_BUCKETS)
+        return bucket;
+    shift = (bucket >> SL_HIST_SUB_BUCKETS_LOG2) - 1;
+    return ((unsigned long long)(SL_HIST_SUB_BUCKETS + (bucket & (SL_HIST_SUB_BUCKETS-1)))) << shift;
+}
+
+/*f sl_hist_merge */
+extern void
+sl_hist_merge(t_sl_hist *hist, const t_sl_hist *other)
+{
+    int i;
+    if (other->count == 0)
+        return;
+    hist->count += other->count;
+    hist->total += other->total;
+    if (other->min < hist->min) hist->min = other->min;
+    if (other->max > hist->max) hist->max = other->max;
+    for (i=0; i<SL_HIST_BUCKETS; i++) {
+        hist->buckets[i] += other->buckets[i];
+    }
+}
+
+/*f sl_hist_percentile */
+extern unsigned long long
+sl_hist_percentile(const t_sl_hist *hist, double fraction)
+{
+    unsigned long long target, seen, value;
+    int i;
+
+    if (hist->count == 0)
+        return 0;
+    target = (unsigned long long)(fraction * hist->count);
+    if (target < 1) target = 1;
+    seen = 0;
+    for (i=0; i<SL_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target)
+            break;
+    }
+    if (i >= SL_HIST_BUCKETS-1)
+        return hist->max;
+    value = (sl_hist_bucket_value(i) + sl_hist_bucket_value(i+1)) / 2;
+    if (value > hist->max)
+        value = hist->max;
+    if (value < hist->min)
+        value = hist->min;
+    return value;
+}
+
+/*f sl_hist_mean */
+extern double
+sl_hist_mean(const t_sl_hist *hist)
+{
+    if (hist->count == 0)
+        return 0;
+    return ((double)hist->total) / hist->count;
+}
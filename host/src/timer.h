@@ -16,7 +16,14 @@
  * @brief         x86 Host timing macros
  *
  * This file supplies a few macros to support high-precision
- * timestamping of host code.
+ * timestamping of host code, and histograms (t_sl_hist) to record
+ * distributions of the times measured.
+ *
+ * CPU clocks are converted to real time by a rate measured at run
+ * time against CLOCK_MONOTONIC_RAW (see timer.c), as the timestamp
+ * counter rate is not known at compile time; this is only reliable
+ * if the CPU has an invariant timestamp counter, which
+ * sl_timer_calibrate checks.
  *
  */
 
@@ -28,18 +35,21 @@
 
 /*a Includes
  */
+#include <string.h>
 
 /*a Defines
  */
 /** The x86 CPU speed effects the correlation between CPU ticks and
  * realtime, which therefore effects performance measurements;
  * SL_TIMER_x86_CLKS_PER_US provides either a compile-time constant
- * (if known at compile time) or whatever CLKS_PER_US is set to.
+ * (if CLKS_PER_US is set at compile time) or the rate measured by
+ * sl_timer_calibrate on first use (which the environment variable
+ * SL_TIMER_CLKS_PER_US may override).
  */
 #ifdef CLKS_PER_US
 #define SL_TIMER_x86_CLKS_PER_US (CLKS_PER_US)
 #else
-#define SL_TIMER_x86_CLKS_PER_US (2400)
+#define SL_TIMER_x86_CLKS_PER_US (sl_timer_clks_per_us())
 #endif
 
 /** GNU C compiler (and compilers that support the GNU C extensions,
@@ -55,10 +65,25 @@
 #define SL_TIMER_CPU_CLOCKS (0)
 #endif
 
+/** The CPU may execute rdtsc before earlier instructions complete, or
+ * later instructions before it; for timing a patch of code,
+ * SL_TIMER_CPU_CLOCKS_START waits for earlier instructions before
+ * reading the timestamp (lfence; rdtsc), and SL_TIMER_CPU_CLOCKS_END
+ * reads it after the patch completes and before later instructions
+ * start (rdtscp; lfence)
+ **/
+#ifdef __GNUC__
+#define SL_TIMER_CPU_CLOCKS_START ({unsigned long long x;unsigned int lo,hi; __asm__ __volatile__ ("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) :: "memory");x = (((unsigned long long)(hi))<<32) | lo;x;})
+#define SL_TIMER_CPU_CLOCKS_END ({unsigned long long x;unsigned int lo,hi; __asm__ __volatile__ ("rdtscp\n\tlfence" : "=a" (lo), "=d" (hi) :: "ecx", "memory");x = (((unsigned long long)(hi))<<32) | lo;x;})
+#else
+#define SL_TIMER_CPU_CLOCKS_START (0)
+#define SL_TIMER_CPU_CLOCKS_END (0)
+#endif
+
 /** Convert SL_TIMER_CPU_CLOCKS value (or difference between such
  * values) into a double-prescision microsecond value
  **/
-#define SL_TIMER_US_FROM_CLKS(clks) (clks/(0.0+SL_TIMER_x86_CLKS_PER_US))
+#define SL_TIMER_US_FROM_CLKS(clks) ((clks)/(0.0+SL_TIMER_x86_CLKS_PER_US))
 
 /** Initialize a timer structure
  */
@@ -67,7 +92,7 @@
 /** Mark entry to a patch of code, be it a block or a function;
  * records the entry timestamp in the timer structure
  */
-#define SL_TIMER_ENTRY(t) {t.entry_clks = SL_TIMER_CPU_CLOCKS;}
+#define SL_TIMER_ENTRY(t) {t.entry_clks = SL_TIMER_CPU_CLOCKS_START;}
 
 /** Find elapsed timestamp difference between now and the entry time
  * for the timer structure
@@ -78,7 +103,12 @@
  * last SL_TIMER_ENTRY, and accumulating total time across all
  * occurences of the patch in the timer structure
  */
-#define SL_TIMER_EXIT(t) {unsigned long long now; now = SL_TIMER_CPU_CLOCKS; (t).accum_clks += (now-(t).entry_clks);}
+#define SL_TIMER_EXIT(t) {unsigned long long now; now = SL_TIMER_CPU_CLOCKS_END; (t).accum_clks += (now-(t).entry_clks);}
+
+/** Mark exit to a patch of code as SL_TIMER_EXIT does, and also
+ * record the time spent in a histogram
+ */
+#define SL_TIMER_EXIT_HIST(t,h) {unsigned long long now, clks; now = SL_TIMER_CPU_CLOCKS_END; clks = now-(t).entry_clks; (t).accum_clks += clks; sl_hist_record(&(h), clks);}
 
 /** Return the total time accumulated in the timer structure over all
  * occcurences.
@@ -100,6 +130,15 @@
  */
 #define SL_TIMER_DELTA_VALUE_US(t) ({unsigned long long r;r=SL_TIMER_DELTA_VALUE(t);SL_TIMER_US_FROM_CLKS(r);})
 
+/** Histograms are log-linear: values below SL_HIST_SUB_BUCKETS have a
+ * bucket each, and each power of two above that is split into
+ * SL_HIST_SUB_BUCKETS buckets, so a bucket is within 1/16 of any
+ * value in it
+ */
+#define SL_HIST_SUB_BUCKETS_LOG2 4
+#define SL_HIST_SUB_BUCKETS (1<<SL_HIST_SUB_BUCKETS_LOG2)
+#define SL_HIST_BUCKETS (SL_HIST_SUB_BUCKETS*(64-SL_HIST_SUB_BUCKETS_LOG2+1))
+
 /*a Types
  */
 /*t t_sl_timer */
@@ -119,8 +158,142 @@ typedef struct t_sl_timer
     unsigned long long int last_accum_clks;
 } t_sl_timer;
 
+/*t t_sl_hist */
+/** Histogram of values (usually clocks)
+ */
+typedef struct t_sl_hist
+{
+    /** Number of values recorded **/
+    unsigned long long int count;
+
+    /** Smallest and largest values recorded **/
+    unsigned long long int min;
+    unsigned long long int max;
+
+    /** Total of the values recorded **/
+    unsigned long long int total;
+
+    /** Number of values recorded in each bucket **/
+    unsigned long long int buckets[SL_HIST_BUCKETS];
+} t_sl_hist;
+
 /*a External functions
  */
+/*f sl_timer_calibrate */
+/**
+ * @brief Measure the rate of the timestamp counter against
+ * CLOCK_MONOTONIC_RAW (over about 10ms), or take it from the
+ * SL_TIMER_CLKS_PER_US environment variable; warns if the timestamp
+ * counter is not invariant
+ *
+ * @returns CPU clocks per microsecond
+ *
+ */
+extern double sl_timer_calibrate(void);
+
+/*f sl_timer_tsc_invariant */
+/**
+ * @brief Determine if the timestamp counter runs at a constant rate
+ * in all power states
+ *
+ * @returns Non-zero if the timestamp counter is invariant
+ *
+ */
+extern int sl_timer_tsc_invariant(void);
+
+/*f sl_timer_clks_per_us */
+/**
+ * @brief Get the calibrated CPU clocks per microsecond, calibrating
+ * on first use
+ *
+ */
+extern double sl_timer_calibrated_clks_per_us;
+static inline double
+sl_timer_clks_per_us(void)
+{
+    double clks_per_us = sl_timer_calibrated_clks_per_us;
+    if (clks_per_us > 0)
+        return clks_per_us;
+    return sl_timer_calibrate();
+}
+
+/*f sl_hist_init */
+/**
+ * @brief Empty a histogram
+ *
+ */
+static inline void
+sl_hist_init(t_sl_hist *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+    hist->min = ~0ULL;
+}
+
+/*f sl_hist_bucket */
+/**
+ * @brief Find the bucket of a value
+ *
+ */
+static inline int
+sl_hist_bucket(unsigned long long value)
+{
+    int msb;
+    if (value < SL_HIST_SUB_BUCKETS)
+        return (int)value;
+    msb = 63 - __builtin_clzll(value);
+    return ((msb - SL_HIST_SUB_BUCKETS_LOG2 + 1) << SL_HIST_SUB_BUCKETS_LOG2) +
+        (int)((value >> (msb - SL_HIST_SUB_BUCKETS_LOG2)) & (SL_HIST_SUB_BUCKETS-1));
+}
+
+/*f sl_hist_record */
+/**
+ * @brief Record a value in a histogram
+ *
+ */
+static inline void
+sl_hist_record(t_sl_hist *hist, unsigned long long value)
+{
+    hist->count++;
+    hist->total += value;
+    if (value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+    hist->buckets[sl_hist_bucket(value)]++;
+}
+
+/*f sl_hist_bucket_value */
+/**
+ * @brief Get the smallest value in a bucket
+ *
+ */
+extern unsigned long long sl_hist_bucket_value(int bucket);
+
+/*f sl_hist_merge */
+/**
+ * @brief Add the values recorded in one histogram to another, such
+ * as those of many threads into one
+ *
+ */
+extern void sl_hist_merge(t_sl_hist *hist, const t_sl_hist *other);
+
+/*f sl_hist_percentile */
+/**
+ * @brief Find a percentile of the values recorded, as the middle of
+ * the bucket holding it (limited to the largest value)
+ *
+ * @param fraction Fraction of the values at or below the result, such
+ *                 as 0.99 for the 99th percentile
+ *
+ * @returns Value, or zero if none have been recorded
+ *
+ */
+extern unsigned long long sl_hist_percentile(const t_sl_hist *hist, double fraction);
+
+/*f sl_hist_mean */
+/**
+ * @brief Get the mean of the values recorded, or zero if none
+ *
+ */
+extern double sl_hist_mean(const t_sl_hist *hist);
 
 /*a Wrapper
  */
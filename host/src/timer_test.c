@@ -0,0 +1,208 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          timer_test.c
+ * @brief         Test for the host timer calibration and histograms
+ *
+ * Checks the calibrated timestamp counter against CLOCK_MONOTONIC_RAW
+ * over a sleep, and the bucketing, percentiles and merging of
+ * histograms against exact values.
+ *
+ */
+
+/*a Includes
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "timer.h"
+
+/*a Tests
+ */
+/*f test_calibrate */
+/**
+ * @brief Time a 50ms sleep with the calibrated timestamp counter and
+ * with CLOCK_MONOTONIC_RAW; they should agree within 1%
+ *
+ */
+static int
+test_calibrate(void)
+{
+    struct timespec start, end, sleep_time;
+    unsigned long long start_clks, end_clks;
+    double clks_per_us, clock_us, tsc_us;
+
+    clks_per_us = SL_TIMER_x86_CLKS_PER_US;
+    if ((clks_per_us < 100) || (clks_per_us > 10000))
+        return 1;
+    fprintf(stderr, "Calibrated %f clocks per us, invariant %d\n",
+            clks_per_us, sl_timer_tsc_invariant());
+
+    sleep_time.tv_sec  = 0;
+    sleep_time.tv_nsec = 50*1000*1000;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    start_clks = SL_TIMER_CPU_CLOCKS_START;
+    nanosleep(&sleep_time, NULL);
+    end_clks = SL_TIMER_CPU_CLOCKS_END;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+    clock_us = (end.tv_sec - start.tv_sec)*1000000.0 + (end.tv_nsec - start.tv_nsec)/1000.0;
+    tsc_us = SL_TIMER_US_FROM_CLKS(end_clks - start_clks);
+    if ((tsc_us < clock_us*0.99) || (tsc_us > clock_us*1.01)) {
+        fprintf(stderr, "Sleep was %fus by clock but %fus by timestamp counter\n", clock_us, tsc_us);
+        return 2;
+    }
+    return 0;
+}
+
+/*f test_hist_buckets */
+/**
+ * @brief Check every value lies between the smallest values of its
+ * bucket and the next, and buckets are within 1/16 of their values
+ *
+ */
+static int
+test_hist_buckets(void)
+{
+    unsigned long long value;
+    int bucket;
+
+    for (value=1; value<(1ULL<<62); value=value*1.37+1) {
+        bucket = sl_hist_bucket(value);
+        if ((bucket < 0) || (bucket >= SL_HIST_BUCKETS))
+            return 2;
+        if (sl_hist_bucket_value(bucket) > value)
+            return 3;
+        if (sl_hist_bucket_value(bucket+1) <= value)
+            return 4;
+        if ((value >= SL_HIST_SUB_BUCKETS) &&
+            ((sl_hist_bucket_value(bucket+1) - sl_hist_bucket_value(bucket))*16 > value))
+            return 5;
+    }
+    if (sl_hist_bucket(~0ULL) != SL_HIST_BUCKETS-1)
+        return 6;
+    return 0;
+}
+
+/*f test_hist_percentiles */
+/**
+ * @brief Record 1 to 100000 in two histograms, merge them, and check
+ * the percentiles are within a bucket of the exact ones
+ *
+ */
+static int
+test_hist_percentiles(void)
+{
+    static const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+    t_sl_hist *hist, *other;
+    unsigned long long value;
+    int i;
+
+    hist  = malloc(sizeof(*hist));
+    other = malloc(sizeof(*other));
+    sl_hist_init(hist);
+    sl_hist_init(other);
+    for (value=1; value<=100000; value++) {
+        sl_hist_record((value & 1) ? hist : other, value);
+    }
+    sl_hist_merge(hist, other);
+    if ((hist->count != 100000) || (hist->min != 1) || (hist->max != 100000))
+        return 1;
+    if (sl_hist_mean(hist) != 50000.5)
+        return 2;
+    for (i=0; i<4; i++) {
+        double exact, got;
+        exact = fractions[i]*100000;
+        got   = sl_hist_percentile(hist, fractions[i]);
+        if ((got < exact*(1-1.0/16)) || (got > exact*(1+1.0/16))) {
+            fprintf(stderr, "Percentile %f got %f expected %f\n", fractions[i], got, exact);
+            return 3;
+        }
+    }
+    if (sl_hist_percentile(hist, 1.0) != 100000)
+        return 4;
+    sl_hist_init(other);
+    if ((sl_hist_percentile(other, 0.5) != 0) || (sl_hist_mean(other) != 0))
+        return 5;
+    free(hist);
+    free(other);
+    return 0;
+}
+
+/*f test_timer_exit_hist */
+/**
+ * @brief Check SL_TIMER_EXIT_HIST accumulates and records each time
+ *
+ */
+static int
+test_timer_exit_hist(void)
+{
+    t_sl_timer timer;
+    t_sl_hist *hist;
+    int i;
+
+    hist = malloc(sizeof(*hist));
+    SL_TIMER_INIT(timer);
+    sl_hist_init(hist);
+    for (i=0; i<1000; i++) {
+        SL_TIMER_ENTRY(timer);
+        SL_TIMER_EXIT_HIST(timer, *hist);
+    }
+    if (hist->count != 1000)
+        return 1;
+    if (hist->total != SL_TIMER_VALUE(timer))
+        return 2;
+    fprintf(stderr, "Empty timed patch p50 %llu p99 %llu clocks\n",
+            sl_hist_percentile(hist, 0.5), sl_hist_percentile(hist, 0.99));
+    free(hist);
+    return 0;
+}
+
+/*a Toplevel - main
+ */
+/*f TEST_RUN */
+/**
+ * @brief Run a test and display a pass/fail message
+ *
+ * @param msg Message describing the test for (success or failure)
+ *
+ * @param x Test function to run for the test
+ *
+ */
+#define TEST_RUN(msg,x)                    \
+    do { \
+    int err = x; \
+    if (err!=0) { \
+    fprintf(stderr,"TEST FAILED (%d): %s\n",err,msg); \
+    failures++; \
+    } else {                                   \
+    fprintf(stderr,"Test passed: %s\n",msg); \
+    } \
+    } while (0);
+
+/*f main */
+/**
+ * @brief Main function - run the required tests
+ *
+ */
+extern int
+main(int argc, char **argv)
+{
+    int failures = 0;
+    TEST_RUN("Timestamp counter calibration",test_calibrate());
+    TEST_RUN("Histogram buckets",test_hist_buckets());
+    TEST_RUN("Histogram percentiles and merge",test_hist_percentiles());
+    TEST_RUN("Timer exit with histogram",test_timer_exit_hist());
+    return failures;
+}
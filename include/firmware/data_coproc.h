@@ -35,8 +35,52 @@
 /*a Defines
  */
 #define DCPRC_MAX_WORKQS 64
+
+/* Work queues (from 0) that the data_coproc_host.c workq manager
+ * scans; work on any other queue is never gathered */
+#define DCPRC_SCANNED_WORKQS 32
 #define DCPRC_WORKQ_PTR_CLEAR_MASK ((1<<16)-1)
 
+/* Flag in the max_entries of a workq buffer descriptor: the host
+ * writes the wptr to host memory just after the work queue entries,
+ * not to the descriptor, and the firmware DMAs it from there */
+#define DCPRC_WORKQ_WPTR_MIRROR (1U<<31)
+
+/* Flag in operand_0 of a work queue entry: the host physical address
+ * is of a scatter-gather list of struct dcprc_sg_entry, and the rest
+ * of operand_0 is the number of entries in the list */
+#define DCPRC_WORK_SGL (1U<<31)
+#define DCPRC_WORK_SGL_ENTRIES_MASK (DCPRC_WORK_SGL-1)
+
+/* Firmware built with DCPRC_STAGE_TIMESTAMPS (the *_timed firmware)
+ * returns the times of the stages of each work item in place of
+ * data_0 to data_2 of its result: when the gatherer gave it to a
+ * worker, when the worker picked it up, and when the worker finished
+ * it (after any data DMA) and wrote the result. The times are the
+ * low 32 bits of the ME timestamp, which counts every
+ * DCPRC_STAGE_TICK_CYCLES ME clocks; the host scales them by the ME
+ * clock it is given */
+#define DCPRC_STAGE_TICK_CYCLES 16
+
+/* Pattern search automata: the 'dcprc_patterns' symbol has a number
+ * of slots, each holding one automaton (struct dcprc_pattern_automaton);
+ * the slot for pattern search work is in operand_1 bits 30:24, with
+ * the rest of operand_1 free for the host */
+#define DCPRC_PATTERN_SLOTS       4
+#define DCPRC_PATTERN_SLOT_SIZE   (256*1024)
+#define DCPRC_PATTERN_SLOT_SHIFT  24
+#define DCPRC_PATTERN_MAX_STATES  65536
+#define DCPRC_PATTERN_MAX_LENGTH  255
+
+/* Fields of an automaton transition: the next state, and the number
+ * of patterns that end in that state and the longest of them */
+#define DCPRC_PATTERN_NEXT_STATE(t) ((t) & 0xffff)
+#define DCPRC_PATTERN_MATCHES(t)    (((t) >> 16) & 0xff)
+#define DCPRC_PATTERN_MAX_MATCH(t)  (((t) >> 24) & 0xff)
+
+/* First offset result of a pattern search with no matches */
+#define DCPRC_PATTERN_NO_MATCH 0xffffffff
+
 #ifdef __NFCC_VERSION
 #ifndef __DATA_BIG_ENDIAN
 #define __DATA_BIG_ENDIAN
@@ -99,7 +143,33 @@ struct dcprc_workq_entry {
     };
 };
 #endif
-int assert_me[sizeof(struct dcprc_workq_entry)==16?1:-1];
+typedef int dcprc_workq_entry_is_16B[sizeof(struct dcprc_workq_entry)==16?1:-1];
+
+/*t struct dcprc_sg_entry */
+/**
+ *
+ * Scatter-gather list entry; a work item with DCPRC_WORK_SGL set in
+ * operand_0 has its data in the host memory regions described by an
+ * array of these, in order, which is itself in host memory
+ *
+ * Note that this structure is 16B long, so four may be fetched in a
+ * single 64B DMA.
+ */
+#ifdef __DATA_BIG_ENDIAN
+struct dcprc_sg_entry {
+    uint32_t host_physical_address_lo;
+    uint32_t host_physical_address_hi;
+    uint32_t size;
+    uint32_t __reserved;
+};
+#else
+struct dcprc_sg_entry {
+    uint64_t host_physical_address;
+    uint32_t size;
+    uint32_t __reserved;
+};
+#endif
+typedef int dcprc_sg_entry_is_16B[sizeof(struct dcprc_sg_entry)==16?1:-1];
 
 /*t struct dcprc_workq_buffer_desc */
 /**
@@ -108,6 +178,11 @@ int assert_me[sizeof(struct dcprc_workq_entry)==16?1:-1];
  *
  * These should be reset to 0 on firmware loading, and configured by the host
  *
+ * If max_entries has DCPRC_WORKQ_WPTR_MIRROR set then the wptr is
+ * only used to disable the queue (bit 31 set); the live wptr is a
+ * 32-bit value in host memory at host_physical_address +
+ * max_entries*sizeof(struct dcprc_workq_entry).
+ *
  * Note that this structure is 16B long. DO NOT CHANGE THIS.
  */
 #ifdef __DATA_BIG_ENDIAN
@@ -125,6 +200,26 @@ struct dcprc_workq_buffer_desc {
 };
 #endif
 
+/*t struct dcprc_pattern_automaton */
+/**
+ *
+ * Header of a pattern search automaton; a DFA (Aho-Corasick) over
+ * byte classes. It is followed by the class of each byte value (64
+ * words, the class of byte b in bits 8*(b&3) upwards of word b>>2),
+ * and then by num_states*num_classes transitions, the transition from
+ * state s on class c being word s*num_classes+c. The start state is
+ * zero.
+ *
+ * All of it is 32-bit words, so it reads the same on the host and the
+ * NFP.
+ */
+struct dcprc_pattern_automaton {
+    uint32_t num_states;
+    uint32_t num_classes;
+    uint32_t size;        /* Bytes, including this header */
+    uint32_t __reserved;
+};
+
 /** struct dcprc_cls_workq
  */
 struct dcprc_cls_workq {
@@ -0,0 +1,53 @@
+/** Copyright (C) 2016,  Gavin J Stark.  All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file          include/firmware/nfp_stats.h
+ * @brief         Convention for firmware counter blocks read by the host
+ *
+ * A firmware application exports counters by allocating a block of
+ * memory whose name ends in NFP_STATS_SYMBOL_SUFFIX, for example
+ *
+ *   _alloc_mem("pcap_stats cls island 32")
+ *
+ * The block is an array of 32-bit counters, counter n at
+ * NFP_STATS_COUNTER_OFFSET(n). Counters are only ever incremented or
+ * added to, with atomic operations (cls_incr, mem[incr]), by any
+ * number of threads; they wrap modulo 2^32, and need not be cleared
+ * at load, as the host only uses differences between reads.
+ *
+ * An island-scope block gives one run-time symbol per island that
+ * uses it ('i32.pcap_stats'), and a global block a single symbol, so
+ * counters of every ME are covered by a block in each of their
+ * islands. The block name, its number of counters and their names
+ * are defined in the application's shared header (e.g. PCAP_STATS_*
+ * in firmware/pcap.h), and given to the host nfp_stats module
+ * (host/src/nfp_stats.h), which finds every instance of the block
+ * among the run-time symbols.
+ *
+ */
+
+/** Open guard
+ */
+#ifndef _FIRMWARE_NFP_STATS_H_
+#define _FIRMWARE_NFP_STATS_H_
+
+/** Defines
+ */
+#define NFP_STATS_SYMBOL_SUFFIX "_stats"
+#define NFP_STATS_COUNTER_OFFSET(n) ((n)<<2)
+#define NFP_STATS_BLOCK_SIZE(num_counters) NFP_STATS_COUNTER_OFFSET(num_counters)
+
+/** Close guard
+ */
+#endif /* _FIRMWARE_NFP_STATS_H_ */
@@ -17,6 +17,11 @@
  *
  */
 
+/** Open guard
+ */
+#ifndef _FIRMWARE_PCAP_H_
+#define _FIRMWARE_PCAP_H_
+
 /** Includes
  */
 #include <stdint.h> 
@@ -35,31 +40,184 @@
 #define PCAP_HOST_CLS_RING_SIZE_ENTRIES (PCAP_HOST_CLS_RING_SIZE>>3)
 #define PCAP_HOST_CLS_RING_SIZE__STR STRINGIFY(PKTGEN_CLS_RING_SIZE)
 
-/* Note that PCAP_BUF_TOTAL_PKTS MUST NOT exceed the 'number' field in
-   the pcap_buf_desc*/
-#define PCAP_BUF_TOTAL_PKTS 1024
+/* PCAP_BUF_TOTAL_PKTS is the size of the packet bitmask in a
+   buffer, and so the limit on packets in a buffer; it MUST NOT exceed
+   the 'number' field in the mu_buf_desc (16 bits) */
+#define PCAP_BUF_TOTAL_PKTS 16384
 
-/* PCAP_BUF_MAX_PKT must be a little less than PCAP_BUF_TOTAL_PKTS -
- possibly one less would be sufficient
+/* PCAP_BUF_MAX_PKTS_LIMIT must be a little less than
+ PCAP_BUF_TOTAL_PKTS - possibly one less would be sufficient
 */
-#define PCAP_BUF_MAX_PKT (PCAP_BUF_TOTAL_PKTS-4)
+#define PCAP_BUF_MAX_PKTS_LIMIT (PCAP_BUF_TOTAL_PKTS-4)
+
+/** PCAP_BUF_* geometry
+ *
+ * Buffers are (1<<PCAP_BUF_SIZE_SHIFT) bytes, from 64kB (for low
+ * latency) to 2MB (for fewer buffer round trips with small packets),
+ * holding up to max_pkts packets from first_pkt_offset. The host
+ * chooses the geometry with a struct pcap_buf_geometry in the
+ * pcap_cls_host CLS data before the firmware starts; the defaults
+ * below are used if it does not, or if the geometry is not valid.
+ */
+#define PCAP_BUF_SIZE_SHIFT     18
+#define PCAP_BUF_SIZE_SHIFT_MIN 16
+#define PCAP_BUF_SIZE_SHIFT_MAX 21
+
+/* PCAP_BUF_MAX_PKT is the default limit on packets in a buffer */
+#define PCAP_BUF_MAX_PKT 1020
+
+/* PCAP_BUF_PKT_DESC_OFFSET is offsetof(struct pcap_buffer, pkt_desc) */
+#define PCAP_BUF_PKT_DESC_OFFSET (64 + (PCAP_BUF_TOTAL_PKTS/8))
+
+/* PCAP_PKT_BUF_DESC_SIZE is sizeof(struct pcap_pkt_buf_desc) */
+#define PCAP_PKT_BUF_DESC_SIZE 16
+
+/* PCAP_BUF_MIN_FIRST_PKT_OFFSET is the end of the descriptors of
+ * max_pkts packets, rounded up to 64B
+ */
+#define PCAP_BUF_MIN_FIRST_PKT_OFFSET(max_pkts) \
+    ((PCAP_BUF_PKT_DESC_OFFSET + (max_pkts)*PCAP_PKT_BUF_DESC_SIZE + 63) & ~63)
+
+/* PCAP_BUF_FIRST_PKT_OFFSET is the default first packet offset; it
+ * must be at least PCAP_BUF_MIN_FIRST_PKT_OFFSET(PCAP_BUF_MAX_PKT),
+ * 64 + 2048 + 1020*16; 20kB wastes a bit of the buffer but not much
+ */
+#define PCAP_BUF_FIRST_PKT_OFFSET (20*1024)
+
+/* PCAP_BUF_SNAPLEN_MAX is the largest packet length recorded; a
+ * geometry snaplen of 0 (or larger) captures whole packets
+ */
+#define PCAP_BUF_SNAPLEN_MAX 0xffff
+
+/* PCAP_BUF_MIN_PKT_SPACE is the space a buffer must have after
+ * first_pkt_offset, for the largest packet the NBI can deliver (with
+ * the CTM packet offset)
+ */
+#define PCAP_BUF_MIN_PKT_SPACE (16*1024+64)
+
+#define PCAP_BUF_GEOMETRY_MAGIC 0x70636231 /* 'pcb1' */
+
+/* PCAP_BUF_GEOMETRY_VALID is true if a geometry may be used by the
+ * firmware; the magic is checked separately
+ */
+#define PCAP_BUF_GEOMETRY_VALID(shift,max_pkts,first_pkt_offset)     \
+    (((shift) >= PCAP_BUF_SIZE_SHIFT_MIN) &&                          \
+     ((shift) <= PCAP_BUF_SIZE_SHIFT_MAX) &&                          \
+     ((max_pkts) >= 1) && ((max_pkts) <= PCAP_BUF_MAX_PKTS_LIMIT) &&  \
+     (((first_pkt_offset) & 63) == 0) &&                              \
+     ((first_pkt_offset) >= PCAP_BUF_MIN_FIRST_PKT_OFFSET(max_pkts)) && \
+     ((first_pkt_offset) + PCAP_BUF_MIN_PKT_SPACE <= (1U<<(shift))))
+
+/* PCAP_BUF_GEOMETRY_DEFAULT initializes a struct pcap_buf_geometry */
+#define PCAP_BUF_GEOMETRY_DEFAULT \
+    { PCAP_BUF_GEOMETRY_MAGIC, PCAP_BUF_SIZE_SHIFT, PCAP_BUF_MAX_PKT, \
+      PCAP_BUF_FIRST_PKT_OFFSET }
+
+/** PCAP_STATS_*
+ *
+ * Packet capture firmware counters, in the 'pcap_stats' block in the
+ * CLS of each island running capture threads (see
+ * firmware/nfp_stats.h)
+ */
+#define PCAP_STATS_SYMBOL            "pcap_stats"
+#define PCAP_STATS_PKTS_RX           0 /* Packets taken from the CTM */
+#define PCAP_STATS_CTM_DMAS          1 /* Packets DMAed from CTM to MU */
+#define PCAP_STATS_CTM_DMA_STALLS    2 /* Polls waiting for CTM DMA credit */
+#define PCAP_STATS_ALLOC_RETRIES     3 /* Polls retrying MU buffer allocation */
+#define PCAP_STATS_MU_BUFS_STARTED   4 /* MU buffers taken for packets */
+#define PCAP_STATS_MU_BUFS_COMPLETED 5 /* MU buffers completed to the host */
+#define PCAP_STATS_PCIE_DMAS         6 /* DMAs from MU to host */
+#define PCAP_STATS_HOST_BUF_STALLS   7 /* Polls waiting for host buffers */
+#define PCAP_STATS_NUM_COUNTERS      8
+
+#define PCAP_STATS_NAMES \
+    "pkts_rx", "ctm_dmas", "ctm_dma_stalls", "alloc_retries", \
+    "mu_bufs_started", "mu_bufs_completed", "pcie_dmas", "host_buf_stalls"
 
-/* PCAP_BUF_FIRST_PKT_OFFSET must be greater than
- * 64B+(PCAP_BUF_TOTAL_PKTS/8)+PCAP_BUF_MAX_PKT*sizeof(pcap_pkt_buf_desc)
- * 64 + 128 + 1020*8
+/** PCAP_JOURNAL_*
  *
- * Since the latter dominates, 16*PCAP_BUF_MAX_PKT is fine... it wastes
- * a bit of the buffer but not much
+ * Packet capture debug journal: an MU ring journal of
+ * PCAP_JOURNAL_NUM_ENTRIES struct pcap_journal_entry, in the
+ * 'pcap_debug_journal' memory (QDEF_DEBUG_JOURNAL), which the firmware
+ * overwrites as it wraps. The host drains it (pcap_journal.h) by
+ * reading entries and writing them back as zero, so a non-zero mark
+ * means an entry not yet drained.
+ *
+ * Entries carry the ME timestamp, which all MEs share and which ticks
+ * every PCAP_JOURNAL_TICK_CYCLES ME clocks. The arguments of the buffer
+ * events all start with the MU buffer base (mu_base_s8), so a buffer
+ * can be followed from being added with a host buffer, through being
+ * filled and DMAed, to being recycled.
  */
-#define PCAP_BUF_FIRST_PKT_OFFSET (16*1024)
+#define PCAP_JOURNAL_SYMBOL       "pcap_debug_journal"
+#define PCAP_JOURNAL_LOG2_WORDS   16 /* Must match QDEF_DEBUG_JOURNAL */
+#define PCAP_JOURNAL_ENTRY_WORDS  4
+#define PCAP_JOURNAL_NUM_ENTRIES  ((1<<PCAP_JOURNAL_LOG2_WORDS)/PCAP_JOURNAL_ENTRY_WORDS)
+#define PCAP_JOURNAL_MARK         0xa5
+#define PCAP_JOURNAL_TICK_CYCLES  16
+
+/* Entry id from type and ACTIVE_CTX_STS, and its fields */
+#define PCAP_JOURNAL_ID(type,ctx_sts) \
+    ((PCAP_JOURNAL_MARK<<24) | ((type)<<16) | ((((ctx_sts)>>25)&0x3f)<<8) | ((ctx_sts)&0x7f))
+#define PCAP_JOURNAL_ID_MARK(id)   (((id)>>24)&0xff)
+#define PCAP_JOURNAL_ID_TYPE(id)   (((id)>>16)&0xff)
+#define PCAP_JOURNAL_ID_ISLAND(id) (((id)>>8)&0x3f)
+#define PCAP_JOURNAL_ID_ME(id)     (((id)>>3)&0xf)
+#define PCAP_JOURNAL_ID_CTX(id)    ((id)&0x7)
+
+/* Entry types, with their arguments a, b */
+#define PCAP_JOURNAL_HOST_BUF        1 /* buf_seq, pcie_base_low: host buffer taken */
+#define PCAP_JOURNAL_HOST_BUF_STALL  2 /* host ring rptr, 0: host ring empty */
+#define PCAP_JOURNAL_MU_BUF_ADDED    3 /* mu_base_s8, buf_seq: ready to allocate */
+#define PCAP_JOURNAL_MU_BUF_TAKEN    4 /* mu_base_s8, pkt seq: first packet */
+#define PCAP_JOURNAL_MU_BUF_FULL     5 /* mu_base_s8, total packets */
+#define PCAP_JOURNAL_DMA_MASTER      6 /* mu_base_s8, total packets so far */
+#define PCAP_JOURNAL_SLAVE_DMA       7 /* mu_base_s8, num_blocks<<16 | num_packets */
+#define PCAP_JOURNAL_MU_BUF_DMAED    8 /* mu_base_s8, total DMAs */
+#define PCAP_JOURNAL_NUM_TYPES       9
+
+#define PCAP_JOURNAL_NAMES \
+    "none", "host_buf", "host_buf_stall", "mu_buf_added", "mu_buf_taken", \
+    "mu_buf_full", "dma_master", "slave_dma", "mu_buf_dmaed"
+
+/** struct pcap_journal_entry
+ *
+ * Debug journal entry; all 32-bit words, so the same on host and ME
+ */
+struct pcap_journal_entry {
+    uint32_t id;         /* PCAP_JOURNAL_ID */
+    uint32_t timestamp;  /* ME timestamp_low */
+    uint32_t a;
+    uint32_t b;
+};
+
+/** PCAP_PKT_SEQ_*
+ *
+ * The packet descriptor sequence word: the 16-bit NBI Rx sequence
+ * number of the packet and the NBI sequencer that numbered it. The
+ * picocode gives each port (or group of ports) its own sequencer, and
+ * each sequencer numbers its packets contiguously, so a gap in the
+ * numbers of a sequencer is a packet dropped before the host.
+ */
+#define PCAP_PKT_SEQ_MASK     0xffff
+#define PCAP_PKT_SEQR_SHIFT   16
+#define PCAP_PKT_SEQR_MASK    0x7
+#define PCAP_PKT_NUM_SEQRS    8
+
+#define PCAP_PKT_SEQ(seq)     ((seq) & PCAP_PKT_SEQ_MASK)
+#define PCAP_PKT_SEQR(seq)    (((seq) >> PCAP_PKT_SEQR_SHIFT) & PCAP_PKT_SEQR_MASK)
+#define PCAP_PKT_SEQ_WORD(seqr,seq) \
+    ((((seqr) & PCAP_PKT_SEQR_MASK) << PCAP_PKT_SEQR_SHIFT) | ((seq) & PCAP_PKT_SEQ_MASK))
 
 /** struct pcap_pkt_buf_desc
  *
  * Packet buffer descriptor stored in the host and MU buffer.  The offset
  * is the 64B block offset from mu_base_s8.  num_blocks is the number
  * of 64B block spaces used in the MU buffer for the packet. The
- * sequence number is a 16/32-bit sequence number of the packet, as
- * supplied by the NBI Rx.
+ * sequence word is the NBI Rx sequencer and sequence number of the
+ * packet (PCAP_PKT_SEQ_WORD). The length is that of the packet as
+ * received, and caplen the bytes of it captured, which is less if the
+ * geometry has a snaplen.
  *
  */
 #ifdef __NFCC_VERSION
@@ -67,12 +225,18 @@ struct pcap_pkt_buf_desc {
     uint32_t offset:16;
     uint32_t num_blocks:16;
     uint32_t seq;
+    uint32_t length:16;
+    uint32_t caplen:16;
+    uint32_t pad;
 };
 #else
 struct pcap_pkt_buf_desc {
     uint32_t num_blocks:16;
     uint32_t offset:16;
     uint32_t seq;
+    uint32_t caplen:16;
+    uint32_t length:16;
+    uint32_t pad;
 };
 #endif
 
@@ -92,10 +256,10 @@ struct pcap_buf_hdr {
 /** struct pcap_buffer
  *
  * MU/host buffer layout, up to the packet data, which is placed at
- * PCAP_BUF_FIRST_PKT_OFFSET
+ * the first_pkt_offset of the buffer geometry; only the descriptors
+ * of the first max_pkts packets are used
  *
- * Note that this must be less than PCAP_BUF_FIRST_PKT_OFFSET in size
- * Note also that the pkt_add_mu_buf_desc clears this structure in a
+ * Note that the pkt_add_mu_buf_desc clears this structure in a
  * 'knowledgeable manner', i.e. it knows the structure and offsets
  * intimately. So changing this structure requires changing that
  * function.
@@ -106,12 +270,35 @@ struct pcap_buffer {
     uint32_t pad[11];         /* Pad to 64B alignment */
     uint32_t pkt_bitmask[PCAP_BUF_TOTAL_PKTS/32]; /* n*64B to pad
                                                  * properly */
-    struct pcap_pkt_buf_desc pkt_desc[PCAP_BUF_MAX_PKT];
+    struct pcap_pkt_buf_desc pkt_desc[PCAP_BUF_MAX_PKTS_LIMIT];
+};
+
+/** struct pcap_buf_geometry
+ *
+ * Geometry of the MU and host buffers, as chosen by the host; the
+ * magic is PCAP_BUF_GEOMETRY_MAGIC if it is set. The snaplen limits
+ * the bytes of each packet copied to the MU and host buffers.
+ */
+struct pcap_buf_geometry {
+    uint32_t magic;
+    uint32_t buf_size_shift;   /* Buffers are 1<<buf_size_shift bytes */
+    uint32_t max_pkts;         /* Packets in a buffer at most */
+    uint32_t first_pkt_offset; /* Byte offset of the first packet */
+    uint32_t snaplen;          /* Bytes of each packet, 0 for all */
+    uint32_t pad[3];
 };
 
 /** struct pcap_cls_host
+ *
+ * Host data in pcap_cls_host_shared_data; the geometry is read only
+ * when the firmware starts
  */
 struct pcap_cls_host {
     uint32_t wptr;
+    uint32_t pad[3];
+    struct pcap_buf_geometry geometry;
 };
 
+/** Close guard
+ */
+#endif /* _FIRMWARE_PCAP_H_ */
@@ -17,6 +17,11 @@
  *
  */
 
+/** Open guard
+ */
+#ifndef _FIRMWARE_PKTGEN_H_
+#define _FIRMWARE_PKTGEN_H_
+
 /** Includes
  */
 #include <stdint.h> 
@@ -30,6 +35,16 @@
 #define PKTGEN_CLS_RING_SIZE 1024
 #define PKTGEN_CLS_RING_SIZE__STR STRINGIFY(PKTGEN_CLS_RING_SIZE)
 
+/* Transmit times are 40 bits (tx_time_hi:8, tx_time_lo:32) and wrap */
+#define PKTGEN_TX_TIME_MASK ((((uint64_t)1)<<40)-1)
+
+/* Playback time scale is fixed point with 16 fractional bits; a scale
+ * of PKTGEN_TIME_SCALE_ONE plays the schedule back at its recorded
+ * rate, PKTGEN_TIME_SCALE_ONE/2 at twice the rate, and so on */
+#define PKTGEN_TIME_SCALE_SHIFT 16
+#define PKTGEN_TIME_SCALE_ONE   (1<<PKTGEN_TIME_SCALE_SHIFT)
+#define PKTGEN_TIME_SCALE_MAX   ((1<<24)-1)
+
 /** struct pktgen_sched_entry
  */
 #ifdef __NFCC_VERSION
@@ -60,6 +75,11 @@ struct pktgen_cls_ring {
 };
 
 /** struct pktgen_cls_host
+ *
+ * stream_wptr and stream_end are written by the host while a
+ * PKTGEN_HOST_CMD_STREAM is in progress: stream_wptr is the number of
+ * schedule entries written to the stream ring, and stream_end is set
+ * non-zero once the last entry has been written
  */
 struct pktgen_cls_host {
     struct pktgen_cls_ring cls_ring;
@@ -67,14 +87,34 @@ struct pktgen_cls_host {
     uint32_t rptr;
     uint32_t ack_data;
     uint32_t last_tx_seq;
+    uint32_t stream_wptr;
+    uint32_t stream_end;
 };
 
+/* A stream ring is a power-of-two number of batches of 8 schedule
+ * entries, with no schedule header */
+#define PKTGEN_STREAM_BATCH_ENTRIES 8
+#define PKTGEN_STREAM_BATCH_SIZE (PKTGEN_STREAM_BATCH_ENTRIES*sizeof(struct pktgen_sched_entry))
+
 /** struct pktgen_host_cmd
+ *
+ * PKTGEN_HOST_CMD_PLAYBACK sets the time scale, loop count and loop
+ * time offset (40 bits, in schedule time units) applied to all
+ * subsequent PKTGEN_HOST_CMD_PKT commands; a loop count of 0 is
+ * treated as 1.
+ *
+ * PKTGEN_HOST_CMD_STREAM plays a schedule from a ring in NFP memory
+ * that the host refills while transmission proceeds (see struct
+ * pktgen_cls_host); the time scale of the playback mode applies, but
+ * not the looping. The host can reuse ring entries once last_tx_seq
+ * indicates that the packets they describe have been transmitted.
  */
 enum {
     PKTGEN_HOST_CMD_PKT=1,
     PKTGEN_HOST_CMD_ACK=2,
     PKTGEN_HOST_CMD_DMA=3,
+    PKTGEN_HOST_CMD_PLAYBACK=4,
+    PKTGEN_HOST_CMD_STREAM=5,
 };
 #ifdef __NFCC_VERSION
 struct pktgen_host_cmd {
@@ -104,6 +144,21 @@ struct pktgen_host_cmd {
             uint32_t data;
             uint32_t pad_1[2];
         } ack_cmd;
+        struct {
+            int      cmd_type:8;
+            unsigned int time_scale:24;
+            uint32_t loop_count;
+            uint32_t loop_offset_lo;
+            uint32_t loop_offset_hi;
+        } playback_cmd;
+        struct {
+            int      cmd_type:8;
+            unsigned int ring_batches_log2:8;
+            unsigned int pad_0:16;
+            uint32_t base_delay;
+            uint32_t mu_base_s8;
+            uint32_t pad_1;
+        } stream_cmd;
     };
 };
 
@@ -136,7 +191,53 @@ struct pktgen_host_cmd {
             uint32_t data;
             uint32_t pad_1[2];
         } ack_cmd;
+        struct {
+            unsigned int time_scale:24;
+            int      cmd_type:8;
+            uint32_t loop_count;
+            uint32_t loop_offset_lo;
+            uint32_t loop_offset_hi;
+        } playback_cmd;
+        struct {
+            unsigned int pad_0:16;
+            unsigned int ring_batches_log2:8;
+            int      cmd_type:8;
+            uint32_t base_delay;
+            uint32_t mu_base_s8;
+            uint32_t pad_1;
+        } stream_cmd;
     };
 };
 
 #endif
+
+/** pktgen_scale_tx_time
+ *
+ * @param tx_time_lo  Bottom 32 bits of a schedule transmit time
+ * @param tx_time_hi  Top 8 bits of a schedule transmit time
+ * @param time_scale  Playback time scale (PKTGEN_TIME_SCALE_ONE is 1.0)
+ *
+ * Return the 40-bit transmit time scaled by @p time_scale
+ *
+ * This is used by the firmware batch distributor for every schedule
+ * entry, and by the host schedule model, so that both perform
+ * exactly the same (truncating) arithmetic.
+ *
+ */
+static __inline uint64_t
+pktgen_scale_tx_time(uint32_t tx_time_lo, uint32_t tx_time_hi, uint32_t time_scale)
+{
+    uint64_t tx_time;
+
+    tx_time_hi &= 0xff;
+    if (time_scale == PKTGEN_TIME_SCALE_ONE)
+        return (((uint64_t)tx_time_hi) << 32) | tx_time_lo;
+
+    tx_time  = (((uint64_t)tx_time_lo) * time_scale) >> PKTGEN_TIME_SCALE_SHIFT;
+    tx_time += (((uint64_t)tx_time_hi) * time_scale) << (32-PKTGEN_TIME_SCALE_SHIFT);
+    return tx_time & PKTGEN_TX_TIME_MASK;
+}
+
+/** Close guard
+ */
+#endif /* _FIRMWARE_PKTGEN_H_ */
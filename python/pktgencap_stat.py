@@ -0,0 +1,190 @@
+#!/usr/bin/env python
+# Copyright (c) 2016 Gavin J Stark
+# All rights reserved.
+#
+# Sample the live statistics block (host/src/pktgen_stats.h) in the
+# pktgencap shared memory, read-only, without talking to pktgencap.
+#
+# As a script it prints one JSON object per sample; as a module,
+# c_pktgencap_stats().read() returns a dictionary of the fields.
+
+#a Imports
+import ctypes
+import ctypes.util
+import json
+import sys
+import time
+
+#a Constants - must match pktgencap.h and pktgen_stats.h
+shm_filename            = "/tmp/nfp_shm.lock"
+shm_key                 = ord('x')
+PKTGEN_STATS_SHM_OFFSET = 384*1024
+PKTGEN_STATS_MAGIC      = 0x54534750
+PKTGEN_STATS_VERSION    = 1
+PKTGEN_STATS_READ_TRIES = 100000
+PKTGEN_STATS_READ_SPINS = 64
+PKTGEN_STATS_MAX_FW_COUNTERS = 64
+PKTGEN_STATS_FW_NAME_LEN     = 48
+PKTGEN_STATS_SEQ_NUM_SEQRS   = 8
+PKTGEN_STATS_SEQ_RANGES      = 16
+SHM_RDONLY              = 0o10000
+
+#c c_pktgen_stats_fw_counter
+class c_pktgen_stats_fw_counter(ctypes.Structure):
+    """
+    struct pktgen_stats_fw_counter
+    """
+    _fields_ = [ ("name",  ctypes.c_char*PKTGEN_STATS_FW_NAME_LEN),
+                 ("total", ctypes.c_uint64),
+                 ("rate",  ctypes.c_uint64),
+                 ]
+
+#c c_pktgen_stats_seqr
+class c_pktgen_stats_seqr(ctypes.Structure):
+    """
+    struct pktgen_stats_seqr
+    """
+    _fields_ = [ ("gaps",     ctypes.c_uint64),
+                 ("missing",  ctypes.c_uint64),
+                 ("reorders", ctypes.c_uint64),
+                 ]
+
+#c c_pktgen_stats_seq_range
+class c_pktgen_stats_seq_range(ctypes.Structure):
+    """
+    struct pktgen_stats_seq_range
+    """
+    _fields_ = [ ("kind",    ctypes.c_uint64),
+                 ("seqr",    ctypes.c_uint64),
+                 ("buf_seq", ctypes.c_uint64),
+                 ("first",   ctypes.c_uint64),
+                 ("num",     ctypes.c_uint64),
+                 ]
+
+#c c_pktgen_stats
+class c_pktgen_stats(ctypes.Structure):
+    """
+    struct pktgen_stats; fields are only ever added at the end
+    """
+    _fields_ = [ ("magic",              ctypes.c_uint32),
+                 ("version",            ctypes.c_uint32),
+                 ("size",               ctypes.c_uint32),
+                 ("seq",                ctypes.c_uint32),
+                 ("update_ns",          ctypes.c_uint64),
+                 ("start_ns",           ctypes.c_uint64),
+                 ("poll_loops",         ctypes.c_uint64),
+                 ("capture_buffers",    ctypes.c_uint64),
+                 ("capture_packets",    ctypes.c_uint64),
+                 ("capture_bytes",      ctypes.c_uint64),
+                 ("capture_stalls",     ctypes.c_uint64),
+                 ("buffers_given",      ctypes.c_uint64),
+                 ("poll_ns",            ctypes.c_uint64),
+                 ("recycle_ns",         ctypes.c_uint64),
+                 ("give_buffer_ns",     ctypes.c_uint64),
+                 ("buffers_total",      ctypes.c_uint64),
+                 ("buffers_nfp",        ctypes.c_uint64),
+                 ("buffers_consumers",  ctypes.c_uint64),
+                 ("consumers_attached", ctypes.c_uint64),
+                 ("fw_update_ns",       ctypes.c_uint64),
+                 ("fw_num_counters",    ctypes.c_uint64),
+                 ("fw_counters",        c_pktgen_stats_fw_counter*PKTGEN_STATS_MAX_FW_COUNTERS),
+                 ("seq_buf_gaps",       ctypes.c_uint64),
+                 ("seq_bufs_missing",   ctypes.c_uint64),
+                 ("seq_buf_reorders",   ctypes.c_uint64),
+                 ("seq_pkt_gaps",       ctypes.c_uint64),
+                 ("seq_pkts_missing",   ctypes.c_uint64),
+                 ("seq_pkt_reorders",   ctypes.c_uint64),
+                 ("seq_seqrs",          c_pktgen_stats_seqr*PKTGEN_STATS_SEQ_NUM_SEQRS),
+                 ("seq_num_ranges",     ctypes.c_uint64),
+                 ("seq_ranges",         c_pktgen_stats_seq_range*PKTGEN_STATS_SEQ_RANGES),
+                 ]
+
+#c c_pktgencap_stats
+class c_pktgencap_stats(object):
+    """
+    Read-only attachment to the pktgencap statistics block
+    """
+    #f __init__
+    def __init__(self):
+        libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+        libc.ftok.restype  = ctypes.c_int
+        libc.ftok.argtypes = [ctypes.c_char_p, ctypes.c_int]
+        libc.shmget.restype  = ctypes.c_int
+        libc.shmget.argtypes = [ctypes.c_int, ctypes.c_size_t, ctypes.c_int]
+        libc.shmat.restype  = ctypes.c_void_p
+        libc.shmat.argtypes = [ctypes.c_int, ctypes.c_void_p, ctypes.c_int]
+        key = libc.ftok(shm_filename.encode(), shm_key)
+        if key == -1:
+            raise IOError("Failed to find %s; is pktgencap running?"%shm_filename)
+        shm_id = libc.shmget(key, 0, 0)
+        if shm_id == -1:
+            raise IOError("Failed to find pktgencap shared memory")
+        base = libc.shmat(shm_id, None, SHM_RDONLY)
+        if (base is None) or (base == ctypes.c_void_p(-1).value):
+            raise IOError("Failed to attach to pktgencap shared memory")
+        self.address = base + PKTGEN_STATS_SHM_OFFSET
+        self.shared = c_pktgen_stats.from_address(self.address)
+        pass
+    #f read
+    def read(self):
+        """
+        Take a consistent snapshot, as pktgen_stats_read does; returns
+        a dictionary of the fields, or None if there is no block
+        """
+        shared = self.shared
+        if (shared.magic != PKTGEN_STATS_MAGIC) or (shared.version != PKTGEN_STATS_VERSION):
+            return None
+        size = min(shared.size, ctypes.sizeof(c_pktgen_stats))
+        for i in range(PKTGEN_STATS_READ_TRIES):
+            if (i % PKTGEN_STATS_READ_SPINS) == PKTGEN_STATS_READ_SPINS-1:
+                time.sleep(0)
+                pass
+            seq = shared.seq
+            if seq & 1: continue
+            copy = c_pktgen_stats()
+            ctypes.memmove(ctypes.addressof(copy), self.address, size)
+            if shared.seq == seq:
+                result = dict((f[0], getattr(copy, f[0])) for f in c_pktgen_stats._fields_)
+                num_fw = min(copy.fw_num_counters, PKTGEN_STATS_MAX_FW_COUNTERS)
+                result["fw_counters"] = dict((c.name.decode(), {"total":c.total, "per_s":c.rate})
+                                             for c in copy.fw_counters[:num_fw])
+                result["seq_seqrs"] = [dict((f[0], getattr(r, f[0])) for f in c_pktgen_stats_seqr._fields_)
+                                       for r in copy.seq_seqrs]
+                num_ranges = min(copy.seq_num_ranges, PKTGEN_STATS_SEQ_RANGES)
+                result["seq_ranges"] = [dict((f[0], getattr(r, f[0])) for f in c_pktgen_stats_seq_range._fields_)
+                                        for r in copy.seq_ranges[:num_ranges]]
+                return result
+            pass
+        return None
+    pass
+
+#a Toplevel
+#f main
+def main(argv):
+    interval = 1.0
+    count = 0
+    if len(argv)>1: interval = float(argv[1])
+    if len(argv)>2: count = int(argv[2])
+    stats = c_pktgencap_stats()
+    last = None
+    n = 0
+    while (count==0) or (n<count):
+        if n>0: time.sleep(interval)
+        s = stats.read()
+        if s is None:
+            sys.stderr.write("No consistent pktgencap statistics in shared memory\n")
+            return 1
+        if last is not None:
+            secs = max((s["update_ns"]-last["update_ns"])/1.0E9, 1.0E-9)
+            s["packets_per_s"]   = (s["capture_packets"]-last["capture_packets"])/secs
+            s["dma_bytes_per_s"] = (s["capture_bytes"]-last["capture_bytes"])/secs
+            pass
+        sys.stdout.write(json.dumps(s)+"\n")
+        sys.stdout.flush()
+        last = s
+        n += 1
+        pass
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -7,6 +7,7 @@ import os
 import time
 import tempfile
 import re
+import json
 
 #a Test
 #c Basic tests
@@ -171,6 +172,27 @@ class NullTests(TestBase):
         #host_bin_dir+"data_coprocessor_basic",["-i","1000","-b","250","-L","fred.log"]
         self.run_without_log("data_coprocessor_basic",["-i","1000","-b","250"],timeout=10.0)
         return
+    def test_null_submitter_threads(self):
+        self.run_without_log("data_coprocessor_basic",["-i","100","-b","100","-T","8"],timeout=30.0)
+        return
+    def test_null_commit_policy(self):
+        self.run_without_log("data_coprocessor_basic",["-i","100","-b","100","--commit-items","16","--commit-delay-us","20","--commit-drain"],timeout=10.0)
+        return
+    def test_null_verify(self):
+        self.run_without_log("data_coprocessor_basic",["-i","10","-b","100","--verify","null"],timeout=10.0)
+        pass
+    def test_null_stage_latency(self):
+        latency_file = tempfile.NamedTemporaryFile()
+        self.run_without_log("data_coprocessor_basic",["-i","100","-b","100","--stage-times","--latency-file",latency_file.name,"--firmware","firmware/nffw/data_coproc_null_timed_many.nffw"],timeout=10.0)
+        latency = json.load(latency_file)
+        for stage in ["submit_to_result", "gather_to_pickup", "pickup_to_done"]:
+            self.assertEqual(latency[stage]["count"],100*100,"Bad count for %s"%stage)
+            self.assertTrue(latency[stage]["p50_us"]<=latency[stage]["p999_us"],"Bad percentiles for %s"%stage)
+            pass
+        pass
+    def test_null_wptr_mirror(self):
+        self.run_without_log("data_coprocessor_basic",["-i","100","-b","100","--wptr-mirror"],timeout=10.0)
+        return
     def test_null_small_batch_with_log(self):
         def check_log(line, iteration,batch,data):
             self.assertEqual(data[3],batch,"Bad data for %d:%d:%s"%(iteration, batch, line))
@@ -189,7 +211,7 @@ class FetchSumTests(TestBase):
         def check_log(line, iteration,batch,data):
             self.assertEqual(data[3],(n*(n-1)/2)&0xff,"Bad data for %d:%d:%s"%(iteration, batch, line))
             pass
-        self.run_with_log("data_coprocessor_basic",args,check_log,timeout=30.0)
+        self.run_with_log("data_coprocessor_basic",args+["--verify","fetch_sum"],check_log,timeout=30.0)
         pass
     def test_fetch_sum_small_96(self):
         self.fetch_sum_n(96,args=["-i","1","-b","100","-S","96","--firmware","firmware/nffw/data_coproc_fetch_sum_one.nffw"])
@@ -223,6 +245,52 @@ class FetchSumTests(TestBase):
     def test_fetch_sum_many_1M(self):
         self.fetch_sum_n(1024*1024,args=["-i","1","-b","250","-S","%d"%(1024*1024),"--firmware","firmware/nffw/data_coproc_fetch_sum_many.nffw"])
         pass
+    def test_fetch_sum_sgl_1k1(self):
+        self.fetch_sum_n(1025,args=["-i","1","-b","100","-S","1025","--sg-entries","7","--firmware","firmware/nffw/data_coproc_fetch_sum_one.nffw"])
+        pass
+    def test_fetch_sum_sgl_many_1M(self):
+        self.fetch_sum_n(1024*1024,args=["-i","1","-b","250","-S","%d"%(1024*1024),"--sg-entries","33","--firmware","firmware/nffw/data_coproc_fetch_sum_many.nffw"])
+        pass
+    def test_fetch_sum_hybrid(self):
+        self.run_without_log("data_coprocessor_basic",["-i","100","-b","64","-S","65536","--hybrid","fetch_sum","--firmware","firmware/nffw/data_coproc_fetch_sum_one.nffw"],timeout=30.0)
+        pass
+
+class DigestTests(TestBase):
+    def digest_n(self, n, args):
+        self.run_without_log("data_coprocessor_basic",args+["-S","%d"%n,"--verify","digest"],timeout=30.0)
+        pass
+    def test_digest_small_sizes(self):
+        for n in [64, 65, 95, 96, 97, 127, 128, 1000]:
+            self.digest_n(n,args=["-i","1","-b","10","--firmware","firmware/nffw/data_coproc_digest_one.nffw"])
+            pass
+        pass
+    def test_digest_small_8k1(self):
+        self.digest_n(8193,args=["-i","1","-b","100","--firmware","firmware/nffw/data_coproc_digest_one.nffw"])
+        pass
+    def test_digest_many_1M(self):
+        self.digest_n(1024*1024,args=["-i","1","-b","250","--firmware","firmware/nffw/data_coproc_digest_many.nffw"])
+        pass
+    def test_digest_cpu_reference(self):
+        self.digest_n(8193,args=["-i","1","-b","100","--cpu-reference","digest","--firmware","firmware/nffw/data_coproc_digest_one.nffw"])
+        pass
+
+class PatternTests(TestBase):
+    def pattern_n(self, n, patterns, args):
+        (fd, filename) = tempfile.mkstemp()
+        os.write(fd, "\n".join(patterns)+"\n")
+        os.close(fd)
+        try:
+            self.run_without_log("data_coprocessor_basic",args+["-S","%d"%n,"--patterns",filename,"--verify","pattern"],timeout=30.0)
+        finally:
+            os.unlink(filename)
+            pass
+        pass
+    def test_pattern_small_1k(self):
+        self.pattern_n(1000,["abc","bc","\x01\x02"],args=["-i","1","-b","10","--firmware","firmware/nffw/data_coproc_pattern_one.nffw"])
+        pass
+    def test_pattern_many_64k(self):
+        self.pattern_n(65536,["%04x"%i for i in range(100)],args=["-i","1","-b","100","--firmware","firmware/nffw/data_coproc_pattern_many.nffw"])
+        pass
 
 #a Toplevel
 def prune(test_class):
@@ -243,6 +311,8 @@ def prune(test_class):
 suite = unittest.TestSuite()
 for s in [ NullTests,
            FetchSumTests,
+           DigestTests,
+           PatternTests,
            ]:
     prune(s)
     suite.addTest(unittest.TestLoader().loadTestsFromTestCase(s))